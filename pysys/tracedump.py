@@ -0,0 +1,129 @@
+# --- Revised 3-Clause BSD License ---
+# Copyright Semtech Corporation 2020. All rights reserved.
+#
+# Redistribution and use in source and binary forms, with or without modification,
+# are permitted provided that the following conditions are met:
+#
+#     * Redistributions of source code must retain the above copyright notice,
+#       this list of conditions and the following disclaimer.
+#     * Redistributions in binary form must reproduce the above copyright notice,
+#       this list of conditions and the following disclaimer in the documentation
+#       and/or other materials provided with the distribution.
+#     * Neither the name of the Semtech corporation nor the names of its
+#       contributors may be used to endorse or promote products derived from this
+#       software without specific prior written permission.
+#
+# THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+# ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+# WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+# DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+# INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+# BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+# DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+# LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+# OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+# ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+
+"""Decode a flight recorder dump written by station (~temp/station.trace, see src/trace.h).
+
+A dump is taken with 'kill -USR1 <pid>', by writing 'trace' into the command FIFO,
+on a fatal error or when station crashes.
+
+    python3 tracedump.py [--json] station.trace
+"""
+
+from typing import Any,Dict,List,Tuple
+import sys
+import json
+import struct
+from datetime import datetime, timezone
+
+HDR = '4sHHIIqqiI'
+REC = 'IBBHII'
+
+EVENTS = { 1: 'RX', 2: 'TXADM', 3: 'TIMESYNC', 4: 'WSFILL', 5: 'STALL', 6: 'SCHEDLAT' }
+VERDICTS = [ 'ok', 'replace', 'mirror', 'shed_dup', 'shed_filter', 'shed_snr',
+             'dc', 'cca', 'toolate', 'collision', 'other' ]
+PROF_KINDS = [ 'timer', 'aio_rd', 'aio_wr' ]
+
+
+def verdict(v:int) -> str:
+    return VERDICTS[v] if v < len(VERDICTS) else str(v)
+
+
+def s4(v:int) -> int:
+    return v-(1<<32) if v & 0x80000000 else v
+
+
+def decode_rec(ev:int, a:int, b:int, c:int, d:int) -> Dict[str,Any]:
+    if ev == 1:
+        snr = d>>8 & 0xFF
+        return { 'dr': a, 'verdict': verdict(b), 'freq': c, 'len': d & 0xFF,
+                 'snr': (snr-256 if snr & 0x80 else snr)/4, 'rssi': -(d>>16 & 0xFF), 'load': d>>24 }
+    if ev == 2:
+        return { 'txunit': a & 0x7F, 'relocate': a>>7, 'verdict': verdict(b), 'freq': c, 'lead_us': s4(d) }
+    if ev == 3:
+        return { 'txunit': a, 'quality': b, 'xtime': c, 'pps_xtime': d }
+    if ev == 4:
+        return { 'congested': a, 'queued': c, 'bufsize': d }
+    if ev == 5:
+        return { 'kind': PROF_KINDS[a] if a < len(PROF_KINDS) else a, 'dur_us': s4(c), 'fn': '0x%08X' % d }
+    if ev == 6:
+        return { 'delay_us': s4(c) }
+    return { 'a': a, 'b': b, 'c': c, 'd': d }
+
+
+def decode(data:bytes) -> Tuple[Dict[str,Any],List[Dict[str,Any]]]:
+    """Return header and records - oldest first - with unwrapped ustime and UTC time."""
+    for endian in '<>':
+        magic,version,recsize,nrecs,widx,now,utcoff,reason,pid = struct.unpack_from(endian+HDR, data)
+        if magic == b'STRC' and version == 1:
+            break
+    else:
+        raise ValueError('Not a station trace dump')
+    if recsize != struct.calcsize(REC):
+        raise ValueError('Unsupported record size: %d' % recsize)
+    hdr = { 'version': version, 'nrecs': nrecs, 'written': widx, 'now': now,
+            'utcOffset': utcoff, 'reason': reason, 'pid': pid }
+    base = struct.calcsize(HDR)
+    n = min(widx, nrecs)
+    recs = []  # type: List[Dict[str,Any]]
+    ref = now
+    # Walk back from the newest record - consecutive records are assumed to be within +/-35min
+    for k in range(n):
+        i = (widx-1-k) % nrecs
+        t,ev,a,b,c,d = struct.unpack_from(endian+REC, data, base + i*recsize)
+        dt = (ref - t) & 0xFFFFFFFF
+        if dt & 0x80000000:
+            dt -= 1<<32
+        ref -= dt
+        r = { 'ustime': ref, 'utc': (ref+utcoff)/1e6, 'ev': EVENTS.get(ev, str(ev)) }
+        r.update(decode_rec(ev,a,b,c,d))
+        recs.append(r)
+    recs.reverse()
+    return hdr, recs
+
+
+def main(argv:List[str]) -> int:
+    args = [ a for a in argv if not a.startswith('--') ]
+    if len(args) != 1:
+        print(__doc__, file=sys.stderr)
+        return 1
+    with open(args[0], 'rb') as f:
+        hdr, recs = decode(f.read())
+    if '--json' in argv:
+        json.dump({ 'header': hdr, 'records': recs }, sys.stdout, indent=1)
+        print()
+        return 0
+    why = { 0: 'on request', -1: 'fatal error' }.get(hdr['reason'], 'signal %d' % hdr['reason'])
+    print('# pid=%d dumped %s - %d records (%d written)' % (hdr['pid'], why, len(recs), hdr['written']))
+    for r in recs:
+        utc = datetime.fromtimestamp(r['utc'], timezone.utc).strftime('%Y-%m-%d %H:%M:%S.%f')
+        rel = (r['ustime'] - hdr['now'])/1e6
+        fields = ' '.join('%s=%s' % (k,v) for k,v in r.items() if k not in ('ustime','utc','ev'))
+        print('%s %+12.6fs %-8s %s' % (utc, rel, r['ev'], fields))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main(sys.argv[1:]))
@@ -36,6 +36,7 @@
 #include "s2conf.h"
 #include "rt.h"
 #include "tc.h"
+#include "trace.h"
 
 
 static str_t  fifo;
@@ -84,13 +85,15 @@ static void fifo_read(aio_t* _aio) {
 
             if( cmdline[0] != '{' ) {
                 // Not a json object - check for some builtin commands
-                int lvl = log_str2level(cmdline);
-                if( lvl >= 0 ) {
-                    log_setLevel(lvl);
-                } else {
-                    
-                    err = "Unknown fifo command";
+                if( strcmp(cmdline, "trace") == 0 ) {
+                    if( sys_dumpTrace(0) ) {
+                        LOG(INFO, "Flight recorder dumped (%u records written so far)", trace_widx);
+                    } else {
+                        err = "Failed to dump trace";
+                    }
                 }
+                else if( log_parseLevels(cmdline) != NULL )
+                    err = "Unknown fifo command";
             }
             else if( TC ) {
                 ujbuf_t sendbuf = (*TC->s2ctx.getSendbuf)(&TC->s2ctx, i);
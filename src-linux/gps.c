@@ -70,6 +70,8 @@ static u1_t UBX_EN_NAVTIMEGPS[] = {
 };
 #endif // defined(CFG_ubx)
 
+#define GPS_TTY_VMIN 64  // TTY wakeup threshold in bytes (~one GGA sentence)
+
 
 typedef struct termios tio_t;
 
@@ -107,23 +109,6 @@ static u2_t fletcher8 (u1_t* data, int len) {
 #endif // defined(CFG_ubx)
 
 
-static int nmea_cksum ( u1_t* data, int len) {
-    if( data[0] != '$' )
-        return 0;
-    int v = 0;
-    for( int i=1; i<len; i++ ) {
-        if( data[i] == '*' ) {
-            int s = (rt_hexDigit(data[i+1]) << 4) | rt_hexDigit(data[i+2]);
-            if( s!=v)
-                LOG(MOD_GPS|ERROR,"NMEA checksum error: %02X vs %02X", s, v);
-            return s==v;
-        }
-        v ^= data[i];
-    }
-    return 0;
-}
-
-
 static int nmea_str (char** pp, int cnt, char** args) {
     char* p = *pp;
     int c, i = 0;
@@ -162,6 +147,8 @@ static int nmea_decimal(char** pp, sL_t* pv) {
 }
 
 
+// Single pass over the digits - an empty field reads as 0.0 (GGA without a fix
+// leaves position, dilution and altitude blank).
 static int nmea_float(char** pp, double* pv) {
     char* p = *pp;
     if( p[0] == '*' )
@@ -171,23 +158,21 @@ static int nmea_float(char** pp, double* pv) {
         p++;
         sign = 1;
     }
-    uL_t p10 = 1;
-    uL_t w = 0;
-    uL_t v = rt_readDec((str_t*)&p);
-    if( *pp + sign == p )
-        return 0;
+    uL_t v = 0, p10 = 1;
+    while( *p >= '0' && *p <= '9' )
+        v = v*10 + (*p++ - '0');
     if( *p == '.' ) {
-        char* f = ++p;
-        w = rt_readDec((str_t*)&f);
-        while( p < f ) {
-            p++;
-            p10 *= 10;
+        while( *++p >= '0' && *p <= '9' ) {
+            if( p10 < 1000000000000000ULL ) {
+                v = v*10 + (*p - '0');
+                p10 *= 10;
+            }
         }
     }
     if( *p != ',' && *p != '*' )
         return 0;
     *pp = p+1;
-    *pv = (double)((sign?-1:1)*v) + (double)w/p10;
+    *pv = (sign?-1:1) * ((double)v/p10);
     return 1;
 }
 
@@ -320,6 +305,15 @@ static void nmea_gga (char* p) {
     lon = nmea_p2dec(lon, lonD[0]);
     LOG(MOD_GPS|XDEBUG, "nmea_gga: lat %f, lon %f", lat, lon);
 
+    if( quality > 0 && quality == last_quality && last_reported_fix > 0 && !report_move &&
+        !check_tolerance(orig_lat, lat, 0.001) && !check_tolerance(orig_lon, lon, 0.001) ) {
+        // Steady fix within tolerance - nothing to report or persist
+        last_alt = alt;
+        last_dilution = dilution;
+        last_satellites = satellites;
+        return;
+    }
+
     if( (quality == 0) ^ (last_quality == 0) )
         time_fixchange = rt_getTime();
 
@@ -392,11 +386,157 @@ static void reopen_timeout (tmr_t* tmr) {
 }
 
 
+// Bytes are fed into a small state machine as they arrive: sentence bodies are
+// collected into gpsline while the NMEA checksum is accumulated, so every byte is
+// looked at exactly once and nothing needs to be rescanned or moved around.
+enum {
+    GPS_IDLE,      // hunting for '$' (or UBX sync)
+    GPS_NMEA,      // sentence body - running XOR checksum
+    GPS_NMEA_CK1,  // 1st hex digit after '*'
+    GPS_NMEA_CK2,  // 2nd hex digit after '*'
+    GPS_UBX_SYN2,  // seen UBX_SYN1
+    GPS_UBX_FRAME, // class/id/len/payload/cksum - collected into gpsline
+};
+
+static u1_t gpsstate;
+static u1_t gpsxsum;    // XOR of NMEA sentence body
+static u1_t gpsck;      // checksum as transmitted
+#if defined(CFG_ubx)
+static int  ubxend;     // expected frame length in gpsline (0=header incomplete)
+#endif // defined(CFG_ubx)
+
+
+static void gps_garbage (str_t what) {
+    if( garbageCnt == 0 ) {
+        LOG(MOD_GPS|WARNING, "GPS garbage (%s): $%.*s", what, gpsfill, gpsline);
+    } else {
+        garbageCnt -= 1;  // 1st few sentences might be garbage
+    }
+}
+
+
+static void nmea_sentence () {
+    // gpsline: talker+type and fields including trailing '*'
+    LOG(MOD_GPS|XDEBUG, "GPS: $%.*s", gpsfill, gpsline);
+    if( gpsfill > 6 && gpsline[2] == 'G' && gpsline[3] == 'G' && gpsline[4] == 'A' && gpsline[5] == ',' )
+        nmea_gga((char*)gpsline+6);
+}
+
+
+#if defined(CFG_ubx)
+static void ubx_frame () {
+    // gpsline: class, id, len(2), payload, cksum(2)
+    int ubxlen = ubxend - 6;
+    u2_t cksum = rt_rlsbf2(&gpsline[4+ubxlen]);
+    u2_t fltch = fletcher8(&gpsline[0], ubxlen+4);
+    LOG(MOD_GPS|DEBUG, "UBX cksum=%04X vs found=%04X", cksum, fltch);
+    if( cksum != fltch )
+        return;
+    if( gpsline[0] == 0x01 && gpsline[1] == 0x20 && ubxlen == 16 ) {
+        u4_t tow      = rt_rlsbf4(&gpsline[4]);    // GPS time of week in ms
+        u4_t tow_ns   = rt_rlsbf4(&gpsline[4+4]);
+        u2_t week     = rt_rlsbf2(&gpsline[4+4+2]);
+        u1_t leapsecs = gpsline[4+4+2+0];
+        u1_t status   = gpsline[4+4+2+1];
+        u4_t tacc     = rt_rlsbf4(&gpsline[4+4+2+2]);
+        LOG(MOD_GPS|DEBUG, "NAV-TIMEGPS tow(ms)=%d.%06d week=%d leapsecs=%d status=%d tacc=%d",
+            tow, tow_ns, week, leapsecs, status, tacc);
+    } else {
+        LOG(MOD_GPS|WARNING, "Unknown UBX frame: %H", ubxend, &gpsline[0]);
+    }
+}
+#endif // defined(CFG_ubx)
+
+
+static void gps_feed (const u1_t* data, int len) {
+    for( int i=0; i<len; i++ ) {
+        int c = data[i];
+        switch( gpsstate ) {
+        case GPS_NMEA: {
+            if( c == '*' ) {
+                gpsline[gpsfill++] = c;
+                gpsstate = GPS_NMEA_CK1;
+                continue;
+            }
+            if( c < 0x20 || c >= 0x7F || c == '$' || gpsfill >= sizeof(gpsline)-2 ) {
+                gps_garbage("truncated");
+                break;  // reconsider this byte as start of a new sentence
+            }
+            gpsxsum ^= c;
+            gpsline[gpsfill++] = c;
+            continue;
+        }
+        case GPS_NMEA_CK1:
+        case GPS_NMEA_CK2: {
+            int h = rt_hexDigit(c);
+            if( h < 0 ) {
+                gps_garbage("no checksum");
+                break;
+            }
+            gpsck = (gpsck<<4) | h;
+            if( gpsstate == GPS_NMEA_CK1 ) {
+                gpsstate = GPS_NMEA_CK2;
+                continue;
+            }
+            gpsstate = GPS_IDLE;
+            if( gpsck != gpsxsum ) {
+                LOG(MOD_GPS|ERROR,"NMEA checksum error: %02X vs %02X", gpsck, gpsxsum);
+                gps_garbage("checksum");
+                continue;
+            }
+            gpsline[gpsfill] = 0;
+            nmea_sentence();
+            continue;
+        }
+#if defined(CFG_ubx)
+        case GPS_UBX_SYN2: {
+            if( c != UBX_SYN2 )
+                break;
+            gpsstate = GPS_UBX_FRAME;
+            gpsfill = ubxend = 0;
+            continue;
+        }
+        case GPS_UBX_FRAME: {
+            gpsline[gpsfill++] = c;
+            if( ubxend == 0 ) {
+                if( gpsfill < 4 )
+                    continue;
+                ubxend = rt_rlsbf2(&gpsline[2]) + 6;
+                if( ubxend > sizeof(gpsline) ) {
+                    LOG(MOD_GPS|WARNING, "UBX frame too large: %d bytes", ubxend);
+                    gpsstate = GPS_IDLE;
+                    continue;
+                }
+            }
+            if( gpsfill == ubxend ) {
+                ubx_frame();
+                gpsstate = GPS_IDLE;
+            }
+            continue;
+        }
+#endif // defined(CFG_ubx)
+        }
+        // GPS_IDLE - or byte did not fit the current state
+        gpsstate = GPS_IDLE;
+        if( c == '$' ) {
+            gpsstate = GPS_NMEA;
+            gpsfill = gpsxsum = gpsck = 0;
+        }
+#if defined(CFG_ubx)
+        else if( c == UBX_SYN1 ) {
+            gpsstate = GPS_UBX_SYN2;
+        }
+#endif // defined(CFG_ubx)
+    }
+}
+
+
 static void gps_read(aio_t* _aio) {
     assert(aio == _aio);
-    int n, done = 0;
+    u1_t buf[512];
+    int n;
     while(1) {
-        n = read(aio->fd, gpsline+gpsfill, sizeof(gpsline)-gpsfill);
+        n = read(aio->fd, buf, sizeof(buf));
         if( n == 0 ) {
             // EOF
             aio_close(aio);
@@ -409,63 +549,7 @@ static void gps_read(aio_t* _aio) {
                 return;
             rt_fatal("Failed to read GPS data from '%s': %s", device, strerror(errno));
         }
-        gpsfill = n = gpsfill + n;
-        for( int i=0; i<n; i++ ) {
-            if( gpsline[i] == '\n' ) {
-                if( nmea_cksum(gpsline, i) ) {
-                    LOG(MOD_GPS|XDEBUG, "GPS: %.*s", i+1, &gpsline[done]);
-                    if( gpsline[done+0] == '$' && gpsline[done+3] == 'G' &&
-                        gpsline[done+4] == 'G' && gpsline[done+5] == 'A' && gpsline[done+6] == ',' ) {
-                        nmea_gga((char*)gpsline+7);
-                    }
-                }
-                else {
-                    if( garbageCnt == 0 ) {
-                        LOG(MOD_GPS|WARNING, "GPS garbage: %.*s", i+1, &gpsline[done]);
-                    } else {
-                        garbageCnt -= 1;  // 1st few sentences might be garbage
-                    }
-                }
-                done = i+1;
-                break;
-            }
-#if defined(CFG_ubx)
-            if( gpsline[i] == UBX_SYN1 && i+1 < n && gpsline[i+1] == UBX_SYN2 ) {
-                if( i+6 > n )
-                    break; // need more data to read header
-                u2_t ubxlen = rt_rlsbf2(&gpsline[i+4]);
-                if( i + ubxlen + 8 > n )
-                    break;
-                u2_t cksum = rt_rlsbf2(&gpsline[i+6+ubxlen]);
-                u2_t fltch = fletcher8(&gpsline[i+2], ubxlen+4);
-                LOG(MOD_GPS|DEBUG, "UBX cksum=%04X vs found=%04X", cksum, fltch);
-                if( cksum != fltch ) {
-                    done = i+1;
-                    break;
-                }
-                done = i+8+ubxlen;
-                if( gpsline[i+2] == 0x01 && gpsline[i+3] == 0x20 && ubxlen == 16 ) {
-                    u4_t tow      = rt_rlsbf4(&gpsline[i+6]);    // GPS time of week in ms
-                    u4_t tow_ns   = rt_rlsbf4(&gpsline[i+6+4]);
-                    u2_t week     = rt_rlsbf2(&gpsline[i+6+4+2]);
-                    u1_t leapsecs = gpsline[i+6+4+2+0];
-                    u1_t status   = gpsline[i+6+4+2+1];
-                    u4_t tacc     = rt_rlsbf4(&gpsline[i+6+4+2+2]);
-                    LOG(MOD_GPS|DEBUG, "NAV-TIMEGPS tow(ms)=%d.%06d week=%d leapsecs=%d status=%d tacc=%d",
-                        tow, tow_ns, week, leapsecs, status, tacc);
-                } else {
-                    LOG(MOD_GPS|WARNING, "Unknown UBX frame: %H", 8+ubxlen, &gpsline[i]);
-                }
-                break;
-            }
-#endif // defined(CFG_ubx)
-        }
-        if( done ) {
-            if( done < gpsfill )
-                memmove(&gpsline[0], &gpsline[done], gpsfill-done);
-            gpsfill -= done;
-            done = 0;
-        }
+        gps_feed(buf, n);
     }
 }
 
@@ -541,11 +625,11 @@ static int gps_reopen () {
         tio.c_iflag |= IGNPAR;
         tio.c_iflag &= ~(ICRNL|IGNCR|IXON|IXOFF);
         tio.c_oflag  = 0;
-        tio.c_lflag |= ICANON;
-        tio.c_lflag &= ~(ISIG|IEXTEN|ECHO|ECHOE|ECHOK);
-        //tio.c_lflag &= ~(ICANON|ISIG|IEXTEN|ECHO|ECHOE|ECHOK);
-        //tio.c_cc[VMIN]  = 8;
-        //tio.c_cc[VTIME] = 0;
+        // Raw mode: the parser does its own framing - wake up only once a batch
+        // of bytes is available instead of for every line.
+        tio.c_lflag &= ~(ICANON|ISIG|IEXTEN|ECHO|ECHOE|ECHOK);
+        tio.c_cc[VMIN]  = GPS_TTY_VMIN;
+        tio.c_cc[VTIME] = 0;
         if( tcsetattr(fd, TCSANOW, &tio) == -1 ) {
             LOG(MOD_GPS|ERROR, "Failed to apply TTY settings to '%s': %s", device, strerror(errno));
             close(fd);
@@ -567,6 +651,7 @@ static int gps_reopen () {
     aio = aio_open(&device, fd, gps_read, NULL);
     atexit(gps_close);
     gpsfill = 0;
+    gpsstate = GPS_IDLE;
     gps_read(aio);
     return 1;
 }
@@ -45,8 +45,10 @@
 #include "sys.h"
 #include "sys_linux.h"
 #include "sx130xconf.h"
+#include "s2conf.h"
 #include "ral.h"
 #include "ralsub.h"
+#include "metrics.h"
 
 
 #define WAIT_SLAVE_PID_INTV rt_millis(500)
@@ -67,29 +69,58 @@ typedef struct slave {
     dbuf_t     sx1301confJson;
     chdefl_t   upchs;
     int        last_expcmd;
-    // Read Spill Buffer
-    struct {
-        u1_t buf[PIPE_BUF];
-        int off;
-        int exp;
-    } rsb;
+    u1_t       txstatus;  // TXSTATUS_* as last pushed by slave for frame txseq
+    u4_t       txseq;
+    shmlink_t  shm;       // RX/TX frames - if shm.up==NULL frames go thru the pipes
+    aio_t*     shmev;     // wakeups for up ring
+    ral_msgbuf_t rmb;     // framed messages read from slave - may end with partial message
 } slave_t;
 
 static int    n_slaves;
 static slave_t* slaves;
 static pid_t    master_pid;
 static u4_t     region;
+static int      confFd = -1;  // slave setups from station.conf/slave-N.conf - parsed once, mapped by slaves
 
 
 // Fwd decl
 static void restart_slave (tmr_t* tmr);
 
-static int read_slave_pipe (slave_t* slave, u1_t* buf, int bufsize, int expcmd, struct ral_response* expresp) {
+static void slave_rxframe (slave_t* slave, struct ral_rx_resp* resp) {
+    if( !TC ) {
+        // Radio lingering between TC sessions - nowhere to queue the frame
+        LOG(MOD_RAL|XDEBUG, "Slave (%d) has RX frame dropped - no TC session", (int)(slave-slaves));
+        metric_inc(MC_rx_drop_nosession);
+        return;
+    }
+    rxjob_t* rxjob = s2e_nextRxjob(&TC->s2ctx);
+    if( rxjob == NULL ) {
+        LOG(MOD_RAL|ERROR, "Slave (%d) has RX frame dropped - out of space", (int)(slave-slaves));
+        metric_inc(MC_rx_drop_nospace);
+        return;
+    }
+    memcpy(&TC->s2ctx.rxq.rxdata[rxjob->off], resp->rxdata, resp->rxlen);
+    rxjob->len = resp->rxlen;
+    rxjob->freq = resp->freq;
+    rxjob->rctx = resp->rctx;
+    rxjob->xtime = resp->xtime;
+    rxjob->rssi = resp->rssi;
+    rxjob->snr = resp->snr;
+    rxjob->dr = s2e_rps2dr(&TC->s2ctx, resp->rps);
+    if( rxjob->dr == DR_ILLEGAL ) {
+        LOG(MOD_RAL|ERROR, "Unable to map to an up DR: %R", resp->rps);
+        return;
+    }
+    s2e_addRxjob(&TC->s2ctx, rxjob);
+}
+
+static int read_slave_pipe (slave_t* slave, int expcmd, struct ral_response* expresp) {
     u1_t slave_idx = (int)(slave-slaves);
     u1_t retries = 0;
     u1_t expok = 0;
+    ral_msgbuf_t* mb = &slave->rmb;
     while(1) {
-        int n = read(slave->up->fd, buf, bufsize);
+        int n = read(slave->up->fd, &mb->buf[mb->len], sizeof(mb->buf) - mb->len);
         if( n == 0 ) {
             // EOF
             LOG(MOD_RAL|ERROR, "Slave (%d) - EOF", slave_idx);
@@ -112,96 +143,79 @@ static int read_slave_pipe (slave_t* slave, u1_t* buf, int bufsize, int expcmd,
             // NOT REACHED
         }
         slave->restartCnt = 0;
-        int off = 0;
-        while( off < n ) {
-            int dlen = n - off;
-            struct ral_header* hdr = (struct ral_header*)&buf[off];
-            int consumed = 0;
-            if( slave->rsb.off ) {
-                assert(slave->rsb.off<slave->rsb.exp);
-                int chunksz = min(slave->rsb.exp-slave->rsb.off, n-off);
-                memcpy(&slave->rsb.buf[slave->rsb.off], &buf[off], chunksz);
-                off += chunksz;
-                slave->rsb.off += chunksz;
-                if( slave->rsb.off < slave->rsb.exp ) {
-                    continue;
-                }
-                hdr = (struct ral_header*)slave->rsb.buf;
-                dlen = slave->rsb.off;
-            }
-            if( expcmd >= 0 && hdr->cmd == expcmd ) {
-                if( (slave->rsb.exp = sizeof(struct ral_response)) > dlen ) goto spill;
-                *expresp = *(struct ral_response*)hdr;
-                consumed = sizeof(*expresp);
+        mb->len += n;
+        ral_msg_t msg;
+        int pos = 0, mlen, nrx = 0;
+        while( (mlen = ral_decMsg(mb, &pos, &msg)) > 0 ) {
+            u1_t cmd = msg.hdr.cmd;
+            if( expcmd >= 0 && cmd == expcmd && mlen >= sizeof(struct ral_response) ) {
+                *expresp = msg.resp;
                 expok = 1;
                 slave->last_expcmd = expcmd = -1;
             }
-            else if( slave->last_expcmd >= 0 && hdr->cmd == slave->last_expcmd ) {
-                if( (slave->rsb.exp = sizeof(struct ral_response)) > dlen ) goto spill;
-                LOG(MOD_RAL|WARNING, "Slave (%d) responded to expired synchronous cmd: %d. Ignoring.", slave_idx, hdr->cmd);
-                consumed = sizeof(struct ral_response);
+            else if( cmd == RAL_CMD_TXSTATUS && mlen >= sizeof(struct ral_response) ) {
+                if( msg.resp.rctx == slave->txseq )
+                    slave->txstatus = msg.resp.status;  // else late update about an earlier frame
+            }
+            else if( slave->last_expcmd >= 0 && cmd == slave->last_expcmd && mlen >= sizeof(struct ral_response) ) {
+                LOG(MOD_RAL|WARNING, "Slave (%d) responded to expired synchronous cmd: %d. Ignoring.", slave_idx, cmd);
                 slave->last_expcmd = -1;
             }
-            else if( hdr->cmd == RAL_CMD_TIMESYNC ) {
-                if( (slave->rsb.exp= sizeof(struct ral_timesync_resp)) > dlen ) goto spill;
-                struct ral_timesync_resp* resp = (struct ral_timesync_resp*)hdr;
-                ustime_t delay = ts_updateTimesync(slave_idx, resp->quality, &resp->timesync);
+            else if( cmd == RAL_CMD_TIMESYNC && mlen >= sizeof(struct ral_timesync_resp) ) {
+                ustime_t delay = ts_updateTimesync(slave_idx, msg.tsresp.quality, &msg.tsresp.timesync);
                 rt_setTimer(&slave->tsync, rt_micros_ahead(delay));
-                consumed = sizeof(*resp);
             }
-            else if( hdr->cmd == RAL_CMD_RX ) {
-                if( (slave->rsb.exp = sizeof(struct ral_rx_resp)) > dlen ) goto spill;
-                struct ral_rx_resp* resp = (struct ral_rx_resp*)hdr;
-                rxjob_t* rxjob = !TC ? NULL : s2e_nextRxjob(&TC->s2ctx);
-                if( rxjob != NULL ) {
-                    memcpy(&TC->s2ctx.rxq.rxdata[rxjob->off], resp->rxdata, resp->rxlen);
-                    rxjob->len = resp->rxlen;
-                    rxjob->freq = resp->freq;
-                    rxjob->rctx = resp->rctx;
-                    rxjob->xtime = resp->xtime;
-                    rxjob->rssi = resp->rssi;
-                    rxjob->snr = resp->snr;
-                    rxjob->dr = s2e_rps2dr(&TC->s2ctx, resp->rps);
-                    if( rxjob->dr == DR_ILLEGAL ) {
-                        LOG(MOD_RAL|ERROR, "Unable to map to an up DR: %R", resp->rps);
-                    } else {
-                        s2e_addRxjob(&TC->s2ctx, rxjob);
-                        s2e_flushRxjobs(&TC->s2ctx); // XXX
-                    }
-                } else {
-                    LOG(MOD_RAL|ERROR, "Slave (%d) has RX frame dropped - out of space", slave_idx);
-                }
-                consumed = sizeof(*resp);
+            else if( cmd == RAL_CMD_RX && mlen >= RAL_RX_RESP_HDRLEN && mlen == RAL_RX_RESP_HDRLEN + msg.rx.rxlen ) {
+                slave_rxframe(slave, &msg.rx);
+                nrx++;
             }
             else {
-                
-                rt_fatal("Slave (%d) sent unexpected data: cmd=%d size=%d", slave_idx, hdr->cmd, dlen);
-            }
-            if( slave->rsb.off ) {
-                slave->rsb.off = 0;
-            } else {
-                off += consumed;
-            }
-            continue;
-        spill:
-            if( sizeof(slave->rsb.buf)-slave->rsb.off < dlen ) {
-                rt_fatal("Slave (%d) Cannot store data in slave->rsb.buf size=%d slave->rsb.off=%d", slave_idx, n-off, slave->rsb.off);
-            } else {
-                memcpy(&slave->rsb.buf[slave->rsb.off], hdr, dlen);
-                slave->rsb.off += dlen;
-                off += dlen;
+                rt_fatal("Slave (%d) sent unexpected data: cmd=%d size=%d", slave_idx, cmd, mlen);
             }
         }
-        assert(off==n);
+        if( mlen < 0 )
+            rt_fatal("Slave (%d) sent corrupt message framing", slave_idx);
+        ral_shiftMsgbuf(mb, pos);
+        if( nrx && TC )
+            s2e_flushRxjobs(&TC->s2ctx);
     }
 }
 
 
 static void pipe_read (aio_t* aio) {
     slave_t* slave = aio->ctx;
-    u1_t buf[PIPE_BUF];
     struct ral_response resp;
-    read_slave_pipe(slave, buf, PIPE_BUF, -1, &resp);
+    read_slave_pipe(slave, -1, &resp);
+}
+
+
+// Drain RX frames from the shared memory ring of a slave
+static void shm_read (aio_t* aio) {
+    slave_t* slave = aio->ctx;
+    shmring_t* up = slave->shm.up;
+    struct ral_rx_resp* resp;
+    int len, n = 0;
+    shmring_ack(slave->shm.upev);
+    while( (resp = shmring_peek(up, &len)) != NULL ) {
+        if( len < RAL_RX_RESP_HDRLEN || resp->cmd != RAL_CMD_RX || len != RAL_RX_RESP_HDRLEN + resp->rxlen )
+            rt_fatal("Slave (%d) sent corrupt ring record: cmd=%d len=%d", (int)(slave-slaves), resp->cmd, len);
+        slave->restartCnt = 0;
+        slave_rxframe(slave, resp);
+        shmring_pop(up);
+        n++;
+    }
+    if( n && TC )
+        s2e_flushRxjobs(&TC->s2ctx);
+}
+
+
+static void close_shm (slave_t* slave) {
+    if( slave->shmev ) {
+        aio_close(slave->shmev);  // closes upev
+        slave->shmev = NULL;
+        slave->shm.upev = -1;
+    }
+    shmlink_close(&slave->shm);
 }
 
 
@@ -216,6 +230,7 @@ static void killAllSlaves () {
         slave->pid = 0;
         aio_close(slave->up);
         aio_close(slave->dn);
+        close_shm(slave);
         rt_clrTimer(&slave->tmr);
         if( pid )
             kill(pid, SIGKILL);
@@ -276,18 +291,35 @@ static void recheck_slave (tmr_t* tmr) {
 }
 
 
-static void execSlave (int idx, int rdfd, int wrfd) {
+static void execSlave (int idx, int rdfd, int wrfd, shmlink_t* shm) {
     wordexp_t wexp;
     memset(&wexp, 0, sizeof(wexp));
 
     // Prepare some env vars
-    char idxbuf[12], rdfdbuf[12], wrfdbuf[12];
+    char idxbuf[12], rdfdbuf[12], wrfdbuf[12], shmbuf[40], confbuf[12];
     snprintf(idxbuf,  sizeof(idxbuf),  "%d", idx);
     snprintf(rdfdbuf, sizeof(rdfdbuf), "%d", rdfd);
     snprintf(wrfdbuf, sizeof(wrfdbuf), "%d", wrfd);
     setenv("SLAVE_IDX" , idxbuf , 1);
     setenv("SLAVE_RDFD", rdfdbuf, 1);
     setenv("SLAVE_WRFD", wrfdbuf, 1);
+    if( shm->up ) {
+        // Shared memory ring fds survive exec
+        int fds[] = { shm->memfd, shm->upev, shm->dnev };
+        for( int i=0; i<SIZE_ARRAY(fds); i++ )
+            fcntl(fds[i], F_SETFD, 0);
+        snprintf(shmbuf, sizeof(shmbuf), "%d,%d,%d", shm->memfd, shm->upev, shm->dnev);
+        setenv("SLAVE_SHM", shmbuf, 1);
+    } else {
+        unsetenv("SLAVE_SHM");
+    }
+    if( confFd >= 0 ) {
+        fcntl(confFd, F_SETFD, 0);
+        snprintf(confbuf, sizeof(confbuf), "%d", confFd);
+        setenv("SLAVE_CONF", confbuf, 1);
+    } else {
+        unsetenv("SLAVE_CONF");
+    }
     int fail = wordexp(sys_slaveExec, &wexp, WRDE_DOOFFS|WRDE_NOCMD|WRDE_UNDEF|WRDE_SHOWERR);
     if( fail ) {
         str_t err;
@@ -313,11 +345,14 @@ static void execSlave (int idx, int rdfd, int wrfd) {
 }
 
 
-static int write_slave_pipe (slave_t* slave, void* data, int len) {
+static int write_slave_pipe (slave_t* slave, void* msg, int msglen) {
     if( slave->dn == NULL ) {
         LOG(MOD_RAL|ERROR, "Slave currently down/restarting");
         return 0;
     }
+    u1_t data[PIPE_BUF];
+    int len = ral_encMsg(data, sizeof(data), msg, msglen);
+    assert(len > 0);
     int n, retries = 0;
  again:
     n = write(slave->dn->fd, data, len);
@@ -354,7 +389,7 @@ static void send_config (slave_t* slave) {
         req.upchs = slave->upchs;
         memcpy(req.json, slave->sx1301confJson.buf, jlen);
         LOG(MOD_RAL|INFO, "Master sending %d bytes of JSON sx1301conf to slave (%d)", jlen, (int)(slave-slaves));
-        if( !write_slave_pipe(slave, &req, sizeof(req)) )
+        if( !write_slave_pipe(slave, &req, RAL_CONFIG_HDRLEN + jlen) )
             rt_fatal("Failed to send sx1301conf");
     }
 }
@@ -383,6 +418,9 @@ static void restart_slave (tmr_t* tmr) {
     aio_close(slave->up);
     aio_close(slave->dn);
     slave->up = slave->dn = NULL;
+    slave->rmb.len = 0;
+    slave->txstatus = TXSTATUS_IDLE;
+    close_shm(slave);
 
     if( is_slave_alive(slave) ) {
         LOG(MOD_RAL|INFO, "Slave pid=%d idx=%d: Trying kill (cnt=%d)", slaveIdx, pid, slave->killCnt);
@@ -400,11 +438,13 @@ static void restart_slave (tmr_t* tmr) {
     }
     slave->up = aio_open(slave, up[0], pipe_read, NULL);
     slave->dn = aio_open(slave, dn[1], NULL, NULL);  // we need this only for O_CLOEXEC
+    if( RAL_SHM_RINGSIZE > 0 && shmlink_create(&slave->shm, RAL_SHM_RINGSIZE) )
+        slave->shmev = aio_open(slave, slave->shm.upev, shm_read, NULL);
     sys_flushLog();
 
     if( (pid = fork()) == 0 ) {
         // This is the child process.  Execute the shell command.
-        execSlave(slaveIdx, dn[0], up[1]);
+        execSlave(slaveIdx, dn[0], up[1], &slave->shm);
         // NOT REACHED
         assert(0);
     }
@@ -415,6 +455,10 @@ static void restart_slave (tmr_t* tmr) {
     LOG(MOD_RAL|INFO, "Master has started slave: pid=%d idx=%d (attempt %d)", pid, slaveIdx, slave->restartCnt);
     close(up[1]);
     close(dn[0]);
+    if( slave->shm.memfd >= 0 ) {
+        close(slave->shm.memfd);  // slave has its copy - mapping stays valid
+        slave->shm.memfd = -1;
+    }
     slave->pid = pid;
     send_config(slave);
     pipe_read(slave->up);
@@ -449,6 +493,12 @@ static slave_t* txunit2slave(u1_t txunit, str_t op) {
 }
 
 
+// Pre-staging not supported - the slave builds the HAL packet when RAL_CMD_TX arrives
+int ral_txprep (txjob_t* txjob, s2ctx_t* s2ctx) {
+    return 0;
+}
+
+
 int ral_tx (txjob_t* txjob, s2ctx_t* s2ctx, int nocca) {
     // NOTE: nocca not possible to implement with current libloragw API
     slave_t* slave = txunit2slave(txjob->txunit, "tx");
@@ -464,31 +514,36 @@ int ral_tx (txjob_t* txjob, s2ctx_t* s2ctx, int nocca) {
     req.freq = txjob->freq;
     req.txpow = txjob->txpow;
     req.txlen = txjob->len;
-    memcpy(req.txdata, &s2ctx->txq.txdata[txjob->off], txjob->len);
-    if( !write_slave_pipe(slave, &req, sizeof(req)) )
-        return RAL_TX_FAIL;
-    if( region == 0 )
+    req.txtime = txjob->txtime;
+    req.airtime = txjob->airtime;
+    req.txseq = ++slave->txseq;
+    slave->txstatus = TXSTATUS_IDLE;
+    if( !slave->shm.dn || !shmring_put(slave->shm.dn, slave->shm.dnev, &req, RAL_TX_REQ_HDRLEN,
+                                       &s2ctx->txq.txdata[txjob->off], txjob->len) ) {
+        memcpy(req.txdata, &s2ctx->txq.txdata[txjob->off], txjob->len);
+        if( !write_slave_pipe(slave, &req, RAL_TX_REQ_HDRLEN + txjob->len) )
+            return RAL_TX_FAIL;
+    }
+    if( region == 0 ) {
+        slave->txstatus = TXSTATUS_SCHEDULED;
         return RAL_TX_OK;
+    }
     struct ral_response resp;
-    u1_t buf[PIPE_BUF];
-    if( !read_slave_pipe(slave, buf, PIPE_BUF, RAL_CMD_TX, &resp) )
+    if( !read_slave_pipe(slave, RAL_CMD_TX, &resp) )
         return TXSTATUS_IDLE;
+    if( resp.status == RAL_TX_OK )
+        slave->txstatus = TXSTATUS_SCHEDULED;
     return resp.status;
 }
 
 
+// Slave pushes TX state changes - never wait for the slave, just take in what is already queued
 int ral_txstatus (u1_t txunit) {
     slave_t* slave = txunit2slave(txunit, "tx");
     if( slave == NULL )
         return TXSTATUS_IDLE;
-    struct ral_txstatus_req req = { .cmd = RAL_CMD_TXSTATUS, .rctx = txunit };
-    if( !write_slave_pipe(slave, &req, sizeof(req)) )
-        return TXSTATUS_IDLE;
-    struct ral_response resp;
-    u1_t buf[PIPE_BUF];
-    if( !read_slave_pipe(slave, buf, PIPE_BUF, RAL_CMD_TXSTATUS, &resp) )
-        return TXSTATUS_IDLE;
-    return resp.status;
+    pipe_read(slave->up);
+    return slave->txstatus;
 }
 
 
@@ -498,6 +553,7 @@ void ral_txabort (u1_t txunit) {
         return;
     struct ral_txstatus_req req = { .cmd = RAL_CMD_TXABORT, .rctx = txunit };
     write_slave_pipe(slave, &req, sizeof(req));
+    slave->txstatus = TXSTATUS_IDLE;
 }
 
 
@@ -615,18 +671,17 @@ void ral_ini () {
     assert(slaves == NULL);
     n_slaves = slaveCnt;
     slaves = rt_mallocN(slave_t, n_slaves);
-    int allok = 1;
+    struct sx130xconf* confs = rt_mallocN(struct sx130xconf, n_slaves);
+    if( !sx130xconf_parse_files(confs, n_slaves) )
+        rt_fatal("Failed to load/parse some slave config files");
     for( int sidx=0; sidx < n_slaves; sidx++ ) {
-        struct sx130xconf sx1301conf;
-        if( !sx130xconf_parse_setup(&sx1301conf, sidx, "sx1301/1", "{}", 2) ) {
-            allok = 0;
-        } else {
-            slaves[sidx].antennaType = sx1301conf.antennaType;
-        }
+        slaves[sidx].antennaType = confs[sidx].antennaType;
         slaves[sidx].last_expcmd = -1;
+        slaves[sidx].shm.memfd = slaves[sidx].shm.upev = slaves[sidx].shm.dnev = -1;
     }
-    if( !allok )
-        rt_fatal("Failed to load/parse some slave config files");
+    // Slaves look up their setup in this image instead of reading/parsing the files again
+    confFd = shmconf_create(confs, sizeof(*confs), n_slaves);
+    rt_free(confs);
 
     master_pid = getpid();
     atexit(killAllSlaves);
@@ -0,0 +1,233 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if defined(CFG_lgw1) && defined(CFG_ral_master_slave)
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#include "rt.h"
+#include "ral.h"
+#include "ralsub.h"
+
+
+// Shared memory link between ral_master and one ral_slave.
+//
+// A memfd holds two single producer/single consumer rings: up (slave->master, RX frames)
+// and dn (master->slave, TX frames). Records are variable length and never wrap -
+// if a record does not fit at the end of the ring a pad record skips the rest.
+// Head and tail are free running byte counters - the ring size is a power of 2
+// so the slot mapping stays continuous when they wrap at 2^32. A producer signals the consumer's
+// eventfd only if the ring was empty, bursts of frames cost a single wakeup.
+// The pipes stay in place for control messages and to detect a dying peer.
+
+#define SHMREC_PAD 0xFFFFFFFF
+#define SHMREC_HDR ((u4_t)sizeof(u4_t))
+#define shmrec_size(len) (SHMREC_HDR + (((len)+3) & ~3))
+
+static int memfdCreate (const char* name, int flags) {
+#if defined(__NR_memfd_create)
+    return syscall(__NR_memfd_create, name, /*MFD_CLOEXEC*/1|flags);
+#else
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int mapLink (shmlink_t* l, int memfd, u4_t ringsize) {
+    l->mapsize = 2*(sizeof(shmring_t) + ringsize);
+    void* p = mmap(NULL, l->mapsize, PROT_READ|PROT_WRITE, MAP_SHARED, memfd, 0);
+    if( p == MAP_FAILED ) {
+        LOG(MOD_RAL|ERROR, "Failed to map shared memory ring: %s", strerror(errno));
+        return 0;
+    }
+    l->up = (shmring_t*)p;
+    l->dn = (shmring_t*)((u1_t*)p + sizeof(shmring_t) + ringsize);
+    return 1;
+}
+
+
+int shmlink_create (shmlink_t* l, u4_t ringsize) {
+    l->memfd = l->upev = l->dnev = -1;
+    l->up = l->dn = NULL;
+    if( ringsize < 2*shmrec_size(sizeof(struct ral_tx_req)) || ringsize > 0x40000000 )
+        return 0;
+    ringsize = 1u << (32 - __builtin_clz(ringsize-1));  // round up to power of 2
+    if( (l->memfd = memfdCreate("station-ral", 0)) == -1 ||
+        ftruncate(l->memfd, 2*(sizeof(shmring_t) + ringsize)) == -1 ||
+        (l->upev = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1 ||
+        (l->dnev = eventfd(0, EFD_NONBLOCK|EFD_CLOEXEC)) == -1 ) {
+        LOG(MOD_RAL|ERROR, "Failed to create shared memory ring: %s", strerror(errno));
+        shmlink_close(l);
+        return 0;
+    }
+    if( !mapLink(l, l->memfd, ringsize) ) {
+        shmlink_close(l);
+        return 0;
+    }
+    memset(l->up, 0, sizeof(shmring_t));
+    memset(l->dn, 0, sizeof(shmring_t));
+    l->up->size = l->dn->size = ringsize;
+    return 1;
+}
+
+
+int shmlink_attach (shmlink_t* l, int memfd, int upev, int dnev) {
+    shmring_t hdr;
+    l->up = l->dn = NULL;
+    l->memfd = memfd;
+    l->upev = upev;
+    l->dnev = dnev;
+    if( pread(memfd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || hdr.size == 0 || (hdr.size & (hdr.size-1)) != 0 || !mapLink(l, memfd, hdr.size) ) {
+        LOG(MOD_RAL|ERROR, "Failed to attach shared memory ring - falling back to pipes");
+        shmlink_close(l);
+        return 0;
+    }
+    close(memfd);  // mapping stays valid
+    l->memfd = -1;
+    return 1;
+}
+
+
+void shmlink_close (shmlink_t* l) {
+    if( l->up )
+        munmap(l->up, l->mapsize);
+    if( l->memfd >= 0 ) close(l->memfd);
+    if( l->upev  >= 0 ) close(l->upev);
+    if( l->dnev  >= 0 ) close(l->dnev);
+    l->up = l->dn = NULL;
+    l->memfd = l->upev = l->dnev = -1;
+}
+
+
+int shmring_put (shmring_t* r, int evfd, const void* hdr, int hdrlen, const void* data, int datalen) {
+    u4_t len  = hdrlen + datalen;
+    u4_t need = shmrec_size(len);
+    u4_t head = r->head;
+    u4_t tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    u4_t off  = head & (r->size-1);
+    u4_t skip = off + need > r->size ? r->size - off : 0;
+    if( skip + need > r->size - (head - tail) ) {
+        r->drops += 1;
+        return 0;  // ring full
+    }
+    if( skip ) {
+        *(u4_t*)&r->data[off] = SHMREC_PAD;
+        off = 0;
+    }
+    *(u4_t*)&r->data[off] = len;
+    memcpy(&r->data[off+SHMREC_HDR], hdr, hdrlen);
+    if( datalen )
+        memcpy(&r->data[off+SHMREC_HDR+hdrlen], data, datalen);
+    __atomic_store_n(&r->head, head + skip + need, __ATOMIC_SEQ_CST);
+    // Consumer may have drained everything up to our old head and gone to sleep
+    if( __atomic_load_n(&r->tail, __ATOMIC_SEQ_CST) == head )
+        eventfd_write(evfd, 1);
+    return 1;
+}
+
+
+void* shmring_peek (shmring_t* r, int* plen) {
+    u4_t tail = r->tail;
+    while( tail != __atomic_load_n(&r->head, __ATOMIC_SEQ_CST) ) {
+        u4_t off = tail & (r->size-1);
+        u4_t len = *(u4_t*)&r->data[off];
+        if( len == SHMREC_PAD ) {
+            tail += r->size - off;
+            __atomic_store_n(&r->tail, tail, __ATOMIC_SEQ_CST);
+            continue;
+        }
+        *plen = len;
+        return &r->data[off+SHMREC_HDR];
+    }
+    return NULL;
+}
+
+
+void shmring_pop (shmring_t* r) {
+    u4_t tail = r->tail;
+    u4_t len = *(u4_t*)&r->data[tail & (r->size-1)];
+    __atomic_store_n(&r->tail, tail + shmrec_size(len), __ATOMIC_SEQ_CST);
+}
+
+
+void shmring_ack (int evfd) {
+    eventfd_t v;
+    eventfd_read(evfd, &v);  // non-blocking - clear pending wakeups
+}
+
+
+// Read-only image of an array of records - e.g. slave setups parsed by the master.
+// The memfd is sealed against modification (where supported) and mapped by slaves.
+
+#define SHMCONF_MAGIC 0x46435353  // "SSCF"
+
+int shmconf_create (const void* recs, u4_t recsize, u4_t n) {
+    shmconf_t hdr = { .magic = SHMCONF_MAGIC, .recsize = recsize, .count = n };
+    u4_t len = recsize * n;
+    int fd = memfdCreate("station-conf", /*MFD_ALLOW_SEALING*/2);
+    if( fd == -1 ||
+        pwrite(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        pwrite(fd, recs, len, sizeof(hdr)) != len ) {
+        LOG(MOD_RAL|ERROR, "Failed to create configuration image: %s", strerror(errno));
+        if( fd >= 0 ) close(fd);
+        return -1;
+    }
+#if defined(F_ADD_SEALS)
+    fcntl(fd, F_ADD_SEALS, F_SEAL_SEAL|F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE);
+#endif
+    return fd;
+}
+
+
+const void* shmconf_map (int fd, u4_t recsize, u4_t* pn) {
+    shmconf_t hdr;
+    struct stat st;
+    if( pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) || fstat(fd, &st) == -1 ||
+        hdr.magic != SHMCONF_MAGIC || hdr.recsize != recsize ||
+        st.st_size != sizeof(hdr) + (sL_t)recsize * hdr.count ) {
+        LOG(MOD_RAL|ERROR, "Configuration image not usable - parsing config files");
+        return NULL;
+    }
+    void* p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if( p == MAP_FAILED ) {
+        LOG(MOD_RAL|ERROR, "Failed to map configuration image: %s", strerror(errno));
+        return NULL;
+    }
+    *pn = hdr.count;
+    return &((shmconf_t*)p)->data[0];
+}
+
+#endif // defined(CFG_lgw1) && defined(CFG_ral_master_slave)
@@ -42,18 +42,34 @@
 #include "lgw/loragw_hal.h"
 
 
+#define TXSTATUS_POLL_INTV rt_millis(1)
+
+
 static u1_t   pps_en;
 static sL_t   last_xtime;
 static u4_t   region;
 static tmr_t  rxpoll_tmr;
+static ustime_t rxpollIntv;
 static aio_t* rd_aio;
 static aio_t* wr_aio;
 static s2_t   txpowAdjust; // scaled by TXPOW_SCALE
+static shmlink_t shm = { .memfd=-1, .upev=-1, .dnev=-1 };  // RX/TX frames - shm.up==NULL => use pipes
+static aio_t* shm_aio;
+static ral_msgbuf_t rmb;   // framed messages from master - may end with partial message
 static struct lgw_pkt_rx_s pkt_rx[LGW_PKT_FIFO_SIZE];
+static u1_t   radioOn;      // concentrator started
+static struct sx130xconf startedConf;  // setup as parsed before sx130xconf_start
+static struct sx130xconf runningConf;  // setup of running concentrator
+static struct sx130xconf nextConf;     // setup from latest RAL_CMD_CONFIG
+static float  rssiAdj[LGW_RF_CHAIN_NB];  // RSSI offset changes applied live - HAL still uses startup values
+static tmr_t  txstat_tmr;   // polls radio for TX state changes of current frame
+static u1_t   txstat;       // TXSTATUS_* last pushed to master
+static u4_t   txseq;        // of current frame
+static ustime_t txstart, txend;
 
 
 static void pipe_write_data (void* data, int len) {
-    assert(len < PIPE_BUF);
+    assert(len <= PIPE_BUF);
     int retries = 0;
     while(1) {
         int n = write(wr_aio->fd, data, len);
@@ -72,14 +88,24 @@ static void pipe_write_data (void* data, int len) {
     }
 }
 
+static void pipe_write_msg (void* msg, int msglen) {
+    u1_t buf[PIPE_BUF];
+    int len = ral_encMsg(buf, sizeof(buf), msg, msglen);
+    assert(len > 0);
+    pipe_write_data(buf, len);
+}
+
 
 static void rx_polling (tmr_t* tmr) {
-    int n;
+    // RX frames not taken by shm ring are batched into writes of up to PIPE_BUF
+    u1_t batch[PIPE_BUF];
+    int n, total = 0, blen = 0;
     while( (n = lgw_receive(LGW_PKT_FIFO_SIZE, pkt_rx)) != 0 ) {
         if( n < 0 || n > LGW_PKT_FIFO_SIZE ) {
             LOG(MOD_RAL|ERROR, "lgw_receive error: %d", n);
             break;
         }
+        total += n;
         for( int i=0; i<n; i++ ) {
             struct lgw_pkt_rx_s* p = &pkt_rx[i];
             if( p->status != STAT_CRC_OK ) {
@@ -94,20 +120,31 @@ static void rx_polling (tmr_t* tmr) {
                 continue;
             }
             struct ral_rx_resp resp;
-            memset(&resp, 0, sizeof(resp));
+            memset(&resp, 0, RAL_RX_RESP_HDRLEN);
             resp.rctx   = sys_slaveIdx;
             resp.cmd    = RAL_CMD_RX;
             resp.xtime  = ts_xticks2xtime(p->count_us, last_xtime);
             resp.rps    = ral_lgw2rps(p);
             resp.freq   = p->freq_hz;
-            resp.rssi   = (u1_t)(p->rssi * -1);
+            resp.rssi   = (u1_t)((p->rssi + rssiAdj[p->rf_chain % LGW_RF_CHAIN_NB]) * -1);
             resp.snr    = (s1_t)(p->snr  *  8);
             resp.rxlen  = p->size;
+            if( shm.up && shmring_put(shm.up, shm.upev, &resp, RAL_RX_RESP_HDRLEN, p->payload, p->size) )
+                continue;
             memcpy(resp.rxdata, p->payload, p->size);
-            pipe_write_data(&resp, sizeof(resp));
+            int mlen = RAL_RX_RESP_HDRLEN + p->size;
+            int k = ral_encMsg(&batch[blen], sizeof(batch)-blen, &resp, mlen);
+            if( k == 0 ) {
+                pipe_write_data(batch, blen);
+                blen = 0;
+                k = ral_encMsg(batch, sizeof(batch), &resp, mlen);
+            }
+            blen += k;
         }
     }
-    rt_setTimer(&rxpoll_tmr, rt_micros_ahead(RX_POLL_INTV));
+    if( blen )
+        pipe_write_data(batch, blen);
+    rt_setTimer(&rxpoll_tmr, rt_micros_ahead(ral_rxpollIntv(&rxpollIntv, total)));
 }
 
 
@@ -116,14 +153,114 @@ static void sendTimesync () {
     resp.rctx = sys_slaveIdx;
     resp.cmd = RAL_CMD_TIMESYNC;
     resp.quality = ral_getTimesync(pps_en, &last_xtime, &resp.timesync);
-    pipe_write_data(&resp, sizeof(resp));
+    pipe_write_msg(&resp, sizeof(resp));
+}
+
+
+static u1_t read_txstatus () {
+    u1_t status;
+    int err = lgw_status(TX_STATUS, &status);
+    if( err != LGW_HAL_SUCCESS ) {
+        LOG(MOD_RAL|ERROR, "lgw_status failed");
+        return TXSTATUS_IDLE;
+    }
+    return status == TX_SCHEDULED ? TXSTATUS_SCHEDULED : status == TX_EMITTING ? TXSTATUS_EMITTING : TXSTATUS_IDLE;
+}
+
+
+static void push_txstatus (u1_t status) {
+    struct ral_response resp = { .rctx = txseq, .cmd = RAL_CMD_TXSTATUS, .status = status };
+    txstat = status;
+    pipe_write_msg(&resp, sizeof(resp));
+}
+
+
+// Master no longer asks for TX status - we tell it about each change. The radio is only
+// polled around the expected transitions: TX start and TX end of the current frame.
+static void txstatus_poll (tmr_t* tmr) {
+    u1_t status = read_txstatus();
+    if( status != txstat )
+        push_txstatus(status);
+    if( status == TXSTATUS_IDLE )
+        return;
+    ustime_t next = rt_getTime() + TXSTATUS_POLL_INTV;
+    ustime_t due = status == TXSTATUS_SCHEDULED ? txstart : txend;
+    rt_setTimer(&txstat_tmr, max(due, next));
+}
+
+
+static void handle_txreq (struct ral_tx_req* txreq) {
+    struct lgw_pkt_tx_s pkt_tx;
+    if( (txreq->rps & RPS_BCN) ) {
+        pkt_tx.tx_mode = ON_GPS;
+        pkt_tx.preamble = 10;
+    } else {
+        pkt_tx.tx_mode = TIMESTAMPED;
+        pkt_tx.preamble = 8;
+    }
+    ral_rps2lgw(txreq->rps, &pkt_tx);
+    pkt_tx.freq_hz    = txreq->freq;
+    pkt_tx.count_us   = txreq->xtime;
+    pkt_tx.rf_chain   = 0;
+    pkt_tx.rf_power   = (float)(txreq->txpow - txpowAdjust)/TXPOW_SCALE;
+    pkt_tx.coderate   = CR_LORA_4_5;
+    pkt_tx.invert_pol = true;
+    pkt_tx.no_crc     = true;
+    pkt_tx.no_header  = false;
+    pkt_tx.size       = txreq->txlen;
+    memcpy(pkt_tx.payload, txreq->txdata, txreq->txlen);
+    int err = lgw_send(pkt_tx);
+    txseq   = txreq->txseq;
+    txstart = txreq->txtime;
+    txend   = txreq->txtime + txreq->airtime;
+    if( err == LGW_HAL_SUCCESS ) {
+        txstat = TXSTATUS_SCHEDULED;  // master assumes this on success
+        rt_setTimer(&txstat_tmr, max(txstart, rt_getTime() + TXSTATUS_POLL_INTV));
+    } else {
+        rt_clrTimer(&txstat_tmr);
+        push_txstatus(TXSTATUS_IDLE);
+    }
+    if( region == 0 )
+        return;
+    // Send back CCA/LBT result
+    struct ral_response resp = { .rctx = txreq->rctx, .cmd = txreq->cmd };
+    if( err == LGW_HAL_SUCCESS ) {
+        resp.status = RAL_TX_OK;
+    } else if( err == LGW_LBT_ISSUE ) {
+        resp.status = RAL_TX_NOCA;
+    } else {
+        LOG(MOD_RAL|ERROR, "lgw_send failed");
+        resp.status = RAL_TX_FAIL;
+    }
+    pipe_write_msg(&resp, sizeof(resp));
+}
+
+
+// Process TX frames queued by master in the shared memory ring.
+// Called before any pipe command so that e.g. txstatus sees a preceding TX.
+static void shm_drain () {
+    struct ral_tx_req* txreq;
+    int len;
+    if( shm.dn == NULL )
+        return;
+    shmring_ack(shm.dnev);
+    while( (txreq = shmring_peek(shm.dn, &len)) != NULL ) {
+        if( len < RAL_TX_REQ_HDRLEN || len != RAL_TX_REQ_HDRLEN + txreq->txlen ||
+            (txreq->cmd != RAL_CMD_TX && txreq->cmd != RAL_CMD_TX_NOCCA) )
+            rt_fatal("Master sent corrupt ring record: cmd=%d len=%d", txreq->cmd, len);
+        handle_txreq(txreq);
+        shmring_pop(shm.dn);
+    }
+}
+
+static void shm_read (aio_t* aio) {
+    shm_drain();
 }
 
 
 static void pipe_read (aio_t* aio) {
-    u1_t buf[PIPE_BUF];
     while(1) {
-        int n = read(aio->fd, buf, sizeof(buf));
+        int n = read(aio->fd, &rmb.buf[rmb.len], sizeof(rmb.buf) - rmb.len);
         if( n == 0 ) {
             // EOF
             LOG(MOD_RAL|INFO, "EOF from master (%d)", sys_slaveIdx);
@@ -135,106 +272,68 @@ static void pipe_read (aio_t* aio) {
                 return;
             rt_fatal("Slave pipe read fail: %s", strerror(errno));
         }
-        int off = 0;
-        while( off < n ) {
-            struct ral_header* req = (struct ral_header*)&buf[off];
-            assert(n >= off + sizeof(*req));
-            if( n >= off + sizeof(struct ral_txstatus_req) && req->cmd == RAL_CMD_TXSTATUS ) {
-                off += sizeof(struct ral_txstatus_req);
-                struct ral_response* resp = (struct ral_response*)req;
-                u1_t ret=TXSTATUS_IDLE, status;
-                int err = lgw_status(TX_STATUS, &status);
-                /**/ if (err != LGW_HAL_SUCCESS)  { LOG(MOD_RAL|ERROR, "lgw_status failed"); }
-                else if( status == TX_SCHEDULED ) { ret = TXSTATUS_SCHEDULED; }
-                else if( status == TX_EMITTING  ) { ret = TXSTATUS_EMITTING; }
-                resp->status = ret;
-                pipe_write_data(resp, sizeof(*resp));
-                continue;
-            }
-            else if( n >= off + sizeof(struct ral_txabort_req) && req->cmd == RAL_CMD_TXABORT) {
-                off += sizeof(struct ral_txabort_req);
+        shm_drain();
+        rmb.len += n;
+        ral_msg_t msg;
+        int pos = 0, mlen;
+        while( (mlen = ral_decMsg(&rmb, &pos, &msg)) > 0 ) {
+            u1_t cmd = msg.hdr.cmd;
+            if( cmd == RAL_CMD_TXABORT && mlen >= sizeof(struct ral_txabort_req) ) {
                 lgw_abort_tx();
-                continue;
+                rt_clrTimer(&txstat_tmr);
+                txstat = TXSTATUS_IDLE;  // master cleared its copy
             }
-            else if( n >= off + sizeof(struct ral_timesync_req) && req->cmd == RAL_CMD_TIMESYNC) {
-                off += sizeof(struct ral_timesync_req);
+            else if( cmd == RAL_CMD_TIMESYNC && mlen >= sizeof(struct ral_timesync_req) ) {
                 sendTimesync();
-                continue;
             }
-            else if( n >= off + sizeof(struct ral_tx_req) && (req->cmd == RAL_CMD_TX_NOCCA || req->cmd == RAL_CMD_TX  )) {
-                off += sizeof(struct ral_tx_req);
-                struct ral_tx_req* txreq = (struct ral_tx_req*)req;
-                struct lgw_pkt_tx_s pkt_tx;
-                if( (txreq->rps & RPS_BCN) ) {  
-                    pkt_tx.tx_mode = ON_GPS;
-                    pkt_tx.preamble = 10;
-                } else {
-                    pkt_tx.tx_mode = TIMESTAMPED;
-                    pkt_tx.preamble = 8;
-                }
-                ral_rps2lgw(txreq->rps, &pkt_tx);
-                pkt_tx.freq_hz    = txreq->freq;
-                pkt_tx.count_us   = txreq->xtime;
-                pkt_tx.rf_chain   = 0;
-                pkt_tx.rf_power   = (float)(txreq->txpow - txpowAdjust)/TXPOW_SCALE;
-                pkt_tx.coderate   = CR_LORA_4_5;
-                pkt_tx.invert_pol = true;
-                pkt_tx.no_crc     = true;
-                pkt_tx.no_header  = false;
-                pkt_tx.size       = txreq->txlen;
-                memcpy(pkt_tx.payload, txreq->txdata, txreq->txlen);
-                int err = lgw_send(pkt_tx);
-                if( region == 0 ) {
-                    continue;
-                }
-                // Send back CCA/LBT result
-                struct ral_response* resp = (struct ral_response*)req;
-                u1_t ret = RAL_TX_OK;
-                if( err == LGW_HAL_SUCCESS ) {
-                    ret = RAL_TX_OK;
-                } else if( err == LGW_LBT_ISSUE ) {
-                    ret = RAL_TX_NOCA;
-                } else {
-                    LOG(MOD_RAL|ERROR, "lgw_send failed");
-                    ret = RAL_TX_FAIL;
-                }
-                resp->status = ret;
-                pipe_write_data(resp, sizeof(*resp));
-                continue;
+            else if( (cmd == RAL_CMD_TX_NOCCA || cmd == RAL_CMD_TX) &&
+                     mlen >= RAL_TX_REQ_HDRLEN && mlen == RAL_TX_REQ_HDRLEN + msg.tx.txlen ) {
+                handle_txreq(&msg.tx);
             }
-            else if( n >= off + sizeof(struct ral_config_req) && req->cmd == RAL_CMD_CONFIG) {
-                off += sizeof(struct ral_config_req);
-                struct ral_config_req* confreq = (struct ral_config_req*)req;
-                struct sx130xconf sx1301conf;
+            else if( cmd == RAL_CMD_CONFIG && mlen >= RAL_CONFIG_HDRLEN && mlen == RAL_CONFIG_HDRLEN + msg.config.jsonlen ) {
+                struct ral_config_req* confreq = &msg.config;
+                struct sx130xconf* sx1301conf = &nextConf;
                 int status = 0;
-                // Note: sx1301conf_start can take considerable amount of time (if LBT on up to 8s!!)
-                if( (status = !sx130xconf_parse_setup(&sx1301conf, sys_slaveIdx, confreq->hwspec, confreq->json, confreq->jsonlen)) ||
-                    (status = !sx130xconf_challoc(&sx1301conf, &confreq->upchs)   << 1) ||
-                    (status = !sys_runRadioInit(sx1301conf.device)                << 2) ||
-                    (status = !sx130xconf_start(&sx1301conf, confreq->region)     << 3) )
+                memset(sx1301conf, 0, sizeof(*sx1301conf));
+                if( (status = !sx130xconf_parse_setup(sx1301conf, sys_slaveIdx, confreq->hwspec, confreq->json, confreq->jsonlen)) ||
+                    (status = !sx130xconf_challoc(sx1301conf, &confreq->upchs)   << 1) )
                     rt_fatal("Slave radio start up failed with status 0x%02x", status);
-                if( sx1301conf.pps && sys_slaveIdx ) {
+                if( sx1301conf->pps && sys_slaveIdx ) {
                     LOG(MOD_RAL|ERROR, "Only slave#0 may have PPS enabled");
-                    sx1301conf.pps = 0;
+                    sx1301conf->pps = 0;
+                }
+                if( radioOn && confreq->region == region && sx130xconf_isLiveUpdate(&startedConf, sx1301conf) &&
+                    sx130xconf_updateLive(&runningConf, sx1301conf, rssiAdj) ) {
+                    // Only TX gains, RSSI offsets, PPS changed - concentrator keeps running
+                    startedConf = *sx1301conf;
+                } else {
+                    radioOn = 0;
+                    startedConf = runningConf = *sx1301conf;
+                    memset(rssiAdj, 0, sizeof(rssiAdj));
+                    // Note: sx1301conf_start can take considerable amount of time (if LBT on up to 8s!!)
+                    if( (status = !sys_runRadioInit(runningConf.device)            << 2) ||
+                        (status = !sx130xconf_start(&runningConf, confreq->region)  << 3) )
+                        rt_fatal("Slave radio start up failed with status 0x%02x", status);
+                    radioOn = 1;
+                    region = confreq->region;
+                    last_xtime = ts_newXtimeSession(sys_slaveIdx);
+                    rt_yieldTo(&rxpoll_tmr, rx_polling);
                 }
-                pps_en = sx1301conf.pps;
-                region = confreq->region;
-                txpowAdjust = sx1301conf.txpowAdjust;
-                last_xtime = ts_newXtimeSession(sys_slaveIdx);
-                rt_yieldTo(&rxpoll_tmr, rx_polling);
+                pps_en = runningConf.pps;
+                txpowAdjust = runningConf.txpowAdjust;
                 sendTimesync();
-                continue;
             }
-            else if( n >= off + sizeof(struct ral_stop_req) && req->cmd == RAL_CMD_STOP) {
-                off += sizeof(struct ral_stop_req);
+            else if( cmd == RAL_CMD_STOP && mlen >= sizeof(struct ral_stop_req) ) {
                 lgw_stop();
-                continue;
+                radioOn = 0;
             }
             else {
-                rt_fatal("Master sent unexpected data: cmd=%d size=%d", req->cmd, n-off);
+                rt_fatal("Master sent unexpected data: cmd=%d size=%d", cmd, mlen);
             }
         }
-        assert(off==n); // req fragments should not exist
+        if( mlen < 0 )
+            rt_fatal("Master sent corrupt message framing");
+        ral_shiftMsgbuf(&rmb, pos);
     }
 }
 
@@ -244,6 +343,34 @@ void sys_startupSlave (int rdfd, int wrfd) {
     rd_aio = aio_open(&rxpoll_tmr, rdfd, pipe_read, NULL);
     wr_aio = aio_open(&rxpoll_tmr, wrfd, NULL, NULL);
     rt_iniTimer(&rxpoll_tmr, NULL);
+    rt_iniTimer(&txstat_tmr, txstatus_poll);
+    str_t shmenv = getenv("SLAVE_SHM");
+    if( shmenv ) {
+        // memfd,upev,dnev - RX/TX frames via shared memory rings
+        int memfd = rt_readDec(&shmenv);
+        int upev  = (*shmenv == ',' ? (shmenv++, rt_readDec(&shmenv)) : -1);
+        int dnev  = (*shmenv == ',' ? (shmenv++, rt_readDec(&shmenv)) : -1);
+        if( memfd >= 0 && upev >= 0 && dnev >= 0 && shmlink_attach(&shm, memfd, upev, dnev) ) {
+            shm_aio = aio_open(&rxpoll_tmr, shm.dnev, shm_read, NULL);
+            LOG(MOD_RAL|INFO, "Slave LGW (%d) - RX/TX frames via shared memory ring (%d bytes)", sys_slaveIdx, shm.up->size);
+        }
+    }
+    str_t confenv = getenv("SLAVE_CONF");
+    if( confenv ) {
+        // Setups parsed by master - spares reading/parsing station.conf/slave-N.conf
+        int fd = rt_readDec(&confenv);
+        u4_t n;
+        const struct sx130xconf* confs = fd >= 0 ? shmconf_map(fd, sizeof(*confs), &n) : NULL;
+        if( confs )
+            sx130xconf_setCache(confs, n);
+        if( fd >= 0 )
+            close(fd);  // mapping stays valid
+    }
+    // All slaves reset/init their radio concurrently while the master waits for router_config
+    struct sx130xconf sx1301conf;
+    memset(&sx1301conf, 0, sizeof(sx1301conf));
+    if( sx130xconf_parse_setup(&sx1301conf, sys_slaveIdx, "sx1301/1", "{}", 2) )
+        sys_preRadioInit(sx1301conf.device);
     pipe_read(rd_aio);
     LOG(MOD_RAL|INFO, "Slave LGW (%d) - started.", sys_slaveIdx);
     aio_loop();
@@ -0,0 +1,72 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if defined(CFG_lgw1) && defined(CFG_ral_master_slave)
+
+#include "rt.h"
+#include "ral.h"
+#include "ralsub.h"
+
+
+// Append a framed message to buf - returns bytes used or 0 if it does not fit
+int ral_encMsg (u1_t* buf, int bufsize, const void* msg, int msglen) {
+    if( RAL_MSG_HDRLEN + msglen > bufsize )
+        return 0;
+    rt_wlsbf2(buf, msglen);
+    memcpy(buf+RAL_MSG_HDRLEN, msg, msglen);
+    return RAL_MSG_HDRLEN + msglen;
+}
+
+
+// Decode next message at *ppos and advance.
+// Returns message length, 0 if message is not yet complete, -1 if framing is corrupt.
+int ral_decMsg (ral_msgbuf_t* mb, int* ppos, ral_msg_t* msg) {
+    int pos = *ppos;
+    if( mb->len - pos < RAL_MSG_HDRLEN )
+        return 0;
+    int msglen = rt_rlsbf2(&mb->buf[pos]);
+    if( msglen < sizeof(struct ral_header) || msglen > sizeof(*msg) )
+        return -1;
+    if( mb->len - pos - RAL_MSG_HDRLEN < msglen )
+        return 0;
+    memcpy(msg, &mb->buf[pos+RAL_MSG_HDRLEN], msglen);
+    *ppos = pos + RAL_MSG_HDRLEN + msglen;
+    return msglen;
+}
+
+
+// Drop decoded messages and keep a trailing partial message
+void ral_shiftMsgbuf (ral_msgbuf_t* mb, int pos) {
+    if( pos == 0 )
+        return;
+    memmove(mb->buf, &mb->buf[pos], mb->len - pos);
+    mb->len -= pos;
+}
+
+#endif // defined(CFG_lgw1) && defined(CFG_ral_master_slave)
@@ -31,9 +31,15 @@
 
 #if defined(CFG_lgw1) && defined(CFG_ral_master_slave)
 
+#include <stddef.h>
 #include "timesync.h"
 
 
+// Pipe messages are framed: 2 byte length (LE) followed by that many bytes of one of the
+// structs below. Trailing unused rxdata/txdata/json is not sent. A write carries one
+// or more complete messages and never exceeds PIPE_BUF - thus writes stay atomic.
+enum { RAL_MSG_HDRLEN = 2 };
+
 enum {
     RAL_CMD_CONFIG = 1,
     RAL_CMD_TXSTATUS,
@@ -78,7 +84,7 @@ struct ral_config_req {
     u4_t region;   // 0=no LBT, !=0 LBT for this region
     chdefl_t upchs;
     char hwspec[MAX_HWSPEC_SIZE];
-    char json[PIPE_BUF-16-MAX_HWSPEC_SIZE-sizeof(chdefl_t)];  // 16 >= 8+1+2+4
+    char json[PIPE_BUF-16-MAX_HWSPEC_SIZE-sizeof(chdefl_t)-RAL_MSG_HDRLEN];  // 16 >= 8+1+2+4
 };
 
 struct ral_tx_req {
@@ -89,13 +95,16 @@ struct ral_tx_req {
     rps_t rps;
     u4_t  freq;
     sL_t  xtime;
+    ustime_t txtime;    // TX start/duration on CLOCK_MONOTONIC (shared with slave) - drive TX status polling
+    u4_t  airtime;
+    u4_t  txseq;        // echoed in RAL_CMD_TXSTATUS updates
     u1_t  txdata[MAX_TXFRAME_LEN];
 };
 
 // Generic response - status
 // tx:       RAL_TX_{OK,FAIL,NOCA}
 // cca:      0=busy, 1=clear
-// txstatus: TX status code
+// txstatus: TX status code - pushed unsolicited by slave on each change, rctx=txseq of the frame
 // config:   0=fail, 1=ok
 struct ral_response {
     sL_t rctx;
@@ -122,6 +131,71 @@ struct ral_rx_resp {
     u1_t  rxdata[MAX_RXFRAME_LEN];
 };
 
+// Variable length records carry only the used part of rx/txdata/json
+#define RAL_RX_RESP_HDRLEN ((int)offsetof(struct ral_rx_resp, rxdata))
+#define RAL_TX_REQ_HDRLEN  ((int)offsetof(struct ral_tx_req, txdata))
+#define RAL_CONFIG_HDRLEN  ((int)offsetof(struct ral_config_req, json))
+
+// Any message - aligned copy of a message taken from a pipe buffer
+typedef union ral_msg {
+    struct ral_header        hdr;
+    struct ral_response      resp;
+    struct ral_timesync_req  tsreq;
+    struct ral_timesync_resp tsresp;
+    struct ral_txstatus_req  txstatus;
+    struct ral_tx_req        tx;
+    struct ral_rx_resp       rx;
+    struct ral_config_req    config;
+} ral_msg_t;
+
+// Framed messages read from a pipe - may end with a partial message
+typedef struct ral_msgbuf {
+    int  len;
+    u1_t buf[2*PIPE_BUF];
+} ral_msgbuf_t;
+
+int ral_encMsg  (u1_t* buf, int bufsize, const void* msg, int msglen);
+int ral_decMsg  (ral_msgbuf_t* mb, int* ppos, ral_msg_t* msg);
+void ral_shiftMsgbuf (ral_msgbuf_t* mb, int pos);
+
+// SPSC ring in shared memory - see ral_shm.c
+typedef struct shmring {
+    u4_t size;     // capacity of data
+    u4_t head;     // producer position - free running
+    u4_t tail;     // consumer position - free running
+    u4_t drops;    // records rejected because ring was full
+    u1_t data[];
+} shmring_t;
+
+typedef struct shmlink {
+    shmring_t* up;     // slave -> master
+    shmring_t* dn;     // master -> slave
+    u4_t       mapsize;
+    int        memfd;
+    int        upev;   // eventfd - data in up ring
+    int        dnev;   // eventfd - data in dn ring
+} shmlink_t;
+
+int   shmlink_create (shmlink_t* l, u4_t ringsize);
+int   shmlink_attach (shmlink_t* l, int memfd, int upev, int dnev);
+void  shmlink_close  (shmlink_t* l);
+int   shmring_put    (shmring_t* r, int evfd, const void* hdr, int hdrlen, const void* data, int datalen);
+void* shmring_peek   (shmring_t* r, int* plen);
+void  shmring_pop    (shmring_t* r);
+void  shmring_ack    (int evfd);
+
+// Read-only array of records in a sealed memfd - see ral_shm.c
+typedef struct shmconf {
+    u4_t magic;
+    u4_t recsize;  // sizeof one record - master and slave are the same executable
+    u4_t count;
+    u4_t _pad;     // keep data 16 byte aligned
+    u1_t data[];
+} shmconf_t;
+
+int         shmconf_create (const void* recs, u4_t recsize, u4_t n);
+const void* shmconf_map    (int fd, u4_t recsize, u4_t* pn);
+
 // Fwd decl.
 struct lgw_pkt_tx_s;
 struct lgw_pkt_rx_s;
@@ -45,36 +45,129 @@
 #include "tc.h"
 
 
-#define UPBUFSZ   4096
 #define DNBUFSZ   4096
-#define UPBUFHI   (UPBUFSZ/2)
 #define DNBUFHI   (DNBUFSZ/2)
-#define WS_CHUNKS MIN_UPJSON_SIZE
+#define RMTSH_RETRY_INTV rt_millis(100)  // recheck paused sessions (rate cap / no WS space)
 
 
 typedef struct rmtsh {
     str_t    user;
     pid_t    pid;
     aio_t*   aio;
-    char     upbuf[UPBUFSZ];
     char     dnbuf[DNBUFSZ];
-    int      upfill, upsink;
     int      dnfill, dnsink;
+    u1_t     paused;      // not reading PTY output - shell blocks until resumed
     ustime_t mtime;
 } rmtsh_t;
 
 static rmtsh_t rmtshTable[MAX_RMTSH];
 
+// Output rate cap shared by all sessions - token bucket with a burst of one second
+static tmr_t    resumeTmr;
+static ustime_t rateTime;
+static sL_t     rateTokens;
+
 
 // Fwd decl
 static void stopRmtsh (rmtsh_t* rmtsh);
+static void up_read (aio_t* aio);
+
+
+// Number of output bytes we may send right now
+static int upBudget () {
+    if( RMTSH_RATE_MAX == 0 )
+        return RMTSH_FRAME_MAX;
+    ustime_t now = rt_getTime();
+    // A full bucket holds one second - no point in crediting more (and no overflow below)
+    if( now - rateTime > rt_seconds(1) )
+        rateTime = now - rt_seconds(1);
+    // Keep the fraction of a token - frequent calls would otherwise never gain any
+    sL_t tokens = (now - rateTime) * RMTSH_RATE_MAX / 1000000;
+    rateTime += tokens * 1000000 / RMTSH_RATE_MAX;
+    rateTokens += tokens;
+    if( rateTokens >= (sL_t)RMTSH_RATE_MAX ) {
+        rateTokens = RMTSH_RATE_MAX;
+        rateTime = now;
+    }
+    return rateTokens <= 0 ? 0 : (int)min(rateTokens, (sL_t)RMTSH_FRAME_MAX);
+}
+
+
+static void pauseRmtsh (rmtsh_t* rmtsh) {
+    if( !rmtsh->paused ) {
+        rmtsh->paused = 1;
+        aio_set_rdfn(rmtsh->aio, NULL);
+    }
+    if( resumeTmr.next == TMR_NIL )
+        rt_setTimer(&resumeTmr, rt_micros_ahead(RMTSH_RETRY_INTV));
+}
+
+
+// Resume reading output of paused sessions - called when WS send buffer drained some data
+void s2e_resumeRmtsh () {
+    for( int i=0; i<MAX_RMTSH; i++ ) {
+        rmtsh_t* rmtsh = &rmtshTable[i];
+        if( rmtsh->aio != NULL && rmtsh->paused ) {
+            rmtsh->paused = 0;
+            aio_set_rdfn(rmtsh->aio, up_read);
+            up_read(rmtsh->aio);
+        }
+    }
+}
 
 
+static void resume_timeout (tmr_t* tmr) {
+    s2e_resumeRmtsh();
+}
+
+
+// PTY output is read straight into the WS send buffer and as much as is available
+// goes into one binary frame (first byte is the session number). Uplink traffic
+// has priority: while frames are pending or the send buffer is above the high water
+// mark the PTY is not read - the shell blocks on a full PTY until we resume.
 static void up_read (aio_t* aio) {
     rmtsh_t* rmtsh = aio->ctx;
     int n;
     while(1) {
-        n = read(aio->fd, rmtsh->upbuf+rmtsh->upfill, UPBUFSZ-rmtsh->upfill);
+        if( TC == NULL ) {
+            // No connection - drop data
+            char scratch[512];
+            n = read(aio->fd, scratch, sizeof(scratch));
+        } else {
+            s2ctx_t* s2ctx = &TC->s2ctx;
+            int budget = upBudget();
+            if( budget <= 0 || s2ctx->sendhigh || rxq_firstJob(&s2ctx->rxq) != NULL ) {
+                pauseRmtsh(rmtsh);
+                return;
+            }
+            ujbuf_t sendbuf = s2e_getSendbufClass(s2ctx, MIN_UPJSON_SIZE, WSCLASS_BULK);
+            if( sendbuf.buf == NULL ) {
+                pauseRmtsh(rmtsh);
+                return;
+            }
+            // Leave at least half of the free space to other traffic
+            int room = min(budget, sendbuf.bufsize/2 - 1);
+            if( room <= 0 ) {
+                pauseRmtsh(rmtsh);
+                return;
+            }
+            int fill = 0;
+            do {
+                if( (n = read(aio->fd, sendbuf.buf+1+fill, room-fill)) > 0 )
+                    fill += n;
+            } while( n > 0 && fill < room );
+            if( fill > 0 ) {
+                sendbuf.buf[0] = rmtsh - rmtshTable;
+                sendbuf.pos = 1+fill;
+                (*s2ctx->sendBinary)(s2ctx, &sendbuf);
+                rateTokens -= fill;
+                rmtsh->mtime = rt_getTime();
+                if( fill == room )
+                    continue;  // maybe more
+                if( n == -1 && errno == EAGAIN )
+                    return;
+            }
+        }
         if( n == -1 ) {
             if( errno == EAGAIN ) {
                 return;
@@ -87,32 +180,6 @@ static void up_read (aio_t* aio) {
             return;
         }
         rmtsh->mtime = rt_getTime();
-        rmtsh->upfill += n;
-        if( TC ) {
-            n = min(WS_CHUNKS, 1+rmtsh->upfill-rmtsh->upsink);
-            if( n == 1 )
-                continue; // do sent empty data frame - would signal EOF
-            ujbuf_t sendbuf = (*TC->s2ctx.getSendbuf)(&TC->s2ctx, n);
-            if( sendbuf.buf != NULL ) {
-                sendbuf.buf[0] = rmtsh - rmtshTable;
-                memcpy(sendbuf.buf+1, &rmtsh->upbuf[rmtsh->upsink], n-1);
-                sendbuf.pos = n;
-                (*TC->s2ctx.sendBinary)(&TC->s2ctx, &sendbuf);
-                rmtsh->upsink += n-1;
-            } else {
-                LOG(WARNING, "No enough WS space to sent command");
-            }
-        } else {
-            // No connection - drop data
-            if( rmtsh->upfill >= UPBUFHI )
-                rmtsh->upsink  = UPBUFHI;
-        }
-        // Compaction required?
-        if( rmtsh->upfill >= UPBUFHI && rmtsh->upsink > 0 ) {
-            memcpy(&rmtsh->upbuf[0], &rmtsh->upbuf[rmtsh->upsink], rmtsh->upfill-rmtsh->upsink);
-            rmtsh->upfill -= rmtsh->upsink;
-            rmtsh->upsink = 0;
-        }
     }
 }
 
@@ -139,6 +206,24 @@ static void dn_write (aio_t* aio) {
 
 
 static void dn_fill (rmtsh_t* rmtsh, u1_t* data, int len) {
+    if( rmtsh->dnfill == rmtsh->dnsink ) {
+        // Nothing queued - write straight from the WS receive buffer and only keep the rest
+        rmtsh->dnfill = rmtsh->dnsink = 0;
+        int n = write(rmtsh->aio->fd, data, len);
+        if( n == -1 ) {
+            if( errno != EAGAIN ) {
+                stopRmtsh(rmtsh);
+                return;
+            }
+            n = 0;
+        }
+        if( n > 0 )
+            rmtsh->mtime = rt_getTime();
+        if( n == len )
+            return;
+        data += n;
+        len -= n;
+    }
     if( rmtsh->dnfill + len > DNBUFSZ ) {
         // Compact
         if( rmtsh->dnsink > 0 ) {
@@ -179,7 +264,7 @@ static void stopRmtsh (rmtsh_t* rmtsh) {
     rmtsh->pid = 0;
     aio_close(rmtsh->aio);
     rmtsh->aio = NULL;
-    rmtsh->upfill = rmtsh->upsink = 0;
+    rmtsh->paused = 0;
     rmtsh->dnfill = rmtsh->dnsink = 0;
 }
 
@@ -233,6 +318,8 @@ static void startRmtsh (rmtsh_t* rmtsh, str_t user, str_t term) {
     rmtsh->user = rt_strdup(user);
     rmtsh->mtime = rt_getTime();
     rmtsh->pid = rc;
+    if( resumeTmr.callback == NULL )
+        rt_iniTimer(&resumeTmr, resume_timeout);
     rmtsh->aio = aio_open(rmtsh, pty_master, up_read, NULL);
     up_read(rmtsh->aio);
     LOG(NOTICE, "Rmtsh#%d started (pid=%d)", (int)(rmtsh - rmtshTable), rmtsh->pid);
@@ -317,7 +404,7 @@ void s2e_handleRmtsh (s2ctx_t* s2ctx, ujdec_t* D) {
 }
 
 
-int s2e_onBinary (s2ctx_t* s2ctx, u1_t* data, ujoff_t len) {
+int s2e_handleRmtshData (s2ctx_t* s2ctx, u1_t* data, ujoff_t len) {
     if( len == 0 ) {
         return 1;
     }
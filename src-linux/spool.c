@@ -0,0 +1,232 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if !defined(CFG_no_spool)
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "s2conf.h"
+#include "s2e.h"
+#include "sys.h"
+
+
+// Uplink spool - store and forward RX frames while muxs is not reachable.
+//
+// The spool is a memory mapped file in the temp dir (~temp/station.spool).
+// It starts with a header followed by records appended back to back.
+// Records are consumed from the head. Once all records are replayed
+// head and tail are reset, so the segment is reused from the start.
+// The file survives restarts - records older than SPOOL_MAXAGE are discarded.
+
+#define SPOOL_MAGIC 0x4C4F5053  // "SPOL"
+
+typedef struct spoolhdr {
+    u4_t magic;
+    u4_t size;     // size of record area
+    u4_t head;     // oldest record
+    u4_t tail;     // append new records here
+    u4_t nrecs;    // records between head and tail
+    u4_t dropped;  // frames lost because spool was full or records too old
+} spoolhdr_t;
+
+typedef struct spoolrec {
+    sL_t rxutc;    // UTC when frame was received
+    sL_t xtime;
+    sL_t rctx;
+    s4_t fts;
+    u4_t freq;
+    u1_t rssi;
+    s1_t snr;
+    u1_t dr;
+    u1_t len;      // frame data follows record
+} spoolrec_t;
+
+#define SPOOL_RECSIZE(len) ((sizeof(spoolrec_t) + (len) + 7) & ~7)
+
+static spoolhdr_t* spool;
+static u1_t        spoolFailed;
+
+
+static void spool_reset (u4_t size) {
+    memset(spool, 0, sizeof(*spool));
+    spool->magic = SPOOL_MAGIC;
+    spool->size = size;
+}
+
+// Record at head is complete - header and frame data end before tail
+static int spool_headValid () {
+    u4_t avail = spool->tail - spool->head;
+    if( avail < sizeof(spoolrec_t) )
+        return 0;
+    const spoolrec_t* r = (const spoolrec_t*)((u1_t*)(spool+1) + spool->head);
+    return SPOOL_RECSIZE(r->len) <= avail;
+}
+
+// Walk all records - a torn write or corrupt file must not be replayed
+static int spool_valid () {
+    u4_t head = spool->head, n = 0;
+    while( spool->head < spool->tail ) {
+        if( !spool_headValid() )
+            break;
+        const spoolrec_t* r = (const spoolrec_t*)((u1_t*)(spool+1) + spool->head);
+        spool->head += SPOOL_RECSIZE(r->len);
+        n += 1;
+    }
+    int ok = spool->head == spool->tail && n == spool->nrecs;
+    spool->head = head;
+    return ok;
+}
+
+
+static int spool_open () {
+    if( spool )
+        return 1;
+    if( SPOOL_SIZE == 0 || spoolFailed )
+        return 0;
+    spoolFailed = 1;   // don't retry on errors
+    str_t fn = sys_makeFilepath("~temp/station.spool", 0);
+    int fd = open(fn, O_RDWR|O_CREAT|O_CLOEXEC, 0600);
+    if( fd < 0 ) {
+        LOG(MOD_S2E|ERROR, "Failed to open uplink spool '%s': %s", fn, strerror(errno));
+        rt_free((void*)fn);
+        return 0;
+    }
+    u4_t mapsz = sizeof(spoolhdr_t) + (SPOOL_SIZE & ~7);
+    void* p = MAP_FAILED;
+    if( ftruncate(fd, mapsz) == 0 )
+        p = mmap(NULL, mapsz, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if( p == MAP_FAILED ) {
+        LOG(MOD_S2E|ERROR, "Failed to map uplink spool '%s' (%u bytes): %s", fn, mapsz, strerror(errno));
+        rt_free((void*)fn);
+        return 0;
+    }
+    spool = p;
+    if( spool->magic != SPOOL_MAGIC || spool->size != mapsz - sizeof(spoolhdr_t) ||
+        spool->head > spool->tail || spool->tail > spool->size ) {
+        spool_reset(mapsz - sizeof(spoolhdr_t));
+    }
+    else if( !spool_valid() ) {
+        LOG(MOD_S2E|ERROR, "Uplink spool '%s' corrupt (%u frames claimed) - discarding it", fn, spool->nrecs);
+        spool_reset(mapsz - sizeof(spoolhdr_t));
+    }
+    else if( spool->nrecs ) {
+        LOG(MOD_S2E|INFO, "Uplink spool '%s' has %u frames pending", fn, spool->nrecs);
+    }
+    rt_free((void*)fn);
+    spoolFailed = 0;
+    return 1;
+}
+
+
+int s2e_spoolRxjobs (s2ctx_t* s2ctx) {
+    rxq_t* rxq = &s2ctx->rxq;
+    if( rxq_firstJob(rxq) == NULL || !spool_open() )
+        return 0;
+    u1_t* area = (u1_t*)(spool+1);
+    sL_t utcoff = rt_getUTC() - rt_getTime();
+    int n = 0;
+    rxjob_t* j;
+    while( (j = rxq_firstJob(rxq)) != NULL ) {
+        u4_t recsz = SPOOL_RECSIZE(j->len);
+        if( spool->tail + recsz > spool->size ) {
+            if( spool->dropped++ == 0 )
+                LOG(MOD_S2E|ERROR, "Uplink spool full (%u frames) - dropping frames", spool->nrecs);
+        } else {
+            spoolrec_t* r = (spoolrec_t*)&area[spool->tail];
+            r->rxutc = j->rxtime + utcoff;
+            r->xtime = j->xtime;
+            r->rctx  = j->rctx;
+            r->fts   = j->fts;
+            r->freq  = j->freq;
+            r->rssi  = j->rssi;
+            r->snr   = j->snr;
+            r->dr    = j->dr;
+            r->len   = j->len;
+            memcpy(r+1, &rxq->rxdata[j->off], j->len);
+            spool->tail += recsz;
+            spool->nrecs += 1;
+            n += 1;
+        }
+        rxq_popJob(rxq);
+    }
+    return n;
+}
+
+
+int s2e_unspoolRxjobs (s2ctx_t* s2ctx) {
+    if( !spool_open() || spool->nrecs == 0 )
+        return 0;
+    rxq_t* rxq = &s2ctx->rxq;
+    u1_t* area = (u1_t*)(spool+1);
+    ustime_t now = rt_getTime();
+    sL_t utcoff = rt_getUTC() - now;
+    int n = 0;
+    while( spool->nrecs > 0 ) {
+        if( !spool_headValid() ) {
+            LOG(MOD_S2E|ERROR, "Uplink spool corrupt at offset %u (%u frames left) - discarding it",
+                spool->head, spool->nrecs);
+            spool_reset(spool->size);
+            return n;
+        }
+        spoolrec_t* r = (spoolrec_t*)&area[spool->head];
+        if( r->rxutc - utcoff < now - SPOOL_MAXAGE ) {
+            spool->dropped += 1;
+        } else {
+            rxjob_t* j = rxq_nextJob(rxq);
+            if( j == NULL )
+                break;   // rxq full - continue when it was flushed
+            j->rxtime = r->rxutc - utcoff;
+            j->xtime  = r->xtime;
+            j->rctx   = r->rctx;
+            j->fts    = r->fts;
+            j->freq   = r->freq;
+            j->rssi   = r->rssi;
+            j->snr    = r->snr;
+            j->dr     = r->dr;
+            j->len    = r->len;
+            memcpy(&rxq->rxdata[j->off], r+1, r->len);
+            rxq_commitJob(rxq, j);
+            n += 1;
+        }
+        spool->head += SPOOL_RECSIZE(r->len);
+        spool->nrecs -= 1;
+    }
+    if( spool->nrecs == 0 ) {
+        if( spool->dropped )
+            LOG(MOD_S2E|WARNING, "Uplink spool replayed - %u frames lost (spool full or older than %~T)",
+                spool->dropped, SPOOL_MAXAGE);
+        spool->head = spool->tail = spool->dropped = 0;
+    }
+    return n;
+}
+
+#endif // !defined(CFG_no_spool)
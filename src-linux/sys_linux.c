@@ -37,6 +37,12 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
 
 #include "argp2.h"
 #include "s2conf.h"
@@ -46,10 +52,12 @@
 #include "s2e.h"
 #include "ral.h"
 #include "timesync.h"
+#include "trace.h"
 #include "sys.h"
 #include "sys_linux.h"
 #include "fs.h"
 #include "selftests.h"
+#include "benchmarks.h"
 
 extern char* makeFilepath (const char* prefix, const char* suffix, char** pCachedFile, int isReadable); // sys.c
 extern int writeFile (str_t file, const char* data, int datalen);
@@ -95,7 +103,10 @@ static str_t  radioDevice;
 static str_t  versionTxt;
 static char*  updfile;
 static char*  temp_updfile;
+static char*  traceFile;   // flight recorder dump - NULL until paths are final
 static int    updfd = -1;
+static u1_t*  updbuf;      // coalesce small HTTP chunks into large writes
+static int    updbufFill;
 
 static str_t  protoEuiSrc;
 static str_t  prefixEuiSrc;
@@ -115,6 +126,36 @@ static void handle_signal (int signum) {
     //_exit(128+signum);
 }
 
+// SIGUSR1 - dump flight recorder (e.g. kill -USR1 `cat ~temp/station.pid` from rmtsh/runcmd)
+static void handle_dumpTrace (int signum) {
+    int e = errno;
+    if( workerPid )
+        kill(workerPid, SIGUSR1);  // daemon supervisor - worker holds the trace
+    else
+        sys_dumpTrace(0);
+    errno = e;
+}
+
+// SA_RESETHAND restored the default action - deliver again to get the core dump/exit status
+static void handle_crash (int signum) {
+    sys_dumpTrace(signum);
+    raise(signum);
+}
+
+static void setupTraceSignals () {
+    static u1_t altstack[32*1024];   // crash handler must run on stack overflow
+    stack_t ss = { .ss_sp = altstack, .ss_size = sizeof(altstack) };
+    sigaltstack(&ss, NULL);
+    struct sigaction sa = { .sa_handler = handle_crash, .sa_flags = SA_ONSTACK|SA_RESETHAND };
+    sigemptyset(&sa.sa_mask);
+    static const int CRASH_SIGNALS[] = { SIGSEGV, SIGBUS, SIGFPE, SIGILL, SIGABRT };
+    for( int i=0; i < SIZE_ARRAY(CRASH_SIGNALS); i++ )
+        sigaction(CRASH_SIGNALS[i], &sa, NULL);
+    sa.sa_handler = handle_dumpTrace;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &sa, NULL);
+}
+
 
 
 static int updateDirSetting (str_t path, str_t source, str_t* pdir, str_t* psrc) {
@@ -308,9 +349,27 @@ str_t sys_radioDevice (str_t device) {
 
 
 void sys_fatal (int code) {
+    sys_dumpTrace(-1);
     exit(code==0 ? FATAL_GENERIC : code);
 }
 
+// Write flight recorder ring to ~temp/station.trace (station-N.trace for slaves).
+// Async signal safe - used by crash handlers. The daemon supervisor has nothing to dump.
+int sys_dumpTrace (int reason) {
+    if( traceFile == NULL || (daemonPid && daemonPid == getpid()) )
+        return 0;
+    int fd = open(traceFile, O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+    if( fd == -1 )
+        return 0;
+    trace_hdr_t h;
+    trace_header(&h, reason);
+    h.pid = getpid();
+    int ok = ( write(fd, &h, sizeof(h)) == sizeof(h) &&
+               write(fd, trace_ring, sizeof(trace_ring)) == sizeof(trace_ring) );
+    close(fd);
+    return ok;
+}
+
 static char* makePidFilename() {
     return makeFilepath("~temp/station",".pid",NULL,0);
 }
@@ -357,6 +416,122 @@ static void killOldPid () {
 
 
 
+// --------------------------------------------------------------------------------
+//
+// Realtime scheduling (RT_POLICY, RT_PRIORITY, RT_CPUS, RT_SLAVE_CPUS, RT_MLOCK)
+//
+// Applied to the main loop of the station process (not the daemon supervisor) and -
+// since slaves are the same executable reading the same station.conf - to each RAL
+// slave. Children forked afterwards (radio init, commands) start with normal
+// scheduling (SCHED_RESET_ON_FORK).
+// Helper threads (log, DNS, WS writer) inherit the settings and drop them again
+// right away by calling sys_normalThread.
+//
+// --------------------------------------------------------------------------------
+
+enum { RT_PREFAULT_STACK = 64*1024 };  // stack touched up front so the main loop does not page fault later
+
+static u1_t      rtSched;       // main loop runs with a realtime policy
+static u1_t      rtPinned;      // main loop is pinned - normalCpus has the original affinity
+static cpu_set_t normalCpus;
+
+
+// CPU list as in taskset -c: 0,2-3
+static int parseCpus (str_t spec, cpu_set_t* set) {
+    CPU_ZERO(set);
+    str_t p = spec;
+    while( *p ) {
+        sL_t lo = rt_readDec(&p), hi = lo;
+        if( lo < 0 )
+            return 0;
+        if( *p == '-' ) {
+            p++;
+            if( (hi = rt_readDec(&p)) < lo )
+                return 0;
+        }
+        if( hi >= CPU_SETSIZE )
+            return 0;
+        for( sL_t c=lo; c<=hi; c++ )
+            CPU_SET(c, set);
+        if( *p == ',' )
+            p++;
+        else if( *p )
+            return 0;
+    }
+    return CPU_COUNT(set) > 0;
+}
+
+
+static void prefaultStack () {
+    u1_t buf[RT_PREFAULT_STACK];
+    memset(buf, 0, sizeof(buf));
+    __asm__ volatile ("" : : "r"(buf) : "memory");  // keep the stores
+}
+
+
+static void setupRealtime (int isSlave) {
+    if( RT_MLOCK ) {
+#if defined(__GLIBC__)
+        // Keep freed heap memory mapped - returning it to the OS would fault it in again later
+        mallopt(M_TRIM_THRESHOLD, -1);
+        mallopt(M_MMAP_MAX, 0);
+#endif
+        int err = -1;
+#if defined(MCL_ONFAULT)
+        // Lock future mappings as they are touched - otherwise every thread stack is committed in full
+        err = mlockall(MCL_CURRENT|MCL_FUTURE|MCL_ONFAULT);
+#endif
+        if( err == -1 )
+            err = mlockall(MCL_CURRENT|MCL_FUTURE);  // kernel without MCL_ONFAULT
+        if( err == -1 ) {
+            LOG(MOD_SYS|WARNING, "RT_MLOCK: mlockall failed: %s", strerror(errno));
+        } else {
+            prefaultStack();
+            LOG(MOD_SYS|INFO, "RT_MLOCK: memory locked");
+        }
+    }
+    str_t cpus = isSlave && RT_SLAVE_CPUS[0] ? RT_SLAVE_CPUS : RT_CPUS;
+    if( cpus[0] ) {
+        cpu_set_t set;
+        if( !parseCpus(cpus, &set) ) {
+            LOG(MOD_SYS|ERROR, "RT_CPUS: illegal CPU list: %s", cpus);
+        } else if( sched_getaffinity(0, sizeof(normalCpus), &normalCpus) == -1 || sched_setaffinity(0, sizeof(set), &set) == -1 ) {
+            LOG(MOD_SYS|WARNING, "RT_CPUS: failed to pin to CPUs %s: %s", cpus, strerror(errno));
+        } else {
+            rtPinned = 1;
+            LOG(MOD_SYS|INFO, "RT_CPUS: pinned to CPUs %s", cpus);
+        }
+    }
+    if( RT_POLICY[0] ) {
+        int policy = strcmp(RT_POLICY, "fifo") == 0 ? SCHED_FIFO : strcmp(RT_POLICY, "rr") == 0 ? SCHED_RR : -1;
+        if( policy < 0 ) {
+            LOG(MOD_SYS|ERROR, "RT_POLICY: expecting fifo or rr: %s", RT_POLICY);
+            return;
+        }
+        struct sched_param sp = {
+            .sched_priority = max(sched_get_priority_min(policy), min(sched_get_priority_max(policy), (int)RT_PRIORITY))
+        };
+        if( sched_setscheduler(0, policy|SCHED_RESET_ON_FORK, &sp) == -1 ) {
+            LOG(MOD_SYS|WARNING, "RT_POLICY: failed to set %s priority %d (needs CAP_SYS_NICE): %s",
+                RT_POLICY, sp.sched_priority, strerror(errno));
+        } else {
+            rtSched = 1;
+            LOG(MOD_SYS|INFO, "RT_POLICY: %s priority %d", RT_POLICY, sp.sched_priority);
+        }
+    }
+}
+
+
+void sys_normalThread () {
+    if( rtSched ) {
+        struct sched_param sp = { .sched_priority = 0 };
+        pthread_setschedparam(pthread_self(), SCHED_OTHER, &sp);
+    }
+    if( rtPinned )
+        pthread_setaffinity_np(pthread_self(), sizeof(normalCpus), &normalCpus);
+}
+
+
 static void leds_off () {
     sys_inState(SYSIS_STATION_DEAD);
 }
@@ -445,25 +620,57 @@ str_t sys_version () {
 
 /* FW Update ************************************ */
 
+#define UPDBUF_SIZE (64*1024)
+
+static void updateFail (str_t what) {
+    LOG(MOD_SYS|ERROR, "Failed to %s '%s': %s", what, temp_updfile, strerror(errno));
+    close(updfd);
+    updfd = -1;
+}
+
+static void updateFlush () {
+    u1_t* p = updbuf;
+    int n = updbufFill;
+    updbufFill = 0;
+    while( n > 0 && updfd != -1 ) {
+        int err = write(updfd, p, n);
+        if( err == -1 ) {
+            if( errno == EINTR )
+                continue;
+            updateFail("write");
+            return;
+        }
+        p += err;
+        n -= err;
+    }
+}
+
 void sys_updateStart (int len) {
     close(updfd);
+    updbufFill = 0;
     if( len == 0 ) {
         updfd = -1;
         return;
     }
     makeFilepath("/tmp/update", ".bi_", &temp_updfile, 0);
     updfd = open(temp_updfile, O_CREAT|O_TRUNC|O_WRONLY, S_IRUSR|S_IWUSR|S_IXUSR|S_IRGRP|S_IXGRP);
-    if( updfd == -1 )
+    if( updfd == -1 ) {
         LOG(MOD_SYS|ERROR, "Failed to open '%s': %s", temp_updfile, strerror(errno));
+        return;
+    }
+    if( updbuf == NULL )
+        updbuf = rt_mallocN(u1_t, UPDBUF_SIZE);
 }
 
 void sys_updateWrite (u1_t* data, int off, int len) {
-    if( updfd == -1 ) return;
-    int err = write(updfd, data, len);
-    if( err == -1 ) {
-        LOG(MOD_SYS|ERROR, "Failed to write '%s': %s", temp_updfile, strerror(errno));
-        close(updfd);
-        updfd = -1;
+    while( len > 0 && updfd != -1 ) {
+        int n = min(len, UPDBUF_SIZE - updbufFill);
+        memcpy(updbuf + updbufFill, data, n);
+        updbufFill += n;
+        data += n;
+        len -= n;
+        if( updbufFill == UPDBUF_SIZE )
+            updateFlush();
     }
 }
 
@@ -471,6 +678,9 @@ int sys_updateCommit (int len) {
     // Rename file and start a process
     if( len == 0 )
         return 1;
+    updateFlush();
+    rt_free(updbuf);
+    updbuf = NULL;
     if( updfd == -1 ) {
         if( temp_updfile )
             unlink(temp_updfile);
@@ -501,10 +711,53 @@ void sys_abortUpdate () {
     sync();
 }
 
+static pid_t spawnCommand (int detach, str_t* argv);
+static int   waitCommand  (pid_t pid1, str_t cmd, ustime_t max_wait, int wmode);
+
+// Radio init started at process startup - runs while TC connects and
+// router_config is pending. Claimed by the first sys_runRadioInit.
+static pid_t    preInitPid;
+static char*    preInitDevice;
+static ustime_t preInitBeg;
+
+void sys_preRadioInit (str_t device) {
+    if( !radioInit || device == NULL || preInitPid > 0 )
+        return;
+    setenv("LORAGW_SPI", device, 1);
+    char buf[16];
+    str_t argv[4] = { radioInit, device, NULL, NULL };
+    if( sys_slaveIdx >= 0 ) {
+        snprintf(buf, sizeof(buf), "%d", sys_slaveIdx);
+        argv[2] = buf;
+    }
+    pid_t pid = spawnCommand(0, argv);
+    if( pid <= 0 )
+        return;
+    LOG(MOD_SYS|INFO, "Radio init started early: %s %s (pid=%d)", radioInit, device, pid);
+    preInitPid = pid;
+    preInitDevice = rt_strdup(device);
+    preInitBeg = rt_getTime();
+}
+
 int sys_runRadioInit (str_t device) {
     setenv("LORAGW_SPI", device, 1);   // for libloragw (SPI module)
     if( !radioInit )
         return 1;
+    if( preInitPid > 0 ) {
+        pid_t pid = preInitPid;
+        int same = strcmp(preInitDevice, device) == 0;
+        preInitPid = 0;
+        rt_free(preInitDevice);
+        preInitDevice = NULL;
+        // Reap early run - give it what is left of RADIO_INIT_WAIT since it was started
+        ustime_t left = max(RADIO_INIT_WAIT - (rt_getTime() - preInitBeg), rt_millis(1));
+        int err = waitCommand(pid, radioInit, left, WNOHANG);
+        if( same && err == 0 ) {
+            LOG(MOD_SYS|INFO, "Radio init already done - started %~T ago", rt_getTime() - preInitBeg);
+            return 1;
+        }
+        // Other device or early run failed - run again
+    }
     char buf[16];
     str_t argv[4] = { radioInit, device, NULL, NULL };
     if( sys_slaveIdx >= 0 ) {
@@ -515,16 +768,134 @@ int sys_runRadioInit (str_t device) {
 }
 
 
+// --------------------------------------------------------------------------------
+//
+// Command helper - detached commands (runcmd, updates) are started by a small
+// process forked at startup. Forking the station process itself copies the page
+// tables of all its buffers (and of locked memory) - stalling TX timing.
+// Requests go over a SOCK_SEQPACKET pair: one record per command, argv strings
+// each NUL terminated. The helper ignores SIGCHLD - finished commands are reaped
+// by the kernel. Commands inherit cwd/environment as of station startup.
+//
+// --------------------------------------------------------------------------------
+
+enum { CMDHELPER_RECSIZE = 4096 };
+
+static int cmdHelperFd = -1;   // station side of the socket pair - -1 if no helper
+
+static void cmdHelperMain (int fd) {
+    char rec[CMDHELPER_RECSIZE+1];
+    str_t argv[MAX_CMDARGS+2];
+    sys_normalThread();   // drop pinning - realtime policy is not inherited (SCHED_RESET_ON_FORK)
+    signal(SIGINT,  SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+    signal(SIGCHLD, SIG_IGN);
+    traceFile = NULL;   // crash/SIGUSR1 dumps are the station's - not this process
+    while(1) {
+        ssize_t n = recv(fd, rec, CMDHELPER_RECSIZE, 0);
+        if( n == -1 && errno == EINTR )
+            continue;
+        if( n <= 0 )
+            _exit(0);   // station gone - don't run its atexit handlers
+        rec[n] = 0;
+        int argc = 0;
+        for( int i=0; i < n && argc <= MAX_CMDARGS; argc++ ) {
+            argv[argc] = &rec[i];
+            i += strlen(&rec[i]) + 1;
+        }
+        argv[argc] = NULL;
+        if( argc > 0 )
+            spawnCommand(0, argv);
+    }
+}
+
+static int startCmdHelper () {
+    int sv[2];
+    if( socketpair(AF_UNIX, SOCK_SEQPACKET|SOCK_CLOEXEC, 0, sv) == -1 ) {
+        LOG(MOD_SYS|ERROR, "Command helper: socketpair failed: %s", strerror(errno));
+        return 0;
+    }
+    sys_flushLog();
+    pid_t pid = fork();
+    if( pid == 0 ) {
+        close(sv[0]);
+        cmdHelperMain(sv[1]);
+        // NOT REACHED
+    }
+    close(sv[1]);
+    if( pid < 0 ) {
+        LOG(MOD_SYS|ERROR, "Command helper: fork failed: %s", strerror(errno));
+        close(sv[0]);
+        return 0;
+    }
+    cmdHelperFd = sv[0];
+    LOG(MOD_SYS|DEBUG, "Command helper started (pid=%d)", pid);
+    return 1;
+}
+
+// Hand a detached command to the helper - never blocks. Returns 0 if the command must be spawned directly.
+static int queueCommand (str_t* argv) {
+    char rec[CMDHELPER_RECSIZE];
+    int len = 0;
+    for( int i=0; argv[i]; i++ ) {
+        int k = strlen(argv[i]) + 1;
+        if( len + k > sizeof(rec) ) {
+            LOG(MOD_SYS|ERROR, "%s: Command line too long for command helper", argv[0]);
+            return 0;
+        }
+        memcpy(rec+len, argv[i], k);
+        len += k;
+    }
+    if( cmdHelperFd < 0 )
+        return 0;
+    if( send(cmdHelperFd, rec, len, MSG_DONTWAIT|MSG_NOSIGNAL) == len ) {
+        LOG(MOD_SYS|VERBOSE, "%s: Queued to command helper", argv[0]);
+        return 1;
+    }
+    if( errno == EAGAIN ) {
+        LOG(MOD_SYS|ERROR, "%s: Command helper busy", argv[0]);
+        return 0;
+    }
+    // Helper died - don't restart it: forking the grown station process is what the helper
+    // avoids, and a fork while other threads hold locks (e.g. log) can deadlock the child.
+    LOG(MOD_SYS|WARNING, "Command helper gone (%s) - spawning commands directly from now on", strerror(errno));
+    close(cmdHelperFd);
+    cmdHelperFd = -1;
+    return 0;
+}
+
+
 int sys_execCommand (ustime_t max_wait, str_t* argv) {
     int argc = 0;
     while( argv[argc] ) argc++;
     if( argc == 0 || (argc==1 && argv[0][0]==0) )
         return 0;
+    if( max_wait == 0 && queueCommand(argv) )
+        return 0;
+    pid_t pid1 = spawnCommand(max_wait==0, argv);
+    if( pid1 < 0 )
+        return -1;
+    LOG(MOD_SYS|VERBOSE, "%s: Forked, waiting...", argv[0]);
+    log_flushIO();
+    int wmode = WNOHANG;
+    if( max_wait == 0 ) {       // detached child forks a grand child - child exits
+        max_wait = USTIME_MAX;  // basically forever
+        wmode = 0;
+    }
+    return waitCommand(pid1, argv[0], max_wait, wmode);
+}
+
+
+// Fork a child running argv - if detach the child forks the actual command and exits right away.
+static pid_t spawnCommand (int detach, str_t* argv) {
+    int argc = 0;
+    while( argv[argc] ) argc++;
     sys_flushLog();
     pid_t pid1;
     if( (pid1 = fork()) == 0 ) {
         pid_t pid2 = 0;
-        if( max_wait!=0 || (pid2 = fork()) == 0 ) {
+        signal(SIGCHLD, SIG_DFL);  // command helper ignores it - dispositions survive exec
+        if( !detach || (pid2 = fork()) == 0 ) {
             if( access(argv[0], X_OK) != 0 ) {
                 // Not an executable file
                 str_t* argv2 = rt_mallocN(str_t, argc+3);
@@ -559,44 +930,42 @@ int sys_execCommand (ustime_t max_wait, str_t* argv) {
         LOG(MOD_SYS|ERROR, "%s: Fork failed: %s", argv[0], strerror(errno));
         return -1;
     }
-    LOG(MOD_SYS|VERBOSE, "%s: Forked, waiting...", argv[0]);
-    log_flushIO();
-    int wmode = WNOHANG;
-    if( max_wait == 0 ) {       // detached child forks a grand child - child exits
-        max_wait = USTIME_MAX;  // basically forever
-        wmode = 0;
-    }
+    return pid1;
+}
+
+
+static int waitCommand (pid_t pid1, str_t cmd, ustime_t max_wait, int wmode) {
     for( ustime_t u=0; u < max_wait; u+=rt_millis(1) ) {
         int status = 0;
         int err = waitpid(pid1, &status, wmode);
         if( err == -1 ) {
-            LOG(MOD_SYS|ERROR, "Process %s (pid=%d) - waitpid failed: %s", argv[0], pid1, strerror(errno));
+            LOG(MOD_SYS|ERROR, "Process %s (pid=%d) - waitpid failed: %s", cmd, pid1, strerror(errno));
             return -1;
         }
         if( err == pid1 ) {
             if( WIFEXITED(status) ) {
                 int xcode = WEXITSTATUS(status);
                 if( xcode == 0 ) {
-                    LOG(MOD_SYS|INFO, "Process %s (pid=%d) completed", argv[0], pid1);
+                    LOG(MOD_SYS|INFO, "Process %s (pid=%d) completed", cmd, pid1);
                     log_flushIO();
                     return 0;
                 }
-                LOG(MOD_SYS|ERROR, "Process %s (pid=%d) failed with exit code %d", argv[0], pid1, xcode);
+                LOG(MOD_SYS|ERROR, "Process %s (pid=%d) failed with exit code %d", cmd, pid1, xcode);
                 return xcode;
             }
             if( WIFSIGNALED(status) ) {
                 int signo = WTERMSIG(status);
-                LOG(MOD_SYS|ERROR, "Process %s (pid=%d) terminated by signal %d", argv[0], pid1, signo);
+                LOG(MOD_SYS|ERROR, "Process %s (pid=%d) terminated by signal %d", cmd, pid1, signo);
                 return -2;
             }
-            LOG(MOD_SYS|ERROR, "Process %s (pid=%d) with strange exit state 0x%X", argv[0], pid1, status);
+            LOG(MOD_SYS|ERROR, "Process %s (pid=%d) with strange exit state 0x%X", cmd, pid1, status);
             return -4;
         }
         rt_usleep(rt_millis(2));
     }
     kill(pid1, SIGTERM);
     LOG(MOD_SYS|ERROR, "Process %s (pid=%d) did not terminate within %ldms - killing it (SIGTERM)",
-        argv[0], pid1, max_wait/1000);
+        cmd, pid1, max_wait/1000);
     return -3;
 }
 
@@ -815,6 +1184,7 @@ static struct argp_option options[] = {
     },
     { "log-level", 'l', "LVL|0..7", 0,
       ("Set a log level LVL=#loglvls# or use a numeric value. "
+       "Append /N to limit a module to N lines per second. "
        "Overrides environment STATION_LOGLEVEL.")
     },
     { "home", 'h', "DIR", 0,
@@ -984,6 +1354,9 @@ struct argp argp = { options, parse_opt, "", NULL, NULL, NULL, NULL };
 
 
 static void startupMaster2 (tmr_t* tmr) {
+    rt_addFeature("upbatch");
+    rt_addFeature("dnbatch");
+    rt_addFeature("binmsg");
 #if !defined(CFG_no_rmtsh)
     rt_addFeature("rmtsh");
 #endif
@@ -1003,20 +1376,26 @@ static void startupMaster2 (tmr_t* tmr) {
 }
 
 static void startupMaster (tmr_t* tmr) {
+    setupRealtime(0);   // daemon supervisor stays at normal priority
+    startCmdHelper();   // fork while the process is small - before the log thread exists
     sys_startLogThread();
     if( getenv("STATION_SELFTESTS") ) {
         selftests();
         // NOT REACHED
     }
+    if( getenv("STATION_BENCHMARKS") ) {
+        benchmarks();
+        // NOT REACHED
+    }
     // Kill off any old processes - create a file with my pid
     writePid();
     // If there is an update pending - run it
     sys_runUpdate();
     ral_ini();
     atexit(leds_off);
-    // Wait until slaves are up
-    //startupMaster2(tmr);
-    rt_setTimerCb(tmr, rt_millis_ahead(200), startupMaster2);
+    // Connect to TC right away - radio/slaves come up while INFOS/MUXS handshakes
+    // are in flight and the radio config is only needed once router_config arrives.
+    rt_yieldTo(tmr, startupMaster2);
 }
 
 
@@ -1067,6 +1446,7 @@ int sys_main (int argc, char** argv) {
     signal(SIGHUP,  SIG_IGN);
     signal(SIGINT,  handle_signal);
     signal(SIGTERM, handle_signal);
+    setupTraceSignals();
 
     char cwd[MAX_FILEPATH_LEN];
     if( getcwd(cwd, sizeof(cwd)) != NULL )
@@ -1232,6 +1612,7 @@ int sys_main (int argc, char** argv) {
     // }
 
     setupConfigFilenames();
+    makeFilepath("~temp/station#", ".trace", &traceFile, 0);
     checkRollForward();
     if( !checkUris() )
         return 1;
@@ -1255,6 +1636,21 @@ int sys_main (int argc, char** argv) {
         setsid();
     }
 
+#if defined(CFG_simclock)
+    str_t simclock = getenv("STATION_SIMCLOCK");
+    if( simclock ) {
+        // Value is the real time in ms granted to pending I/O before idle time is skipped
+        str_t p = simclock;
+        sL_t quantum = simclock[0] ? rt_readDec(&p) : 1;
+        if( quantum < 0 || *p )
+            rt_fatal("STATION_SIMCLOCK has illegal value: %s", simclock);
+#if defined(CFG_ral_master_slave)
+        LOG(MOD_SYS|WARNING, "STATION_SIMCLOCK ignored - slave processes would not share simulated time");
+#else // !defined(CFG_ral_master_slave)
+        rt_simClock(sys_time(), rt_millis(quantum));
+#endif // !defined(CFG_ral_master_slave)
+    }
+#endif // defined(CFG_simclock)
     aio_ini();
     sys_iniLogging(&logfile, !isSlave && !daemon);
     sys_ini();
@@ -1263,6 +1659,7 @@ int sys_main (int argc, char** argv) {
 
 #if defined(CFG_ral_master_slave)
     if( isSlave ) {
+        setupRealtime(1);
         sys_startupSlave(slave_rdfd, slave_wrfd);
         // NOT REACHED
         assert(0);
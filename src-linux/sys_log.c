@@ -34,31 +34,46 @@
 #include <unistd.h>
 #include <errno.h>
 #include <pthread.h>
+#include <semaphore.h>
 #include <sys/stat.h>
+#include <time.h>
 #include "rt.h"
+#include "s2conf.h"
 #include "sys.h"
 #include "sys_linux.h"
 
 
 #define LOG_LAG         100  // millis
-#define LOG_OUTSIZ     8192
-#define LOG_HIGHWATER (LOG_OUTSIZ/2)
+#define LOG_RINGSIZ   16384  // power of 2
+#define LOG_HIGHWATER (LOG_RINGSIZ/2)
+#define LOG_REC_COMMIT 0x80000000
+#define LOG_REC_BINARY 0x40000000  // deferred record - see log_fmtRecord
 #define MAX_LOGHDR      64
+#define LOG_RECHECK_INTV rt_seconds(2)  // stat log file at most this often
 
 static struct logfile* logfile;
 
-static tmr_t delay;               // wait until we flush
-static char  outbuf[LOG_OUTSIZ];  // buffer output
-static int   outfill = 0;         // write index
+// Multi producer / single consumer ring of log records.
+// Producers reserve space by advancing rhead (CAS), copy their data and then
+// publish the record by setting the commit bit in its 4 byte header.
+// The consumer (log thread or sys_flushLog - serialized by mxwrite) copies
+// committed records into outbuf, zeroes the consumed ring space and advances rtail.
+// If the ring is full, records are dropped and counted - never truncated.
+static u1_t  ring[LOG_RINGSIZ] __attribute__((aligned(4)));
+static u4_t  rhead;               // next record reserved here (free running)
+static u4_t  rtail;               // oldest record not yet consumed (free running)
+static u4_t  dropped;             // records dropped since last report
+static u4_t  droppedBytes;
+static char  outbuf[LOG_RINGSIZ+LOGLINE_LEN];  // consumer copies/formats records here
+static u1_t  recbuf[LOGLINE_LEN];               // consumer copy of a deferred record
 
 static aio_t* stdout_aio;         //
 static char   stdout_buf[MAX_LOGHDR+PIPE_BUF];
 static int    stdout_idx = MAX_LOGHDR;
 
 
-static pthread_mutex_t  mxfill  = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t  mxcond  = PTHREAD_MUTEX_INITIALIZER;
-static pthread_cond_t   condvar = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t  mxwrite = PTHREAD_MUTEX_INITIALIZER;  // one consumer at a time
+static sem_t            logsem;   // ring became non-empty or crossed high water
 static pthread_t        thr;
 static int              thrUp = 0;
 
@@ -115,6 +130,68 @@ static void stdout_read(aio_t* aio) {
 }
 
 
+// Log file stays open - size is tracked from our own writes.
+// The file is re-checked once in a while in case another process (slaves,
+// logrotate) appended to it or moved it away.
+static int      logfd = -1;
+static sL_t     logsize;         // current size of log file
+static ustime_t logchecked;      // last time file was stat'ed
+static ustime_t logsynced;       // last fdatasync
+
+static void closeLogFile () {
+    if( logfd >= 0 )
+        close(logfd);
+    logfd = -1;
+}
+
+static void rotateLogFile () {
+    struct stat st;
+    int flen = strlen(logfile->path);
+    char fn[flen + 15];
+    struct timespec min_ctim;
+    int logfno = -1;
+    strcpy(fn, logfile->path);
+    for( int i=0; i<logfile->rotate; i++ ) {
+        snprintf(fn+flen, 15, ".%d", i);
+        if( stat(fn, &st) == -1 ) {
+            if( errno != ENOENT )
+                fprintf(stderr,"Failed to stat log file %s: %s\n", fn, strerror(errno));
+            logfno = i;
+            break;
+        }
+        if( logfno < 0 || min_ctim.tv_sec > st.st_ctim.tv_sec ) {
+            min_ctim.tv_sec = st.st_ctim.tv_sec;
+            logfno = i;
+        }
+    }
+    if( unlink(fn) == -1 && errno != ENOENT )
+        fprintf(stderr,"Failed to unlink log file %s: %s\n", fn, strerror(errno));
+    if( rename(logfile->path, fn) == -1 ) {
+        fprintf(stderr,"Failed to rename log file %s => %s: %s\n", logfile->path, fn, strerror(errno));
+        if( unlink(logfile->path) == -1 )
+            fprintf(stderr,"Failed to unlink log file %s: %s\n", logfile->path, strerror(errno));
+    }
+}
+
+static int checkLogFile (ustime_t now) {
+    struct stat st = { .st_size = 0 };
+    if( stat(logfile->path, &st) == -1 ) {
+        if( errno != ENOENT ) {
+            fprintf(stderr,"Failed to stat log file %s: %s\n", logfile->path, strerror(errno));
+            return 0;
+        }
+        closeLogFile();   // moved away - start a new one
+    }
+    else if( logfd >= 0 ) {
+        struct stat fst;
+        if( fstat(logfd, &fst) == -1 || fst.st_ino != st.st_ino || fst.st_dev != st.st_dev )
+            closeLogFile();   // path now refers to another file
+    }
+    logsize = st.st_size;
+    logchecked = now;
+    return 1;
+}
+
 static void writeLogData (const char *data, int len) {
     if( !logfile || !logfile->path ) {
       log2stderr:
@@ -122,99 +199,158 @@ static void writeLogData (const char *data, int len) {
             sys_fatal(FATAL_NOLOGGING);
         return;
     }
-    struct stat st = { .st_size = 0 };
-    if( stat(logfile->path, &st) == -1 && errno != ENOENT ) {
-        fprintf(stderr,"Failed to stat log file %s: %s\n", logfile->path, strerror(errno));
+    ustime_t now = rt_getTime();
+    if( (logfd < 0 || logsize >= logfile->size || now - logchecked >= LOG_RECHECK_INTV) && !checkLogFile(now) )
         goto log2stderr;
+    if( logsize >= logfile->size ) {
+        closeLogFile();
+        rotateLogFile();
+        logsize = 0;
     }
-    if( st.st_size >= logfile->size ) {
-        int flen = strlen(logfile->path);
-        char fn[flen + 15];
-        struct timespec min_ctim;
-        int logfno = -1;
-        strcpy(fn, logfile->path);
-        for( int i=0; i<logfile->rotate; i++ ) {
-            snprintf(fn+flen, 15, ".%d", i);
-            if( stat(fn, &st) == -1 ) {
-                if( errno != ENOENT )
-                    fprintf(stderr,"Failed to stat log file %s: %s\n", fn, strerror(errno));
-                logfno = i;
-                break;
-            }
-            if( logfno < 0 || min_ctim.tv_sec > st.st_ctim.tv_sec ) {
-                min_ctim.tv_sec = st.st_ctim.tv_sec;
-                logfno = i;
-            }
-        }
-        if( unlink(fn) == -1 && errno != ENOENT )
-            fprintf(stderr,"Failed to unlink log file %s: %s\n", fn, strerror(errno));
-        if( rename(logfile->path, fn) == -1 ) {
-            fprintf(stderr,"Failed to rename log file %s => %s: %s\n", logfile->path, fn, strerror(errno));
-            if( unlink(logfile->path) == -1 )
-                fprintf(stderr,"Failed to unlink log file %s: %s\n", logfile->path, strerror(errno));
+    if( logfd < 0 ) {
+        logfd = open(logfile->path, O_CREAT|O_APPEND|O_WRONLY|O_CLOEXEC, S_IRUSR|S_IWUSR|S_IRGRP);
+        if( logfd == -1 ) {
+            fprintf(stderr,"Failed to open log file %s: %s\n", logfile->path, strerror(errno));
+            goto log2stderr;
         }
     }
-    int fd = open(logfile->path, O_CREAT|O_APPEND|O_WRONLY, S_IRUSR|S_IWUSR|S_IRGRP);
-    if( fd == -1 ) {
-        fprintf(stderr,"Failed to open log file %s: %s\n", logfile->path, strerror(errno));
-        goto log2stderr;
-    }
     int n;
-    if( (n = write(fd, data, len)) != len ) {
+    if( (n = write(logfd, data, len)) != len ) {
         fprintf(stderr,"Partial write to log file %s: %s\n", logfile->path, strerror(errno));
-        close(fd);
+        closeLogFile();
         goto log2stderr;
     }
-    close(fd);
+    logsize += n;
+    if( LOG_SYNC_INTV && now - logsynced >= LOG_SYNC_INTV ) {
+        fdatasync(logfd);
+        logsynced = now;
+    }
 }
 
 
+static void ringCopy (u4_t pos, void* dst, const void* src, int len, int in) {
+    u4_t off = pos & (LOG_RINGSIZ-1);
+    int k = min(len, LOG_RINGSIZ-(int)off);
+    if( in ) {
+        memcpy(&ring[off], src, k);
+        memcpy(&ring[0], (const u1_t*)src+k, len-k);
+    } else {
+        memcpy(dst, &ring[off], k);
+        memcpy((u1_t*)dst+k, &ring[0], len-k);
+    }
+}
+
+static int ringPut (const void* data, int len, u4_t flags) {
+    u4_t need = 4 + ((len+3) & ~3);
+    u4_t h = __atomic_load_n(&rhead, __ATOMIC_RELAXED);
+    u4_t t;
+    do {
+        t = __atomic_load_n(&rtail, __ATOMIC_ACQUIRE);
+        if( h + need - t > LOG_RINGSIZ ) {
+            __atomic_add_fetch(&dropped, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&droppedBytes, len, __ATOMIC_RELAXED);
+            sem_post(&logsem);
+            return 0;
+        }
+    } while( !__atomic_compare_exchange_n(&rhead, &h, h+need, 1, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED) );
+    ringCopy(h+4, NULL, data, len, 1);
+    __atomic_store_n((u4_t*)&ring[h & (LOG_RINGSIZ-1)], (u4_t)len | flags | LOG_REC_COMMIT, __ATOMIC_RELEASE);
+    // Wake consumer if ring was empty or just crossed high water
+    if( h == t || (h - t < LOG_HIGHWATER && h + need - t >= LOG_HIGHWATER) )
+        sem_post(&logsem);
+    return 1;
+}
+
 static void addLog (const char *logline, int len) {
     if( !thrUp ) {
         writeLogData(logline, len);
         return;
     }
-    pthread_mutex_lock(&mxfill);
-    int k = min(LOG_OUTSIZ-outfill, len);
-    memcpy(outbuf + outfill, logline, k);
-    outfill += k;
-    int notify = (len == 0 || outfill >= LOG_HIGHWATER);
-    pthread_mutex_unlock(&mxfill);
-    if( notify ) {
-        pthread_cond_signal(&condvar);
-    } else if( delay.next == TMR_NIL ) {
-        // Delay timer not running
-        rt_setTimer(&delay, rt_millis_ahead(LOG_LAG));
+    if( len == 0 ) {
+        sem_post(&logsem);
+        return;
     }
+    ringPut(logline, len, 0);
 }
 
 
-static void on_delay (tmr_t* tmr) {
-    pthread_mutex_lock(&mxfill);
-    if( outfill )
-        pthread_cond_signal(&condvar);
-    pthread_mutex_unlock(&mxfill);
+int sys_addLogRecord (const u1_t* rec, int len) {
+    if( !thrUp || len > sizeof(recbuf) )
+        return 0;
+    ringPut(rec, len, LOG_REC_BINARY);
+    return 1;   // even if dropped - counted
 }
 
 
-static void thread_log (void) {
-    pthread_mutex_lock(&mxcond);
+// Consume committed records and write them out - caller holds mxwrite.
+// Returns 1 if an uncommitted record stopped the drain.
+static int drainLog () {
+    int busy = 0;
     while(1) {
-        pthread_cond_wait(&condvar, &mxcond);
-        pthread_mutex_lock(&mxfill);
-        int len = outfill;
-        pthread_mutex_unlock(&mxfill);
-        if( len ) {
-            writeLogData(outbuf, len);
-            pthread_mutex_lock(&mxfill);
-            if( len < outfill ) {
-                memcpy(&outbuf[0], &outbuf[len], outfill-len);
-                outfill -= len;
+        u4_t t = rtail;
+        u4_t h = __atomic_load_n(&rhead, __ATOMIC_ACQUIRE);
+        int fill = 0;
+        u4_t ndrop = __atomic_exchange_n(&dropped, 0, __ATOMIC_RELAXED);
+        if( ndrop ) {
+            u4_t nbytes = __atomic_exchange_n(&droppedBytes, 0, __ATOMIC_RELAXED);
+            fill = snprintf(outbuf, 128, "---- %u log messages dropped (%u bytes) - log buffer full\n", ndrop, nbytes);
+        }
+        while( t != h ) {
+            u4_t hdr = __atomic_load_n((u4_t*)&ring[t & (LOG_RINGSIZ-1)], __ATOMIC_ACQUIRE);
+            if( !(hdr & LOG_REC_COMMIT) ) {
+                busy = 1;   // producer still copying
+                break;
+            }
+            int len = hdr & ~(LOG_REC_COMMIT|LOG_REC_BINARY);
+            u4_t need = 4 + ((len+3) & ~3);
+            if( hdr & LOG_REC_BINARY ) {
+                if( fill + LOGLINE_LEN > sizeof(outbuf) )
+                    break;  // write what we have first
+                ringCopy(t+4, recbuf, NULL, len, 0);
+                fill += log_fmtRecord(outbuf+fill, LOGLINE_LEN, recbuf, len);
             } else {
-                outfill = 0;
+                ringCopy(t+4, outbuf+fill, NULL, len, 0);
+                fill += len;
             }
-            pthread_mutex_unlock(&mxfill);
+            // Zero consumed space - headers of future records must read as uncommitted
+            u4_t off = t & (LOG_RINGSIZ-1);
+            int k = min((int)need, LOG_RINGSIZ-(int)off);
+            memset(&ring[off], 0, k);
+            memset(&ring[0], 0, need-k);
+            t += need;
         }
+        if( fill == 0 )
+            return busy;
+        __atomic_store_n(&rtail, t, __ATOMIC_RELEASE);
+        writeLogData(outbuf, fill);
+        if( busy )
+            return busy;
+        // Loop - more records might be pending if outbuf was full
+    }
+}
+
+
+static void thread_log (void) {
+    sys_normalThread();
+    while(1) {
+        if( sem_wait(&logsem) == -1 )
+            continue;  // EINTR
+        // Give producers some time to fill in more - cut short by high water/drop posts
+        u4_t fill = __atomic_load_n(&rhead, __ATOMIC_ACQUIRE) - __atomic_load_n(&rtail, __ATOMIC_ACQUIRE);
+        if( fill < LOG_HIGHWATER ) {
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += LOG_LAG*1000000;
+            if( ts.tv_nsec >= 1000000000 ) {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000;
+            }
+            sem_timedwait(&logsem, &ts);
+        }
+        pthread_mutex_lock(&mxwrite);
+        while( drainLog() )
+            usleep(1000);
+        pthread_mutex_unlock(&mxwrite);
     }
 }
 
@@ -222,12 +358,14 @@ static void thread_log (void) {
 void sys_flushLog (void) {
     fflush(stdout);
     fflush(stderr);
-    pthread_mutex_lock(&mxcond);
-    pthread_mutex_lock(&mxfill);
-    writeLogData(outbuf, outfill);
-    outfill = 0;
-    pthread_mutex_unlock(&mxfill);
-    pthread_mutex_unlock(&mxcond);
+    pthread_mutex_lock(&mxwrite);
+    if( thrUp ) {
+        for( int i=0; i<100 && drainLog(); i++ )
+            usleep(1000);
+    }
+    if( LOG_SYNC_INTV && logfd >= 0 )
+        fdatasync(logfd);
+    pthread_mutex_unlock(&mxwrite);
 }
 
 
@@ -276,9 +414,9 @@ void sys_iniLogging (struct logfile* lf, int captureStdio) {
 
 void sys_startLogThread () {
     if( !thrUp ) {
+        sem_init(&logsem, 0, 0);
         if( pthread_create(&thr, NULL, (void * (*)(void *))thread_log, NULL) != 0 )
             sys_fatal(FATAL_PTHREAD);
-        rt_iniTimer(&delay, on_delay);
         thrUp = 1;
     }
 }
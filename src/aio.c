@@ -30,12 +30,62 @@
 #include <time.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
 #include "rt.h"
+#include "s2conf.h"
+#include "metrics.h"
+#include "trace.h"
 
+#if defined(CFG_simclock)
+#define SIMCLOCK (rt_simTime != 0)   // timerfd runs on system time - not armed while simulating
+#else // !defined(CFG_simclock)
+#define SIMCLOCK 0
+#endif // !defined(CFG_simclock)
 
+// Wakeup delay of the loop past the timer deadline it slept for - includes
+// scheduling latency of this thread (see RT_POLICY) and timeout rounding.
+static inline void obsSchedLat (ustime_t due) {
+    if( due == USTIME_MAX || SIMCLOCK )
+        return;
+    ustime_t now = rt_getTime();
+    if( now >= due )
+        metric_obs(MH_sched_lat, now - due);
+    if( PROF_STALL > 0 && now - due > PROF_STALL )
+        trace_rec(now, TRACE_SCHEDLAT, 0, 0, trace_clamp(now - due), 0);
+}
+
+
+#if defined(CFG_epoll)
+#include <sys/epoll.h>
+
+// Interest is registered incrementally - loop cost scales with ready fds only
+enum { N_AIO_HANDLES = 32 };
+static int  epollFD;
+static u4_t aioEvents[N_AIO_HANDLES];  // interest currently registered with epoll
+#else // !defined(CFG_epoll)
 enum { N_AIO_HANDLES = 10 };
+#endif // !defined(CFG_epoll)
 static aio_t aioHandles[N_AIO_HANDLES];
 
+#if defined(CFG_epoll)
+// Bring epoll interest in line with rdfn/wrfn - only touches the kernel on change.
+// An fd without any callbacks is removed entirely so that HUP/ERR conditions
+// do not wake up the loop for nothing.
+static void aio_update (aio_t* aio) {
+    int  i  = aio - aioHandles;
+    u4_t ev = (aio->rdfn ? EPOLLIN : 0) | (aio->wrfn ? EPOLLOUT : 0);
+    if( ev == aioEvents[i] )
+        return;
+    struct epoll_event e = { .events = ev, .data.u64 = ((uL_t)(u4_t)aio->fd << 32) | i };
+    int op = aioEvents[i] == 0 ? EPOLL_CTL_ADD : ev == 0 ? EPOLL_CTL_DEL : EPOLL_CTL_MOD;
+    if( epoll_ctl(epollFD, op, aio->fd, &e) == -1 ) {
+        LOG(MOD_AIO|ERROR, "epoll_ctl(op=%d, fd=%d) failed: %s", op, aio->fd, strerror(errno));
+        return;
+    }
+    aioEvents[i] = ev;
+}
+#endif // defined(CFG_epoll)
+
 
 // There aren't that many fd open thus recalc every time we go into select
 //int aio_maxfd;
@@ -54,6 +104,9 @@ aio_t* aio_open(void* ctx, int fd, aiofn_t rdfn, aiofn_t wrfn) {
             if( (flags = fcntl(fd, F_GETFD, 0)) == -1 ||
                 fcntl(fd, F_SETFD, flags|FD_CLOEXEC) == -1 )
                 LOG(MOD_AIO|ERROR, "fcntl(fd, F_SETFD, FD_CLOEXEC) failed: %s", strerror(errno));
+#if defined(CFG_epoll)
+            aio_update(&aioHandles[i]);
+#endif // defined(CFG_epoll)
             return &aioHandles[i];
         }
     }
@@ -74,11 +127,18 @@ aio_t* aio_fromCtx(void* ctx) {
 void aio_close (aio_t* aio) {
     if( aio == NULL )
         return;
+    assert(aio >= aioHandles && aio < &aioHandles[N_AIO_HANDLES]);
+#if defined(CFG_epoll)
+    if( aioEvents[aio-aioHandles] ) {
+        aio->rdfn = aio->wrfn = NULL;
+        aio_update(aio);
+        aioEvents[aio-aioHandles] = 0;
+    }
+#endif // defined(CFG_epoll)
     if( aio->fd >= 0 ) {
         close(aio->fd);
         aio->fd = -1;
     }
-    assert(aio >= aioHandles && aio < &aioHandles[N_AIO_HANDLES]);
     memset(aio, 0, sizeof(*aio));
 }
 
@@ -86,12 +146,18 @@ void aio_close (aio_t* aio) {
 void aio_set_rdfn (aio_t* aio, aiofn_t rdfn) {
     assert(aio->ctx != NULL && aio->fd >= 0);
     aio->rdfn = rdfn;
+#if defined(CFG_epoll)
+    aio_update(aio);
+#endif // defined(CFG_epoll)
 }
 
 
 void aio_set_wrfn (aio_t* aio, aiofn_t wrfn) {
     assert(aio->ctx != NULL && aio->fd >= 0);
     aio->wrfn = wrfn;
+#if defined(CFG_epoll)
+    aio_update(aio);
+#endif // defined(CFG_epoll)
 }
 
 
@@ -102,19 +168,102 @@ static int timerFD;
 #endif // CFG_timerfd
 
 
+#if defined(CFG_epoll)
+enum { EPOLL_TIMERFD = ~0 };  // epoll data tag of timerFD
+
+void aio_loop () {
+    struct epoll_event events[N_AIO_HANDLES+1];
+    while(1) {
+        int n;
+        ustime_t due;
+        do {
+            int timeout = -1;
+            due = USTIME_MAX;
+#if defined(CFG_timerfd)
+            ustime_t deadline = due = rt_processTimerQ();
+            if( deadline != USTIME_MAX && !SIMCLOCK ) {
+                struct itimerspec spec;
+                memset(&spec, 0, sizeof(spec));
+                spec.it_value.tv_sec = deadline / rt_seconds(1);
+                spec.it_value.tv_nsec = (deadline % rt_seconds(1)) * 1000;
+                if( timerfd_settime(timerFD, TFD_TIMER_ABSTIME, &spec, NULL) == -1 )
+                    rt_fatal("timerfd_settime failed: %s", strerror(errno));      // LCOV_EXCL_LINE
+            }
+#else // !defined(CFG_timerfd)
+            ustime_t ahead = rt_processTimerQ();
+            if( ahead != USTIME_MAX ) {
+                // Round up - waking early would only spin until the timer is due
+                ahead = (ahead + rt_millis(1) - 1) / rt_millis(1);
+                timeout = ahead > INT_MAX ? INT_MAX : (int)ahead;
+                if( !SIMCLOCK )
+                    due = rt_getTime() + rt_millis(timeout);
+            }
+#endif // !defined(CFG_timerfd)
+#if defined(CFG_simclock)
+            if( rt_simTime && rt_nextDeadline() != USTIME_MAX )
+                timeout = (int)(rt_simQuantum / rt_millis(1));
+#endif // defined(CFG_simclock)
+            n = epoll_wait(epollFD, events, SIZE_ARRAY(events), timeout);
+        } while( n == -1 && errno == EINTR );
+        if( n == -1 )
+            rt_fatal("epoll_wait failed: %s", strerror(errno));      // LCOV_EXCL_LINE
+        obsSchedLat(due);
+#if defined(CFG_simclock)
+        if( n == 0 && rt_simTime )
+            rt_simAdvance(rt_nextDeadline());  // idle - skip to next timer
+#endif // defined(CFG_simclock)
+        ustime_t t0 = rt_getTime(), t = t0;
+        for( int k=0; k < n; k++ ) {
+            uL_t tag = events[k].data.u64;
+            u4_t ev  = events[k].events;
+#if defined(CFG_timerfd)
+            if( tag == (uL_t)EPOLL_TIMERFD ) {
+                u1_t buf[8];
+                int err;
+                while( (err = read(timerFD, buf, sizeof(buf))) > 0 );
+                if( err != -1 || errno != EAGAIN )
+                    rt_fatal("Failed to read timerfd: err=%d %s\n", err, strerror(errno));     // LCOV_EXCL_LINE
+                rt_processTimerQ();
+                continue;
+            }
+#endif // defined(CFG_timerfd)
+            aio_t* aio = &aioHandles[(u4_t)tag];
+            int fd = (int)(u4_t)(tag >> 32);
+            // A callback earlier in this batch may have closed this handle
+            if( !aio->ctx || aio->fd != fd )
+                continue;
+            if( (ev & (EPOLLIN|EPOLLHUP|EPOLLERR)) && aio->rdfn ) {
+                aiofn_t fn = aio->rdfn;
+                fn(aio);
+                t = metrics_profCb(fn, PROF_AIO_RD, t);
+            }
+            if( (ev & (EPOLLOUT|EPOLLHUP|EPOLLERR)) && aio->ctx && aio->fd == fd && aio->wrfn ) {
+                aiofn_t fn = aio->wrfn;
+                fn(aio);
+                t = metrics_profCb(fn, PROF_AIO_WR, t);
+            }
+        }
+        metric_obs(MH_loop_iter, t - t0);
+    }
+}
+
+#else // !defined(CFG_epoll)
+
 void aio_loop () {
     while(1) {
         int n, maxfd;
         fd_set rdset;
         fd_set wrset;
+        ustime_t due;
         do {
+            due = USTIME_MAX;
             maxfd = -1;
             FD_ZERO(&rdset);
             FD_ZERO(&wrset);
             struct timeval *ptimeout = NULL;
 #if defined(CFG_timerfd)
-            ustime_t deadline = rt_processTimerQ();
-            if( deadline != USTIME_MAX ) {
+            ustime_t deadline = due = rt_processTimerQ();
+            if( deadline != USTIME_MAX && !SIMCLOCK ) {
                 struct itimerspec spec;
                 memset(&spec, 0, sizeof(spec));
                 spec.it_value.tv_sec = deadline / rt_seconds(1);
@@ -131,8 +280,18 @@ void aio_loop () {
                 ptimeout = &timeout;
                 timeout.tv_sec = ahead / rt_seconds(1);
                 timeout.tv_usec = ahead % rt_seconds(1);
+                if( !SIMCLOCK )
+                    due = rt_getTime() + ahead;
             }
 #endif // !defined(CFG_timerfd)
+#if defined(CFG_simclock)
+            struct timeval quantum;
+            if( rt_simTime && rt_nextDeadline() != USTIME_MAX ) {
+                ptimeout = &quantum;
+                quantum.tv_sec = rt_simQuantum / rt_seconds(1);
+                quantum.tv_usec = rt_simQuantum % rt_seconds(1);
+            }
+#endif // defined(CFG_simclock)
             for( int i=0; i < N_AIO_HANDLES; i++ ) {
                 aio_t* aio = &aioHandles[i];
                 if( !aio->ctx )
@@ -144,6 +303,12 @@ void aio_loop () {
             }
             n = select(maxfd+1, &rdset, &wrset, NULL, ptimeout);
         } while( n == -1 && errno == EINTR );
+        obsSchedLat(due);
+#if defined(CFG_simclock)
+        if( n == 0 && rt_simTime )
+            rt_simAdvance(rt_nextDeadline());  // idle - skip to next timer
+#endif // defined(CFG_simclock)
+        ustime_t t0 = rt_getTime(), t;
 #if defined(CFG_timerfd)
         if( FD_ISSET(timerFD, &rdset) ) {
             u1_t buf[8];
@@ -155,21 +320,28 @@ void aio_loop () {
             n--;
         }
 #endif // defined(CFG_timerfd)
+        t = rt_getTime();
         for( int i=0; n > 0 && i < N_AIO_HANDLES; i++ ) {
             aio_t* aio = &aioHandles[i];
             if( !aio->ctx )
                 continue;
             if( FD_ISSET(aio->fd, &rdset) && aio->rdfn ) {
-                aio->rdfn(aio);
+                aiofn_t fn = aio->rdfn;
+                fn(aio);
+                t = metrics_profCb(fn, PROF_AIO_RD, t);
                 n--;
             }
             if( FD_ISSET(aio->fd, &wrset) && aio->wrfn ) {
-                aio->wrfn(aio);
+                aiofn_t fn = aio->wrfn;
+                fn(aio);
+                t = metrics_profCb(fn, PROF_AIO_WR, t);
                 n--;
             }
         }
+        metric_obs(MH_loop_iter, t - t0);
     }
 }
+#endif // !defined(CFG_epoll)
 
 
 void aio_ini () {
@@ -180,5 +352,15 @@ void aio_ini () {
     if( timerFD == -1 )
         rt_fatal("timerfd_create failed: %s", strerror(errno));      // LCOV_EXCL_LINE
 #endif // defined(CFG_timerfd)
+#if defined(CFG_epoll)
+    epollFD = epoll_create1(EPOLL_CLOEXEC);
+    if( epollFD == -1 )
+        rt_fatal("epoll_create1 failed: %s", strerror(errno));      // LCOV_EXCL_LINE
+#if defined(CFG_timerfd)
+    struct epoll_event e = { .events = EPOLLIN, .data.u64 = (uL_t)EPOLL_TIMERFD };
+    if( epoll_ctl(epollFD, EPOLL_CTL_ADD, timerFD, &e) == -1 )
+        rt_fatal("epoll_ctl(timerfd) failed: %s", strerror(errno));      // LCOV_EXCL_LINE
+#endif // defined(CFG_timerfd)
+#endif // defined(CFG_epoll)
 }
 
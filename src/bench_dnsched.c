@@ -0,0 +1,443 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+// Downlink scheduling stress: a synthetic LNS feeds dnmsg/dnsched streams with
+// a mix of class A/B/C traffic into a session while the clock is simulated.
+// The radio layer is replaced by a model which accepts every frame handed over
+// in time (CCA may randomly report a busy channel). Timers of the txunits are
+// run directly by this harness - everything except CPU times is deterministic.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "benchmarks.h"
+#include "s2conf.h"
+#include "s2e.h"
+#include "uj.h"
+#include "kwcrc.h"
+#include "ral.h"
+#include "timesync.h"
+#include "metrics.h"
+#include "sys.h"
+
+#if defined(CFG_benchmarks) && defined(CFG_simclock)
+
+enum { DNS_TXJOBS = 512, DNS_MAXSAMPLES = 1<<16 };
+
+#define DNS_SIMSTART  rt_seconds(1000)
+#define DNS_GPSSTART  ((sL_t)1300000000*1000000)   // GPS time at DNS_SIMSTART
+#define DNS_DURATION  rt_seconds(600)             // simulated time of one scenario
+#define DNS_PINGSLOT  rt_millis(30)
+
+typedef struct dnsregion {
+    str_t    name;
+    ujcrc_t  crc;
+    u4_t     freq_range[2];
+    u1_t     dr1[2];          // RX1 DR range
+    u4_t     rx1freqs[8];
+    u4_t     rx2freq;
+    u1_t     rx2dr;
+    u1_t     bdr;            // class B ping DR
+    s2_t     drs[16][2];     // SF/BW as in router_config.DRs (SF -1 = undefined, 0 = FSK)
+} dnsregion_t;
+
+#define DRS_UNDEF  {-1,0},{-1,0},{-1,0},{-1,0}
+
+static const dnsregion_t EU863 = {
+    "EU863", J_EU863, { 863000000, 870000000 }, { 0, 5 },
+    { 868100000, 868300000, 868500000 }, 869525000, 0, 3,
+    { {12,125},{11,125},{10,125},{9,125},{8,125},{7,125},{7,250},{0,0}, DRS_UNDEF, DRS_UNDEF }
+};
+static const dnsregion_t KR920 = {
+    "KR920", J_KR920, { 920900000, 923300000 }, { 0, 5 },
+    { 922100000, 922300000, 922500000 }, 921900000, 0, 3,
+    { {12,125},{11,125},{10,125},{9,125},{8,125},{7,125},{-1,0},{-1,0}, DRS_UNDEF, DRS_UNDEF }
+};
+static const dnsregion_t US902 = {
+    "US902", J_US902, { 902000000, 928000000 }, { 8, 13 },
+    { 923300000, 923900000, 924500000, 925100000, 925700000, 926300000, 926900000, 927500000 }, 923300000, 8, 8,
+    { {10,125},{9,125},{8,125},{7,125},{8,500},{-1,0},{-1,0},{-1,0},
+      {12,500},{11,500},{10,500},{9,500},{8,500},{7,500},{-1,0},{-1,0} }
+};
+
+typedef struct dnscen {
+    str_t    name;
+    const dnsregion_t* region;
+    int      rate;           // downlinks per 10s
+    u1_t     pctB, pctC;     // class B/C share - rest is class A
+    u1_t     txunits;        // 2 = alternate antenna available
+    u1_t     ccaBusy;        // percent of CCA attempts which find the channel busy
+} dnscen_t;
+
+static const dnscen_t SCENARIOS[] = {
+    { "eu863/A",          &EU863,    2,  0,  0, 1,  0 },
+    { "eu863/A",          &EU863,   20,  0,  0, 1,  0 },
+    { "eu863/ABC",        &EU863,   20, 20, 20, 1,  0 },
+    { "eu863/ABC/2ant",   &EU863,   20, 20, 20, 2,  0 },
+    { "kr920/A/cca",      &KR920,   10,  0,  0, 1, 20 },
+    { "kr920/ABC/2ant",   &KR920,   20, 20, 20, 2, 20 },
+    { "us902/ABC",        &US902,   50, 20, 20, 1,  0 },
+    { "us902/ABC",        &US902,  200, 20, 20, 1,  0 },
+    { "us902/ABC/2ant",   &US902,  200, 30, 20, 2,  0 },
+    { NULL }
+};
+
+
+static struct dnsstate {
+    const dnscen_t* scen;
+    u4_t     rnd;
+    u4_t     diid;
+    u4_t     jobs;           // downlinks generated
+    u4_t     dnsched;        // ... thereof as dnsched
+    u4_t     lost;           // rejected during decode (not accounted in metrics)
+    u4_t     handoffs;       // frames passed to radio
+    int      maxQueued;      // peak number of txjobs queued on all txunits
+    ustime_t cpuAdd;         // CPU spent in s2e_onMsg
+    ustime_t cpuSched;       // CPU spent in txunit timer callbacks
+    int      nlead, nmargin;
+    ustime_t* lead;          // requested TX time - arrival
+    ustime_t* margin;        // TX time - hand off to radio
+    struct {
+        ustime_t txbeg, txend;
+    } radio[MAX_TXUNITS];
+} S;
+
+static char dnsSendbuf[4096];
+
+static dbuf_t dns_getSendbuf (s2ctx_t* s2ctx, int minsize) {
+    dbuf_t b = { .buf = dnsSendbuf, .bufsize = sizeof(dnsSendbuf), .pos = 0 };
+    return b;
+}
+
+static void dns_send (s2ctx_t* s2ctx, dbuf_t* b) {
+    b->buf = NULL;
+    b->pos = b->bufsize = 0;
+}
+
+// xorshift32 - deterministic across platforms/libc
+static u4_t rnd () {
+    u4_t x = S.rnd;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return S.rnd = x;
+}
+
+static u4_t rndRange (u4_t lo, u4_t hi) {
+    return lo + rnd() % (hi-lo+1);
+}
+
+// Exponentially distributed inter arrival time
+static ustime_t rndGap (int per10s) {
+    double u = (rnd() + 1.0) / 4294967297.0;
+    return (ustime_t)(-log(u) * 1e7 / per10s);
+}
+
+static inline sL_t xtimeOf (u1_t txunit, ustime_t t) {
+    return ((sL_t)txunit << RAL_TXUNIT_SHIFT) | ((sL_t)1 << RAL_XTSESS_SHIFT) | t;
+}
+
+static void addSample (ustime_t* v, int* n, ustime_t t) {
+    if( *n < DNS_MAXSAMPLES )
+        v[(*n)++] = t;
+}
+
+
+static int sim_tx (txjob_t* txjob, s2ctx_t* s2ctx, int nocca) {
+    ustime_t now = rt_getTime();
+    if( !nocca && s2ctx->ccaEnabled && rndRange(0,99) < S.scen->ccaBusy )
+        return RAL_TX_NOCA;
+    S.radio[txjob->txunit].txbeg = txjob->txtime;
+    S.radio[txjob->txunit].txend = txjob->txtime + txjob->airtime;
+    S.handoffs += 1;
+    addSample(S.margin, &S.nmargin, txjob->txtime - now);
+    return RAL_TX_OK;
+}
+
+static int sim_txstatus (u1_t txunit) {
+    ustime_t now = rt_getTime();
+    if( now < S.radio[txunit].txbeg )
+        return TXSTATUS_SCHEDULED;
+    if( now < S.radio[txunit].txend )
+        return TXSTATUS_EMITTING;
+    return TXSTATUS_IDLE;
+}
+
+static void sim_txabort (u1_t txunit) {
+    S.radio[txunit].txbeg = S.radio[txunit].txend = 0;
+}
+
+static u1_t sim_altAntennas (u1_t txunit) {
+    return S.scen->txunits == 2 ? 1 << (1-txunit) : 0;
+}
+
+
+// Downlinks which made it into metrics - admitted or rejected
+static uL_t accounted () {
+    uL_t* c = metrics_ctr;
+    return c[MC_tx_admitted] + c[MC_tx_rej_dc] + c[MC_tx_rej_cca] + c[MC_tx_rej_toolate] + c[MC_tx_rej_collision] + c[MC_tx_rej_other];
+}
+
+static void submit (s2ctx_t* s2ctx, ujbuf_t* b) {
+    ustime_t t0 = sys_time();
+    s2e_onMsg(s2ctx, b->buf, b->pos);
+    S.cpuAdd += sys_time() - t0;
+}
+
+// Generate next downlink as an LNS would send it
+static void genDnmsg (s2ctx_t* s2ctx, ujbuf_t* b) {
+    const dnsregion_t* r = S.scen->region;
+    ustime_t now = rt_getTime();
+    u1_t txunit = rndRange(0, S.scen->txunits-1);
+    u1_t frame[32];
+    int  flen = bench_upframe(frame, S.diid);
+    int  cls = rndRange(0,99);
+    int  nfreq = 0;
+    while( nfreq < SIZE_ARRAY(r->rx1freqs) && r->rx1freqs[nfreq] )
+        nfreq++;
+    S.jobs += 1;
+    S.diid += 1;
+    b->pos = 0;
+    if( cls < S.scen->pctB ) {
+        // Class B - ping slot which is 1..32s ahead, every 4th a multicast dnsched entry
+        ustime_t lead = rt_seconds(1) + rndRange(0, 31*1000) * rt_millis(1);
+        sL_t gpstime = DNS_GPSSTART + now-DNS_SIMSTART + lead;
+        gpstime -= gpstime % DNS_PINGSLOT;
+        addSample(S.lead, &S.nlead, DNS_SIMSTART + gpstime-DNS_GPSSTART - now);
+        uj_encOpen(b, '{');
+        if( (S.diid & 3) == 0 ) {
+            S.dnsched += 1;
+            uj_encKVn(b, "msgtype", 's', "dnsched", NULL);
+            uj_encKey(b, "schedule");
+            uj_encOpen(b, '[');
+            uj_encOpen(b, '{');
+            uj_encKVn(b,
+                      "diid",     'I', (sL_t)S.diid,
+                      "priority", 'i', rndRange(0,255),
+                      "DR",       'i', r->bdr,
+                      "Freq",     'u', r->rx2freq,
+                      "gpstime",  'I', gpstime,
+                      "rctx",     'i', txunit,
+                      "pdu",      'H', flen, frame,
+                      NULL);
+            uj_encClose(b, '}');
+            uj_encClose(b, ']');
+        } else {
+            uj_encKVn(b,
+                      "msgtype",  's', "dnmsg",
+                      "DevEui",   'E', (uL_t)0x0011000000000000 | S.diid,
+                      "dC",       'i', 1,
+                      "diid",     'I', (sL_t)S.diid,
+                      "pdu",      'H', flen, frame,
+                      "RxDelay",  'i', 0,
+                      "priority", 'i', rndRange(0,255),
+                      "RX1DR",    'i', r->bdr,
+                      "RX1Freq",  'u', r->rx2freq,
+                      "gpstime",  'I', gpstime,
+                      "rctx",     'i', txunit,
+                      NULL);
+        }
+        uj_encClose(b, '}');
+    }
+    else if( cls < S.scen->pctB + S.scen->pctC ) {
+        // Class C - RX2 as soon as possible
+        addSample(S.lead, &S.nlead, 0);
+        uj_encOpen(b, '{');
+        uj_encKVn(b,
+                  "msgtype",  's', "dnmsg",
+                  "DevEui",   'E', (uL_t)0x0011000000000000 | S.diid,
+                  "dC",       'i', 2,
+                  "diid",     'I', (sL_t)S.diid,
+                  "pdu",      'H', flen, frame,
+                  "RxDelay",  'i', 0,
+                  "priority", 'i', rndRange(0,255),
+                  "RX2DR",    'i', r->rx2dr,
+                  "RX2Freq",  'u', r->rx2freq,
+                  "xtime",    'I', xtimeOf(txunit, now),
+                  NULL);
+        uj_encClose(b, '}');
+    }
+    else {
+        // Class A - LNS answers 100..900ms after the uplink, RX1 is 1s after uplink
+        ustime_t lead = rt_millis(100) + rndRange(0, 800) * rt_millis(1);
+        addSample(S.lead, &S.nlead, lead);
+        uj_encOpen(b, '{');
+        uj_encKVn(b,
+                  "msgtype",  's', "dnmsg",
+                  "DevEui",   'E', (uL_t)0x0011000000000000 | S.diid,
+                  "dC",       'i', 0,
+                  "diid",     'I', (sL_t)S.diid,
+                  "pdu",      'H', flen, frame,
+                  "RxDelay",  'i', 1,
+                  "priority", 'i', rndRange(0,255),
+                  "RX1DR",    'i', rndRange(r->dr1[0], r->dr1[1]),
+                  "RX1Freq",  'u', r->rx1freqs[rndRange(0, nfreq-1)],
+                  "RX2DR",    'i', r->rx2dr,
+                  "RX2Freq",  'u', r->rx2freq,
+                  "xtime",    'I', xtimeOf(txunit, now + lead - rt_seconds(1)),
+                  NULL);
+        uj_encClose(b, '}');
+    }
+    xeos(b);
+}
+
+
+static int cmpUstime (const void* a, const void* b) {
+    ustime_t x = *(const ustime_t*)a, y = *(const ustime_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double quantile (ustime_t* v, int n, int q) {
+    return n == 0 ? 0.0 : v[min(n-1, n*q/100)] / 1e6;
+}
+
+static void printQuantiles (str_t name, ustime_t* v, int n) {
+    qsort(v, n, sizeof(v[0]), cmpUstime);
+    printf(",\"%s\":{\"p50\":%.3f,\"p90\":%.3f,\"p99\":%.3f,\"max\":%.3f}", name,
+           quantile(v,n,50), quantile(v,n,90), quantile(v,n,99), n ? v[n-1]/1e6 : 0.0);
+}
+
+
+static void runScenario (const dnscen_t* scen, ustime_t* lead, ustime_t* margin) {
+    memset(&S, 0, sizeof(S));
+    S.scen = scen;
+    S.rnd = 0x2545F491;
+    S.lead = lead;
+    S.margin = margin;
+    rt_simClock(DNS_SIMSTART, 0);
+
+    s2ctx_t* s2ctx = rt_malloc(s2ctx_t);
+    s2e_ini(s2ctx);
+    s2ctx->getSendbuf    = dns_getSendbuf;
+    s2ctx->sendText      = dns_send;
+    s2ctx->sendBinary    = dns_send;
+    s2ctx->radioTx       = sim_tx;
+    s2ctx->radioTxstatus = sim_txstatus;
+    s2ctx->radioTxabort  = sim_txabort;
+    s2ctx->altAntennas   = sim_altAntennas;
+    txq_free(&s2ctx->txq);
+    txq_ini(&s2ctx->txq, NULL, DNS_TXJOBS, 64*1024);
+    for( int u=0; u<MAX_TXUNITS; u++ ) {
+        txord_free(&s2ctx->txunits[u].q);
+        txord_ini(&s2ctx->txunits[u].q, NULL, DNS_TXJOBS);
+    }
+    const dnsregion_t* r = scen->region;
+    s2e_setRegion(s2ctx, r->name, r->crc);
+    s2ctx->min_freq = r->freq_range[0];
+    s2ctx->max_freq = r->freq_range[1];
+    for( int dr=0; dr<16; dr++ ) {
+        int sf = r->drs[dr][0], bw = r->drs[dr][1];
+        s2ctx->dr_defs[dr] = sf < 0 ? RPS_ILLEGAL : sf == 0 ? FSK : rps_make(12-sf, bw==125 ? BW125 : bw==250 ? BW250 : BW500);
+    }
+
+    // SX130X counters tick with the simulated clock - GPS time known from LNS
+    ts_iniTimesync();
+    for( u1_t u=0; u<scen->txunits; u++ ) {
+        timesync_t sync = { .ustime = rt_simTime, .xtime = xtimeOf(u, rt_simTime) };
+        ts_updateTimesync(u, 0, &sync);
+    }
+    ts_setTimesyncLns(xtimeOf(0, rt_simTime), DNS_GPSSTART);
+    metrics_reset();
+
+    ujbuf_t b = { .buf = rt_mallocN(char, 1024), .bufsize = 1024 };
+    ustime_t end = DNS_SIMSTART + DNS_DURATION;
+    ustime_t arrival = DNS_SIMSTART + rndGap(scen->rate);
+    while(1) {
+        tmr_t* tmr = NULL;
+        for( int u=0; u<MAX_TXUNITS; u++ ) {
+            tmr_t* t = &s2ctx->txunits[u].timer;
+            if( t->next != TMR_NIL && (tmr == NULL || t->deadline < tmr->deadline) )
+                tmr = t;
+        }
+        if( arrival < end && (tmr == NULL || arrival <= tmr->deadline) ) {
+            rt_simAdvance(arrival);
+            uL_t n = accounted();
+            genDnmsg(s2ctx, &b);
+            submit(s2ctx, &b);
+            if( accounted() == n )
+                S.lost += 1;  // dropped while decoding - e.g. no viable RX2
+            int queued = 0;
+            for( int u=0; u<MAX_TXUNITS; u++ )
+                queued += s2ctx->txunits[u].q.n;
+            S.maxQueued = max(S.maxQueued, queued);
+            arrival += rndGap(scen->rate);
+            continue;
+        }
+        if( tmr == NULL )
+            break;
+        rt_simAdvance(tmr->deadline);
+        rt_clrTimer(tmr);
+        ustime_t t0 = sys_time();
+        tmr->callback(tmr);
+        S.cpuSched += sys_time() - t0;
+    }
+    rt_free(b.buf);
+
+    uL_t* c = metrics_ctr;
+    printf("{\"msgtype\":\"dnstress\",\"scenario\":\"%s\",\"region\":\"%s\",\"txunits\":%d,\"rate\":%.1f,"
+           "\"jobs\":%u,\"dnsched\":%u,\"admitted\":%lu,\"emitted\":%lu,\"success\":%.4f,\"lost\":%u,\"max_queued\":%d,"
+           "\"rej\":{\"dc\":%lu,\"cca\":%lu,\"toolate\":%lu,\"collision\":%lu,\"other\":%lu},"
+           "\"cpu_add_ns\":%.1f,\"cpu_sched_ns\":%.1f",
+           scen->name, r->name, scen->txunits, scen->rate/10.0,
+           S.jobs, S.dnsched, (unsigned long)c[MC_tx_admitted], (unsigned long)c[MC_tx_emitted],
+           S.jobs ? (double)c[MC_tx_emitted]/S.jobs : 0.0, S.lost, S.maxQueued,
+           (unsigned long)c[MC_tx_rej_dc], (unsigned long)c[MC_tx_rej_cca], (unsigned long)c[MC_tx_rej_toolate],
+           (unsigned long)c[MC_tx_rej_collision], (unsigned long)c[MC_tx_rej_other],
+           S.jobs ? S.cpuAdd*1e3/S.jobs : 0.0, S.jobs ? S.cpuSched*1e3/S.jobs : 0.0);
+    printQuantiles("lead", S.lead, S.nlead);
+    printQuantiles("margin", S.margin, S.nmargin);
+    printf("}\n");
+    fflush(stdout);
+
+    s2e_free(s2ctx);
+    rt_free(s2ctx);
+    rt_simClock(0, 0);
+}
+
+
+void bench_dnstress () {
+    int s2eLevel = log_setLevel(MOD_S2E|CRITICAL);
+    int synLevel = log_setLevel(MOD_SYN|CRITICAL);
+    int jsnLevel = log_setLevel(MOD_JSN|CRITICAL);
+    ustime_t* lead   = rt_mallocN(ustime_t, DNS_MAXSAMPLES);
+    ustime_t* margin = rt_mallocN(ustime_t, DNS_MAXSAMPLES);
+    for( int i=0; SCENARIOS[i].name; i++ ) {
+#if defined(S2E_REGION)
+        if( SCENARIOS[i].region->crc != S2E_REGION )
+            continue;  // station built for one region only
+#endif // defined(S2E_REGION)
+        runScenario(&SCENARIOS[i], lead, margin);
+    }
+    rt_free(lead);
+    rt_free(margin);
+    log_setLevel(MOD_S2E|s2eLevel);
+    log_setLevel(MOD_SYN|synLevel);
+    log_setLevel(MOD_JSN|jsnLevel);
+}
+
+#endif // defined(CFG_benchmarks) && defined(CFG_simclock)
@@ -0,0 +1,138 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if defined(CFG_linux) || defined(CFG_flashsim)
+#include <fcntl.h>
+#include "s2conf.h"
+#include "benchmarks.h"
+#include "fs.h"
+
+#if defined(CFG_benchmarks)
+
+#define BENCH_FILE "bench.dat"
+enum { BENCH_FILESZ = 16*1024 };
+
+// Runs on a freshly erased file system like the selftests
+static void benchFs () {
+    static int done;
+    if( done )
+        return;
+    done = 1;
+    fs_erase();
+    u4_t key[4] = {0x12345678,0x9ABCDEF0,0x0FEDCBA9,0x87654321};
+    fs_ini(key);
+}
+
+// Append b->arg bytes - file is rewritten every BENCH_FILESZ bytes which keeps GC busy
+void bench_fsWrite (bench_t* b) {
+    bench_stop(b);
+    benchFs();
+    u1_t data[256];
+    int sz = min(b->arg, (int)sizeof(data));
+    for( int i=0; i<sz; i++ )
+        data[i] = i*7;
+    bench_start(b);
+    int fd = -1, off = 0;
+    for( int i=0; i<b->n; i++ ) {
+        if( fd < 0 ) {
+            fd = fs_open(BENCH_FILE, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+            off = 0;
+        }
+        if( fs_write(fd, data, sz) != sz ) {
+            LOG(ERROR, "Benchmark %s: write failed", b->name);
+            break;
+        }
+        if( (off += sz) >= BENCH_FILESZ ) {
+            fs_close(fd);
+            fd = -1;
+        }
+    }
+    if( fd >= 0 )
+        fs_close(fd);
+    bench_stop(b);
+    fs_unlink(BENCH_FILE);
+}
+
+// Read b->arg bytes sequentially - rewind at end of file
+void bench_fsRead (bench_t* b) {
+    bench_stop(b);
+    benchFs();
+    u1_t data[256];
+    int sz = min(b->arg, (int)sizeof(data));
+    int fd = fs_open(BENCH_FILE, O_CREAT|O_TRUNC|O_WRONLY, 0644);
+    memset(data, 0x5A, sizeof(data));
+    for( int off=0; off<BENCH_FILESZ; off+=sizeof(data) )
+        fs_write(fd, data, sizeof(data));
+    fs_close(fd);
+    fd = fs_open(BENCH_FILE, O_RDONLY);
+    bench_start(b);
+    for( int i=0; i<b->n; i++ ) {
+        if( fs_read(fd, data, sz) != sz )
+            fs_lseek(fd, 0, SEEK_SET);
+    }
+    bench_stop(b);
+    fs_close(fd);
+    fs_unlink(BENCH_FILE);
+}
+
+// Decrypt one flash page - b->arg words per call (1=rdFlash1, else rdFlashN)
+void bench_fsDecrypt (bench_t* b) {
+    static u4_t w[FLASH_PAGE_SIZE/4];
+    u4_t base = FLASH_ADDR + FLASH_PAGE_SIZE*FS_PAGE_START;
+    int chunk = max(1, min(b->arg, FLASH_PAGE_SIZE/4));
+    bench_stop(b);
+    benchFs();
+    bench_start(b);
+    for( int i=0; i<b->n; i++ ) {
+        if( chunk == 1 ) {
+            for( int u=0; u<FLASH_PAGE_SIZE/4; u++ )
+                w[u] = rdFlash1(base+4*u);
+        } else {
+            for( int u=0; u<FLASH_PAGE_SIZE/4; u+=chunk )
+                rdFlashN(base+4*u, w+u, chunk);
+        }
+    }
+}
+
+// Record checksum over b->arg bytes
+void bench_fsCrc (bench_t* b) {
+    static u1_t data[FLASH_PAGE_SIZE];
+    bench_stop(b);
+    for( int i=0; i<sizeof(data); i++ )
+        data[i] = i*13;
+    int len = min(b->arg, (int)sizeof(data));
+    bench_start(b);
+    u2_t crc = 0;
+    for( int i=0; i<b->n; i++ )
+        crc = dataCrc(crc, data, len);
+    data[0] = crc;  // keep result alive
+}
+
+#endif // defined(CFG_benchmarks)
+#endif // defined(CFG_linux) || defined(CFG_flashsim)
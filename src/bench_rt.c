@@ -0,0 +1,59 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "benchmarks.h"
+
+#if defined(CFG_benchmarks)
+
+static void benchTimeout (tmr_t* tmr) {}
+
+// Re-arm one of b->arg queued timers with a new random deadline
+void bench_setTimer (bench_t* b) {
+    bench_stop(b);
+    int ntmr = b->arg;
+    tmr_t* tmrs = rt_mallocN(tmr_t, ntmr);
+    ustime_t base = rt_getTime() + rt_seconds(3600);
+    u4_t r = 1;
+    for( int i=0; i<ntmr; i++ ) {
+        rt_iniTimer(&tmrs[i], benchTimeout);
+        r = r*1103515245 + 12345;
+        rt_setTimer(&tmrs[i], base + (r>>8) % rt_seconds(60));
+    }
+    bench_start(b);
+    for( int i=0; i<b->n; i++ ) {
+        r = r*1103515245 + 12345;
+        rt_setTimer(&tmrs[(r>>4) % ntmr], base + (r>>8) % rt_seconds(60));
+    }
+    bench_stop(b);
+    for( int i=0; i<ntmr; i++ )
+        rt_clrTimer(&tmrs[i]);
+    rt_free(tmrs);
+}
+
+#endif // defined(CFG_benchmarks)
@@ -0,0 +1,155 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "benchmarks.h"
+#include "s2conf.h"
+#include "s2e.h"
+
+#if defined(CFG_benchmarks)
+
+enum { BENCH_RXDEPTH = 16, BENCH_TXJOBS = 512 };
+
+static char benchSendbuf[4096];
+
+static dbuf_t bench_getSendbuf (s2ctx_t* s2ctx, int minsize) {
+    dbuf_t b = { .buf = benchSendbuf, .bufsize = sizeof(benchSendbuf), .pos = 0 };
+    return b;
+}
+
+static void bench_sendText (s2ctx_t* s2ctx, dbuf_t* b) {
+    b->buf = NULL;
+    b->pos = b->bufsize = 0;
+}
+
+// Session with EU868 like data rates and room for deep TX queues
+static s2ctx_t* benchCtx () {
+    s2ctx_t* s2ctx = rt_malloc(s2ctx_t);
+    s2e_ini(s2ctx);
+    s2ctx->getSendbuf = bench_getSendbuf;
+    s2ctx->sendText   = bench_sendText;
+    s2ctx->sendBinary = bench_sendText;
+    for( int dr=0; dr<6; dr++ )
+        s2ctx->dr_defs[dr] = rps_make(SF12-dr, BW125);
+    txq_free(&s2ctx->txq);
+    txq_ini(&s2ctx->txq, NULL, BENCH_TXJOBS, 64*1024);
+    for( int u=0; u<MAX_TXUNITS; u++ ) {
+        txord_free(&s2ctx->txunits[u].q);
+        txord_ini(&s2ctx->txunits[u].q, NULL, BENCH_TXJOBS);
+    }
+    return s2ctx;
+}
+
+static void freeCtx (s2ctx_t* s2ctx) {
+    s2e_free(s2ctx);
+    rt_free(s2ctx);
+}
+
+static void addFrame (s2ctx_t* s2ctx, u4_t seq) {
+    rxjob_t* j = s2e_nextRxjob(s2ctx);
+    j->len   = bench_upframe(&s2ctx->rxq.rxdata[j->off], seq);
+    j->freq  = 868100000 + (seq % 8) * 200000;
+    j->dr    = 5;
+    j->rssi  = 80;
+    j->snr   = 28;
+    j->xtime = seq * 1000;
+    s2e_addRxjob(s2ctx, j);
+}
+
+// Mirror check and commit of a new frame
+void bench_addRxjob (bench_t* b) {
+    bench_stop(b);
+    s2ctx_t* s2ctx = benchCtx();
+    bench_start(b);
+    for( int i=0; i<b->n; i++ ) {
+        addFrame(s2ctx, i);
+        if( s2ctx->rxq.njobs > BENCH_RXDEPTH )
+            rxq_popJob(&s2ctx->rxq);
+    }
+    bench_stop(b);
+    freeCtx(s2ctx);
+}
+
+// JSON updf encoding per frame - frames are queued outside of the measurement
+void bench_flushRx (bench_t* b) {
+    bench_stop(b);
+    s2ctx_t* s2ctx = benchCtx();
+    for( int i=0; i<b->n; ) {
+        int k = min(BENCH_RXDEPTH, b->n - i);
+        for( int j=0; j<k; j++ )
+            addFrame(s2ctx, i+j);
+        bench_start(b);
+        s2e_flushRxjobs(s2ctx);
+        bench_stop(b);
+        i += k;
+    }
+    freeCtx(s2ctx);
+}
+
+static txjob_t* newTxjob (s2ctx_t* s2ctx, ustime_t txtime, u4_t seq) {
+    txjob_t* j = txq_reserveJob(&s2ctx->txq);
+    j->txtime  = txtime;
+    j->deveui  = 0x0000001100000000 + seq;
+    j->diid    = seq;
+    j->freq    = 869525000;
+    j->dr      = 0;
+    j->len     = 33;
+    j->addcrc  = 0;
+    txq_commitJob(&s2ctx->txq, j);
+    return j;
+}
+
+// Insert one txjob into a queue already holding b->arg jobs (and remove it again
+// to keep the depth constant - removal is part of the measured operation)
+void bench_addTxjob (bench_t* b) {
+    bench_stop(b);
+    s2ctx_t* s2ctx = benchCtx();
+    ustime_t now = rt_getTime();
+    ustime_t base = now + rt_seconds(1);
+    ustime_t spacing = rt_millis(100);
+    for( int k=0; k<b->arg; k++ )
+        s2e_addTxjob(s2ctx, newTxjob(s2ctx, base + k*spacing, k), 0, now);
+    u4_t r = 1;
+    bench_start(b);
+    for( int i=0; i<b->n; i++ ) {
+        r = r*1103515245 + 12345;
+        ustime_t txtime = base + spacing/2 + (r>>8) % (b->arg*spacing);
+        txjob_t* j = newTxjob(s2ctx, txtime, i);
+        if( !s2e_addTxjob(s2ctx, j, 0, now) ) {
+            txq_freeJob(&s2ctx->txq, j);
+            continue;
+        }
+        txord_t* q = &s2ctx->txunits[j->txunit].q;
+        txord_unqJob(&s2ctx->txq, q, txord_find(&s2ctx->txq, q, txtime) - 1);
+        txq_freeJob(&s2ctx->txq, j);
+    }
+    bench_stop(b);
+    freeCtx(s2ctx);
+}
+
+#endif // defined(CFG_benchmarks)
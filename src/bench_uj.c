@@ -0,0 +1,168 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "benchmarks.h"
+#include "s2e.h"
+#include "uj.h"
+
+#if defined(CFG_benchmarks)
+
+static const char DNMSG[] =
+    "{\"msgtype\":\"dnmsg\",\"DevEui\":\"00-00-00-00-11-00-00-01\",\"dC\":0,\"diid\":35123,"
+    "\"pdu\":\"60041300268000010001E7A3C5F1820F0E5D6C3B2A19\",\"RxDelay\":1,"
+    "\"RX1DR\":5,\"RX1Freq\":868100000,\"RX2DR\":0,\"RX2Freq\":869525000,\"priority\":0,"
+    "\"xtime\":36028797019216734,\"rctx\":0,\"MuxTime\":1597169123.1236970}";
+
+static const char ROUTER_CONFIG[] =
+    "{\"msgtype\":\"router_config\",\"NetID\":[1,19],\"JoinEui\":[[0,18446744073709551615]],"
+    "\"region\":\"EU863\",\"hwspec\":\"sx1301/1\",\"freq_range\":[863000000,870000000],"
+    "\"DRs\":[[12,125,0],[11,125,0],[10,125,0],[9,125,0],[8,125,0],[7,125,0],[7,250,0],[0,0,0],"
+    "[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0]],"
+    "\"sx1301_conf\":[{\"radio_0\":{\"enable\":true,\"freq\":867500000},"
+    "\"radio_1\":{\"enable\":true,\"freq\":868500000},"
+    "\"chan_FSK\":{\"enable\":true,\"radio\":1,\"if\":300000},"
+    "\"chan_Lora_std\":{\"enable\":true,\"radio\":1,\"if\":-200000,\"bandwidth\":250000,\"spread_factor\":7},"
+    "\"chan_multiSF_0\":{\"enable\":true,\"radio\":1,\"if\":-400000},"
+    "\"chan_multiSF_1\":{\"enable\":true,\"radio\":1,\"if\":-200000},"
+    "\"chan_multiSF_2\":{\"enable\":true,\"radio\":1,\"if\":0},"
+    "\"chan_multiSF_3\":{\"enable\":true,\"radio\":0,\"if\":-400000},"
+    "\"chan_multiSF_4\":{\"enable\":true,\"radio\":0,\"if\":-200000},"
+    "\"chan_multiSF_5\":{\"enable\":true,\"radio\":0,\"if\":0},"
+    "\"chan_multiSF_6\":{\"enable\":true,\"radio\":0,\"if\":200000},"
+    "\"chan_multiSF_7\":{\"enable\":true,\"radio\":0,\"if\":400000}}],"
+    "\"nocca\":false,\"nodc\":false,\"nodwell\":false,\"upbatch\":true,\"binmsg\":false,"
+    "\"bcning\":null,\"MuxTime\":1597169123.1236970}";
+
+// Visit every value - numbers and strings are fully parsed by uj_nextValue
+static int walk (ujdec_t* D) {
+    int n = 1;
+    switch( uj_nextValue(D) ) {
+    case UJ_OBJECT: {
+        uj_enterObject(D);
+        while( uj_nextField(D) )
+            n += walk(D);
+        uj_exitObject(D);
+        break;
+    }
+    case UJ_ARRAY: {
+        uj_enterArray(D);
+        while( uj_nextSlot(D) >= 0 )
+            n += walk(D);
+        uj_exitArray(D);
+        break;
+    }
+    default:
+        break;
+    }
+    return n;
+}
+
+// Decoder works in place - the operation includes copying the message
+static void benchDecode (bench_t* b, const char* json, int len) {
+    bench_stop(b);
+    char* buf = rt_mallocN(char, len+1);
+    bench_start(b);
+    for( int i=0; i<b->n; i++ ) {
+        memcpy(buf, json, len+1);
+        ujdec_t D;
+        uj_iniDecoder(&D, buf, len);
+        if( uj_decode(&D) ) {
+            LOG(ERROR, "Benchmark %s: decode failed", b->name);
+            break;
+        }
+        walk(&D);
+        uj_assertEOF(&D);
+    }
+    bench_stop(b);
+    rt_free(buf);
+}
+
+void bench_ujDnmsg (bench_t* b) {
+    benchDecode(b, DNMSG, sizeof(DNMSG)-1);
+}
+
+void bench_ujRouterConfig (bench_t* b) {
+    benchDecode(b, ROUTER_CONFIG, sizeof(ROUTER_CONFIG)-1);
+}
+
+// Typical RX log line
+void bench_xprintf (bench_t* b) {
+    char buf[256];
+    u1_t frame[32];
+    int len = bench_upframe(frame, 0x1234);
+    for( int i=0; i<b->n; i++ ) {
+        dbuf_t lbuf = { .buf = buf, .bufsize = sizeof(buf), .pos = 0 };
+        xprintf(&lbuf, "RX %F DR%d %R snr=%.1f rssi=%d xtime=0x%lX - updf mhdr=%02X DevAddr=%08X FCtrl=%02X FCnt=%d FOpts=[] %H mic=%d (%d bytes)",
+                868100000 + (i&7)*200000, 5, rps_make(SF7,BW125), 7.25, -80, (sL_t)i*1000,
+                frame[0], rt_rlsbf4(frame+1), frame[5], rt_rlsbf2(frame+6), len-13, frame+9, (s4_t)rt_rlsbf4(frame+19), len);
+        xeos(&lbuf);
+    }
+}
+
+// Payload as carried in updf/dnmsg "FRMPayload"/"pdu" fields - b->arg is the length in bytes
+void bench_ujEncHex (bench_t* b) {
+    u1_t data[255];
+    char buf[2*sizeof(data)+8];
+    int len = min(b->arg, (int)sizeof(data));
+    for( int i=0; i<len; i++ )
+        data[i] = i*37+11;
+    for( int i=0; i<b->n; i++ ) {
+        ujbuf_t ubuf = { .buf = buf, .bufsize = sizeof(buf), .pos = 0 };
+        uj_encHex(&ubuf, data, len);
+        xeos(&ubuf);
+    }
+}
+
+// Decoder works in place - the operation includes copying the JSON string
+void bench_ujHexstr (bench_t* b) {
+    u1_t data[255];
+    char json[2*sizeof(data)+8], buf[sizeof(json)];
+    int len = min(b->arg, (int)sizeof(data));
+    for( int i=0; i<len; i++ )
+        data[i] = i*37+11;
+    ujbuf_t jbuf = { .buf = json, .bufsize = sizeof(json), .pos = 0 };
+    uj_encHex(&jbuf, data, len);
+    xeos(&jbuf);
+    for( int i=0; i<b->n; i++ ) {
+        memcpy(buf, json, jbuf.pos+1);
+        ujdec_t D;
+        uj_iniDecoder(&D, buf, jbuf.pos);
+        if( uj_decode(&D) ) {
+            LOG(ERROR, "Benchmark %s: decode failed", b->name);
+            break;
+        }
+        if( uj_hexstr(&D, data, sizeof(data)) != len ) {
+            LOG(ERROR, "Benchmark %s: wrong length", b->name);
+            break;
+        }
+        uj_assertEOF(&D);
+    }
+}
+
+#endif // defined(CFG_benchmarks)
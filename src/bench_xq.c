@@ -0,0 +1,86 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "benchmarks.h"
+#include "xq.h"
+
+#if defined(CFG_benchmarks)
+
+enum { BENCH_RXDEPTH = 16 };   // frames kept pending while measuring
+
+static rxjob_t* nextFrame (rxq_t* rxq, u4_t seq) {
+    rxjob_t* j = rxq_nextJob(rxq);
+    j->len   = bench_upframe(&rxq->rxdata[j->off], seq);
+    j->freq  = 868100000 + (seq % 8) * 200000;
+    j->dr    = 5;
+    j->rssi  = 80;
+    j->snr   = 28;
+    j->xtime = seq * 1000;
+    return j;
+}
+
+// Allocate, commit and eventually pop one frame
+void bench_rxq (bench_t* b) {
+    bench_stop(b);
+    rxq_t* rxq = rt_malloc(rxq_t);
+    rxq_ini(rxq);
+    bench_start(b);
+    for( int i=0; i<b->n; i++ ) {
+        rxq_commitJob(rxq, nextFrame(rxq, i));
+        if( rxq->njobs > BENCH_RXDEPTH )
+            rxq_popJob(rxq);
+    }
+    bench_stop(b);
+    rt_free(rxq);
+}
+
+// Commit a frame and drop the one before it (mirror frame) - tombstones are reclaimed by pop
+void bench_rxqDrop (bench_t* b) {
+    bench_stop(b);
+    rxq_t* rxq = rt_malloc(rxq_t);
+    rxq_ini(rxq);
+    bench_start(b);
+    rxjob_t* prev = NULL;
+    for( int i=0; i<b->n; i++ ) {
+        rxjob_t* j = nextFrame(rxq, i);
+        rxq_commitJob(rxq, j);
+        if( prev && (i & 1) )
+            rxq_dropJob(rxq, prev);
+        prev = j;
+        if( rxq->njobs > BENCH_RXDEPTH ) {
+            if( rxq_firstJob(rxq) == prev )
+                prev = NULL;
+            rxq_popJob(rxq);
+        }
+    }
+    bench_stop(b);
+    rt_free(rxq);
+}
+
+#endif // defined(CFG_benchmarks)
@@ -0,0 +1,134 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmarks.h"
+
+#if defined(CFG_benchmarks)
+
+// Each benchmark is repeated with doubling operation counts until one run takes
+// at least this long. Results are printed as one JSON object per line to stdout.
+#define BENCH_MIN_TIME  rt_millis(200)
+#define BENCH_MAX_OPS   (1<<26)
+
+static const struct {
+    str_t name;
+    void (*fn) (bench_t* b);
+    int   arg;
+} BENCHMARKS[] = {
+    { "rxq_nextJob",         bench_rxq,            0 },
+    { "rxq_dropJob",         bench_rxqDrop,        0 },
+    { "s2e_addRxjob",        bench_addRxjob,       0 },
+    { "s2e_flushRxjobs",     bench_flushRx,        0 },
+    { "s2e_addTxjob",        bench_addTxjob,      10 },
+    { "s2e_addTxjob",        bench_addTxjob,     100 },
+    { "s2e_addTxjob",        bench_addTxjob,     250 },
+    { "uj_decode/dnmsg",     bench_ujDnmsg,        0 },
+    { "uj_decode/router_config", bench_ujRouterConfig, 0 },
+    { "xprintf",             bench_xprintf,        0 },
+    { "uj_encHex",           bench_ujEncHex,      23 },
+    { "uj_encHex",           bench_ujEncHex,     222 },
+    { "uj_hexstr",           bench_ujHexstr,      23 },
+    { "uj_hexstr",           bench_ujHexstr,     222 },
+    { "rt_setTimer",         bench_setTimer,      10 },
+    { "rt_setTimer",         bench_setTimer,     100 },
+    { "rt_setTimer",         bench_setTimer,    1000 },
+#if defined(CFG_linux) || defined(CFG_flashsim)
+    { "fs_write",            bench_fsWrite,      256 },
+    { "fs_read",             bench_fsRead,       256 },
+    { "fs_decrypt",          bench_fsDecrypt,      1 },
+    { "fs_decrypt",          bench_fsDecrypt,   1024 },
+    { "fs_crc",              bench_fsCrc,         64 },
+    { "fs_crc",              bench_fsCrc,       4096 },
+#endif // defined(CFG_linux) || defined(CFG_flashsim)
+    { NULL,                  NULL,                 0 }
+};
+
+
+void bench_start (bench_t* b) {
+    if( b->running )
+        return;
+    b->running = 1;
+    b->allocs0 = rt_nallocs;
+    b->t0 = rt_getTime();
+}
+
+void bench_stop (bench_t* b) {
+    if( !b->running )
+        return;
+    b->elapsed += rt_getTime() - b->t0;
+    b->allocs += rt_nallocs - b->allocs0;
+    b->running = 0;
+}
+
+
+int bench_upframe (u1_t* buf, u4_t seq) {
+    buf[0] = 0x40;                      // MHDR: unconfirmed data up
+    rt_wlsbf4(buf+1, 0x26000000 | (seq & 0xFFF));
+    buf[5] = 0x80;                      // FCtrl: ADR
+    rt_wlsbf2(buf+6, seq);
+    buf[8] = 1;                         // FPort
+    for( int i=0; i<10; i++ )
+        buf[9+i] = seq >> (i & 3);
+    rt_wlsbf4(buf+19, seq * 2654435761u);  // MIC
+    return 23;
+}
+
+
+void benchmarks () {
+    printf("{\"msgtype\":\"benchinfo\",\"version\":\"%s\",\"platform\":\"%s\",\"variant\":\"%s\",\"commit\":\"%s\"}\n",
+           CFG_version, CFG_platform, CFG_variant, CFG_commit);
+    for( int i=0; BENCHMARKS[i].fn; i++ ) {
+        bench_t b = { .name = BENCHMARKS[i].name, .arg = BENCHMARKS[i].arg };
+        for( int n=1; ; n *= 2 ) {
+            b.n = n;
+            b.elapsed = 0;
+            b.allocs = 0;
+            bench_start(&b);
+            BENCHMARKS[i].fn(&b);
+            bench_stop(&b);
+            if( b.elapsed >= BENCH_MIN_TIME || n >= BENCH_MAX_OPS )
+                break;
+        }
+        printf("{\"msgtype\":\"bench\",\"name\":\"%s\",\"arg\":%d,\"ops\":%d,\"ns_op\":%.1f,\"allocs_op\":%.3f}\n",
+               b.name, b.arg, b.n, b.elapsed*1e3/b.n, (double)b.allocs/b.n);
+        fflush(stdout);
+    }
+#if defined(CFG_simclock)
+    bench_dnstress();
+#endif // defined(CFG_simclock)
+    exit(0);
+}
+
+#else // !defined(CFG_benchmarks)
+
+void benchmarks () {}
+
+#endif // !defined(CFG_benchmarks)
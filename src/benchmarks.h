@@ -0,0 +1,72 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _benchmarks_h_
+#define _benchmarks_h_
+
+#include "rt.h"
+
+// One benchmark run. The benchmark function performs b->n operations.
+// Setup/teardown can be excluded from the measurement with bench_stop/bench_start.
+typedef struct bench {
+    str_t    name;
+    int      arg;        // parameter of the benchmark (e.g. queue depth)
+    int      n;          // operations to perform in this run
+    ustime_t t0;
+    ustime_t elapsed;
+    u4_t     allocs0;
+    u4_t     allocs;
+    u1_t     running;
+} bench_t;
+
+void bench_start (bench_t* b);
+void bench_stop  (bench_t* b);
+int  bench_upframe (u1_t* buf, u4_t seq);   // distinct unconfirmed data uplink - returns length
+
+extern void bench_rxq       (bench_t* b);
+extern void bench_rxqDrop   (bench_t* b);
+extern void bench_addRxjob  (bench_t* b);
+extern void bench_flushRx   (bench_t* b);
+extern void bench_addTxjob  (bench_t* b);
+extern void bench_ujDnmsg   (bench_t* b);
+extern void bench_ujRouterConfig (bench_t* b);
+extern void bench_xprintf   (bench_t* b);
+extern void bench_ujEncHex  (bench_t* b);
+extern void bench_ujHexstr  (bench_t* b);
+extern void bench_setTimer  (bench_t* b);
+extern void bench_fsWrite   (bench_t* b);
+extern void bench_fsRead    (bench_t* b);
+extern void bench_fsDecrypt (bench_t* b);
+extern void bench_fsCrc     (bench_t* b);
+
+void bench_dnstress ();      // downlink scheduling under simulated time - one JSON line per scenario
+
+void benchmarks ();
+
+#endif // _benchmarks_h_
@@ -351,6 +351,7 @@ static void cups_update_info (conn_t* _conn, int ev) {
                     assert(cstate == CUPS_FEED_UPDATE);
                     sys_commitConfigUpdate(); 
                     sys_updateStart(segm_len);
+                    cups->updcrc = 0;
                     LOG(MOD_CUP|INFO, "Update segment (%d bytes)", segm_len);
                 }
             }
@@ -374,9 +375,9 @@ static void cups_update_info (conn_t* _conn, int ev) {
             else { // cstate == CUPS_FEED_UPDATE
                 if( sys_updateCommit(cups->segm_len) ) {
                     cups->uflags |= UPDATE_FLAG(UPDATE);
-                    LOG(MOD_CUP|INFO, "Update received (%d bytes)", cups->segm_len);
+                    LOG(MOD_CUP|INFO, "Update received (%d bytes, crc=0x%08X)", cups->segm_len, cups->updcrc);
                 } else {
-                    LOG(MOD_CUP|ERROR, "Update received (%d bytes) but failed to write (ignored)", cups->segm_len);
+                    LOG(MOD_CUP|ERROR, "Update received (%d bytes, crc=0x%08X) but failed to write (ignored)", cups->segm_len, cups->updcrc);
                 }
             }
             goto next_cstate;
@@ -408,9 +409,11 @@ static void cups_update_info (conn_t* _conn, int ev) {
             }
         } else {
             assert(cstate == CUPS_FEED_UPDATE);
+            // Hash and CRC each chunk as it arrives - no re-reading of the update file
             if( cups->sig != NULL ) {
                 mbedtls_sha512_update(&cups->sig->sha, data, dlen);
             }
+            cups->updcrc = rt_crc32(cups->updcrc, data, dlen);
             sys_updateWrite(data, segm_off, dlen);
         }
         body.pos += dlen;
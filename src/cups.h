@@ -63,6 +63,7 @@ typedef struct cups {
     u1_t     temp[4];     // assemble length fields
     int      segm_off;
     int      segm_len;
+    u4_t     updcrc;      // CRC32 of update segment received so far
     tmrcb_t  ondone;
     cups_sig_t* sig;
 } cups_t;
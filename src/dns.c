@@ -0,0 +1,308 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+// --------------------------------------------------------------------------------
+//
+// Asynchronous name resolution
+//
+// getaddrinfo may block for the whole resolver timeout. Lookups are therefore
+// handed to a helper thread and completions are delivered back to the main
+// thread via an eventfd. Answers are kept in a small cache for DNS_CACHE_TTL
+// since getaddrinfo does not expose record TTLs.
+// The helper thread must not log or touch rt_malloc'ed memory other than the job
+// it is currently working on - jobs are only freed by the main thread.
+//
+// --------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include "s2conf.h"
+#include "sys.h"
+#include "dns.h"
+
+enum { DNS_CACHE_SIZE = 4 };
+enum { DNS_KEY_LEN = MAX_HOSTNAME_LEN+MAX_PORT_LEN+2 };
+
+typedef struct dnsjob {
+    struct dnsjob* next;
+    dnsreq_t*      req;       // NULL if cancelled
+    char           host[MAX_HOSTNAME_LEN+1];
+    char           port[MAX_PORT_LEN+1];
+    dnsres_t       res;
+} dnsjob_t;
+
+typedef struct dnsent {
+    ustime_t expires;         // 0 = unused
+    char     key[DNS_KEY_LEN];
+    dnsres_t res;
+} dnsent_t;
+
+static dnsent_t cache[DNS_CACHE_SIZE];
+
+
+static void makeKey (char* key, const char* host, const char* port) {
+    snprintf(key, DNS_KEY_LEN, "%s:%s", host, port);
+}
+
+static dnsent_t* cache_find (const char* key) {
+    ustime_t now = rt_getTime();
+    for( int i=0; i < DNS_CACHE_SIZE; i++ ) {
+        dnsent_t* e = &cache[i];
+        if( e->expires && strcmp(e->key, key) == 0 ) {
+            if( now <= e->expires )
+                return e;
+            e->expires = 0;
+        }
+    }
+    return NULL;
+}
+
+static void cache_add (const char* key, const dnsres_t* res) {
+    if( DNS_CACHE_TTL == 0 || res->err || res->naddrs == 0 )
+        return;
+    dnsent_t* e = &cache[0];
+    for( int i=0; i < DNS_CACHE_SIZE; i++ ) {
+        if( cache[i].expires == 0 || strcmp(cache[i].key, key) == 0 ) {
+            e = &cache[i];
+            break;
+        }
+        if( cache[i].expires < e->expires )
+            e = &cache[i];  // evict oldest
+    }
+    snprintf(e->key, sizeof(e->key), "%s", key);
+    e->res = *res;
+    e->expires = rt_getTime() + DNS_CACHE_TTL;
+}
+
+// Runs on helper thread if there is one
+static void lookup (dnsjob_t* job) {
+    struct addrinfo hints = { .ai_family=AF_UNSPEC, .ai_socktype=SOCK_STREAM, .ai_protocol=IPPROTO_TCP };
+    struct addrinfo* ai = NULL;
+    dnsres_t* res = &job->res;
+    res->naddrs = 0;
+    res->err = getaddrinfo(job->host, job->port, &hints, &ai);
+    if( res->err )
+        return;
+    for( struct addrinfo* a = ai; a && res->naddrs < DNS_MAX_ADDRS; a = a->ai_next ) {
+        if( a->ai_addrlen > sizeof(res->addr[0]) )
+            continue;
+        memcpy(&res->addr[res->naddrs], a->ai_addr, a->ai_addrlen);
+        res->addrlen[res->naddrs++] = a->ai_addrlen;
+    }
+    freeaddrinfo(ai);
+    if( res->naddrs == 0 )
+        res->err = EAI_NONAME;
+}
+
+static void complete (dnsjob_t* job) {
+    dnsreq_t* req = job->req;
+    if( req != NULL ) {
+        char key[DNS_KEY_LEN];
+        makeKey(key, job->host, job->port);
+        if( job->res.err ) {
+            LOG(MOD_AIO|ERROR, "Failed to resolve %s: %s", key, gai_strerror(job->res.err));
+        } else {
+            LOG(MOD_AIO|DEBUG, "Resolved %s: %d addresses", key, job->res.naddrs);
+        }
+        cache_add(key, &job->res);
+        req->res = job->res;
+        req->job = NULL;
+        rt_yieldTo(&req->tmr, req->tmr.callback);
+    }
+    rt_free(job);
+}
+
+
+#if defined(CFG_linux)
+
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static struct {
+    pthread_t       thr;
+    pthread_mutex_t mx;
+    pthread_cond_t  cv;
+    int             donefd;   // helper -> main: jobs completed
+    aio_t*          doneaio;
+    dnsjob_t*       todo;     // FIFO of pending lookups (protected by mx)
+    dnsjob_t*       done;     // LIFO of finished lookups (protected by mx)
+    u1_t            running;
+} dnsThr;
+
+
+static void* dns_main (void* ctx) {
+    sys_normalThread();
+    pthread_mutex_lock(&dnsThr.mx);
+    while(1) {
+        while( dnsThr.todo == NULL )
+            pthread_cond_wait(&dnsThr.cv, &dnsThr.mx);
+        dnsjob_t* job = dnsThr.todo;
+        dnsThr.todo = job->next;
+        int cancelled = job->req == NULL;
+        pthread_mutex_unlock(&dnsThr.mx);
+        if( !cancelled )
+            lookup(job);
+        pthread_mutex_lock(&dnsThr.mx);
+        job->next = dnsThr.done;
+        dnsThr.done = job;
+        eventfd_write(dnsThr.donefd, 1);
+    }
+    return NULL;
+}
+
+
+static void dns_done (aio_t* aio) {
+    eventfd_t v;
+    if( eventfd_read(aio->fd, &v) == -1 && errno == EAGAIN )
+        return;
+    pthread_mutex_lock(&dnsThr.mx);
+    dnsjob_t* job = dnsThr.done;
+    dnsThr.done = NULL;
+    pthread_mutex_unlock(&dnsThr.mx);
+    // Reverse to completion order
+    dnsjob_t* fifo = NULL;
+    while( job ) {
+        dnsjob_t* next = job->next;
+        job->next = fifo;
+        fifo = job;
+        job = next;
+    }
+    while( fifo ) {
+        dnsjob_t* next = fifo->next;
+        complete(fifo);
+        fifo = next;
+    }
+}
+
+
+static int dns_start () {
+    if( dnsThr.running )
+        return 1;
+    int fd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if( fd == -1 ) {
+        LOG(MOD_AIO|ERROR, "DNS eventfd failed: %s", strerror(errno));
+        return 0;
+    }
+    pthread_mutex_init(&dnsThr.mx, NULL);
+    pthread_cond_init(&dnsThr.cv, NULL);
+    dnsThr.donefd = fd;
+    int err = pthread_create(&dnsThr.thr, NULL, dns_main, NULL);
+    if( err ) {
+        LOG(MOD_AIO|ERROR, "DNS thread start failed: %s", strerror(err));
+        close(fd);
+        return 0;
+    }
+    pthread_detach(dnsThr.thr);
+    dnsThr.doneaio = aio_open(&dnsThr, fd, dns_done, NULL);
+    dnsThr.running = 1;
+    return 1;
+}
+
+
+static void submit (dnsjob_t* job) {
+    if( !dns_start() ) {
+        lookup(job);   // degrade to blocking lookup
+        complete(job);
+        return;
+    }
+    pthread_mutex_lock(&dnsThr.mx);
+    dnsjob_t** pp = &dnsThr.todo;
+    while( *pp )
+        pp = &(*pp)->next;
+    *pp = job;
+    pthread_cond_signal(&dnsThr.cv);
+    pthread_mutex_unlock(&dnsThr.mx);
+}
+
+static void unlink_req (dnsjob_t* job) {
+    pthread_mutex_lock(&dnsThr.mx);
+    job->req = NULL;
+    pthread_mutex_unlock(&dnsThr.mx);
+}
+
+#else // !defined(CFG_linux)
+
+static void submit (dnsjob_t* job) {
+    lookup(job);
+    complete(job);
+}
+
+static void unlink_req (dnsjob_t* job) {
+    job->req = NULL;
+}
+
+#endif // !defined(CFG_linux)
+
+
+void dns_resolve (dnsreq_t* req, const char* host, const char* port, tmrcb_t cb) {
+    dns_cancel(req);
+    rt_iniTimer(&req->tmr, cb);
+    char key[DNS_KEY_LEN];
+    makeKey(key, host, port);
+    dnsent_t* e = cache_find(key);
+    if( e ) {
+        LOG(MOD_AIO|DEBUG, "Resolved %s from cache: %d addresses", key, e->res.naddrs);
+        req->res = e->res;
+        rt_yieldTo(&req->tmr, cb);
+        return;
+    }
+    if( strlen(host) > MAX_HOSTNAME_LEN || strlen(port) > MAX_PORT_LEN ) {
+        req->res.err = EAI_NONAME;
+        req->res.naddrs = 0;
+        rt_yieldTo(&req->tmr, cb);
+        return;
+    }
+    dnsjob_t* job = rt_malloc(dnsjob_t);
+    strcpy(job->host, host);
+    strcpy(job->port, port);
+    job->req = req;
+    req->job = job;
+    submit(job);
+}
+
+
+void dns_cancel (dnsreq_t* req) {
+    rt_clrTimer(&req->tmr);
+    if( req->job ) {
+        unlink_req(req->job);
+        req->job = NULL;
+    }
+}
+
+
+void dns_forget (const char* host, const char* port) {
+    char key[DNS_KEY_LEN];
+    makeKey(key, host, port);
+    dnsent_t* e = cache_find(key);
+    if( e )
+        e->expires = 0;
+}
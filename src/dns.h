@@ -0,0 +1,58 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _dns_h_
+#define _dns_h_
+
+#include <sys/socket.h>
+#include "rt.h"
+
+enum { DNS_MAX_ADDRS = 8 };
+
+typedef struct dnsres {
+    int       err;       // 0 or EAI_xxx from getaddrinfo
+    u1_t      naddrs;
+    socklen_t addrlen[DNS_MAX_ADDRS];
+    struct sockaddr_storage addr[DNS_MAX_ADDRS];
+} dnsres_t;
+
+// A lookup in progress. Result is valid when tmr callback fires.
+typedef struct dnsreq {
+    tmr_t        tmr;
+    dnsres_t     res;
+    struct dnsjob* job;  // internal: pending lookup or NULL
+} dnsreq_t;
+
+// Resolve host/port without blocking the caller. Answers are cached for DNS_CACHE_TTL.
+// Callback is always invoked from the timer queue - never from within dns_resolve.
+void dns_resolve (dnsreq_t* req, const char* host, const char* port, tmrcb_t cb);
+void dns_cancel  (dnsreq_t* req);   // callback will not be invoked - safe to call if idle
+void dns_forget  (const char* host, const char* port);  // drop cached answer (e.g. all addresses failed)
+
+#endif // _dns_h_
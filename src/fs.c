@@ -28,6 +28,7 @@
 
 #include <stdio.h>
 #include <fcntl.h>
+#include <limits.h>
 
 
 #if defined(CFG_linux) || defined(CFG_flashsim)
@@ -42,6 +43,14 @@
 #include "uj.h"
 #include "fs.h"
 
+#if !defined(CFG_no_simd) && defined(__SSE2__)
+#include <emmintrin.h>
+#define FS_SIMD_SSE2 1
+#elif !defined(CFG_no_simd) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define FS_SIMD_NEON 1
+#endif
+
 // Flash is organized in 32bit words
 // Whole/part is split up into two sections.
 // If one section is full, a GC collection copies over
@@ -115,14 +124,44 @@ typedef struct fh {
     u2_t droff;   // offset inside data record
     u4_t faddr;
     u4_t foff;    // file read offset
+    u4_t rnext;   // index of next data record in fsent_t.recs
 } fh_t;
 
-
-struct ino_cache {
-    u4_t faddrFile;   // creating FILE record
-    u4_t faddrRename; // last rename
-    u4_t fncrc;
-};
+// In-RAM index of visible files. It mirrors what a backward scan of the
+// record log would find and is rebuilt by fs_ck/fs_gc and updated by each
+// record written. Files deleted/replaced while open are not in the index -
+// reads of such files fall back to scanning the log.
+typedef struct fsrec {
+    u4_t faddr;   // DATA record
+    u4_t dlen;    // bytes of data in record
+} fsrec_t;
+
+typedef struct fsent {
+    u4_t     fncrc;   // CRC of current name
+    u4_t     faddr;   // creating FILE record
+    u4_t     naddr;   // record holding current name (FILE or last RENAME)
+    u4_t     size;    // sum of all data records
+    u4_t     nrecs;
+    u4_t     maxrecs;
+    fsrec_t* recs;
+    u2_t     ino;
+} fsent_t;
+
+
+// Garbage collection copies visible files into the other section in small
+// steps driven by a timer while the current section stays authoritative.
+// Records appended meanwhile are replayed afterwards and only then are the
+// sections switched. A crash at any point leaves a consistent current section.
+#define GC_IDLE  0
+#define GC_COPY  1   // copying files visible at GC start
+#define GC_TAIL  2   // replaying records appended since GC start
+#define GC_ERASE 3   // erasing retired section page by page
+
+typedef struct gcfile {
+    u4_t naddr;   // record holding name at GC start
+    u2_t ino;     // ino in current section
+    u2_t nino;    // ino in other section (0 if not copied)
+} gcfile_t;
 
 
 #define AUXBUF_SZW (2*((FS_MAX_FNSIZE+3)/4))
@@ -143,6 +182,27 @@ static s1_t   fsSection = -1;   // 0|1, -1 no fs_ini called yet
 static const char DEFAULT_CWD[] = "/s2/";
 static str_t  cwd = DEFAULT_CWD;
 static fh_t   fhTable[FS_MAX_FD];
+static fsent_t* fsIdx;
+static u2_t     fsIdxCnt, fsIdxMax;
+static u2_t     eraseCnt[FS_PAGE_CNT];
+
+static struct gcstate {
+    u1_t      state;
+    u1_t      emergency;
+    u2_t      nino;     // next ino in other section
+    u4_t      wp;       // write pointer in other section
+    u4_t      snapEnd;  // flashWP at GC start
+    u4_t      src;      // next tail record to replay
+    u4_t      rsrc;     // record being copied (0 if none)
+    u4_t      rtag;     // its begin tag in other section
+    u4_t      roff;     // bytes of it already copied
+    u2_t      fi, ri;   // file/data record being copied
+    u2_t      nsnap;    // files visible at GC start
+    u2_t      nfiles, maxfiles;
+    gcfile_t* files;
+    u2_t      epage;    // next page of retired section to erase
+    tmr_t     tmr;
+} gc;
 
 static inline u4_t flashFsBeg() {
     return fsSection ? FLASH_BEG_B+4 : FLASH_BEG_A+4;
@@ -160,16 +220,37 @@ static u4_t decrypt1 (u4_t faddr, u4_t data) {
     return encrypt1(faddr, data);
 }
 
+// The key repeats every 16 bytes - XOR whole key periods at a time.
+static void cryptN (u4_t faddr, u4_t* data, uint u4cnt) {
+    uint ki = (faddr>>2) & 3, u = 0;
+    u4_t k[4] = { flashKey[ki], flashKey[(ki+1)&3], flashKey[(ki+2)&3], flashKey[(ki+3)&3] };
+#if defined(FS_SIMD_SSE2)
+    const __m128i kv = _mm_loadu_si128((const __m128i*)k);
+    for( ; u+4 <= u4cnt; u += 4 ) {
+        __m128i* p = (__m128i*)&data[u];
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), kv));
+    }
+#elif defined(FS_SIMD_NEON)
+    const uint32x4_t kv = vld1q_u32(k);
+    for( ; u+4 <= u4cnt; u += 4 )
+        vst1q_u32(&data[u], veorq_u32(vld1q_u32(&data[u]), kv));
+#endif
+    for( ; u+4 <= u4cnt; u += 4 ) {
+        data[u+0] ^= k[0];
+        data[u+1] ^= k[1];
+        data[u+2] ^= k[2];
+        data[u+3] ^= k[3];
+    }
+    for( ; u < u4cnt; u++ )
+        data[u] ^= k[u&3];
+}
+
 static void encryptN (u4_t faddr, u4_t* data, uint u4cnt) {
-    for( uint u=0; u<u4cnt; u++ ) {
-        data[u] = encrypt1(faddr+u*4, data[u]);
-    }
+    cryptN(faddr, data, u4cnt);
 }
 
 static void decryptN (u4_t faddr, u4_t* data, uint u4cnt) {
-    for( uint u=0; u<u4cnt; u++ ) {
-        data[u] = decrypt1(faddr+u*4, data[u]);
-    }
+    cryptN(faddr, data, u4cnt);
 }
 
 void wrFlash1 (u4_t faddr, u4_t data) {
@@ -230,16 +311,72 @@ static u4_t fctx_endtag (fctx_t* fctx) {
     return endtag;
 }
 
-static u2_t dataCrc (u2_t crc, const u1_t* data, uint len) {
-    u1_t a=crc>>8, b=crc&0xFF;
-    for( int i=0; i<len; i++ ) {
+#if defined(FS_SIMD_SSE2)
+static inline u4_t hsum_u4x4 (__m128i v) {
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0x4E));
+    v = _mm_add_epi32(v, _mm_shuffle_epi32(v, 0xB1));
+    return _mm_cvtsi128_si32(v);
+}
+#elif defined(FS_SIMD_NEON)
+static inline u4_t hsum_u4x4 (uint32x4_t v) {
+    return vgetq_lane_u32(v,0) + vgetq_lane_u32(v,1) + vgetq_lane_u32(v,2) + vgetq_lane_u32(v,3);
+}
+#endif
+
+// Fletcher style checksum: a sums bytes, b sums the running values of a.
+// Over a block of L bytes: b += L*a + sum((L-k)*data[k]) and a += sum(data[k]).
+// Sums are kept in u4_t - only the low 8 bits matter so wrap around is harmless.
+u2_t dataCrc (u2_t crc, const u1_t* data, uint len) {
+    u4_t a=crc>>8, b=crc&0xFF;
+    uint i = 0;
+#if defined(FS_SIMD_SSE2)
+    if( len >= 16 ) {
+        const __m128i z = _mm_setzero_si128();
+        const __m128i wlo = _mm_setr_epi16(16,15,14,13,12,11,10,9);
+        const __m128i whi = _mm_setr_epi16( 8, 7, 6, 5, 4, 3, 2,1);
+        __m128i vs = z, vps = z, vw = z;
+        uint n = len/16;
+        for( uint j=0; j<n; j++ ) {
+            __m128i v = _mm_loadu_si128((const __m128i*)(data+16*j));
+            vps = _mm_add_epi32(vps, vs);
+            vs  = _mm_add_epi32(vs, _mm_sad_epu8(v, z));
+            vw  = _mm_add_epi32(vw, _mm_madd_epi16(_mm_unpacklo_epi8(v, z), wlo));
+            vw  = _mm_add_epi32(vw, _mm_madd_epi16(_mm_unpackhi_epi8(v, z), whi));
+        }
+        b += 16*(n*a + hsum_u4x4(vps)) + hsum_u4x4(vw);
+        a += hsum_u4x4(vs);
+        i = 16*n;
+    }
+#elif defined(FS_SIMD_NEON)
+    if( len >= 16 ) {
+        static const u1_t W[16] = { 16,15,14,13,12,11,10,9, 8,7,6,5,4,3,2,1 };
+        const uint8x8_t wlo = vld1_u8(W), whi = vld1_u8(W+8);
+        uint32x4_t vs = vdupq_n_u32(0), vps = vs, vw = vs;
+        uint n = len/16;
+        for( uint j=0; j<n; j++ ) {
+            uint8x16_t v = vld1q_u8(data+16*j);
+            vps = vaddq_u32(vps, vs);
+            vs  = vpadalq_u16(vs, vpaddlq_u8(v));
+            vw  = vpadalq_u16(vw, vmull_u8(vget_low_u8(v), wlo));
+            vw  = vpadalq_u16(vw, vmull_u8(vget_high_u8(v), whi));
+        }
+        b += 16*(n*a + hsum_u4x4(vps)) + hsum_u4x4(vw);
+        a += hsum_u4x4(vs);
+        i = 16*n;
+    }
+#endif
+    for( ; i+4 <= len; i += 4 ) {
+        b += 4*a + 4*data[i] + 3*data[i+1] + 2*data[i+2] + data[i+3];
+        a += data[i] + data[i+1] + data[i+2] + data[i+3];
+    }
+    for( ; i<len; i++ ) {
         b += (a += data[i]);
     }
     while( -len & 3 ) {
         b += a;
         len++;
     }
-    return (a<<8)|b;
+    return ((a&0xFF)<<8)|(b&0xFF);
 }
 
 static u4_t fnCrc (const char* fn) {
@@ -249,18 +386,26 @@ static u4_t fnCrc (const char* fn) {
     return UJ_FINISH_CRC(crc);
 }
 
+static void gc_poll (u4_t reqbytes);
+
 static int isFlashFull (u4_t reqbytes) {
     int emergency = 0;
     reqbytes = (reqbytes + 3) & ~3;
-    while( flashWP + reqbytes > flashFsMax() || nextIno >= MAX_INO-2 ) {
-        if( emergency == 2 ) {
-            // No space even after an emergency clean up
-            errno = ENOSPC;
-            return -1;
+    if( flashWP + reqbytes > flashFsMax() || nextIno >= MAX_INO-2 ) {
+        // GC uses auxbuf - keep normalized filename of caller
+        union auxbuf save = auxbuf;
+        while( flashWP + reqbytes > flashFsMax() || nextIno >= MAX_INO-2 ) {
+            if( emergency == 2 ) {
+                // No space even after an emergency clean up
+                errno = ENOSPC;
+                return -1;
+            }
+            fs_gc(emergency);
+            emergency++;
         }
-        fs_gc(emergency);
-        emergency++;
+        auxbuf = save;
     }
+    gc_poll(reqbytes);
     return 0;
 }
 
@@ -336,6 +481,107 @@ static void fctx_setTo (fctx_t* fctx, u4_t faddr) {
 }
 
 
+static fsent_t* idx_find (u4_t fncrc) {
+    for( int i=0; i<fsIdxCnt; i++ ) {
+        if( fsIdx[i].fncrc == fncrc )
+            return &fsIdx[i];
+    }
+    return NULL;
+}
+
+static fsent_t* idx_byIno (u2_t ino) {
+    for( int i=0; i<fsIdxCnt; i++ ) {
+        if( fsIdx[i].ino == ino )
+            return &fsIdx[i];
+    }
+    return NULL;
+}
+
+static void idx_remove (fsent_t* e) {
+    if( e == NULL )
+        return;
+    rt_free(e->recs);
+    *e = fsIdx[--fsIdxCnt];
+}
+
+static void idx_clear () {
+    while( fsIdxCnt > 0 )
+        idx_remove(&fsIdx[0]);
+}
+
+// Apply the effect of a record appended to the log
+static void idx_apply (u1_t cmd, u2_t ino, u4_t faddr, u4_t crc, u4_t crc2, u4_t dlen) {
+    fsent_t* e;
+    switch( cmd ) {
+    case FSCMD_FILE: {
+        if( crc == 0 )
+            break;   // end of GC marker
+        idx_remove(idx_find(crc));
+        if( fsIdxCnt == fsIdxMax ) {
+            fsIdxMax += 16;
+            fsent_t* a = rt_mallocN(fsent_t, fsIdxMax);
+            if( fsIdxCnt )
+                memcpy(a, fsIdx, fsIdxCnt*sizeof(*a));
+            rt_free(fsIdx);
+            fsIdx = a;
+        }
+        e = &fsIdx[fsIdxCnt++];
+        memset(e, 0, sizeof(*e));
+        e->fncrc = crc;
+        e->faddr = faddr;
+        e->naddr = faddr;
+        e->ino   = ino;
+        break;
+    }
+    case FSCMD_DELETE: {
+        idx_remove(idx_find(crc));
+        break;
+    }
+    case FSCMD_RENAME: {
+        idx_remove(idx_find(crc2));
+        if( (e = idx_find(crc)) != NULL ) {
+            e->fncrc = crc2;
+            e->naddr = faddr;
+        }
+        break;
+    }
+    case FSCMD_DATA: {
+        if( (e = idx_byIno(ino)) == NULL )
+            break;  // file no longer visible
+        if( e->nrecs == e->maxrecs ) {
+            e->maxrecs = e->maxrecs ? 2*e->maxrecs : 4;
+            fsrec_t* a = rt_mallocN(fsrec_t, e->maxrecs);
+            if( e->nrecs )
+                memcpy(a, e->recs, e->nrecs*sizeof(*a));
+            rt_free(e->recs);
+            e->recs = a;
+        }
+        e->recs[e->nrecs].faddr = faddr;
+        e->recs[e->nrecs].dlen  = dlen;
+        e->nrecs += 1;
+        e->size  += dlen;
+        break;
+    }
+    }
+}
+
+static void idx_rebuild () {
+    idx_clear();
+    u4_t faddr = flashFsBeg();
+    while( faddr < flashWP ) {
+        u4_t begtag = rdFlash1(faddr);
+        u4_t len = FSTAG_len(begtag);
+        u1_t cmd = FSTAG_cmd(begtag);
+        if( cmd == FSCMD_DATA ) {
+            idx_apply(cmd, FSTAG_ino(begtag), faddr, 0, 0, len - FSTAG_pad(rdFlash1(faddr+4+len)));
+        } else {
+            idx_apply(cmd, FSTAG_ino(begtag), faddr, rdFlash1(faddr+4), cmd == FSCMD_RENAME ? rdFlash1(faddr+8) : 0, 0);
+        }
+        faddr += len + 8;
+    }
+}
+
+
 static int checkFilename (const char* fn) {
     if( fn == NULL ) {
         errno = EFAULT;
@@ -364,28 +610,10 @@ static int fs_findFile (fctx_t* fctx, const char* fn) {
         fnlen = auxbuf.u4[0];
     }
     char* wb = (char*)&auxbuf.u1[12];
-    u4_t seekcrc = auxbuf.u4[1] = fnCrc(wb);
-    u4_t faddr = flashWP;  // end of last record
-    while( faddr > flashFsBeg() ) {
-        u4_t endtag = rdFlash1(faddr-4);
-        u4_t len = FSTAG_len(endtag);
-        faddr -= len+8;
-        u4_t begtag = rdFlash1(faddr);
-        u1_t cmd = FSTAG_cmd(begtag);
-        if( cmd == FSCMD_DATA )
-            continue;
-        u4_t fncrc = rdFlash1(faddr+4);
-        if( seekcrc == fncrc ) {
-            if( cmd == FSCMD_RENAME || cmd == FSCMD_DELETE )
-                break;
-            assert(cmd == FSCMD_FILE);
-            fctx_setTo(fctx, faddr);
-            fctx->begtag = begtag;
-            fctx->endtag = endtag;
-            return 0;
-        }
-        if( cmd == FSCMD_RENAME && seekcrc == rdFlash1(faddr+8) )
-            seekcrc = fncrc;
+    fsent_t* ent = idx_find(auxbuf.u4[1] = fnCrc(wb));
+    if( ent != NULL ) {
+        fctx_setTo(fctx, ent->faddr);
+        return 0;
     }
     errno = ENOENT;
     return -1;
@@ -418,7 +646,9 @@ static int fs_handleFile (const char* fn, const char* fn2, u1_t cmd, u2_t ino) {
     auxbuf.u4[0] = FSTAG_mkBeg(cmd, ino, fnlen, 0);
     u4_t dlen4 = fnlen/4+2;
     auxbuf.u4[dlen4-1] = FSTAG_mkEnd(dataCrc(CRC_INI, &auxbuf.u1[4], fnlen), fnlen, 0);
+    u4_t faddr = flashWP;
     wrFlashNwp(auxbuf.u4, dlen4, 1);
+    idx_apply(cmd, ino, faddr, auxbuf.u4[1], auxbuf.u4[2], 0);
     return 0;
 }
 
@@ -431,6 +661,7 @@ static int fs_createFile (fh_t* fh, const char* fn) {
     fh->ino   = FSTAG_ino(begtag);
     fh->droff = FSTAG_len(begtag);  // full - read moves on to next
     fh->foff  = 0;
+    fh->rnext = 0;
     return 0;
 }
 
@@ -468,6 +699,16 @@ static int fs_findNextDataRecord (fctx_t* fctx, u2_t ino) {
     return 1;
 }
 
+static int fs_nextDataRecord (fctx_t* fctx, fh_t* fh) {
+    fsent_t* e = idx_byIno(fh->ino);
+    if( e == NULL )  // not visible anymore (deleted/replaced) - scan log
+        return fs_findNextDataRecord(fctx, 0);
+    if( fh->rnext >= e->nrecs )
+        return 0;
+    fctx_setTo(fctx, e->recs[fh->rnext++].faddr);
+    return 1;
+}
+
 int fs_read (int fd, void* dp, int dlen) {
     u1_t* data = (u1_t*)dp;
     fh_t* fh = fd2fh(fd);
@@ -513,7 +754,7 @@ int fs_read (int fd, void* dp, int dlen) {
             }
             data += cpylen;
         }
-        if( !fs_findNextDataRecord(fctx, 0) ) {
+        if( !fs_nextDataRecord(fctx, fh) ) {
             // Keep data record - droff indicates no more
             // data in this one. Next read wil check again if
             // data blocks have been appended
@@ -559,6 +800,7 @@ int fs_write (int fd, const void* dp, int dlen) {
     u1_t* tb = &auxbuf.u1[4];
     int   tblen = sizeof(auxbuf.u1)-8;
     auxbuf.u4[0] = FSTAG_mkBeg(FSCMD_DATA, fh->ino, dlenCeil, 0);
+    idx_apply(FSCMD_DATA, fh->ino, flashWP, 0, 0, dlen);
     while( !tend ) {
         int cpylen = dlen-doff;
         if( cpylen > tblen )
@@ -711,6 +953,7 @@ int fs_open (str_t fn, int mode, ...) {
         fh->droff = FSTAG_len(begtag);  // full - read moves on to next
         fh->foff  = 0;
         fh->faddr = fctx->faddr;
+        fh->rnext = 0;
     }
     else {
         errno = EINVAL;
@@ -748,11 +991,7 @@ int fs_stat (str_t fn, struct stat* st) {
         return -1;
     u2_t ino = FSTAG_ino(fctx_begtag(&fctxCache));
     u4_t ctim = rdFlash1(fctxCache.faddr+8);
-    uint sz = 0;
-    while( fs_findNextDataRecord(&fctxCache, ino) ) {
-        u4_t endtag = fctx_endtag(&fctxCache);
-        sz += FSTAG_len(endtag) - FSTAG_pad(endtag);
-    }
+    uint sz = idx_byIno(ino)->size;
     memset(st, 0, sizeof(*st));
     st->st_mode = 0006;
     st->st_ino = ino;
@@ -777,6 +1016,32 @@ int fs_lseek (int fd, int offset, int whence) {
         return -1;
     }
     u2_t ino = fh->ino;
+    fsent_t* e = idx_byIno(ino);
+    if( e != NULL ) {
+        u4_t foff = 0;
+        for( u4_t ri=0; ri < e->nrecs; ri++ ) {
+            foff += e->recs[ri].dlen;
+            if( foff >= offset ) {
+                fh->faddr = e->recs[ri].faddr;
+                fh->droff = e->recs[ri].dlen - (foff-offset);
+                fh->foff  = offset;
+                fh->rnext = ri+1;
+                return 0;
+            }
+        }
+        // Offset beyond end of file - position at end
+        if( e->nrecs ) {
+            fh->faddr = e->recs[e->nrecs-1].faddr;
+            fh->droff = e->recs[e->nrecs-1].dlen;
+        } else {
+            fh->faddr = e->faddr;
+            fh->droff = FSTAG_len(rdFlash1(e->faddr));
+        }
+        fh->foff  = foff;
+        fh->rnext = e->nrecs;
+        return 0;
+    }
+    // File is not visible anymore - scan log
     fctx_setTo(&fctxCache, flashFsBeg());
     int droff=0, foff=0;
     while( fs_findNextDataRecord(&fctxCache, ino) ) {
@@ -831,6 +1096,20 @@ static int fs_validateRecord (fctx_t* fctx) {
 }
 
 
+static void fs_erasePage (u4_t pgaddr) {
+    sys_eraseFlash(pgaddr, 1);
+    u2_t* cnt = &eraseCnt[(pgaddr - FLASH_BEG_A) / FLASH_PAGE_SIZE];
+    if( *cnt != 0xFFFF )
+        *cnt += 1;
+}
+
+static void gc_reset () {
+    rt_clrTimer(&gc.tmr);
+    rt_free(gc.files);
+    memset(&gc, 0, sizeof(gc));
+}
+
+
 static void fs_smartErase (u4_t pgaddr, u4_t pagecnt) {
     while( pagecnt > 0 ) {
         u4_t off=0, len=AUXBUF_SZ4;
@@ -841,7 +1120,7 @@ static void fs_smartErase (u4_t pgaddr, u4_t pagecnt) {
             sys_readFlash(pgaddr+off, auxbuf.u4, lenw);
             for( int wi=0; wi<lenw; wi++ ) {
                 if( auxbuf.u4[wi] != FLASH_ERASED ) {
-                    sys_eraseFlash(pgaddr, 1);
+                    fs_erasePage(pgaddr);
                     goto nextpage;
                 }
             }
@@ -862,6 +1141,8 @@ static void fs_smartErase (u4_t pgaddr, u4_t pagecnt) {
 int fs_ck () {
     u4_t magic[2];
 
+    gc_reset();
+
     fsSection = 1;
     magic[1] = rdFlash1(FLASH_BEG_B);
     fsSection = 0;
@@ -874,6 +1155,7 @@ int fs_ck () {
         flashWP = flashFsBeg()-4;
         wrFlash1wp(FLASH_MAGIC<<16);
         nextIno = 1;
+        idx_clear();
         LOG(MOD_SYS|INFO, "FSCK initializing pristine flash");
         return 0;
     }
@@ -904,6 +1186,7 @@ int fs_ck () {
     }
     nextIno = maxino+1;           // unlikely ino rollover! -> emergency gc
     flashWP = fctxCache.faddr;
+    idx_rebuild();
     LOG(MOD_SYS|INFO, "FSCK section %c: %d records, %d bytes used, %d bytes free",
         fsSection+'A', rcnt, flashWP - (flashFsBeg()-4), flashFsMax()-flashWP);
 
@@ -918,6 +1201,8 @@ int fs_ck () {
         for( int wi=0; wi<lenw; wi++ ) {
             if( auxbuf.u4[wi] != FLASH_ERASED ) {
                 LOG(MOD_SYS|INFO, "FSCK section %c followed by dirty flash - GC required.", fsSection+'A');
+                // Other section might hold remains of an aborted GC
+                fs_smartErase(fsSection ? FLASH_BEG_A : FLASH_BEG_B, FS_PAGE_CNT/2);
                 fs_gc(0);
                 return 2;
             }
@@ -949,170 +1234,286 @@ void fs_info(fsinfo_t* infop) {
         rcnt++;
     }
     infop->records = rcnt;
+    infop->gcState = gc.state;
+    infop->erases = infop->eraseMax = 0;
+    for( int pi=0; pi < FS_PAGE_CNT; pi++ ) {
+        infop->erases += eraseCnt[pi];
+        if( eraseCnt[pi] > infop->eraseMax )
+            infop->eraseMax = eraseCnt[pi];
+    }
     memcpy(infop->key, flashKey, sizeof(infop->key));
 }
 
 
-void fs_gc (int emergency) {
-    // Invalidate all open files
-    // If any one of them survises GC it'll be reinstated
-    for( int fdi=0; fdi < FS_MAX_FD; fdi++ ) {
-        if( fhTable[fdi].ino != 0 )
-            fhTable[fdi].ino |= MAX_INO+1;  // invalidate
+static gcfile_t* gc_addFile (u4_t naddr, u2_t ino) {
+    if( gc.nfiles == gc.maxfiles ) {
+        gc.maxfiles += 16;
+        gcfile_t* a = rt_mallocN(gcfile_t, gc.maxfiles);
+        if( gc.nfiles )
+            memcpy(a, gc.files, gc.nfiles*sizeof(*a));
+        rt_free(gc.files);
+        gc.files = a;
+    }
+    gcfile_t* f = &gc.files[gc.nfiles++];
+    f->naddr = naddr;
+    f->ino   = ino;
+    f->nino  = 0;
+    return f;
+}
+
+static u2_t gc_mapIno (u2_t ino) {
+    for( int i=0; i<gc.nfiles; i++ ) {
+        if( gc.files[i].ino == ino )
+            return gc.files[i].nino;
     }
+    return 0;
+}
 
-    u4_t faddrCont = flashFsBeg();
-    u4_t faddrEnd = flashWP;
+// Copy record gc.rsrc to the other section replacing its begin tag by gc.rtag.
+// Large records are copied over several steps.
+// Returns remaining budget or -1 if record is not complete yet.
+static int gc_copyRecord (int budget) {
+    u4_t len = FSTAG_len(gc.rtag) + 8;
+    while( gc.roff < len ) {
+        if( budget <= 0 )
+            return -1;
+        u4_t n = len - gc.roff;
+        if( n > AUXBUF_SZ4 )
+            n = AUXBUF_SZ4;
+        rdFlashN(gc.rsrc + gc.roff, auxbuf.u4, n/4);
+        if( gc.roff == 0 )
+            auxbuf.u4[0] = gc.rtag;
+        wrFlashN(gc.wp, auxbuf.u4, n/4, 0);
+        gc.wp   += n;
+        gc.roff += n;
+        budget  -= n;
+    }
+    gc.rsrc = gc.roff = 0;
+    return budget < 0 ? 0 : budget;
+}
+
+// Write a FILE record for a file as it was named at GC start.
+// A rename is folded into the FILE record.
+// Returns bytes written or 0 if file is dropped.
+static int gc_copyFile (gcfile_t* f, fsent_t* e) {
+    u4_t begtag = rdFlash1(f->naddr);
+    u2_t len = FSTAG_len(begtag);
+    rdFlashN(f->naddr, auxbuf.u4, len/4+2);
+    char* fn = (char*)&auxbuf.u4[3];
+    if( FSTAG_cmd(begtag) == FSCMD_RENAME ) {
+        // Extract new filename from RENAME record
+        // and copy to start of a new FILE record
+        char* fn2 = fn + strlen(fn)+1;
+        len = strlen(fn2)+1;
+        auxbuf.u4[1] = auxbuf.u4[2];          // fncrc
+        auxbuf.u4[2] = rdFlash1(e->faddr+8);  // ctim
+        memmove(fn, fn2, len);
+        while( (len&3) != 0 )
+            fn[len++] = 0;
+        len = len+8;
+        u2_t dcrc = dataCrc(CRC_INI, &auxbuf.u1[4], len);
+        auxbuf.u4[len/4+1] = FSTAG_mkEnd(dcrc, len, 0);
+    }
+    if( gc.emergency && strstr(fn, ".log") != NULL )
+        return 0; // do not copy over any log files
+    f->nino = gc.nino++;
+    auxbuf.u4[0] = FSTAG_mkBeg(FSCMD_FILE, f->nino, len, 0);
+    wrFlashN(gc.wp, auxbuf.u4, len/4+2, 0);
+    gc.wp += len+8;
+    return len+8;
+}
 
+static void gc_begin (int emergency) {
+    gc.state     = GC_COPY;
+    gc.emergency = emergency;
+    gc.snapEnd   = flashWP;
+    gc.fi = gc.ri = 0;
+    gc.rsrc = gc.roff = 0;
+    gc.nfiles = 0;
+    for( int i=0; i<fsIdxCnt; i++ )
+        gc_addFile(fsIdx[i].naddr, fsIdx[i].ino);
+    gc.nsnap = gc.nfiles;
     fsSection ^= 1;
-    flashWP = flashFsBeg() - 4;
+    gc.wp = flashFsBeg() - 4;
+    fsSection ^= 1;
+    wrFlash1(gc.wp, rdFlash1(flashFsBeg()-4) + 1);
+    gc.wp += 4;
+    gc.nino = 1;
+}
+
+static void gc_switch () {
+    // Open files follow their file into the new section.
+    // Files deleted/replaced while open do not survive.
+    for( int fdi=0; fdi < FS_MAX_FD; fdi++ ) {
+        fh_t* fh = &fhTable[fdi];
+        if( fh->ino == 0 || fh->ino > MAX_INO )
+            continue;
+        u2_t nino = idx_byIno(fh->ino) != NULL ? gc_mapIno(fh->ino) : 0;
+        fh->ino = nino ? nino : fh->ino | (MAX_INO+1);  // disable
+    }
+    // Wipe magic of retired section first - new section is current from now on.
+    // Remaining pages are erased in the background.
+    fs_erasePage(flashFsBeg()-4);
     fsSection ^= 1;
-    wrFlash1wp(rdFlash1(flashFsBeg()-4) + 1);
-    nextIno = 1;
-
-    while( faddrCont < faddrEnd ) {
-        // Start a new collect phase - gather a set inodes
-        // and follow them til the end of the FS log.
-        // Cache is all zeros
-        struct ino_cache inocache[16] = {{ 0 }};
-        
-        u1_t ucache = 0;
-        u1_t overflow = 0;
-        u4_t faddr = faddrCont;
-        u4_t begtag;
-        faddrCont = faddrEnd;
-        for(; faddr < faddrEnd; faddr += 8 + FSTAG_len(begtag) ) {
-            begtag = rdFlash1(faddr);
-            u1_t cmd = FSTAG_cmd(begtag);
-            if( cmd == FSCMD_DATA )
-                continue;
-            u4_t fncrc = rdFlash1(faddr+4);
-            s1_t match = -1;
-            // Is file in cache?
-            for( u1_t ui=0; ui<ucache; ui++ ) {
-                if( fncrc == inocache[ui].fncrc ) {
-                    match = ui;
+    flashWP = gc.wp;
+    nextIno = gc.nino;
+    idx_rebuild();
+    rt_free(gc.files);
+    gc.files = NULL;
+    gc.nfiles = gc.maxfiles = 0;
+    gc.state = GC_ERASE;
+    gc.epage = 1;
+
+    for( int fdi=0; fdi < FS_MAX_FD; fdi++ ) {
+        if( fhTable[fdi].ino != 0 &&
+            fhTable[fdi].ino <= MAX_INO &&
+            fhTable[fdi].faddr != 0 ) {
+            if( fs_lseek(OFF_FD+fdi, fhTable[fdi].foff, SEEK_SET) == -1 ) {
+                fhTable[fdi].ino |= MAX_INO+1;  // disable
+            }
+        }
+    }
+}
+
+int fs_gcStep (int budget) {
+    while( budget > 0 ) {
+        switch( gc.state ) {
+        case GC_IDLE: {
+            return 0;
+        }
+        case GC_COPY: {
+            if( gc.rsrc == 0 ) {
+                if( gc.fi >= gc.nsnap ) {
+                    gc.state = GC_TAIL;
+                    gc.src = gc.snapEnd;
                     break;
                 }
-            }
-            if( match >= 0 ) {
-                // File is tracked in cache - update cache with effects of found command
-                if( cmd == FSCMD_FILE ) {
-                    // Override previous definition
-                    inocache[match].faddrFile = faddr;
-                    inocache[match].faddrRename = 0;
-                    inocache[match].fncrc = fncrc;
+                gcfile_t* f = &gc.files[gc.fi];
+                fsent_t* e = idx_byIno(f->ino);
+                int n;
+                if( e != NULL && gc.ri == 0 && (n = gc_copyFile(f, e)) > 0 ) {
+                    gc.ri = 1;
+                    budget -= n;
+                    break;
                 }
-                else if( cmd == FSCMD_DELETE ) {
-                    // Remove info from cache - keep list compact
-                    ucache -= 1;
-                    if( match != ucache )                   // last element remove?
-                        inocache[match] = inocache[ucache]; // copy last down to fill the gap
-                    memset(&inocache[ucache], 0, sizeof(inocache[ucache]));
-                    // If all tracked files are gone and we had an overflow then
-                    // we can stop here and restart at continuation faddr
-                    if( ucache == 0 && overflow )
-                        break;
+                if( e == NULL || gc.ri == 0 || gc.ri > e->nrecs || e->recs[gc.ri-1].faddr >= gc.snapEnd ) {
+                    // File gone/dropped or all its data as of GC start copied.
+                    // Anything appended since is replayed from the tail.
+                    gc.fi += 1;
+                    gc.ri = 0;
+                    budget -= 8;
+                    break;
                 }
-                else if( cmd == FSCMD_RENAME ) {
-                    // Update to new name and remember the record containing the latest name
-                    inocache[match].faddrRename = faddr;
-                    inocache[match].fncrc = rdFlash1(faddr+8);
+                gc.rsrc = e->recs[gc.ri-1].faddr;
+                gc.rtag = FSTAG_mkBeg(FSCMD_DATA, f->nino, FSTAG_len(rdFlash1(gc.rsrc)), 0);
+            }
+            if( (budget = gc_copyRecord(budget)) < 0 )
+                return 1;
+            gc.ri += 1;
+            break;
+        }
+        case GC_TAIL: {
+            if( gc.rsrc == 0 ) {
+                if( gc.src >= flashWP ) {
+                    gc_switch();
+                    return 1;
                 }
-            } else if( cmd == FSCMD_FILE && !overflow ) {
-                // Found a new file not yet tracked and cache is likely not yet full
-                if( ucache < SIZE_ARRAY(inocache) ) {
-                    // Append this file to cache
-                    inocache[ucache].faddrFile = faddr;
-                    inocache[ucache].fncrc = fncrc;
-                    ucache += 1;
-                } else {
-                    // Cache is full - this means we have to restart GC scan
-                    // at this point again. For the set of files in the cache
-                    // we keep following them until faddrEnd and see if they survive
-                    // and if so in what state.
-                    overflow = 1;
-                    faddrCont = faddr;
+                u4_t faddr = gc.src;
+                u4_t begtag = rdFlash1(faddr);
+                u1_t cmd = FSTAG_cmd(begtag);
+                gc.src += FSTAG_len(begtag) + 8;
+                if( cmd == FSCMD_FILE || cmd == FSCMD_DATA ) {
+                    u2_t ino = FSTAG_ino(begtag), nino;
+                    if( idx_byIno(ino) == NULL ) {
+                        budget -= 8;  // file not visible anymore
+                        break;
+                    }
+                    if( cmd == FSCMD_FILE ) {
+                        nino = gc_addFile(faddr, ino)->nino = gc.nino++;
+                    }
+                    else if( (nino = gc_mapIno(ino)) == 0 ) {
+                        budget -= 8;  // file was dropped
+                        break;
+                    }
+                    begtag = FSTAG_mkBeg(cmd, nino, FSTAG_len(begtag), FSTAG_pad(begtag));
                 }
+                gc.rsrc = faddr;
+                gc.rtag = begtag;
             }
+            if( (budget = gc_copyRecord(budget)) < 0 )
+                return 1;
+            break;
         }
-        // cache contains surviving files - copy them over to other section.
-        for( u1_t ui=0; ui<ucache; ui++ ) {
-            // Create a new FILE record
-            struct ino_cache* c = &inocache[ui];
-            u4_t a = c->faddrRename ? c->faddrRename : c->faddrFile;
-            u4_t begtag = rdFlash1(a);
-            u2_t len = FSTAG_len(begtag);
-            rdFlashN(a, auxbuf.u4, len/4+2);
-            if( c->faddrRename ) {
-                // Extract new filename from last RENAME record
-                // and copy to start of a new FILE record
-                char* fn = (char*)&auxbuf.u4[3];
-                char* fn2 = fn + strlen(fn)+1;
-                len = strlen(fn2)+1;
-                auxbuf.u4[1] = auxbuf.u4[2];             // fncrc
-                auxbuf.u4[2] = rdFlash1(c->faddrFile+8); // ctim
-                memmove(fn, fn2, len);
-                while( (len&3) != 0 )
-                    fn[len++] = 0;
-                len = len+8;
-                u2_t dcrc = dataCrc(CRC_INI, &auxbuf.u1[4], len);
-                auxbuf.u4[len/4+1] = FSTAG_mkEnd(dcrc, len, 0);
-            }
-            if( emergency ) {
-                char* fn = (char*)&auxbuf.u4[3];
-                if( strstr(fn, ".log") != NULL )
-                    continue; // do not copy over any log files
-            }
-            auxbuf.u4[0] = FSTAG_mkBeg(FSCMD_FILE, nextIno+ui, len, 0);
-            wrFlashNwp(auxbuf.u4, len/4+2, 0);
-
-            // Fixup open file table
-            u2_t ino = FSTAG_ino(begtag);
-            for( int fdi=0; fdi < FS_MAX_FD; fdi++ ) {
-                if( fhTable[fdi].ino == ino+MAX_INO+1 )
-                    fhTable[fdi].ino = nextIno+ui;
+        case GC_ERASE: {
+            if( gc.epage >= FS_PAGE_CNT/2 ) {
+                gc.state = GC_IDLE;
+                return 0;
             }
-
-            // Copy all DATA records for this ino
-            a = c->faddrFile;
-            do {
-                begtag = rdFlash1(a);
-                len = 8 + FSTAG_len(begtag);
-                if( FSTAG_cmd(begtag) == FSCMD_DATA && FSTAG_ino(begtag) == ino ) {
-                    u4_t off = 0;
-                    while( off < len ) {
-                        u4_t n = len-off;
-                        if( n > AUXBUF_SZ4 )
-                            n = AUXBUF_SZ4;
-                        rdFlashN(a+off, auxbuf.u4, n/4);
-                        if( off == 0 )
-                            auxbuf.u4[0] = FSTAG_mkBeg(FSCMD_DATA, nextIno+ui, len-8, 0);
-                        wrFlashNwp(auxbuf.u4, n/4, 0);
-                        off += n;
-                    }
-                }
-                a += len;
-            } while( a < faddrEnd );
+            fs_smartErase((fsSection ? FLASH_BEG_A : FLASH_BEG_B) + gc.epage*FLASH_PAGE_SIZE, 1);
+            gc.epage += 1;
+            budget -= FLASH_PAGE_SIZE;
+            break;
+        }
         }
-        nextIno += ucache;
     }
-    sys_eraseFlash(flashFsBeg()-4, FS_PAGE_CNT/2);
-    fsSection ^= 1;
+    return gc.state != GC_IDLE;
+}
 
-    for( int fdi=0; fdi < FS_MAX_FD; fdi++ ) {
-        if( fhTable[fdi].ino != 0 &&
-            fhTable[fdi].ino <= MAX_INO &&
-            fhTable[fdi].faddr != 0 ) {
-            if( fs_lseek(OFF_FD+fdi, fhTable[fdi].foff, SEEK_SET) == -1 ) {
-                fhTable[fdi].ino |= MAX_INO+1;  // disable
-            }
+static void gc_timeout (tmr_t* tmr) {
+    if( fs_gcStep(FS_GC_STEP) )
+        rt_setTimer(tmr, rt_micros_ahead(FS_GC_INTV));
+}
+
+static void gc_kick () {
+    if( gc.state != GC_IDLE )
+        rt_setTimerCb(&gc.tmr, rt_micros_ahead(FS_GC_INTV), gc_timeout);
+}
+
+int fs_gcBackground () {
+    if( gc.state != GC_IDLE || fsSection < 0 )
+        return -1;
+    gc_begin(0);
+    gc_kick();
+    return 0;
+}
+
+// Start a background GC once free space runs low - but only if it reclaims
+// a fair amount of space. Each GC cycle costs an erase of a full section.
+static void gc_poll (u4_t reqbytes) {
+    if( gc.state != GC_IDLE || flashWP + reqbytes + FS_GC_RESERVE <= flashFsMax() )
+        return;
+    u4_t live = 4;
+    for( int i=0; i<fsIdxCnt; i++ ) {
+        fsent_t* e = &fsIdx[i];
+        live += FSTAG_len(rdFlash1(e->naddr)) + 8 + e->size + 11*e->nrecs;
+    }
+    if( flashWP - (flashFsBeg()-4) < live + FS_GC_RESERVE )
+        return;
+    fs_gcBackground();
+}
+
+void fs_gc (int emergency) {
+    if( gc.state == GC_COPY || gc.state == GC_TAIL ) {
+        // Complete GC running in the background
+        while( gc.state == GC_COPY || gc.state == GC_TAIL )
+            fs_gcStep(INT_MAX);
+        if( !emergency ) {
+            gc_kick();
+            return;
         }
     }
+    // Other section must be erased before it can be written
+    while( gc.state == GC_ERASE )
+        fs_gcStep(INT_MAX);
+    gc_begin(emergency);
+    while( gc.state != GC_ERASE )
+        fs_gcStep(INT_MAX);
+    gc_kick();
 }
 
 
 void fs_erase () {
+    gc_reset();
     sys_iniFlash ();
     // sys_eraseFlash(FLASH_BEG_A, FS_PAGE_CNT);
     fs_smartErase (FLASH_BEG_A, FS_PAGE_CNT);
@@ -1300,6 +1701,7 @@ int fs_shell (char* cmdline) {
     if( strcmp(argv[0], "?") == 0 || strcmp(argv[0], "h") == 0 || strcmp(argv[0], "help") == 0 ) {
         printf("fscmd command list:\n"
                " dump fsck ersase gc info (no arguments)\n"
+               " gc [bg|emergency] (background or emergency GC)\n"
                " unlink access stat read write (args: FILE)\n"
                " rename (args: OLDFILE NEWFILE)\n"
                );
@@ -1316,6 +1718,8 @@ int fs_shell (char* cmdline) {
         return 0;
     }
     if( strcmp(argv[0], "gc") == 0 ) {
+        if( argv[1] != NULL && strcmp(argv[1], "bg") == 0 )
+            return fs_gcBackground() == 0 ? 0 : 1;
         fs_gc(argv[1]==NULL?0:1);
         return 0;
     }
@@ -1328,11 +1732,14 @@ int fs_shell (char* cmdline) {
                "records=%d\n"
                "used=%d bytes\n"
                "free=%d bytes\n"
+               "gc state: %d\n"
+               "erases=%d (max %d per page)\n"
                "key=%08X-%08X-%08X-%08X\n",
                i.fbase, i.pagecnt, i.pagesize,
                i.activeSection+'A',
                i.gcCycles,
                i.records, i.used, i.free,
+               i.gcState, i.erases, i.eraseMax,
                i.key[0], i.key[1], i.key[2], i.key[3]);
         return 0;
     }
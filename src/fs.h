@@ -41,6 +41,8 @@ void rdFlashN (u4_t faddr, u4_t* daddr, uint u4cnt);
 void wrFlash1 (u4_t faddr, u4_t data);
 void wrFlashN (u4_t faddr, u4_t* daddr, uint u4cnt, int keepData);
 
+u2_t dataCrc (u2_t crc, const u1_t* data, uint len);
+
 int fs_open   (str_t filename, int mode, ...);
 int fs_read   (int fd,       void* buf, int size);
 int fs_write  (int fd, const void* buf, int size);
@@ -58,6 +60,8 @@ int  fs_ini   (u4_t key[4]);
 int  fs_ck    ();
 void fs_erase ();
 void fs_gc    (int emergency);
+int  fs_gcBackground ();
+int  fs_gcStep       (int budget);
 int  fs_dump  (void (*logfn)(u1_t mod_level, const char* fmt, ...));
 int  fs_shell (char* cmdline);
 
@@ -71,6 +75,9 @@ typedef struct fsinfo {
     u4_t  records;
     u4_t  used;
     u4_t  free;
+    u1_t  gcState;      // 0=idle 1=copy 2=tail 3=erase
+    u4_t  erases;       // pages erased since start
+    u2_t  eraseMax;     // max erases of a single page since start
     u4_t  key[4];
 } fsinfo_t;
 
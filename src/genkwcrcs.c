@@ -69,19 +69,95 @@ char* replacechar(char *s,char c1,char c2)
     return s;
 }
 
+// Minimal perfect hash over the keyword CRCs (hash and displace):
+// keywords are distributed into buckets, and for each bucket (largest first)
+// a displacement is searched which maps all its members to free slots 0..n-1.
+#define KW_BUCKET(crc) (((crc)*0x9E3779B1u) >> (32-KW_BBITS))
+#define KW_SLOT(crc,d) ((((crc)^(d))*0x85EBCA6Bu >> 8) % nkw)
+
+static int KW_BBITS;
+
+static int makePerfectHash (ujcrc_t* kwcrcs, int nkw, int* slots, u2_t* disp) {
+    int nbkt = 1<<KW_BBITS;
+    int order[nbkt], bsize[nbkt];
+    u1_t used[nkw];
+    memset(bsize, 0, sizeof(bsize));
+    memset(used, 0, sizeof(used));
+    for( int i=0; i<nkw; i++ )
+        bsize[KW_BUCKET(kwcrcs[i])] += 1;
+    for( int b=0; b<nbkt; b++ ) {
+        int j = b;
+        while( j > 0 && bsize[order[j-1]] < bsize[b] ) {
+            order[j] = order[j-1];
+            j--;
+        }
+        order[j] = b;
+    }
+    for( int oi=0; oi<nbkt; oi++ ) {
+        int b = order[oi];
+        disp[b] = 0;
+        if( bsize[b] == 0 )
+            continue;
+        for( int d=1; d<0x10000; d++ ) {
+            int i, k = 0, tried[bsize[b]];
+            for( i=0; i<nkw; i++ ) {
+                if( KW_BUCKET(kwcrcs[i]) != b )
+                    continue;
+                int s = KW_SLOT(kwcrcs[i], (ujcrc_t)d);
+                if( used[s] )
+                    break;
+                used[s] = 1;
+                slots[i] = s;
+                tried[k++] = s;
+            }
+            if( i == nkw ) {
+                disp[b] = d;
+                break;
+            }
+            while( k > 0 )
+                used[tried[--k]] = 0;
+        }
+        if( disp[b] == 0 )
+            return 0;
+    }
+    return 1;
+}
+
 int main (int argc, char** argv) {
     argv++;
     argc--;
     ujcrc_t crcs[argc];
+    ujcrc_t kwcrcs[argc];
+    char*   kwstrs[argc];
+    int     kwslot[argc];
+    int     kwidx[argc];
+    int     nkw = 0;
     for( int i=0; i<argc; i++ ) {
         ujcrc_t crc = calcCRC(argv[i]);
         crcs[i] = crc;
+        kwidx[i] = -1;
         for( int j=i-1; j>=0; j-- ) {
             if( crcs[j] == crc && strcmp(argv[j], argv[i]) != 0 ) {
                 fprintf(stderr, "Collision: %s(0x%X) vs %s(0x%X)\n",
                         argv[i], crc, argv[j], crcs[j]);
                 exit(1);
             }
+            if( crcs[j] == crc )
+                kwidx[i] = kwidx[j];
+        }
+        if( kwidx[i] < 0 ) {
+            kwidx[i] = nkw;
+            kwcrcs[nkw] = crc;
+            kwstrs[nkw] = strdup(argv[i]);
+            nkw += 1;
+        }
+    }
+    u2_t disp[256];
+    for( KW_BBITS=1; (1<<KW_BBITS) < nkw/4; KW_BBITS++ );
+    while( !makePerfectHash(kwcrcs, nkw, kwslot, disp) ) {
+        if( ++KW_BBITS > 8 ) {
+            fprintf(stderr, "Failed to construct perfect hash for %d keywords\n", nkw);
+            exit(1);
         }
     }
     printf("// Auto generated by genkwcrcs - DO NOT CHANGE!\n");
@@ -90,6 +166,35 @@ int main (int argc, char** argv) {
     for( int i=0; i<argc; i++ ) {
         printf("#define J_%-20s ((ujcrc_t)(0x%08X))\n", replacechar(argv[i], '-', '_'), crcs[i]);
     }
+    // Dense keyword indices - slot of the minimal perfect hash
+    printf("#define UJ_NKW   %d\n", nkw);
+    printf("#define UJ_KWBKT %d\n", 1<<KW_BBITS);
+    printf("#define UJ_KWBUCKET(crc) (((crc)*0x9E3779B1u) >> (32-%d))\n", KW_BBITS);
+    printf("#define UJ_KWSLOT(crc,d) ((((crc)^(d))*0x85EBCA6Bu >> 8) %% UJ_NKW)\n");
+    for( int i=0; i<argc; i++ ) {
+        int first = 1;
+        for( int j=0; j<i; j++ )
+            first &= strcmp(argv[i], argv[j]) != 0;
+        if( first )
+            printf("#define K_%-20s %d\n", argv[i], kwslot[kwidx[i]]);
+    }
+    printf("#if defined(UJ_KWTABLES)\n");
+    const char* kwbyslot[nkw];
+    ujcrc_t crcbyslot[nkw];
+    for( int k=0; k<nkw; k++ ) {
+        kwbyslot[kwslot[k]] = kwstrs[k];
+        crcbyslot[kwslot[k]] = kwcrcs[k];
+    }
+    printf("static const u2_t UJ_KWDISP[UJ_KWBKT] = {");
+    for( int b=0; b < (1<<KW_BBITS); b++ )
+        printf("%s%d", b==0 ? "\n    " : b%16 ? "," : ",\n    ", disp[b]);
+    printf("\n};\nstatic const ujcrc_t UJ_KWCRC[UJ_NKW] = {");
+    for( int s=0; s<nkw; s++ )
+        printf("%s0x%08X", s==0 ? "\n    " : s%8 ? "," : ",\n    ", crcbyslot[s]);
+    printf("\n};\nstatic const char* const UJ_KWSTR[UJ_NKW] = {");
+    for( int s=0; s<nkw; s++ )
+        printf("%s\"%s\"", s==0 ? "\n    " : s%8 ? "," : ",\n    ", kwbyslot[s]);
+    printf("\n};\n#endif // defined(UJ_KWTABLES)\n");
     return 0;
 }
 
@@ -47,7 +47,17 @@ typedef struct http {
     struct {
         netctx_t netctx;
         aio_t*   aio;
+        struct http* next;  // more client slots served by this listener
     } listen;
+    struct {
+        tmr_t idle;         // close kept-alive connection if no request arrives
+        u1_t  server;       // accepted HTTPD connection
+        u1_t  keep;         // keep connection open after current response
+        int   fd;           // file sent after response header or -1
+        u4_t  foff;
+        u4_t  flen;
+        u4_t  nreq;         // requests served on this connection
+    } srv;
 } http_t;
 
 enum {
@@ -57,6 +67,7 @@ enum {
     HTTP_SENDING_REQ,
     HTTP_READING_HDR,
     HTTP_READING_BODY,
+    HTTP_CONNECTING,   // TCP connect attempts pending
 };
 
 enum {
@@ -58,12 +58,16 @@ enum {
 void   httpd_ini        (httpd_t*, int bufsize);
 void   httpd_free       (httpd_t*);
 int    httpd_listen     (httpd_t*, const char* port);
+void   httpd_addConn    (httpd_t* listener, httpd_t* conn);  // serve one more client concurrently
 void   httpd_close      (httpd_t*);
 void   httpd_stop       (httpd_t*);
 dbuf_t httpd_getRespbuf (httpd_t*);
 dbuf_t httpd_getHdr     (httpd_t*);
 dbuf_t httpd_getBody    (httpd_t*);
 void   httpd_response   (httpd_t*, dbuf_t* resp);
+#if defined(CFG_linux)
+void   httpd_sendFile   (httpd_t*, dbuf_t* resp, int fd, u4_t len);  // resp header then len bytes of fd via sendfile - takes fd
+#endif // defined(CFG_linux)
 
 enum {
     HTTPD_PATH_DONE,
@@ -10,6 +10,7 @@
 #define J_AS923JP              ((ujcrc_t)(0x6616F98E))
 #define J_asap                 ((ujcrc_t)(0x61D4E603))
 #define J_AU915                ((ujcrc_t)(0xD8599E68))
+#define J_binmsg               ((ujcrc_t)(0xF6AFF34C))
 #define J_bcning               ((ujcrc_t)(0x1EE5E245))
 #define J_beaconing            ((ujcrc_t)(0x58428CA7))
 #define J_cca                  ((ujcrc_t)(0x00636361))
@@ -24,6 +25,8 @@
 #define J_device_mode          ((ujcrc_t)(0x2DB3FCE7))
 #define J_diid                 ((ujcrc_t)(0x64D5D500))
 #define J_disconnect           ((ujcrc_t)(0x508A92A9))
+#define J_DevAddrFilter        ((ujcrc_t)(0x0218DA30))
+#define J_dnbatch              ((ujcrc_t)(0xA1914521))
 #define J_dnmode               ((ujcrc_t)(0xFB97E55A))
 #define J_dnframe              ((ujcrc_t)(0xF7095424))
 #define J_dnmsg                ((ujcrc_t)(0x37C3E917))
@@ -62,6 +65,7 @@
 #define J_log_rotate           ((ujcrc_t)(0x240F1106))
 #define J_log_size             ((ujcrc_t)(0x6453ABB5))
 #define J_max_eirp             ((ujcrc_t)(0x60B4BA83))
+#define J_metrics              ((ujcrc_t)(0xFDF84245))
 #define J_mix_gain             ((ujcrc_t)(0xC7F3BD05))
 #define J_msgid                ((ujcrc_t)(0x66901419))
 #define J_msgtype              ((ujcrc_t)(0xBD07399C))
@@ -75,6 +79,8 @@
 #define J_ontime               ((ujcrc_t)(0xF9E41F34))
 #define J_pa_gain              ((ujcrc_t)(0xDEE8634E))
 #define J_pdu                  ((ujcrc_t)(0x00708461))
+#define J_PingOffset           ((ujcrc_t)(0x651E1CCF))
+#define J_PingPeriod           ((ujcrc_t)(0x258C8078))
 #define J_preamble             ((ujcrc_t)(0x05167D25))
 #define J_priority             ((ujcrc_t)(0xF00C8E15))
 #define J_pps                  ((ujcrc_t)(0x00707073))
@@ -111,6 +117,7 @@
 #define J_txpow_adjust         ((ujcrc_t)(0x03E0F6FD))
 #define J_txtime               ((ujcrc_t)(0x02CB1104))
 #define J_type                 ((ujcrc_t)(0x74F5FE18))
+#define J_upbatch              ((ujcrc_t)(0xF5DCEF62))
 #define J_upchannels           ((ujcrc_t)(0x7FCAA9EB))
 #define J_updf                 ((ujcrc_t)(0x75EFDB07))
 #define J_upgrade              ((ujcrc_t)(0xF49BF544))
@@ -238,3 +245,312 @@
 #define J_wifi_pass            ((ujcrc_t)(0xE13C3600))
 #define J_cups_uri             ((ujcrc_t)(0x594AB0B8))
 #define J_LUT_BASE             ((ujcrc_t)(0x4E5FF50A))
+#define UJ_NKW   233
+#define UJ_KWBKT 64
+#define UJ_KWBUCKET(crc) (((crc)*0x9E3779B1u) >> (32-6))
+#define UJ_KWSLOT(crc,d) ((((crc)^(d))*0x85EBCA6Bu >> 8) % UJ_NKW)
+#define K_addcrc               87
+#define K_antenna_gain         111
+#define K_antenna_type         19
+#define K_api                  53
+#define K_arguments            104
+#define K_AS923                158
+#define K_AS923JP              61
+#define K_asap                 187
+#define K_AU915                67
+#define K_binmsg               3
+#define K_bcning               89
+#define K_beaconing            103
+#define K_cca                  51
+#define K_CN470                186
+#define K_CN779                179
+#define K_command              180
+#define K_config               148
+#define K_dC                   166
+#define K_DevEui               68
+#define K_DevEUI               134
+#define K_device               209
+#define K_device_mode          108
+#define K_diid                 231
+#define K_disconnect           9
+#define K_DevAddrFilter        138
+#define K_dnbatch              1
+#define K_dnmode               91
+#define K_dnframe              202
+#define K_dnmsg                223
+#define K_dnsched              232
+#define K_dntxed               126
+#define K_domain               225
+#define K_DR                   208
+#define K_DRs                  172
+#define K_duty_cycle           97
+#define K_enable               174
+#define K_error                79
+#define K_EU433                164
+#define K_EU863                83
+#define K_euiprefix            149
+#define K_shell                210
+#define K_cmd                  211
+#define K_freq                 106
+#define K_Freq                 63
+#define K_freqs                10
+#define K_freq_range           206
+#define K_gateway_conf         4
+#define K_getxtime             90
+#define K_gps                  96
+#define K_gpstime              75
+#define K_hello                6
+#define K_hwspec               227
+#define K_if                   154
+#define K_IL915                116
+#define K_infos_uri            98
+#define K_JoinEui              66
+#define K_JoinEUI              181
+#define K_KR920                65
+#define K_layout               31
+#define K_log_file             14
+#define K_log_level            215
+#define K_log_rotate           230
+#define K_log_size             173
+#define K_max_eirp             176
+#define K_metrics              222
+#define K_mix_gain             198
+#define K_msgid                112
+#define K_msgtype              64
+#define K_muxs                 8
+#define K_MuxTime              29
+#define K_NetID                157
+#define K_nocca                30
+#define K_nodc                 205
+#define K_nodwell              105
+#define K_no_gps_capture       55
+#define K_ontime               156
+#define K_pa_gain              147
+#define K_pdu                  199
+#define K_PingOffset           58
+#define K_PingPeriod           195
+#define K_preamble             135
+#define K_priority             185
+#define K_pps                  121
+#define K_radio                101
+#define K_radio_conf           35
+#define K_radio_init           114
+#define K_rctx                 226
+#define K_reboot               200
+#define K_reconnect            194
+#define K_region               110
+#define K_regionid             72
+#define K_restart              129
+#define K_rmtsh                22
+#define K_router               217
+#define K_routerid             137
+#define K_router_config        15
+#define K_runcmd               38
+#define K_RX1DR                140
+#define K_RX1Freq              171
+#define K_RX2DR                28
+#define K_RX2Freq              214
+#define K_RxDelay              203
+#define K_schedule             167
+#define K_seqno                115
+#define K_server_address       94
+#define K_serv_port            168
+#define K_spread_factor        81
+#define K_start                16
+#define K_station_conf         229
+#define K_stop                 184
+#define K_term                 57
+#define K_timesync             144
+#define K_threshold            100
+#define K_txpow_adjust         78
+#define K_txtime               122
+#define K_type                 99
+#define K_upbatch              32
+#define K_upchannels           169
+#define K_updf                 143
+#define K_upgrade              73
+#define K_uri                  125
+#define K_US902                197
+#define K_user                 84
+#define K_version              175
+#define K_web_port             190
+#define K_web_dir              124
+#define K_xtime                54
+#define K_bandwidth            117
+#define K_chan_FSK             42
+#define K_chan_Lora_std        92
+#define K_clksrc               127
+#define K_dac_gain             120
+#define K_datarate             130
+#define K_dig_gain             86
+#define K_lorawan_public       192
+#define K_radio_0              163
+#define K_radio_1              188
+#define K_rf_chain             191
+#define K_rf_power             46
+#define K_rssi_offset          132
+#define K_rssi_offset_lbt      151
+#define K_SX1250               69
+#define K_SX1255               150
+#define K_SX1257               36
+#define K_SX1272               85
+#define K_SX1276               161
+#define K_sx1301_conf          44
+#define K_SX1301_conf          70
+#define K_sx1302_conf          207
+#define K_SX1302_conf          43
+#define K_sync_word            113
+#define K_sync_word_size       45
+#define K_tx_enable            212
+#define K_tx_gain_lut          193
+#define K_tx_notch_freq        33
+#define K_pwr_idx              18
+#define K_rssi_tcomp           204
+#define K_coeff_a              12
+#define K_coeff_b              13
+#define K_coeff_c              213
+#define K_coeff_d              136
+#define K_coeff_e              162
+#define K_implicit_hdr         107
+#define K_implicit_payload_length 182
+#define K_implicit_crc_en      228
+#define K_implicit_coderate    220
+#define K_tx_lut               2
+#define K_fpga_dig_gain        165
+#define K_ad9361_atten         177
+#define K_ad9361_auxdac_vref   39
+#define K_ad9361_auxdac_word   218
+#define K_ad9361_tcomp_coeff_a 37
+#define K_ad9361_tcomp_coeff_b 178
+#define K_rf_chain_conf        118
+#define K_rx_enable            7
+#define K_rssi_offset_coeff_a  50
+#define K_rssi_offset_coeff_b  47
+#define K_tx_freq_min          77
+#define K_tx_freq_max          80
+#define K_lbt_conf             153
+#define K_rssi_target          49
+#define K_rssi_shift           152
+#define K_chan_cfg             160
+#define K_freq_hz              20
+#define K_scan_time_us         56
+#define K_chip_enable          11
+#define K_chip_center_freq     159
+#define K_chip_rf_chain        59
+#define K_chan_multiSF_0       221
+#define K_chan_multiSF_1       142
+#define K_chan_multiSF_2       109
+#define K_chan_multiSF_3       26
+#define K_chan_multiSF_4       27
+#define K_chan_multiSF_5       128
+#define K_chan_multiSF_6       102
+#define K_chan_multiSF_7       155
+#define K_chan_LoRa_std        119
+#define K_chan_rx_freq         88
+#define K_bit_rate             52
+#define K_SX1301_array_conf    5
+#define K_board_type           95
+#define K_board_rx_freq        170
+#define K_board_rx_bw          201
+#define K_full_duplex          123
+#define K_FSK_sync             0
+#define K_loramac_public       139
+#define K_nb_dsp               62
+#define K_dsp_stat_interval    21
+#define K_aes_key              219
+#define K_calibration_temperature_celsius_room 82
+#define K_calibration_temperature_code_ad9361 41
+#define K_fpga_flavor          146
+#define K_SX1388_A11           216
+#define K_SX1388_SAGEMCOM      40
+#define K_SX1388_B11           25
+#define K_SX1388_KERLINK       71
+#define K_SX1388_C11           196
+#define K_SX1388_CISCO         224
+#define K_SX1388_E11           24
+#define K_SX1388_SEMTECH       131
+#define K_SX1388_F11           60
+#define K_SX1388_FOXCONN       74
+#define K_SX1388_L11           145
+#define K_SX1388_MULTITECH     48
+#define K_lbt_enable           183
+#define K_freq_band            93
+#define K_rx_freq              133
+#define K_wifi_cfg             141
+#define K_wifi_scan            17
+#define K_wifi_ssid            189
+#define K_wifi_pass            34
+#define K_cups_uri             23
+#define K_LUT_BASE             76
+#if defined(UJ_KWTABLES)
+static const u2_t UJ_KWDISP[UJ_KWBKT] = {
+    5,34,6,1,36,25,5,38,29,26,6,17,81,61,5,84,
+    56,80,497,46,340,134,66,31,649,57,418,2,30,461,8,221,
+    5,424,3,452,3,6,256,0,1,57,0,13,1,345,126,0,
+    72,2,2,3,1,101,94,273,1,132,128,2642,474,525,130,102
+};
+static const ujcrc_t UJ_KWCRC[UJ_NKW] = {
+    0x6CFE62EF,0xA1914521,0x25A75023,0xF6AFF34C,0x186A380C,0x0A4F4BCE,0x46DBE30A,0x73858A63,
+    0x6DF2E513,0x508A92A9,0x47ADEB15,0x887A9A91,0x87785402,0x87785401,0x7886C6B6,0xE5E7E58E,
+    0x61BEF413,0xE63F210E,0xDFD7588B,0x7D4274ED,0xD4F73A99,0x26D3D0B1,0x77731403,0x594AB0B8,
+    0x7D7CD2A4,0x7D73CEA3,0x0A1E99EE,0x0A1E99E9,0x0111107C,0x8F6686E3,0x4CC0D20E,0x11950A24,
+    0xF5DCEF62,0xA8FCE052,0xE13C3600,0xBA23370B,0x1FBE0E5C,0x555897EE,0x1EF2012F,0x21E8657E,
+    0xD7A4F74B,0x2D301DEC,0x399777C1,0x76DDEBC0,0x2AF5BD41,0xE6AAAB54,0x95FCE8DC,0x11C37A17,
+    0xA42F71FA,0xD983A9C2,0x11C37A14,0x00636361,0xED4AA68B,0x00617278,0x759DF115,0xDEA1F99B,
+    0xB4392EF2,0x74F9E80E,0x651E1CCF,0xC99D90A0,0x7D7FCEA7,0x6616F98E,0x2F8B2E0D,0x46C0CB20,
+    0xBD07399C,0xFB789669,0x5B616676,0xD8599E68,0x0F01F1A4,0x1FBE0E5B,0xCF76EBC6,0xEBC39360,
+    0xE6FFB211,0xF49BF544,0x9CA462ED,0xCC004EB5,0x4E5FF50A,0xA3956A08,0x03E0F6FD,0x47A7EB1D,
+    0xA3957216,0xD933EFAA,0x8D9594E4,0xE0529B68,0x75F0DE11,0x1FBE0C5B,0x1932BE8A,0x1991DA5B,
+    0x06FCFE18,0x1EE5E245,0x286076CA,0xFB97E55A,0xAE60A484,0xB067FA9A,0x338DDCAD,0xB6BB08C7,
+    0x00677E64,0x18855C82,0xE3215635,0x74F5FE18,0xB76BCE9C,0x6A861A03,0x0A1E99EB,0x58428CA7,
+    0x5ACAD020,0xB6A53879,0x66E0EB00,0xC842AB12,0x2DB3FCE7,0x0A1E99EF,0xF5F71604,0xB5F37EF4,
+    0x66901419,0xA4BF704D,0xA4224015,0x709FF915,0xE1689771,0x0188BDD4,0xDF35B2E0,0x8CA425D4,
+    0xB95BD71D,0x00707073,0x02CB1104,0x3CC1F742,0xCDD77DAA,0x00757C6E,0x12FBF954,0x028CF35C,
+    0x0A1E99E8,0xFFFF1F62,0xFC3A1C24,0xE9AC9268,0x2C99BDFE,0xEB1D6E55,0x0F01D1A4,0x05167D25,
+    0x87785407,0xE1C9C417,0x0218DA30,0x42F0CD46,0x0114167F,0xA90D75DA,0x0A1E99EC,0x75EFDB07,
+    0xD3CACC10,0x7D75D2AD,0x1A5CFA3E,0xDEE8634E,0xF7A3E35F,0x9D5E0C96,0x1FBE0E5E,0xAFDE7647,
+    0x40F516B1,0x5AA8CB99,0x0000690F,0x0A1E99EA,0xF9E41F34,0x16D1EE1C,0xD653976B,0xE016F2A3,
+    0x39BA8AFD,0x1FBE0C5F,0x87785406,0xBA1753F6,0xE0569061,0xB17E4194,0x00006427,0xDEEAC928,
+    0x7405B388,0x7FCAA9EB,0xE7946A94,0x3E8FAA5D,0x00445A65,0x6453ABB5,0x0697E35F,0x00E51D6C,
+    0x60B4BA83,0x6EA72BD1,0x555897ED,0xD75E9777,0xA46E40CA,0x5B618676,0xA83D6605,0x1C7A0E2A,
+    0x73EDE218,0xF00C8E15,0xD75F977D,0x61D4E603,0xBA1753F7,0xE60F391C,0xA9963701,0x3497D91E,
+    0xF6ECACD6,0x43B971DB,0xD965FF91,0x258C8078,0x7D72CEA2,0x061FA968,0xC7F3BD05,0x00708461,
+    0xF6CE1F1D,0x6E5A1327,0xF7095424,0xCDE79F00,0x47CB0C8F,0x6EDDD406,0x38A2732C,0x2BF4BF45,
+    0x00004416,0xF0921352,0x767A1E0A,0x0063716A,0x631F9A2D,0x87785400,0x3480AA59,0x7B397448,
+    0x7D70D2A0,0xFEE91D0C,0x20EC6177,0xD9FE95FC,0x644EF1C1,0x0A1E99ED,0xFDF84245,0x37C3E917,
+    0x4432F439,0x0590E65C,0x72F5E81D,0xE3C2202A,0x531037C1,0xE4AA60B9,0x240F1106,0x64D5D500,
+    0xFDEA5B35
+};
+static const char* const UJ_KWSTR[UJ_NKW] = {
+    "FSK_sync","dnbatch","tx_lut","binmsg","gateway_conf","SX1301_array_conf","hello","rx_enable",
+    "muxs","disconnect","freqs","chip_enable","coeff_a","coeff_b","log_file","router_config",
+    "start","wifi_scan","pwr_idx","antenna_type","freq_hz","dsp_stat_interval","rmtsh","cups_uri",
+    "SX1388_E11","SX1388_B11","chan_multiSF_3","chan_multiSF_4","RX2DR","MuxTime","nocca","layout",
+    "upbatch","tx_notch_freq","wifi_pass","radio_conf","SX1257","ad9361_tcomp_coeff_a","runcmd","ad9361_auxdac_vref",
+    "SX1388_SAGEMCOM","calibration_temperature_code_ad9361","chan_FSK","SX1302_conf","sx1301_conf","sync_word_size","rf_power","rssi_offset_coeff_b",
+    "SX1388_MULTITECH","rssi_target","rssi_offset_coeff_a","cca","bit_rate","api","xtime","no_gps_capture",
+    "scan_time_us","term","PingOffset","chip_rf_chain","SX1388_F11","AS923JP","nb_dsp","Freq",
+    "msgtype","KR920","JoinEui","AU915","DevEui","SX1250","SX1301_conf","SX1388_KERLINK",
+    "regionid","upgrade","SX1388_FOXCONN","gpstime","LUT-BASE","tx_freq_min","txpow_adjust","error",
+    "tx_freq_max","spread_factor","calibration_temperature_celsius_room","EU863","user","SX1272","dig_gain","addcrc",
+    "chan_rx_freq","bcning","getxtime","dnmode","chan_Lora_std","freq_band","server_address","board_type",
+    "gps","duty_cycle","infos_uri","type","threshold","radio","chan_multiSF_6","beaconing",
+    "arguments","nodwell","freq","implicit_hdr","device_mode","chan_multiSF_2","region","antenna_gain",
+    "msgid","sync_word","radio_init","seqno","IL915","bandwidth","rf_chain_conf","chan_LoRa_std",
+    "dac_gain","pps","txtime","full_duplex","web_dir","uri","dntxed","clksrc",
+    "chan_multiSF_5","restart","datarate","SX1388_SEMTECH","rssi_offset","rx_freq","DevEUI","preamble",
+    "coeff_d","routerid","DevAddrFilter","loramac_public","RX1DR","wifi_cfg","chan_multiSF_1","updf",
+    "timesync","SX1388_L11","fpga_flavor","pa_gain","config","euiprefix","SX1255","rssi_offset_lbt",
+    "rssi_shift","lbt_conf","if","chan_multiSF_7","ontime","NetID","AS923","chip_center_freq",
+    "chan_cfg","SX1276","coeff_e","radio_0","EU433","fpga_dig_gain","dC","schedule",
+    "serv_port","upchannels","board_rx_freq","RX1Freq","DRs","log_size","enable","version",
+    "max_eirp","ad9361_atten","ad9361_tcomp_coeff_b","CN779","command","JoinEUI","implicit_payload_length","lbt_enable",
+    "stop","priority","CN470","asap","radio_1","wifi_ssid","web_port","rf_chain",
+    "lorawan_public","tx_gain_lut","reconnect","PingPeriod","SX1388_C11","US902","mix_gain","pdu",
+    "reboot","board_rx_bw","dnframe","RxDelay","rssi_tcomp","nodc","freq_range","sx1302_conf",
+    "DR","device","shell","cmd","tx_enable","coeff_c","RX2Freq","log_level",
+    "SX1388_A11","router","ad9361_auxdac_word","aes_key","implicit_coderate","chan_multiSF_0","metrics","dnmsg",
+    "SX1388_CISCO","domain","rctx","hwspec","implicit_crc_en","station_conf","log_rotate","diid",
+    "dnsched"
+};
+#endif // defined(UJ_KWTABLES)
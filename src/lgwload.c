@@ -0,0 +1,885 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if defined(CFG_prog_lgwload)
+// Native traffic generator for the lgwsim radio simulation.
+//
+// Plays both ends of a simulated station: it is the lgwsim peer on the
+// unix domain socket (LORAGW_SPI) and a minimal, plain ws:// TC/MUXS on
+// one TCP port (/router-info and /router). Uplinks are generated as a
+// Poisson process across all channels/SFs of a channel plan or replayed
+// from a recorded trace. Every data frame carries its sequence number in
+// DevAddr so the matching updf from station yields RX->MUXS latency.
+// Results are emitted as JSON lines on stdout:
+//   {"msgtype":"loadstep", ...}   one per rate step
+//   {"msgtype":"loadsum", ...}    max sustainable rate (--sweep only)
+//
+// Only the LGW1 HAL struct layout (lgwsim with CFG_lgw1) is supported.
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "rt.h"
+
+// Mirrors of lgw_pkt_rx_s/lgw_pkt_tx_s (see also pysys/simutils.py Lgw1)
+struct sim_rxpkt {
+    u4_t  freq_hz;
+    u1_t  if_chain;
+    u1_t  status;
+    u4_t  count_us;
+    u1_t  rf_chain;
+    u1_t  modulation;
+    u1_t  bandwidth;
+    u4_t  datarate;
+    u1_t  coderate;
+    float rssi;
+    float snr;
+    float snr_min;
+    float snr_max;
+    u2_t  crc;
+    u2_t  size;
+    u1_t  payload[256];
+};
+
+struct sim_txpkt {
+    u4_t  freq_hz;
+    u1_t  tx_mode;
+    u4_t  count_us;
+    u1_t  rf_chain;
+    s1_t  rf_power;
+    u1_t  modulation;
+    u1_t  bandwidth;
+    u4_t  datarate;
+    u1_t  coderate;
+    u1_t  invert_pol;
+    u1_t  f_dev;
+    u2_t  preamble;
+    u1_t  no_crc;
+    u1_t  no_header;
+    u2_t  size;
+    u1_t  payload[256];
+};
+
+#define STAT_CRC_OK  0x10
+#define MOD_LORA     0x10
+#define CR_LORA_4_5  0x01
+#define BW_125KHZ    0x03
+#define BW_250KHZ    0x02
+#define BW_500KHZ    0x01
+#define TXMODE_HELLO 255
+
+#define MAX_WS       4
+#define WS_RBUFSZ    (64*1024)
+#define SEQ_BITS     20              // tracked frames in flight
+#define SEQ_MASK     ((1<<SEQ_BITS)-1)
+#define DEVADDR_MASK 0x01FFFFFF      // NetID 0 - never filtered by station
+#define OUTQ_PKTS    4096            // generator side backlog towards station
+#define SETTLE_TIME  1.0             // after radio connect before traffic starts
+#define DRAIN_TIME   2.0             // after a step before counting losses
+
+typedef struct plan {
+    str_t name;
+    int   nfreqs;
+    u4_t  freqs[8];
+    int   sfmax;
+    u4_t  dnfreq0;    // RX1 base frequency - 0 means RX1 on uplink frequency
+    u4_t  dnstep;
+    int   rx1droff;   // RX1DR = DR + rx1droff
+    str_t rconf;
+} plan_t;
+
+static const plan_t PLANS[] = {
+    { "EU863", 6, { 868100000, 868300000, 868500000, 868850000, 869050000, 869525000 }, 12, 0, 0, 0,
+      "{\"msgtype\":\"router_config\",\"region\":\"EU863\",\"hwspec\":\"sx1301/1\","
+      "\"DRs\":[[12,125,0],[11,125,0],[10,125,0],[9,125,0],[8,125,0],[7,125,0],[7,250,0],[0,0,0],"
+      "[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0],[-1,0,0]],"
+      "\"max_eirp\":16.0,\"protocol\":1,\"freq_range\":[863000000,870000000],"
+      "\"JoinEui\":null,\"NetID\":null,\"bcning\":null,\"config\":{},\"nocca\":true,\"nodc\":true,\"nodwell\":true,"
+      "\"upchannels\":[[868100000,0,5],[868300000,0,5],[868500000,0,5],[868850000,0,5],[869050000,0,5],[869525000,0,5]],"
+      "\"sx1301_conf\":[{\"chan_FSK\":{\"enable\":false},\"chan_Lora_std\":{\"enable\":false},"
+      "\"chan_multiSF_0\":{\"enable\":true,\"if\":-375000,\"radio\":0},"
+      "\"chan_multiSF_1\":{\"enable\":true,\"if\":-175000,\"radio\":0},"
+      "\"chan_multiSF_2\":{\"enable\":true,\"if\":25000,\"radio\":0},"
+      "\"chan_multiSF_3\":{\"enable\":true,\"if\":375000,\"radio\":0},"
+      "\"chan_multiSF_4\":{\"enable\":true,\"if\":-237500,\"radio\":1},"
+      "\"chan_multiSF_5\":{\"enable\":true,\"if\":237500,\"radio\":1},"
+      "\"chan_multiSF_6\":{\"enable\":false},\"chan_multiSF_7\":{\"enable\":false},"
+      "\"radio_0\":{\"enable\":true,\"freq\":868475000},\"radio_1\":{\"enable\":true,\"freq\":869287500}}]}" },
+    { "US902", 8, { 902300000, 902500000, 902700000, 902900000, 903100000, 903300000, 903500000, 903700000 }, 10, 923300000, 600000, 10,
+      "{\"msgtype\":\"router_config\",\"region\":\"US902\",\"hwspec\":\"sx1301/1\","
+      "\"DRs\":[[10,125,0],[9,125,0],[8,125,0],[7,125,0],[8,500,0],[-1,0,0],[-1,0,0],[-1,0,0],"
+      "[12,500,1],[11,500,1],[10,500,1],[9,500,1],[8,500,1],[7,500,1],[-1,0,0],[-1,0,0]],"
+      "\"max_eirp\":30.0,\"protocol\":1,\"freq_range\":[902000000,928000000],"
+      "\"JoinEui\":null,\"NetID\":null,\"bcning\":null,\"config\":{},\"nocca\":true,\"nodc\":true,\"nodwell\":true,"
+      "\"upchannels\":[[902300000,0,3],[902500000,0,3],[902700000,0,3],[902900000,0,3],"
+      "[903100000,0,3],[903300000,0,3],[903500000,0,3],[903700000,0,3]],"
+      "\"sx1301_conf\":[{\"chan_FSK\":{\"enable\":false},\"chan_Lora_std\":{\"enable\":false},"
+      "\"chan_multiSF_0\":{\"enable\":true,\"if\":-400000,\"radio\":0},"
+      "\"chan_multiSF_1\":{\"enable\":true,\"if\":-200000,\"radio\":0},"
+      "\"chan_multiSF_2\":{\"enable\":true,\"if\":0,\"radio\":0},"
+      "\"chan_multiSF_3\":{\"enable\":true,\"if\":200000,\"radio\":0},"
+      "\"chan_multiSF_4\":{\"enable\":true,\"if\":-200000,\"radio\":1},"
+      "\"chan_multiSF_5\":{\"enable\":true,\"if\":0,\"radio\":1},"
+      "\"chan_multiSF_6\":{\"enable\":true,\"if\":200000,\"radio\":1},"
+      "\"chan_multiSF_7\":{\"enable\":true,\"if\":400000,\"radio\":1},"
+      "\"radio_0\":{\"enable\":true,\"freq\":902700000},\"radio_1\":{\"enable\":true,\"freq\":903300000}}]}" },
+};
+
+typedef struct trace {
+    double t;        // seconds relative to trace start
+    u4_t   freq;
+    u1_t   sf;
+    u2_t   bw;       // kHz
+    u1_t   len;      // 0 - generate frame
+    u1_t   frame[255];
+} trace_t;
+
+typedef struct wsconn {
+    int   fd;
+    int   upgraded;
+    int   isMuxs;
+    int   rlen;
+    u1_t  rbuf[WS_RBUFSZ+1];
+} wsconn_t;
+
+// Options
+static str_t  sockPath  = "spidev";
+static int    wsPort    = 6038;
+static const plan_t* plan = &PLANS[0];
+static double rate      = 10;       // frames/sec (--trace: speed factor)
+static double duration  = 10;       // seconds per step
+static double dnRatio   = 0;        // fraction of updf answered by a dnmsg
+static int    sfMin     = 7;
+static int    sfMax     = 12;
+static int    plen      = 16;       // FRMPayload length of generated frames
+static int    sweep     = 0;
+static double maxLoss   = 0.01;
+static double maxLat    = 0.5;      // p99 limit (seconds) for --sweep
+static str_t  tracePath = NULL;
+
+// State
+static sL_t      timeOffset;        // station ustime - xticks (from lgwsim hello)
+static int       lsnFd = -1, simLsnFd = -1, simFd = -1;
+static int       simRlen;
+static u1_t      simRbuf[sizeof(struct sim_txpkt)];
+static u1_t*     outq;
+static int       outBeg, outEnd;
+static wsconn_t  wsconns[MAX_WS];
+static wsconn_t* muxs;
+static sL_t*     sentAt;
+static u4_t      seq;
+static trace_t*  traces;
+static int       ntraces, traceIdx;
+static double    traceLoop;         // offset of current trace loop
+static volatile sig_atomic_t stop;
+
+static struct {
+    u4_t   sent, recv, late, untracked, overflow;
+    u4_t   dnsent, txseen, dntxed;
+    int    nlat, maxnlat;
+    float* lat;                     // seconds
+} st;
+
+
+static sL_t mono () {
+    struct timespec tp;
+    clock_gettime(CLOCK_MONOTONIC, &tp);
+    return tp.tv_sec*(sL_t)1000000 + tp.tv_nsec/1000;
+}
+
+static void fatal (const char* fmt, const char* arg) {
+    fprintf(stderr, "lgwload: ");
+    fprintf(stderr, fmt, arg);
+    fprintf(stderr, ": %s\n", strerror(errno));
+    exit(1);
+}
+
+static int xwrite (int fd, const void* p, int n) {
+    const u1_t* b = p;
+    int off = 0;
+    while( off < n ) {
+        int k = write(fd, b+off, n-off);
+        if( k < 0 ) {
+            if( errno == EINTR )
+                continue;
+            if( errno == EAGAIN ) {
+                struct pollfd pfd = { .fd=fd, .events=POLLOUT };
+                poll(&pfd, 1, 100);
+                continue;
+            }
+            return -1;
+        }
+        off += k;
+    }
+    return n;
+}
+
+static int cmpFloat (const void* a, const void* b) {
+    float x = *(const float*)a, y = *(const float*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double quantile (double q) {
+    if( st.nlat == 0 )
+        return 0;
+    int i = (int)ceil(q*st.nlat) - 1;
+    return st.lat[max(0, min(st.nlat-1, i))];
+}
+
+static void addLatency (float v) {
+    if( st.nlat == st.maxnlat ) {
+        st.maxnlat = max(4096, 2*st.maxnlat);
+        st.lat = realloc(st.lat, st.maxnlat*sizeof(st.lat[0]));
+        if( st.lat == NULL )
+            fatal("%s", "Out of memory");
+    }
+    st.lat[st.nlat++] = v;
+}
+
+
+// --------------------------------------------------------------------------------
+//
+// JSON scanning - station output is well formed and flat enough for this
+//
+// --------------------------------------------------------------------------------
+
+static const char* jfind (const char* s, str_t key) {
+    char k[32];
+    snprintf(k, sizeof(k), "\"%s\":", key);
+    const char* p = strstr(s, k);
+    return p ? p+strlen(k) : NULL;
+}
+
+static sL_t jint (const char* s, str_t key, sL_t dflt) {
+    const char* p = jfind(s, key);
+    return p ? strtoll(p, NULL, 10) : dflt;
+}
+
+
+// --------------------------------------------------------------------------------
+//
+// Minimal websocket server - just enough for station as client
+//
+// --------------------------------------------------------------------------------
+
+static void ws_close (wsconn_t* c) {
+    if( c->fd < 0 )
+        return;
+    close(c->fd);
+    c->fd = -1;
+    if( muxs == c )
+        muxs = NULL;
+}
+
+static void ws_send (wsconn_t* c, const char* msg, int n) {
+    u1_t hdr[4];
+    int hlen = 2;
+    hdr[0] = 0x81;
+    if( n < 126 ) {
+        hdr[1] = n;
+    } else {
+        assert(n < 0x10000);
+        hdr[1] = 126;
+        hdr[2] = n>>8;
+        hdr[3] = n;
+        hlen = 4;
+    }
+    if( xwrite(c->fd, hdr, hlen) < 0 || xwrite(c->fd, msg, n) < 0 )
+        ws_close(c);
+}
+
+static void sendDnmsg (const char* updf) {
+    sL_t devaddr = jint(updf, "DevAddr", 0);
+    int  dr      = jint(updf, "DR", 0);
+    sL_t freq    = jint(updf, "Freq", 0);
+    const char* upinfo = jfind(updf, "upinfo");
+    if( !upinfo )
+        return;
+    sL_t xtime = jint(upinfo, "xtime", 0);
+    sL_t rctx  = jint(upinfo, "rctx", 0);
+    if( plan->dnfreq0 ) {
+        int ch = 0;
+        while( ch < plan->nfreqs-1 && plan->freqs[ch] != freq )
+            ch++;
+        freq = plan->dnfreq0 + ch*plan->dnstep;
+    }
+    char msg[512];
+    int n = snprintf(msg, sizeof(msg),
+                     "{\"msgtype\":\"dnmsg\",\"dC\":0,\"priority\":0,\"RxDelay\":1,"
+                     "\"RX1DR\":%d,\"RX1Freq\":%lld,\"DevEui\":\"00-00-00-00-%02X-%02X-%02X-%02X\","
+                     "\"xtime\":%lld,\"diid\":%lld,\"rctx\":%lld,\"pdu\":\"60%08X000000010203040506070809\"}",
+                     dr + plan->rx1droff, (long long)freq,
+                     (int)(devaddr>>24)&0xFF, (int)(devaddr>>16)&0xFF, (int)(devaddr>>8)&0xFF, (int)devaddr&0xFF,
+                     (long long)xtime, (long long)devaddr, (long long)rctx, (u4_t)devaddr);
+    ws_send(muxs, msg, n);
+    st.dnsent += 1;
+}
+
+static void onUpdf (const char* msg, sL_t now) {
+    sL_t devaddr = jint(msg, "DevAddr", -1);
+    if( devaddr < 0 ) {
+        st.untracked += 1;
+        return;
+    }
+    sL_t* sp = &sentAt[devaddr & SEQ_MASK];
+    if( *sp == 0 ) {
+        st.late += 1;           // left over from previous step or duplicate
+        return;
+    }
+    addLatency((now - *sp)/1e6);
+    *sp = 0;
+    st.recv += 1;
+    if( dnRatio > 0 && drand48() < dnRatio )
+        sendDnmsg(msg);
+}
+
+static void onWsMessage (wsconn_t* c, char* msg) {
+    if( !c->isMuxs ) {
+        // router-info request - point station back at us
+        const char* r = jfind(msg, "router");
+        int rlen = r ? strcspn(r, ",}") : 0;
+        char resp[256];
+        int n = snprintf(resp, sizeof(resp), "{\"router\":%.*s,\"muxs\":\"muxs-::0\",\"uri\":\"ws://localhost:%d/router\"}",
+                         rlen ? rlen : 1, rlen ? r : "0", wsPort);
+        ws_send(c, resp, n);
+        return;
+    }
+    const char* mt = jfind(msg, "msgtype");
+    if( !mt )
+        return;
+    if( strncmp(mt, "\"updf\"", 6) == 0 ) {
+        onUpdf(msg, mono());
+    }
+    else if( strncmp(mt, "\"jreq\"", 6) == 0 || strncmp(mt, "\"propdf\"", 8) == 0 ) {
+        st.untracked += 1;
+    }
+    else if( strncmp(mt, "\"dntxed\"", 8) == 0 ) {
+        st.dntxed += 1;
+    }
+    else if( strncmp(mt, "\"version\"", 9) == 0 ) {
+        ws_send(c, plan->rconf, strlen(plan->rconf));
+    }
+}
+
+static void onWsRead (wsconn_t* c) {
+    int n = read(c->fd, c->rbuf+c->rlen, WS_RBUFSZ-c->rlen);
+    if( n <= 0 ) {
+        if( n < 0 && (errno == EAGAIN || errno == EINTR) )
+            return;
+        ws_close(c);
+        return;
+    }
+    c->rlen += n;
+    c->rbuf[c->rlen] = 0;
+    if( !c->upgraded ) {
+        char* e = strstr((char*)c->rbuf, "\r\n\r\n");
+        if( !e ) {
+            if( c->rlen == WS_RBUFSZ )
+                ws_close(c);
+            return;
+        }
+        // Station does not verify Sec-WebSocket-Accept
+        static const char resp[] =
+            "HTTP/1.1 101 Switching Protocols\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: lgwload\r\n\r\n";
+        c->isMuxs = strncmp((char*)c->rbuf, "GET /router ", 12) == 0;
+        c->upgraded = 1;
+        if( c->isMuxs ) {
+            if( muxs )
+                ws_close(muxs);
+            muxs = c;
+        }
+        int hlen = e+4 - (char*)c->rbuf;
+        memmove(c->rbuf, c->rbuf+hlen, c->rlen-hlen);
+        c->rlen -= hlen;
+        if( xwrite(c->fd, resp, sizeof(resp)-1) < 0 ) {
+            ws_close(c);
+            return;
+        }
+    }
+    int off = 0;
+    while( c->fd >= 0 && c->rlen - off >= 2 ) {
+        u1_t* f = c->rbuf+off;
+        int op = f[0] & 0xF;
+        int masked = f[1] & 0x80;
+        uL_t len = f[1] & 0x7F;
+        int hlen = 2;
+        if( len == 126 ) {
+            if( c->rlen-off < 4 ) break;
+            len = (f[2]<<8) | f[3];
+            hlen = 4;
+        } else if( len == 127 ) {
+            if( c->rlen-off < 10 ) break;
+            len = 0;
+            for( int i=0; i<8; i++ )
+                len = (len<<8) | f[2+i];
+            hlen = 10;
+        }
+        if( masked )
+            hlen += 4;
+        if( len > WS_RBUFSZ-16 ) {
+            ws_close(c);
+            return;
+        }
+        if( c->rlen-off < hlen+(int)len )
+            break;
+        u1_t* p = f+hlen;
+        if( masked ) {
+            for( int i=0; i<(int)len; i++ )
+                p[i] ^= f[hlen-4+(i&3)];
+        }
+        u1_t save = p[len];
+        p[len] = 0;
+        if( op == 1 ) {
+            onWsMessage(c, (char*)p);
+        } else if( op == 8 ) {
+            ws_close(c);
+            return;
+        } else if( op == 9 ) {
+            u1_t pong[2] = { 0x8A, 0 };
+            xwrite(c->fd, pong, 2);
+        }
+        p[len] = save;
+        off += hlen+len;
+    }
+    memmove(c->rbuf, c->rbuf+off, c->rlen-off);
+    c->rlen -= off;
+}
+
+
+// --------------------------------------------------------------------------------
+//
+// Radio side - lgwsim peer
+//
+// --------------------------------------------------------------------------------
+
+static void onSimRead () {
+    while(1) {
+        int n = read(simFd, simRbuf+simRlen, sizeof(simRbuf)-simRlen);
+        if( n <= 0 ) {
+            if( n < 0 && (errno == EAGAIN || errno == EINTR) )
+                return;
+            fprintf(stderr, "lgwload: radio simulation disconnected\n");
+            close(simFd);
+            simFd = -1;
+            timeOffset = 0;
+            return;
+        }
+        simRlen += n;
+        if( simRlen < sizeof(simRbuf) )
+            continue;
+        simRlen = 0;
+        struct sim_txpkt* tx = (struct sim_txpkt*)simRbuf;
+        if( tx->tx_mode == TXMODE_HELLO ) {
+            timeOffset = ((sL_t)tx->freq_hz<<32) | tx->count_us;
+            fprintf(stderr, "lgwload: radio simulation txunit#%d connected\n", tx->f_dev);
+        } else {
+            st.txseen += 1;
+        }
+    }
+}
+
+static void flushOutq () {
+    static const int PKTSZ = sizeof(struct sim_rxpkt);
+    while( outBeg < outEnd ) {
+        int n = write(simFd, outq+outBeg, outEnd-outBeg);
+        if( n < 0 ) {
+            if( errno != EAGAIN && errno != EINTR ) {
+                close(simFd);
+                simFd = -1;
+                timeOffset = 0;
+            }
+            break;
+        }
+        outBeg += n;
+    }
+    if( outBeg == outEnd ) {
+        outBeg = outEnd = 0;
+    } else if( outEnd > (OUTQ_PKTS-1)*PKTSZ ) {
+        memmove(outq, outq+outBeg, outEnd-outBeg);
+        outEnd -= outBeg;
+        outBeg = 0;
+    }
+}
+
+static int sfToDr (int sf) {
+    return 1 << (sf-6);   // DR_LORA_SF7 = 0x02 ... DR_LORA_SF12 = 0x40
+}
+
+static void emitFrame (sL_t t, u4_t freq, int sf, int bw, const u1_t* frame, int len) {
+    static const int PKTSZ = sizeof(struct sim_rxpkt);
+    if( outEnd + PKTSZ > OUTQ_PKTS*PKTSZ ) {
+        st.overflow += 1;
+        return;
+    }
+    struct sim_rxpkt* p = (struct sim_rxpkt*)(outq+outEnd);
+    memset(p, 0, PKTSZ);
+    p->freq_hz    = freq;
+    p->status     = STAT_CRC_OK;
+    p->count_us   = (u4_t)(t - timeOffset);
+    p->modulation = MOD_LORA;
+    p->bandwidth  = bw==500 ? BW_500KHZ : bw==250 ? BW_250KHZ : BW_125KHZ;
+    p->datarate   = sfToDr(sf);
+    p->coderate   = CR_LORA_4_5;
+    p->rssi       = -50.0;
+    p->snr        = 9.0;
+    p->snr_min    = 8.7;
+    p->snr_max    = 9.3;
+    p->size       = len;
+    memcpy(p->payload, frame, len);
+    int ftype = frame[0] >> 5;
+    if( len >= 12 && (ftype == 2 || ftype == 4) ) {
+        // Data uplink - sequence number doubles as DevAddr
+        u4_t devaddr = seq & DEVADDR_MASK;
+        p->payload[1] = devaddr;
+        p->payload[2] = devaddr>>8;
+        p->payload[3] = devaddr>>16;
+        p->payload[4] = devaddr>>24;
+        sentAt[seq & SEQ_MASK] = t;
+        seq += 1;
+        st.sent += 1;
+    } else {
+        st.untracked += 1;
+    }
+    outEnd += PKTSZ;
+}
+
+static void genFrame (sL_t t) {
+    u1_t frame[255];
+    int len = 12 + plen + 4;
+    memset(frame, 0, len);
+    frame[0] = 0x40;                    // unconfirmed data up
+    frame[6] = seq;                     // FCnt
+    frame[7] = seq>>8;
+    frame[8] = 1;                       // FPort
+    for( int i=0; i<plen; i++ )
+        frame[9+i] = i;
+    int sf = sfMin + lrand48() % (sfMax-sfMin+1);
+    emitFrame(t, plan->freqs[lrand48() % plan->nfreqs], sf, 125, frame, len);
+}
+
+// Next emission time of the uplink stream (µs relative to step start)
+static double nextTime (double prev) {
+    if( !traces )
+        return prev - log(1.0 - drand48()) / rate * 1e6;
+    if( traceIdx == ntraces ) {
+        traceLoop += traces[ntraces-1].t + 1.0;
+        traceIdx = 0;
+    }
+    return (traceLoop + traces[traceIdx].t) / rate * 1e6;
+}
+
+static void readTrace (str_t path) {
+    FILE* f = fopen(path, "r");
+    if( !f )
+        fatal("Failed to open trace '%s'", path);
+    char line[1024];
+    int lineno = 0;
+    while( fgets(line, sizeof(line), f) ) {
+        lineno += 1;
+        char hex[600] = { 0 };
+        double t;
+        unsigned freq, sf, bw;
+        if( line[0] == '#' || strspn(line, " \t\r\n") == strlen(line) )
+            continue;
+        if( sscanf(line, "%lf %u %u %u %599s", &t, &freq, &sf, &bw, hex) < 4 || sf < 7 || sf > 12 ) {
+            fprintf(stderr, "lgwload: %s:%d: expecting <time> <freq> <sf> <bw> [<hexframe>]\n", path, lineno);
+            exit(1);
+        }
+        if( (ntraces & 0x3FF) == 0 ) {
+            traces = realloc(traces, (ntraces+0x400)*sizeof(trace_t));
+            if( traces == NULL )
+                fatal("%s", "Out of memory");
+        }
+        trace_t* r = &traces[ntraces++];
+        memset(r, 0, sizeof(*r));
+        r->t = t;
+        r->freq = freq;
+        r->sf = sf;
+        r->bw = bw;
+        for( int i=0; hex[2*i] && hex[2*i+1] && i < 255; i++ ) {
+            unsigned b;
+            sscanf(&hex[2*i], "%2x", &b);
+            r->frame[r->len++] = b;
+        }
+    }
+    fclose(f);
+    if( ntraces == 0 ) {
+        fprintf(stderr, "lgwload: %s: empty trace\n", path);
+        exit(1);
+    }
+    // Make times relative to first record
+    for( int i=ntraces-1; i>=0; i-- )
+        traces[i].t -= traces[0].t;
+}
+
+static void emitTrace (sL_t t) {
+    trace_t* r = &traces[traceIdx++];
+    if( r->len == 0 ) {
+        genFrame(t);
+        return;
+    }
+    emitFrame(t, r->freq, r->sf, r->bw, r->frame, r->len);
+}
+
+
+// --------------------------------------------------------------------------------
+//
+// Main loop
+//
+// --------------------------------------------------------------------------------
+
+static int listenOn (struct sockaddr* sa, int salen) {
+    int fd = socket(sa->sa_family, SOCK_STREAM|SOCK_NONBLOCK, 0);
+    int one = 1;
+    if( fd < 0 )
+        return -1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if( bind(fd, sa, salen) < 0 || listen(fd, 4) < 0 ) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void acceptWs () {
+    int fd = accept4(lsnFd, NULL, NULL, SOCK_NONBLOCK);
+    if( fd < 0 )
+        return;
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    for( int i=0; i<MAX_WS; i++ ) {
+        if( wsconns[i].fd < 0 ) {
+            memset(&wsconns[i], 0, sizeof(wsconns[i]) - WS_RBUFSZ - 1);
+            wsconns[i].fd = fd;
+            return;
+        }
+    }
+    close(fd);
+}
+
+static void acceptSim () {
+    int fd = accept4(simLsnFd, NULL, NULL, SOCK_NONBLOCK);
+    if( fd < 0 )
+        return;
+    if( simFd >= 0 )
+        close(simFd);
+    simFd = fd;
+    simRlen = 0;
+    outBeg = outEnd = 0;
+    timeOffset = 0;
+}
+
+// Serve sockets until deadline (monotonic µs) - generate traffic if gen is set.
+static void runUntil (sL_t deadline, int gen) {
+    sL_t t0 = mono();
+    double tnext = gen ? nextTime(0) : 0;
+    while( !stop ) {
+        sL_t now = mono();
+        if( now >= deadline )
+            return;
+        if( gen && timeOffset ) {
+            while( t0 + (sL_t)tnext <= now ) {
+                if( traces )
+                    emitTrace(t0 + (sL_t)tnext);
+                else
+                    genFrame(t0 + (sL_t)tnext);
+                tnext = nextTime(tnext);
+            }
+        }
+        if( simFd >= 0 && outBeg < outEnd )
+            flushOutq();
+        sL_t wake = gen && timeOffset ? min(deadline, t0 + (sL_t)tnext) : deadline;
+        struct pollfd pfds[3+MAX_WS];
+        int npfds = 0;
+        pfds[npfds++] = (struct pollfd){ .fd=lsnFd,    .events=POLLIN };
+        pfds[npfds++] = (struct pollfd){ .fd=simLsnFd, .events=POLLIN };
+        pfds[npfds++] = (struct pollfd){ .fd=simFd,    .events=POLLIN | (outBeg < outEnd ? POLLOUT : 0) };
+        for( int i=0; i<MAX_WS; i++ )
+            pfds[npfds++] = (struct pollfd){ .fd=wsconns[i].fd, .events=POLLIN };
+        sL_t dt = max(0, wake - mono());
+        struct timespec ts = { .tv_sec = dt/1000000, .tv_nsec = (dt%1000000)*1000 };
+        if( ppoll(pfds, npfds, &ts, NULL) <= 0 )
+            continue;
+        if( pfds[0].revents & POLLIN )
+            acceptWs();
+        if( pfds[1].revents & POLLIN )
+            acceptSim();
+        if( simFd >= 0 && (pfds[2].revents & (POLLIN|POLLHUP|POLLERR)) )
+            onSimRead();
+        for( int i=0; i<MAX_WS; i++ ) {
+            if( wsconns[i].fd >= 0 && (pfds[3+i].revents & (POLLIN|POLLHUP|POLLERR)) )
+                onWsRead(&wsconns[i]);
+        }
+    }
+}
+
+static double runStep (double r) {
+    u4_t seq0 = seq;
+    memset(&st, 0, offsetof(typeof(st), nlat));
+    st.nlat = 0;
+    rate = r;
+    traceIdx = 0;
+    traceLoop = 0;
+    sL_t t = mono();
+    runUntil(t + (sL_t)(duration*1e6), 1);
+    runUntil(mono() + (sL_t)(DRAIN_TIME*1e6), 0);
+    // Forget frames still in flight so they don't count for the next step
+    for( u4_t s=seq0; s != seq; s++ )
+        sentAt[s & SEQ_MASK] = 0;
+    qsort(st.lat, st.nlat, sizeof(st.lat[0]), cmpFloat);
+    double loss = st.sent ? (double)(st.sent - st.recv) / st.sent : 0;
+    printf("{\"msgtype\":\"loadstep\",\"plan\":\"%s\",\"%s\":%.3f,\"duration\":%.1f,"
+           "\"sent\":%u,\"recv\":%u,\"lost\":%u,\"loss\":%.4f,\"late\":%u,\"untracked\":%u,\"overflow\":%u,"
+           "\"fps\":%.1f,\"lat_p50\":%.6f,\"lat_p90\":%.6f,\"lat_p99\":%.6f,\"lat_max\":%.6f,"
+           "\"dnsent\":%u,\"txseen\":%u,\"dntxed\":%u}\n",
+           plan->name, traces ? "speed" : "rate", r, duration,
+           st.sent, st.recv, st.sent - st.recv, loss, st.late, st.untracked, st.overflow,
+           st.recv / duration, quantile(0.5), quantile(0.9), quantile(0.99), quantile(1.0),
+           st.dnsent, st.txseen, st.dntxed);
+    fflush(stdout);
+    if( st.overflow )
+        return 1.0;
+    return loss;
+}
+
+static void usage () {
+    fprintf(stderr,
+            "usage: lgwload [options]\n"
+            "  -s PATH     lgwsim unix socket path (default spidev - same as LORAGW_SPI of station)\n"
+            "  -p PORT     TC/MUXS port - tc.uri of station should be ws://localhost:PORT (default 6038)\n"
+            "  -P PLAN     channel plan: EU863 or US902 (default EU863)\n"
+            "  -r RATE     uplink frames/sec - Poisson arrivals (default 10)\n"
+            "  -t FILE     replay trace: lines of <secs> <freq> <sf> <bwkHz> [<hexframe>] - RATE is a speed factor\n"
+            "  -d SECS     duration per step (default 10)\n"
+            "  -D RATIO    fraction of uplinks answered with an RX1 downlink (default 0)\n"
+            "  -f SF-SF    spreading factor range (default 7-12, capped by plan)\n"
+            "  -l LEN      FRMPayload length of generated frames (default 16)\n"
+            "  -S          sweep: double RATE until loss or p99 latency exceed limits\n"
+            "  -L LOSS     sweep loss limit (default 0.01)\n"
+            "  -T SECS     sweep p99 latency limit (default 0.5)\n");
+    exit(2);
+}
+
+static void onSignal (int sig) {
+    stop = 1;
+}
+
+int main (int argc, char** argv) {
+    int opt;
+    while( (opt = getopt(argc, argv, "s:p:P:r:t:d:D:f:l:SL:T:h")) != -1 ) {
+        switch(opt) {
+        case 's': sockPath = optarg; break;
+        case 'p': wsPort = atoi(optarg); break;
+        case 'P': {
+            int i = 0;
+            while( i < SIZE_ARRAY(PLANS) && strcmp(PLANS[i].name, optarg) != 0 )
+                i++;
+            if( i == SIZE_ARRAY(PLANS) )
+                usage();
+            plan = &PLANS[i];
+            break;
+        }
+        case 'r': rate = atof(optarg); break;
+        case 't': tracePath = optarg; break;
+        case 'd': duration = atof(optarg); break;
+        case 'D': dnRatio = atof(optarg); break;
+        case 'f': if( sscanf(optarg, "%d-%d", &sfMin, &sfMax) != 2 ) usage(); break;
+        case 'l': plen = atoi(optarg); break;
+        case 'S': sweep = 1; break;
+        case 'L': maxLoss = atof(optarg); break;
+        case 'T': maxLat = atof(optarg); break;
+        default: usage();
+        }
+    }
+    sfMax = min(sfMax, plan->sfmax);
+    if( rate <= 0 || duration <= 0 || plen < 0 || plen > 255-16 || sfMin < 7 || sfMin > sfMax )
+        usage();
+    if( tracePath )
+        readTrace(tracePath);
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+    signal(SIGPIPE, SIG_IGN);
+    srand48(mono());
+
+    sentAt = calloc(SEQ_MASK+1, sizeof(sentAt[0]));
+    outq = malloc(OUTQ_PKTS*sizeof(struct sim_rxpkt));
+    if( !sentAt || !outq )
+        fatal("%s", "Out of memory");
+    for( int i=0; i<MAX_WS; i++ )
+        wsconns[i].fd = -1;
+
+    struct sockaddr_in sin = { .sin_family=AF_INET, .sin_port=htons(wsPort), .sin_addr.s_addr=htonl(INADDR_LOOPBACK) };
+    if( (lsnFd = listenOn((struct sockaddr*)&sin, sizeof(sin))) < 0 ) {
+        char port[16];
+        snprintf(port, sizeof(port), "%d", wsPort);
+        fatal("Failed to listen on port %s", port);
+    }
+    struct sockaddr_un sun = { .sun_family=AF_UNIX };
+    snprintf(sun.sun_path, sizeof(sun.sun_path), "%s", sockPath);
+    unlink(sockPath);
+    if( (simLsnFd = listenOn((struct sockaddr*)&sun, sizeof(sun))) < 0 )
+        fatal("Failed to listen on '%s'", sockPath);
+
+    fprintf(stderr, "lgwload: waiting for station (lgwsim=%s port=%d plan=%s)\n", sockPath, wsPort, plan->name);
+    while( !stop && (timeOffset == 0 || muxs == NULL) )
+        runUntil(mono() + 100000, 0);
+    runUntil(mono() + (sL_t)(SETTLE_TIME*1e6), 0);
+
+    double r = rate, best = 0;
+    while( !stop ) {
+        double loss = runStep(r);
+        int ok = loss <= maxLoss && quantile(0.99) <= maxLat;
+        if( !sweep || !ok || stop || timeOffset == 0 )
+            break;
+        best = r;
+        r *= 2;
+    }
+    if( sweep ) {
+        printf("{\"msgtype\":\"loadsum\",\"plan\":\"%s\",\"sfs\":\"%d-%d\",\"max_%s\":%.3f,\"max_fps\":%.1f}\n",
+               plan->name, sfMin, sfMax, traces ? "speed" : "rate", best,
+               traces ? best * ntraces / (traces[ntraces-1].t + 1.0) : best);
+    }
+    unlink(sockPath);
+    return 0;
+}
+
+#endif // defined(CFG_prog_lgwload)
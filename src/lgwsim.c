@@ -117,7 +117,7 @@ static int cca (sL_t txtime, u4_t txfreq) {
 
 static sL_t xticks () {
     // Make it different from ustime_t to increase test coverage
-    return sys_time() - timeOffset;
+    return rt_getTime() - timeOffset;
 }
 
 
@@ -334,7 +334,7 @@ int lgw_start () {
     memset(&sockAddr, 0, sizeof(sockAddr));
     // Make xticks different from ustime to cover more test ground.
     // xticks start at ~(1<<28) whenever a radio simulation starts.
-    timeOffset = sys_time() - 0x10000000;
+    timeOffset = rt_getTime() - 0x10000000;
     sockAddr.sun_family = AF_UNIX;
     snprintf(sockAddr.sun_path, sizeof(sockAddr.sun_path), "%s", sockPath);
     rt_yieldTo(&conn_tmr, try_connecting);
@@ -1115,7 +1115,7 @@ int sx1301ar_start( uint8_t nb_brd ) {
     memset(&sockAddr, 0, sizeof(sockAddr));
     // Make xticks different from ustime to cover more test ground.
     // xticks start at ~(1<<28) whenever a radio simulation starts.
-    timeOffset = sys_time() - 0x10000000;
+    timeOffset = rt_getTime() - 0x10000000;
     sockAddr.sun_family = AF_UNIX;
     snprintf(sockAddr.sun_path, sizeof(sockAddr.sun_path), "%s", sockPath);
     rt_yieldTo(&conn_tmr, try_connecting);
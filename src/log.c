@@ -30,6 +30,7 @@
 #include "sys.h"
 #include "rt.h"
 #include "uj.h"
+#include "xq.h"     // %J - txjob only
 
 const char* LVLSTR[] = {
     [XDEBUG  ]= "XDEB",
@@ -63,6 +64,16 @@ const char* MODSTR[] = {
 #define CFG_logini_lvl INFO
 #endif
 
+// Per module rate limit: max lines per second (0=unlimited).
+// Lines over the limit are counted and reported with the next line
+// of the module after the one second window has passed.
+static struct lograte {
+    u2_t     limit;
+    u2_t     cnt;
+    u4_t     suppressed;
+    ustime_t win;
+} logRates[32];
+
 static char   logline[LOGLINE_LEN];
 static dbuf_t logbuf = { .buf=logline, .bufsize=sizeof(logline), .pos=0 };
 static char   slaveMod[4];
@@ -74,12 +85,16 @@ static u1_t   logLevels[32] = {
 };
 
 
-static int log_header (u1_t mod_level) {
+static int fmtHeader (dbuf_t* b, u1_t mod_level, ustime_t utc) {
     int mod = (mod_level & MOD_ALL) >> 3;
-    logbuf.pos = 0;
+    b->pos = 0;
     str_t mod_s = slaveMod[0] ? slaveMod : mod >= SIZE_ARRAY(MODSTR) ? "???":MODSTR[mod];
-    xprintf(&logbuf, "%.3T [%s:%s] ", rt_getUTC(), mod_s, LVLSTR[mod_level & 7]);
-    return logbuf.pos;
+    xprintf(b, "%.3T [%s:%s] ", utc, mod_s, LVLSTR[mod_level & 7]);
+    return b->pos;
+}
+
+static int log_header (u1_t mod_level) {
+    return fmtHeader(&logbuf, mod_level, rt_getUTC());
 }
 
 int log_str2level (const char* level) {
@@ -105,6 +120,7 @@ int log_str2level (const char* level) {
     return -1;
 }
 
+// Comma separated list of levels: [MOD:]LVL[/N] - N max lines per second (0=no limit)
 str_t log_parseLevels (const char* levels) {
     do {
         int l = log_str2level(levels);
@@ -112,6 +128,14 @@ str_t log_parseLevels (const char* levels) {
             return levels;
         log_setLevel(l);
         str_t s = strchr(levels, ',');
+        str_t r = strchr(levels, '/');
+        if( r && (s == NULL || r < s) ) {
+            char* e;
+            long rate = strtol(r+1, &e, 10);
+            if( e == r+1 || rate < 0 || rate > 0xFFFF || (*e && *e != ',') )
+                return r;
+            log_setRate(l, rate);
+        }
         if( s == NULL )
             return NULL;
         levels = s+1;
@@ -139,13 +163,56 @@ int log_setLevel (int level) {
     return old;
 }
 
+void log_setRate (int level, int rate) {
+    int mod = level & MOD_ALL;
+    for( int m=0; m<32; m++ ) {
+        if( mod == MOD_ALL || m == mod>>3 ) {
+            logRates[m].limit = rate;
+            logRates[m].cnt = 0;
+        }
+    }
+}
+
+static int rateLimited (u1_t mod_level) {
+    struct lograte* r = &logRates[(mod_level & MOD_ALL) >> 3];
+    if( r->limit == 0 )
+        return 0;
+    ustime_t now = rt_getTime();
+    if( now - r->win >= rt_seconds(1) ) {
+        r->win = now;
+        r->cnt = 0;
+        if( r->suppressed ) {
+            log_header(mod_level);
+            xprintf(&logbuf, "%u log lines suppressed (limit %u/s)", r->suppressed, r->limit);
+            log_flush();
+            r->suppressed = 0;
+        }
+    }
+    if( r->cnt >= r->limit ) {
+        r->suppressed += 1;
+        return 1;
+    }
+    r->cnt += 1;
+    return 0;
+}
+
 int log_shallLog (u1_t mod_level) {
     return (mod_level&7) >= logLevels[(mod_level & MOD_ALL) >> 3];
 }
 
 void log_vmsg (u1_t mod_level, const char* fmt, va_list args) {
-    if( !log_shallLog(mod_level) )
+    if( !log_shallLog(mod_level) || rateLimited(mod_level) )
         return;
+    if( LOG_DEFERRED ) {
+        // Leave formatting to the log thread
+        u1_t rec[LOGLINE_LEN];
+        va_list ap;
+        va_copy(ap, args);
+        int len = log_packRecord(rec, sizeof(rec), mod_level, rt_getUTC(), fmt, ap);
+        va_end(ap);
+        if( len > 0 && sys_addLogRecord(rec, len) )
+            return;
+    }
     int n = log_header(mod_level);
     logbuf.pos = n;
     vxprintf(&logbuf, fmt, args);
@@ -160,7 +227,7 @@ void log_msg (u1_t mod_level, const char* fmt, ...) {
 }
 
 int log_special (u1_t mod_level, dbuf_t* b) {
-    if( !log_shallLog(mod_level) )
+    if( !log_shallLog(mod_level) || rateLimited(mod_level) )
         return 0;
     b->buf = logbuf.buf;
     b->bufsize = logbuf.bufsize;
@@ -186,3 +253,238 @@ void log_flushIO () {
     sys_addLog(logbuf.buf, 0);
 }
 
+
+
+// --------------------------------------------------------------------------------
+//
+// Deferred log records
+//
+// Instead of a formatted line a record carries the format string pointer,
+// the UTC timestamp and the raw arguments. Strings and byte arrays are copied
+// since they might not be valid anymore once the record is formatted.
+// Records are only valid within the process that created them.
+//
+// Layout: fmt pointer | utc | mod_level | args...
+//
+// --------------------------------------------------------------------------------
+
+enum { LOGREC_HDRLEN = sizeof(const char*) + sizeof(ustime_t) + 1 };
+enum { LOGREC_NULLSTR = 0xFFFF };
+
+// Walk one format element starting after '%' - returns length of element
+// or 0 if not a conversion (literal percent). *conv is the conversion char.
+static int fmtElem (const char* fmt, char* conv, int* stars, int* frac) {
+    int fmtoff = 0, dot = 0;
+    *stars = 0;
+    *frac = -1;
+    while(1) {
+        char c = fmt[fmtoff];
+        if( c == 0 || fmtoff >= 16 )
+            return 0;
+        fmtoff += 1;
+        switch(c) {
+        case '*': *stars |= dot ? 1 : 2; break;
+        case '.': dot = 1; *frac = 0; break;
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+            if( dot ) *frac = *frac*10 + c - '0';
+            break;
+        case 'c': case 'd': case 'u': case 'x': case 'X': case 'f': case 'g': case 's': case 'p':
+        case 'H': case 'B': case 'M': case 'E': case 'T': case 'F': case 'R': case 'J':
+            *conv = c;
+            return fmtoff;
+        }
+    }
+}
+
+#define PUT(v) do { if( p + sizeof(v) > e ) return 0; memcpy(p, &(v), sizeof(v)); p += sizeof(v); } while(0)
+#define GET(v) do { if( p + sizeof(v) > e ) goto done; memcpy(&(v), p, sizeof(v)); p += sizeof(v); } while(0)
+
+int log_packRecord (u1_t* rec, int recsize, u1_t mod_level, ustime_t utc, const char* fmt, va_list args) {
+    u1_t* p = rec;
+    u1_t* e = rec + recsize;
+    PUT(fmt);
+    PUT(utc);
+    PUT(mod_level);
+    while( (fmt = strchr(fmt, '%')) != NULL ) {
+        fmt += 1;
+        if( fmt[0] == '%' ) {
+            fmt += 1;
+            continue;
+        }
+        char conv;
+        int stars, frac, n = fmtElem(fmt, &conv, &stars, &frac);
+        if( n == 0 )
+            continue;
+        fmt += n;
+        int longFlag = fmt[-2] == 'l';
+        if( stars & 2 ) { int w = va_arg(args, int); PUT(w); }
+        if( stars & 1 ) { frac = va_arg(args, int); PUT(frac); }
+        switch(conv) {
+        case 'c': case 'd': case 'u': case 'x': case 'X': {
+            if( longFlag ) { uL_t v = va_arg(args, uL_t); PUT(v); }
+            else           { int  v = va_arg(args, int);  PUT(v); }
+            break;
+        }
+        case 'F': case 'R': {
+            int v = va_arg(args, int); PUT(v);
+            break;
+        }
+        case 'M': case 'E': case 'T': {
+            uL_t v = va_arg(args, uL_t); PUT(v);
+            break;
+        }
+        case 'p': {
+            void* v = va_arg(args, void*); PUT(v);
+            break;
+        }
+        case 'f': case 'g': {
+            double v = va_arg(args, double); PUT(v);
+            break;
+        }
+        case 's': {
+            const char* s = va_arg(args, const char*);
+            u2_t len = LOGREC_NULLSTR;
+            if( s ) {
+                int max = frac >= 0 ? frac : LOGLINE_LEN;
+                len = 0;
+                while( len < max && s[len] )
+                    len++;
+            }
+            PUT(len);
+            if( s ) {
+                if( p + len > e ) return 0;
+                memcpy(p, s, len);
+                p += len;
+            }
+            break;
+        }
+        case 'H': case 'B': {
+            int len = va_arg(args, int);
+            const u1_t* d = va_arg(args, const u1_t*);
+            len = max(0, min(len, LOGLINE_LEN));
+            PUT(len);
+            if( p + len > e ) return 0;
+            memcpy(p, d, len);
+            p += len;
+            break;
+        }
+        case 'J': {
+            txjob_t* txjob = va_arg(args, txjob_t*);
+            PUT(txjob->deveui);
+            PUT(txjob->diid);
+            PUT(txjob->txunit);
+            break;
+        }
+        }
+    }
+    return p - rec;
+}
+
+
+int log_fmtRecord (char* buf, int bufsize, const u1_t* rec, int reclen) {
+    const u1_t* p = rec;
+    const u1_t* e = rec + reclen;
+    dbuf_t b = { .buf=buf, .bufsize=bufsize, .pos=0 };
+    const char* fmt;
+    ustime_t utc;
+    u1_t mod_level;
+    char elem[40];
+    GET(fmt);
+    GET(utc);
+    GET(mod_level);
+    fmtHeader(&b, mod_level, utc);
+    while( *fmt ) {
+        const char* pct = strchr(fmt, '%');
+        int lit = pct ? pct - fmt : strlen(fmt);
+        xputs(&b, fmt, lit);
+        if( !pct )
+            break;
+        fmt = pct+1;
+        if( fmt[0] == '%' ) {
+            xputs(&b, "%", 1);
+            fmt += 1;
+            continue;
+        }
+        char conv;
+        int stars, frac, n = fmtElem(fmt, &conv, &stars, &frac);
+        if( n == 0 ) {
+            xputs(&b, "%", 1);
+            continue;
+        }
+        // Rebuild format element with star values filled in
+        int w = 0;
+        if( stars & 2 ) GET(w);
+        if( stars & 1 ) GET(frac);
+        dbuf_t eb = { .buf=elem, .bufsize=sizeof(elem), .pos=0 };
+        xputs(&eb, "%", 1);
+        for( int i=0; i<n; i++ ) {
+            if( fmt[i] == '*' )
+                xprintf(&eb, "%d", i > 0 && fmt[i-1] == '.' ? frac : w);
+            else
+                xputs(&eb, &fmt[i], 1);
+        }
+        xeos(&eb);
+        int longFlag = fmt[n-2] == 'l';
+        fmt += n;
+        switch(conv) {
+        case 'c': case 'd': case 'u': case 'x': case 'X': {
+            if( longFlag ) { uL_t v; GET(v); xprintf(&b, elem, v); }
+            else           { int  v; GET(v); xprintf(&b, elem, v); }
+            break;
+        }
+        case 'F': case 'R': {
+            int v; GET(v); xprintf(&b, elem, v);
+            break;
+        }
+        case 'M': case 'E': case 'T': {
+            uL_t v; GET(v); xprintf(&b, elem, v);
+            break;
+        }
+        case 'p': {
+            void* v; GET(v); xprintf(&b, elem, v);
+            break;
+        }
+        case 'f': case 'g': {
+            double v; GET(v); xprintf(&b, elem, v);
+            break;
+        }
+        case 's': {
+            u2_t len; GET(len);
+            if( len == LOGREC_NULLSTR ) {
+                xprintf(&b, elem, NULL);
+                break;
+            }
+            if( p + len > e ) goto done;
+            char s[len+1];
+            memcpy(s, p, len);
+            s[len] = 0;
+            p += len;
+            xprintf(&b, elem, s);
+            break;
+        }
+        case 'H': case 'B': {
+            int len; GET(len);
+            if( p + len > e ) goto done;
+            xprintf(&b, elem, len, p);
+            p += len;
+            break;
+        }
+        case 'J': {
+            txjob_t txjob;
+            GET(txjob.deveui);
+            GET(txjob.diid);
+            GET(txjob.txunit);
+            xprintf(&b, elem, &txjob);
+            break;
+        }
+        }
+    }
+  done:
+    xeol(&b);
+    xeos(&b);
+    return b.pos;
+}
+
+#undef PUT
+#undef GET
@@ -28,6 +28,7 @@
 
 #include "s2conf.h"
 #include "uj.h"
+#include "s2e.h"
 
 
 #define MHDR_FTYPE  0xE0
@@ -79,139 +80,375 @@
 #define OFF_df_minlen  12
 
 
-uL_t* s2e_joineuiFilter;
+uL_t* s2e_joineuiFilter;      // sorted disjoint [lo,hi] pairs - see s2e_setJoineuiFilter
+int   s2e_joineuiFilterLen;   // number of ranges - 0 means no filter
 u4_t  s2e_netidFilter[4] = { 0xffFFffFF, 0xffFFffFF, 0xffFFffFF, 0xffFFffFF };
 
 
-int s2e_parse_lora_frame (ujbuf_t* buf, const u1_t* frame , int len, dbuf_t* lbuf) {
+static int cmpRange (const void* a, const void* b) {
+    uL_t la = ((const uL_t*)a)[0], lb = ((const uL_t*)b)[0];
+    return la < lb ? -1 : la > lb ? 1 : 0;
+}
+
+// Sort n ranges [lo,hi] in place and merge overlapping/adjacent ones into a binary searchable set.
+// The result is terminated by a 0/0 pair - ranges must have room for n+1 entries.
+int s2e_setJoineuiFilter (uL_t* ranges, int n) {
+    qsort(ranges, n, 2*sizeof(uL_t), cmpRange);
+    int m = 0;
+    for( int i=0; i<n; i++ ) {
+        uL_t lo = ranges[2*i], hi = ranges[2*i+1];
+        if( lo > hi )
+            continue;  // empty - never matched anything
+        if( m > 0 && (ranges[2*m-1] == ~(uL_t)0 || lo <= ranges[2*m-1]+1) ) {
+            ranges[2*m-1] = max(ranges[2*m-1], hi);
+            continue;
+        }
+        ranges[2*m+0] = lo;
+        ranges[2*m+1] = hi;
+        m++;
+    }
+    ranges[2*m+0] = ranges[2*m+1] = 0;
+    s2e_joineuiFilter = ranges;
+    s2e_joineuiFilterLen = m;
+    return m;
+}
+
+// DevAddr allowlist - binary trie over prefix bits, MSB first.
+// Node 0 is the root - a child index of 0 means no child.
+typedef struct devaddrNode {
+    u2_t child[2];
+    s2_t pfx;        // prefix ending here or -1
+} devaddrNode_t;
+
+devaddrPrefix_t* s2e_devaddrPrefixes;
+int              s2e_devaddrPrefixCnt;
+u4_t             s2e_devaddrShed;    // frames dropped by the DevAddr filter
+static devaddrNode_t* devaddrTrie;
+static int            devaddrNodes;  // 0 means filter is off
+static u4_t           devaddrCap;    // MAX_DEVADDR_PREFIXES of current allocation
+
+// NwkID length by NetID type - LoRaWAN Backend Interfaces 1.0, 6.1.1
+static const u1_t NWKID_BITS[8] = { 6, 6, 9, 11, 12, 13, 15, 17 };
+
+int s2e_netid2prefix (u4_t netid, u4_t* addr) {
+    int type  = (netid >> 21) & 7;
+    int nbits = NWKID_BITS[type];
+    int pbits = type+1;  // type times 1 followed by a 0
+    u4_t nwkid = netid & ((1<<nbits)-1);
+    *addr = (((1u<<type)-1) << (33-pbits)) | (nwkid << (32-pbits-nbits));
+    return pbits + nbits;
+}
+
+void s2e_resetDevaddrFilter (int enable) {
+    u4_t cap = min(MAX_DEVADDR_PREFIXES, DEVADDR_PREFIX_LIMIT);
+    if( devaddrTrie == NULL || devaddrCap != cap ) {
+        rt_free(devaddrTrie);
+        rt_free(s2e_devaddrPrefixes);
+        devaddrCap = cap;
+        devaddrTrie = rt_mallocN(devaddrNode_t, 32*cap+1);
+        s2e_devaddrPrefixes = rt_mallocN(devaddrPrefix_t, cap);
+    }
+    s2e_devaddrPrefixCnt = 0;
+    s2e_devaddrShed = 0;
+    devaddrTrie[0] = (devaddrNode_t){ .pfx = -1 };
+    devaddrNodes = enable ? 1 : 0;
+}
+
+int s2e_addDevaddrPrefix (u4_t addr, int bits) {
+    if( devaddrNodes == 0 || s2e_devaddrPrefixCnt >= devaddrCap || bits < 0 || bits > 32 )
+        return 0;
+    u4_t mask = bits==0 ? 0 : ~0u << (32-bits);
+    int idx = 0;
+    for( int b=0; b < bits; b++ ) {
+        int bit = (addr >> (31-b)) & 1;
+        if( devaddrTrie[idx].child[bit] == 0 ) {
+            devaddrTrie[devaddrNodes] = (devaddrNode_t){ .pfx = -1 };
+            devaddrTrie[idx].child[bit] = devaddrNodes++;
+        }
+        idx = devaddrTrie[idx].child[bit];
+    }
+    if( devaddrTrie[idx].pfx < 0 )
+        devaddrTrie[idx].pfx = s2e_devaddrPrefixCnt;
+    s2e_devaddrPrefixes[s2e_devaddrPrefixCnt++] = (devaddrPrefix_t){ .addr = addr & mask, .bits = bits };
+    return 1;
+}
+
+void s2e_logDevaddrFilter () {
+    if( devaddrNodes == 0 )
+        return;
+    LOG(MOD_S2E|INFO, "DevAddr filter: %d prefixes, %u frames dropped", s2e_devaddrPrefixCnt, s2e_devaddrShed);
+    for( int i=0; i < s2e_devaddrPrefixCnt; i++ )
+        LOG(MOD_S2E|INFO, "  %08X/%-2d %u frames", s2e_devaddrPrefixes[i].addr, s2e_devaddrPrefixes[i].bits, s2e_devaddrPrefixes[i].hits);
+}
+
+// Shortest matching prefix gets the hit - counters are only bumped if count is set
+static int devaddrPasses (u4_t devaddr, int count) {
+    int idx = 0;
+    for( int b=31; ; b-- ) {
+        int pfx = devaddrTrie[idx].pfx;
+        if( pfx >= 0 ) {
+            if( count )
+                s2e_devaddrPrefixes[pfx].hits += 1;
+            return 1;
+        }
+        if( b < 0 || (idx = devaddrTrie[idx].child[(devaddr >> b) & 1]) == 0 ) {
+            if( count )
+                s2e_devaddrShed += 1;
+            return 0;
+        }
+    }
+}
+
+static int joineuiPasses (uL_t joineui) {
+    const uL_t* f = s2e_joineuiFilter;
+    // Find first range starting above joineui - candidate is the one before
+    int lo = 0, hi = s2e_joineuiFilterLen;
+    while( lo < hi ) {
+        int mid = (lo+hi) >> 1;
+        if( f[2*mid] <= joineui )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo > 0 && joineui <= f[2*lo-1];
+}
+
+
+// Check frame, apply filters and extract the fields needed by JSON encoding and logging.
+// DevAddr filter counters are bumped only if count is set - frames kept by shedding get decoded again.
+static int decodeLoraFrame (lorafrm_t* f, const u1_t* frame, int len, int count) {
+    memset(f, 0, sizeof(*f));
+    f->frame = frame;
+    f->len = len;
     if( len == 0 ) {
     badframe:
         LOG(MOD_S2E|DEBUG, "Not a LoRaWAN frame: %16.4H", len, frame);
+        f->drop = LORAFRM_BAD;
         return 0;
     }
-    int ftype = frame[OFF_mhdr] & MHDR_FTYPE;
+    int ftype = f->ftype = frame[OFF_mhdr] & MHDR_FTYPE;
+    f->mhdr = frame[OFF_mhdr];
     if( (len < OFF_df_minlen && ftype != FRMTYPE_PROP) ||
         // (FTYPE_BIT(ftype) & DNFRAME_TYPE) != 0 || --- because of device_mode feature we parse everything
         (frame[OFF_mhdr] & (MHDR_RFU|MHDR_MAJOR)) != MAJOR_V1 ) {
 	goto badframe;
     }
     if( ftype == FRMTYPE_PROP || ftype == FRMTYPE_JACC ) {
-        str_t msgtype = ftype == FRMTYPE_PROP ? "propdf" : "jacc";
-        uj_encKVn(buf,
-                  "msgtype",   's', msgtype,
-                  "FRMPayload",'H', len, &frame[0],
-                  NULL);
-        xprintf(lbuf, "%s %16.16H", msgtype, len, &frame[0]);
+        f->msgtype = ftype == FRMTYPE_PROP ? "propdf" : "jacc";
         return 1;
     }
     if( ftype == FRMTYPE_JREQ || ftype == FRMTYPE_REJOIN ) {
         if( len != OFF_jreq_len)
             goto badframe;
-        uL_t joineui = rt_rlsbf8(&frame[OFF_joineui]);
-        
-        if( s2e_joineuiFilter[0] != 0 ) {
-            uL_t* f = s2e_joineuiFilter-2;
-            while( *(f += 2) ) {
-                if( joineui >= f[0] && joineui <= f[1] )
-                    goto out1;
-            }
-            
-            xprintf(lbuf, "Join EUI %E filtered", joineui);
+        f->joineui = rt_rlsbf8(&frame[OFF_joineui]);
+        if( s2e_joineuiFilterLen > 0 && !joineuiPasses(f->joineui) ) {
+            f->drop = LORAFRM_JOINEUI;
             return 0;
-          out1:;
         }
-        str_t msgtype = (ftype == FRMTYPE_JREQ ? "jreq" : "rejoin");
-        u1_t  mhdr = frame[OFF_mhdr];
-        uL_t  deveui = rt_rlsbf8(&frame[OFF_deveui]);
-        u2_t  devnonce = rt_rlsbf2(&frame[OFF_devnonce]);
-        s4_t  mic = (s4_t)rt_rlsbf4(&frame[len-4]);
-        uj_encKVn(buf,
-                  "msgtype", 's', msgtype,
-                  "MHdr",    'i', mhdr,
-                  rt_joineui,'E', joineui,
-                  rt_deveui, 'E', deveui,
-                  "DevNonce",'i', devnonce,
-                  "MIC",     'i', mic,
-                  NULL);
-        xprintf(lbuf, "%s MHdr=%02X %s=%:E %s=%:E DevNonce=%d MIC=%d",
-                msgtype, mhdr, rt_joineui, joineui, rt_deveui, deveui, devnonce, mic);
+        f->msgtype  = ftype == FRMTYPE_JREQ ? "jreq" : "rejoin";
+        f->deveui   = rt_rlsbf8(&frame[OFF_deveui]);
+        f->devnonce = rt_rlsbf2(&frame[OFF_devnonce]);
+        f->mic      = (s4_t)rt_rlsbf4(&frame[len-4]);
         return 1;
     }
-    u1_t foptslen = frame[OFF_fctrl] & 0xF;
-    u1_t portoff = foptslen + OFF_fopts;
-    if( portoff > len-4  )
+    f->foptslen = frame[OFF_fctrl] & 0xF;
+    f->portoff = f->foptslen + OFF_fopts;
+    if( f->portoff > len-4  )
         goto badframe;
-    u4_t devaddr = rt_rlsbf4(&frame[OFF_devaddr]);
+    u4_t devaddr = f->devaddr = rt_rlsbf4(&frame[OFF_devaddr]);
     u1_t netid = devaddr >> (32-7);
     if( ((1 << (netid & 0x1F)) & s2e_netidFilter[netid>>5]) == 0 ) {
-        
-        xprintf(lbuf, "DevAddr=%X with NetID=%d filtered", devaddr, netid);
+        f->drop = LORAFRM_NETID;
+        return 0;
+    }
+    if( devaddrNodes > 0 && !devaddrPasses(devaddr, count) ) {
+        f->drop = LORAFRM_DEVADDR;
+        return 0;
+    }
+    f->fctrl   = frame[OFF_fctrl];
+    f->fcnt    = rt_rlsbf2(&frame[OFF_fcnt]);
+    f->mic     = (s4_t)rt_rlsbf4(&frame[len-4]);
+    f->msgtype = ftype==FRMTYPE_DAUP || ftype==FRMTYPE_DCUP ? "updf" : "dndf";
+    return 1;
+}
+
+int s2e_decodeLoraFrame (lorafrm_t* f, const u1_t* frame, int len) {
+    return decodeLoraFrame(f, frame, len, 1);
+}
+
+
+// Decide if a frame is given up while the RX path is overloaded - stages is a set of RXSHED_*.
+// Join requests and confirmed uplinks passing the filters are always kept.
+// snr is scaled by 4, sf is SF12..SF7 or FSK. Returns 0 to keep the frame or the
+// stage shedding it.
+int s2e_shedLoraFrame (const u1_t* frame, int len, int sf, int snr, int stages) {
+    if( (stages & (RXSHED_FILTER|RXSHED_SNR)) == 0 )
+        return 0;
+    lorafrm_t f;
+    if( !decodeLoraFrame(&f, frame, len, 0) ) {
+        if( (stages & RXSHED_FILTER) && f.drop == LORAFRM_DEVADDR )
+            s2e_devaddrShed += 1;  // given up here - never reaches s2e_decodeRxjob
+        return stages & RXSHED_FILTER;
+    }
+    if( f.ftype == FRMTYPE_JREQ || f.ftype == FRMTYPE_REJOIN || f.ftype == FRMTYPE_DCUP )
         return 0;
+    // Demodulation floor: SF7 -7.5dB .. SF12 -20dB
+    if( (stages & RXSHED_SNR) && sf < FSK && snr < -80 + 10*sf + 4*(int)RX_SHED_SNR_MARGIN )
+        return RXSHED_SNR;
+    return 0;
+}
+
+
+// Encode fields of a frame accepted by s2e_decodeLoraFrame as JSON.
+void s2e_encLoraFrame (ujbuf_t* buf, const lorafrm_t* f) {
+    const u1_t* frame = f->frame;
+    int len = f->len;
+    if( f->ftype == FRMTYPE_PROP || f->ftype == FRMTYPE_JACC ) {
+        uj_encKVn(buf,
+                  "msgtype",   's', f->msgtype,
+                  "FRMPayload",'H', len, &frame[0],
+                  NULL);
+        return;
     }
-    u1_t  mhdr  = frame[OFF_mhdr];
-    u1_t  fctrl = frame[OFF_fctrl];
-    u2_t  fcnt  = rt_rlsbf2(&frame[OFF_fcnt]);
-    s4_t  mic   = (s4_t)rt_rlsbf4(&frame[len-4]);
-    str_t dir   = ftype==FRMTYPE_DAUP || ftype==FRMTYPE_DCUP ? "updf" : "dndf";
+    if( f->ftype == FRMTYPE_JREQ || f->ftype == FRMTYPE_REJOIN ) {
+        uj_encKVn(buf,
+                  "msgtype", 's', f->msgtype,
+                  "MHdr",    'i', f->mhdr,
+                  rt_joineui,'E', f->joineui,
+                  rt_deveui, 'E', f->deveui,
+                  "DevNonce",'i', f->devnonce,
+                  "MIC",     'i', f->mic,
+                  NULL);
+        return;
+    }
+    int portoff = f->portoff;
     uj_encKVn(buf,
-              "msgtype",   's', dir,
-              "MHdr",      'i', mhdr,
-              "DevAddr",   'i', (s4_t)devaddr,
-              "FCtrl",     'i', fctrl,
-              "FCnt",      'i', fcnt,
-              "FOpts",     'H', foptslen, &frame[OFF_fopts],
+              "msgtype",   's', f->msgtype,
+              "MHdr",      'i', f->mhdr,
+              "DevAddr",   'i', (s4_t)f->devaddr,
+              "FCtrl",     'i', f->fctrl,
+              "FCnt",      'i', f->fcnt,
+              "FOpts",     'H', f->foptslen, &frame[OFF_fopts],
               "FPort",     'i', portoff == len-4 ? -1 : frame[portoff],
               "FRMPayload",'H', max(0, len-5-portoff), &frame[portoff+1],
-              "MIC",       'i', mic,
+              "MIC",       'i', f->mic,
               NULL);
+}
+
+
+// Describe a decoded frame (or why it was filtered) for the log.
+void s2e_logLoraFrame (dbuf_t* lbuf, const lorafrm_t* f) {
+    const u1_t* frame = f->frame;
+    int len = f->len;
+    switch( f->drop ) {
+    case LORAFRM_BAD:     return;
+    case LORAFRM_JOINEUI: xprintf(lbuf, "Join EUI %E filtered", f->joineui); return;
+    case LORAFRM_NETID:   xprintf(lbuf, "DevAddr=%X with NetID=%d filtered", f->devaddr, f->devaddr >> (32-7)); return;
+    case LORAFRM_DEVADDR: xprintf(lbuf, "DevAddr=%X not matching any prefix - filtered", f->devaddr); return;
+    }
+    if( f->ftype == FRMTYPE_PROP || f->ftype == FRMTYPE_JACC ) {
+        xprintf(lbuf, "%s %16.16H", f->msgtype, len, &frame[0]);
+        return;
+    }
+    if( f->ftype == FRMTYPE_JREQ || f->ftype == FRMTYPE_REJOIN ) {
+        xprintf(lbuf, "%s MHdr=%02X %s=%:E %s=%:E DevNonce=%d MIC=%d",
+                f->msgtype, f->mhdr, rt_joineui, f->joineui, rt_deveui, f->deveui, f->devnonce, f->mic);
+        return;
+    }
     xprintf(lbuf, "%s mhdr=%02X DevAddr=%08X FCtrl=%02X FCnt=%d FOpts=[%H] %4.2H mic=%d (%d bytes)",
-            dir, mhdr, devaddr, fctrl, fcnt,
-            foptslen, &frame[OFF_fopts],
-            max(0, len-4-portoff), &frame[portoff], mic, len);
-    return 1;
+            f->msgtype, f->mhdr, f->devaddr, f->fctrl, f->fcnt,
+            f->foptslen, &frame[OFF_fopts],
+            max(0, len-4-f->portoff), &frame[f->portoff], f->mic, len);
 }
 
 
-static int crc16_no_table(uint8_t* pdu, int len) {
-    uint32_t remainder = 0;
-    uint32_t polynomial = 0x1021;
-    for( int i=0; i<len; i++ ) {
-        remainder ^= pdu[i] << 8;
-        for( int bit=0; bit < 8; bit++ ) {
-            if( remainder & 0x8000 ) {
-                remainder = (remainder << 1) ^ polynomial;
-            } else {
-                remainder <<= 1;
-            }
+// Check frame and apply filters - if buf is not NULL encode frame fields as JSON.
+int s2e_parse_lora_frame (ujbuf_t* buf, const u1_t* frame , int len, dbuf_t* lbuf) {
+    lorafrm_t f;
+    int ok = s2e_decodeLoraFrame(&f, frame, len);
+    if( ok && buf )
+        s2e_encLoraFrame(buf, &f);
+    if( lbuf )
+        s2e_logLoraFrame(lbuf, &f);
+    return ok;
+}
+
+
+// CRC-16/XMODEM (poly 0x1021, MSB first, init 0)
+static u2_t crc16_table[256];
+
+static u2_t crc16 (const u1_t* pdu, int len) {
+    if( crc16_table[1] == 0 ) {
+        for( int b=0; b<256; b++ ) {
+            u2_t remainder = b << 8;
+            for( int bit=0; bit < 8; bit++ )
+                remainder = (remainder & 0x8000) ? (remainder << 1) ^ 0x1021 : remainder << 1;
+            crc16_table[b] = remainder;
         }
     }
-    return remainder & 0xFFFF;
+    u2_t crc = 0;
+    for( int i=0; i<len; i++ )
+        crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ pdu[i]];
+    return crc;
 }
 
+// 24 bit signed coordinate scaled to +/-range
+static s4_t bcn_coord (double v, double range) {
+    return (s4_t)max(-(1<<23), min((1<<23)-1, (s4_t)(v / range * (1<<23))));
+}
 
+int s2e_checkBeaconLayout (const u1_t* layout) {
+    return (layout[0] + 4 <= layout[1] - 2 &&
+            layout[1] + 7 <= layout[2] - 2 &&
+            layout[2] <= BCN_MAXLEN);
+}
 
-// Pack parameters into a BEACON pdu with the following layout:
+// Beacon frame with the following layout:
 //    | 0-n |       4    |  2  |     1    |  3  |  3  | 0-n |  2  |   bytes - all fields little endian
 //    | RFU | epoch_secs | CRC | infoDesc | lat | lon | RFU | CRC |
 //
-void s2e_make_beacon (uint8_t* layout, sL_t epoch_secs, int infodesc, double lat, double lon, uint8_t* pdu) {
-    int time_off     = layout[0];
+// Build all fields except time and its CRC - they only change with layout or position.
+void s2e_prep_beacon (const u1_t* layout, int infodesc, double lat, double lon, u1_t* tmpl) {
     int infodesc_off = layout[1];
     int bcn_len      = layout[2];
-    memset(pdu, 0, bcn_len);
-    for( int i=0; i<4; i++ ) 
-        pdu[time_off+i] = epoch_secs>>(8*i);
-    uint32_t ulon = (uint32_t)(lon / 180 * (1U<<31));
-    uint32_t ulat = (uint32_t)(lat /  90 * (1U<<31));
+    memset(tmpl, 0, bcn_len);
+    s4_t slat = bcn_coord(lat,  90);
+    s4_t slon = bcn_coord(lon, 180);
     for( int i=0; i<3; i++ ) {
-        pdu[infodesc_off+1+i] = ulon>>(8*i);
-        pdu[infodesc_off+4+i] = ulat>>(8*i);
-    } 
-    pdu[infodesc_off] = infodesc;
-    int crc1 = crc16_no_table(&pdu[0],infodesc_off-2);
-    int crc2 = crc16_no_table(&pdu[infodesc_off], bcn_len-2-infodesc_off);
-    for( int i=0; i<2; i++ ) {
-        pdu[infodesc_off-2] = crc1>>(8*i);
-        pdu[bcn_len-2]      = crc2>>(8*i);
+        tmpl[infodesc_off+1+i] = slat>>(8*i);
+        tmpl[infodesc_off+4+i] = slon>>(8*i);
     }
+    tmpl[infodesc_off] = infodesc;
+    u2_t crc2 = crc16(&tmpl[infodesc_off], bcn_len-2-infodesc_off);
+    tmpl[bcn_len-2] = crc2;
+    tmpl[bcn_len-1] = crc2>>8;
+}
+
+// Copy beacon template and fill in time field and its CRC.
+void s2e_stamp_beacon (const u1_t* layout, const u1_t* tmpl, sL_t epoch_secs, u1_t* pdu) {
+    int time_off     = layout[0];
+    int infodesc_off = layout[1];
+    memcpy(pdu, tmpl, layout[2]);
+    for( int i=0; i<4; i++ )
+        pdu[time_off+i] = epoch_secs>>(8*i);
+    u2_t crc1 = crc16(&pdu[0], infodesc_off-2);
+    pdu[infodesc_off-2] = crc1;
+    pdu[infodesc_off-1] = crc1>>8;
+}
+
+// GPS time of the first ping slot at or after gpstime for a device with given ping period/offset.
+// Returns 0 if there is none left in the current beacon period - the next one uses another offset.
+sL_t s2e_nextPingSlot (sL_t gpstime, int period, int offset) {
+    sL_t t0 = gpstime - gpstime % BEACON_INTVL + PING_BCN_RESERVED;
+    sL_t slot = gpstime <= t0 ? 0 : (gpstime - t0 + PING_SLOT_LEN-1) / PING_SLOT_LEN;
+    slot = slot <= offset ? offset : offset + (slot - offset + period-1) / period * period;
+    if( slot >= PING_SLOTS )
+        return 0;
+    return t0 + slot * PING_SLOT_LEN;
+}
+
+
+void s2e_make_beacon (uint8_t* layout, sL_t epoch_secs, int infodesc, double lat, double lon, uint8_t* pdu) {
+    s2e_prep_beacon(layout, infodesc, lat, lon, pdu);
+    s2e_stamp_beacon(layout, pdu, epoch_secs, pdu);
 }
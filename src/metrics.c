@@ -0,0 +1,249 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#if defined(CFG_linux)
+#define _GNU_SOURCE  // dl_iterate_phdr
+#include <link.h>
+#endif // defined(CFG_linux)
+#include <stdio.h>
+#include <stdint.h>
+#include "s2conf.h"
+#include "uj.h"
+#include "metrics.h"
+#include "trace.h"
+
+#define PROM_PREFIX METRICS_PROM_PREFIX
+
+uL_t      metrics_ctr[MC_MAX];
+sL_t      metrics_gauge[MG_MAX];
+mhisto_t  metrics_histo[MH_MAX];
+
+static const struct {
+    str_t id;
+    str_t family;
+    str_t label;
+    str_t help;
+} CTR_DEFS[] = {
+#define COUNTER(id,family,label,help) { #id, family, label, help },
+    METRICS_COUNTERS
+#undef COUNTER
+};
+
+static const struct {
+    str_t id;
+    str_t family;
+    str_t help;
+} GAUGE_DEFS[] = {
+#define GAUGE(id,family,help) { #id, family, help },
+    METRICS_GAUGES
+#undef GAUGE
+}, HISTO_DEFS[] = {
+#define HISTO(id,family,help) { #id, family, help },
+    METRICS_HISTOS
+#undef HISTO
+};
+
+
+typedef struct profsite {
+    void*    fn;         // callback - NULL if slot is free
+    u1_t     kind;       // PROF_xxx
+    u4_t     count;
+    ustime_t sum;
+    ustime_t max;
+    u4_t     bucket[METRIC_HISTO_BUCKETS+1];
+} profsite_t;
+
+static const char* const PROF_KINDS[] = { "timer", "aio_rd", "aio_wr" };
+
+// Open addressing by code address - last entry collects sites not fitting into the table
+static profsite_t profSites[PROF_MAX_SITES+1];
+
+
+void metrics_reset () {
+    memset(metrics_ctr,   0, sizeof(metrics_ctr));
+    memset(metrics_gauge, 0, sizeof(metrics_gauge));
+    memset(metrics_histo, 0, sizeof(metrics_histo));
+    memset(profSites,     0, sizeof(profSites));
+}
+
+
+#if defined(CFG_linux)
+static int exeBaseCb (struct dl_phdr_info* info, size_t size, void* data) {
+    *(uintptr_t*)data = info->dlpi_addr;
+    return 1;   // first entry is the main program
+}
+#endif // defined(CFG_linux)
+
+static void profName (char* buf, int bufsize, void* fn) {
+    if( fn == NULL ) {
+        snprintf(buf, bufsize, "other");
+        return;
+    }
+#if defined(CFG_linux)
+    // Offset into binary - also stable for position independent executables
+    static uintptr_t exeBase = UINTPTR_MAX;
+    if( exeBase == UINTPTR_MAX )
+        dl_iterate_phdr(exeBaseCb, &exeBase);
+    snprintf(buf, bufsize, "exe+0x%lx", (unsigned long)((uintptr_t)fn - exeBase));
+#else // !defined(CFG_linux)
+    snprintf(buf, bufsize, "%p", fn);
+#endif // !defined(CFG_linux)
+}
+
+static profsite_t* profSite (void* fn, int kind) {
+    u4_t h = (u4_t)((uintptr_t)fn * 2654435761u) % PROF_MAX_SITES;
+    for( int i=0; i<PROF_MAX_SITES; i++, h=(h+1)%PROF_MAX_SITES ) {
+        profsite_t* s = &profSites[h];
+        if( s->fn == fn && s->kind == kind )
+            return s;
+        if( s->fn == NULL ) {
+            s->fn = fn;
+            s->kind = kind;
+            return s;
+        }
+    }
+    return &profSites[PROF_MAX_SITES];
+}
+
+ustime_t metrics_profCb (void* fn, int kind, ustime_t beg) {
+    ustime_t now = rt_getTime();
+    ustime_t dur = now - beg;
+    profsite_t* s = profSite(fn, kind);
+    s->count += 1;
+    s->sum += dur;
+    if( dur > s->max )
+        s->max = dur;
+    s->bucket[metric_bucket(dur)] += 1;
+    if( PROF_STALL > 0 && dur > PROF_STALL ) {
+        char name[32];
+        profName(name, sizeof(name), s->fn);
+        metric_inc(MC_cb_overrun);
+        trace_rec(now, TRACE_STALL, kind, 0, trace_clamp(dur), (u4_t)(uintptr_t)fn);
+        LOG(MOD_SYS|WARNING, "Stall: %s callback %s ran for %~T", PROF_KINDS[kind], name, dur);
+    }
+    return now;
+}
+
+// Upper bound of log2 bucket holding the q-quantile - clamped to max
+static ustime_t profQuantile (const profsite_t* s, double q) {
+    u4_t cum = 0, rank = (u4_t)(q * s->count + 0.999999);
+    for( int k=0; k<METRIC_HISTO_BUCKETS; k++ ) {
+        cum += s->bucket[k];
+        if( cum >= rank ) {
+            ustime_t ub = (ustime_t)1<<(k+METRIC_HISTO_MINEXP);
+            return ub < s->max ? ub : s->max;
+        }
+    }
+    return s->max;
+}
+
+// Export the sites with the longest callback runs
+static void profProm (dbuf_t* b) {
+    u1_t done[PROF_MAX_SITES+1] = {0};
+    xprintf(b, "# HELP " PROM_PREFIX "callback_seconds Run time of timer/aio callbacks with the longest runs "
+            "(quantiles from log2 buckets, 1=max)\n# TYPE " PROM_PREFIX "callback_seconds summary\n");
+    for( int n=0; n<PROF_EXPORT_SITES; n++ ) {
+        int top = -1;
+        for( int i=0; i<=PROF_MAX_SITES; i++ ) {
+            if( !done[i] && profSites[i].count && (top < 0 || profSites[i].max > profSites[top].max) )
+                top = i;
+        }
+        if( top < 0 )
+            break;
+        done[top] = 1;
+        const profsite_t* s = &profSites[top];
+        char name[32];
+        profName(name, sizeof(name), s->fn);
+        static const double QS[] = { 0.5, 0.99, 1.0 };
+        for( int k=0; k<SIZE_ARRAY(QS); k++ ) {
+            xprintf(b, PROM_PREFIX "callback_seconds{site=\"%s\",kind=\"%s\",quantile=\"%g\"} %.6f\n",
+                    name, PROF_KINDS[s->kind], QS[k], profQuantile(s, QS[k])/1e6);
+        }
+        xprintf(b, PROM_PREFIX "callback_seconds_sum{site=\"%s\",kind=\"%s\"} %.6f\n", name, PROF_KINDS[s->kind], s->sum/1e6);
+        xprintf(b, PROM_PREFIX "callback_seconds_count{site=\"%s\",kind=\"%s\"} %u\n", name, PROF_KINDS[s->kind], s->count);
+    }
+}
+
+
+static void promHeader (dbuf_t* b, str_t family, str_t help, str_t type) {
+    xprintf(b, "# HELP " PROM_PREFIX "%s %s\n# TYPE " PROM_PREFIX "%s %s\n", family, help, family, type);
+}
+
+int metrics_prom (dbuf_t* b) {
+    for( int i=0; i<MC_MAX; i++ ) {
+        if( i==0 || strcmp(CTR_DEFS[i].family, CTR_DEFS[i-1].family) != 0 )
+            promHeader(b, CTR_DEFS[i].family, CTR_DEFS[i].help, "counter");
+        if( CTR_DEFS[i].label[0] ) {
+            xprintf(b, PROM_PREFIX "%s{%s} %lu\n", CTR_DEFS[i].family, CTR_DEFS[i].label, metrics_ctr[i]);
+        } else {
+            xprintf(b, PROM_PREFIX "%s %lu\n", CTR_DEFS[i].family, metrics_ctr[i]);
+        }
+    }
+    for( int i=0; i<MG_MAX; i++ ) {
+        promHeader(b, GAUGE_DEFS[i].family, GAUGE_DEFS[i].help, "gauge");
+        xprintf(b, PROM_PREFIX "%s %ld\n", GAUGE_DEFS[i].family, metrics_gauge[i]);
+    }
+    for( int i=0; i<MH_MAX; i++ ) {
+        const mhisto_t* h = &metrics_histo[i];
+        str_t family = HISTO_DEFS[i].family;
+        promHeader(b, family, HISTO_DEFS[i].help, "histogram");
+        uL_t cum = 0;
+        for( int k=0; k<METRIC_HISTO_BUCKETS; k++ ) {
+            cum += h->bucket[k];
+            xprintf(b, PROM_PREFIX "%s_bucket{le=\"%.6f\"} %lu\n",
+                    family, (1<<(k+METRIC_HISTO_MINEXP))/1e6, cum);
+        }
+        xprintf(b, PROM_PREFIX "%s_bucket{le=\"+Inf\"} %lu\n", family, h->count);
+        xprintf(b, PROM_PREFIX "%s_sum %.6f\n", family, h->sum/1e6);
+        xprintf(b, PROM_PREFIX "%s_count %lu\n", family, h->count);
+    }
+    profProm(b);
+    return xeos(b);
+}
+
+
+void metrics_json (dbuf_t* b) {
+    for( int i=0; i<MC_MAX; i++ )
+        uj_encKV(b, CTR_DEFS[i].id, 'I', (sL_t)metrics_ctr[i]);
+    for( int i=0; i<MG_MAX; i++ )
+        uj_encKV(b, GAUGE_DEFS[i].id, 'I', metrics_gauge[i]);
+    for( int i=0; i<MH_MAX; i++ ) {
+        const mhisto_t* h = &metrics_histo[i];
+        uj_encKey(b, HISTO_DEFS[i].id);
+        uj_encOpen(b, '{');
+        uj_encKV(b, "count", 'I', (sL_t)h->count);
+        uj_encKV(b, "sum",   'T', h->sum/1e6);
+        uj_encKey(b, "buckets");
+        uj_encOpen(b, '[');
+        for( int k=0; k<=METRIC_HISTO_BUCKETS; k++ )
+            uj_encUint(b, h->bucket[k]);
+        uj_encClose(b, ']');
+        uj_encClose(b, '}');
+    }
+}
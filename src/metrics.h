@@ -0,0 +1,171 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _metrics_h_
+#define _metrics_h_
+
+#include "rt.h"
+
+// Hot path metrics - plain memory updates, no locking, main thread only.
+// All entries of one Prometheus family must be adjacent and differ only by label.
+//
+//      id                family                  label                   help
+#define METRICS_COUNTERS \
+    COUNTER(rx_frames,        "rx_frames_total",      "",                     "Frames received from the radio") \
+    COUNTER(rx_drop_crc,      "rx_dropped_total",     "reason=\"crc\"",       "Received frames not forwarded to the LNS") \
+    COUNTER(rx_drop_nospace,  "rx_dropped_total",     "reason=\"nospace\"",   "") \
+    COUNTER(rx_drop_nosession,"rx_dropped_total",     "reason=\"nosession\"", "") \
+    COUNTER(rx_drop_mirror,   "rx_dropped_total",     "reason=\"mirror\"",    "") \
+    COUNTER(rx_drop_filter,   "rx_dropped_total",     "reason=\"filter\"",    "") \
+    COUNTER(rx_shed_dup,      "rx_dropped_total",     "reason=\"shed_dup\"",  "") \
+    COUNTER(rx_shed_filter,   "rx_dropped_total",     "reason=\"shed_filter\"", "") \
+    COUNTER(rx_shed_snr,      "rx_dropped_total",     "reason=\"shed_snr\"",  "") \
+    COUNTER(tx_admitted,      "tx_admitted_total",    "",                     "Downlink jobs entered into the TX queue") \
+    COUNTER(tx_emitted,       "tx_emitted_total",     "",                     "Downlink frames confirmed on air") \
+    COUNTER(tx_rej_dc,        "tx_rejected_total",    "reason=\"dc\"",        "Downlink jobs dropped without being sent") \
+    COUNTER(tx_rej_cca,       "tx_rejected_total",    "reason=\"cca\"",       "") \
+    COUNTER(tx_rej_toolate,   "tx_rejected_total",    "reason=\"toolate\"",   "") \
+    COUNTER(tx_rej_collision, "tx_rejected_total",    "reason=\"collision\"", "") \
+    COUNTER(tx_rej_other,     "tx_rejected_total",    "reason=\"other\"",     "") \
+    COUNTER(cb_overrun,       "callback_overruns_total", "",                  "Timer/aio callbacks running longer than PROF_STALL") \
+    COUNTER(ws_deflate_raw,   "ws_deflate_bytes_total", "stage=\"raw\"",       "Websocket payload bytes sent compressed - before and after permessage-deflate") \
+    COUNTER(ws_deflate_out,   "ws_deflate_bytes_total", "stage=\"compressed\"", "")
+
+#define METRICS_GAUGES \
+    GAUGE(rxq_depth,          "rxq_depth",                "Frames waiting in the RX queue") \
+    GAUGE(rx_load,            "rx_load_percent",          "Occupancy of RX queue or send buffer driving the RX_SHED_* policy") \
+    GAUGE(ws_queued,          "ws_send_queued_bytes",     "Bytes queued in the websocket send buffer")
+
+#define METRICS_HISTOS \
+    HISTO(tx_lead,            "tx_lead_seconds",          "Time from downlink arrival to its TX time") \
+    HISTO(tx_handoff,         "tx_handoff_lead_seconds",  "Time left until TX start when a frame was handed to the radio") \
+    HISTO(tx_submit,          "tx_submit_seconds",        "Time spent handing one frame to the radio") \
+    HISTO(timer_lag,          "timer_lag_seconds",        "Delay of timer callbacks past their deadline") \
+    HISTO(sched_lat,          "sched_latency_seconds",    "Wakeup delay of the main loop past its timer deadline") \
+    HISTO(loop_iter,          "aio_loop_seconds",         "Time spent dispatching one batch of I/O events") \
+    HISTO(ws_deflate,         "ws_deflate_seconds",       "Time spent compressing one websocket message") \
+    HISTO(ws_inflate,         "ws_inflate_seconds",       "Time spent decompressing one websocket message")
+
+enum {
+#define COUNTER(id,family,label,help) MC_##id,
+    METRICS_COUNTERS
+#undef COUNTER
+    MC_MAX
+};
+enum {
+#define GAUGE(id,family,help) MG_##id,
+    METRICS_GAUGES
+#undef GAUGE
+    MG_MAX
+};
+enum {
+#define HISTO(id,family,help) MH_##id,
+    METRICS_HISTOS
+#undef HISTO
+    MH_MAX
+};
+
+// Histogram buckets have upper bounds 2^k us for k=MINEXP..MINEXP+BUCKETS-1 (16us..8.4s)
+// plus overflow bucket (+Inf). Counts are per bucket - made cumulative on export.
+enum { METRIC_HISTO_MINEXP = 4, METRIC_HISTO_BUCKETS = 20 };
+
+typedef struct mhisto {
+    uL_t bucket[METRIC_HISTO_BUCKETS+1];
+    uL_t count;
+    sL_t sum;        // micros
+} mhisto_t;
+
+extern uL_t      metrics_ctr[MC_MAX];
+extern sL_t      metrics_gauge[MG_MAX];
+extern mhisto_t  metrics_histo[MH_MAX];
+
+static inline int metric_bucket (sL_t us) {
+    if( us <= (1<<METRIC_HISTO_MINEXP) )
+        return 0;
+    int b = 64 - __builtin_clzll(us-1) - METRIC_HISTO_MINEXP;   // ceil(log2(us)) - MINEXP
+    return b > METRIC_HISTO_BUCKETS ? METRIC_HISTO_BUCKETS : b;
+}
+
+static inline void metric_inc (int id) { metrics_ctr[id] += 1; }
+static inline void metric_add (int id, uL_t n) { metrics_ctr[id] += n; }
+static inline void metric_set (int id, sL_t v) { metrics_gauge[id] = v; }
+
+static inline void metric_obs (int id, sL_t us) {
+    mhisto_t* h = &metrics_histo[id];
+    h->bucket[metric_bucket(us)] += 1;
+    h->count += 1;
+    h->sum += us;
+}
+
+// Callback profiler - run time of each timer/aio callback accounted per callback function.
+// Sites are code addresses printed as exe+0xOFFSET - resolve with: addr2line -f -e station 0xOFFSET
+enum { PROF_TIMER, PROF_AIO_RD, PROF_AIO_WR };
+enum { PROF_MAX_SITES = 64, PROF_EXPORT_SITES = 8 };
+
+ustime_t metrics_profCb (void* fn, int kind, ustime_t beg);   // call after callback returned - returns now
+
+// Room needed by metrics_prom/metrics_json - worst case derived from the tables above:
+// integers take up to 20 chars, fixed point values 24, callback site names 31.
+#define METRICS_PROM_PREFIX "station_"
+enum { _MINT = 20, _MFIX = 24 };
+#define _MHDR(family,help,type) \
+    sizeof("# HELP " METRICS_PROM_PREFIX family " " help "\n# TYPE " METRICS_PROM_PREFIX family " " type "\n")
+#define _MPROF_LINE \
+    (sizeof(METRICS_PROM_PREFIX "callback_seconds_count{site=\"\",kind=\"\",quantile=\"\"} \n") + 31 + 6 + 4 + _MFIX)
+enum { METRICS_PROM_SIZE = 256 + PROF_EXPORT_SITES*5*_MPROF_LINE
+#define COUNTER(id,family,label,help) + _MHDR(family,help,"counter") + sizeof(METRICS_PROM_PREFIX family "{" label "} \n") + _MINT
+    METRICS_COUNTERS
+#undef COUNTER
+#define GAUGE(id,family,help) + _MHDR(family,help,"gauge") + sizeof(METRICS_PROM_PREFIX family " \n") + _MINT
+    METRICS_GAUGES
+#undef GAUGE
+#define HISTO(id,family,help) + _MHDR(family,help,"histogram") \
+    + (METRIC_HISTO_BUCKETS+1) * (sizeof(METRICS_PROM_PREFIX family "_bucket{le=\"\"} \n") + _MFIX + _MINT) \
+    + sizeof(METRICS_PROM_PREFIX family "_sum \n") + _MFIX + sizeof(METRICS_PROM_PREFIX family "_count \n") + _MINT
+    METRICS_HISTOS
+#undef HISTO
+};
+enum { METRICS_JSON_SIZE = 64
+#define COUNTER(id,family,label,help) + sizeof("\"" #id "\":,") + _MINT
+    METRICS_COUNTERS
+#undef COUNTER
+#define GAUGE(id,family,help) + sizeof("\"" #id "\":,") + _MINT
+    METRICS_GAUGES
+#undef GAUGE
+#define HISTO(id,family,help) + sizeof("\"" #id "\":{\"count\":,\"sum\":,\"buckets\":[]},") + _MINT + _MFIX \
+    + (METRIC_HISTO_BUCKETS+1) * (_MINT+1)
+    METRICS_HISTOS
+#undef HISTO
+};
+
+void metrics_reset ();
+int  metrics_prom  (dbuf_t* b);   // Prometheus text exposition format - 0 if b too small
+void metrics_json  (dbuf_t* b);   // fields of a JSON object - caller opens/closes it and checks xeos
+
+#endif // _metrics_h_
@@ -35,6 +35,8 @@
 #include "httpd.h"
 #include "tls.h"
 #include "kwcrc.h"
+#include "metrics.h"
+#include "trace.h"
 
 str_t const SUFFIX2CT[] = {
     "txt",  "text/plain",
@@ -47,6 +49,11 @@ str_t const SUFFIX2CT[] = {
     NULL, NULL
 };
 
+// Send buffer fill after frames were queued or drained - flight recorder only
+static inline void traceWsFill (ws_t* conn, u4_t queued) {
+    trace_rec(rt_getTime(), TRACE_WSFILL, conn->wcongested, 0, queued, conn->wbufmax);
+}
+
 
 // --------------------------------------------------------------------------------
 //
@@ -271,6 +278,20 @@ char* http_findHeader (char* p, const char* field) {
     } while(1);
 }
 
+// Check request header if client wants to keep connection open
+static int httpd_keepAlive (char* hdr) {
+    char* eol = strstr(hdr, "\r\n");
+    int keep = eol && eol-hdr >= 8 && strncasecmp(eol-8, "http/1.1", 8) == 0;  // 1.1 default is keep-alive
+    char* p = http_findHeader(hdr, "connection");
+    if( p ) {
+        if( http_icaseCmp(p, "close") )
+            keep = 0;
+        else if( http_icaseCmp(p, "keep-alive") )
+            keep = 1;
+    }
+    return keep;
+}
+
 int http_findContentLength (char* p) {
     return http_readDec(http_findHeader(p, "content-length"));
 }
@@ -313,14 +334,14 @@ enum {
     IO_RDDONE,
 };
 
-enum { WSHDR_INTRA  = 3 }; // frame header internal to wbuf (16bit LSB length of data)
-enum { WSHDR_RESV_W = 8 }; // reserve at start of wbuf
+enum { WSHDR_MAXLEN = 8 }; // space reserved in front of each frame in wbuf (header+mask)
 enum { WSHDR_RESV_R = 1 }; // reserve at start of rbuf
 enum { WSHDR_MASK   = 0x80,
        WSHDR_LEN2   = 0x7E,  // 16 bit length
        WSHDR_LEN4   = 0x7F,  // 64 bit length - not used in this code
 };
 enum { WSHDR_FIN    = 0x80,
+       WSHDR_RSV1   = 0x40,  // permessage-deflate: compressed message
        WSHDR_CONT   = 0x00,
        WSHDR_TEXT   = 0x01,
        WSHDR_BINARY = 0x02,
@@ -328,26 +349,511 @@ enum { WSHDR_FIN    = 0x80,
        WSHDR_PING   = 0x09,
        WSHDR_PONG   = 0x0A,
 };
+enum { WS_XBUFSIZE  = 2048 };  // express queue for WSCLASS_TIMESYNC/CONTROL frames
+enum { WS_BATCH_MAX = 4096 };  // wbuf batches end at the first frame boundary beyond this
+
+
+// End of next wbuf batch starting at pos - whole frames only. Bounding the batch
+// bounds the time express frames have to wait behind a large backlog.
+static u4_t ws_batchEnd (conn_t* conn, u4_t pos, u4_t end) {
+    u4_t p = pos;
+    while( p < end && p - pos < WS_BATCH_MAX ) {
+        u1_t* h = conn->wbuf + p;
+        u4_t n = h[1] & 0x7F;
+        p += n < WSHDR_LEN2 ? 6 + n : 8 + rt_rmsbf2(&h[2]);
+    }
+    return p;
+}
+
+
+// Set up the next batch for the socket - express frames go first. Only called
+// after the previous batch has been sent completely. Returns 0 if nothing is pending.
+static int ws_nextBatch (conn_t* conn) {
+    if( conn->xfill > conn->xend ) {
+        conn->xpos = conn->xend;
+        conn->xend = conn->xfill;
+        return 1;
+    }
+    conn->xpos = conn->xend = conn->xfill = 0;
+    if( conn->wwrap && conn->wpos >= conn->wwrap ) {
+        // Tail of wbuf sent - continue with frames at the start
+        conn->wpos = conn->wend = 0;
+        conn->wwrap = 0;
+    }
+    u4_t wend = conn->wwrap ? conn->wwrap : conn->wfill;
+    if( conn->wpos == wend )
+        return 0;
+    conn->wend = ws_batchEnd(conn, conn->wpos, wend);
+    return 1;
+}
+
+
+#if defined(CFG_linux)
+// --------------------------------------------------------------------------------
+//
+// Optional WS writer thread
+//
+// The writer thread takes over the TLS encryption and socket writes of a
+// connected WS. Framing, buffer management and all events stay on the main
+// thread. Ownership of wbuf[wpos..wend] (or xbuf[xpos..xend]) is handed over per batch:
+//   main:   sets wend (xend), busy=1, signals reqfd
+//   writer: sends wpos..wend (xpos..xend) advancing wpos (xpos), stores err, busy=0, signals donefd
+// While busy main only appends behind wend/xfill and never moves wbuf.
+// The TLS context is shared with the main thread's reads - tlsmx serializes both.
+// The writer thread must not log (log buffers are not thread safe).
+//
+// --------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+enum { WTHR_CHUNK = 4096 };   // max bytes encrypted while holding tlsmx
+
+typedef struct wsthr {
+    pthread_t       thr;
+    pthread_mutex_t tlsmx;
+    int             reqfd;    // main -> writer: batch ready / quit
+    int             donefd;   // writer -> main: batch done or failed
+    aio_t*          doneaio;  // main thread's handle for donefd
+    int             busy;     // writer owns wpos..wend
+    int             quit;
+    int             err;      // mbedtls error which stopped last batch
+    u1_t            sent;     // main: batch handed out - report DATASENT when done
+} wsthr_t;
+
+
+static int wthr_isBusy (ws_t* conn) {
+    return conn->wthr && __atomic_load_n(&conn->wthr->busy, __ATOMIC_ACQUIRE);
+}
+
+
+static void* wthr_main (void* ctx) {
+    ws_t* conn = ctx;
+    wsthr_t* w = conn->wthr;
+    eventfd_t v;
+    sys_normalThread();
+    while( !__atomic_load_n(&w->quit, __ATOMIC_ACQUIRE) ) {
+        if( eventfd_read(w->reqfd, &v) == -1 ) {
+            if( errno == EINTR )
+                continue;
+            break;
+        }
+        int err = 0;
+        while( !err && !__atomic_load_n(&w->quit, __ATOMIC_ACQUIRE) ) {
+            u1_t* base = conn->wbuf;
+            u4_t* ppos = &conn->wpos;
+            u4_t  wend = conn->wend;
+            if( conn->xpos < conn->xend ) {
+                base = conn->xbuf;
+                ppos = &conn->xpos;
+                wend = conn->xend;
+            }
+            u4_t wpos = __atomic_load_n(ppos, __ATOMIC_ACQUIRE);
+            if( wpos >= wend )
+                break;
+            pthread_mutex_lock(&w->tlsmx);
+            int ret = tls_write(&conn->netctx, conn->tlsctx, base + wpos, min(wend - wpos, WTHR_CHUNK));
+            pthread_mutex_unlock(&w->tlsmx);
+            if( ret > 0 ) {
+                __atomic_store_n(ppos, wpos + ret, __ATOMIC_RELEASE);
+                continue;
+            }
+            if( ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE ) {
+                err = ret ? ret : MBEDTLS_ERR_NET_SEND_FAILED;
+                break;
+            }
+            // Socket full (or TLS waits for main thread to read) - wait without holding tlsmx.
+            // Repeat with the same length as required by mbedtls.
+            struct pollfd pfd[2] = {
+                { .fd = conn->netctx.fd, .events = ret == MBEDTLS_ERR_SSL_WANT_WRITE ? POLLOUT : 0 },
+                { .fd = w->reqfd,        .events = POLLIN },
+            };
+            poll(pfd, 2, ret == MBEDTLS_ERR_SSL_WANT_WRITE ? 1000 : 10);
+        }
+        w->err = err;
+        __atomic_store_n(&w->busy, 0, __ATOMIC_RELEASE);
+        eventfd_write(w->donefd, 1);
+    }
+    return NULL;
+}
+
+
+static void wthr_stop (ws_t* conn) {
+    wsthr_t* w = conn->wthr;
+    if( w == NULL )
+        return;
+    __atomic_store_n(&w->quit, 1, __ATOMIC_RELEASE);
+    eventfd_write(w->reqfd, 1);
+    pthread_join(w->thr, NULL);
+    if( w->err )
+        log_mbedError(MOD_AIO|ERROR, w->err, "[%d] Send failed", conn->netctx.fd);
+    close(w->reqfd);
+    aio_close(w->doneaio);
+    pthread_mutex_destroy(&w->tlsmx);
+    rt_free(w);
+    conn->wthr = NULL;
+}
+
+
+static void ws_closing_w (aio_t* aio);
+
+// Hand next batch of frames to writer thread. Also processes the
+// completion of the previous batch.
+static void wthr_next (ws_t* conn) {
+    wsthr_t* w = conn->wthr;
+    if( wthr_isBusy(conn) )
+        return;   // wthr_done follows
+    if( w->err ) {
+        // Reported by wthr_stop
+        ws_shutdown(conn);
+        return;
+    }
+    if( conn->state != WS_CONNECTED ) {
+        // WS close protocol pending - drain remaining data on main thread
+        wthr_stop(conn);
+        aio_set_wrfn(conn->aio, ws_closing_w);
+        return;
+    }
+    if( w->sent ) {
+        w->sent = 0;
+        metric_set(MG_ws_queued, ws_sendQueued(conn));
+        if( conn->wcongested && ws_sendQueued(conn) <= conn->wbufmax/4 ) {
+            conn->wcongested = 0;
+            conn->evcb(conn, WSEV_SENDLOW);
+        }
+        traceWsFill(conn, ws_sendQueued(conn));
+        conn->evcb(conn, WSEV_DATASENT);
+        if( conn->wthr == NULL || conn->state != WS_CONNECTED )
+            return;
+    }
+    if( !ws_nextBatch(conn) )
+        return;
+    w->sent = 1;
+    __atomic_store_n(&w->busy, 1, __ATOMIC_RELEASE);
+    eventfd_write(w->reqfd, 1);
+}
+
+
+static void wthr_done (aio_t* aio) {
+    ws_t* conn = (ws_t*)aio->ctx;
+    eventfd_t v;
+    if( eventfd_read(aio->fd, &v) == -1 && errno == EAGAIN )
+        return;
+    if( conn->wthr )
+        wthr_next(conn);
+}
+
+
+static void wthr_start (ws_t* conn) {
+    wsthr_t* w = rt_malloc(wsthr_t);
+    int reqfd = eventfd(0, EFD_CLOEXEC);
+    int donefd = eventfd(0, EFD_CLOEXEC|EFD_NONBLOCK);
+    if( reqfd == -1 || donefd == -1 ) {
+        LOG(MOD_AIO|ERROR, "[%d] Writer thread eventfd failed: %s - sending on main thread", conn->netctx.fd, strerror(errno));
+        goto fail;
+    }
+    pthread_mutex_init(&w->tlsmx, NULL);
+    w->reqfd = reqfd;
+    w->donefd = donefd;
+    w->doneaio = aio_open(conn, donefd, wthr_done, NULL);
+    conn->wthr = w;
+    int err;
+    if( (err = pthread_create(&w->thr, NULL, wthr_main, conn)) != 0 ) {
+        LOG(MOD_AIO|ERROR, "[%d] Writer thread start failed: %s - sending on main thread", conn->netctx.fd, strerror(err));
+        aio_close(w->doneaio);
+        pthread_mutex_destroy(&w->tlsmx);
+        conn->wthr = NULL;
+        donefd = -1;
+        goto fail;
+    }
+    LOG(MOD_AIO|INFO, "[%d] WS writer thread started", conn->netctx.fd);
+    return;
+ fail:
+    if( reqfd != -1 ) close(reqfd);
+    if( donefd != -1 ) close(donefd);
+    rt_free(w);
+}
+
+
+static int conn_tlsRead (conn_t* conn, u1_t* p, size_t sz) {
+    wsthr_t* w = conn->wthr;
+    if( w == NULL )
+        return tls_read(&conn->netctx, conn->tlsctx, p, sz);
+    pthread_mutex_lock(&w->tlsmx);
+    int r = tls_read(&conn->netctx, conn->tlsctx, p, sz);
+    pthread_mutex_unlock(&w->tlsmx);
+    return r;
+}
+
+#else // !defined(CFG_linux)
+
+static int  wthr_isBusy (ws_t* conn) { return 0; }
+static void wthr_stop  (ws_t* conn) {}
+static void wthr_start (ws_t* conn) { LOG(MOD_AIO|WARNING, "WS writer thread not supported on this platform"); }
+static void wthr_next  (ws_t* conn) {}
+
+static int conn_tlsRead (conn_t* conn, u1_t* p, size_t sz) {
+    return tls_read(&conn->netctx, conn->tlsctx, p, sz);
+}
 
+#endif // !defined(CFG_linux)
 
-// Write data between wpos..wend
+
+#if defined(CFG_wsdeflate)
+// --------------------------------------------------------------------------------
+//
+// permessage-deflate (RFC 7692)
+//
+// Offered if ws_setDeflate was called with window bits 9..15. The same bound is
+// requested for both directions so the zlib contexts kept across messages (context
+// takeover) stay small: deflate needs 2^(bits+2) bytes plus a hash table, inflate
+// 2^bits plus ~7KB. Only data frames in wbuf are compressed - express frames jump
+// ahead of queued frames and therefore go out uncompressed which leaves the shared
+// window alone. A message which does not get smaller is sent as is and the deflate
+// context is reset since the peer never sees that data.
+//
+// --------------------------------------------------------------------------------
+
+#include <zlib.h>
+
+#if defined(CFG_selftests)
+#define WSZ_FN          // selftest_ws.c drives the codec directly
+#else
+#define WSZ_FN static
+#endif
+
+enum { WSZ_MIN_BITS = 9 };   // zlib cannot produce raw deflate streams with 8 bit windows
+enum { WSZ_MIN_LEN  = 64 };  // shorter messages are not worth compressing
+
+typedef struct wsz {
+    z_stream tx;
+    z_stream rx;
+    u1_t     txReset;   // client_no_context_takeover - fresh deflate context per message
+    u1_t     rxReset;   // server_no_context_takeover - fresh inflate context per message
+    u1_t*    txbuf;     // compressed output before it replaces the frame payload
+    u4_t     txbufsize;
+    u1_t*    rxbuf;     // inflated message
+    u4_t     rxbufsize;
+    u4_t     rxlen;     // length of inflated message (0=current frame was not compressed)
+    u4_t     txmsgs, txraw, txout, txrawsent;  // stats: compressed messages, bytes in/out, sent uncompressed
+    u4_t     rxmsgs, rxin, rxout;
+} wsz_t;
+
+static const u1_t WSZ_TAIL[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+
+WSZ_FN void wsz_free (ws_t* conn) {
+    wsz_t* z = conn->wsz;
+    if( z == NULL )
+        return;
+    if( z->txmsgs || z->rxmsgs )
+        LOG(MOD_AIO|INFO, "[%d] WS deflate: sent %u messages %u -> %u bytes (%u sent uncompressed), recv %u messages %u -> %u bytes",
+            conn->netctx.fd, z->txmsgs, z->txraw, z->txout, z->txrawsent, z->rxmsgs, z->rxin, z->rxout);
+    deflateEnd(&z->tx);
+    inflateEnd(&z->rx);
+    rt_free(z->txbuf);
+    rt_free(z->rxbuf);
+    rt_free(z);
+    conn->wsz = NULL;
+}
+
+
+static void wsz_offer (ws_t* conn, char* buf, int bufsize) {
+    buf[0] = 0;
+    if( conn->zbits )
+        snprintf(buf, bufsize,
+                 "Sec-WebSocket-Extensions: permessage-deflate; client_max_window_bits=%d; server_max_window_bits=%d\r\n",
+                 conn->zbits, conn->zbits);
+}
+
+
+// Parse server's extension response - returns 0 if connection must be failed.
+WSZ_FN int wsz_accept (ws_t* conn) {
+    char* p = http_findHeader((char*)conn->rbuf, "sec-websocket-extensions");
+    if( p == NULL || conn->zbits == 0 )
+        return p == NULL;  // no extension or an extension we never offered
+    int n = http_icaseCmp(p, "permessage-deflate");
+    if( !n )
+        goto bad;
+    // Both windows were offered as zbits - missing parameters mean the offered value
+    int cbits = conn->zbits, sbits = conn->zbits, creset = 0, sreset = 0;
+    p = http_skipWsp(p+n);
+    while( *p == ';' ) {
+        p = http_skipWsp(p+1);
+        if( (n = http_icaseCmp(p, "client_no_context_takeover")) ) {
+            creset = 1;
+        } else if( (n = http_icaseCmp(p, "server_no_context_takeover")) ) {
+            sreset = 1;
+        } else if( (n = http_icaseCmp(p, "client_max_window_bits=")) ) {
+            cbits = http_readDec(p+n);
+            while( p[n] >= '0' && p[n] <= '9' ) n++;
+        } else if( (n = http_icaseCmp(p, "server_max_window_bits=")) ) {
+            sbits = http_readDec(p+n);
+            while( p[n] >= '0' && p[n] <= '9' ) n++;
+        } else {
+            goto bad;
+        }
+        p = http_skipWsp(p+n);
+    }
+    if( *p != '\r' || cbits < WSZ_MIN_BITS || cbits > conn->zbits || sbits < 8 || sbits > conn->zbits )
+        goto bad;
+    wsz_t* z = rt_malloc(wsz_t);
+    // memLevel follows the window - 2^(memLevel+9) bytes of hash table
+    if( deflateInit2(&z->tx, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -cbits, max(1, cbits-7), Z_DEFAULT_STRATEGY) != Z_OK ) {
+        rt_free(z);
+        goto bad;
+    }
+    // Inflating with a larger window than the server's is safe - zlib has no 8 bit raw windows
+    if( inflateInit2(&z->rx, -max(sbits, WSZ_MIN_BITS)) != Z_OK ) {
+        deflateEnd(&z->tx);
+        rt_free(z);
+        goto bad;
+    }
+    z->txReset = creset;
+    z->rxReset = sreset;
+    conn->wsz = z;
+    LOG(MOD_AIO|INFO, "[%d] WS permessage-deflate: client window %d bits%s, server window %d bits%s", conn->netctx.fd,
+        cbits, creset ? " (no context takeover)" : "", sbits, sreset ? " (no context takeover)" : "");
+    return 1;
+ bad: {
+        char* e = strchr(p, '\r');
+        LOG(MOD_AIO|ERROR, "[%d] Unacceptable WS extension response: %.*s", conn->netctx.fd, e ? (int)(e-p) : 0, p);
+        return 0;
+    }
+}
+
+
+// Replace payload data[0..*pn) with its compressed form - returns 0 if sent as is.
+WSZ_FN int wsz_deflate (ws_t* conn, u1_t* data, int* pn) {
+    wsz_t* z = conn->wsz;
+    int n = *pn;
+    if( n < WSZ_MIN_LEN )
+        return 0;
+    ustime_t t0 = rt_getTime();
+    if( z->txbufsize < n ) {
+        rt_free(z->txbuf);
+        z->txbufsize = max(n, 1024);
+        z->txbuf = rt_mallocN(u1_t, z->txbufsize);
+    }
+    z->tx.next_in = data;
+    z->tx.avail_in = n;
+    z->tx.next_out = z->txbuf;
+    z->tx.avail_out = n;
+    int err = deflate(&z->tx, Z_SYNC_FLUSH);
+    int zlen = n - z->tx.avail_out - sizeof(WSZ_TAIL);
+    // Complete output ends in the empty stored block 00 00 FF FF - not sent (RFC 7692 7.2.1)
+    int ok = err == Z_OK && z->tx.avail_in == 0 && z->tx.avail_out > 0 && zlen > 0
+        && memcmp(z->txbuf + zlen, WSZ_TAIL, sizeof(WSZ_TAIL)) == 0;
+    if( ok ) {
+        memcpy(data, z->txbuf, zlen);
+        *pn = zlen;
+        z->txmsgs += 1;
+        z->txraw += n;
+        z->txout += zlen;
+        metric_add(MC_ws_deflate_raw, n);
+        metric_add(MC_ws_deflate_out, zlen);
+    } else {
+        z->txrawsent += 1;
+    }
+    if( !ok || z->txReset )
+        deflateReset(&z->tx);
+    metric_obs(MH_ws_deflate, rt_getTime() - t0);
+    return ok;
+}
+
+
+// Inflate a received compressed message into rxbuf - returns 0 on failure.
+WSZ_FN int wsz_inflate (ws_t* conn, u1_t* data, int n) {
+    wsz_t* z = conn->wsz;
+    ustime_t t0 = rt_getTime();
+    if( z->rxbuf == NULL ) {
+        z->rxbufsize = conn->rbufsize;
+        z->rxbuf = rt_mallocN(u1_t, z->rxbufsize);
+    }
+    z->rx.next_in = data;
+    z->rx.avail_in = n;
+    z->rx.next_out = z->rxbuf;
+    z->rx.avail_out = z->rxbufsize;
+    int tail = 0, err;
+    do {
+        if( z->rx.avail_out == 0 ) {
+            // Output buffer full - grow like rbuf does
+            u4_t size = min(2*z->rxbufsize, max(conn->rbufmax, conn->rbufsize));
+            if( size <= z->rxbufsize ) {
+                LOG(MOD_AIO|ERROR, "[%d] Inflated WS message exceeds %u bytes", conn->netctx.fd, z->rxbufsize);
+                return 0;
+            }
+            u1_t* rxbuf = rt_mallocN(u1_t, size);
+            memcpy(rxbuf, z->rxbuf, z->rxbufsize);
+            rt_free(z->rxbuf);
+            z->rx.next_out = rxbuf + z->rxbufsize;
+            z->rx.avail_out = size - z->rxbufsize;
+            z->rxbuf = rxbuf;
+            z->rxbufsize = size;
+        }
+        err = inflate(&z->rx, Z_SYNC_FLUSH);
+        if( err == Z_STREAM_END )
+            break;  // peer ended the stream with a final block - context starts over
+        if( err != Z_OK && err != Z_BUF_ERROR ) {
+            LOG(MOD_AIO|ERROR, "[%d] Inflating WS message failed: %s", conn->netctx.fd, z->rx.msg ? z->rx.msg : "?");
+            return 0;
+        }
+        if( z->rx.avail_in == 0 && !tail ) {
+            z->rx.next_in = (u1_t*)WSZ_TAIL;
+            z->rx.avail_in = sizeof(WSZ_TAIL);
+            tail = 1;
+        }
+    } while( z->rx.avail_in > 0 || z->rx.avail_out == 0 );
+    z->rxlen = z->rxbufsize - z->rx.avail_out;
+    z->rxmsgs += 1;
+    z->rxin += n;
+    z->rxout += z->rxlen;
+    if( z->rxReset || err == Z_STREAM_END )
+        inflateReset(&z->rx);
+    metric_obs(MH_ws_inflate, rt_getTime() - t0);
+    return 1;
+}
+
+#else // !defined(CFG_wsdeflate)
+
+static void wsz_free    (ws_t* conn) {}
+static void wsz_offer   (ws_t* conn, char* buf, int bufsize) { buf[0] = 0; }
+static int  wsz_accept  (ws_t* conn) { return http_findHeader((char*)conn->rbuf, "sec-websocket-extensions") == NULL; }
+static int  wsz_deflate (ws_t* conn, u1_t* data, int* pn) { return 0; }
+static int  wsz_inflate (ws_t* conn, u1_t* data, int n) { return 0; }
+
+#endif // !defined(CFG_wsdeflate)
+
+
+// Write data between wpos..wend - or xpos..xend if an express batch is in progress
 static int writeData (conn_t* conn) {
     int ret;
-    while( conn->wpos < conn->wend ) {
-        if( (ret = tls_write(&conn->netctx, conn->tlsctx, conn->wbuf + conn->wpos, conn->wend - conn->wpos) ) <= 0 ) {
+    u1_t* base = conn->wbuf;
+    u4_t* ppos = &conn->wpos;
+    u4_t  end  = conn->wend;
+    if( conn->xpos < conn->xend ) {
+        base = conn->xbuf;
+        ppos = &conn->xpos;
+        end  = conn->xend;
+    }
+    while( *ppos < end ) {
+        if( (ret = tls_write(&conn->netctx, conn->tlsctx, base + *ppos, end - *ppos) ) <= 0 ) {
             if( ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE ) {
                 log_mbedError(MOD_AIO|ERROR, ret, "[%d] Send failed", conn->netctx.fd);
                 return IO_ERROR;
             }
             return IO_WRPEND;
         }
-        conn->wpos += ret;
+        *ppos += ret;
     }
     return IO_WRDONE;
 }
 
 
-enum { WS_FRAME, HTTP_HDR, HTTP_BODY };
+enum { WS_FRAME, HTTP_HDR, HTTP_BODY, HTTPD_BODY };  // HTTPD_BODY: pipelined request may follow
 // Fill in data from rpos..rbufsize
 static int readData (conn_t* conn, int mode) {
     int r;
@@ -358,10 +864,12 @@ static int readData (conn_t* conn, int mode) {
             u1_t* r = &conn->rbuf[b];
             int n = conn->rpos - b;
             if( n >= 2 ) {
-                u1_t opcode = r[0] & 0xF;
+                // opcode plus RSV1 - set only on data frames and only with permessage-deflate
+                u1_t opcode = r[0] & (WSHDR_RSV1|0xF);
                 u2_t len = r[1] & 0x7F;
-                // ensure: FIN=1 RSV1/2/3=0, no masking (0x80) and no 64bit length
-                if( (r[0] & 0xF0) != 0x80 || (r[1]&0x80) || len == 0x7F ) {
+                int zok = conn->wsz && (opcode == (WSHDR_RSV1|WSHDR_TEXT) || opcode == (WSHDR_RSV1|WSHDR_BINARY));
+                // ensure: FIN=1 RSV2/3=0, no masking (0x80) and no 64bit length
+                if( (r[0] & 0xB0) != 0x80 || ((r[0] & WSHDR_RSV1) && !zok) || (r[1]&0x80) || len == 0x7F ) {
                     LOG(MOD_AIO|ERROR, "[%d] Illegal WS frame: %02X:%02X", conn->netctx.fd, r[0], r[1]);
                     return IO_ERROR;
                 }
@@ -399,9 +907,9 @@ static int readData (conn_t* conn, int mode) {
             }
         }
         else {
-            assert(mode==HTTP_BODY);
+            assert(mode==HTTP_BODY || mode==HTTPD_BODY);
             if( conn->rpos >= conn->rend ) {
-                if( conn->rpos > conn->rend ) {
+                if( conn->rpos > conn->rend && mode == HTTP_BODY ) {
                     LOG(MOD_AIO|ERROR, "[%d] Received more data than expected HTTP content size: %d extra bytes", conn->netctx.fd, conn->rpos - conn->rend);
                     return IO_ERROR;
                 }
@@ -409,7 +917,7 @@ static int readData (conn_t* conn, int mode) {
             }
         }
     readagain:
-        if( (r = tls_read(&conn->netctx, conn->tlsctx, conn->rbuf + conn->rpos, conn->rbufsize - conn->rpos) ) <= 0 ) {
+        if( (r = conn_tlsRead(conn, conn->rbuf + conn->rpos, conn->rbufsize - conn->rpos) ) <= 0 ) {
             if( r == 0 ) {
                 LOG(MOD_AIO|DEBUG, "[%d] Connection closed unexpectedly", conn->netctx.fd);
                 return IO_ERROR;
@@ -433,6 +941,18 @@ static int readData (conn_t* conn, int mode) {
         conn->rpos -= r;
         goto readagain;
     }
+    if( mode == WS_FRAME && conn->rbufsize < conn->rbufmax ) {
+        // Frame does not fit - enlarge buffer and keep reading
+        u4_t size = min(2*conn->rbufsize, conn->rbufmax);
+        u1_t* rbuf = rt_mallocN(u1_t, size);
+        memcpy(rbuf, conn->rbuf, conn->rpos);
+        rt_free(conn->rbuf);
+        conn->rbuf = rbuf;
+        conn->rbufsize = size;
+        conn->rgrows += 1;
+        LOG(MOD_AIO|INFO, "[%d] Recv buffer enlarged to %u bytes", conn->netctx.fd, size);
+        goto readagain;
+    }
     LOG(MOD_AIO|ERROR, "[%d] Recv buffer too small", conn->netctx.fd);
     return IO_ERROR;
 }
@@ -443,6 +963,231 @@ void conn_evcb_nil (conn_t* conn, int ev) {
 }
 
 
+// --------------------------------------------------------------------------------
+//
+// Staggered parallel TCP connect (RFC 8305 "happy eyeballs")
+//
+// Addresses are resolved via dns_resolve and ordered alternating between
+// address families. A new attempt is started every CONN_STAGGER or as soon as
+// the previous one failed, so a blackholed address only costs one stagger step
+// instead of a full TCP timeout. The first socket completing the TCP handshake becomes conn->netctx,
+// all other attempts are closed.
+//
+// --------------------------------------------------------------------------------
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "dns.h"
+
+enum { HEV_MAX_ADDRS = DNS_MAX_ADDRS };
+enum { HEV_MAX_INFLIGHT = 3 };   // bounds AIO handles used by one connect
+
+typedef void (*hevdone_t)(conn_t* conn, int ok);
+
+typedef struct hevatt {
+    struct hev* hev;
+    aio_t*      aio;         // pending attempt or NULL
+} hevatt_t;
+
+typedef struct hev {
+    conn_t*   conn;
+    hevdone_t done;
+    tmr_t     tmr;           // stagger step / overall timeout
+    dnsreq_t  dns;
+    char      host[MAX_HOSTNAME_LEN+1];
+    char      port[MAX_PORT_LEN+1];
+    ustime_t  deadline;
+    u1_t      naddrs;
+    u1_t      next;          // next address to try
+    u1_t      nact;          // attempts in flight
+    u1_t      order[HEV_MAX_ADDRS];  // attempt index -> dns.res.addr index
+    hevatt_t  att[HEV_MAX_ADDRS];
+} hev_t;
+
+static void hev_tick (tmr_t* tmr);
+
+
+static void hev_drop (hev_t* hev, int i) {
+    hevatt_t* att = &hev->att[i];
+    if( att->aio == NULL )
+        return;
+    aio_close(att->aio);  // closes socket
+    att->aio = NULL;
+    hev->nact -= 1;
+}
+
+static void hev_free (hev_t* hev) {
+    for( int i=0; i < hev->naddrs; i++ )
+        hev_drop(hev, i);
+    rt_clrTimer(&hev->tmr);
+    dns_cancel(&hev->dns);
+    hev->conn->hev = NULL;
+    rt_free(hev);
+}
+
+static void hev_finish (hev_t* hev, int fd) {
+    conn_t* conn = hev->conn;
+    hevdone_t done = hev->done;
+    if( fd < 0 && hev->naddrs > 0 )
+        dns_forget(hev->host, hev->port);  // addresses might be stale
+    hev_free(hev);
+    conn->netctx.fd = fd;
+    done(conn, fd >= 0);
+}
+
+static void hev_won (hevatt_t* att) {
+    hev_t* hev = att->hev;
+    aio_t* aio = att->aio;
+    int fd = aio->fd;
+    LOG(MOD_AIO|DEBUG, "[%d] TCP connected to %s:%s (address %d of %d)",
+        fd, hev->host, hev->port, (int)(att - hev->att) + 1, hev->naddrs);
+    // Detach socket from AIO handle so that aio_close keeps it open
+    aio_set_wrfn(aio, NULL);
+    aio->fd = -1;
+    aio_close(aio);
+    att->aio = NULL;
+    hev->nact -= 1;
+    hev_finish(hev, fd);
+}
+
+static void hev_writable (aio_t* aio) {
+    hevatt_t* att = (hevatt_t*)aio->ctx;
+    hev_t* hev = att->hev;
+    int err = 0;
+    socklen_t errlen = sizeof(err);
+    if( getsockopt(aio->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1 )
+        err = errno;
+    if( err == EINPROGRESS )
+        return;
+    if( err == 0 ) {
+        hev_won(att);
+        return;
+    }
+    LOG(MOD_AIO|VERBOSE, "[%d] TCP connect to %s:%s (address %d of %d) failed: %s",
+        aio->fd, hev->host, hev->port, (int)(att - hev->att) + 1, hev->naddrs, strerror(err));
+    hev_drop(hev, att - hev->att);
+    // Don't wait for the stagger step - move on to next address right away
+    rt_yieldTo(&hev->tmr, hev_tick);
+}
+
+enum { HEV_NONE, HEV_PENDING, HEV_DONE };
+
+// Start attempt on next address and arm timer for the one after.
+static int hev_start (hev_t* hev) {
+    while( hev->next < hev->naddrs ) {
+        if( hev->nact >= HEV_MAX_INFLIGHT ) {
+            // Oldest attempt had its chance - make room
+            int k = 0;
+            while( hev->att[k].aio == NULL )
+                k++;
+            LOG(MOD_AIO|VERBOSE, "TCP connect to %s:%s (address %d of %d) abandoned", hev->host, hev->port, k+1, hev->naddrs);
+            hev_drop(hev, k);
+        }
+        int i = hev->next++;
+        struct sockaddr* sa = (struct sockaddr*)&hev->dns.res.addr[hev->order[i]];
+        int fd = socket(sa->sa_family, SOCK_STREAM, IPPROTO_TCP);
+        if( fd == -1 ) {
+            LOG(MOD_AIO|VERBOSE, "TCP socket (family %d) failed: %s", sa->sa_family, strerror(errno));
+            continue;
+        }
+        int flags = fcntl(fd, F_GETFL, 0);
+        if( flags == -1 || fcntl(fd, F_SETFL, flags|O_NONBLOCK) == -1 ) {
+            LOG(MOD_AIO|ERROR, "[%d] Non blocking failed: %s", fd, strerror(errno));
+            close(fd);
+            continue;
+        }
+        hevatt_t* att = &hev->att[i];
+        att->hev = hev;
+        if( connect(fd, sa, hev->dns.res.addrlen[hev->order[i]]) == 0 ) {
+            att->aio = aio_open(att, fd, NULL, NULL);
+            hev->nact += 1;
+            hev_won(att);
+            return HEV_DONE;
+        }
+        if( errno != EINPROGRESS ) {
+            LOG(MOD_AIO|VERBOSE, "[%d] TCP connect to %s:%s (address %d of %d) failed: %s",
+                fd, hev->host, hev->port, i+1, hev->naddrs, strerror(errno));
+            close(fd);
+            continue;
+        }
+        att->aio = aio_open(att, fd, NULL, hev_writable);
+        hev->nact += 1;
+        break;
+    }
+    if( hev->nact == 0 )
+        return HEV_NONE;
+    ustime_t t = rt_micros_ahead(CONN_STAGGER);
+    rt_setTimerCb(&hev->tmr, hev->next < hev->naddrs && t < hev->deadline ? t : hev->deadline, hev_tick);
+    return HEV_PENDING;
+}
+
+static void hev_tick (tmr_t* tmr) {
+    hev_t* hev = memberof(hev_t, tmr, tmr);
+    if( rt_getTime() >= hev->deadline ) {
+        LOG(MOD_AIO|ERROR, "TCP connect to %s:%s timed out (%d addresses)", hev->host, hev->port, hev->naddrs);
+        hev_finish(hev, -1);
+        return;
+    }
+    if( hev_start(hev) == HEV_NONE ) {
+        LOG(MOD_AIO|ERROR, "TCP connect to %s:%s failed (%d addresses)", hev->host, hev->port, hev->naddrs);
+        hev_finish(hev, -1);
+    }
+}
+
+static void conn_cancelConnect (conn_t* conn) {
+    if( conn->hev )
+        hev_free(conn->hev);
+}
+
+static void hev_resolved (tmr_t* tmr) {
+    hev_t* hev = memberof(hev_t, tmr, dns.tmr);
+    dnsres_t* res = &hev->dns.res;
+    if( res->err ) {
+        hev_finish(hev, -1);
+        return;
+    }
+    // Alternate address families starting with the resolver's first choice
+    int fam = res->addr[0].ss_family;
+    int i1 = 0, i2 = 0;
+    while( hev->naddrs < res->naddrs ) {
+        while( i1 < res->naddrs && res->addr[i1].ss_family != fam ) i1++;
+        while( i2 < res->naddrs && res->addr[i2].ss_family == fam ) i2++;
+        if( i2 >= res->naddrs || (i1 < res->naddrs && hev->naddrs % 2 == 0) )
+            hev->order[hev->naddrs++] = i1++;
+        else
+            hev->order[hev->naddrs++] = i2++;
+    }
+    switch( hev_start(hev) ) {
+    case HEV_NONE: {
+        LOG(MOD_AIO|ERROR, "TCP connect to %s:%s failed (%d addresses)", hev->host, hev->port, hev->naddrs);
+        hev_finish(hev, -1);
+        return;
+    }
+    case HEV_PENDING: {
+        LOG(MOD_AIO|DEBUG, "TCP connecting to %s:%s (%d addresses)", hev->host, hev->port, hev->naddrs);
+        return;
+    }
+    }
+}
+
+// Resolve host and start connect attempts.
+// done reports the outcome (also failures) - always from the timer queue or AIO loop.
+static void conn_connect (conn_t* conn, const char* host, const char* port, hevdone_t done) {
+    hev_t* hev = rt_malloc(hev_t);
+    snprintf(hev->host, sizeof(hev->host), "%s", host);
+    snprintf(hev->port, sizeof(hev->port), "%s", port);
+    hev->conn = conn;
+    hev->done = done;
+    hev->deadline = rt_micros_ahead(CONN_TIMEOUT);
+    rt_setTimerCb(&hev->tmr, hev->deadline, hev_tick);
+    conn->hev = hev;
+    dns_resolve(&hev->dns, host, port, hev_resolved);
+}
+
+
 static void triggerWsClosedEv(tmr_t* tmr) {
     ws_t* conn = tmr2ws(tmr);
     evcb_t evcb = conn->evcb;
@@ -453,11 +1198,28 @@ static void triggerWsClosedEv(tmr_t* tmr) {
 
 void ws_shutdown (ws_t* conn) {
     LOG(MOD_AIO|DEBUG, "[%d] WS connection shutdown...", conn->netctx.fd);
+    conn_cancelConnect(conn);
+    wthr_stop(conn);
+    wsz_free(conn);
+    if( conn->wpeak )
+        LOG(MOD_AIO|INFO, "[%d] WS buffers: send peak %u of %u bytes (%u grows), recv %u bytes (%u grows)",
+            conn->netctx.fd, conn->wpeak, conn->wbufsize, conn->wgrows, conn->rbufsize, conn->rgrows);
+    if( conn->wpeak )
+        LOG(MOD_AIO|INFO, "[%d] WS send classes: timesync %u bytes (%u dropped), control %u (%u), uplink %u (%u), bulk %u (%u)",
+            conn->netctx.fd,
+            conn->wclassBytes[WSCLASS_TIMESYNC], conn->wclassDrops[WSCLASS_TIMESYNC],
+            conn->wclassBytes[WSCLASS_CONTROL],  conn->wclassDrops[WSCLASS_CONTROL],
+            conn->wclassBytes[WSCLASS_UPLINK],   conn->wclassDrops[WSCLASS_UPLINK],
+            conn->wclassBytes[WSCLASS_BULK],     conn->wclassDrops[WSCLASS_BULK]);
+    memset(conn->wclassBytes, 0, sizeof(conn->wclassBytes));
+    memset(conn->wclassDrops, 0, sizeof(conn->wclassDrops));
     mbedtls_net_free(&conn->netctx);
     rt_free(conn->rbuf);
     rt_free(conn->wbuf);
+    rt_free(conn->xbuf);
     conn->rbuf = NULL;
     conn->wbuf = NULL;
+    conn->xbuf = NULL;
     rt_free((void*)conn->authtoken);
     conn->authtoken = NULL;
     tls_freeSession(conn->tlsctx); conn->tlsctx = NULL;
@@ -474,6 +1236,13 @@ static void ws_closing_w (aio_t* aio) {
     ws_t* conn = (ws_t*)aio->ctx;
     assert(conn->state >= WS_CLOSING_DRAINC);
     LOG(MOD_AIO|XDEBUG, "[%d] ws_closing_w state=%d", conn->netctx.fd, conn->state);
+    if( conn->wthr ) {
+        if( wthr_isBusy(conn) ) {
+            aio_set_wrfn(conn->aio, NULL);  // wthr_next comes back here
+            return;
+        }
+        wthr_stop(conn);
+    }
     int e;
   again:
     if( (e = writeData(conn)) == IO_ERROR ) {
@@ -484,7 +1253,8 @@ static void ws_closing_w (aio_t* aio) {
         return;
     assert(e==IO_WRDONE);
     if( conn->state == WS_CLOSING_DRAINC || conn->state == WS_CLOSING_DRAINS ) {
-        conn->wpos = 0;
+        conn->xpos = conn->xend = conn->xfill = 0;
+        conn->wpos = conn->wwrap = 0;
         conn->wend = conn->wfill = 8;
         u1_t* p = conn->wbuf;
         p[0] = WSHDR_FIN | WSHDR_CLOSE;
@@ -506,13 +1276,21 @@ static void ws_closing_w (aio_t* aio) {
 }
 
 
+// wbuf holds complete WS frames back to back - they are handed to the
+// socket/TLS layer in one go so several frames share a TLS record/syscall.
+// Producers wrap around to the start of wbuf instead of compacting it.
 static void ws_connected_w (aio_t* aio) {
     ws_t* conn = (ws_t*)aio->ctx;
     assert(conn->state == WS_CONNECTED);
     // LOG(MOD_AIO|XDEBUG, "[%d] ws_connected_w state=%d", conn->netctx.fd, conn->state);
+    if( conn->wthr ) {
+        aio_set_wrfn(conn->aio, NULL);
+        wthr_next(conn);
+        return;
+    }
     int e;
   again:
-    if( conn->wpos < conn->wend ) {
+    if( conn->xpos < conn->xend || conn->wpos < conn->wend ) {
         if( (e = writeData(conn)) == IO_ERROR ) {
             ws_shutdown(conn);
             return;
@@ -520,39 +1298,116 @@ static void ws_connected_w (aio_t* aio) {
         if( e == IO_WRPEND )
             return;
         assert(e==IO_WRDONE);
+        metric_set(MG_ws_queued, ws_sendQueued(conn));
+        if( conn->wcongested && ws_sendQueued(conn) <= conn->wbufmax/4 ) {
+            conn->wcongested = 0;
+            conn->evcb(conn, WSEV_SENDLOW);
+        }
+        traceWsFill(conn, ws_sendQueued(conn));
         conn->evcb(conn, WSEV_DATASENT);
     }
     // Do we have more data pending?
-    doff_t wend = conn->wend;
-    if( wend == conn->wfill ) {
+    if( !ws_nextBatch(conn) ) {
         // No more data to send
         aio_set_wrfn(conn->aio, NULL);
         return;
     }
-    // Setup next frame
-    u1_t* wbuf = conn->wbuf;
-    u2_t dlen = rt_rmsbf2(wbuf + wend);
-    u1_t ftype = wbuf[wend+2];  // WSHDR_TEXT | WSHDR_BINARY
-    wend += WSHDR_INTRA;
-    if( dlen < WSHDR_LEN2 ) {
-        // short WS header
-        wbuf[wend-6] = WSHDR_FIN|ftype;
-        wbuf[wend-5] = dlen | WSHDR_MASK;
-        conn->wpos = wend-6;
+    goto again;
+}
+
+
+// Turn data in b (obtained from ws_getSendbuf) into a complete masked WS frame.
+static void ws_commitFrame (ws_t* conn, dbuf_t* b, u1_t ftype) {
+    int n = b->pos;
+    u1_t* data = (u1_t*)b->buf;
+    int express = conn->xbuf && data >= conn->xbuf && data < conn->xbuf + WS_XBUFSIZE;
+    u1_t* base = express ? conn->xbuf : conn->wbuf;
+    u4_t off = data - base - WSHDR_MAXLEN;
+    u1_t* h = base + off;
+    int hlen;
+    conn->wclassBytes[conn->wclass] += n;
+    u1_t rsv = 0;
+    if( conn->wsz && !express && (ftype == WSHDR_TEXT || ftype == WSHDR_BINARY) && wsz_deflate(conn, data, &n) )
+        rsv = WSHDR_RSV1;
+    if( n < WSHDR_LEN2 ) {
+        // short WS header - move small payload next to it to keep frames contiguous
+        h[0] = WSHDR_FIN|rsv|ftype;
+        h[1] = n | WSHDR_MASK;
+        hlen = 6;
+        memmove(h+hlen, data, n);
+        data = h+hlen;
     } else {
-        // medium WS head (note we have WSHDR_WRESV reserve at the start of wbuf)
-        wbuf[wend-8] = WSHDR_FIN|ftype;
-        wbuf[wend-7] = WSHDR_LEN2 | WSHDR_MASK;
-        wbuf[wend-6] = dlen>>8;
-        wbuf[wend-5] = dlen;
-        conn->wpos = wend-8;
-    }
-    conn->wend = wend + dlen;
+        // medium WS header
+        h[0] = WSHDR_FIN|rsv|ftype;
+        h[1] = WSHDR_LEN2 | WSHDR_MASK;
+        h[2] = n>>8;
+        h[3] = n;
+        hlen = 8;
+    }
     // Masking value - 0
-    wbuf[wend-4] = wbuf[wend-3] = wbuf[wend-2] = wbuf[wend-1] = 1;
-    for( int i=0; i<dlen; i++ )
-        wbuf[wend+i] ^= 1;
-    goto again;
+    h[hlen-4] = h[hlen-3] = h[hlen-2] = h[hlen-1] = 1;
+    for( int i=0; i<n; i++ )
+        data[i] ^= 1;
+    if( express ) {
+        conn->xfill = off + hlen + n;
+    } else {
+        if( off < conn->wfill )
+            conn->wwrap = conn->wfill;  // frame was placed at start of wbuf
+        conn->wfill = off + hlen + n;
+    }
+    b->buf = NULL;
+    b->pos = b->bufsize = 0;
+    aio_set_wrfn(conn->aio, ws_connected_w);
+    u4_t queued = ws_sendQueued(conn);
+    metric_set(MG_ws_queued, queued);
+    if( queued > conn->wpeak )
+        conn->wpeak = queued;
+    if( !conn->wcongested && queued >= conn->wbufmax - conn->wbufmax/4 ) {
+        conn->wcongested = 1;
+        conn->evcb(conn, WSEV_SENDHIGH);
+    }
+    traceWsFill(conn, queued);
+}
+
+
+u4_t ws_sendQueued (ws_t* conn) {
+    if( conn->wwrap )
+        return conn->wwrap - conn->wpos + conn->wfill;
+    return conn->wfill - conn->wpos;
+}
+
+
+// Enlarge wbuf so that at least need bytes are free after the queued frames.
+// Pending data is moved to the start of the new buffer which also undoes any wrap.
+// Data handed to TLS but not yet sent moves along - TLS keeps its own copy
+// of a partially written record and only needs the same length again.
+static int ws_growSendbuf (ws_t* conn, u4_t need) {
+    if( wthr_isBusy(conn) )
+        return 0;  // writer thread uses wbuf - come back after wthr_done
+    u4_t queued = ws_sendQueued(conn);
+    u4_t size = conn->wbufsize;
+    while( size < queued + need && size < conn->wbufmax )
+        size *= 2;
+    size = min(size, conn->wbufmax);
+    if( size <= conn->wbufsize || size < queued + need )
+        return 0;
+    u1_t* wbuf = rt_mallocN(u1_t, size);
+    if( conn->wwrap ) {
+        u4_t tail = conn->wwrap - conn->wpos;
+        memcpy(wbuf, conn->wbuf + conn->wpos, tail);
+        memcpy(wbuf + tail, conn->wbuf, conn->wfill);
+    } else {
+        memcpy(wbuf, conn->wbuf + conn->wpos, queued);
+    }
+    rt_free(conn->wbuf);
+    conn->wbuf = wbuf;
+    conn->wbufsize = size;
+    conn->wend -= conn->wpos;
+    conn->wpos = conn->wwrap = 0;
+    conn->wfill = queued;
+    conn->wgrows += 1;
+    LOG(MOD_AIO|INFO, "[%d] Send buffer enlarged to %u bytes (%u queued)", conn->netctx.fd, size, queued);
+    return 1;
 }
 
 
@@ -571,6 +1426,13 @@ static void ws_connected_r (aio_t* aio) {
     assert(e==IO_RDDONE);
     u1_t* p = &conn->rbuf[conn->rbeg];
     u1_t opcode = p[-1];
+    if( opcode & WSHDR_RSV1 ) {
+        if( !wsz_inflate(conn, p, conn->rend - conn->rbeg) ) {
+            ws_shutdown(conn);
+            return;
+        }
+        opcode &= ~WSHDR_RSV1;
+    }
     switch(opcode) {
     case WSHDR_PING: {
         int plen = conn->rend-conn->rbeg;
@@ -580,12 +1442,9 @@ static void ws_connected_r (aio_t* aio) {
             LOG(MOD_AIO|WARNING, "[%d] Cannot respond to PING message of length %d", conn->netctx.fd, plen);
             break;
         }
-        wbuf.buf[0-WSHDR_INTRA] = plen>>8;
-        wbuf.buf[1-WSHDR_INTRA] = plen;
-        wbuf.buf[2-WSHDR_INTRA] = WSHDR_PONG;
-        conn->wfill += plen+WSHDR_INTRA;
         memcpy(wbuf.buf, p, plen);
-        aio_set_wrfn(conn->aio, ws_connected_w);
+        wbuf.pos = plen;
+        ws_commitFrame(conn, &wbuf, WSHDR_PONG);
         LOG(MOD_AIO|XDEBUG, "[%d|WS] > PONG", conn->netctx.fd);
         break;
     }
@@ -594,8 +1453,10 @@ static void ws_connected_r (aio_t* aio) {
         break;
     }
     case WSHDR_TEXT: {
+        dbuf_t m = ws_getRecvbuf(conn);
         int offset = 0;
-        int plen = conn->rend - conn->rbeg;
+        int plen = m.bufsize;
+        p = (u1_t*)m.buf;
         while( offset < plen ) {
             LOG(MOD_AIO|XDEBUG, "[%d|WS] %c %.*s", conn->netctx.fd, offset ? '.' : '<', min((LOGLINE_LEN-50),plen-offset), p+offset);
             offset += (LOGLINE_LEN-50);
@@ -627,6 +1488,10 @@ static void ws_connected_r (aio_t* aio) {
         break;
     }
     }
+#if defined(CFG_wsdeflate)
+    if( conn->wsz )
+        conn->wsz->rxlen = 0;
+#endif // defined(CFG_wsdeflate)
     conn->rbeg = conn->rend;
     if( conn->rend == conn->rpos )
         conn->rbeg = conn->rend = conn->rpos = WSHDR_RESV_R;
@@ -664,7 +1529,10 @@ static void ws_handshaking (aio_t* aio) {
             assert(conn->rbuf == NULL && conn->wbuf == NULL);
             conn->rbuf = rt_mallocN(u1_t, conn->rbufsize);
             conn->wbuf = rt_mallocN(u1_t, conn->wbufsize);
+            conn->xbuf = rt_mallocN(u1_t, WS_XBUFSIZE);
 
+            char zoffer[128];
+            wsz_offer(conn, zoffer, sizeof(zoffer));
             conn->wpos = 0;
             conn->wend = snprintf
                 ((char*)conn->wbuf, conn->wbufsize,
@@ -674,8 +1542,8 @@ static void ws_handshaking (aio_t* aio) {
                  "Connection: upgrade\r\n"
                  "Sec-WebSocket-Key: %s\r\n"
                  "Sec-WebSocket-Version: 13\r\n"
+                 "%s"
                  //"Sec-WebSocket-Protocol: ...\r\n"
-                 //"Sec-WebSocket-Extensions: ...\r\n"
                  //"Origin: http://www.example.com\r\n"  // if browser request or similar
                  //and other header fields if required e.g. cookies
                  "%s\r\n",
@@ -687,6 +1555,7 @@ static void ws_handshaking (aio_t* aio) {
                  //  aPnEh0f0Q/DcX6MmuFsHYw==
                  //  OMQ7ar+ghnUHbT8lsfjziA==
                  "bpse8nVmEl6ZlX4lSb6RMw==",
+                 zoffer,
                  conn->authtoken ? conn->authtoken : "");
             assert(conn->wend < conn->wbufsize-1);
             conn->state = WS_CLIENT_REQ;
@@ -735,7 +1604,7 @@ static void ws_connecting (aio_t* aio) {
         if( e == IO_WRPEND )
             return;
         // IO_WRDONE
-        aio->wrfn = NULL;
+        aio_set_wrfn(aio, NULL);
         conn->state = WS_SERVER_RESP;
         return;
     }
@@ -754,10 +1623,18 @@ static void ws_connecting (aio_t* aio) {
             ws_shutdown(conn);
             return;
         }
-        conn->wpos = conn->wend = conn->wfill = WSHDR_RESV_W;
+        if( !wsz_accept(conn) ) {
+            ws_shutdown(conn);
+            return;
+        }
+        conn->wpos = conn->wend = conn->wfill = conn->wwrap = 0;
+        conn->xpos = conn->xend = conn->xfill = 0;
+        conn->wcongested = 0;
         aio_set_rdfn(conn->aio, ws_connected_r);
         aio_set_wrfn(conn->aio, NULL);
         conn->state = WS_CONNECTED;
+        if( conn->wthrmode )
+            wthr_start(conn);
         conn->evcb(conn, WSEV_CONNECTED);
         conn->rbeg = conn->rend; // signal lower level that we consumed this frame
         if( conn->aio )
@@ -776,29 +1653,75 @@ static void ws_connecting (aio_t* aio) {
 // If space is not used caller can just walk away - no clean/free required.
 //
 dbuf_t ws_getSendbuf (ws_t* conn, int minsize) {
+    return ws_getSendbufClass(conn, minsize, WSCLASS_UPLINK);
+}
+
+
+// Express classes are placed into xbuf which is sent at the next batch boundary
+// ahead of anything queued in wbuf. A timesync request which does not fit is
+// dropped - it would only be sent late and produce a bad round trip sample.
+static dbuf_t getSendbuf (ws_t* conn, int minsize);
+
+dbuf_t ws_getSendbufClass (ws_t* conn, int minsize, int wsclass) {
+    conn->wclass = wsclass;
+    if( wsclass <= WSCLASS_CONTROL && conn->state == WS_CONNECTED && conn->xbuf ) {
+        if( !wthr_isBusy(conn) && conn->xpos == conn->xfill )
+            conn->xpos = conn->xend = conn->xfill = 0;
+        if( conn->xfill + WSHDR_MAXLEN + minsize <= WS_XBUFSIZE ) {
+            dbuf_t b = {
+                .buf    =(char*)(conn->xbuf + conn->xfill + WSHDR_MAXLEN),
+                .bufsize=WS_XBUFSIZE - conn->xfill - WSHDR_MAXLEN,
+                .pos    =0 };
+            return b;
+        }
+        if( wsclass == WSCLASS_TIMESYNC ) {
+            conn->wclassDrops[wsclass] += 1;
+            dbuf_t b = { .buf=NULL, .bufsize=0, .pos=0 };
+            return b;
+        }
+    }
+    dbuf_t b = getSendbuf(conn, minsize);
+    if( b.buf == NULL && conn->state == WS_CONNECTED )
+        conn->wclassDrops[wsclass] += 1;
+    return b;
+}
+
+
+static dbuf_t getSendbuf (ws_t* conn, int minsize) {
     if( conn->state != WS_CONNECTED )
         goto errexit;  // nope - come back later
-    if( conn->wpos == conn->wfill )
-        conn->wpos = conn->wend = conn->wfill = WSHDR_RESV_W;
-    if( WSHDR_RESV_W + WSHDR_INTRA + minsize > conn->wbufsize ) {
+    if( !wthr_isBusy(conn) && conn->wpos == conn->wfill && !conn->wwrap )
+        conn->wpos = conn->wend = conn->wfill = 0;
+    int need = WSHDR_MAXLEN + minsize;
+    if( need > max(conn->wbufsize, conn->wbufmax) ) {
         LOG(MOD_AIO|CRITICAL, "[%d] Requested send buffer size exceeds available space: %d > %d bytes",
-            conn->netctx.fd, minsize, conn->wbufsize - WSHDR_RESV_W - WSHDR_INTRA);
+            conn->netctx.fd, minsize, max(conn->wbufsize, conn->wbufmax) - WSHDR_MAXLEN);
         goto errexit;  // nope - come back never...
     }
-    int n = conn->wfill + minsize - conn->wbufsize;
-    if( n > 0 ) {
-        int m = conn->wpos - WSHDR_RESV_W;
-        if( n > m - WSHDR_INTRA )
-            goto errexit; // nope - even compaction would not make enough space - come back later
-        // Compaction
-        memmove(&conn->wbuf[WSHDR_RESV_W], &conn->wbuf[conn->wpos], conn->wfill - conn->wpos);
-        conn->wpos  -= m;
-        conn->wend  -= m;
-        conn->wfill -= m;
+    u4_t off, end, wpos;
+  retry:
+    // A writer thread advances wpos concurrently - pairs with its release store
+    wpos = __atomic_load_n(&conn->wpos, __ATOMIC_ACQUIRE);
+    if( conn->wwrap ) {
+        // Already wrapped - free space is between wfill and wpos
+        off = conn->wfill;
+        end = wpos;
+    } else if( conn->wfill + need <= conn->wbufsize ) {
+        off = conn->wfill;
+        end = conn->wbufsize;
+    } else {
+        // Wrap around - only becomes effective if frame is committed
+        off = 0;
+        end = wpos;
+    }
+    if( off + need > end ) {
+        if( ws_growSendbuf(conn, need) )
+            goto retry;
+        goto errexit; // nope - come back later
     }
     dbuf_t b = {
-        .buf    =(char*)(conn->wbuf + conn->wfill + WSHDR_INTRA),
-        .bufsize=conn->wbufsize - conn->wfill - WSHDR_INTRA,
+        .buf    =(char*)(conn->wbuf + off + WSHDR_MAXLEN),
+        .bufsize=min(end - off - WSHDR_MAXLEN, 0xFFFF),
         .pos    =0 };
     return b;
 
@@ -815,14 +1738,7 @@ dbuf_t ws_getSendbuf (ws_t* conn, int minsize) {
 void ws_sendData (ws_t* conn, dbuf_t* b, int binaryData) {
     if( conn->state != WS_CONNECTED )
         return;
-    int n = b->pos;
-    b->buf[0-WSHDR_INTRA] = n>>8;
-    b->buf[1-WSHDR_INTRA] = n;
-    b->buf[2-WSHDR_INTRA] = binaryData ? WSHDR_BINARY : WSHDR_TEXT;
-    conn->wfill += n+WSHDR_INTRA;
-    b->buf = NULL;
-    b->pos = b->bufsize = 0;
-    aio_set_wrfn(conn->aio, ws_connected_w);
+    ws_commitFrame(conn, b, binaryData ? WSHDR_BINARY : WSHDR_TEXT);
 }
 
 
@@ -852,6 +1768,15 @@ dbuf_t ws_getRecvbuf (ws_t* conn) {
             .pos = 0 };
         return b;
     }
+#if defined(CFG_wsdeflate)
+    if( conn->wsz && conn->wsz->rxlen ) {
+        dbuf_t b = {
+            .buf = (char*)conn->wsz->rxbuf,
+            .bufsize = conn->wsz->rxlen,
+            .pos = 0 };
+        return b;
+    }
+#endif // defined(CFG_wsdeflate)
     dbuf_t b = {
         .buf = (char*)(conn->rbuf + conn->rbeg),
         .bufsize = conn->rend - conn->rbeg,
@@ -866,16 +1791,39 @@ void ws_ini (ws_t* conn, int rbufsize, int wbufsize) {
     rt_iniTimer(&conn->tmr, NULL);
     conn->state = WS_CLOSED;
     conn->evcb = conn_evcb_nil;
-    conn->rbufsize = rbufsize;
-    conn->wbufsize = wbufsize;
+    conn->rbufsize = conn->rbufmax = rbufsize;
+    conn->wbufsize = conn->wbufmax = wbufsize;
+}
+
+
+void ws_setBufmax (ws_t* conn, int rbufmax, int wbufmax) {
+    conn->rbufmax = max((u4_t)rbufmax, conn->rbufsize);
+    conn->wbufmax = max((u4_t)wbufmax, conn->wbufsize);
+}
+
+
+void ws_setWriterThread (ws_t* conn, int on) {
+    conn->wthrmode = on;
+}
+
+
+void ws_setDeflate (ws_t* conn, int bits) {
+#if defined(CFG_wsdeflate)
+    conn->zbits = bits == 0 ? 0 : max(WSZ_MIN_BITS, min(15, bits));
+#endif
 }
 
 
 void ws_free (ws_t* conn) {
+    conn_cancelConnect(conn);
+    wthr_stop(conn);
+    wsz_free(conn);
     rt_free(conn->rbuf);
     rt_free(conn->wbuf);
+    rt_free(conn->xbuf);
     conn->rbuf = NULL;
     conn->wbuf = NULL;
+    conn->xbuf = NULL;
     rt_free(conn->host);
     rt_free(conn->port);
     rt_free(conn->uripath);
@@ -893,34 +1841,31 @@ void ws_free (ws_t* conn) {
 }
 
 
+static void ws_tcpConnected (conn_t* conn, int ok) {
+    if( !ok ) {
+        ws_shutdown(conn);
+        return;
+    }
+    sys_keepAlive(conn->netctx.fd);
+    conn->aio = aio_open(conn, conn->netctx.fd, NULL, NULL);
+    ws_handshaking(conn->aio);
+}
+
+
 int ws_connect (ws_t* conn, char* host, char* port, char* uripath) {
     if( conn->state != WS_CLOSED )
         return 0;  // forgot to ws_close?
     rt_clrTimer(&conn->tmr);
     mbedtls_net_free(&conn->netctx);
     mbedtls_net_init(&conn->netctx);
-
-    int ret;
-    if( (ret = mbedtls_net_connect(&conn->netctx, host, port, MBEDTLS_NET_PROTO_TCP)) != 0 ) {
-        log_mbedError(MOD_AIO|ERROR, ret, "[%d] WS connect failed", conn->netctx.fd);
-        ws_shutdown(conn);
-        return 0;
-    }
-    if( (ret = mbedtls_net_set_nonblock(&conn->netctx)) != 0 ) {
-        log_mbedError(MOD_AIO|ERROR, ret, "[%d] Non blocking failed", conn->netctx.fd);
-        ws_shutdown(conn);
-        return 0;
-    }
-    sys_keepAlive(conn->netctx.fd);
     if( conn->tlsctx )
         mbedtls_ssl_set_bio(conn->tlsctx, &conn->netctx, mbedtls_net_send, mbedtls_net_recv, NULL);
 
     conn->host = rt_strdup(host);
     conn->port = rt_strdup(port);
     conn->uripath = rt_strdup(uripath);
-    conn->aio = aio_open(conn, conn->netctx.fd, NULL, NULL);
-    conn->state = WS_TLS_HANDSHAKE;
-    ws_handshaking(conn->aio);
+    conn->state = WS_TLS_HANDSHAKE;  // TCP connect still pending while conn->aio==NULL
+    conn_connect(conn, host, port, ws_tcpConnected);
     return 1;
 }
 
@@ -964,6 +1909,11 @@ static void http_read (aio_t* aio) {
         // Read upto \r\n\r\n
         int e = readData(&conn->c, HTTP_HDR);
         if( e == IO_ERROR ) {
+            if( conn->srv.server && conn->c.rpos == 0 ) {
+                // Client closed kept-alive connection between requests
+                httpd_close(conn);
+                return;
+            }
             LOG(MOD_AIO|ERROR, "[%d] Error reading HTTP Header", conn->c.netctx.fd);
             http_close(conn);
             return;
@@ -982,12 +1932,14 @@ static void http_read (aio_t* aio) {
             conn->extra.coff = conn->extra.clen = clen = 0;
         }
         conn->c.creason = http_statusCode(hdr);
+        if( conn->srv.server )
+            conn->srv.keep = httpd_keepAlive(hdr) && clen == conn->extra.clen;
         conn->c.rbeg = conn->c.rend;  // remember end header / start of body
         conn->c.rend += clen;
         conn->c.state = HTTP_READING_BODY;
     }
     assert(conn->c.state == HTTP_READING_BODY && conn->extra.coff >= 0 && conn->extra.coff <= conn->extra.clen);
-    int e = readData(&conn->c, HTTP_BODY);
+    int e = readData(&conn->c, conn->srv.server ? HTTPD_BODY : HTTP_BODY);
     if( e == IO_ERROR ) {
         LOG(MOD_AIO|ERROR, "[%d] Error reading HTTP Body", conn->c.netctx.fd);
         http_close(conn);
@@ -1038,6 +1990,8 @@ void http_ini (http_t* conn, int bufsize) {
 
 
 void http_free (http_t* conn) {
+    if( conn->c.wbuf != conn->c.rbuf )
+        rt_free(conn->c.wbuf);
     rt_free(conn->c.rbuf);
     conn->c.rbuf = conn->c.wbuf = NULL;
     ws_free(&conn->c);
@@ -1050,6 +2004,7 @@ void http_free (http_t* conn) {
 static void _http_close (http_t* conn, tmrcb_t trigCloseEv) {
     rt_clrTimer(&conn->c.tmr);
     LOG(MOD_AIO|DEBUG, "[%d] HTTP connection shutdown...", conn->c.netctx.fd);
+    conn_cancelConnect(&conn->c);
     mbedtls_net_free(&conn->c.netctx);
     tls_freeSession(conn->c.tlsctx); conn->c.tlsctx = NULL;
     tls_freeConf(conn->c.tlsconf); conn->c.tlsconf = NULL;
@@ -1069,35 +2024,35 @@ void http_close (http_t* conn) {
 }
 
 
+static void http_tcpConnected (conn_t* c, int ok) {
+    http_t* conn = memberof(http_t, c, c);
+    if( !ok ) {
+        http_close(conn);
+        return;
+    }
+    sys_keepAlive(conn->c.netctx.fd);
+    conn->c.aio = aio_open(conn, conn->c.netctx.fd, NULL, NULL);
+    conn->c.state = HTTP_CONNECTED;
+    rt_yieldTo(&conn->c.tmr, triggerHttpConnectedEv);
+}
+
+
 int http_connect (http_t* conn, char* host, char* port) {
     if( conn->c.state != HTTP_CLOSED )
         return 0;  // forgot to http_close?
     rt_clrTimer(&conn->c.tmr);
     mbedtls_net_free(&conn->c.netctx);
     mbedtls_net_init(&conn->c.netctx);
-
-    int ret;
-    if( (ret = mbedtls_net_connect(&conn->c.netctx, host, port, MBEDTLS_NET_PROTO_TCP)) != 0 ) {
-        log_mbedError(MOD_AIO|ERROR, ret, "[%d] HTTP connect failed", conn->c.netctx.fd);
-        http_close(conn);
-        return 0;
-    }
-    if( (ret = mbedtls_net_set_nonblock(&conn->c.netctx)) != 0 ) {
-        log_mbedError(MOD_AIO|ERROR, ret, "[%d] Non blocking failed", conn->c.netctx.fd);
-        http_close(conn);
-        return 0;
-    }
-    sys_keepAlive(conn->c.netctx.fd);
     if( conn->c.tlsctx )
         mbedtls_ssl_set_bio(conn->c.tlsctx, &conn->c.netctx, mbedtls_net_send, mbedtls_net_recv, NULL);
 
-    conn->c.aio = aio_open(conn, conn->c.netctx.fd, NULL, NULL);
+    conn->c.state = HTTP_CONNECTING;
+    conn_connect(&conn->c, host, port, http_tcpConnected);
     // NOTE: the first wfill bytes are reserved for host:port
     // We might need this to build Host header line.
+    // host/port may live in wbuf - conn_connect is done with them by now.
     int n = snprintf((char*)conn->c.wbuf, conn->c.wbufsize, "%s:%s", host, port);
     conn->c.wfill = conn->c.rbeg = conn->c.rend = n+1;
-    conn->c.state = HTTP_CONNECTED;
-    rt_yieldTo(&conn->c.tmr, triggerHttpConnectedEv);
     return 1;
 }
 
@@ -1195,6 +2150,36 @@ void http_request (http_t* conn, dbuf_t* req) {
 
 
 
+#if defined(CFG_linux)
+#include <sys/sendfile.h>
+#endif // defined(CFG_linux)
+
+static void httpd_idle (tmr_t* tmr) {
+    httpd_t* conn = memberof(httpd_t, tmr, srv.idle);
+    if( conn->c.state != HTTPD_READING_HDR )
+        return;
+    LOG(MOD_AIO|DEBUG, "[%d] HTTPD connection idle - closing", conn->c.netctx.fd);
+    httpd_close(conn);
+}
+
+
+// Response is out - wait for next request on a kept-alive connection.
+// Pipelined data received with the previous request is moved to the front.
+static void httpd_next (httpd_t* conn) {
+    u4_t left = conn->c.rpos - conn->c.rend;
+    memmove(conn->c.rbuf, conn->c.rbuf + conn->c.rend, left);
+    conn->c.rpos = left;
+    conn->c.rbeg = conn->c.rend = 0;
+    conn->extra.coff = conn->extra.clen = -1;
+    conn->c.state = HTTPD_READING_HDR;
+    conn->srv.nreq += 1;
+    aio_set_rdfn(conn->c.aio, http_read);
+    rt_setTimerCb(&conn->srv.idle, rt_micros_ahead(HTTPD_IDLE_TIMEOUT), httpd_idle);
+    if( left )
+        rt_yieldTo(&conn->c.tmr, triggerHttpRead);
+}
+
+
 static void httpd_write (aio_t* aio) {
     httpd_t* conn = (httpd_t*)aio->ctx;
     assert(conn->c.state == HTTPD_SENDING_RESP);
@@ -1206,74 +2191,175 @@ static void httpd_write (aio_t* aio) {
     if( e == IO_WRPEND )
         return;
     assert(e==IO_WRDONE);
-    conn->c.wpos = conn->c.wend = conn->c.wfill;
-    conn->c.state = HTTPD_CLOSED;
-    httpd_close(conn);
+#if defined(CFG_linux)
+    if( conn->srv.fd >= 0 ) {
+        while( conn->srv.foff < conn->srv.flen ) {
+            off_t off = conn->srv.foff;
+            ssize_t n = sendfile(conn->c.netctx.fd, conn->srv.fd, &off, conn->srv.flen - conn->srv.foff);
+            if( n <= 0 ) {
+                if( n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) )
+                    return;
+                LOG(MOD_AIO|ERROR, "[%d] sendfile failed: %s", conn->c.netctx.fd, n==0 ? "file truncated" : strerror(errno));
+                httpd_close(conn);
+                return;
+            }
+            conn->srv.foff = off;
+        }
+        close(conn->srv.fd);
+        conn->srv.fd = -1;
+    }
+#endif // defined(CFG_linux)
+    aio_set_wrfn(aio, NULL);
+    conn->c.wpos = conn->c.wend = 0;
+    if( !conn->srv.keep ) {
+        httpd_close(conn);
+        return;
+    }
+    httpd_next(conn);
+}
+
+
+// Find a client slot for a new connection. If all are busy evict
+// a kept-alive connection which is waiting for its next request.
+static httpd_t* httpd_slot (httpd_t* listener) {
+    httpd_t* idle = NULL;
+    for( httpd_t* conn = listener; conn; conn = conn->listen.next ) {
+        if( conn->c.aio == NULL && conn->c.state == HTTPD_CLOSED )
+            return conn;
+        if( idle == NULL && conn->c.state == HTTPD_READING_HDR && conn->c.rpos == 0 && conn->srv.nreq > 0 )
+            idle = conn;
+    }
+    if( idle ) {
+        LOG(MOD_AIO|DEBUG, "[%d] Closing idle HTTPD connection to make room", idle->c.netctx.fd);
+        httpd_close(idle);
+    }
+    return idle;
 }
 
 
 static void httpd_accept (aio_t* aio) {
-    httpd_t* conn = (httpd_t*)aio->ctx;
+    httpd_t* listener = (httpd_t*)aio->ctx;
     netctx_t client_netctx;
     int ret;
     mbedtls_net_init(&client_netctx);
-    if( (ret = mbedtls_net_accept( &conn->listen.netctx, &client_netctx, NULL, 0, NULL) ) != 0 ) {
-        log_mbedError(MOD_AIO|ERROR, ret, "[%d->%d] Accept failed", conn->listen.netctx.fd, client_netctx.fd);
+    if( (ret = mbedtls_net_accept( &listener->listen.netctx, &client_netctx, NULL, 0, NULL) ) != 0 ) {
+        log_mbedError(MOD_AIO|ERROR, ret, "[%d->%d] Accept failed", listener->listen.netctx.fd, client_netctx.fd);
         return;
     }
-    
-    if( conn->c.aio != NULL ) {
-        LOG(MOD_AIO|WARNING, "[%d->%d] Dropping new connection - busy with [%d]!",
-            conn->listen.netctx.fd, client_netctx.fd, conn->c.netctx.fd);
+    httpd_t* conn = httpd_slot(listener);
+    if( conn == NULL ) {
+        LOG(MOD_AIO|WARNING, "[%d->%d] Dropping new connection - all connections busy!",
+            listener->listen.netctx.fd, client_netctx.fd);
         mbedtls_net_free(&client_netctx);
         return;
     }
     assert(conn->c.state == HTTPD_CLOSED);
+    if( (ret = mbedtls_net_set_nonblock(&client_netctx)) != 0 ) {
+        log_mbedError(MOD_AIO|ERROR, ret, "[%d] Non blocking failed", client_netctx.fd);
+        mbedtls_net_free(&client_netctx);
+        return;
+    }
     conn->c.netctx = client_netctx;
     conn->c.rpos = conn->c.rbeg = conn->c.rend = 0;
     conn->c.wfill = conn->c.wpos = conn->c.wend = 0;
     conn->extra.coff = conn->extra.clen = -1;
+    conn->srv.keep = 0;
+    conn->srv.nreq = 0;
     conn->c.state = HTTPD_READING_HDR;
     conn->c.aio = aio_open(conn, conn->c.netctx.fd, http_read, NULL);
-    LOG(MOD_AIO|DEBUG, "[%d->%d] Connection accepted...", conn->listen.netctx.fd, conn->c.netctx.fd);
+    rt_setTimerCb(&conn->srv.idle, rt_micros_ahead(HTTPD_IDLE_TIMEOUT), httpd_idle);
+    LOG(MOD_AIO|DEBUG, "[%d->%d] Connection accepted...", listener->listen.netctx.fd, conn->c.netctx.fd);
 }
 
 
-void httpd_response (httpd_t* conn, dbuf_t* req) {
-    int wfill = conn->c.wfill;
-    assert(req->pos > 0 && (u1_t*)req->buf == &conn->c.wbuf[wfill]);
-    conn->c.rpos = conn->c.rbeg = conn->c.rend =
-        conn->c.wpos = wfill;
-    conn->c.wend = req->pos + wfill;
+static void httpd_startResp (httpd_t* conn, dbuf_t* resp) {
+    assert(resp->pos > 0 && (u1_t*)resp->buf == conn->c.wbuf);
+    // Without a content length the client can only detect the end by us closing
+    int n = resp->pos;
+    char* p = resp->buf;
+    int hend = 0;
+    for( int i=3; i<n && !hend; i++ ) {
+        if( p[i-3]=='\r' && p[i-2]=='\n' && p[i-1]=='\r' && p[i]=='\n' )
+            hend = i;
+    }
+    if( !hend || http_findHeader(p, "content-length") == NULL )
+        conn->srv.keep = 0;
+    conn->c.wpos = 0;
+    conn->c.wend = resp->pos;
     conn->c.state = HTTPD_SENDING_RESP;
     aio_set_wrfn(conn->c.aio, httpd_write);
+}
+
+
+void httpd_response (httpd_t* conn, dbuf_t* resp) {
+    httpd_startResp(conn, resp);
     httpd_write(conn->c.aio);
 }
 
 
+#if defined(CFG_linux)
+void httpd_sendFile (httpd_t* conn, dbuf_t* resp, int fd, u4_t len) {
+    httpd_startResp(conn, resp);
+    conn->srv.fd = fd;
+    conn->srv.foff = 0;
+    conn->srv.flen = len;
+    httpd_write(conn->c.aio);
+}
+#endif // defined(CFG_linux)
+
+
 dbuf_t httpd_getRespbuf (httpd_t* conn) {
-    return http_getReqbuf(conn);
+    dbuf_t b = { .buf=NULL, .bufsize=0, .pos=0 };
+    if( conn->c.state == HTTPD_CONNECTED ) {
+        b.buf = (char*)conn->c.wbuf;
+        b.bufsize = conn->c.wbufsize;
+    }
+    return b;
 }
 
 dbuf_t httpd_getHdr (httpd_t* conn) {
-    return http_getHdr(conn);
+    dbuf_t b = { .buf=NULL, .bufsize=0, .pos=0 };
+    if( conn->c.state == HTTPD_CONNECTED ) {
+        b.buf = (char*)conn->c.rbuf;
+        b.bufsize = conn->c.rbeg;
+    }
+    return b;
 }
 
 dbuf_t httpd_getBody (httpd_t* conn) {
-    return http_getBody(conn);
+    dbuf_t b = { .buf=NULL, .bufsize=0, .pos=0 };
+    if( conn->c.state == HTTPD_CONNECTED ) {
+        b.buf = (char*)conn->c.rbuf + conn->c.rbeg;
+        b.bufsize = conn->c.rend - conn->c.rbeg;
+    }
+    return b;
 }
 
 
 void httpd_ini (httpd_t* conn, int bufsize) {
     http_ini(conn, bufsize);
+    // Separate response buffer - request and pipelined data must survive the response
+    conn->c.wbuf = rt_mallocN(u1_t, bufsize);
+    conn->srv.server = 1;
+    conn->srv.fd = -1;
+    rt_iniTimer(&conn->srv.idle, httpd_idle);
 }
 
 
 void httpd_free (httpd_t* conn) {
+    rt_clrTimer(&conn->srv.idle);
     http_free(conn);
 }
 
 
+void httpd_addConn (httpd_t* listener, httpd_t* conn) {
+    conn->listen.next = listener->listen.next;
+    listener->listen.next = conn;
+    conn->c.wfill = conn->c.rbeg = conn->c.rend = 0;
+    conn->c.state = HTTPD_CLOSED;
+}
+
+
 int httpd_listen (httpd_t* conn, const char* port) {
     if( conn->listen.aio != NULL ||    // forgot to httpd_stop?
         conn->c.tlsctx != NULL )    // TLS not supported for HTTPD
@@ -1300,7 +2386,8 @@ void httpd_stop (httpd_t* conn) {
     aio_close(conn->listen.aio);
     conn->listen.aio = NULL;
     mbedtls_net_free(&conn->listen.netctx);
-    httpd_close(conn);
+    for( httpd_t* c = conn; c; c = c->listen.next )
+        httpd_close(c);
 }
 
 
@@ -1311,6 +2398,12 @@ static void triggerHttpdClosedEv(tmr_t* tmr) {
 
 
 void httpd_close (httpd_t* conn) {
+    rt_clrTimer(&conn->srv.idle);
+    if( conn->srv.fd >= 0 ) {
+        close(conn->srv.fd);
+        conn->srv.fd = -1;
+    }
+    conn->srv.keep = 0;
     _http_close(conn, triggerHttpdClosedEv);
 }
 
@@ -1442,7 +2535,7 @@ static int validateAuthToken (str_t s) {
 
 
 int conn_setup_tls (conn_t* conn, int cred_cat, int cred_set, const char* servername) {
-    tlsconf_t* tlsconf = tls_makeConf();
+    tlsconf_t* tlsconf = NULL;
     str_t elems[SYS_CRED_NELEMS];
     int elemslen[SYS_CRED_NELEMS];
     int auth = sys_cred(cred_cat, cred_set, elems, elemslen);    // get pointers to files or cert data
@@ -1451,9 +2544,16 @@ int conn_setup_tls (conn_t* conn, int cred_cat, int cred_set, const char* server
         errmsg = "%s URI requires TLS but no trust configured";
         goto errexit;
     }
-    if( !tls_setTrustedCAs(tlsconf, elems[SYS_CRED_TRUST], elemslen[SYS_CRED_TRUST]) ) {
-        errmsg = "%s%s trust certificates rejected by MBedTLS";
-        goto errexit;
+    // Reuse parsed trust/cert/key as long as credential files are unchanged
+    u4_t credid = cred_cat*(SYS_CRED_BOOT+1) + cred_set;
+    u4_t credcrc = sys_crcCred(cred_cat, cred_set);
+    int cached = (tlsconf = tls_findConf(credid, credcrc)) != NULL;
+    if( !cached ) {
+        tlsconf = tls_makeConf();
+        if( !tls_setTrustedCAs(tlsconf, elems[SYS_CRED_TRUST], elemslen[SYS_CRED_TRUST]) ) {
+            errmsg = "%s%s trust certificates rejected by MBedTLS";
+            goto errexit;
+        }
     }
     if( auth == SYS_AUTH_TOKEN ) {
         errmsg = "%s%s has no cert configured - running server auth and client auth with token";
@@ -1474,13 +2574,15 @@ int conn_setup_tls (conn_t* conn, int cred_cat, int cred_set, const char* server
     else if( auth == SYS_AUTH_SERVER ) {
         errmsg = "%s%s has no key+cert configured - running server auth only";
     }
-    else if( !tls_setMyCert(tlsconf,
-                            elems[SYS_CRED_MYCERT], elemslen[SYS_CRED_MYCERT],
-                            elems[SYS_CRED_MYKEY ], elemslen[SYS_CRED_MYKEY ], NULL) ) {
+    else if( !cached && !tls_setMyCert(tlsconf,
+                                       elems[SYS_CRED_MYCERT], elemslen[SYS_CRED_MYCERT],
+                                       elems[SYS_CRED_MYKEY ], elemslen[SYS_CRED_MYKEY ], NULL) ) {
         errmsg = "%s%s key/cert rejected by MBedTLS";
         goto errexit;
     }
     LOG(MOD_AIO|INFO, errmsg, sys_credcat2str(cred_cat), sys_credset2str(cred_set));
+    if( !cached )
+        tls_keepConf(tlsconf, credid, credcrc);
     assert(conn->tlsconf==NULL && conn->tlsctx==NULL);
     conn->tlsconf = tlsconf;
     conn->tlsctx = tls_makeSession(tlsconf, servername);
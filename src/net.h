@@ -35,6 +35,15 @@
 
 struct conn;
 typedef void (*evcb_t)(struct conn*, int ev);
+
+// WS send priority classes - see ws_getSendbufClass
+enum {
+    WSCLASS_TIMESYNC = 0,  // express queue - dropped rather than queued behind other traffic
+    WSCLASS_CONTROL,       // express queue - falls back to normal queue if express queue is full
+    WSCLASS_UPLINK,        // normal queue (default)
+    WSCLASS_BULK,          // normal queue - producers back off on their own (rmtsh)
+    WSCLASS_CNT
+};
 typedef mbedtls_net_context netctx_t;
 
 typedef struct conn {
@@ -42,16 +51,36 @@ typedef struct conn {
     tmr_t    tmr;
     // Read side
     u1_t*    rbuf;
-    doff_t   rbufsize;
-    doff_t   rpos;     // socket fills in data here
-    doff_t   rbeg;     // oldest frame in recv buffer, rbeg[-1] is OPCODE
-    doff_t   rend;     // end of frame, after that starts a WS header
+    u4_t     rbufsize;
+    u4_t     rpos;     // socket fills in data here
+    u4_t     rbeg;     // oldest frame in recv buffer, rbeg[-1] is OPCODE
+    u4_t     rend;     // end of frame, after that starts a WS header
+    u4_t     rbufmax;  // WS: rbuf may grow up to this size
     // Write side
     u1_t*    wbuf;
-    doff_t   wbufsize;
-    doff_t   wpos;     // socket reads data from here and sends it
-    doff_t   wend;     // end of WS frame, after that 2 bytes frame length + frame data
-    doff_t   wfill;    // local producers fill in data here
+    u4_t     wbufsize;
+    u4_t     wpos;     // socket reads data from here and sends it
+    u4_t     wend;     // end of data handed to socket (WS: several complete frames)
+    u4_t     wfill;    // local producers fill in data here
+    u4_t     wwrap;    // WS: if not 0 - end of pending frames at the tail, producers wrapped to start of wbuf
+    u4_t     wbufmax;  // WS: wbuf may grow up to this size
+    u1_t*    xbuf;     // WS: express frames (WSCLASS_TIMESYNC/CONTROL) - sent ahead of frames in wbuf
+    u4_t     xpos;     // socket reads express data from here
+    u4_t     xend;     // end of express data handed to socket (xpos<xend: express batch in progress)
+    u4_t     xfill;    // producers append express frames here
+    u1_t     wclass;   // class of buffer last handed out by ws_getSendbufClass
+    u4_t     wclassBytes[WSCLASS_CNT]; // payload bytes committed per class
+    u4_t     wclassDrops[WSCLASS_CNT]; // send buffer requests failed/dropped per class
+    // WS buffer statistics / flow control
+    u4_t     wpeak;    // max bytes queued in wbuf
+    u2_t     wgrows;   // number of times wbuf was enlarged
+    u2_t     rgrows;   // number of times rbuf was enlarged
+    u1_t     wcongested; // queued data above high watermark - WSEV_SENDLOW pending
+    u1_t     wthrmode;   // WS: hand sending to a writer thread once connected
+    struct wsthr* wthr;  // WS: writer thread state or NULL
+    u1_t     zbits;      // WS: permessage-deflate window bits to offer (0=off)
+    struct wsz*   wsz;   // WS: negotiated permessage-deflate state or NULL
+    struct hev*   hev;   // pending TCP connect attempts or NULL
 
     u1_t     state;
     s1_t     optemp;   // some temp value related to opctx
@@ -147,3 +147,15 @@ int ral_challoc (chdefl_t* upchs, challoc_cb alloc_cb, void* ctx) {
     alloc_cb(ctx, NULL, CHALLOC_DONE);
     return 1;
 }
+
+
+// Adaptive RX FIFO polling: poll every RX_POLL_INTV while frames are flowing
+// and back off towards RX_POLL_IDLE_INTV while the radio is idle.
+ustime_t ral_rxpollIntv (ustime_t* intv, int nframes) {
+    if( nframes > 0 || *intv < RX_POLL_INTV ) {
+        *intv = RX_POLL_INTV;
+    } else {
+        *intv = min(2 * *intv, max(RX_POLL_INTV, RX_POLL_IDLE_INTV));
+    }
+    return *intv;
+}
@@ -102,6 +102,7 @@ struct {
 
 typedef void (*challoc_cb) (void* ctx, challoc_t* ch, int flag);
 int   ral_challoc (chdefl_t* upchs, challoc_cb alloc_cb, void* ctx);
+ustime_t ral_rxpollIntv (ustime_t* intv, int nframes);
 
 int ral_rps2bw (rps_t rps);
 int ral_rps2sf (rps_t rps);
@@ -112,6 +113,7 @@ int   ral_config (str_t hwspec, u4_t cca_region, char* json, int jsonlen, chdefl
 int   ral_txstatus (u1_t txunit);
 void  ral_txabort (u1_t txunit);
 int   ral_tx  (txjob_t* txjob, s2ctx_t* s2ctx, int nocca);
+int   ral_txprep (txjob_t* txjob, s2ctx_t* s2ctx);   // encode HAL TX packet ahead of ral_tx (TX_PRESTAGE) - 0 if not supported
 u1_t  ral_altAntennas (u1_t txunit);
 
 
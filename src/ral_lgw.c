@@ -38,13 +38,14 @@
 #include "sys.h"
 #include "sx130xconf.h"
 #include "ral.h"
+#include "metrics.h"
 #include "lgw/loragw_reg.h"
 #include "lgw/loragw_hal.h"
 #if defined(CFG_sx1302)
 #include "lgw/loragw_sx1302.h"
 #endif // defined(CFG_sx1302)
 
-#define RAL_MAX_RXBURST 10
+#define RAL_MAX_RXBURST 16   // frames fetched from HAL per lgw_receive call
 
 #define FSK_BAUD      50000
 #define FSK_FDEV      25  // [kHz]
@@ -175,6 +176,11 @@ static sL_t       last_xtime;
 static tmr_t      rxpollTmr;
 static tmr_t      syncTmr;
 static tmr_t      tempTmr;
+static u1_t       radioOn;        // concentrator started by ral_config
+static u4_t       startedRegion;  // cca_region the concentrator was started with
+static struct sx130xconf startedConf;  // setup as parsed before sx130xconf_start
+static struct sx130xconf nextConf;     // setup being parsed by ral_config
+static float      rssiAdj[LGW_RF_CHAIN_NB];  // RSSI offset changes applied live - HAL still uses startup values
 
 
 // ATTR_FASTCODE
@@ -185,7 +191,7 @@ static void synctime (tmr_t* tmr) {
     rt_setTimer(&syncTmr, rt_micros_ahead(delay));
 }
 
-static void updatetemp(tmr_t tmr) {
+static void updatetemp(tmr_t* tmr) {
     update_temp_comp_value(&sx130xconf.tx_temp_lut);
     rt_setTimer(&tempTmr, rt_micros_ahead(TEMP_COMP_UPDATE));
 }
@@ -195,49 +201,95 @@ u1_t ral_altAntennas (u1_t txunit) {
 }
 
 
-int ral_tx (txjob_t* txjob, s2ctx_t* s2ctx, int nocca) {
-    struct lgw_pkt_tx_s pkt_tx;
-    memset(&pkt_tx, 0, sizeof(pkt_tx));
+// Pre-staged HAL packet - see ral_txprep
+static struct lgw_pkt_tx_s stagedPkt;
+static txjob_t*   stagedJob;      // job stagedPkt was built for (NULL=none)
+static sL_t       stagedDiid;     // txjobs are recycled - identify by diid as well
+static s2_t       stagedTxpow;
+static u1_t       stagedDr;
+static s2_t       stagedAdjust;   // txpowAdjust used for stagedPkt
+static int        stagedTemp;     // temperature compensation value used for stagedPkt
+
+
+static void txbuild (txjob_t* txjob, s2ctx_t* s2ctx, struct lgw_pkt_tx_s* p) {
+    memset(p, 0, sizeof(*p));
 
     if( txjob->preamble == 0 ) {
         if( txjob->txflags & TXFLAG_BCN ) {
-            pkt_tx.tx_mode = ON_GPS;
-            pkt_tx.preamble = 10;
+            p->tx_mode = ON_GPS;
+            p->preamble = 10;
         } else {
-            pkt_tx.tx_mode = TIMESTAMPED;
-            pkt_tx.preamble = 8;
+            p->tx_mode = TIMESTAMPED;
+            p->preamble = 8;
         }
     } else {
-        pkt_tx.preamble = txjob->preamble;
+        p->preamble = txjob->preamble;
     }
     rps_t rps = s2e_dr2rps(s2ctx, txjob->dr);
-    ral_rps2lgw(rps, &pkt_tx);
-    pkt_tx.freq_hz    = txjob->freq;
-    pkt_tx.count_us   = txjob->xtime;
-    pkt_tx.rf_chain   = 0;
-    pkt_tx.rf_power   = (float)(txjob->txpow - txpowAdjust) / TXPOW_SCALE;
-    pkt_tx.coderate   = CR_LORA_4_5;
-    pkt_tx.invert_pol = true;
-    pkt_tx.no_crc     = !txjob->addcrc;
-    pkt_tx.no_header  = false;
-    pkt_tx.size       = txjob->len;
+    ral_rps2lgw(rps, p);
+    p->freq_hz    = txjob->freq;
+    p->count_us   = txjob->xtime;
+    p->rf_chain   = 0;
+    p->rf_power   = (float)(txjob->txpow - txpowAdjust) / TXPOW_SCALE;
+    p->coderate   = CR_LORA_4_5;
+    p->invert_pol = true;
+    p->no_crc     = !txjob->addcrc;
+    p->no_header  = false;
+    p->size       = txjob->len;
 
     #if !defined(CFG_sx1302)
-    pkt_tx.dig_gain = -1;
+    p->dig_gain = -1;
     #endif
 
-    memcpy(pkt_tx.payload, &s2ctx->txq.txdata[txjob->off], pkt_tx.size);
+    memcpy(p->payload, &s2ctx->txq.txdata[txjob->off], p->size);
 
     #if !defined(CFG_sx1302)
     if (sx130xconf.tx_temp_lut.temp_comp_enabled) {
         int8_t rf_power;
         int8_t dig_gain;
-        lookup_power_settings(&sx130xconf.tx_temp_lut, pkt_tx.rf_power, &rf_power, &dig_gain);
-        LOG(XDEBUG, "Temp Tx Comp temp=%dC rf=%f idx=%d dig=%d pa=%d mix=%d", sx130xconf.tx_temp_lut.temp_comp_value, pkt_tx.rf_power, rf_power, dig_gain, sx130xconf.tx_temp_lut.lut[rf_power].pa_gain, sx130xconf.tx_temp_lut.lut[rf_power].mix_gain);
-        pkt_tx.dig_gain = dig_gain;
-        pkt_tx.rf_power = rf_power;
+        lookup_power_settings(&sx130xconf.tx_temp_lut, p->rf_power, &rf_power, &dig_gain);
+        LOG(XDEBUG, "Temp Tx Comp temp=%dC rf=%f idx=%d dig=%d pa=%d mix=%d", sx130xconf.tx_temp_lut.temp_comp_value, p->rf_power, rf_power, dig_gain, sx130xconf.tx_temp_lut.lut[rf_power].pa_gain, sx130xconf.tx_temp_lut.lut[rf_power].mix_gain);
+        p->dig_gain = dig_gain;
+        p->rf_power = rf_power;
     }
     #endif
+}
+
+
+// Does stagedPkt still match txjob and the current TX power settings?
+static int stagedValid (txjob_t* txjob) {
+    return stagedJob == txjob && stagedDiid == txjob->diid && stagedTxpow == txjob->txpow &&
+        stagedDr == txjob->dr && stagedPkt.freq_hz == txjob->freq &&
+        stagedAdjust == txpowAdjust && stagedTemp == sx130xconf.tx_temp_lut.temp_comp_value;
+}
+
+
+// Encode the HAL TX packet for a queued txjob ahead of time. ral_tx then only patches
+// in the final xtime (re-synced against the latest timesync) and hands it to the HAL.
+// Anything else affecting the packet invalidates the staged copy.
+int ral_txprep (txjob_t* txjob, s2ctx_t* s2ctx) {
+    if( stagedValid(txjob) )
+        return 1;
+    txbuild(txjob, s2ctx, &stagedPkt);
+    stagedJob    = txjob;
+    stagedDiid   = txjob->diid;
+    stagedTxpow  = txjob->txpow;
+    stagedDr     = txjob->dr;
+    stagedAdjust = txpowAdjust;
+    stagedTemp   = sx130xconf.tx_temp_lut.temp_comp_value;
+    return 1;
+}
+
+
+int ral_tx (txjob_t* txjob, s2ctx_t* s2ctx, int nocca) {
+    struct lgw_pkt_tx_s pkt_tx;
+    if( stagedValid(txjob) ) {
+        pkt_tx = stagedPkt;
+        pkt_tx.count_us = txjob->xtime;
+    } else {
+        txbuild(txjob, s2ctx, &pkt_tx);
+    }
+    stagedJob = NULL;
 
     // NOTE: nocca not possible to implement with current libloragw API
 #if defined(CFG_sx1302)
@@ -293,57 +345,86 @@ void ral_txabort (u1_t txunit) {
 #endif
 }
 
+static struct lgw_pkt_rx_s rxpkts[RAL_MAX_RXBURST];
+static ustime_t rxpollIntv;
+
+// Map one received frame into an rxjob - returns 0 if the RX queue is out of space
+static int rxpkt2job (struct lgw_pkt_rx_s* p) {
+    LOG(XDEBUG, "RX mod=%s f=%d bw=%d sz=%d dr=%d %H", p->modulation == 0x10 ? "LORA" : "FSK", p->freq_hz, (int[]){0,500,250,125}[p->bandwidth], p->size, p->datarate, p->size, p->payload);
+
+    if( p->status != STAT_CRC_OK ) {
+        LOG(XDEBUG, "Dropped frame without CRC or with broken CRC");
+        metric_inc(MC_rx_drop_crc);
+        return 1; // silently ignore bad CRC
+    }
+    if( p->size > MAX_RXFRAME_LEN ) {
+        // This should not happen since caller provides
+        // space for max frame length - 255 bytes
+        LOG(MOD_RAL|ERROR, "Frame size (%d) exceeds offered buffer (%d)", p->size, MAX_RXFRAME_LEN);
+        return 1;
+    }
+    if( !TC ) {
+        // Radio lingering between TC sessions - nowhere to queue the frame
+        LOG(XDEBUG, "SX130X RX frame dropped - no TC session");
+        metric_inc(MC_rx_drop_nosession);
+        return 1;
+    }
+    rxjob_t* rxjob = s2e_nextRxjob(&TC->s2ctx);
+    if( rxjob == NULL ) {
+        // Make room by pushing out what is queued and try again
+        s2e_flushRxjobs(&TC->s2ctx);
+        rxjob = s2e_nextRxjob(&TC->s2ctx);
+    }
+    if( rxjob == NULL ) {
+        LOG(ERROR, "SX130X RX frame dropped - out of space");
+        metric_inc(MC_rx_drop_nospace);
+        return 0;
+    }
+    memcpy(&TC->s2ctx.rxq.rxdata[rxjob->off], p->payload, p->size);
+    rxjob->len   = p->size;
+    rxjob->freq  = p->freq_hz;
+    rxjob->xtime = ts_xticks2xtime(p->count_us, last_xtime);
+#if defined(CFG_sx1302)
+    rxjob->rssi  = (u1_t)-(p->rssis + rssiAdj[p->rf_chain % LGW_RF_CHAIN_NB]);
+#else
+    rxjob->rssi  = (u1_t)-(p->rssi + rssiAdj[p->rf_chain % LGW_RF_CHAIN_NB]);
+#endif
+    rxjob->snr   = (s1_t)(p->snr*4);
+    rps_t rps = ral_lgw2rps(p);
+    rxjob->dr = s2e_rps2dr(&TC->s2ctx, rps);
+    if( rxjob->dr == DR_ILLEGAL ) {
+        LOG(MOD_RAL|ERROR, "Unable to map to an up DR: %R", rps);
+        return 1;
+    }
+    s2e_addRxjob(&TC->s2ctx, rxjob);
+    return 1;
+}
+
 //ATTR_FASTCODE
 static void rxpolling (tmr_t* tmr) {
-    int rounds = 0;
-    while(rounds++ < RAL_MAX_RXBURST) {
-        struct lgw_pkt_rx_s pkt_rx;
-        int n = lgw_receive(1, &pkt_rx);
-        if( n < 0 || n > 1 ) {
+    // Drain the HAL FIFO with as few SPI transactions as possible
+    int total = 0, n;
+    do {
+        n = lgw_receive(RAL_MAX_RXBURST, rxpkts);
+        if( n < 0 || n > RAL_MAX_RXBURST ) {
             LOG(MOD_RAL|ERROR, "lgw_receive error: %d", n);
             break;
         }
-        if( n==0 ) {
+        total += n;  // also frames dropped below - a full RX queue must keep the fast poll rate
+        int i = 0;
+        while( i < n && rxpkt2job(&rxpkts[i]) )
+            i++;
+        if( i < n ) {
+            if( n-i-1 > 0 ) {
+                LOG(ERROR, "SX130X RX %d more frames dropped - out of space", n-i-1);
+                metric_add(MC_rx_drop_nospace, n-i-1);
+            }
             break;
         }
-        LOG(XDEBUG, "RX mod=%s f=%d bw=%d sz=%d dr=%d %H", pkt_rx.modulation == 0x10 ? "LORA" : "FSK", pkt_rx.freq_hz, (int[]){0,500,250,125}[pkt_rx.bandwidth], pkt_rx.size, pkt_rx.datarate, pkt_rx.size, pkt_rx.payload);
-
-        rxjob_t* rxjob = !TC ? NULL : s2e_nextRxjob(&TC->s2ctx);
-        if( rxjob == NULL ) {
-            LOG(ERROR, "SX130X RX frame dropped - out of space");
-            break; // Allow to flush RX jobs
-        }
-        if( pkt_rx.status != STAT_CRC_OK ) {
-            LOG(XDEBUG, "Dropped frame without CRC or with broken CRC");
-            continue; // silently ignore bad CRC
-        }
-        if( pkt_rx.size > MAX_RXFRAME_LEN ) {
-            // This should not happen since caller provides
-            // space for max frame length - 255 bytes
-            LOG(MOD_RAL|ERROR, "Frame size (%d) exceeds offered buffer (%d)", pkt_rx.size, MAX_RXFRAME_LEN);
-            continue;
-        }
-        memcpy(&TC->s2ctx.rxq.rxdata[rxjob->off], pkt_rx.payload, pkt_rx.size);
-        rxjob->len   = pkt_rx.size;
-        rxjob->freq  = pkt_rx.freq_hz;
-        rxjob->xtime = ts_xticks2xtime(pkt_rx.count_us, last_xtime);
-#if defined(CFG_sx1302)
-        rxjob->rssi  = (u1_t)-pkt_rx.rssis;
-#else
-        rxjob->rssi  = (u1_t)-pkt_rx.rssi;
-#endif
-        rxjob->snr   = (s1_t)(pkt_rx.snr*4);
-        rps_t rps = ral_lgw2rps(&pkt_rx);
-        rxjob->dr = s2e_rps2dr(&TC->s2ctx, rps);
-        if( rxjob->dr == DR_ILLEGAL ) {
-            LOG(MOD_RAL|ERROR, "Unable to map to an up DR: %R", rps);
-            continue;
-        }
-        s2e_addRxjob(&TC->s2ctx, rxjob);
-
-    }
-    s2e_flushRxjobs(&TC->s2ctx);
-    rt_setTimer(tmr, rt_micros_ahead(RX_POLL_INTV));
+    } while( n == RAL_MAX_RXBURST );  // FIFO possibly not yet empty
+    if( TC )
+        s2e_flushRxjobs(&TC->s2ctx);
+    rt_setTimer(tmr, rt_micros_ahead(ral_rxpollIntv(&rxpollIntv, total)));
 }
 
 
@@ -370,25 +451,52 @@ int ral_config (str_t hwspec, u4_t cca_region, char* json, int jsonlen, chdefl_t
             int status = 0;
 
             // Zero and setup some defaults
-            memset(&sx130xconf, 0, sizeof(sx130xconf));
+            memset(&nextConf, 0, sizeof(nextConf));
 
             // set default antenna gain to 3.0 dBi
             LOG(MOD_RAL|INFO, "Set default antenna gain to 3.0 dBi");
-            sx130xconf.txpowAdjust = 3.0 * TXPOW_SCALE;
+            nextConf.txpowAdjust = 3.0 * TXPOW_SCALE;
 
 #if !defined(CFG_sx1302)
-            if( (status = !sx130xconf_parse_tcomp(&sx130xconf, -1, hwspec, json.buf, json.bufsize) << 0) ||
-                (status = !sx130xconf_parse_setup(&sx130xconf, -1, hwspec, json.buf, json.bufsize) << 1) ||
+            if( (status = !sx130xconf_parse_tcomp(&nextConf, -1, hwspec, json.buf, json.bufsize) << 0) ||
+                (status = !sx130xconf_parse_setup(&nextConf, -1, hwspec, json.buf, json.bufsize) << 1) ||
 #else
-            if( (status = !sx130xconf_parse_setup(&sx130xconf, -1, hwspec, json.buf, json.bufsize) << 1) ||
+            if( (status = !sx130xconf_parse_setup(&nextConf, -1, hwspec, json.buf, json.bufsize) << 1) ||
 #endif
-                (status = !sx130xconf_challoc(&sx130xconf, upchs)    << 2) ||
-                (status = !sys_runRadioInit(sx130xconf.device)       << 3) ||
+                (status = !sx130xconf_challoc(&nextConf, upchs)    << 2) ) {
+                LOG(MOD_RAL|ERROR, "ral_config failed with status 0x%02x", status);
+                continue;
+            }
+            if( radioOn && cca_region == startedRegion && sx130xconf_isLiveUpdate(&startedConf, &nextConf) ) {
+                // Only TX gains, temp comp, RSSI offsets, PPS changed - keep concentrator running
+                if( sx130xconf_updateLive(&sx130xconf, &nextConf, rssiAdj) ) {
+                    startedConf = nextConf;
+                    txpowAdjust = sx130xconf.txpowAdjust;
+                    pps_en = sx130xconf.pps;
+#if !defined(CFG_sx1302)
+                    rt_clrTimer(&tempTmr);
+                    if (sx130xconf.tx_temp_lut.temp_comp_enabled) {
+                        strncpy(sx130xconf.tx_temp_lut.temp_comp_file, DEFAULT_TEMP_COMP_FILE, sizeof(sx130xconf.tx_temp_lut.temp_comp_file)-1);
+                        rt_yieldTo(&tempTmr, updatetemp);
+                    }
+#endif
+                    ok = 1;
+                    continue;
+                }
+                LOG(MOD_RAL|WARNING, "Live radio config update failed - restarting concentrator");
+            }
+            radioOn = 0;
+            startedConf = nextConf;
+            startedRegion = cca_region;
+            sx130xconf = nextConf;
+            memset(rssiAdj, 0, sizeof(rssiAdj));
+            if( (status = !sys_runRadioInit(sx130xconf.device)       << 3) ||
                 (status = !sx130xconf_start(&sx130xconf, cca_region) << 4) ) {
                 LOG(MOD_RAL|ERROR, "ral_config failed with status 0x%02x", status);
             } else {
 
                 // Radio started
+                radioOn = 1;
                 txpowAdjust = sx130xconf.txpowAdjust;
                 pps_en = sx130xconf.pps;
 
@@ -423,10 +531,16 @@ void ral_ini() {
 #if !defined(CFG_sx1302)
     rt_iniTimer(&tempTmr, updatetemp);
 #endif
+    // Device is known from station.conf - reset/init the radio while TC connects
+    struct sx130xconf conf;
+    memset(&conf, 0, sizeof(conf));
+    if( sx130xconf_parse_setup(&conf, -1, "sx1301/1", "{}", 2) )
+        sys_preRadioInit(conf.device);
 }
 
 void ral_stop() {
     lgw_stop();
+    radioOn = 0;
     last_xtime = 0;
     rt_clrTimer(&rxpollTmr);
     rt_clrTimer(&syncTmr);
@@ -42,6 +42,7 @@
 #endif // defined(CFG_linux)
 #include "sx1301v2conf.h"
 #include "ral.h"
+#include "metrics.h"
 #include "lgw2/sx1301ar_err.h"
 #include "lgw2/sx1301ar_gps.h"
 #include "lgw2/spi_linuxdev.h"
@@ -190,6 +191,12 @@ u1_t ral_altAntennas (u1_t txunit) {
 }
 
 
+// Pre-staging not supported - ral_tx does all the work
+int ral_txprep (txjob_t* txjob, s2ctx_t* s2ctx) {
+    return 0;
+}
+
+
 int ral_tx (txjob_t* txjob, s2ctx_t* s2ctx, int nocca) {
     sx1301ar_tx_pkt_t pkt_tx = sx1301ar_init_tx_pkt();
 
@@ -247,7 +254,10 @@ void ral_txabort (u1_t txunit) {
         LOG(MOD_RAL|ERROR, "sx1301ar_abort_tx failed: %s", sx1301ar_err_message(sx1301ar_errno));
 }
 
+static ustime_t rxpollIntv;
+
 static void rxpolling (tmr_t* tmr) {
+    int total = 0;
     while(1) {
         sx1301ar_rx_pkt_t pkt_rx[SX1301AR_MAX_PKT_NB];
         u1_t n;
@@ -259,15 +269,24 @@ static void rxpolling (tmr_t* tmr) {
         if( n==0 ) {
             break;
         }
+        total += n;
         for( int i=0; i<n; i++ ) {
-            rxjob_t* rxjob = !TC ? NULL : s2e_nextRxjob(&TC->s2ctx);
+            if( !TC ) {
+                // Radio lingering between TC sessions - nowhere to queue the frame
+                LOG(XDEBUG, "SX1301 RX frame dropped - no TC session");
+                metric_inc(MC_rx_drop_nosession);
+                continue;
+            }
+            rxjob_t* rxjob = s2e_nextRxjob(&TC->s2ctx);
             if( rxjob == NULL ) {
                 LOG(ERROR, "SX1301 RX frame dropped - out of space");
+                metric_inc(MC_rx_drop_nospace);
                 continue;
             }
             sx1301ar_rx_pkt_t* p = &pkt_rx[i];
             if( p->status != STAT_CRC_OK ) {
                 LOG(XDEBUG, "Dropped frame without CRC or with broken CRC");
+                metric_inc(MC_rx_drop_crc);
                 continue; // silently ignore bad CRC
             }
             if( p->size > MAX_RXFRAME_LEN ) {
@@ -306,7 +325,7 @@ static void rxpolling (tmr_t* tmr) {
         }
     }
     s2e_flushRxjobs(&TC->s2ctx);
-    rt_setTimer(tmr, rt_micros_ahead(RX_POLL_INTV));
+    rt_setTimer(tmr, rt_micros_ahead(ral_rxpollIntv(&rxpollIntv, total)));
 }
 
 int ral_config (str_t hwspec, u4_t cca_region, char* json, int jsonlen, chdefl_t* upchs) {
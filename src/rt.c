@@ -28,15 +28,26 @@
 
 #include "sys.h"
 #include "rt.h"
+#include "metrics.h"
 
 // More recent version of protocol uses standards compliant
 // fields with capital EUI spelling
 str_t rt_deveui  = "DevEui";
 str_t rt_joineui = "JoinEui";
 
+#if defined(CFG_timerheap)
+// Timers are kept in a binary min heap ordered by deadline - ties are broken
+// by the order in which timers were armed (same as the linked list variant).
+// Set/clear are O(log n). A queued timer has next=TMR_END, hidx is its slot.
+static tmr_t** timerHeap;
+static u4_t    timerHeapSize;  // allocated slots
+static u4_t    timerHeapCnt;   // used slots
+static u4_t    timerSeqno;
+#else // !defined(CFG_timerheap)
 // We're using a simple linked list.
 // Complexity is O(n) but we don't expect to have many entries on a router.
 static tmr_t* timerQ = TMR_END;
+#endif // !defined(CFG_timerheap)
 // Buffer holding feature list
 static dbuf_t features;
 
@@ -45,6 +56,14 @@ ustime_t rt_utcOffset_ts;
 
 
 void rt_usleep (sL_t us) {
+#if defined(CFG_simclock)
+    if( rt_simTime ) {
+        // Give peers a bit of real time - the rest is skipped
+        sys_usleep(min(us, rt_simQuantum));
+        rt_simAdvance(rt_simTime + us);
+        return;
+    }
+#endif // defined(CFG_simclock)
     sys_usleep(us);
 }
 
@@ -54,7 +73,26 @@ uL_t rt_eui() {
 }
 
 
+#if defined(CFG_simclock)
+ustime_t rt_simTime;
+ustime_t rt_simQuantum;
+
+void rt_simClock (ustime_t start, ustime_t quantum) {
+    rt_simTime = start;
+    rt_simQuantum = quantum;
+}
+
+void rt_simAdvance (ustime_t deadline) {
+    if( deadline > rt_simTime && deadline != USTIME_MAX )
+        rt_simTime = deadline;
+}
+#endif // defined(CFG_simclock)
+
 ustime_t rt_getTime () {
+#if defined(CFG_simclock)
+    if( rt_simTime )
+        return rt_simTime;
+#endif // defined(CFG_simclock)
     return (ustime_t)sys_time();
 }
 
@@ -135,25 +173,101 @@ void rt_ini() {
 }
 
 
+#if defined(CFG_timerheap)
+
+static inline int tmrBefore (tmr_t* a, tmr_t* b) {
+    return a->deadline < b->deadline || (a->deadline == b->deadline && (s4_t)(a->seqno - b->seqno) < 0);
+}
+
+static inline void heapPlace (tmr_t* tmr, u4_t idx) {
+    timerHeap[idx] = tmr;
+    tmr->hidx = idx;
+}
+
+static void heapSiftUp (tmr_t* tmr, u4_t idx) {
+    while( idx > 0 ) {
+        u4_t parent = (idx-1)/2;
+        if( !tmrBefore(tmr, timerHeap[parent]) )
+            break;
+        heapPlace(timerHeap[parent], idx);
+        idx = parent;
+    }
+    heapPlace(tmr, idx);
+}
+
+static void heapSiftDown (tmr_t* tmr, u4_t idx) {
+    u4_t n = timerHeapCnt;
+    while(1) {
+        u4_t child = 2*idx+1;
+        if( child >= n )
+            break;
+        if( child+1 < n && tmrBefore(timerHeap[child+1], timerHeap[child]) )
+            child += 1;
+        if( !tmrBefore(timerHeap[child], tmr) )
+            break;
+        heapPlace(timerHeap[child], idx);
+        idx = child;
+    }
+    heapPlace(tmr, idx);
+}
+
+static void heapRemove (tmr_t* tmr) {
+    u4_t idx = tmr->hidx;
+    assert(idx < timerHeapCnt && timerHeap[idx] == tmr);
+    tmr_t* last = timerHeap[--timerHeapCnt];
+    tmr->next = TMR_NIL;
+    if( last == tmr )
+        return;
+    if( idx > 0 && tmrBefore(last, timerHeap[(idx-1)/2]) )
+        heapSiftUp(last, idx);
+    else
+        heapSiftDown(last, idx);
+}
+
+
+static inline tmr_t* headTimer () {
+    return timerHeapCnt == 0 ? TMR_END : timerHeap[0];
+}
+
+static inline void unqHeadTimer (tmr_t* head) {
+    heapRemove(head);
+}
+
+#else // !defined(CFG_timerheap)
+
+static inline tmr_t* headTimer () {
+    return timerQ;
+}
+
+static inline void unqHeadTimer (tmr_t* head) {
+    timerQ = head->next;
+    head->next = TMR_NIL;
+}
+
+#endif // !defined(CFG_timerheap)
+
+
 ATTR_FASTCODE
 ustime_t rt_processTimerQ () {
     while(1) {
-        if( timerQ == TMR_END )
+        tmr_t* expired = headTimer();
+        if( expired == TMR_END )
             return USTIME_MAX;
+        ustime_t now = rt_getTime();
+        ustime_t lag = now - expired->deadline;
 #if defined(CFG_timerfd)
-        ustime_t deadline = timerQ->deadline;
-        if( (deadline - rt_getTime()) > 0 )
-            return deadline;
+        if( lag < 0 )
+            return expired->deadline;
 #else // !defined(CFG_timerfd)
-        ustime_t ahead;
-        if( (ahead = timerQ->deadline - rt_getTime()) > 0 )
-            return ahead;
+        if( lag < 0 )
+            return -lag;
 #endif // !defined(CFG_timerfd)
-        tmr_t* expired = timerQ;
-        timerQ = expired->next;
-        expired->next = TMR_NIL;
-        if (expired->callback) {
-            expired->callback(expired);
+        metric_obs(MH_timer_lag, lag);
+        unqHeadTimer(expired);
+        tmrcb_t cb = expired->callback;
+        if (cb) {
+            cb(expired);    // might free/reuse expired
+            metrics_profCb(cb, PROF_TIMER, now);
         } else {
             LOG(ERROR, "Timer due with NULL callback (tmr %p)", expired);
         }
@@ -161,6 +275,14 @@ ustime_t rt_processTimerQ () {
 }
 
 
+#if defined(CFG_simclock)
+ustime_t rt_nextDeadline () {
+    tmr_t* head = headTimer();
+    return head == TMR_END ? USTIME_MAX : head->deadline;
+}
+#endif // defined(CFG_simclock)
+
+
 void rt_iniTimer (tmr_t* tmr, tmrcb_t callback) {
     tmr->next     = TMR_NIL;
     tmr->deadline = rt_getTime();
@@ -181,6 +303,20 @@ void rt_setTimer (tmr_t* tmr, ustime_t deadline) {
     if( tmr->next != TMR_NIL )
         rt_clrTimer(tmr); // still active
     tmr->deadline = deadline;
+#if defined(CFG_timerheap)
+    if( timerHeapCnt == timerHeapSize ) {
+        u4_t sz = max(timerHeapSize*2, 32);
+        tmr_t** h = rt_mallocN(tmr_t*, sz);
+        if( timerHeapCnt > 0 )
+            memcpy(h, timerHeap, timerHeapCnt*sizeof(h[0]));
+        rt_free(timerHeap);
+        timerHeap = h;
+        timerHeapSize = sz;
+    }
+    tmr->next = TMR_END;
+    tmr->seqno = timerSeqno++;
+    heapSiftUp(tmr, timerHeapCnt++);
+#else // !defined(CFG_timerheap)
     tmr_t *p, **pp = &timerQ;
     while( (p = *pp) != TMR_END ) {
         if( deadline < p->deadline )
@@ -189,6 +325,7 @@ void rt_setTimer (tmr_t* tmr, ustime_t deadline) {
     }
     tmr->next = p;
     *pp = tmr;
+#endif // !defined(CFG_timerheap)
 }
 
 
@@ -201,6 +338,9 @@ void rt_yieldTo (tmr_t* tmr, tmrcb_t callback) {
 void rt_clrTimer (tmr_t* tmr) {
     if( (tmr == NULL || tmr == TMR_END) || tmr->next == TMR_NIL )
         return;  // not active or NULL
+#if defined(CFG_timerheap)
+    heapRemove(tmr);
+#else // !defined(CFG_timerheap)
     tmr_t *p, **pp = &timerQ;
     while( (p = *pp) != TMR_END ) {
         if( p == tmr ) {
@@ -211,6 +351,7 @@ void rt_clrTimer (tmr_t* tmr) {
         pp = &p->next;
     }
     assert(0);     // LCOV_EXCL_LINE
+#endif // !defined(CFG_timerheap)
 }
 
 
@@ -231,8 +372,32 @@ uL_t rt_rlsbf8 (const u1_t* buf) {
     return rt_rlsbf4(buf) | ((uL_t)rt_rlsbf4(buf+4) << 32);
 }
 
+void rt_wlsbf2 (u1_t* buf, u2_t v) {
+    buf[0] = v;
+    buf[1] = v>>8;
+}
+
+void rt_wlsbf4 (u1_t* buf, u4_t v) {
+    buf[0] = v;
+    buf[1] = v>>8;
+    buf[2] = v>>16;
+    buf[3] = v>>24;
+}
+
+void rt_wlsbf8 (u1_t* buf, uL_t v) {
+    rt_wlsbf4(buf, (u4_t)v);
+    rt_wlsbf4(buf+4, (u4_t)(v>>32));
+}
+
+
+#if defined(CFG_benchmarks)
+u4_t rt_nallocs;
+#endif // defined(CFG_benchmarks)
 
 void* _rt_malloc(int size, int zero) {
+#if defined(CFG_benchmarks)
+    rt_nallocs += 1;
+#endif // defined(CFG_benchmarks)
     void* p = malloc(size);
     if( p == NULL )
         rt_fatal("Out of memory - requesting %d bytes", size);
@@ -252,6 +417,104 @@ void _rt_free_d (void* p, const char* f, int l) {
     free(p);
 }
 
+// --------------------------------------------------------------------------------
+// Arena allocator
+// --------------------------------------------------------------------------------
+
+#define ARENA_ALIGN 16
+#define ARENA_ROUND(n) (((n) + ARENA_ALIGN-1) & ~(ARENA_ALIGN-1))
+
+struct rt_arenablk {
+    rt_arenablk_t* next;
+    u4_t size;               // usable bytes after header
+    u4_t used;
+};
+
+#define ARENA_HDRSZ ARENA_ROUND((int)sizeof(rt_arenablk_t))
+
+#if defined(CFG_variant_debug)
+static u4_t arenaPeakAll;    // max of all arena footprints seen
+#endif // defined(CFG_variant_debug)
+
+
+void rt_arenaIni (rt_arena_t* a, int blksize) {
+    memset(a, 0, sizeof(*a));
+    a->blksize = ARENA_ROUND(max(blksize, 256));
+}
+
+
+void rt_arenaFree (rt_arena_t* a) {
+    rt_arenablk_t* b = a->blks;
+    while( b ) {
+        rt_arenablk_t* n = b->next;
+        rt_free(b);
+        b = n;
+    }
+    u4_t blksize = a->blksize;
+    memset(a, 0, sizeof(*a));
+    a->blksize = blksize;
+}
+
+
+void* rt_arenaAlloc (rt_arena_t* a, int size) {
+    if( a == NULL )
+        return _rt_malloc(size, 1);
+    u4_t sz = ARENA_ROUND(max(size,1));
+    rt_arenablk_t* b = a->blks;
+    if( b == NULL || b->used + sz > b->size ) {
+        u4_t bsz = max(sz, a->blksize);
+        b = _rt_malloc(ARENA_HDRSZ + bsz, 0);
+        b->size = bsz;
+        b->used = 0;
+        // Keep the block with more room at the head - an oversized object
+        // must not retire a barely used current block.
+        if( a->blks && a->blks->size - a->blks->used > bsz - sz ) {
+            b->next = a->blks->next;
+            a->blks->next = b;
+        } else {
+            b->next = a->blks;
+            a->blks = b;
+        }
+        a->nblks += 1;
+        a->total += ARENA_HDRSZ + bsz;
+        a->peak = max(a->peak, a->total);
+#if defined(CFG_variant_debug)
+        arenaPeakAll = max(arenaPeakAll, a->total);
+#endif // defined(CFG_variant_debug)
+    }
+    void* p = (u1_t*)b + ARENA_HDRSZ + b->used;
+    b->used += sz;
+    a->used += sz;
+    a->nallocs += 1;
+    memset(p, 0, size);
+    return p;
+}
+
+
+void rt_arenaRelease (rt_arena_t* a, void* p) {
+    if( a == NULL )
+        rt_free(p);
+}
+
+
+char* rt_arenaStrdup (rt_arena_t* a, str_t s) {
+    if( s == NULL ) return NULL;
+    int n = strlen(s);
+    return memcpy(rt_arenaAlloc(a, n+1), s, n+1);
+}
+
+
+#if defined(CFG_variant_debug)
+void rt_arenaReport (rt_arena_t* a, str_t what) {
+    // Slack: bytes held but not handed out - stranded block tails and the unused rest of the current block
+    u4_t slack = a->total - a->used - a->nblks*ARENA_HDRSZ;
+    LOG(MOD_SYS|INFO, "Arena %s: %d objs in %d blks - used %u / held %u bytes (slack %u, %d%%) - peak %u (all arenas %u)",
+        what, a->nallocs, a->nblks, a->used, a->total, slack,
+        a->total ? (int)(100*(uL_t)slack/a->total) : 0, a->peak, arenaPeakAll);
+}
+#endif // defined(CFG_variant_debug)
+
+
 char* rt_strdup (str_t s) {
     if( s == NULL ) return NULL;
     return strcpy(_rt_malloc(strlen(s)+1, 0), s);
@@ -528,13 +791,82 @@ static const uint32_t crc_table[256] = {
     0xB3667A2E,0xC4614AB8,0x5D681B02,0x2A6F2B94,0xB40BBE37,0xC30C8EA1,0x5A05DF1B,0x2D02EF8D,
 };
 
-u4_t rt_crc32 (u4_t crc, const void* buf, int size) {
-    const u1_t *p = (u1_t*)buf;
-
-    crc = crc ^ ~0U;
+// Slicing-by-8: crc_slices[k][b] is the CRC of byte b followed by k zero bytes.
+// Derived from crc_table on first use.
+static u4_t crc_slices[8][256];
+static u1_t crc_slicesReady;
+
+static void iniCrcSlices () {
+    for( int b=0; b<256; b++ )
+        crc_slices[0][b] = crc_table[b];
+    for( int k=1; k<8; k++ ) {
+        for( int b=0; b<256; b++ ) {
+            u4_t c = crc_slices[k-1][b];
+            crc_slices[k][b] = crc_table[c & 0xFF] ^ (c >> 8);
+        }
+    }
+    crc_slicesReady = 1;
+}
+
+static u4_t crc32_sliced (u4_t crc, const u1_t* p, int size) {
+    if( !crc_slicesReady )
+        iniCrcSlices();
+    while( size >= 8 ) {
+        u4_t a = crc ^ (p[0] | (p[1]<<8) | (p[2]<<16) | ((u4_t)p[3]<<24));
+        u4_t b =        p[4] | (p[5]<<8) | (p[6]<<16) | ((u4_t)p[7]<<24);
+        crc = (crc_slices[7][ a     &0xFF] ^ crc_slices[6][(a>> 8)&0xFF] ^
+               crc_slices[5][(a>>16)&0xFF] ^ crc_slices[4][ a>>24      ] ^
+               crc_slices[3][ b     &0xFF] ^ crc_slices[2][(b>> 8)&0xFF] ^
+               crc_slices[1][(b>>16)&0xFF] ^ crc_slices[0][ b>>24      ]);
+        p += 8;
+        size -= 8;
+    }
     while( size-- > 0 )
         crc = crc_table[(crc ^ *p++) & 0xFF] ^ (crc >> 8);
-    return crc ^ ~0U;
+    return crc;
+}
+
+#if defined(__aarch64__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && defined(CFG_linux) && !defined(CFG_no_hwcrc)
+// ARMv8 CRC32 instructions use the same polynomial (0xEDB88320 reflected).
+// Availability is checked at runtime - binaries also run on cores without it.
+// (x86 SSE4.2 crc32 implements CRC-32C and is therefore not usable here.)
+#include <sys/auxv.h>
+#include <arm_acle.h>
+#ifndef HWCAP_CRC32
+#define HWCAP_CRC32 (1 << 7)
+#endif
+
+__attribute__((target("+crc")))
+static u4_t crc32_armv8 (u4_t crc, const u1_t* p, int size) {
+    while( size > 0 && ((uintptr_t)p & 7) ) {
+        crc = __crc32b(crc, *p++);
+        size--;
+    }
+    while( size >= 8 ) {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        crc = __crc32d(crc, v);
+        p += 8;
+        size -= 8;
+    }
+    while( size-- > 0 )
+        crc = __crc32b(crc, *p++);
+    return crc;
+}
+
+static u4_t crc32_select (u4_t crc, const u1_t* p, int size);
+static u4_t (*crc32_impl) (u4_t crc, const u1_t* p, int size) = crc32_select;
+
+static u4_t crc32_select (u4_t crc, const u1_t* p, int size) {
+    crc32_impl = (getauxval(AT_HWCAP) & HWCAP_CRC32) ? crc32_armv8 : crc32_sliced;
+    return crc32_impl(crc, p, size);
+}
+#else
+#define crc32_impl crc32_sliced
+#endif
+
+u4_t rt_crc32 (u4_t crc, const void* buf, int size) {
+    return crc32_impl(crc ^ ~0U, (const u1_t*)buf, size) ^ ~0U;
 }
 
 void rt_addFeature (str_t s) {
@@ -119,12 +119,15 @@ int   log_setLevel (int level);
 str_t log_parseLevels (const char* levels);
 int   log_str2level (const char* level);
 int   log_shallLog (u1_t mod_level);
+void  log_setRate (int level, int rate);  // MOD of level: max lines per second (0=unlimited)
 void  log_msg (u1_t mod_level, const char* fmt, ...);
 void  log_vmsg (u1_t mod_level, const char* fmt, va_list args);
 int   log_special (u1_t mod_level, dbuf_t* buf);
 void  log_specialFlush (int len);
 void  log_flush ();
 void  log_flushIO ();
+int   log_packRecord (u1_t* rec, int recsize, u1_t mod_level, ustime_t utc, const char* fmt, va_list args); // 0 if no fit
+int   log_fmtRecord (char* buf, int bufsize, const u1_t* rec, int reclen);  // deferred record => log line
 
 
 #if defined(CFG_log_file_line)
@@ -164,6 +167,10 @@ typedef struct tmr {
     ustime_t    deadline;
     tmrcb_t     callback;
     void*       ctx;
+#if defined(CFG_timerheap)
+    u4_t        hidx;     // position in timer heap (valid if next != TMR_NIL)
+    u4_t        seqno;    // order of arming - keeps timers with same deadline FIFO
+#endif // defined(CFG_timerheap)
 } tmr_t;
 
 
@@ -191,6 +198,17 @@ ustime_t rt_getUTC ();
 ustime_t rt_ustime2utc (ustime_t ustime);
 struct datetime rt_datetime (ustime_t ustime);
 
+#if defined(CFG_simclock)
+// Simulated time - clock only moves if the process would otherwise wait:
+// rt_usleep and aio_loop if no I/O showed up within rt_simQuantum real time.
+// Then time jumps to the next timer deadline (discrete event simulation).
+extern ustime_t rt_simTime;      // current simulated time - 0 = running on system time
+extern ustime_t rt_simQuantum;   // real time granted to pending I/O before idle time is skipped
+void     rt_simClock     (ustime_t start, ustime_t quantum);   // start=0 returns to system time
+void     rt_simAdvance   (ustime_t deadline);                  // never moves backwards
+ustime_t rt_nextDeadline ();                                   // earliest armed timer - USTIME_MAX if none
+#endif // defined(CFG_simclock)
+
 #define rt_seconds(n) ((ustime_t)((n)*(ustime_t)1000000))
 #define rt_millis(n)  ((ustime_t)((n)*(ustime_t)1000))
 #define rt_micros_ahead(n)  (rt_getTime()+(n))
@@ -201,6 +219,9 @@ u2_t rt_rlsbf2 (const u1_t* buf);
 u2_t rt_rmsbf2 (const u1_t* buf);
 u4_t rt_rlsbf4 (const u1_t* buf);
 uL_t rt_rlsbf8 (const u1_t* buf);
+void rt_wlsbf2 (u1_t* buf, u2_t v);
+void rt_wlsbf4 (u1_t* buf, u4_t v);
+void rt_wlsbf8 (u1_t* buf, uL_t v);
 
 char*   rt_strdup   (str_t s);
 char*   rt_strdupn  (str_t s, int n);
@@ -209,6 +230,9 @@ char*   rt_strdupq  (str_t s);
 void*  _rt_malloc   (int size, int zero);
 void*  _rt_malloc_d (int size, int zero, const char* f, int l);
 void   _rt_free_d   (void* p, const char* f, int l);
+#if defined(CFG_benchmarks)
+extern u4_t rt_nallocs;  // calls to _rt_malloc
+#endif // defined(CFG_benchmarks)
 
 #if defined(CFG_variant_debug)
 #define rt_malloc(type)      ((type*)_rt_malloc_d(sizeof(type), 1, __FILE__, __LINE__))
@@ -220,6 +244,33 @@ void   _rt_free_d   (void* p, const char* f, int l);
 #define rt_free              free
 #endif
 
+// Bump allocator for objects sharing one lifetime (e.g. a TC session).
+// Memory is taken from a chain of blocks and only given back in one go
+// by rt_arenaFree - individual objects are never freed. Sizing the first
+// block to fit all expected objects turns many small heap allocations into one.
+// A NULL arena falls back to the regular heap.
+typedef struct rt_arenablk rt_arenablk_t;
+
+typedef struct rt_arena {
+    rt_arenablk_t* blks;     // current block first
+    u4_t     blksize;        // size of additional blocks
+    u4_t     used;           // bytes handed out (incl. alignment padding)
+    u4_t     total;          // bytes held in blocks
+    u4_t     peak;           // max total since rt_arenaIni
+    u2_t     nblks;          // blocks in chain
+    u2_t     nallocs;        // objects handed out
+} rt_arena_t;
+
+void   rt_arenaIni    (rt_arena_t* a, int blksize);
+void   rt_arenaFree   (rt_arena_t* a);
+void*  rt_arenaAlloc  (rt_arena_t* a, int size);       // zeroed
+void   rt_arenaRelease(rt_arena_t* a, void* p);        // nop for arena objects, rt_free if a==NULL
+char*  rt_arenaStrdup (rt_arena_t* a, str_t s);
+#if defined(CFG_variant_debug)
+void   rt_arenaReport (rt_arena_t* a, str_t what);
+#endif // defined(CFG_variant_debug)
+#define rt_arenaMallocN(a,type,num) ((type*)rt_arenaAlloc(a, sizeof(type)*(num)))
+
 int  rt_hexDigit (int c);  // expose this - it's useful elsewhere
 sL_t rt_readDec  (str_t* pp);
 uL_t rt_readEui  (str_t* pp, int len);
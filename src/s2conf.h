@@ -36,14 +36,16 @@
 #define DFLT_CUPS_BUFSZ           "\"8KB\""
 /* TC */
 #define DFLT_MAX_RXDATA           (10*1024)
-#define DFLT_MAX_TXDATA           (16*1024)
+#define DFLT_TX_DATA              "\"16KB\""
 #define DFLT_MAX_WSSDATA               2048
 #define DFLT_TC_RECV_BUFSZ        (40*1024)
 #define DFLT_TC_SEND_BUFSZ        (80*1024)
+#define DFLT_TC_RECV_BUFSZ_MAX    "\"128KB\""
+#define DFLT_TC_SEND_BUFSZ_MAX    "\"1024KB\""
 #define DFLT_RADIO_INIT_WAIT    "\"200ms\""
 #define DFLT_MAX_TXUNITS                  4
 #define DFLT_MAX_130X                     8
-#define DFLT_MAX_TXJOBS                 128
+#define DFLT_TX_JOBS                  "128"
 #define DFLT_MAX_RXJOBS                  64
 #define DFLT_RADIODEV  "\"/dev/spidev?.0\""
 #define DFLT_TX_MIN_GAP          "\"10ms\""   // worst case for ODU as of 07.2018 (horrible SPI performance)
@@ -95,6 +97,9 @@
 #define FS_PAGE_CNT      (500)
 #define FS_MAX_FD        8
 #define FS_MAX_FNSIZE    256
+#define FS_GC_RESERVE    (FLASH_PAGE_SIZE*FS_PAGE_CNT/8)  // free space in section below which background GC starts
+#define FS_GC_STEP       (4*1024)                          // bytes copied/erased per background GC step
+#define FS_GC_INTV       rt_millis(2)                      // pause between background GC steps
 
 // --------------------------------------------------------------------------------
 // Non Lora runtime parameters
@@ -125,13 +130,11 @@ enum {  MAX_WSSFRAMES   =  32 };
 enum {  MIN_UPJSON_SIZE = 384 };
 enum {  MAX_TXUNITS     = DFLT_MAX_TXUNITS };
 enum {  MAX_130X        = DFLT_MAX_130X };
-enum {  MAX_TXJOBS      = DFLT_MAX_TXJOBS  };
 enum {  MAX_TXFRAME_LEN =  255 };
 enum {  MAX_RXFRAME_LEN =  255 };
 enum {  MAX_RXJOBS      = DFLT_MAX_RXJOBS };
 enum {  TXPOW_SCALE     =   10 };   // keep TX power internally as s2_t scaled by this
 enum {  MAX_RXDATA      = DFLT_MAX_RXDATA };
-enum {  MAX_TXDATA      = DFLT_MAX_TXDATA };
 enum {  MAX_WSSDATA     = DFLT_MAX_WSSDATA };
 
 struct conf_param {
@@ -163,11 +166,14 @@ void  s2conf_printAll ();
 CONF_PARAM(RADIODEV            , str   , str     ,        DFLT_RADIODEV, "default radio device")
 CONF_PARAM(LOGFILE_SIZE        , u4    , size_mb ,    DFLT_LOGFILE_SIZE, "default size of a logfile")
 CONF_PARAM(LOGFILE_ROTATE      , u4    , u4      ,  DFLT_LOGFILE_ROTATE, "besides current log file keep *.1..N (none if 0)")
+CONF_PARAM(LOG_DEFERRED        , u4    , bool    ,            "false", "format log lines on the log thread instead of the caller")
+CONF_PARAM(LOG_SYNC_INTV       , ustime, tspan_s ,             "\"0s\"", "fdatasync log file at most this often (0=leave it to the OS)")
 CONF_PARAM(TCP_KEEPALIVE_EN    , u4    , u4      ,   DFLT_TCP_KEEPALIVE, "TCP keepalive enabled")
 CONF_PARAM(TCP_KEEPALIVE_IDLE  , u4    , u4      ,    DFLT_TCP_KEEPIDLE, "TCP keepalive TCP_KEEPIDLE [s]")
 CONF_PARAM(TCP_KEEPALIVE_INTVL , u4    , u4      ,   DFLT_TCP_KEEPINTVL, "TCP keepalive TCP_KEEPINTVL [s]")
 CONF_PARAM(TCP_KEEPALIVE_CNT   , u4    , u4      ,     DFLT_TCP_KEEPCNT, "TCP keepalive TCP_KEEPCNT")
 CONF_PARAM(MAX_JOINEUI_RANGES  , u4    , u4      ,                 "10", "max ranges to suppress unwanted join requests")
+CONF_PARAM(MAX_DEVADDR_PREFIXES, u4    , u4      ,                 "32", "max DevAddr prefixes/NetIDs to suppress foreign data frames (at most 2047)")
 CONF_PARAM(CUPS_CONN_TIMEOUT   , ustime, tspan_s ,            "\"60s\"", "connection timeout")
 CONF_PARAM(CUPS_OKSYNC_INTV    , ustime, tspan_h ,            "\"24h\"", "regular check-in with CUPS for updates")
 CONF_PARAM(CUPS_RESYNC_INTV    , ustime, tspan_m ,             "\"1m\"", "check-in with CUPS for updates after a failure")
@@ -176,11 +182,36 @@ CONF_PARAM(GPS_REPORT_DELAY    , ustime, tspan_s ,           "\"120s\"", "delay
 CONF_PARAM(GPS_REOPEN_TTY_INTV , ustime, tspan_ms,             "\"1s\"", "recheck TTY open if it failed")
 CONF_PARAM(GPS_REOPEN_FIFO_INTV, ustime, tspan_ms,             "\"1s\"", "recheck if FIFO writer fake GPS")
 CONF_PARAM(CMD_REOPEN_FIFO_INTV, ustime, tspan_ms,             "\"1s\"", "recheck if FIFO writer")
+CONF_PARAM(RMTSH_FRAME_MAX     , u4    , size_kb ,          "\"16KB\"", "max remote shell output batched into one binary WS frame")
+CONF_PARAM(RMTSH_RATE_MAX      , u4    , size_kb ,                  "0", "remote shell output cap in bytes per second (0=unlimited)")
 CONF_PARAM(RX_POLL_INTV        , ustime, tspan_ms,           "\"20ms\"", "interval to poll SX1301 RX FIFO")
+CONF_PARAM(RX_POLL_IDLE_INTV   , ustime, tspan_ms,          "\"100ms\"", "RX FIFO poll interval backs off up to this value while no frames arrive")
+CONF_PARAM(TC_SEND_BUFSZ_MAX   , u4    , size_kb , DFLT_TC_SEND_BUFSZ_MAX, "muxs send buffer grows up to this size (absorbs backhaul stalls)")
+CONF_PARAM(TC_WRITER_THREAD    , u4    , bool    ,            "false", "encrypt and send muxs traffic on a separate thread")
+CONF_PARAM(TC_WS_DEFLATE       , u4    , u4      ,                 "10", "offer permessage-deflate to muxs with 2^N byte windows (9..15, 0=off, needs CFG_wsdeflate)")
+CONF_PARAM(TC_RECV_BUFSZ_MAX   , u4    , size_kb , DFLT_TC_RECV_BUFSZ_MAX, "muxs recv buffer grows up to this size")
+CONF_PARAM(TX_JOBS             , u4    , u4      ,         DFLT_TX_JOBS, "size of TX job pool (downlinks queued at the same time)")
+CONF_PARAM(TX_DATA             , u4    , size_kb ,         DFLT_TX_DATA, "size of TX data pool for pending downlink frames")
+CONF_PARAM(RAL_SHM_RINGSIZE    , u4    , size_kb ,          "\"64KB\"", "shared memory ring per slave and direction for RX/TX frames - rounded up to a power of 2 (0=pipes only)")
+CONF_PARAM(SPOOL_SIZE          , u4    , size_kb ,                  "0", "spool uplinks to disk while muxs is disconnected (0=disabled)")
+CONF_PARAM(SPOOL_MAXAGE        , ustime, tspan_m ,            "\"1h\"", "spooled uplinks older than this are discarded")
+CONF_PARAM(UPBATCH_MAX         , u4    , u4      ,                 "16", "max frames per batched updf message (if muxs enables upbatch)")
+CONF_PARAM(UPBATCH_LINGER      , ustime, tspan_ms,            "\"0ms\"", "wait this long for more frames before sending a partial batch")
+CONF_PARAM(DNBATCH_MAX         , u4    , u4      ,                 "16", "max TX confirmations per batched dntxed message (if muxs enables dnbatch)")
+CONF_PARAM(DNBATCH_LINGER      , ustime, tspan_ms,           "\"20ms\"", "collect TX confirmations this long before sending a batch")
+CONF_PARAM(RX_MIRROR_WINDOW    , ustime, tspan_ms,            "\"0ms\"", "only frames this recent are checked for mirrors (0=all pending frames)")
+CONF_PARAM(RX_SHED_DUP         , u4    , u4      ,                 "50", "RX load (% of RX queue/send buffer) to drop duplicates of any pending frame (0=never)")
+CONF_PARAM(RX_SHED_FILTER      , u4    , u4      ,                 "65", "RX load to drop frames failing NetID/JoinEUI/DevAddr filters on arrival (0=never)")
+CONF_PARAM(RX_SHED_SNR         , u4    , u4      ,                 "80", "RX load to drop low SNR frames - not join requests/confirmed uplinks (0=never)")
+CONF_PARAM(RX_SHED_SNR_MARGIN  , u4    , u4      ,                  "5", "frames less than this many dB above the demodulation floor of their SF count as low SNR")
 CONF_PARAM(TC_TIMEOUT          , ustime, tspan_s ,            "\"60s\"", "reconnected to muxs")
+CONF_PARAM(MUXS_MIRRORS        , str   , str     ,               "\"\"", "comma separated ws(s):// URIs of extra muxs sessions receiving copies of all uplinks")
+CONF_PARAM(TC_MUXS_TTL         , ustime, tspan_s ,            "\"1h\"", "reuse last good muxs URI without asking INFOS (0=disabled)")
+CONF_PARAM(TC_DIRECT_TIMEOUT   , ustime, tspan_s ,           "\"10s\"", "give up on cached muxs URI and ask INFOS after this time")
 CONF_PARAM(CLASS_C_BACKOFF_BY  , ustime, tspan_s ,          "\"100ms\"", "retry interval for class C TX attempts")
 CONF_PARAM(CLASS_C_BACKOFF_MAX , u4    , u4      ,                 "10", "max number of class C TX attempts")
 CONF_PARAM(RADIO_INIT_WAIT     , ustime, tspan_s , DFLT_RADIO_INIT_WAIT, "max wait for radio init command to finish")
+CONF_PARAM(RADIO_LINGER        , ustime, tspan_s ,            "\"2m\"", "keep radio running after TC session ended - identical router_config skips radio setup (0=stop at once)")
 CONF_PARAM(PPS_VALID_INTV      , ustime, tspan_ms,            "\"10m\"", "max age of last PPS sync for GPS time conversions")
 CONF_PARAM(TIMESYNC_RADIO_INTV , ustime, tspan_ms,         "\"2100ms\"", "interval to resync MCU/SX1301")
 CONF_PARAM(TIMESYNC_LNS_RETRY  , ustime, tspan_s ,           "\"71ms\"", "resend timesync message to server")
@@ -189,10 +220,24 @@ CONF_PARAM(TIMESYNC_LNS_BURST  , u4    , u4      ,                 "10", "volley
 CONF_PARAM(TIMESYNC_REPORTS    , ustime, tspan_s ,             "\"5m\"", "report interval for current timesync status")
 CONF_PARAM(TX_MIN_GAP          , ustime, tspan_s ,      DFLT_TX_MIN_GAP, "min distance between two frames being TXed")
 CONF_PARAM(TX_AIM_GAP          , ustime, tspan_s ,      DFLT_TX_AIM_GAP, "aim for this TX lead time, if delayed should not fall under min")
+CONF_PARAM(TX_PRESTAGE         , u4    , bool    ,            "false", "encode the HAL TX packet of the next frame ahead of time - allows a smaller TX_AIM_GAP")
 CONF_PARAM(TX_MAX_AHEAD        , ustime, tspan_s ,    DFLT_TX_MAX_AHEAD, "maximum time message can be scheduled into the future")
 CONF_PARAM(TXCHECK_FUDGE       , ustime, tspan_s ,   DFLT_TXCHECK_FUDGE, "check radio state this time into ongoing TX")
 CONF_PARAM(BEACON_INTVL        , ustime, tspan_s ,    DFLT_BEACON_INTVL, "beaconing interval")
+CONF_PARAM(HTTPD_IDLE_TIMEOUT  , ustime, tspan_s ,            "\"15s\"", "close kept-alive web server connections idle for this long")
+CONF_PARAM(DNS_CACHE_TTL       , ustime, tspan_s ,            "\"5m\"", "reuse resolved addresses for this long (0=no cache)")
+CONF_PARAM(CONN_STAGGER        , ustime, tspan_ms,          "\"250ms\"", "start next parallel TCP connect attempt after this time (RFC 8305)")
+CONF_PARAM(CONN_TIMEOUT        , ustime, tspan_s ,            "\"30s\"", "give up on all TCP connect attempts to a host after this time")
+CONF_PARAM(PROF_STALL          , ustime, tspan_ms,          "\"10ms\"", "log timer/aio callbacks running longer than this (0=off)")
+CONF_PARAM(WEB_BUFSZ           , u4    , size_kb ,             "\"32KB\"", "web server request/response buffer size (/metrics needs METRICS_PROM_SIZE)")
+CONF_PARAM(METRICS_PUSH_INTV   , ustime, tspan_s ,             "\"0s\"", "push hot path metrics to muxs this often (0=off, scrape web server /metrics)")
 CONF_PARAM(TLS_SNI             ,     u4,    bool ,               "true", "Set and verify server name of TLS connections")
+CONF_PARAM(TLS_RESUME          ,     u4,    bool ,               "true", "Resume TLS sessions when reconnecting to the same server")
+CONF_PARAM(RT_POLICY           , str   , str     ,               "\"\"", "run main loop and RAL slaves with realtime scheduling: fifo or rr (empty=normal)")
+CONF_PARAM(RT_PRIORITY         , u4    , u4      ,                 "10", "realtime priority for RT_POLICY")
+CONF_PARAM(RT_CPUS             , str   , str     ,               "\"\"", "pin main loop to these CPUs, e.g. 2-3 (empty=any)")
+CONF_PARAM(RT_SLAVE_CPUS       , str   , str     ,               "\"\"", "pin RAL slaves to these CPUs (empty=same as RT_CPUS)")
+CONF_PARAM(RT_MLOCK            , u4    , bool    ,            "false", "lock station memory and pre-fault the main loop stack")
 CONF_PARAM(TEMP_COMP_UPDATE    , ustime, tspan_s ,             "\"5m\"", "interval for updating temperature")
 
 #endif // _s2conf_x_
@@ -33,12 +33,19 @@
 #include "s2e.h"
 #include "kwcrc.h"
 #include "timesync.h"
+#include "metrics.h"
+#include "trace.h"
 
 
 u1_t s2e_dcDisabled;    // no duty cycle limits - override for test/dev
 u1_t s2e_ccaDisabled;   // no LBT etc           - ditto
 u1_t s2e_dwellDisabled; // no dwell time limits - ditto
 
+static u4_t ralConfigCrc;  // digest of radio setup passed to ral_config - 0 if radio not running
+static tmr_t radioLingerTmr;  // radio kept running after session end - stopped unless next router_config is identical
+static rps_t lingerDRs[DR_CNT];  // DR table of the radio setup still running - maps uplinks until next router_config
+static u1_t txRejWhy = MC_tx_rej_other;  // MC_tx_rej_xxx of latest failed TX placement - counted if txjob is dropped
+
 
 extern inline int   rps_sf   (rps_t params);
 extern inline int   rps_bw   (rps_t params);
@@ -47,6 +54,9 @@ extern inline rps_t rps_make (int sf, int bw);
 // Fwd decl.
 static void s2e_txtimeout (tmr_t* tmr);
 static void s2e_bcntimeout (tmr_t* tmr);
+static void s2e_upbatchtimeout (tmr_t* tmr);
+static void s2e_dnbatchtimeout (tmr_t* tmr);
+static void s2e_metricstimeout (tmr_t* tmr);
 
 
 static void setDC (s2ctx_t* s2ctx, ustime_t t) {
@@ -59,45 +69,113 @@ static void setDC (s2ctx_t* s2ctx, ustime_t t) {
 }
 
 static void resetDC (s2ctx_t* s2ctx, u2_t dc_chnlRate) {
+    if( s2ctx->dc_chnlRate == dc_chnlRate )
+        return;  // same region again (router_config after reconnect) - keep DC history
     setDC(s2ctx, rt_getTime());
     s2ctx->dc_chnlRate = dc_chnlRate;
 }
 
 
+// Region dependent TX admission - direct calls if the region is fixed at build time
+#if defined(S2E_REGION)
+#define CAN_TX(s2ctx,txjob,pcca)  S2E_CANTX(s2ctx, txjob, pcca)
+#define DC_FREE(s2ctx,txjob,u)    S2E_DCFREE(s2ctx, txjob, u)
+#else // !defined(S2E_REGION)
+#define CAN_TX(s2ctx,txjob,pcca)  (*(s2ctx)->canTx)(s2ctx, txjob, pcca)
+#define DC_FREE(s2ctx,txjob,u)    (*(s2ctx)->dcFree)(s2ctx, txjob, u)
+#endif // !defined(S2E_REGION)
+
 static int s2e_canTxOK (s2ctx_t* s2ctx, txjob_t* txjob, int* ccaDisabled) {
     return 1;
 }
 
+static ustime_t s2e_dcFreeNone (s2ctx_t* s2ctx, txjob_t* txjob, u1_t txunit) {
+    return USTIME_MIN;
+}
+
+
+static void s2e_radioLingerDone (tmr_t* tmr) {
+    LOG(MOD_S2E|INFO, "No identical router_config within %~T - stopping radio", RADIO_LINGER);
+    ralConfigCrc = 0;
+    ral_stop();
+}
+
 
 void s2e_ini (s2ctx_t* s2ctx) {
+    if( radioLingerTmr.callback == NULL )
+        rt_iniTimer(&radioLingerTmr, s2e_radioLingerDone);
     if( s2e_joineuiFilter == NULL )
         s2e_joineuiFilter = rt_mallocN(uL_t, 2*MAX_JOINEUI_RANGES+2);  // need min one trailing 0 entry
 
     memset(s2ctx, 0, sizeof(*s2ctx));
-    txq_ini(&s2ctx->txq);
+    // Size the arena to hold TX pools and TX unit queues in one block
+    int njobs = max(1, min((int)TX_JOBS, MAX_TXJOBS_LIMIT));
+    int nslabs = (TX_DATA + TXSLAB_SIZE-1) / TXSLAB_SIZE + 1;
+    rt_arenaIni(&s2ctx->arena,
+                njobs * sizeof(txjob_t) + nslabs * (TXSLAB_SIZE+sizeof(u1_t)+sizeof(u2_t))
+                + MAX_TXUNITS * njobs * sizeof(txidx_t) + (4+MAX_TXUNITS)*16);
+    txq_ini(&s2ctx->txq, &s2ctx->arena, njobs, TX_DATA);
     rxq_ini(&s2ctx->rxq);
 
     s2ctx->canTx = s2e_canTxOK;
+    s2ctx->dcFree = s2e_dcFreeNone;
+    s2ctx->radioTx = ral_tx;
+    s2ctx->radioTxprep = ral_txprep;
+    s2ctx->radioTxstatus = ral_txstatus;
+    s2ctx->radioTxabort = ral_txabort;
+    s2ctx->altAntennas = ral_altAntennas;
     for( u1_t i=0; i<DR_CNT; i++ )
-        s2ctx->dr_defs[i] = RPS_ILLEGAL;
+        s2ctx->dr_defs[i] = ralConfigCrc ? lingerDRs[i] : RPS_ILLEGAL;
     setDC(s2ctx, USTIME_MIN);   // disable until we have a region that needs it
 
     for( int u=0; u < MAX_TXUNITS; u++ ) {
         rt_iniTimer(&s2ctx->txunits[u].timer, s2e_txtimeout);
         s2ctx->txunits[u].timer.ctx = s2ctx;
-        s2ctx->txunits[u].head = TXIDX_END;
+        txord_ini(&s2ctx->txunits[u].q, &s2ctx->arena, s2ctx->txq.njobs);
     }
     rt_iniTimer(&s2ctx->bcntimer, s2e_bcntimeout);
     s2ctx->bcntimer.ctx = s2ctx;
+    rt_iniTimer(&s2ctx->upbatchTimer, s2e_upbatchtimeout);
+    s2ctx->upbatchTimer.ctx = s2ctx;
+    rt_iniTimer(&s2ctx->dnbatchTimer, s2e_dnbatchtimeout);
+    s2ctx->dnbatchTimer.ctx = s2ctx;
+    s2ctx->dnpendMax = min(DNBATCH_MAX, 255);
+    if( s2ctx->dnpendMax > 1 )
+        s2ctx->dnpend = rt_arenaMallocN(&s2ctx->arena, dntxed_t, s2ctx->dnpendMax);
+    rt_iniTimer(&s2ctx->metricsTimer, s2e_metricstimeout);
+    s2ctx->metricsTimer.ctx = s2ctx;
+    if( METRICS_PUSH_INTV > 0 )
+        rt_setTimer(&s2ctx->metricsTimer, rt_micros_ahead(METRICS_PUSH_INTV));
 }
 
 
 void s2e_free (s2ctx_t* s2ctx) {
-    for( int u=0; u < MAX_TXUNITS; u++ )
+    for( int u=0; u < MAX_TXUNITS; u++ ) {
         rt_clrTimer(&s2ctx->txunits[u].timer);
+        txord_free(&s2ctx->txunits[u].q);
+    }
+    txq_free(&s2ctx->txq);
     rt_clrTimer(&s2ctx->bcntimer);
+    rt_clrTimer(&s2ctx->upbatchTimer);
+    rt_clrTimer(&s2ctx->dnbatchTimer);
+    if( s2ctx->dnpendN )
+        LOG(MOD_S2E|WARNING, "Session ended - %d TX confirmations not sent", s2ctx->dnpendN);
+    rt_clrTimer(&s2ctx->metricsTimer);
+    memcpy(lingerDRs, s2ctx->dr_defs, sizeof(lingerDRs));
+    s2e_logDevaddrFilter();
+#if defined(CFG_variant_debug)
+    rt_arenaReport(&s2ctx->arena, "s2e session");
+#endif // defined(CFG_variant_debug)
+    rt_arenaFree(&s2ctx->arena);
     memset(s2ctx, 0, sizeof(*s2ctx));
     ts_iniTimesync();
+    if( ralConfigCrc != 0 && RADIO_LINGER > 0 ) {
+        // Reconnects mostly get the same channel plan - keep the radio receiving
+        // (uplinks are spooled) and skip channel allocation and radio restart.
+        rt_setTimer(&radioLingerTmr, rt_micros_ahead(RADIO_LINGER));
+        return;
+    }
+    ralConfigCrc = 0;
     ral_stop();
 }
 
@@ -116,86 +194,342 @@ rxjob_t* s2e_nextRxjob (s2ctx_t* s2ctx) {
 }
 
 
+enum { SENDHIGH_LOAD = 75 };  // WSEV_SENDHIGH - send buffer is 3/4 full
+enum { RXSHED_HYST = 10 };    // leave a stage only once load is this far below its threshold
+
+// Overload policy - as RX queue or send buffer fill up frames of least value are given up first:
+// duplicates, then frames failing the filters, then low SNR frames.
+static int s2e_rxshedStages (s2ctx_t* s2ctx) {
+    static const u1_t stages[] = { RXSHED_DUP, RXSHED_FILTER, RXSHED_SNR };
+    const u4_t thres[] = { RX_SHED_DUP, RX_SHED_FILTER, RX_SHED_SNR };
+    int load = rxq_occupancy(&s2ctx->rxq);
+    if( s2ctx->sendhigh )
+        load = max(load, SENDHIGH_LOAD);
+    metric_set(MG_rx_load, load);
+    u1_t active = 0;
+    for( int i=0; i < SIZE_ARRAY(stages); i++ ) {
+        u4_t t = thres[i];
+        if( t > RXSHED_HYST && (s2ctx->rxshed & stages[i]) )
+            t -= RXSHED_HYST;
+        if( thres[i] > 0 && load >= t )
+            active |= stages[i];
+    }
+    if( active != s2ctx->rxshed ) {
+        LOG(MOD_S2E|(active > s2ctx->rxshed ? WARNING : INFO), "RX load %d%% - %s%s%s%s", load,
+            active ? "shedding" : "no longer shedding frames",
+            active & RXSHED_DUP ? " duplicates" : "",
+            active & RXSHED_FILTER ? " filtered" : "",
+            active & RXSHED_SNR ? " low-SNR" : "");
+        s2ctx->rxshed = active;
+    }
+    return active;
+}
+
+static inline void traceRx (rxjob_t* rxjob, int verdict) {
+    trace_rec(rxjob->rxtime, TRACE_RX, rxjob->dr, verdict, rxjob->freq,
+              rxjob->len | (u1_t)rxjob->snr<<8 | rxjob->rssi<<16 | (u4_t)metrics_gauge[MG_rx_load]<<24);
+}
+
 void s2e_addRxjob (s2ctx_t* s2ctx, rxjob_t* rxjob) {
     // Add newly received frame to rxq
+    metric_inc(MC_rx_frames);
+    int stages = s2e_rxshedStages(s2ctx);
     // Check for mirror frame (reflection on a neighboring frequency)
-    for( rxjob_t* p = &s2ctx->rxq.rxjobs[s2ctx->rxq.first]; p < rxjob; p++ ) {
-        if( p->dr == rxjob->dr &&
-            p->len == rxjob->len &&
-            memcmp(&s2ctx->rxq.rxdata[p->off], &s2ctx->rxq.rxdata[rxjob->off], rxjob->len) == 0 ) {
-            // Duplicate detected - drop the mirror
-            if( (8*rxjob->snr - rxjob->rssi) > (8*p->snr - p->rssi) ) {
-                // Drop previous frame p
-                LOG(MOD_S2E|DEBUG, "Dropped mirror frame freq=%F snr=%5.1f rssi=%d (vs. freq=%F snr=%5.1f rssi=%d) - DR%d mic=%d (%d byes)",
-                    p->freq, p->snr/4.0, -p->rssi, rxjob->freq, rxjob->snr/4.0, -rxjob->rssi,
-                    p->dr, (s4_t)rt_rlsbf4(&s2ctx->rxq.rxdata[p->off]+rxjob->len-4), p->len);
-
-                rxq_commitJob(&s2ctx->rxq, rxjob);
-                rxjob = rxq_dropJob(&s2ctx->rxq, p);
-            } else {
-                // else: Drop newly retrieved frame - aka don't commit it
-                LOG(MOD_S2E|DEBUG, "Dropped mirror frame freq=%F snr=%5.1f rssi=%d (vs. freq=%F snr=%5.1f rssi=%d) - DR%d mic=%d (%d byes)",
-                    rxjob-> freq, rxjob->snr/4.0, -rxjob->rssi, p->freq, p->snr/4.0, -p->rssi,
-                    rxjob->dr, (s4_t)rt_rlsbf4(&s2ctx->rxq.rxdata[rxjob->off]+rxjob->len-4), rxjob->len);
-            }
-            return;
+    // If overloaded drop any duplicate of a pending frame regardless of age.
+    rxjob_t* p = rxq_findMirror(&s2ctx->rxq, rxjob, (stages & RXSHED_DUP) ? 0 : RX_MIRROR_WINDOW);
+    if( p != NULL ) {
+        // Duplicate detected - drop the mirror
+        int mirror = RX_MIRROR_WINDOW == 0 || rxjob->rxtime - p->rxtime <= RX_MIRROR_WINDOW;
+        if( (8*rxjob->snr - rxjob->rssi) > (8*p->snr - p->rssi) ) {
+            // Drop previous frame p
+            LOG(MOD_S2E|DEBUG, "Dropped mirror frame freq=%F snr=%5.1f rssi=%d (vs. freq=%F snr=%5.1f rssi=%d) - DR%d mic=%d (%d byes)",
+                p->freq, p->snr/4.0, -p->rssi, rxjob->freq, rxjob->snr/4.0, -rxjob->rssi,
+                p->dr, (s4_t)rt_rlsbf4(&s2ctx->rxq.rxdata[p->off]+rxjob->len-4), p->len);
+
+            rxq_commitJob(&s2ctx->rxq, rxjob);
+            rxq_dropJob(&s2ctx->rxq, p);
+            traceRx(rxjob, TRACE_RX_REPLACE);
+        } else {
+            // else: Drop newly retrieved frame - aka don't commit it
+            LOG(MOD_S2E|DEBUG, "Dropped mirror frame freq=%F snr=%5.1f rssi=%d (vs. freq=%F snr=%5.1f rssi=%d) - DR%d mic=%d (%d byes)",
+                rxjob-> freq, rxjob->snr/4.0, -rxjob->rssi, p->freq, p->snr/4.0, -p->rssi,
+                rxjob->dr, (s4_t)rt_rlsbf4(&s2ctx->rxq.rxdata[rxjob->off]+rxjob->len-4), rxjob->len);
+            traceRx(rxjob, mirror ? TRACE_RX_MIRROR : TRACE_RX_SHED_DUP);
         }
+        metric_inc(mirror ? MC_rx_drop_mirror : MC_rx_shed_dup);
+        return;
+    }
+    int why = s2e_shedLoraFrame(&s2ctx->rxq.rxdata[rxjob->off], rxjob->len,
+                                rps_sf(s2e_dr2rps(s2ctx, rxjob->dr)), rxjob->snr, stages);
+    if( why ) {
+        // Don't commit - frame data space is reused
+        LOG(MOD_S2E|DEBUG, "Shed %s frame DR%d snr=%.1f (%d bytes)",
+            why == RXSHED_SNR ? "low-SNR" : "filtered", rxjob->dr, rxjob->snr/4.0, rxjob->len);
+        metric_inc(why == RXSHED_SNR ? MC_rx_shed_snr : MC_rx_shed_filter);
+        traceRx(rxjob, why == RXSHED_SNR ? TRACE_RX_SHED_SNR : TRACE_RX_SHED_FILTER);
+        return;
     }
     // No mirror frame found
     rxq_commitJob(&s2ctx->rxq, rxjob);
+    traceRx(rxjob, TRACE_OK);
+    metric_set(MG_rxq_depth, s2ctx->rxq.njobs);
 }
 
-void s2e_flushRxjobs (s2ctx_t* s2ctx) {
-    while( s2ctx->rxq.first < s2ctx->rxq.next ) {
-        // Get a send buffer - parse frame / check filter
+// UTC time when frame was received (also valid for frames replayed from the spool)
+static sL_t s2e_rxjobUTC (rxjob_t* j) {
+    return rt_getUTC() - (rt_getTime() - j->rxtime);
+}
+
+// Decode and log one rxjob. The frame is decoded once - log line and JSON/binary
+// encoding work off the same fields.
+// Returns 0 if the frame is not LoRaWAN or was filtered.
+static int s2e_decodeRxjob (s2ctx_t* s2ctx, rxjob_t* j, lorafrm_t* f) {
+    int ok = s2e_decodeLoraFrame(f, &s2ctx->rxq.rxdata[j->off], j->len);
+    dbuf_t lbuf;
+    if( f->drop != LORAFRM_BAD && log_special(MOD_S2E|VERBOSE, &lbuf) ) {
+        xprintf(&lbuf, "RX %F DR%d %R snr=%.1f rssi=%d xtime=0x%lX - ",
+                j->freq, j->dr, s2e_dr2rps(s2ctx, j->dr), j->snr/4.0, -j->rssi, j->xtime);
+        s2e_logLoraFrame(&lbuf, f);
+        log_specialFlush(lbuf.pos);
+    }
+    if( !ok )
+        metric_inc(MC_rx_drop_filter);
+    return ok;
+}
+
+// Encode one rxjob as an updf object into sendbuf.
+// Returns 0 if frame failed sanity checks or was stopped by filters.
+static int s2e_encRxjob (s2ctx_t* s2ctx, ujbuf_t* sendbuf, rxjob_t* j) {
+    lorafrm_t f;
+    if( !s2e_decodeRxjob(s2ctx, j, &f) )
+        return 0;
+    uj_encOpen(sendbuf, '{');
+    s2e_encLoraFrame(sendbuf, &f);
+    double reftime = 0.0;
+    if( s2ctx->muxtime ) {
+        reftime = s2ctx->muxtime +
+            ts_normalizeTimespanMCU(rt_getTime()-s2ctx->reftime) / 1e6;
+    }
+    uj_encKVn(sendbuf,
+              "RefTime",  'T', reftime,
+              "DR",       'i', j->dr,
+              "Freq",     'i', j->freq,
+              "upinfo",   '{',
+              /**/ "rctx",    'I', j->rctx,
+              /**/ "xtime",   'I', j->xtime,
+              /**/ "gpstime", 'I', ts_xtime2gpstime(j->xtime),
+              /**/ "fts",     'i', j->fts,
+              /**/ "rssi",    'i', -(s4_t)j->rssi,
+              /**/ "snr",     'g', j->snr/4.0,
+              /**/ "rxtime",  'T', s2e_rxjobUTC(j)/1e6,
+              "}",
+              NULL);
+    uj_encClose(sendbuf, '}');
+    return 1;
+}
+
+// Muxs negotiated batching (router_config upbatch):
+// If fewer than UPBATCH_MAX frames are ready, wait up to UPBATCH_LINGER for more to arrive.
+// Returns 1 if sending should be delayed.
+static int s2e_lingerRxbatch (s2ctx_t* s2ctx) {
+    rxq_t* rxq = &s2ctx->rxq;
+    rxjob_t* j = rxq_firstJob(rxq);
+    if( j == NULL )
+        return 1;
+    if( UPBATCH_LINGER > 0 && rxq->njobs < UPBATCH_MAX ) {
+        ustime_t deadline = j->rxtime + UPBATCH_LINGER;
+        if( deadline > rt_getTime() ) {
+            if( s2ctx->upbatchTimer.next == TMR_NIL )
+                rt_setTimer(&s2ctx->upbatchTimer, deadline);
+            return 1;
+        }
+    }
+    rt_clrTimer(&s2ctx->upbatchTimer);
+    return 0;
+}
+
+// Encoded uplink message is copied as is to mirror sessions (if any) before it is
+// committed to the primary websocket (which masks the data in place).
+static void s2e_sendUplink (s2ctx_t* s2ctx, dbuf_t* sendbuf, int binary) {
+    if( s2ctx->fanout )
+        (*s2ctx->fanout)(s2ctx, sendbuf, binary);
+    if( binary )
+        (*s2ctx->sendBinary)(s2ctx, sendbuf);
+    else
+        (*s2ctx->sendText)(s2ctx, sendbuf);
+}
+
+// Pack up to UPBATCH_MAX frames into one JSON array message.
+static void s2e_flushRxbatch (s2ctx_t* s2ctx) {
+    rxq_t* rxq = &s2ctx->rxq;
+    rxjob_t* j;
+    while( rxq_firstJob(rxq) != NULL ) {
         ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, MIN_UPJSON_SIZE);
         if( sendbuf.buf == NULL ) {
             // Websocket has no space - WS will call again
             return;
         }
-        rxjob_t* j = &s2ctx->rxq.rxjobs[s2ctx->rxq.first++];
-        dbuf_t lbuf = { .buf = NULL };
-        if( log_special(MOD_S2E|VERBOSE, &lbuf) )
-            xprintf(&lbuf, "RX %F DR%d %R snr=%.1f rssi=%d xtime=0x%lX - ",
-                    j->freq, j->dr, s2e_dr2rps(s2ctx, j->dr), j->snr/4.0, -j->rssi, j->xtime);
+        uj_encOpen(&sendbuf, '[');
+        int n = 0;
+        while( n < UPBATCH_MAX && sendbuf.bufsize - sendbuf.pos > MIN_UPJSON_SIZE &&
+               (j = rxq_firstJob(rxq)) != NULL ) {
+            int pos = sendbuf.pos;
+            if( !s2e_encRxjob(s2ctx, &sendbuf, j) ) {
+                sendbuf.pos = pos;
+                rxq_popJob(rxq);
+                continue;
+            }
+            if( sendbuf.pos >= sendbuf.bufsize-1 ) {
+                // No space left for this frame and closing bracket
+                sendbuf.pos = pos;
+                if( n == 0 ) {
+                    LOG(MOD_S2E|ERROR, "JSON encoding exceeds available buffer space: %d", sendbuf.bufsize);
+                    rxq_popJob(rxq);
+                    continue;
+                }
+                break;
+            }
+            rxq_popJob(rxq);
+            n += 1;
+        }
+        if( n == 0 )
+            continue;
+        uj_encClose(&sendbuf, ']');
+        if( !xeos(&sendbuf) ) {
+            LOG(MOD_S2E|ERROR, "JSON encoding exceeds available buffer space: %d", sendbuf.bufsize);
+        } else {
+            s2e_sendUplink(s2ctx, &sendbuf, 0);
+            assert(sendbuf.buf==NULL);
+        }
+    }
+}
 
-        uj_encOpen(&sendbuf, '{');
-        if( !s2e_parse_lora_frame(&sendbuf, &s2ctx->rxq.rxdata[j->off], j->len, lbuf.buf ? &lbuf : NULL) ) {
+// Binary updf record:
+//   0     1  2     6     14     22       30  34   35  36       44      52  53
+//  +-----+--+-----+-----+------+--------+---+----+---+--------+-------+---+-------+
+//  | tag |DR| Freq| rctx| xtime| gpstime|fts|rssi|snr| RefTime| rxtime|len| frame |
+//  +-----+--+-----+-----+------+--------+---+----+---+--------+-------+---+-------+
+//  RefTime/rxtime in microseconds, rssi scaled by -1, snr scaled by 4
+//
+static int s2e_encRxjobBin (s2ctx_t* s2ctx, dbuf_t* sendbuf, rxjob_t* j) {
+    lorafrm_t f;
+    if( !s2e_decodeRxjob(s2ctx, j, &f) )
+        return 0;
+    const u1_t* frame = f.frame;
+    sL_t reftime = 0;
+    if( s2ctx->muxtime ) {
+        reftime = (sL_t)(s2ctx->muxtime*1e6) +
+            ts_normalizeTimespanMCU(rt_getTime()-s2ctx->reftime);
+    }
+    u1_t* p = (u1_t*)sendbuf->buf + sendbuf->pos;
+    p[0] = BINMSG_UPDF;
+    p[1] = j->dr;
+    rt_wlsbf4(p+ 2, j->freq);
+    rt_wlsbf8(p+ 6, j->rctx);
+    rt_wlsbf8(p+14, j->xtime);
+    rt_wlsbf8(p+22, ts_xtime2gpstime(j->xtime));
+    rt_wlsbf4(p+30, j->fts);
+    p[34] = j->rssi;
+    p[35] = j->snr;
+    rt_wlsbf8(p+36, reftime);
+    rt_wlsbf8(p+44, s2e_rxjobUTC(j));
+    p[52] = j->len;
+    memcpy(p+BINMSG_UPDF_HDRLEN, frame, j->len);
+    sendbuf->pos += BINMSG_UPDF_HDRLEN + j->len;
+    return 1;
+}
+
+// Binary messages carry one updf record or - if upbatch is enabled - up to UPBATCH_MAX records.
+static void s2e_flushRxbin (s2ctx_t* s2ctx) {
+    rxq_t* rxq = &s2ctx->rxq;
+    int maxrec = s2ctx->upbatch ? UPBATCH_MAX : 1;
+    rxjob_t* j;
+    while( rxq_firstJob(rxq) != NULL ) {
+        dbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, BINMSG_UPDF_HDRLEN+MAX_RXFRAME_LEN);
+        if( sendbuf.buf == NULL ) {
+            // Websocket has no space - WS will call again
+            return;
+        }
+        int n = 0;
+        while( n < maxrec && sendbuf.bufsize - sendbuf.pos >= BINMSG_UPDF_HDRLEN+MAX_RXFRAME_LEN &&
+               (j = rxq_popJob(rxq)) != NULL ) {
+            n += s2e_encRxjobBin(s2ctx, &sendbuf, j);
+        }
+        if( n > 0 )
+            s2e_sendUplink(s2ctx, &sendbuf, 1);
+    }
+}
+
+static void s2e_upbatchtimeout (tmr_t* tmr) {
+    s2e_flushRxjobs((s2ctx_t*)tmr->ctx);
+}
+
+// Optional traffic - skipped while disconnected or the send buffer is congested
+static void s2e_metricstimeout (tmr_t* tmr) {
+    s2ctx_t* s2ctx = tmr->ctx;
+    rt_setTimer(tmr, rt_micros_ahead(METRICS_PUSH_INTV));
+    if( s2ctx->sendhigh )
+        return;
+    ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, METRICS_JSON_SIZE);
+    if( sendbuf.buf == NULL )
+        return;
+    uj_encOpen(&sendbuf, '{');
+    uj_encKV(&sendbuf, "msgtype", 's', "metrics");
+    metrics_json(&sendbuf);
+    uj_encClose(&sendbuf, '}');
+    if( !xeos(&sendbuf) ) {
+        LOG(MOD_S2E|ERROR, "JSON encoding exceeds available buffer space: %d", sendbuf.bufsize);
+        return;
+    }
+    (*s2ctx->sendText)(s2ctx, &sendbuf);
+}
+
+static void s2e_sendRxjobs (s2ctx_t* s2ctx) {
+    if( s2ctx->upbatch && s2e_lingerRxbatch(s2ctx) )
+        return;
+    if( s2ctx->binmsg ) {
+        s2e_flushRxbin(s2ctx);
+        return;
+    }
+    if( s2ctx->upbatch ) {
+        s2e_flushRxbatch(s2ctx);
+        return;
+    }
+    while( rxq_firstJob(&s2ctx->rxq) != NULL ) {
+        // Get a send buffer - parse frame / check filter
+        ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, MIN_UPJSON_SIZE);
+        if( sendbuf.buf == NULL ) {
+            // Websocket has no space - WS will call again
+            return;
+        }
+        rxjob_t* j = rxq_popJob(&s2ctx->rxq);
+        if( !s2e_encRxjob(s2ctx, &sendbuf, j) ) {
             // Frame failed sanity checks or stopped by filters
             sendbuf.pos = 0;
             continue;
         }
-        if( lbuf.buf )
-            log_specialFlush(lbuf.pos);
-        double reftime = 0.0;
-        if( s2ctx->muxtime ) {
-            reftime = s2ctx->muxtime +
-                ts_normalizeTimespanMCU(rt_getTime()-s2ctx->reftime) / 1e6;
-        }
-        uj_encKVn(&sendbuf,
-                  "RefTime",  'T', reftime,
-                  "DR",       'i', j->dr,
-                  "Freq",     'i', j->freq,
-                  "upinfo",   '{',
-                  /**/ "rctx",    'I', j->rctx,
-                  /**/ "xtime",   'I', j->xtime,
-                  /**/ "gpstime", 'I', ts_xtime2gpstime(j->xtime),
-                  /**/ "fts",     'i', j->fts,
-                  /**/ "rssi",    'i', -(s4_t)j->rssi,
-                  /**/ "snr",     'g', j->snr/4.0,
-                  /**/ "rxtime",  'T', rt_getUTC()/1e6,
-                  "}",
-                  NULL);
-        uj_encClose(&sendbuf, '}');
         if( !xeos(&sendbuf) ) {
             LOG(MOD_S2E|ERROR, "JSON encoding exceeds available buffer space: %d", sendbuf.bufsize);
         } else {
-            (*s2ctx->sendText)(s2ctx, &sendbuf);
+            s2e_sendUplink(s2ctx, &sendbuf, 0);
             assert(sendbuf.buf==NULL);
         }
     }
 }
 
+void s2e_flushRxjobs (s2ctx_t* s2ctx) {
+    if( s2ctx->spooling ) {
+        // Muxs not ready - keep frames on disk until router_config arrives again
+        s2e_spoolRxjobs(s2ctx);
+        return;
+    }
+    s2e_sendRxjobs(s2ctx);
+    // Live frames are out - replay spooled frames as long as the websocket takes them
+    while( rxq_firstJob(&s2ctx->rxq) == NULL && s2e_unspoolRxjobs(s2ctx) > 0 )
+        s2e_sendRxjobs(s2ctx);
+    metric_set(MG_rxq_depth, s2ctx->rxq.njobs);
+}
+
 
 
 // --------------------------------------------------------------------------------
@@ -257,38 +591,172 @@ static ustime_t _calcAirTime (rps_t rps, u1_t plen, u1_t nocrc, u2_t preamble) {
     return (((ustime_t)tmp << sfx) * rt_seconds(1) + div/2) / div;
 }
 
+// Airtimes of all LoRa frames with default preamble - filled on first use.
+// Indexed by [sf][bw][nocrc][plen], FSK and odd preambles use the formula.
+static u4_t airtimeTable[SF7-SF12+1][BW500-BW125+1][2][256];
+static u1_t airtimeTableReady;
+
+static void iniAirtimeTable () {
+    for( int sf=SF12; sf<=SF7; sf++ ) {
+        for( int bw=BW125; bw<=BW500; bw++ ) {
+            for( int nocrc=0; nocrc<=1; nocrc++ ) {
+                for( int plen=0; plen<256; plen++ )
+                    airtimeTable[sf][bw][nocrc][plen] = _calcAirTime(rps_make(sf,bw), plen, nocrc, 8);
+            }
+        }
+    }
+    airtimeTableReady = 1;
+}
+
+static ustime_t calcAirTime (rps_t rps, u1_t plen, u1_t nocrc, u2_t preamble) {
+    if( rps == RPS_ILLEGAL || rps_sf(rps) > SF7 || rps_bw(rps) > BW500 || (preamble != 0 && preamble != 8) )
+        return _calcAirTime(rps, plen, nocrc, preamble);
+    if( !airtimeTableReady )
+        iniAirtimeTable();
+    return airtimeTable[rps_sf(rps)][rps_bw(rps)][nocrc!=0][plen];
+}
+
+ustime_t s2e_calcAirTimeRef (rps_t rps, u1_t plen, u1_t nocrc, u2_t preamble) {
+    return _calcAirTime(rps, plen, nocrc, preamble);
+}
+
 ustime_t s2e_calcDnAirTime (rps_t rps, u1_t plen, u1_t addcrc, u2_t preamble) {
-    return _calcAirTime(rps, plen, !addcrc, preamble);
+    return calcAirTime(rps, plen, !addcrc, preamble);
 }
 
 ustime_t s2e_calcUpAirTime (rps_t rps, u1_t plen) {
-    return _calcAirTime(rps, plen, 0, 8);
+    return calcAirTime(rps, plen, 0, 8);
 }
 
-static void send_dntxed (s2ctx_t* s2ctx, txjob_t* txjob) {
-    if( txjob->deveui ) {
-        // Note: dnsched does not have deveui field set - don't report dntxed
-        ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, MIN_UPJSON_SIZE/2);
+dbuf_t s2e_getSendbufClass (s2ctx_t* s2ctx, int minsize, int wsclass) {
+    if( s2ctx->getSendbufClass == NULL )
+        return (*s2ctx->getSendbuf)(s2ctx, minsize);
+    return (*s2ctx->getSendbufClass)(s2ctx, minsize, wsclass);
+}
+
+// Binary dntxed:
+//   0     1     9       17     25      33       41   45  46    47
+//  +-----+-----+-------+------+-------+--------+----+---+-----+
+//  | tag | diid| DevEui| xtime| txtime| gpstime|Freq|DR | rctx|
+//  +-----+-----+-------+------+-------+--------+----+---+-----+
+//  txtime in microseconds - with dnbatch a message may carry several records
+//
+
+static void s2e_encDntxedBin (u1_t* p, const dntxed_t* d) {
+    p[0] = BINMSG_DNTXED;
+    rt_wlsbf8(p+ 1, d->diid);
+    rt_wlsbf8(p+ 9, d->deveui);
+    rt_wlsbf8(p+17, d->xtime);
+    rt_wlsbf8(p+25, d->txtime);
+    rt_wlsbf8(p+33, d->gpstime);
+    rt_wlsbf4(p+41, d->freq);
+    p[45] = d->dr;
+    p[46] = d->txunit;
+}
+
+static void s2e_encDntxed (ujbuf_t* sendbuf, const dntxed_t* d) {
+    uj_encOpen(sendbuf, '{');
+    uj_encKVn(sendbuf,
+              "msgtype",   's', "dntxed",
+              "seqno",     'I', d->diid,    // for older servers (remove if obsoleted)
+              "diid",      'I', d->diid,    // newer servers
+              "DR",        'i', d->dr,
+              "Freq",      'u', d->freq,
+              rt_deveui,   'E', d->deveui,
+              "rctx",      'i', d->txunit,  // antenna that sent this frame
+              "xtime",     'I', d->xtime,
+              "txtime",    'T', d->txtime/1e6,
+              "gpstime",   'I', d->gpstime,
+              NULL);
+    uj_encClose(sendbuf, '}');
+}
+
+// Send TX confirmations d[0..n) - several per message if muxs negotiated dnbatch.
+// Binary messages carry consecutive records, JSON messages become an array of dntxed objects.
+static void s2e_sendDntxed (s2ctx_t* s2ctx, const dntxed_t* d, int n) {
+    int i = 0;
+    while( i < n ) {
+        int minsize = s2ctx->binmsg ? BINMSG_DNTXED_LEN : MIN_UPJSON_SIZE/2;
+        dbuf_t sendbuf = s2e_getSendbufClass(s2ctx, minsize, WSCLASS_CONTROL);
         if( sendbuf.buf == NULL ) {
-            LOG(MOD_S2E|ERROR, "%J - failed to send dntxed, no buffer space", txjob);
+            LOG(MOD_S2E|ERROR, "Failed to send %d dntxed, no buffer space", n-i);
             return;
         }
-        uj_encOpen(&sendbuf, '{');
-        uj_encKVn(&sendbuf,
-                  "msgtype",   's', "dntxed",
-                  "seqno",     'I', txjob->diid,    // for older servers (remove if obsoleted)
-                  "diid",      'I', txjob->diid,    // newer servers
-                  "DR",        'i', txjob->dr,
-                  "Freq",      'u', txjob->freq,
-                  rt_deveui,   'E', txjob->deveui,
-                  "rctx",      'i', txjob->txunit,  // antenna that sent this frame
-                  "xtime",     'I', txjob->xtime,
-                  "txtime",    'T', txjob->txtime/1e6,
-                  "gpstime",   'I', txjob->gpstime,
-                  NULL);
-        uj_encClose(&sendbuf, '}');
+        if( s2ctx->binmsg ) {
+            do {
+                s2e_encDntxedBin((u1_t*)sendbuf.buf + sendbuf.pos, &d[i++]);
+                sendbuf.pos += BINMSG_DNTXED_LEN;
+            } while( i < n && sendbuf.bufsize - sendbuf.pos >= BINMSG_DNTXED_LEN );
+            (*s2ctx->sendBinary)(s2ctx, &sendbuf);
+            continue;
+        }
+        if( n == 1 ) {
+            s2e_encDntxed(&sendbuf, &d[i++]);
+        } else {
+            uj_encOpen(&sendbuf, '[');
+            int k = 0;
+            while( i < n ) {
+                int pos = sendbuf.pos;
+                s2e_encDntxed(&sendbuf, &d[i]);
+                if( sendbuf.pos >= sendbuf.bufsize-1 ) {
+                    // No space left for this record and closing bracket
+                    sendbuf.pos = pos;
+                    break;
+                }
+                i += 1;
+                k += 1;
+            }
+            if( k == 0 ) {
+                LOG(MOD_S2E|ERROR, "JSON encoding exceeds available buffer space: %d", sendbuf.bufsize);
+                i += 1;
+                continue;
+            }
+            uj_encClose(&sendbuf, ']');
+        }
+        if( !xeos(&sendbuf) ) {
+            LOG(MOD_S2E|ERROR, "JSON encoding exceeds available buffer space: %d", sendbuf.bufsize);
+            continue;
+        }
         (*s2ctx->sendText)(s2ctx, &sendbuf);
     }
+}
+
+static void s2e_flushDntxed (s2ctx_t* s2ctx) {
+    rt_clrTimer(&s2ctx->dnbatchTimer);
+    int n = s2ctx->dnpendN;
+    s2ctx->dnpendN = 0;
+    s2e_sendDntxed(s2ctx, s2ctx->dnpend, n);
+}
+
+static void s2e_dnbatchtimeout (tmr_t* tmr) {
+    s2e_flushDntxed((s2ctx_t*)tmr->ctx);
+}
+
+static void send_dntxed (s2ctx_t* s2ctx, txjob_t* txjob) {
+    // Note: dnsched does not have deveui field set - don't report dntxed
+    if( txjob->deveui ) {
+        dntxed_t d = {
+            .diid    = txjob->diid,
+            .deveui  = txjob->deveui,
+            .xtime   = txjob->xtime,
+            .txtime  = txjob->txtime,
+            .gpstime = txjob->gpstime,
+            .freq    = txjob->freq,
+            .dr      = txjob->dr,
+            .txunit  = txjob->txunit,
+        };
+        if( !s2ctx->dnbatch ) {
+            s2e_sendDntxed(s2ctx, &d, 1);
+        } else {
+            // Muxs negotiated batching (router_config dnbatch):
+            // collect confirmations for up to DNBATCH_LINGER or until dnpend is full
+            s2ctx->dnpend[s2ctx->dnpendN++] = d;
+            if( s2ctx->dnpendN >= s2ctx->dnpendMax )
+                s2e_flushDntxed(s2ctx);
+            else if( s2ctx->dnbatchTimer.next == TMR_NIL )
+                rt_setTimer(&s2ctx->dnbatchTimer, rt_micros_ahead(DNBATCH_LINGER));
+        }
+    }
     LOG(MOD_S2E|INFO, "TX %J - %s: %F %.1fdBm ant#%d(%d) DR%d %R frame=%12.4H",
         txjob, txjob->deveui ? "dntxed" : "on air",
         txjob->freq, (double)txjob->txpow/TXPOW_SCALE,
@@ -307,6 +775,9 @@ ustime_t s2e_updateMuxtime(s2ctx_t* s2ctx, double muxstime, ustime_t now) {
 }
 
 
+#if defined(S2E_REGION)
+const rps_t s2e_regionDRs[DR_CNT] = S2E_REGION_DRS;
+#else // !defined(S2E_REGION)
 rps_t s2e_dr2rps (s2ctx_t* s2ctx, u1_t dr) {
     return dr < 16 ? s2ctx->dr_defs[dr] : RPS_ILLEGAL;
 }
@@ -320,12 +791,12 @@ u1_t s2e_rps2dr (s2ctx_t* s2ctx, rps_t rps) {
     }
     return DR_ILLEGAL;
 }
+#endif // !defined(S2E_REGION)
 
 
-static void check_dnfreq (s2ctx_t* s2ctx, ujdec_t* ujd, u4_t* pfreq, u1_t* pchnl) {
-    sL_t freq = uj_int(ujd);
+static int map_dnfreq (s2ctx_t* s2ctx, sL_t freq, u4_t* pfreq, u1_t* pchnl) {
     if( freq < s2ctx->min_freq || freq > s2ctx->max_freq )
-        uj_error(ujd, "Illegal frequency value: %ld - not in range %d..%d", freq, s2ctx->min_freq, s2ctx->max_freq);
+        return 0;
     *pfreq = freq;
     // Find and assign a DN channel to this freq.
     // This channel index is only used locally to tracking duty cycle
@@ -336,7 +807,7 @@ static void check_dnfreq (s2ctx_t* s2ctx, ujdec_t* ujd, u4_t* pfreq, u1_t* pchnl
             break;
         if( freq == s2ctx->dn_chnls[ch] ) {
             *pchnl = ch;
-            return;
+            return 1;
         }
     }
     // New DN frequency detected
@@ -348,11 +819,22 @@ static void check_dnfreq (s2ctx_t* s2ctx, ujdec_t* ujd, u4_t* pfreq, u1_t* pchnl
         s2ctx->dn_chnls[ch] = freq;
     }
     *pchnl = ch;
+    return 1;
+}
+
+static void check_dnfreq (s2ctx_t* s2ctx, ujdec_t* ujd, u4_t* pfreq, u1_t* pchnl) {
+    sL_t freq = uj_int(ujd);
+    if( !map_dnfreq(s2ctx, freq, pfreq, pchnl) )
+        uj_error(ujd, "Illegal frequency value: %ld - not in range %d..%d", freq, s2ctx->min_freq, s2ctx->max_freq);
+}
+
+static int valid_dr (s2ctx_t* s2ctx, sL_t dr) {
+    return dr >= 0 && dr < DR_CNT && s2e_dr2rps(s2ctx, dr) != RPS_ILLEGAL;
 }
 
 static void check_dr (s2ctx_t* s2ctx, ujdec_t* ujd, u1_t* pdr) {
     sL_t dr = uj_int(ujd);
-    if( dr < 0 || dr >= DR_CNT || s2ctx->dr_defs[dr] == RPS_ILLEGAL )
+    if( !valid_dr(s2ctx, dr) )
         uj_error(ujd, "Illegal datarate value: %d for region %s", dr, s2ctx->region_s);
     *pdr = dr;
 }
@@ -403,6 +885,28 @@ static void updateAirtimeTxpow (s2ctx_t* s2ctx, txjob_t* txjob) {
     txjob->txpow = calcTxpow(s2ctx, txjob);
 }
 
+static ustime_t s2e_dcFreeEU863 (s2ctx_t* s2ctx, txjob_t* txjob, u1_t txunit) {
+    return s2ctx->txunits[txunit].dc_eu863bands[freq2band(txjob->freq)];
+}
+
+static ustime_t s2e_dcFreePerChnl (s2ctx_t* s2ctx, txjob_t* txjob, u1_t txunit) {
+    return s2ctx->txunits[txunit].dc_perChnl[txjob->dnchnl];
+}
+
+// Earliest DC legal txtime of txjob's band/channel on any of the given antennas.
+// The DC tables already hold the next free time, so this is a few lookups
+// instead of probing canTx for each antenna and retry time.
+static ustime_t dcEarliest (s2ctx_t* s2ctx, txjob_t* txjob, u1_t txunit, u1_t alts) {
+    if( s2e_dcDisabled )
+        return USTIME_MIN;
+    ustime_t t = DC_FREE(s2ctx, txjob, txunit);
+    for( u1_t u=0; alts && t > txjob->txtime; u++, alts >>= 1 ) {
+        if( (alts & 1) )
+            t = min(t, DC_FREE(s2ctx, txjob, u));
+    }
+    return t;
+}
+
 static int calcPriority (txjob_t* txjob) {
     int prio = txjob->prio;
     if( txjob->rx2freq || ((txjob->txflags & TXFLAG_CLSC) && txjob->retries < CLASS_C_BACKOFF_MAX) )
@@ -446,12 +950,46 @@ static int altTxTime (s2ctx_t* s2ctx, txjob_t* txjob, ustime_t earliest) {
         txjob->txtime += CLASS_C_BACKOFF_BY;
         if( txjob->txtime < earliest )
             goto again;
+        // Jump over backoff steps which would fail for lack of DC on all antennas
+        u1_t txunit = ral_rctx2txunit(txjob->rctx);
+        ustime_t dcfree = dcEarliest(s2ctx, txjob, txunit, (*s2ctx->altAntennas)(txunit));
+        if( dcfree > txjob->txtime ) {
+            ustime_t steps = (dcfree - txjob->txtime + CLASS_C_BACKOFF_BY-1) / CLASS_C_BACKOFF_BY;
+            if( dcfree == USTIME_MAX || txjob->retries + steps > CLASS_C_BACKOFF_MAX ) {
+                if( txjob->rx2freq )
+                    goto again;  // RX2 might have DC
+                LOG(MOD_S2E|VERBOSE, "%J - class C no DC within remaining TX tries", txjob);
+                return 0;
+            }
+            txjob->retries += steps;
+            txjob->xtime += steps * CLASS_C_BACKOFF_BY;
+            txjob->txtime += steps * CLASS_C_BACKOFF_BY;
+        }
+        // Skip over TX slots already taken on the preferred antenna
+        txord_t* q = &s2ctx->txunits[ral_rctx2txunit(txjob->rctx)].q;
+        ustime_t t = txord_freeSlot(&s2ctx->txq, q, txjob->txtime, txjob->airtime, TX_MIN_GAP);
+        txjob->xtime += t - txjob->txtime;
+        txjob->txtime = t;
         return 1;
     }
     if( (txjob->txflags & TXFLAG_PING) ) {
-        // Class B ping slot - server currently supplies only one time slot
-        LOG(MOD_S2E|VERBOSE, "%J - class B ping has no alternate TX time", txjob);
-        return 0;
+        if( txjob->pingPeriod == 0 ) {
+            // Class B ping slot - server supplied only one time slot
+            LOG(MOD_S2E|VERBOSE, "%J - class B ping has no alternate TX time", txjob);
+            return 0;
+        }
+        // Next ping slot of this device within the same beacon period
+        sL_t gpstime = txjob->gpstime + max((sL_t)1, (sL_t)(earliest - txjob->txtime));
+        gpstime = s2e_nextPingSlot(gpstime, txjob->pingPeriod, txjob->pingOffset);
+        sL_t xtime = gpstime ? ts_gpstime2xtime(txjob->txunit, gpstime) : 0;
+        if( gpstime == 0 || gpstime / BEACON_INTVL != txjob->gpstime / BEACON_INTVL || xtime == 0 ) {
+            LOG(MOD_S2E|VERBOSE, "%J - class B no more ping slots in beacon period", txjob);
+            return 0;
+        }
+        txjob->gpstime  = gpstime;
+        txjob->xtime    = xtime;
+        txjob->txtime   = ts_xtime2ustime(xtime);
+        return 1;
     }
     // Class A
     if( txjob->rx2freq == 0 ) {
@@ -467,6 +1005,7 @@ static int altTxTime (s2ctx_t* s2ctx, txjob_t* txjob, ustime_t earliest) {
     updateAirtimeTxpow(s2ctx, txjob);
     if( txjob->txtime < earliest ) {
         LOG(MOD_S2E|VERBOSE, "%J - too late for RX2 by %~T", txjob, earliest - txjob->txtime);
+        txRejWhy = MC_tx_rej_toolate;
         return 0;
     }
     LOG(MOD_S2E|VERBOSE, "%J - trying RX2 %F DR%d", txjob, txjob->freq, txjob->dr);
@@ -476,7 +1015,7 @@ static int altTxTime (s2ctx_t* s2ctx, txjob_t* txjob, ustime_t earliest) {
 
 static int s2e_canTxEU863 (s2ctx_t* s2ctx, txjob_t* txjob, int* ccaDisabled) {
     ustime_t txtime = txjob->txtime;
-    ustime_t band_exp = s2ctx->txunits[txjob->txunit].dc_eu863bands[freq2band(txjob->freq)];
+    ustime_t band_exp = s2e_dcFreeEU863(s2ctx, txjob, txjob->txunit);
     if( txtime >= band_exp ) {
         
         return 1;   // clear channel analysis not required
@@ -490,7 +1029,7 @@ static int s2e_canTxEU863 (s2ctx_t* s2ctx, txjob_t* txjob, int* ccaDisabled) {
 
 static int s2e_canTxPerChnlDC (s2ctx_t* s2ctx, txjob_t* txjob, int* ccaDisabled) {
     ustime_t txtime = txjob->txtime;
-    ustime_t chfree = s2ctx->txunits[txjob->txunit].dc_perChnl[txjob->dnchnl];
+    ustime_t chfree = s2e_dcFreePerChnl(s2ctx, txjob, txjob->txunit);
     if( txtime >= chfree )
         return 2;  // can send if channel clear
     LOG(MOD_S2E|VERBOSE, "%J %F - no DC in channel: txtime=%>.3T until=%>.3T",
@@ -507,6 +1046,13 @@ static int s2e_canTxPerChnlDC (s2ctx_t* s2ctx, txjob_t* txjob, int* ccaDisabled)
 }
 
 
+// Record admission decision - rej is MC_tx_rej_xxx or 0 if placed
+static inline void traceTx (txjob_t* txjob, int relocate, ustime_t now, int rej) {
+    trace_rec(now, TRACE_TXADM, txjob->txunit | relocate<<7, rej ? TRACE_TX_DC + rej - MC_tx_rej_dc : TRACE_OK,
+              txjob->freq, trace_clamp(txjob->txtime - now));
+}
+
+
 // Add a txjob to the TX queue and insert ordered by txtime.
 // Only basic exclusion constraints are checked for newly arriving txjobs:
 // Independent on antenna choice:
@@ -524,17 +1070,22 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
         // txjob is fresh entry from LNS and not one that got reschduled due to TX conflicts
         ustime_t txtime = txjob->txtime;    //
         txunit = txjob->txunit = ral_rctx2txunit(txjob->rctx);
-        txjob->altAnts = ral_altAntennas(txunit);
+        txjob->altAnts = (*s2ctx->altAntennas)(txunit);
         updateAirtimeTxpow(s2ctx, txjob);
+        metric_obs(MH_tx_lead, txtime - now);
 
         if( txtime > now + TX_MAX_AHEAD ) {
             LOG(MOD_S2E|WARNING, "%J - Tx job too far ahead: %~T", txjob, txtime-now);
+            metric_inc(MC_tx_rej_other);
+            traceTx(txjob, relocate, now, MC_tx_rej_other);
             return 0;
         }
 
-        if( txtime < earliest  &&  !altTxTime(s2ctx, txjob, earliest) )
-            
+        if( txtime < earliest  &&  !altTxTime(s2ctx, txjob, earliest) ) {
+            metric_inc(MC_tx_rej_toolate);
+            traceTx(txjob, relocate, now, MC_tx_rej_toolate);
             return 0;
+        }
         goto start;
     }
   check_alt: {
@@ -543,12 +1094,13 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
             // No more alternative antennas - try later TX time
             if( !altTxTime(s2ctx, txjob, earliest) ) {
                 LOG(MOD_S2E|WARNING, "%J - unable to place frame", txjob);
-                
+                metric_inc(txRejWhy);
+                traceTx(txjob, relocate, now, txRejWhy);
                 return 0;
             }
             // and reset antenna options
             txunit = txjob->txunit = ral_rctx2txunit(txjob->rctx);
-            txjob->altAnts = ral_altAntennas(txunit);
+            txjob->altAnts = (*s2ctx->altAntennas)(txunit);
         } else {
             // Try to find alternative antenna
             txunit = 0;
@@ -559,32 +1111,34 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
         }
     }
   start: {
+        if( dcEarliest(s2ctx, txjob, txunit, txjob->altAnts) > txjob->txtime ) {
+            // No antenna left with DC at this txtime - skip probing them one by one
+            LOG(MOD_S2E|VERBOSE, "%J %F - no DC on any antenna", txjob, txjob->freq);
+            txjob->altAnts = 0;
+            txRejWhy = MC_tx_rej_dc;
+            goto check_alt;
+        }
         int ccaDisabled = 0;
-        if( !s2e_dcDisabled && !(*s2ctx->canTx)(s2ctx, txjob, &ccaDisabled) )
+        if( !s2e_dcDisabled && !CAN_TX(s2ctx, txjob, &ccaDisabled) ) {
+            txRejWhy = MC_tx_rej_dc;
             goto check_alt;
+        }
         ustime_t txtime = txjob->txtime;
-        txidx_t* pidx = &s2ctx->txunits[txunit].head;
-        txidx_t  idx  = pidx[0];
-        txjob_t* curr = txq_idx2job(&s2ctx->txq, idx);
+        s2txunit_t* u = &s2ctx->txunits[txunit];
+        txjob_t* curr = txord_job(&s2ctx->txq, &u->q, 0);
         if( curr && (curr->txflags & TXFLAG_TXING) && txtime < curr->txtime + curr->airtime + TX_MIN_GAP ) {
             // Would interfer with currently ongoing TX
             LOG(MOD_S2E|DEBUG, "%J - frame colliding with ongoing TX on ant#%d", txjob, txunit);
+            txRejWhy = MC_tx_rej_collision;
             goto check_alt;
         }
         // Insert into Q by ascending txtime
-        do {
-            if( idx == TXIDX_END  ||  txtime < curr->txtime ) {
-                // Found my place - insert/append
-                assert(txjob->next == TXIDX_NIL);
-                txjob->next = idx;
-                pidx[0] = txq_job2idx(&s2ctx->txq, txjob);
-                if( pidx == &s2ctx->txunits[txunit].head ) // new txjob is head of q?
-                    rt_yieldTo(&s2ctx->txunits[txunit].timer, s2e_txtimeout);
-                return 1;
-            }
-            idx = (pidx = &curr->next)[0];
-            curr = txq_idx2job(&s2ctx->txq, idx);
-        } while(1);
+        if( txord_insJob(&s2ctx->txq, &u->q, txjob) == 0 ) // new txjob is head of q?
+            rt_yieldTo(&u->timer, s2e_txtimeout);
+        if( !relocate )
+            metric_inc(MC_tx_admitted);
+        traceTx(txjob, relocate, now, 0);
+        return 1;
     }
 }
 
@@ -606,11 +1160,11 @@ int s2e_addTxjob (s2ctx_t* s2ctx, txjob_t* txjob, int relocate, ustime_t now) {
 //
 ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
     ustime_t now = rt_getTime();
-    txidx_t *phead = &s2ctx->txunits[txunit].head;
- again:
-    if( phead[0] == TXIDX_END )
+    txord_t* q = &s2ctx->txunits[txunit].q;
+ again:;
+    txjob_t* curr = txord_job(&s2ctx->txq, q, 0);
+    if( curr == NULL )
         return USTIME_MAX;
-    txjob_t* curr = txq_idx2job(&s2ctx->txq, phead[0]);
     ustime_t txdelta = curr->txtime - now;
 
     if( (curr->txflags & TXFLAG_TXING) ) {
@@ -622,9 +1176,10 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
             if( !(curr->txflags & TXFLAG_TXCHECKED) ) {
                 update_DC(s2ctx, curr);
                 curr->txflags |= TXFLAG_TXCHECKED;
+                metric_inc(MC_tx_emitted);
                 send_dntxed(s2ctx, curr);
             }
-            txq_unqJob(&s2ctx->txq, phead);
+            txord_unqJob(&s2ctx->txq, q, 0);
             txq_freeJob(&s2ctx->txq, curr);
             goto again;
         }
@@ -632,25 +1187,19 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
         if( !(curr->txflags & TXFLAG_TXCHECKED) ) {
             if( txdelta > -TXCHECK_FUDGE )
                 return curr->txtime + TXCHECK_FUDGE;
-            int txs = ral_txstatus(txunit);
+            int txs = (*s2ctx->radioTxstatus)(txunit);
             if( txs != TXSTATUS_EMITTING ) {
                 // Something went wrong - should be emitting
                 LOG(MOD_S2E|ERROR, "%J - radio is not emitting frame - abandoning TX, trying alternative", curr);
-                ral_txabort(txunit);
+                (*s2ctx->radioTxabort)(txunit);
                 curr->txflags &= ~TXFLAG_TXING;
+                txRejWhy = MC_tx_rej_other;
                 goto check_alt;
             }
             // Looks like it's on air
             update_DC(s2ctx, curr);
-            
-            
-            
-            
-            
-            
-            
-
             curr->txflags |= TXFLAG_TXCHECKED;
+            metric_inc(MC_tx_emitted);
             // sending dntxed here instead @txend gives nwks more time to update/inform muxs (join)
             send_dntxed(s2ctx, curr);
         }
@@ -659,8 +1208,9 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
     if( txdelta < TX_MIN_GAP ) {
         // Missed TX start time - try alternative or drop frame
         LOG(MOD_S2E|ERROR, "%J - missed TX time: txdelta=%~T min=%~T", curr, txdelta, TX_MIN_GAP);
+        txRejWhy = MC_tx_rej_toolate;
       check_alt:
-        txq_unqJob(&s2ctx->txq, phead);
+        txord_unqJob(&s2ctx->txq, q, 0);
         if( !s2e_addTxjob(s2ctx, curr, /*relocate*/1, now) )  // note: might change queue head! (reload @ again)
             txq_freeJob(&s2ctx->txq, curr);
         goto again;
@@ -668,6 +1218,8 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
     // Txtime time too far out Head is TXable - is it time to feed the radio?
     if( txdelta > TX_AIM_GAP ) {
         LOG(MOD_S2E|DEBUG, "%J - next TX start ahead by %~T", curr, txdelta);
+        if( TX_PRESTAGE )
+            (*s2ctx->radioTxprep)(curr, s2ctx);
         return curr->txtime - TX_AIM_GAP;
     }
 
@@ -683,57 +1235,69 @@ ustime_t s2e_nextTxAction (s2ctx_t* s2ctx, u1_t txunit) {
     }
     if( curr->xtime == 0 ) {
         LOG(MOD_S2E|ERROR, "%J - time sync problems - trying alternative", curr);
+        txRejWhy = MC_tx_rej_other;
         goto check_alt;
     }
     // Txtime close enough to make a decision
     // Check channel access
     int ccaDisabled = s2e_ccaDisabled;
-    if( !s2e_dcDisabled && !(*s2ctx->canTx)(s2ctx, curr, &ccaDisabled) )
+    if( !s2e_dcDisabled && !CAN_TX(s2ctx, curr, &ccaDisabled) ) {
+        txRejWhy = MC_tx_rej_dc;
         goto check_alt;
+    }
 
     // Check collision with subsequent frames and weigh priorities
     // Assuming a txjob with later txstart time is not blocked by duty cycle
     // if the earlier current txjob isn't
     ustime_t txend = curr->txtime + curr->airtime;
-    txjob_t* other_txjob = curr;
+    txjob_t* other_txjob;
     int prio = calcPriority(curr);
-    do {
-        other_txjob = txq_idx2job(&s2ctx->txq, other_txjob->next);
-        if( other_txjob == NULL )
-            break;
+    for( int pos=1; (other_txjob = txord_job(&s2ctx->txq, q, pos)) != NULL; pos++ ) {
         if( txend < other_txjob->txtime - TX_MIN_GAP )
             break;  // no overlap
         int oprio = calcPriority(other_txjob);
         if( prio < oprio ) {
             LOG(MOD_S2E|ERROR, "%J - Hindered by %J %~T later: prio %d<%d - trying alternative",
                 curr, other_txjob, other_txjob->txtime - curr->txtime, prio, oprio);
+            txRejWhy = MC_tx_rej_collision;
             goto check_alt;
         }
-    } while(1);
+    }
 
-    LOG(MOD_S2E|VERBOSE, "%J - starting TX in %~T", curr, txdelta);
-    int txerr = ral_tx(curr, s2ctx, ccaDisabled);
+    ustime_t t0 = rt_getTime();
+    int txerr = (*s2ctx->radioTx)(curr, s2ctx, ccaDisabled);
+    ustime_t t1 = rt_getTime();
+    metric_obs(MH_tx_submit, t1 - t0);
+    LOG(MOD_S2E|VERBOSE, "%J - started TX in %~T (handed to radio in %~T)", curr, curr->txtime - t1, t1 - t0);
     if( txerr != RAL_TX_OK ) {
         if( txerr == RAL_TX_NOCA ) {
             LOG(MOD_S2E|ERROR, "%J - channel busy - trying alternative", curr);
+            txRejWhy = MC_tx_rej_cca;
         } else {
             LOG(MOD_S2E|ERROR, "%J - radio layer failed to TX - trying alternative", curr);
+            txRejWhy = MC_tx_rej_other;
         }
         goto check_alt;
     }
     curr->txflags |= TXFLAG_TXING;
+    metric_obs(MH_tx_handoff, curr->txtime - t1);
 
     // Unqueue all overlapping subsequent txjobs and find alternatives (antenna/txtime)
     // If no alternatives drop txjob.
     while(1) {
-        txjob_t* next_txjob = txq_idx2job(&s2ctx->txq, curr->next);
+        txjob_t* next_txjob = txord_job(&s2ctx->txq, q, 1);
         if( next_txjob == NULL || txend < next_txjob->txtime - TX_MIN_GAP )
             break;  // no next or no overlap
         LOG(MOD_S2E|INFO, "%J - displaces %J due to %~T overlap", curr, next_txjob, next_txjob->txtime - TX_MIN_GAP - txend);
-        txq_unqJob(&s2ctx->txq, &curr->next);
+        txord_unqJob(&s2ctx->txq, q, 1);
+        txRejWhy = MC_tx_rej_collision;
         if( !s2e_addTxjob(s2ctx, next_txjob, /*relocate*/1, now) )  // note: might change next!
             txq_freeJob(&s2ctx->txq, next_txjob);
     }
+    // Pipeline: prepare the next frame while this one is on air
+    txjob_t* next_txjob = txord_job(&s2ctx->txq, q, 1);
+    if( TX_PRESTAGE && next_txjob )
+        (*s2ctx->radioTxprep)(next_txjob, s2ctx);
     return curr->txtime + TXCHECK_FUDGE;
 }
 
@@ -791,7 +1355,13 @@ static void s2e_bcntimeout (tmr_t* tmr) {
     txjob->txflags = TXFLAG_BCN;
     txjob->prio    = PRIO_BEACON;
     txjob->len     = bcn_len;
-    s2e_make_beacon(s2ctx->bcn.layout, epoch*128, 0, lat, lon, p);
+    if( !s2ctx->bcn.tmplok || lat != s2ctx->bcn.lat || lon != s2ctx->bcn.lon ) {
+        s2e_prep_beacon(s2ctx->bcn.layout, 0, lat, lon, s2ctx->bcn.tmpl);
+        s2ctx->bcn.lat = lat;
+        s2ctx->bcn.lon = lon;
+        s2ctx->bcn.tmplok = 1;
+    }
+    s2e_stamp_beacon(s2ctx->bcn.layout, s2ctx->bcn.tmpl, epoch*128, p);
 
     txq_commitJob(&s2ctx->txq, txjob);
     if( !s2e_addTxjob(s2ctx, txjob, /*initial placement*/0, now) )
@@ -844,6 +1414,61 @@ inline static void upch_insert (chdefl_t* upchs, uint idx, u4_t freq, u1_t bw, u
     upchs->rps[idx].maxSF = maxSF;
 }
 
+// Select region specific TX policies (duty cycle, CCA, TX power).
+int s2e_setRegion (s2ctx_t* s2ctx, str_t region, ujcrc_t regionCrc) {
+    snprintf(s2ctx->region_s, sizeof(s2ctx->region_s), "%s", region);
+    s2ctx->region = regionCrc;
+#if defined(S2E_REGION)
+    if( regionCrc != S2E_REGION ) {
+        LOG(MOD_S2E|ERROR, "Region %s not supported - station built for region %s only", region, S2E_REGION_S);
+        return 0;
+    }
+#endif // defined(S2E_REGION)
+    switch( s2ctx->region ) {
+    case J_EU863: {
+        s2ctx->canTx  = s2e_canTxEU863;
+        s2ctx->dcFree = s2e_dcFreeEU863;
+        s2ctx->txpow  = 16 * TXPOW_SCALE;
+        s2ctx->txpow2 = 27 * TXPOW_SCALE;
+        s2ctx->txpow2_freq[0] = 869400000;
+        s2ctx->txpow2_freq[1] = 869650000;
+        resetDC(s2ctx, 3600/100);  // 100s / 1h cummulative on time under PSA = ~2.78%
+        break;
+    }
+    case J_IL915: {
+        s2ctx->txpow  = 14 * TXPOW_SCALE;
+        s2ctx->txpow2 = 20 * TXPOW_SCALE;
+        s2ctx->txpow2_freq[0] = 916200000;
+        s2ctx->txpow2_freq[1] = 916400000;
+        resetDC(s2ctx, 100);      // 1%
+        break;
+    }
+    case J_KR920: {
+        s2ctx->ccaEnabled = 1;
+        s2ctx->canTx = s2e_canTxPerChnlDC;
+        s2ctx->dcFree = s2e_dcFreePerChnl;
+        s2ctx->txpow = 23 * TXPOW_SCALE;
+        resetDC(s2ctx, 50);      // 2%
+        break;
+    }
+    case J_AS923JP: {
+        s2ctx->ccaEnabled = 1;
+        s2ctx->canTx = s2e_canTxPerChnlDC;
+        s2ctx->dcFree = s2e_dcFreePerChnl;
+        s2ctx->txpow = 13 * TXPOW_SCALE;
+        resetDC(s2ctx, 10);      // 10%
+
+        break;
+    }
+    case J_US902: {
+        s2ctx->txpow = 30 * TXPOW_SCALE;
+        break;
+    }
+    }
+    return 1;
+}
+
+
 static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
     char hwspec[MAX_HWSPEC_SIZE] = { 0 };
     ujbuf_t sx130xconf = { .buf=NULL };
@@ -854,7 +1479,8 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
     chdefl_t upchs = {{0}};
     int chslots = 0;
     s2bcn_t bcn = { 0 };
-        
+
+    s2e_resetDevaddrFilter(0);  // off unless present in this router_config
     while( (field = uj_nextField(D)) ) {
         switch(field) {
         case J_freq_range: {
@@ -927,18 +1553,42 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
             }
             break;
         }
+        case J_DevAddrFilter: {
+            // Items: NetID (24 bit) or [DevAddr, prefix length]
+            if( !uj_null(D) ) {
+                s2e_resetDevaddrFilter(1);
+                uj_enterArray(D);
+                while( uj_nextSlot(D) >= 0 ) {
+                    u4_t addr;
+                    int bits;
+                    if( uj_nextValue(D) == UJ_ARRAY ) {
+                        uj_enterArray(D);
+                        addr = (uj_nextSlot(D), uj_uint(D));
+                        bits = (uj_nextSlot(D), uj_intRange(D, 0, 32));
+                        uj_exitArray(D);
+                    } else {
+                        bits = s2e_netid2prefix(uj_intRange(D, 0, 0xFFFFFF), &addr);
+                    }
+                    if( !s2e_addDevaddrPrefix(addr, bits) ) {
+                        LOG(MOD_S2E|ERROR, "Too many DevAddr filter prefixes - max %d supported",
+                            min(MAX_DEVADDR_PREFIXES, DEVADDR_PREFIX_LIMIT));
+                    }
+                }
+                uj_exitArray(D);
+            }
+            break;
+        }
         case J_JoinEUI: {
             rt_joineui = "JoinEUI";
             rt_deveui  = "DevEUI";
             // FALL THRU
         }
         case J_JoinEui: {
-            for( int i=0; i<2*MAX_JOINEUI_RANGES; i++ )
-                s2e_joineuiFilter[i] = 0;
             if( !uj_null(D) ) {
                 uj_enterArray(D);
                 int off;
                 while( (off = uj_nextSlot(D)) >= 0 ) {
+                    jlistlen = off+1;
                     uj_enterArray(D);
                     if( off < MAX_JOINEUI_RANGES ) {
                         s2e_joineuiFilter[2*off+0] = (uj_nextSlot(D), uj_int(D));
@@ -949,54 +1599,14 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
                     uj_exitArray(D);
                 }
                 uj_exitArray(D);
-                jlistlen = min(off, MAX_JOINEUI_RANGES);
-                s2e_joineuiFilter[2*jlistlen] = 0; // terminate list
-                
+                s2e_setJoineuiFilter(s2e_joineuiFilter, min(jlistlen, (int)MAX_JOINEUI_RANGES));
+            } else {
+                s2e_setJoineuiFilter(s2e_joineuiFilter, 0);
             }
             break;
         }
         case J_region: {
-            const char* s = uj_str(D);
-            snprintf(s2ctx->region_s, sizeof(s2ctx->region_s), "%s", s);
-            s2ctx->region = D->str.crc;
-            switch( s2ctx->region ) {
-            case J_EU863: {
-                s2ctx->canTx  = s2e_canTxEU863;
-                s2ctx->txpow  = 16 * TXPOW_SCALE;
-                s2ctx->txpow2 = 27 * TXPOW_SCALE;
-                s2ctx->txpow2_freq[0] = 869400000;
-                s2ctx->txpow2_freq[1] = 869650000;
-                resetDC(s2ctx, 3600/100);  // 100s / 1h cummulative on time under PSA = ~2.78%
-                break;
-            }
-            case J_IL915: {
-                s2ctx->txpow  = 14 * TXPOW_SCALE;
-                s2ctx->txpow2 = 20 * TXPOW_SCALE;
-                s2ctx->txpow2_freq[0] = 916200000;
-                s2ctx->txpow2_freq[1] = 916400000;
-                resetDC(s2ctx, 100);      // 1%
-                break;
-            }
-            case J_KR920: {
-                s2ctx->ccaEnabled = 1;
-                s2ctx->canTx = s2e_canTxPerChnlDC;
-                s2ctx->txpow = 23 * TXPOW_SCALE;
-                resetDC(s2ctx, 50);      // 2%
-                break;
-            }
-            case J_AS923JP: {
-                s2ctx->ccaEnabled = 1;
-                s2ctx->canTx = s2e_canTxPerChnlDC;
-                s2ctx->txpow = 13 * TXPOW_SCALE;
-                resetDC(s2ctx, 10);      // 10%
-
-                break;
-            }
-            case J_US902: {
-                s2ctx->txpow = 30 * TXPOW_SCALE;
-                break;
-            }
-            }
+            s2e_setRegion(s2ctx, uj_str(D), D->str.crc);
             break;
         }
         case J_max_eirp: {
@@ -1011,6 +1621,21 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
             rt_utcOffset_ts = s2ctx->reftime;
             break;
         }
+        case J_binmsg: {
+            // Muxs accepts/sends binary messages (feature binmsg)
+            s2ctx->binmsg = uj_bool(D);
+            break;
+        }
+        case J_upbatch: {
+            // Muxs accepts multiple updf frames per message (feature upbatch)
+            s2ctx->upbatch = uj_bool(D) && UPBATCH_MAX > 1;
+            break;
+        }
+        case J_dnbatch: {
+            // Muxs accepts multiple dntxed records per message (feature dnbatch)
+            s2ctx->dnbatch = uj_bool(D) && s2ctx->dnpend != NULL;
+            break;
+        }
         case J_hwspec: {
             str_t s = uj_str(D);
             if( D->str.len > sizeof(hwspec)-1 )
@@ -1099,6 +1724,11 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
                 }
             }
             uj_exitObject(D);
+            if( (bcn.ctrl&0xF0) != 0 && !s2e_checkBeaconLayout(bcn.layout) ) {
+                LOG(MOD_S2E|ERROR, "Illegal beacon layout %d/%d/%d (max length %d) - beaconing disabled",
+                    bcn.layout[0], bcn.layout[1], bcn.layout[2], BCN_MAXLEN);
+                bcn.ctrl = 0;
+            }
             break;
         }
         default: {
@@ -1112,6 +1742,19 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
         LOG(MOD_S2E|ERROR, "No 'hwspec' in 'router_config' message");
         return 0;
     }
+#if defined(S2E_REGION)
+    if( s2ctx->region != S2E_REGION ) {
+        LOG(MOD_S2E|ERROR, "'router_config' for region '%s' rejected - station built for region %s", s2ctx->region_s, S2E_REGION_S);
+        return 0;
+    }
+    for( int dr=0; dr<DR_CNT; dr++ ) {
+        if( s2ctx->dr_defs[dr] != s2e_regionDRs[dr] ) {
+            LOG(MOD_S2E|ERROR, "'router_config' rejected - DR%d %R does not match builtin %R of region %s",
+                dr, s2ctx->dr_defs[dr], s2e_regionDRs[dr], S2E_REGION_S);
+            return 0;
+        }
+    }
+#endif // defined(S2E_REGION)
     if( sx130xconf.buf == NULL ) {
         LOG(MOD_S2E|ERROR, "No 'sx1301_conf' or 'sx1302_conf' in 'router_config' message");
         return 0;
@@ -1136,12 +1779,25 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
             upchs.freq[chslot], 0, FSK, FSK);
         }
     }
-    ts_iniTimesync();
-    if( !ral_config(hwspec,
-                    s2ctx->ccaEnabled ? s2ctx->region : 0,
-                    sx130xconf.buf, sx130xconf.bufsize,
-                    &upchs) ) {
-        return 0;
+    // Restart radio only if the radio setup differs from the one currently running
+    u4_t cca_region = s2ctx->ccaEnabled ? s2ctx->region : 0;
+    u4_t ralcrc = rt_crc32(0, hwspec, strlen(hwspec));
+    ralcrc = rt_crc32(ralcrc, &cca_region, sizeof(cca_region));
+    ralcrc = rt_crc32(ralcrc, sx130xconf.buf, sx130xconf.bufsize);
+    ralcrc = rt_crc32(ralcrc, upchs.freq, sizeof(upchs.freq));
+    ralcrc = rt_crc32(ralcrc, upchs.rps, sizeof(upchs.rps));
+    rt_clrTimer(&radioLingerTmr);
+    if( ralcrc != ralConfigCrc ) {
+        ralConfigCrc = 0;
+        ts_iniTimesync();
+        if( !ral_config(hwspec, cca_region,
+                        sx130xconf.buf, sx130xconf.bufsize,
+                        &upchs) ) {
+            return 0;
+        }
+        ralConfigCrc = ralcrc;
+    } else {
+        LOG(MOD_S2E|INFO, "Radio setup unchanged - radio keeps running");
     }
     // Override local settings with server settings if provided
     if( ccaDisabled   ) s2e_ccaDisabled   = ccaDisabled   & 2;
@@ -1169,13 +1825,27 @@ static int handle_router_config (s2ctx_t* s2ctx, ujdec_t* D) {
             LOG(MOD_S2E|VERBOSE, "            %.1f dBm EIRP for %F..%F",
                 s2ctx->txpow2/(double)TXPOW_SCALE, s2ctx->txpow2_freq[0], s2ctx->txpow2_freq[1]);
         }
-        LOG(MOD_S2E|VERBOSE, "  %s list: %d entries", rt_joineui, jlistlen);
+        LOG(MOD_S2E|VERBOSE, "  %s list: %d entries (%d merged ranges)", rt_joineui, jlistlen, s2e_joineuiFilterLen);
         LOG(MOD_S2E|VERBOSE, "  NetID filter: %08X-%08X-%08X-%08X",
             s2e_netidFilter[3], s2e_netidFilter[2], s2e_netidFilter[1], s2e_netidFilter[0]);
+        for( int i=0; i < s2e_devaddrPrefixCnt; i++ )
+            LOG(MOD_S2E|VERBOSE, "  DevAddr prefix: %08X/%d", s2e_devaddrPrefixes[i].addr, s2e_devaddrPrefixes[i].bits);
         LOG(MOD_S2E|VERBOSE, "  Dev/test settings: nocca=%d nodc=%d nodwell=%d",
             (s2e_ccaDisabled!=0), (s2e_dcDisabled!=0), (s2e_dwellDisabled!=0));
     }
-    if( (bcn.ctrl&0xF0) != 0 ) {
+    if( (bcn.ctrl&0xF0) == 0 ) {
+        if( (s2ctx->bcn.ctrl&0xF0) != 0 ) {
+            LOG(MOD_S2E|VERBOSE, "Beaconing stopped");
+            rt_clrTimer(&s2ctx->bcntimer);
+            memset(&s2ctx->bcn, 0, sizeof(s2ctx->bcn));
+        }
+    }
+    else if( bcn.ctrl == s2ctx->bcn.ctrl && s2ctx->bcntimer.next != TMR_NIL &&
+             memcmp(bcn.layout, s2ctx->bcn.layout, sizeof(bcn.layout)) == 0 &&
+             memcmp(bcn.freqs, s2ctx->bcn.freqs, sizeof(bcn.freqs)) == 0 ) {
+        // Same beacon setup - keep running schedule
+    }
+    else {
         // At least one beacon frequency was specified
         LOG(MOD_S2E|VERBOSE, "Beaconing every %~T on %F(%d) @ DR%d (frame layout %d/%d/%d)",
             BEACON_INTVL, bcn.freqs[0],
@@ -1194,6 +1864,7 @@ void handle_dnframe (s2ctx_t* s2ctx, ujdec_t* D) {
     txjob_t* txjob = txq_reserveJob(&s2ctx->txq);
     if( txjob == NULL ) {
         LOG(MOD_S2E|ERROR, "Out of TX jobs - dropping incoming message");
+        metric_inc(MC_tx_rej_other);
         return;
     }
     int flags = 0;
@@ -1275,6 +1946,7 @@ void handle_dnframe (s2ctx_t* s2ctx, ujdec_t* D) {
     txjob->txtime = ts_xtime2ustime(txjob->xtime);
     if( txjob->xtime == 0 || txjob->txtime == 0 ) {
         LOG(MOD_S2E|ERROR, "%J - dropped due to time conversion problems (MCU/GPS out of sync, obsolete input) - xtime=%ld", txjob, txjob->xtime);
+        metric_inc(MC_tx_rej_other);
         return;  // illegal/obsolete xtime
     }
     txq_commitJob(&s2ctx->txq, txjob);
@@ -1283,131 +1955,8 @@ void handle_dnframe (s2ctx_t* s2ctx, ujdec_t* D) {
 }
 
 
-void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
-    ustime_t now = rt_getTime();
-    txjob_t* txjob = txq_reserveJob(&s2ctx->txq);
-    if( txjob == NULL ) {
-        LOG(MOD_S2E|ERROR, "Out of TX jobs - dropping incoming message");
-        return;
-    }
-    int flags = 0;
-    ujcrc_t field;
-    while( (field = uj_nextField(D)) ) {
-        switch(field) {
-        case J_msgtype: {
-            uj_skipValue(D);
-            break;
-        }
-        case J_DevEUI:
-        case J_DevEui: {
-            txjob->deveui = uj_eui(D);
-            flags |= 0x01;
-            break;
-        }
-        case J_dC: {
-            int txflags = 0, dc = uj_intRange(D, 0, 2);
-            switch(dc) {
-                case 0: txflags = TXFLAG_CLSA; break;
-                case 1: txflags = TXFLAG_PING; break;
-                case 2: txflags = TXFLAG_CLSC; break;
-            }
-            txjob->txflags = txflags;
-            flags |= 0x02;
-            break;
-        }
-        case J_seqno:   // older server (remove if obsoleted)
-        case J_diid: {  // newer servers use this field name
-            txjob->diid = uj_int(D);
-            flags |= 0x04;
-            break;
-        }
-        case J_pdu: {
-            uj_str(D);
-            int xlen = D->str.len/2;
-            u1_t* p = txq_reserveData(&s2ctx->txq, xlen);
-            if( p == NULL ) {
-                uj_error(D, "Out of TX data space");
-                return;
-            }
-            txjob->len = uj_hexstr(D, p, xlen);
-            flags |= 0x08;
-            break;
-        }
-        case J_RxDelay: {
-            // Map zero to one
-            txjob->rxdelay = max(1, uj_intRange(D, 0, 15));
-            flags |= 0x10;
-            break;
-        }
-        case J_priority: {
-            txjob->prio = uj_intRange(D, 0, 255);
-            break;
-        }
-        case J_dnmode: {
-            // Currently not needed to make decisions
-            //str_t mode = uj_str(D); // "updn" or "dn"
-            //dnmode = (mode[0]=='d' && mode[1]=='n');
-            uj_skipValue(D);
-            break;
-        }
-        case J_xtime: {  // 0==absent
-            txjob->xtime = uj_int(D);
-            break;
-        }
-        case J_DR: {
-            txjob->rxdelay = 0;
-            flags |= 0x10;  // rxdelay flag - RxDelay is implicitly 0
-            // FALL THRU
-        }
-        case J_RX1DR: {
-            check_dr(s2ctx, D, &txjob->dr);
-            flags |= 0x0100;
-            break;
-        }
-        case J_Freq:
-        case J_RX1Freq: {
-            check_dnfreq(s2ctx, D, &txjob->freq, &txjob->dnchnl);
-            flags |= 0x0200;
-            break;
-        }
-        case J_RX2DR: {
-            check_dr(s2ctx, D, &txjob->rx2dr);
-            flags |= 0x0400;
-            break;
-        }
-        case J_RX2Freq: {
-            check_dnfreq(s2ctx, D, &txjob->rx2freq, &txjob->dnchnl);
-            flags |= 0x0800;
-            break;
-        }
-        case J_MuxTime: {
-            s2e_updateMuxtime(s2ctx, uj_num(D), now);
-            break;
-        }
-        case J_rctx: {
-            txjob->rctx = uj_int(D);
-            flags |= 0x1000;
-            break;
-        }
-        case J_gpstime: {  // GPS microseconds
-            txjob->gpstime = uj_uint(D);
-            break;
-        }
-        case J_preamble: {
-            txjob->preamble = uj_uint(D);
-            break;
-        }
-        case J_addcrc: {
-            txjob->addcrc = uj_uint(D);
-            break;
-        }
-        default: {
-            LOG(MOD_S2E|WARNING, "Unknown field in dnmsg - ignored: %s", D->field.name);
-            uj_skipValue(D);
-            break;
-        }
-        }
-    }
+// Check fields of a decoded dnmsg (flags tell which ones were present) and queue it.
+static void s2e_submitDnmsg (s2ctx_t* s2ctx, txjob_t* txjob, int flags, ustime_t now) {
     if ( (flags & 0x10) != 0x10) {
         // Map zero to one
         txjob->rxdelay = 1;
@@ -1430,6 +1979,20 @@ void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
     txjob->txunit = ral_rctx2txunit(txjob->rctx);
 
     if( (txjob->txflags & TXFLAG_PING) ) {
+        if( txjob->pingPeriod ) {
+            int period = txjob->pingPeriod;
+            if( period < 32 || period > PING_SLOTS || (period & (period-1)) != 0 || txjob->pingOffset >= period ) {
+                LOG(MOD_S2E|WARNING, "Ignoring 'dnmsg' with illegal PingPeriod=%d/PingOffset=%d", period, txjob->pingOffset);
+                return;
+            }
+            sL_t gpsnow = ts_xtime2gpstime(ts_ustime2xtime(txjob->txunit, now));
+            txjob->gpstime = gpsnow==0 ? 0 : s2e_nextPingSlot(gpsnow + TX_AIM_GAP, period, txjob->pingOffset);
+            if( txjob->gpstime == 0 ) {
+                LOG(MOD_S2E|WARNING, "%J - class B no ping slot left in beacon period (or no GPS time)", txjob);
+                metric_inc(MC_tx_rej_toolate);
+                return;
+            }
+        }
         txjob->xtime  = ts_gpstime2xtime(txjob->txunit, txjob->gpstime);
         txjob->txtime = ts_xtime2ustime(txjob->xtime);
     }
@@ -1452,6 +2015,7 @@ void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
     }
     if( txjob->xtime == 0 || txjob->txtime == 0 ) {
         LOG(MOD_S2E|ERROR, "%J - dropped due to time conversion problems (MCU/GPS out of sync, obsolete input) - xtime=%ld", txjob, txjob->xtime);
+        metric_inc(MC_tx_rej_other);
         return;
     }
     txq_commitJob(&s2ctx->txq, txjob);
@@ -1460,6 +2024,247 @@ void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
 }
 
 
+
+// Binary dnmsg:
+//   0     1       9     17     25    33       41       49       53       57        59 60   61    62    63    64   65     66
+//  +-----+-------+-----+------+-----+--------+--------+--------+--------+---------+--+-------+-----+-----+----+------+---+-----+
+//  | tag | DevEui| diid| xtime| rctx| gpstime| MuxTime| RX1Freq| RX2Freq| preamble|dC|RxDelay|RX1DR|RX2DR|prio|addcrc|len| pdu |
+//  +-----+-------+-----+------+-----+--------+--------+--------+--------+---------+--+-------+-----+-----+----+------+---+-----+
+//  MuxTime in microseconds (0=absent), RX1Freq/RX2Freq 0 if absent,
+//  RxDelay 0xFF corresponds to the JSON DR/Freq form (no RX delay).
+//
+static void handle_dnmsgBin (s2ctx_t* s2ctx, const u1_t* p, int len) {
+    ustime_t now = rt_getTime();
+    if( len < BINMSG_DNMSG_HDRLEN || len != BINMSG_DNMSG_HDRLEN + p[BINMSG_DNMSG_HDRLEN-1] ) {
+        LOG(MOD_S2E|ERROR, "Malformed binary dnmsg (%d bytes)", len);
+        return;
+    }
+    txjob_t* txjob = txq_reserveJob(&s2ctx->txq);
+    if( txjob == NULL ) {
+        LOG(MOD_S2E|ERROR, "Out of TX jobs - dropping incoming message");
+        metric_inc(MC_tx_rej_other);
+        return;
+    }
+    int flags = 0x01|0x04|0x08|0x10|0x1000;
+    txjob->deveui  = rt_rlsbf8(p+ 1);
+    txjob->diid    = (sL_t)rt_rlsbf8(p+ 9);
+    txjob->xtime   = (sL_t)rt_rlsbf8(p+17);
+    txjob->rctx    = (sL_t)rt_rlsbf8(p+25);
+    txjob->gpstime = (sL_t)rt_rlsbf8(p+33);
+    sL_t muxtime   = (sL_t)rt_rlsbf8(p+41);
+    u4_t rx1freq   = rt_rlsbf4(p+49);
+    u4_t rx2freq   = rt_rlsbf4(p+53);
+    txjob->preamble= rt_rlsbf2(p+57);
+    int  dc        = p[59];
+    int  rxdelay   = p[60];
+    txjob->prio    = p[63];
+    txjob->addcrc  = p[64];
+    int  pdulen    = p[65];
+    if( muxtime )
+        s2e_updateMuxtime(s2ctx, muxtime/1e6, now);
+    if( dc <= 2 ) {
+        txjob->txflags = dc==0 ? TXFLAG_CLSA : dc==1 ? TXFLAG_PING : TXFLAG_CLSC;
+        flags |= 0x02;
+    }
+    if( rxdelay == 0xFF ) {
+        txjob->rxdelay = 0;
+    } else if( rxdelay <= 15 ) {
+        txjob->rxdelay = max(1, rxdelay);  // map zero to one
+    } else {
+        flags &= ~0x10;
+    }
+    if( rx1freq ) {
+        if( !map_dnfreq(s2ctx, rx1freq, &txjob->freq, &txjob->dnchnl) || !valid_dr(s2ctx, p[61]) ) {
+            LOG(MOD_S2E|ERROR, "Illegal RX1 frequency/datarate in binary dnmsg: %u/DR%d", rx1freq, p[61]);
+            return;
+        }
+        txjob->dr = p[61];
+        flags |= 0x0300;
+    }
+    if( rx2freq ) {
+        if( !map_dnfreq(s2ctx, rx2freq, &txjob->rx2freq, &txjob->dnchnl) || !valid_dr(s2ctx, p[62]) ) {
+            LOG(MOD_S2E|ERROR, "Illegal RX2 frequency/datarate in binary dnmsg: %u/DR%d", rx2freq, p[62]);
+            return;
+        }
+        txjob->rx2dr = p[62];
+        flags |= 0x0C00;
+    }
+    u1_t* pdu = txq_reserveData(&s2ctx->txq, pdulen);
+    if( pdu == NULL ) {
+        LOG(MOD_S2E|ERROR, "Out of TX data space - dropping binary dnmsg");
+        metric_inc(MC_tx_rej_other);
+        return;
+    }
+    memcpy(pdu, p+BINMSG_DNMSG_HDRLEN, pdulen);
+    txjob->len = pdulen;
+    s2e_submitDnmsg(s2ctx, txjob, flags, now);
+}
+
+
+// --------------------------------------------------------------------------------
+// Schema driven decoding of downlink messages into txjob_t.
+// Each schema is a static list of field descriptors. On first use it is
+// compiled into a map from dense keyword index (see uj_kwIndex) to
+// descriptor so that each field is resolved with a single table lookup.
+// --------------------------------------------------------------------------------
+
+enum {
+    DNF_SKIP,       // ignore value
+    DNF_EUI,        // uL_t  - EUI
+    DNF_S8,         // sL_t  - signed integer
+    DNF_U8,         // sL_t  - unsigned integer
+    DNF_GPSSEC,     // sL_t  - GPS seconds stored as microseconds
+    DNF_U2,         // u2_t  - unsigned integer
+    DNF_U1,         // u1_t  - unsigned integer
+    DNF_R1,         // u1_t  - integer in range [lo,hi]
+    DNF_DC,         // txflags from device class 0..2
+    DNF_RXDELAY,    // u1_t  - RX delay 0..15, zero mapped to one
+    DNF_DR,         // u1_t  - datarate valid in region
+    DNF_DR0,        // u1_t  - datarate, sets rxdelay=0 (DR/Freq form)
+    DNF_FREQ,       // u4_t  - downlink frequency, also sets dnchnl
+    DNF_PDU,        // frame data from hex string
+    DNF_MUXTIME,    // update muxtime
+};
+
+typedef struct dnfield {
+    ujcrc_t crc;
+    u1_t    type;    // DNF_*
+    u1_t    off;     // offset into txjob_t
+    u2_t    flag;    // flag bits set if field is present
+    u1_t    lo, hi;  // DNF_R1 range
+} dnfield_t;
+
+typedef struct dnschema {
+    str_t            name;    // for log messages
+    const dnfield_t* fields;
+    u1_t             kwmap[UJ_NKW];  // keyword index -> fields index+1 (0=unknown)
+    u1_t             compiled;
+} dnschema_t;
+
+#define DNF(kw, type, fld, flag, ...) { J_##kw, DNF_##type, offsetof(txjob_t, fld), flag, __VA_ARGS__ }
+
+static const dnfield_t DNMSG_FIELDS[] = {
+    DNF(msgtype,  SKIP,    txtime,   0x0000),
+    DNF(dnmode,   SKIP,    txtime,   0x0000),  // "updn" or "dn" - not needed to make decisions
+    DNF(DevEUI,   EUI,     deveui,   0x0001),
+    DNF(DevEui,   EUI,     deveui,   0x0001),
+    DNF(dC,       DC,      txflags,  0x0002),
+    DNF(seqno,    S8,      diid,     0x0004),  // older server (remove if obsoleted)
+    DNF(diid,     S8,      diid,     0x0004),  // newer servers use this field name
+    DNF(pdu,      PDU,     len,      0x0008),
+    DNF(RxDelay,  RXDELAY, rxdelay,  0x0010),
+    DNF(priority, R1,      prio,     0x0000, 0, 255),
+    DNF(xtime,    S8,      xtime,    0x0000),  // 0==absent
+    DNF(DR,       DR0,     dr,       0x0110),  // rxdelay flag - RxDelay is implicitly 0
+    DNF(RX1DR,    DR,      dr,       0x0100),
+    DNF(Freq,     FREQ,    freq,     0x0200),
+    DNF(RX1Freq,  FREQ,    freq,     0x0200),
+    DNF(RX2DR,    DR,      rx2dr,    0x0400),
+    DNF(RX2Freq,  FREQ,    rx2freq,  0x0800),
+    DNF(MuxTime,  MUXTIME, txtime,   0x0000),
+    DNF(rctx,     S8,      rctx,     0x1000),
+    DNF(gpstime,  U8,      gpstime,  0x0000),  // GPS microseconds
+    DNF(preamble, U2,      preamble, 0x0000),
+    DNF(addcrc,   U1,      addcrc,   0x0000),
+    DNF(PingPeriod, U2,    pingPeriod, 0x0000),  // class B: station computes ping slot
+    DNF(PingOffset, U2,    pingOffset, 0x0000),
+    { 0 }
+};
+
+static const dnfield_t DNSCHED_FIELDS[] = {
+    DNF(diid,     S8,      diid,     0x0000),
+    DNF(priority, R1,      prio,     0x0000, 0, 255),
+    DNF(DR,       DR,      dr,       0x0001),
+    DNF(Freq,     FREQ,    freq,     0x0002),
+    DNF(ontime,   GPSSEC,  gpstime,  0x0004),  // GPS seconds - no fractions currently
+    DNF(gpstime,  U8,      gpstime,  0x0004),  // GPS microseconds
+    DNF(xtime,    U8,      xtime,    0x0004),  // send on xtime
+    DNF(pdu,      PDU,     len,      0x0008),
+    DNF(rctx,     S8,      rctx,     0x0000),
+    DNF(preamble, U2,      preamble, 0x0000),
+    DNF(addcrc,   U1,      addcrc,   0x0000),
+    { 0 }
+};
+
+static dnschema_t dnmsgSchema   = { .name = "dnmsg",             .fields = DNMSG_FIELDS   };
+static dnschema_t dnschedSchema = { .name = "dnsched.schedule", .fields = DNSCHED_FIELDS };
+
+static void compileSchema (dnschema_t* schema) {
+    memset(schema->kwmap, 0, sizeof(schema->kwmap));
+    for( int i=0; schema->fields[i].crc; i++ ) {
+        int k = uj_kwIndex(schema->fields[i].crc, NULL);
+        assert(k >= 0 && schema->kwmap[k] == 0);
+        schema->kwmap[k] = i+1;
+    }
+    schema->compiled = 1;
+}
+
+// Decode all fields of current object into txjob - returns flags of present fields
+static int decodeTxjob (s2ctx_t* s2ctx, ujdec_t* D, dnschema_t* schema, int slot, txjob_t* txjob, ustime_t now) {
+    if( !schema->compiled )
+        compileSchema(schema);
+    int flags = 0;
+    ujcrc_t field;
+    while( (field = uj_nextField(D)) ) {
+        int k = uj_kwIndex(field, NULL);
+        const dnfield_t* f = k >= 0 && schema->kwmap[k] ? &schema->fields[schema->kwmap[k]-1] : NULL;
+        if( f == NULL ) {
+            if( slot < 0 ) {
+                LOG(MOD_S2E|WARNING, "Unknown field in %s - ignored: %s", schema->name, D->field.name);
+            } else {
+                LOG(MOD_S2E|WARNING, "Unknown field in %s[%d] - ignored: %s", schema->name, slot, D->field.name);
+            }
+            uj_skipValue(D);
+            continue;
+        }
+        void* p = (u1_t*)txjob + f->off;
+        switch( f->type ) {
+        case DNF_SKIP:    uj_skipValue(D); break;
+        case DNF_EUI:     *(uL_t*)p = uj_eui(D); break;
+        case DNF_S8:      *(sL_t*)p = uj_int(D); break;
+        case DNF_U8:      *(sL_t*)p = uj_uint(D); break;
+        case DNF_GPSSEC:  *(sL_t*)p = rt_seconds(uj_uint(D)); break;
+        case DNF_U2:      *(u2_t*)p = uj_uint(D); break;
+        case DNF_U1:      *(u1_t*)p = uj_uint(D); break;
+        case DNF_R1:      *(u1_t*)p = uj_intRange(D, f->lo, f->hi); break;
+        case DNF_DC: {
+            int dc = uj_intRange(D, 0, 2);
+            txjob->txflags = dc==0 ? TXFLAG_CLSA : dc==1 ? TXFLAG_PING : TXFLAG_CLSC;
+            break;
+        }
+        case DNF_RXDELAY: *(u1_t*)p = max(1, uj_intRange(D, 0, 15)); break;
+        case DNF_DR0:     txjob->rxdelay = 0;  // FALL THRU
+        case DNF_DR:      check_dr(s2ctx, D, (u1_t*)p); break;
+        case DNF_FREQ:    check_dnfreq(s2ctx, D, (u4_t*)p, &txjob->dnchnl); break;
+        case DNF_PDU: {
+            uj_str(D);
+            int xlen = D->str.len/2;
+            u1_t* pdu = txq_reserveData(&s2ctx->txq, xlen);
+            if( pdu == NULL )
+                uj_error(D, "Out of TX data space");
+            txjob->len = uj_hexstr(D, pdu, xlen);
+            break;
+        }
+        case DNF_MUXTIME: s2e_updateMuxtime(s2ctx, uj_num(D), now); break;
+        }
+        flags |= f->flag;
+    }
+    return flags;
+}
+
+void handle_dnmsg (s2ctx_t* s2ctx, ujdec_t* D) {
+    ustime_t now = rt_getTime();
+    txjob_t* txjob = txq_reserveJob(&s2ctx->txq);
+    if( txjob == NULL ) {
+        LOG(MOD_S2E|ERROR, "Out of TX jobs - dropping incoming message");
+        metric_inc(MC_tx_rej_other);
+        return;
+    }
+    int flags = decodeTxjob(s2ctx, D, &dnmsgSchema, -1, txjob, now);
+    s2e_submitDnmsg(s2ctx, txjob, flags, now);
+}
+
+
 void handle_dnsched (s2ctx_t* s2ctx, ujdec_t* D) {
     ustime_t now = rt_getTime();
     ujcrc_t field;
@@ -1482,74 +2287,8 @@ void handle_dnsched (s2ctx_t* s2ctx, ujdec_t* D) {
                     uj_error(D, "Out of TX jobs - stopping parsing of 'dnsched' message");
                     return;
                 }
-                int flags = 0;
                 uj_enterObject(D);
-                while( (field = uj_nextField(D)) ) {
-                    switch(field) {
-                    case J_diid: {  // newer servers use this field name
-                        txjob->diid = uj_int(D);
-                        break;
-                    }
-                    case J_priority: {
-                        txjob->prio = uj_intRange(D, 0, 255);
-                        break;
-                    }
-                    case J_DR: {
-                        check_dr(s2ctx, D, &txjob->dr);
-                        flags |= 0x01;
-                        break;
-                    }
-                    case J_Freq: {
-                        check_dnfreq(s2ctx, D, &txjob->freq, &txjob->dnchnl);
-                        flags |= 0x02;
-                        break;
-                    }
-                    case J_ontime: {   // GPS seconds - no fractions currently
-                        txjob->gpstime = rt_seconds(uj_uint(D));
-                        flags |= 0x04;
-                        break;
-                    }
-                    case J_gpstime: {  // GPS microseconds
-                        txjob->gpstime = uj_uint(D);
-                        flags |= 0x04;
-                        break;
-                    }
-                    case J_xtime: {    // send on xtime
-                        txjob->xtime = uj_uint(D);
-                        flags |= 0x04;
-                        break;
-                    }
-                    case J_pdu: {
-                        uj_str(D);
-                        int xlen = D->str.len/2;
-                        u1_t* p = txq_reserveData(&s2ctx->txq, xlen);
-                        if( p == NULL ) {
-                            uj_error(D, "Out of TX data space");
-                            return;
-                        }
-                        txjob->len = uj_hexstr(D, p, xlen);
-                        flags |= 0x08;
-                        break;
-                    }
-                    case J_rctx: {
-                        txjob->rctx = uj_int(D);
-                        break;
-                    }
-                    case J_preamble: {
-                        txjob->preamble = uj_uint(D);
-                        break;
-                    }
-                    case J_addcrc: {
-                        txjob->addcrc = uj_uint(D);
-                        break;
-                    }
-                    default: {
-                        LOG(MOD_S2E|WARNING, "Unknown field in dnsched.schedule[%d] - ignored: %s", slot, D->field.name);
-                        uj_skipValue(D);
-                        break;
-                    }
-                    }
-                }
+                int flags = decodeTxjob(s2ctx, D, &dnschedSchema, slot, txjob, now);
                 if( flags != 0xF ) {
                     LOG(MOD_S2E|WARNING, "Some mandatory fields in dnsched.schedule[%d] are missing (flags=0x%X)", slot, flags);
                 } else {
@@ -1632,6 +2371,32 @@ void handle_timesync (s2ctx_t* s2ctx, ujdec_t* D) {
 }
 
 
+// Binary timesync response:
+//   0     1       9      17       25       33
+//  +-----+-------+------+--------+--------+
+//  | tag | txtime| xtime| gpstime| MuxTime|
+//  +-----+-------+------+--------+--------+
+//  MuxTime in microseconds (0=absent)
+//
+static void handle_timesyncBin (s2ctx_t* s2ctx, const u1_t* p, int len) {
+    ustime_t rxtime = rt_getTime();
+    if( len != BINMSG_TIMESYNC_DNLEN ) {
+        LOG(MOD_S2E|ERROR, "Malformed binary timesync (%d bytes)", len);
+        return;
+    }
+    ustime_t txtime  = (sL_t)rt_rlsbf8(p+ 1);
+    ustime_t xtime   = (sL_t)rt_rlsbf8(p+ 9);
+    sL_t     gpstime = (sL_t)rt_rlsbf8(p+17);
+    sL_t     muxtime = (sL_t)rt_rlsbf8(p+25);
+    if( muxtime )
+        s2e_updateMuxtime(s2ctx, muxtime/1e6, rxtime);
+    if( xtime )
+        ts_setTimesyncLns(xtime, gpstime);
+    if( txtime && gpstime )
+        ts_processTimesyncLns(txtime, rxtime, gpstime);
+}
+
+
 void handle_getxtime (s2ctx_t* s2ctx, ujdec_t* D) {
     // No fields required - skip everything
     ujcrc_t field;
@@ -1758,7 +2523,10 @@ int s2e_onMsg (s2ctx_t* s2ctx, char* json, ujoff_t jsonlen) {
     }
     case J_router_config: {
         ok = handle_router_config(s2ctx, &D);
-        if( ok ) sys_inState(SYSIS_TC_CONNECTED);
+        if( ok ) {
+            s2ctx->spooling = 0;
+            sys_inState(SYSIS_TC_CONNECTED);
+        }
         break;
     }
     case J_dnframe: {
@@ -1819,14 +2587,47 @@ int s2e_onMsg (s2ctx_t* s2ctx, char* json, ujoff_t jsonlen) {
 }
 
 
+int s2e_onBinary (s2ctx_t* s2ctx, u1_t* data, ujoff_t datalen) {
+    if( datalen == 0 || data[0] < BINMSG_MIN )
+        return s2e_handleRmtshData(s2ctx, data, datalen);
+    switch( data[0] ) {
+    case BINMSG_DNMSG: {
+        handle_dnmsgBin(s2ctx, data, datalen);
+        break;
+    }
+    case BINMSG_TIMESYNC: {
+        handle_timesyncBin(s2ctx, data, datalen);
+        break;
+    }
+    default: {
+        LOG(MOD_S2E|WARNING, "Unknown binary message tag 0x%02X - ignored (%d bytes)", data[0], datalen);
+        break;
+    }
+    }
+    return 1;
+}
+
+
 #if defined(CFG_no_rmtsh)
 void s2e_handleRmtsh (s2ctx_t* s2ctx, ujdec_t* D) {
     uj_error(D, "Rmtsh not implemented");
 }
 
-int s2e_onBinary (s2ctx_t* s2ctx, u1_t* data, ujoff_t datalen) {
+int s2e_handleRmtshData (s2ctx_t* s2ctx, u1_t* data, ujoff_t datalen) {
     LOG(MOD_S2E|ERROR, "Ignoring rmtsh binary data (%d bytes)", datalen);
     return 0;
 }
+
+void s2e_resumeRmtsh () {}
+#endif
+
+#if defined(CFG_no_spool)
+int s2e_spoolRxjobs (s2ctx_t* s2ctx) {
+    return 0;
+}
+
+int s2e_unspoolRxjobs (s2ctx_t* s2ctx) {
+    return 0;
+}
 #endif
 
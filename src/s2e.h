@@ -36,9 +36,60 @@
 #include "ws.h"
 
 extern uL_t* s2e_joineuiFilter;
+extern int   s2e_joineuiFilterLen;
 extern u4_t  s2e_netidFilter[4];
+int  s2e_setJoineuiFilter (uL_t* ranges, int n);
+
+typedef struct devaddrPrefix {
+    u4_t addr;
+    u4_t hits;   // data frames passed by this prefix
+    u1_t bits;
+} devaddrPrefix_t;
+
+// MAX_DEVADDR_PREFIXES is clamped to this - trie nodes (32 per prefix + root) are indexed by u2_t
+#define DEVADDR_PREFIX_LIMIT ((0xFFFFu-1)/32)
+
+extern devaddrPrefix_t* s2e_devaddrPrefixes;
+extern int   s2e_devaddrPrefixCnt;
+extern u4_t  s2e_devaddrShed;
+void s2e_resetDevaddrFilter (int enable);   // enable with no prefixes drops all data frames
+int  s2e_addDevaddrPrefix (u4_t addr, int bits);
+int  s2e_netid2prefix (u4_t netid, u4_t* addr);  // DevAddr prefix of a 24 bit NetID - returns prefix length
+void s2e_logDevaddrFilter ();
+
+// Uplink frame decoded once - shared by JSON/binary encoding and logging
+enum { LORAFRM_OK=0, LORAFRM_BAD, LORAFRM_JOINEUI, LORAFRM_NETID, LORAFRM_DEVADDR };
+typedef struct lorafrm {
+    const u1_t* frame;
+    str_t msgtype;    // propdf, jacc, jreq, rejoin, updf, dndf
+    uL_t  joineui;
+    uL_t  deveui;
+    u4_t  devaddr;
+    s4_t  mic;
+    u2_t  fcnt;
+    u2_t  devnonce;
+    u1_t  len;
+    u1_t  ftype;
+    u1_t  mhdr;
+    u1_t  fctrl;
+    u1_t  foptslen;
+    u1_t  portoff;    // offset of FPort - len-4 if there is none
+    u1_t  drop;       // LORAFRM_xxx - why s2e_decodeLoraFrame rejected the frame
+} lorafrm_t;
+
+int  s2e_decodeLoraFrame (lorafrm_t* f, const u1_t* frame, int len);
+void s2e_encLoraFrame (ujbuf_t* buf, const lorafrm_t* f);
+void s2e_logLoraFrame (dbuf_t* lbuf, const lorafrm_t* f);
+
+// Overload policy stages (RX_SHED_*) - also reasons for shedding a frame
+enum { RXSHED_DUP=0x01, RXSHED_FILTER=0x02, RXSHED_SNR=0x04 };
+int  s2e_shedLoraFrame (const u1_t* frame, int len, int sf, int snr, int stages);
 int  s2e_parse_lora_frame(ujbuf_t* buf, const u1_t* frame , int len, dbuf_t* lbuf);
 void s2e_make_beacon (uint8_t* layout, sL_t epoch_secs, int infodesc, double lat, double lon, uint8_t* buf);
+void s2e_prep_beacon (const u1_t* layout, int infodesc, double lat, double lon, u1_t* tmpl);
+void s2e_stamp_beacon (const u1_t* layout, const u1_t* tmpl, sL_t epoch_secs, u1_t* pdu);
+int  s2e_checkBeaconLayout (const u1_t* layout);
+sL_t s2e_nextPingSlot (sL_t gpstime, int period, int offset);
 
 
 enum { SF12, SF11, SF10, SF9, SF8, SF7, FSK, SFNIL };
@@ -90,24 +141,67 @@ enum { MAX_UPCHNLS = MAX_130X * 10 };  // 10 channels per chip
 enum { DR_CNT = 16 };
 enum { DR_ILLEGAL = 16 };
 
+// Binary messages (negotiated via feature/router_config 'binmsg').
+// First byte is a tag - values below BINMSG_MIN are rmtsh session numbers.
+// All integers are little endian. Fixed header layouts are documented in s2e.c.
+enum {
+    BINMSG_MIN      = 0x80,
+    BINMSG_UPDF     = 0x80,   // station -> muxs: received frame(s)
+    BINMSG_DNTXED   = 0x81,   // station -> muxs: TX confirmation
+    BINMSG_TIMESYNC = 0x82,   // both directions: timesync request/response
+    BINMSG_DNMSG    = 0x90,   // muxs -> station: downlink frame
+};
+enum { BINMSG_UPDF_HDRLEN     = 53 };
+enum { BINMSG_DNTXED_LEN      = 47 };
+enum { BINMSG_TIMESYNC_UPLEN  =  9 };
+enum { BINMSG_TIMESYNC_DNLEN  = 33 };
+enum { BINMSG_DNMSG_HDRLEN    = 66 };
+
+// TX confirmation - copied out of the txjob so it can wait for a dntxed batch
+typedef struct dntxed {
+    sL_t     diid;
+    uL_t     deveui;
+    sL_t     xtime;
+    ustime_t txtime;
+    sL_t     gpstime;
+    u4_t     freq;
+    u1_t     dr;
+    u1_t     txunit;
+} dntxed_t;
+
 typedef struct s2txunit {
     ustime_t dc_eu863bands[DC_NUM_BANDS];
     ustime_t dc_perChnl[MAX_DNCHNLS+1];
-    txidx_t  head;
+    txord_t  q;        // queued txjobs ordered by txtime
     tmr_t    timer;
 } s2txunit_t;
 
+enum { BCN_MAXLEN = 32 };
+// Class B ping slots following each beacon (micros/slots)
+enum { PING_BCN_RESERVED = 2120000, PING_SLOT_LEN = 30000, PING_SLOTS = 4096 };
+
 typedef struct s2bcn {
     u1_t     ctrl;      // 0x0F => DR, 0xF0 = n frequencies
     u1_t     layout[3]; // time_off, infodesc_off, bcn_len
     u4_t     freqs[8];  // 1 or up to 8 frequencies
+    u1_t     tmplok;    // tmpl is valid for lat/lon
+    double   lat, lon;
+    u1_t     tmpl[BCN_MAXLEN];  // beacon frame without time/CRC - see s2e_prep_beacon
 } s2bcn_t;
 
 typedef struct s2ctx {
     dbuf_t (*getSendbuf) (struct s2ctx* s2ctx, int minsize);     // wired to TC/websocket
+    dbuf_t (*getSendbufClass) (struct s2ctx* s2ctx, int minsize, int wsclass); // ditto - optional, see s2e_getSendbufClass
     void   (*sendText)   (struct s2ctx* s2ctx, dbuf_t* buf);     // ditto
     void   (*sendBinary) (struct s2ctx* s2ctx, dbuf_t* buf);     // ditto
+    void   (*fanout)     (struct s2ctx* s2ctx, dbuf_t* buf, int binary); // optional - copy uplink message to mirror sessions
     int    (*canTx)      (struct s2ctx* s2ctx, txjob_t* txjob, int* ccaDisabled);  // region dependent
+    ustime_t (*dcFree)   (struct s2ctx* s2ctx, txjob_t* txjob, u1_t txunit);       // ditto - earliest DC legal txtime
+    int    (*radioTx)    (txjob_t* txjob, struct s2ctx* s2ctx, int nocca);  // radio layer - ral_tx unless simulated
+    int    (*radioTxprep)(txjob_t* txjob, struct s2ctx* s2ctx);            // ditto - ral_txprep
+    int    (*radioTxstatus) (u1_t txunit);                                 // ditto - ral_txstatus
+    void   (*radioTxabort)  (u1_t txunit);                                 // ditto - ral_txabort
+    u1_t   (*altAntennas)   (u1_t txunit);                                 // ditto - ral_altAntennas
 
     u1_t     ccaEnabled;     // this region uses CCA
     rps_t    dr_defs[DR_CNT];
@@ -127,6 +221,19 @@ typedef struct s2ctx {
     s2txunit_t txunits[MAX_TXUNITS];
     s2bcn_t    bcn;      // beacon definition
     tmr_t      bcntimer;
+    u1_t       upbatch;      // muxs accepts batched updf messages
+    u1_t       binmsg;       // muxs speaks binary messages for updf/dntxed/timesync/dnmsg
+    tmr_t      upbatchTimer; // linger for more frames before sending a batch
+    u1_t       dnbatch;      // muxs accepts batched dntxed messages
+    u1_t       dnpendN;      // TX confirmations waiting in dnpend
+    u1_t       dnpendMax;    // capacity of dnpend
+    dntxed_t*  dnpend;       // DNBATCH_MAX entries (arena) or NULL
+    tmr_t      dnbatchTimer; // send pending TX confirmations
+    u1_t       sendhigh;     // TC send buffer above high watermark - defer optional traffic
+    u1_t       spooling;     // muxs not ready - rxjobs are diverted to the uplink spool
+    u1_t       rxshed;       // RXSHED_* stages active - RX path overloaded
+    tmr_t      metricsTimer; // periodic metrics push to muxs (METRICS_PUSH_INTV)
+    rt_arena_t arena;        // session scoped allocations - released wholesale by s2e_free
 
 } s2ctx_t;
 
@@ -138,14 +245,19 @@ extern u1_t s2e_ccaDisabled;   // ignore busy channels - override for test/dev
 extern u1_t s2e_dwellDisabled; // ignore dwell time limits - override for test/dev
 
 
+#include "s2region.h"
+#if !defined(S2E_REGION)
 rps_t    s2e_dr2rps (s2ctx_t*, u1_t dr);
 u1_t     s2e_rps2dr (s2ctx_t*, rps_t rps);
+#endif // !defined(S2E_REGION)
 ustime_t s2e_calcUpAirTime (rps_t rps, u1_t plen);
 ustime_t s2e_calcDnAirTime (rps_t rps, u1_t plen, u1_t lcrc, u2_t preamble);
+ustime_t s2e_calcAirTimeRef (rps_t rps, u1_t plen, u1_t nocrc, u2_t preamble);  // formula behind the airtime table
 ustime_t s2e_updateMuxtime(s2ctx_t* s2ctx, double muxstime, ustime_t now);   // now=0 => rt_getTime(), return now
 
 void     s2e_ini          (s2ctx_t*);
 void     s2e_free         (s2ctx_t*);
+int      s2e_setRegion    (s2ctx_t*, str_t region, ujcrc_t regionCrc);  // 0 if region rejected (fixed region build)
 void     s2e_enableDC     (s2ctx_t*, u2_t chnlRate);
 void     s2e_disableDC    (s2ctx_t*);
 rxjob_t* s2e_nextRxjob    (s2ctx_t*);
@@ -153,9 +265,15 @@ void     s2e_addRxjob     (s2ctx_t*, rxjob_t* rxjob);
 void     s2e_flushRxjobs  (s2ctx_t*);
 int      s2e_onMsg        (s2ctx_t*, char* json, ujoff_t jsonlen);
 int      s2e_onBinary     (s2ctx_t*, u1_t* data, ujoff_t datalen);
+int      s2e_addTxjob     (s2ctx_t*, txjob_t* txjob, int relocate, ustime_t now);
 ustime_t s2e_nextTxAction (s2ctx_t*, u1_t txunit);
 int      s2e_handleCommands (ujcrc_t msgtype, s2ctx_t* s2ctx, ujdec_t* D);
 void     s2e_handleRmtsh    (s2ctx_t* s2ctx, ujdec_t* D);
+int      s2e_handleRmtshData(s2ctx_t* s2ctx, u1_t* data, ujoff_t datalen);
+void     s2e_resumeRmtsh    ();  // WS send space freed up - continue paused rmtsh output
+dbuf_t   s2e_getSendbufClass(s2ctx_t* s2ctx, int minsize, int wsclass);  // WSCLASS_xxx - getSendbuf if not supported
+int      s2e_spoolRxjobs    (s2ctx_t* s2ctx);  // move queued rxjobs to uplink spool - returns number of frames
+int      s2e_unspoolRxjobs  (s2ctx_t* s2ctx);  // refill rxq from uplink spool - returns number of frames
 
 
 #endif // _s2e_h_
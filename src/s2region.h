@@ -0,0 +1,116 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+#ifndef _s2region_h_
+#define _s2region_h_
+
+// Region fixed at build time - add one of region_eu863, region_us902, ... to a variant.
+// DR mapping and TX admission (DC/CCA) then compile to constant tables and direct calls
+// instead of per session state and function pointers.
+// A router_config for a different region or with different DRs is rejected.
+//
+// Included by s2e.h after the rps_t definitions.
+
+#define RPS_DR(sf,bw)  ((SF##sf) | (BW##bw << 3))
+#define RPS_DN(sf,bw)  (RPS_DR(sf,bw) | RPS_DNONLY)
+#define RPS_NO         RPS_ILLEGAL
+
+#define S2E_UPS_125 RPS_DR(12,125), RPS_DR(11,125), RPS_DR(10,125), RPS_DR(9,125), RPS_DR(8,125), RPS_DR(7,125)
+#define S2E_DNS_500    RPS_DN(12,500), RPS_DN(11,500), RPS_DN(10,500), RPS_DN(9,500), RPS_DN(8,500), RPS_DN(7,500)
+
+#if defined(CFG_region_eu863)
+#define S2E_REGION      J_EU863
+#define S2E_REGION_S    "EU863"
+#define S2E_REGION_DRS  { S2E_UPS_125, RPS_DR(7,250), RPS_FSK, RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO }
+#define S2E_CANTX       s2e_canTxEU863
+#define S2E_DCFREE      s2e_dcFreeEU863
+#elif defined(CFG_region_il915)
+#define S2E_REGION      J_IL915
+#define S2E_REGION_S    "IL915"
+#define S2E_REGION_DRS  { S2E_UPS_125, RPS_DR(7,250), RPS_FSK, RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO }
+#define S2E_CANTX       s2e_canTxOK
+#define S2E_DCFREE      s2e_dcFreeNone
+#elif defined(CFG_region_as923jp)
+#define S2E_REGION      J_AS923JP
+#define S2E_REGION_S    "AS923JP"
+#define S2E_REGION_DRS  { S2E_UPS_125, RPS_DR(7,250), RPS_FSK, RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO }
+#define S2E_CANTX       s2e_canTxPerChnlDC
+#define S2E_DCFREE      s2e_dcFreePerChnl
+#elif defined(CFG_region_as923)
+#define S2E_REGION      J_AS923
+#define S2E_REGION_S    "AS923"
+#define S2E_REGION_DRS  { S2E_UPS_125, RPS_DR(7,250), RPS_FSK, RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO }
+#define S2E_CANTX       s2e_canTxOK
+#define S2E_DCFREE      s2e_dcFreeNone
+#elif defined(CFG_region_kr920)
+#define S2E_REGION      J_KR920
+#define S2E_REGION_S    "KR920"
+#define S2E_REGION_DRS  { S2E_UPS_125, RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO }
+#define S2E_CANTX       s2e_canTxPerChnlDC
+#define S2E_DCFREE      s2e_dcFreePerChnl
+#elif defined(CFG_region_cn470)
+#define S2E_REGION      J_CN470
+#define S2E_REGION_S    "CN470"
+#define S2E_REGION_DRS  { S2E_UPS_125, RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO,RPS_NO }
+#define S2E_CANTX       s2e_canTxOK
+#define S2E_DCFREE      s2e_dcFreeNone
+#elif defined(CFG_region_us902)
+#define S2E_REGION      J_US902
+#define S2E_REGION_S    "US902"
+#define S2E_REGION_DRS  { RPS_DR(10,125), RPS_DR(9,125), RPS_DR(8,125), RPS_DR(7,125), RPS_DR(8,500), \
+                          RPS_NO,RPS_NO,RPS_NO, S2E_DNS_500, RPS_NO,RPS_NO }
+#define S2E_CANTX       s2e_canTxOK
+#define S2E_DCFREE      s2e_dcFreeNone
+#elif defined(CFG_region_au915)
+#define S2E_REGION      J_AU915
+#define S2E_REGION_S    "AU915"
+#define S2E_REGION_DRS  { S2E_UPS_125, RPS_DR(8,500), RPS_NO, S2E_DNS_500, RPS_NO,RPS_NO }
+#define S2E_CANTX       s2e_canTxOK
+#define S2E_DCFREE      s2e_dcFreeNone
+#endif
+
+#if defined(S2E_REGION)
+extern const rps_t s2e_regionDRs[DR_CNT];  // S2E_REGION_DRS - for checking router_config
+
+static inline rps_t s2e_dr2rps (struct s2ctx* s2ctx, u1_t dr) {
+    static const rps_t drs[DR_CNT] = S2E_REGION_DRS;
+    return dr < DR_CNT ? drs[dr] : RPS_ILLEGAL;
+}
+
+// This is called only for received frame (maps only to correct *up* DRs)
+static inline u1_t s2e_rps2dr (struct s2ctx* s2ctx, rps_t rps) {
+    static const rps_t drs[DR_CNT] = S2E_REGION_DRS;
+    for( u1_t dr=0; dr<DR_CNT; dr++ ) {
+        if( drs[dr] == rps )
+            return dr;
+    }
+    return DR_ILLEGAL;
+}
+#endif // defined(S2E_REGION)
+
+#endif // _s2region_h_
@@ -32,6 +32,7 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include "selftests.h"
+#include "s2conf.h"
 #include "rt.h"
 #include "fs.h"
 
@@ -69,6 +70,204 @@ static fsinfo_t printFsInfo (const char* msg, fsinfo_t* ip) {
 }
 
 
+// Scalar reference of record checksum
+static u2_t refCrc (u2_t crc, const u1_t* data, uint len) {
+    u1_t a=crc>>8, b=crc&0xFF;
+    for( int i=0; i<len; i++ ) {
+        b += (a += data[i]);
+    }
+    while( -len & 3 ) {
+        b += a;
+        len++;
+    }
+    return (a<<8)|b;
+}
+
+// Word parallel crypto/checksum kernels against the scalar definitions.
+// Scribbles over flash - caller has to erase afterwards.
+static void selftest_fsKernels (u4_t key[4]) {
+    static u1_t buf[FLASH_PAGE_SIZE+16];
+    static u4_t w[FLASH_PAGE_SIZE/4], raw[FLASH_PAGE_SIZE/4];
+    u4_t r = 7;
+    for( int i=0; i<sizeof(buf); i++ ) {
+        r = r*1103515245 + 12345;
+        buf[i] = r>>16;
+    }
+    for( int len=0; len<600; len++ ) {
+        int off = len & 15;
+        u2_t crc = len*0x9E37;
+        TCHECK(dataCrc(crc, buf+off, len) == refCrc(crc, buf+off, len));
+    }
+    TCHECK(dataCrc(0x1234, buf, FLASH_PAGE_SIZE) == refCrc(0x1234, buf, FLASH_PAGE_SIZE));
+    // Chained over chunks as done when validating records
+    TCHECK(dataCrc(dataCrc(0x1234, buf, 512), buf+512, 4) == refCrc(0x1234, buf, 516));
+
+    u4_t base = FLASH_ADDR + FLASH_PAGE_SIZE*FS_PAGE_START;
+    for( int n=0; n<=40; n++ ) {
+        u4_t faddr = base + 4*(n*5 % 11);
+        memcpy(w, buf+n, 4*n);
+        wrFlashN(faddr, w, n, 1);
+        TCHECK(memcmp(w, buf+n, 4*n) == 0);    // keepData restored plain text
+        sys_readFlash(faddr, raw, n);
+        for( int u=0; u<n; u++ ) {
+            TCHECK(raw[u] == (w[u] ^ key[((faddr>>2)+u) & 3]));
+            TCHECK(rdFlash1(faddr+4*u) == w[u]);
+        }
+        memset(w, 0, sizeof(w));
+        rdFlashN(faddr, w, n);
+        TCHECK(memcmp(w, buf+n, 4*n) == 0);
+    }
+    // Full page - word by word and bulk agree
+    memcpy(w, buf, sizeof(w));
+    wrFlashN(base, w, FLASH_PAGE_SIZE/4, 0);
+    rdFlashN(base, raw, FLASH_PAGE_SIZE/4);
+    TCHECK(memcmp(raw, buf, FLASH_PAGE_SIZE) == 0);
+    for( int u=0; u<FLASH_PAGE_SIZE/4; u++ )
+        TCHECK(rdFlash1(base+4*u) == raw[u]);
+}
+
+
+// Random operations checked against a simple in-memory model.
+// Exercises the RAM index incl. renames over existing files, GC and fs_ck.
+// With bg set a background GC is advanced in small steps between operations.
+#define NMODEL 6
+#define MODEL_SZ 600
+
+static struct {
+    int  exists;
+    int  len;
+    u1_t data[MODEL_SZ];
+} model[NMODEL];
+
+static void modelCheck (int k) {
+    char fn[8] = { 'm', '0'+k, 0 };
+    struct stat st;
+    int err = fs_stat(fn, &st);
+    TCHECK((err == 0) == model[k].exists);
+    TCHECK(fs_access(fn, 0) == err);
+    if( err != 0 )
+        return;
+    TCHECK(st.st_size == model[k].len);
+    u1_t buf[MODEL_SZ+8];
+    int fd = fs_open(fn, O_RDONLY);
+    TCHECK(fd >= 0);
+    int n, off = 0;
+    while( (n = fs_read(fd, buf+off, 1 + (off*7) % 97)) > 0 )
+        off += n;
+    TCHECK(off == model[k].len && memcmp(buf, model[k].data, off) == 0);
+    if( off > 0 ) {
+        int pos = (off*13) % off;
+        TCHECK(fs_lseek(fd, pos, SEEK_SET) == 0);
+        TCHECK(fs_read(fd, buf, MODEL_SZ) == off-pos && memcmp(buf, model[k].data+pos, off-pos) == 0);
+    }
+    fs_close(fd);
+}
+
+static void selftest_fsModel (int bg) {
+    fs_erase();
+    u4_t key[4] = {0x12345678,0x9ABCDEF0,0x0FEDCBA9,0x87654321};
+    fs_ini(key);
+    memset(model, 0, sizeof(model));
+    u4_t r = 1;
+    u1_t data[MODEL_SZ];
+    int rdfd = -1, rdk = 0, rdoff = 0;   // reader kept open across operations
+    int rdlive = 0;                      // reader's file still visible
+    u1_t rddata[MODEL_SZ];
+    for( int step=0; step<3000; step++ ) {
+        r = r*1103515245 + 12345;
+        int k = (r>>8) % NMODEL, k2 = (r>>12) % NMODEL, op = (r>>16) % 16;
+        char fn[8] = { 'm', '0'+k, 0 }, fn2[8] = { 'm', '0'+k2, 0 };
+        if( bg ) {
+            if( rdfd >= 0 && !rdlive ) {
+                fs_close(rdfd);  // GC does not preserve deleted files
+                rdfd = -1;
+            }
+            fs_gcStep(64 + (r>>20) % 1024);
+        }
+        if( op <= 5 ) {  // create or append
+            int append = op >= 3 && model[k].exists;
+            int n = (r>>20) % 100;
+            if( append && model[k].len + n > MODEL_SZ )
+                append = 0;
+            for( int i=0; i<n; i++ )
+                data[i] = step + i*k;
+            int fd = fs_open(fn, append ? O_CREAT|O_APPEND|O_WRONLY : O_CREAT|O_TRUNC|O_WRONLY, 0777);
+            TCHECK(fd >= 0);
+            TCHECK(fs_write(fd, data, n/2) == n/2);
+            TCHECK(fs_write(fd, data+n/2, n-n/2) == n-n/2);
+            fs_close(fd);
+            if( !append ) {
+                model[k].len = 0;
+                if( rdk == k ) rdlive = 0;
+            }
+            memcpy(model[k].data + model[k].len, data, n);
+            model[k].len += n;
+            model[k].exists = 1;
+        }
+        else if( op <= 7 ) {
+            TCHECK((fs_unlink(fn) == 0) == model[k].exists);
+            model[k].exists = 0;
+            if( rdk == k ) rdlive = 0;
+        }
+        else if( op <= 9 && k != k2 ) {
+            TCHECK((fs_rename(fn, fn2) == 0) == model[k].exists);
+            if( model[k].exists ) {
+                model[k2] = model[k];
+                model[k].exists = 0;
+                if( rdk == k2 ) rdlive = 0;
+                else if( rdk == k ) rdk = k2;
+            }
+        }
+        else if( op == 10 ) {
+            if( rdfd >= 0 ) {
+                // Open reader sees data as of its file - even if deleted/replaced since
+                u1_t buf[MODEL_SZ];
+                int n = fs_read(rdfd, buf, MODEL_SZ);
+                TCHECK(n == rdoff && memcmp(buf, rddata, n) == 0);
+                fs_close(rdfd);
+                rdfd = -1;
+            } else if( model[k].exists ) {
+                rdfd = fs_open(fn, O_RDONLY);
+                TCHECK(rdfd >= 0);
+                rdk = k;
+                rdlive = 1;
+                rdoff = model[k].len;
+                memcpy(rddata, model[k].data, rdoff);
+            }
+        }
+        else if( op == 11 && (r>>24) % 8 == 0 ) {
+            if( rdfd >= 0 ) {
+                fs_close(rdfd);  // GC does not preserve deleted files
+                rdfd = -1;
+            }
+            if( (r>>28) & 1 ) fs_gc(0); else fs_ck();
+        }
+        else if( op == 11 && bg && (r>>24) % 8 == 1 ) {
+            fs_gcBackground();
+        }
+        else {
+            modelCheck(k);
+        }
+        // Keep reader consistent only while no appends to its file are possible
+        if( rdfd >= 0 && model[rdk].exists && model[rdk].len != rdoff ) {
+            fs_close(rdfd);
+            rdfd = -1;
+        }
+    }
+    if( rdfd >= 0 )
+        fs_close(rdfd);
+    for( int k=0; k<NMODEL; k++ )
+        modelCheck(k);
+    if( bg ) {
+        // Finish pending GC - the new section must be found clean
+        while( fs_gcStep(FS_GC_STEP) );
+        TCHECK(fs_ck() == 1);
+        for( int k=0; k<NMODEL; k++ )
+            modelCheck(k);
+    }
+}
+
+
 #define TNORM(i, fn, expfn)                                     \
     sz = fs_fnNormalize(fn, norm, sizeof(norm));                \
     fprintf(stderr, "FN%d: (%d) %s\n", i, sz, norm);            \
@@ -400,6 +599,10 @@ void selftest_fs () {
 
     fs_close(fd);
     fs_close(fd1);
+
+    selftest_fsKernels(key);
+    selftest_fsModel(0);
+    selftest_fsModel(1);
 }
 
 #endif
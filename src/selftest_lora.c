@@ -33,6 +33,25 @@
 
 static const uL_t euiFilter1[] = { 0xEFCDAB8967452300, 0xEFCDAB8967452300, 0 };
 static const uL_t euiFilter2[] = { 0xEFCDAB8967452300, 0xEFCDAB8967452301, 0 };
+static const uL_t euiFilter3[] = {
+    0xEFCDAB8967452302, ~(uL_t)0,
+    0x30, 0x3F,
+    0x05, 0x10,
+    0x50, 0x40,  // empty
+    0x20, 0x2F,  // adjacent to 0x30..
+    0x00, 0x08,
+};
+
+
+static u2_t refCrc16 (const u1_t* p, int len) {
+    u2_t r = 0;
+    for( int i=0; i<len; i++ ) {
+        r ^= p[i] << 8;
+        for( int b=0; b<8; b++ )
+            r = (r & 0x8000) ? (r << 1) ^ 0x1021 : r << 1;
+    }
+    return r;
+}
 
 
 void selftest_lora () {
@@ -68,17 +87,41 @@ void selftest_lora () {
                   "\"JoinEui\":\"EF-CD-AB-89-67-45-23-01\","
                   "\"DevEui\":\"EF-FD-EB-F9-E7-F5-E3-F1\","
                   "\"DevNonce\":61936,\"MIC\":-1549622880", B.buf) == 0);
+    // Decoded once - JSON and log text from the same fields
+    {
+        lorafrm_t f;
+        char lb[128];
+        dbuf_t L = dbuf_ini(lb);
+        TCHECK(s2e_decodeLoraFrame(&f, (const u1_t*)Tjreq, 23));
+        TCHECK(f.drop == LORAFRM_OK && f.devnonce == 61936 && f.joineui == 0xEFCDAB8967452301);
+        s2e_logLoraFrame(&L, &f);
+        xeos(&L);
+        TCHECK(strncmp("jreq MHdr=00 ", lb, 13) == 0 && strstr(lb, "DevNonce=61936 ") != NULL);
+        TCHECK(!s2e_decodeLoraFrame(&f, (const u1_t*)Tjreq, 22) && f.drop == LORAFRM_BAD);
+    }
     // Too short
     B.pos = 0;
     TCHECK(!s2e_parse_lora_frame(&B, (const u1_t*)Tjreq, 22, NULL));
     // Filter enabled
     B.pos = 0;
-    memcpy(s2e_joineuiFilter, euiFilter1, sizeof(euiFilter1));  // jreq removed
+    memcpy(joineuiFilter, euiFilter1, sizeof(euiFilter1));  // jreq removed
+    TCHECK(s2e_setJoineuiFilter(joineuiFilter, 1) == 1);
     TCHECK(!s2e_parse_lora_frame(&B, (const u1_t*)Tjreq, 23, NULL));
     B.pos = 0;
-    memcpy(s2e_joineuiFilter, euiFilter2, sizeof(euiFilter2));  // jreq passes
+    memcpy(joineuiFilter, euiFilter2, sizeof(euiFilter2));  // jreq passes
+    TCHECK(s2e_setJoineuiFilter(joineuiFilter, 1) == 1);
+    TCHECK(s2e_parse_lora_frame(&B, (const u1_t*)Tjreq, 23, NULL));
+    // Unsorted, overlapping and empty ranges - merged into a sorted set
+    B.pos = 0;
+    memcpy(joineuiFilter, euiFilter3, sizeof(euiFilter3));
+    TCHECK(s2e_setJoineuiFilter(joineuiFilter, SIZE_ARRAY(euiFilter3)/2) == 3);
+    TCHECK(joineuiFilter[0] == 0 && joineuiFilter[1] == 0x10);
+    TCHECK(joineuiFilter[2] == 0x20 && joineuiFilter[3] == 0x3F);
+    TCHECK(joineuiFilter[4] == 0xEFCDAB8967452302 && joineuiFilter[5] == ~(uL_t)0);
+    TCHECK(!s2e_parse_lora_frame(&B, (const u1_t*)Tjreq, 23, NULL));
+    joineuiFilter[4] = 0xEFCDAB8967452301;
     TCHECK(s2e_parse_lora_frame(&B, (const u1_t*)Tjreq, 23, NULL));
-    s2e_joineuiFilter[0] = 0;
+    s2e_setJoineuiFilter(joineuiFilter, 0);
 
     B.pos = 0;
     const char* Tdaup1 = "\x40\xAB\xCD\xEF\xFF\x01\xF3\xF4\xFF\x20\x21\x22\xA0\xA1\xA2\xA3";  // daup
@@ -95,6 +138,145 @@ void selftest_lora () {
     B.pos = 0;
     s2e_netidFilter[0] = s2e_netidFilter[1] = s2e_netidFilter[2] = s2e_netidFilter[3] = 0;
     TCHECK(!s2e_parse_lora_frame(&B, (const u1_t*)Tdaup1, 12+1+3, NULL));
+    s2e_netidFilter[0] = s2e_netidFilter[1] = s2e_netidFilter[2] = s2e_netidFilter[3] = 0xffFFffFF;
+
+    // DevAddr prefix filter - DevAddr of Tdaup1 is FFEFCDAB
+    u4_t maxPrefixes = MAX_DEVADDR_PREFIXES;
+    MAX_DEVADDR_PREFIXES = 3;
+    u4_t addr;
+    TCHECK(s2e_netid2prefix(0x000013, &addr) == 7 && addr == 0x26000000);
+    TCHECK(s2e_netid2prefix(0x600001, &addr) == 15 && addr == 0xE0020000);
+    TCHECK(s2e_netid2prefix(0xE00005, &addr) == 25 && addr == 0xFE000280);
+    s2e_resetDevaddrFilter(1);
+    B.pos = 0;
+    TCHECK(!s2e_parse_lora_frame(&B, (const u1_t*)Tdaup1, 12+1+3, NULL));  // empty list drops all
+    TCHECK(s2e_addDevaddrPrefix(0x26000000, 7));
+    TCHECK(s2e_addDevaddrPrefix(0xFFEFCD00, 24));
+    TCHECK(s2e_addDevaddrPrefix(0xFFFFFFFF, 11));
+    TCHECK(!s2e_addDevaddrPrefix(0x12345678, 16));  // full
+    TCHECK(s2e_devaddrPrefixes[2].addr == 0xFFE00000);
+    B.pos = 0;
+    TCHECK(s2e_parse_lora_frame(&B, (const u1_t*)Tdaup1, 12+1+3, NULL));
+    TCHECK(s2e_devaddrPrefixes[2].hits == 1 && s2e_devaddrPrefixes[1].hits == 0);  // shortest prefix counts
+    TCHECK(s2e_devaddrShed == 1);
+    s2e_resetDevaddrFilter(1);
+    TCHECK(s2e_addDevaddrPrefix(0xFFEFCDAA, 32));
+    TCHECK(s2e_addDevaddrPrefix(0xFFEFCDAB, 32));
+    B.pos = 0;
+    TCHECK(s2e_parse_lora_frame(&B, (const u1_t*)Tdaup1, 12+1+3, NULL));
+    TCHECK(s2e_devaddrPrefixes[1].hits == 1);
+    // Trie node indexes are u2_t - capacity is clamped
+    MAX_DEVADDR_PREFIXES = 100000;
+    s2e_resetDevaddrFilter(1);
+    for( u4_t i=0; i < DEVADDR_PREFIX_LIMIT; i++ )
+        TCHECK(s2e_addDevaddrPrefix(i*0x9E3779B9, 32));
+    TCHECK(!s2e_addDevaddrPrefix(0x12345678, 32));
+    TCHECK(s2e_devaddrPrefixCnt == DEVADDR_PREFIX_LIMIT);
+    B.pos = 0;
+    TCHECK(!s2e_parse_lora_frame(&B, (const u1_t*)Tdaup1, 12+1+3, NULL));
+    s2e_resetDevaddrFilter(0);
+    MAX_DEVADDR_PREFIXES = maxPrefixes;
+
+    // Overload shedding - SNR scaled by 4, SF7 floor -7.5dB + margin 5dB
+    const u1_t* daup = (const u1_t*)Tdaup1;
+    u1_t dcup[16];
+    memcpy(dcup, daup, sizeof(dcup));
+    dcup[0] = 0x80;  // confirmed
+    u4_t margin = RX_SHED_SNR_MARGIN;
+    RX_SHED_SNR_MARGIN = 5;
+    TCHECK(s2e_shedLoraFrame(daup, 16, SF7, -16, RXSHED_DUP) == 0);
+    TCHECK(s2e_shedLoraFrame(daup, 16, SF7, -16, RXSHED_SNR) == RXSHED_SNR);
+    TCHECK(s2e_shedLoraFrame(daup, 16, SF7,  -8, RXSHED_SNR) == 0);
+    TCHECK(s2e_shedLoraFrame(daup, 16, SF12, -16, RXSHED_SNR) == 0);
+    TCHECK(s2e_shedLoraFrame(daup, 16, FSK, -80, RXSHED_SNR) == 0);
+    TCHECK(s2e_shedLoraFrame(dcup, 16, SF7, -40, RXSHED_SNR|RXSHED_FILTER) == 0);
+    TCHECK(s2e_shedLoraFrame((const u1_t*)Tjreq, 23, SF7, -40, RXSHED_SNR|RXSHED_FILTER) == 0);
+    TCHECK(s2e_shedLoraFrame(daup, 12, SF7, 40, RXSHED_FILTER) == RXSHED_FILTER);  // too short
+    TCHECK(s2e_shedLoraFrame(daup, 12, SF7, 40, RXSHED_SNR) == 0);
+    // DevAddr filter counts each frame once - shedding checks and the final decode share the frame
+    lorafrm_t f;
+    MAX_DEVADDR_PREFIXES = 1;
+    s2e_resetDevaddrFilter(1);
+    TCHECK(s2e_addDevaddrPrefix(0xFFE00000, 11));
+    for( int i=0; i<3; i++ ) {
+        TCHECK(s2e_shedLoraFrame(daup, 16, SF7, 40, RXSHED_SNR|RXSHED_FILTER) == 0);
+        TCHECK(s2e_decodeLoraFrame(&f, daup, 16));
+        TCHECK(s2e_devaddrPrefixes[0].hits == i+1);
+    }
+    memcpy(dcup, daup, sizeof(dcup));
+    dcup[4] = 0x26;  // DevAddr 26EFCDAB - not in filter
+    TCHECK(s2e_shedLoraFrame(dcup, 16, SF7, 40, RXSHED_SNR) == 0);
+    TCHECK(s2e_devaddrShed == 0);
+    TCHECK(s2e_shedLoraFrame(dcup, 16, SF7, 40, RXSHED_FILTER) == RXSHED_FILTER);
+    TCHECK(s2e_devaddrShed == 1);
+    TCHECK(!s2e_decodeLoraFrame(&f, dcup, 16) && f.drop == LORAFRM_DEVADDR);
+    TCHECK(s2e_devaddrShed == 2 && s2e_devaddrPrefixes[0].hits == 3);
+    s2e_resetDevaddrFilter(0);
+    MAX_DEVADDR_PREFIXES = maxPrefixes;
+    RX_SHED_SNR_MARGIN = margin;
+
+    // Beacon - EU868 layout
+    u1_t layout[3] = { 2, 8, 17 };
+    u1_t bcn[BCN_MAXLEN], tmpl[BCN_MAXLEN];
+    TCHECK(s2e_checkBeaconLayout(layout));
+    s2e_make_beacon(layout, 0x12345678, 0, 45.0, -90.0, bcn);
+    TCHECK(bcn[0] == 0 && bcn[1] == 0);
+    TCHECK(bcn[2] == 0x78 && bcn[3] == 0x56 && bcn[4] == 0x34 && bcn[5] == 0x12);
+    TCHECK(rt_rlsbf2(&bcn[6]) == refCrc16(&bcn[0], 6));
+    TCHECK(bcn[8] == 0);
+    TCHECK(bcn[9] == 0x00 && bcn[10] == 0x00 && bcn[11] == 0x40);   // lat 45 => 2^22
+    TCHECK(bcn[12] == 0x00 && bcn[13] == 0x00 && bcn[14] == 0xC0);  // lon -90 => -2^22
+    TCHECK(rt_rlsbf2(&bcn[15]) == refCrc16(&bcn[8], 7));
+    // Template stamped with different times
+    s2e_prep_beacon(layout, 0, 45.0, -90.0, tmpl);
+    TCHECK(memcmp(&tmpl[8], &bcn[8], 9) == 0);
+    s2e_stamp_beacon(layout, tmpl, 0x12345678, bcn);
+    u1_t bcn2[BCN_MAXLEN];
+    s2e_make_beacon(layout, 0x12345678, 0, 45.0, -90.0, bcn2);
+    TCHECK(memcmp(bcn, bcn2, 17) == 0);
+    s2e_stamp_beacon(layout, tmpl, 0x12345680, bcn);
+    TCHECK(bcn[2] == 0x80 && rt_rlsbf2(&bcn[6]) == refCrc16(&bcn[0], 6));
+    s2e_make_beacon(layout, 0, 0, 90.0, 180.0, bcn);    // clamped
+    TCHECK(bcn[11] == 0x7F && bcn[14] == 0x7F);
+    layout[2] = BCN_MAXLEN+1;
+    TCHECK(!s2e_checkBeaconLayout(layout));
+    layout[0] = 5; layout[2] = 17;
+    TCHECK(!s2e_checkBeaconLayout(layout));
+
+    // Class B ping slots
+    ustime_t bcnIntvl = BEACON_INTVL;
+    BEACON_INTVL = rt_seconds(128);
+    sL_t t0 = rt_seconds(10*128) + PING_BCN_RESERVED;
+    TCHECK(s2e_nextPingSlot(rt_seconds(10*128), 32, 5) == t0 + 5*PING_SLOT_LEN);
+    TCHECK(s2e_nextPingSlot(t0 + 5*PING_SLOT_LEN, 32, 5) == t0 + 5*PING_SLOT_LEN);
+    TCHECK(s2e_nextPingSlot(t0 + 5*PING_SLOT_LEN+1, 32, 5) == t0 + 37*PING_SLOT_LEN);
+    TCHECK(s2e_nextPingSlot(t0 + 4069*PING_SLOT_LEN, 32, 5) == t0 + 4069*PING_SLOT_LEN);
+    TCHECK(s2e_nextPingSlot(t0 + 4069*PING_SLOT_LEN+1, 32, 5) == 0);
+    TCHECK(s2e_nextPingSlot(t0 + 100*PING_SLOT_LEN, 4096, 4095) == t0 + 4095*PING_SLOT_LEN);
+    BEACON_INTVL = bcnIntvl;
 
     free(jsonbuf);
 }
+
+
+void selftest_airtime () {
+    // Table lookup must agree with formula over the full domain
+    for( int sf=SF12; sf<=SF7; sf++ ) {
+        for( int bw=BW125; bw<=BW500; bw++ ) {
+            rps_t rps = rps_make(sf,bw);
+            for( int plen=0; plen<256; plen++ ) {
+                TCHECK(s2e_calcDnAirTime(rps, plen, 0, 0) == s2e_calcAirTimeRef(rps, plen, 1, 8));
+                TCHECK(s2e_calcDnAirTime(rps, plen, 1, 8) == s2e_calcAirTimeRef(rps, plen, 0, 8));
+                TCHECK(s2e_calcUpAirTime(rps, plen) == s2e_calcAirTimeRef(rps, plen, 0, 8));
+            }
+        }
+    }
+    // Not covered by table
+    TCHECK(s2e_calcDnAirTime(rps_make(SF7,BW125), 20, 0, 12) == s2e_calcAirTimeRef(rps_make(SF7,BW125), 20, 1, 12));
+    TCHECK(s2e_calcDnAirTime(rps_make(SF7,BW125), 20, 0, 12) > s2e_calcDnAirTime(rps_make(SF7,BW125), 20, 0, 8));
+    TCHECK(s2e_calcDnAirTime(rps_make(FSK,BW125), 20, 0, 0) == s2e_calcAirTimeRef(rps_make(FSK,BW125), 20, 1, 8));
+    TCHECK(s2e_calcDnAirTime(RPS_ILLEGAL, 20, 0, 0) == 0);
+    // Spot check against known values
+    TCHECK(s2e_calcUpAirTime(rps_make(SF7,BW125), 20) == 56576);
+    TCHECK(s2e_calcUpAirTime(rps_make(SF12,BW125), 20) == 1318996);
+}
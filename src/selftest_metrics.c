@@ -0,0 +1,146 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "selftests.h"
+#include "s2conf.h"
+#include "uj.h"
+#include "metrics.h"
+#include "trace.h"
+
+
+void selftest_metrics () {
+    TCHECK(metric_bucket(-5) == 0);
+    TCHECK(metric_bucket(0) == 0);
+    TCHECK(metric_bucket(16) == 0);
+    TCHECK(metric_bucket(17) == 1);
+    TCHECK(metric_bucket(32) == 1);
+    TCHECK(metric_bucket(33) == 2);
+    TCHECK(metric_bucket(1<<(METRIC_HISTO_MINEXP+METRIC_HISTO_BUCKETS-1)) == METRIC_HISTO_BUCKETS-1);
+    TCHECK(metric_bucket((1<<(METRIC_HISTO_MINEXP+METRIC_HISTO_BUCKETS-1))+1) == METRIC_HISTO_BUCKETS);
+    TCHECK(metric_bucket(rt_seconds(3600)) == METRIC_HISTO_BUCKETS);
+
+    metrics_reset();
+    metric_inc(MC_rx_frames);
+    metric_inc(MC_rx_frames);
+    metric_add(MC_rx_drop_crc, 3);
+    metric_inc(MC_tx_rej_cca);
+    metric_set(MG_ws_queued, 1234);
+    metric_obs(MH_tx_lead, 10);
+    metric_obs(MH_tx_lead, 1000);
+    metric_obs(MH_tx_lead, rt_seconds(60));
+    TCHECK(metrics_histo[MH_tx_lead].count == 3);
+    TCHECK(metrics_histo[MH_tx_lead].bucket[0] == 1);
+    TCHECK(metrics_histo[MH_tx_lead].bucket[6] == 1);
+    TCHECK(metrics_histo[MH_tx_lead].bucket[METRIC_HISTO_BUCKETS] == 1);
+
+    // Callback profiler - one stalling run
+    ustime_t stall = PROF_STALL;
+    PROF_STALL = rt_millis(10);
+    for( int i=0; i<99; i++ )
+        metrics_profCb(selftest_metrics, PROF_TIMER, rt_getTime()-20);
+    metrics_profCb(selftest_metrics, PROF_TIMER, rt_getTime()-rt_millis(50));
+    metrics_profCb(selftest_metrics, PROF_AIO_RD, rt_getTime());
+    TCHECK(metrics_ctr[MC_cb_overrun] == 1);
+    PROF_STALL = stall;
+
+    dbuf_t b = { .buf = rt_mallocN(char, METRICS_PROM_SIZE), .bufsize = METRICS_PROM_SIZE };
+    TCHECK(metrics_prom(&b));
+    TCHECK(strstr(b.buf, "\nstation_rx_frames_total 2\n") != NULL);
+    TCHECK(strstr(b.buf, "\nstation_rx_dropped_total{reason=\"crc\"} 3\n") != NULL);
+    TCHECK(strstr(b.buf, "\nstation_tx_rejected_total{reason=\"cca\"} 1\n") != NULL);
+    TCHECK(strstr(b.buf, "\nstation_ws_send_queued_bytes 1234\n") != NULL);
+    // One HELP/TYPE per family
+    TCHECK(strstr(b.buf, "# TYPE station_rx_dropped_total counter\n") != NULL);
+    TCHECK(strstr(strstr(b.buf, "# TYPE station_rx_dropped_total")+1, "# TYPE station_rx_dropped_total") == NULL);
+    // Cumulative buckets
+    TCHECK(strstr(b.buf, "\nstation_tx_lead_seconds_bucket{le=\"0.000016\"} 1\n") != NULL);
+    TCHECK(strstr(b.buf, "\nstation_tx_lead_seconds_bucket{le=\"0.001024\"} 2\n") != NULL);
+    TCHECK(strstr(b.buf, "\nstation_tx_lead_seconds_bucket{le=\"8.388608\"} 2\n") != NULL);
+    TCHECK(strstr(b.buf, "\nstation_tx_lead_seconds_bucket{le=\"+Inf\"} 3\n") != NULL);
+    TCHECK(strstr(b.buf, "\nstation_tx_lead_seconds_sum 60.001010\n") != NULL);
+    TCHECK(strstr(b.buf, "\nstation_tx_lead_seconds_count 3\n") != NULL);
+    // Longest running site first - p50 from log2 bucket, max exact
+    char* p = strstr(b.buf, "\nstation_callback_seconds{site=\"exe+0x");
+    TCHECK(p != NULL);
+    TCHECK(strstr(p, "kind=\"timer\",quantile=\"0.5\"} 0.000032\n") != NULL);
+    TCHECK(strstr(p, "kind=\"timer\",quantile=\"1\"} 0.05") != NULL);
+    TCHECK(strstr(p, "kind=\"timer\"} 100\n") != NULL);
+    TCHECK(strstr(p, "kind=\"aio_rd\"} 1\n") != NULL);
+
+    // Too small buffer is detected
+    dbuf_t s = { .buf = b.buf, .bufsize = 100 };
+    TCHECK(!metrics_prom(&s));
+
+    b.pos = 0;
+    uj_encOpen(&b, '{');
+    metrics_json(&b);
+    uj_encClose(&b, '}');
+    TCHECK(xeos(&b));
+    TCHECK(b.pos < METRICS_JSON_SIZE);
+    TCHECK(strstr(b.buf, "\"rx_drop_crc\":3,") != NULL);
+    TCHECK(strstr(b.buf, "\"tx_lead\":{\"count\":3,") != NULL);
+
+    // Worst case values must fit into the advertised sizes
+    for( int i=0; i<MC_MAX; i++ )
+        metrics_ctr[i] = UINT64_MAX;
+    for( int i=0; i<MG_MAX; i++ )
+        metrics_gauge[i] = INT64_MIN;
+    for( int i=0; i<MH_MAX; i++ ) {
+        for( int k=0; k<=METRIC_HISTO_BUCKETS; k++ )
+            metrics_histo[i].bucket[k] = UINT64_MAX;
+        metrics_histo[i].count = UINT64_MAX;
+        metrics_histo[i].sum = INT64_MIN;
+    }
+    b.pos = 0;
+    TCHECK(metrics_prom(&b));
+    TCHECK(strstr(b.buf, "\nstation_rx_frames_total 18446744073709551615\n") != NULL);
+    dbuf_t j = { .buf = rt_mallocN(char, METRICS_JSON_SIZE), .bufsize = METRICS_JSON_SIZE };
+    uj_encOpen(&j, '{');
+    uj_encKV(&j, "msgtype", 's', "metrics");
+    metrics_json(&j);
+    uj_encClose(&j, '}');
+    TCHECK(xeos(&j));
+    rt_free(j.buf);
+    rt_free(b.buf);
+    metrics_reset();
+
+    // Flight recorder wraps around - oldest records are overwritten
+    u4_t widx = trace_widx;
+    for( u4_t i=0; i < TRACE_RECORDS+3; i++ )
+        trace_rec(0x100000000LL + i, TRACE_RX, 5, TRACE_OK, 868100000, i);
+    TCHECK(trace_widx == widx + TRACE_RECORDS+3);
+    trace_rec_t* r = &trace_ring[(trace_widx-1) & (TRACE_RECORDS-1)];
+    TCHECK(r->t == TRACE_RECORDS+2 && r->ev == TRACE_RX && r->a == 5 && r->c == 868100000 && r->d == TRACE_RECORDS+2);
+    TCHECK(trace_ring[trace_widx & (TRACE_RECORDS-1)].d == 3);  // oldest surviving record
+    TCHECK(trace_clamp(rt_seconds(-3600)) == (u4_t)-0x7FFFFFFF);
+    TCHECK(trace_clamp(-5) == (u4_t)-5);
+    trace_hdr_t h;
+    trace_header(&h, -1);
+    TCHECK(memcmp(h.magic, "STRC", 4) == 0 && h.recsize == 16 && h.nrecs == TRACE_RECORDS && h.widx == trace_widx && h.reason == -1);
+}
@@ -30,13 +30,169 @@
 #include "rt.h"
 
 
+enum { N_TEST_TIMERS = 200 };
+static tmr_t testTimers[N_TEST_TIMERS];
+static int   firedOrder[N_TEST_TIMERS];
+static int   firedCnt;
+
+static void testTimerCb (tmr_t* tmr) {
+    firedOrder[firedCnt++] = tmr - testTimers;
+}
+
+static void selftest_timers () {
+    ustime_t now = rt_getTime();
+    firedCnt = 0;
+    for( int i=0; i<N_TEST_TIMERS; i++ ) {
+        rt_iniTimer(&testTimers[i], testTimerCb);
+        // Lots of equal deadlines to check FIFO order of ties
+        rt_setTimer(&testTimers[i], now - rt_seconds(3600) - (rand() % 16));
+    }
+    // Re-arm and clear some timers while queued
+    for( int i=0; i<N_TEST_TIMERS; i+=7 )
+        rt_setTimer(&testTimers[i], now - rt_seconds(3600) - (rand() % 16));
+    for( int i=3; i<N_TEST_TIMERS; i+=11 )
+        rt_clrTimer(&testTimers[i]);
+    rt_clrTimer(&testTimers[3]);    // already cleared - no-op
+    rt_processTimerQ();
+
+    int expected = 0;
+    for( int i=0; i<N_TEST_TIMERS; i++ ) {
+        if( i < 3 || (i-3) % 11 != 0 )
+            expected++;
+        TCHECK(testTimers[i].next == TMR_NIL);
+    }
+    TCHECK(firedCnt == expected);
+    for( int k=1; k<firedCnt; k++ ) {
+        tmr_t* a = &testTimers[firedOrder[k-1]];
+        tmr_t* b = &testTimers[firedOrder[k]];
+        TCHECK(a->deadline <= b->deadline);
+    }
+    // Ties must fire in order of arming
+    for( int k=1; k<firedCnt; k++ ) {
+        int a = firedOrder[k-1], b = firedOrder[k];
+        if( testTimers[a].deadline == testTimers[b].deadline && a%7 != 0 && b%7 != 0 )
+            TCHECK(a < b);
+    }
+}
+
+
+#if defined(CFG_simclock)
+static void selftest_simclock () {
+    ustime_t now = rt_getTime();
+    rt_simClock(now, 0);
+    TCHECK(rt_getTime() == now);
+    TCHECK(rt_getUTC() == now + rt_utcOffset);
+    firedCnt = 0;
+    rt_iniTimer(&testTimers[0], testTimerCb);
+    rt_setTimer(&testTimers[0], now + rt_millis(5));
+    TCHECK(rt_nextDeadline() <= now + rt_millis(5));
+    rt_processTimerQ();
+    TCHECK(firedCnt == 0);         // simulated time does not move by itself
+    TCHECK(rt_getTime() == now);
+    rt_simAdvance(now + rt_millis(5));
+    rt_simAdvance(now);            // never backwards
+    rt_simAdvance(USTIME_MAX);     // no timer - stays put
+    TCHECK(rt_getTime() == now + rt_millis(5));
+    rt_processTimerQ();
+    TCHECK(firedCnt == 1 && testTimers[0].next == TMR_NIL);
+    rt_usleep(rt_seconds(1));      // returns right away
+    TCHECK(rt_getTime() == now + rt_millis(1005));
+    rt_simClock(0, 0);
+    TCHECK(rt_getTime() - now < rt_seconds(1));
+}
+#endif // defined(CFG_simclock)
+
+
+// Bitwise reference implementation
+static u4_t crc32_bitwise (u4_t crc, const u1_t* p, int n) {
+    crc = ~crc;
+    while( n-- > 0 ) {
+        crc ^= *p++;
+        for( int b=0; b<8; b++ )
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void selftest_crc32 () {
+    TCHECK(rt_crc32(0, "123456789", 9) == 0xCBF43926);
+    TCHECK(rt_crc32(0, "", 0) == 0);
+
+    u1_t buf[300];
+    u4_t x = 1;
+    for( int i=0; i<sizeof(buf); i++ ) {
+        x = x*1103515245 + 12345;
+        buf[i] = x >> 16;
+    }
+    // All lengths with varying alignment - and the same piecewise
+    for( int off=0; off<8; off++ ) {
+        for( int n=0; n+off <= sizeof(buf); n += 1+n/16 ) {
+            u4_t ref = crc32_bitwise(0, buf+off, n);
+            TCHECK(rt_crc32(0, buf+off, n) == ref);
+            int k = n/3;
+            TCHECK(rt_crc32(rt_crc32(0, buf+off, k), buf+off+k, n-k) == ref);
+        }
+    }
+}
+
+static void selftest_arena () {
+    rt_arena_t a;
+    rt_arenaIni(&a, 1000);
+    TCHECK(a.blks == NULL && a.total == 0);
+    u1_t* p1 = rt_arenaAlloc(&a, 10);
+    u1_t* p2 = rt_arenaAlloc(&a, 3);
+    TCHECK(a.nblks == 1 && a.nallocs == 2);
+    TCHECK(((uintptr_t)p1 & 15) == 0 && ((uintptr_t)p2 & 15) == 0);
+    TCHECK(p2 >= p1+10);
+    TCHECK(p1[0] == 0 && p1[9] == 0 && p2[2] == 0);
+    memset(p1, 0xAA, 10);
+    TCHECK(p2[0] == 0);
+    // Oversized object gets its own block - current block stays in use
+    u1_t* big = rt_arenaAlloc(&a, 5000);
+    TCHECK(a.nblks == 2);
+    u1_t* p3 = rt_arenaAlloc(&a, 16);
+    TCHECK(a.nblks == 2 && p3 == p2+16);
+    TCHECK(big[4999] == 0);
+    char* s = rt_arenaStrdup(&a, "hello");
+    TCHECK(strcmp(s, "hello") == 0);
+    TCHECK(rt_arenaStrdup(&a, NULL) == NULL);
+    // Running out of the current block chains a new one
+    for( int i=0; i<100; i++ )
+        rt_arenaAlloc(&a, 64);
+    TCHECK(a.nblks > 2);
+    TCHECK(a.used <= a.total && a.peak == a.total);
+    rt_arenaRelease(&a, p1);  // nop
+    rt_arenaFree(&a);
+    TCHECK(a.blks == NULL && a.nblks == 0 && a.total == 0 && a.used == 0);
+    TCHECK(rt_arenaAlloc(&a, 8) != NULL && a.nblks == 1);
+    rt_arenaFree(&a);
+    // NULL arena is the heap
+    char* h = rt_arenaAlloc(NULL, 32);
+    TCHECK(h[31] == 0);
+    rt_arenaRelease(NULL, h);
+}
+
 void selftest_rt () {
+    selftest_timers();
+    selftest_arena();
+#if defined(CFG_simclock)
+    selftest_simclock();
+#endif // defined(CFG_simclock)
+    selftest_crc32();
+
     TCHECK(rt_seconds(2) == rt_millis(2000));
     u1_t b[] = { 1,2,3,4,5,6,7,8 };
     TCHECK(rt_rlsbf2(b) == 0x0201);
     TCHECK(rt_rmsbf2(b) == 0x0102);
     TCHECK(rt_rlsbf4(b) == 0x04030201);
     TCHECK(rt_rlsbf8(b) == (uL_t)0x0807060504030201);
+    u1_t w[8] = { 0 };
+    rt_wlsbf2(w, 0x0201);
+    TCHECK(memcmp(w, b, 2) == 0);
+    rt_wlsbf4(w, 0x04030201);
+    TCHECK(memcmp(w, b, 4) == 0);
+    rt_wlsbf8(w, (uL_t)0x0807060504030201);
+    TCHECK(memcmp(w, b, 8) == 0);
     TCHECK(rt_hexDigit('1') == 1);
     TCHECK(rt_hexDigit('a') == 10);
     TCHECK(rt_hexDigit('f') == 15);
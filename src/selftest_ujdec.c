@@ -589,6 +589,24 @@ static void test_sugar() {
         TFAIL("G21");            // LCOV_EXCL_LINE
     TCHECK(4 == uj_hexstr(&D, buf, sizeof(buf)));
     TCHECK(strcmp((const char*)buf, "ABC") == 0);
+    iniDecoder(&D,"\"0aFf9A\"");
+    if( uj_decode(&D) )
+        TFAIL("G22");            // LCOV_EXCL_LINE
+    TCHECK(3 == uj_hexstr(&D, buf, sizeof(buf)));
+    TCHECK(buf[0] == 0x0A && buf[1] == 0xFF && buf[2] == 0x9A);
+    // Characters adjacent to the hex digit ranges
+    const char* hexedge = "/09:@AFG`afg\x7F\x80\xB0\xC6\xE6\xFF";
+    for( const char* hp = hexedge; *hp; hp++ ) {
+        int c = (u1_t)*hp;
+        char s[6] = { '"', '0', c, '"', 0 };
+        iniDecoder(&D, s);
+        if( uj_decode(&D) ) {
+            TCHECK(rt_hexDigit(c) < 0);
+            continue;
+        }
+        TCHECK(1 == uj_hexstr(&D, buf, sizeof(buf)));
+        TCHECK(rt_hexDigit(c) >= 0 && buf[0] == rt_hexDigit(c));
+    }
 
     // ---------- uj_msgtype
     iniDecoder(&D,"null");
@@ -676,6 +694,74 @@ static void test_comment() {
 }
 
 
+static ujcrc_t crcOf (const char* s) {
+    ujcrc_t crc = 0;
+    while( *s )
+        crc = UJ_UPDATE_CRC(crc, *s++);
+    return UJ_FINISH_CRC(crc);
+}
+
+static void test_longStrings() {
+    ujdec_t D;
+
+    // Runs of plain characters and white space spanning several vector blocks
+    iniDecoder(&D, "{\n                                   \"sx1301_conf_long_field_name\":\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t\t"
+               "\"0123456789abcdef0123456789\\\"ABCDEF\\u00e40123456789abcdef\\\\END\"\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n\r\n}");
+    if( uj_decode(&D) )
+        TFAIL("long strings");            // LCOV_EXCL_LINE
+    uj_enterObject(&D);
+    TCHECK(uj_nextField(&D));
+    TCHECK(strcmp(D.field.name,"sx1301_conf_long_field_name")==0);
+    TCHECK(D.field.crc == crcOf("sx1301_conf_long_field_name"));
+    TCHECK(strcmp(uj_str(&D), "0123456789abcdef0123456789\"ABCDEF\xC3\xA4" "0123456789abcdef\\END")==0);
+    TCHECK(D.str.len == 55);
+    TCHECK(!uj_nextField(&D));
+    uj_exitObject(&D);
+    uj_assertEOF(&D);
+
+    memcpy(jsonbuf, "\"0123456789abcdef0123456789abcdef\0\"", 36);
+    uj_iniDecoder(&D, jsonbuf, 36);
+    if( !uj_decode(&D) ) {
+        uj_str(&D);
+        TFAIL("long strings NUL");        // LCOV_EXCL_LINE
+    }
+}
+
+
+static void test_kwIndex() {
+    ujdec_t D;
+
+    // Every keyword maps to a distinct dense index
+    u1_t seen[UJ_NKW] = {0};
+    for( int k=0; k<UJ_NKW; k++ ) {
+        str_t s = uj_kwName(k);
+        TCHECK(s != NULL);
+        int i = uj_kwIndex(crcOf(s), s);
+        TCHECK(i == k && seen[i] == 0);
+        seen[i] = 1;
+    }
+    TCHECK(uj_kwName(-1) == NULL && uj_kwName(UJ_NKW) == NULL);
+    TCHECK(uj_kwIndex(J_dnmsg, NULL) == K_dnmsg);
+    TCHECK(uj_kwIndex(J_dnmsg, "dnmsg") == K_dnmsg);
+    TCHECK(uj_kwIndex(J_dnmsg, "dnmsG") == -1);
+    TCHECK(uj_kwIndex(crcOf("no_such_keyword"), "no_such_keyword") == -1);
+
+    iniDecoder(&D, "{\"DevEui\":\"dnmsg\",\"xyz\":1}");
+    if( uj_decode(&D) )
+        TFAIL("kwIndex");            // LCOV_EXCL_LINE
+    uj_enterObject(&D);
+    TCHECK(uj_nextField(&D) == J_DevEui);
+    TCHECK(uj_fieldKw(&D) == K_DevEui);
+    uj_str(&D);
+    TCHECK(uj_strKw(&D) == K_dnmsg);
+    TCHECK(uj_nextField(&D));
+    TCHECK(uj_fieldKw(&D) == -1);
+    uj_skipValue(&D);
+    TCHECK(!uj_nextField(&D));
+    uj_exitObject(&D);
+}
+
+
 static void test_indexedField_intRange() {
     ujdec_t D;
 
@@ -718,6 +804,8 @@ void selftest_ujdec () {
 
     test_simple_errors();
     test_simple_values();
+    test_longStrings();
+    test_kwIndex();
     test_S2();
     test_S3();
     test_F11();
@@ -174,6 +174,32 @@ static void test_simple_values() {
 }
 
 
+static void test_hex() {
+    char jsonbuf[600];
+    u1_t d[256];
+    for( int i=0; i<256; i++ )
+        d[i] = i;
+
+    ujbuf_t B = { .buf = jsonbuf, .bufsize = sizeof(jsonbuf), .pos = 0 };
+    uj_encHex(&B, d, 256);
+    TCHECK(xeos(&B) == 1);
+    TCHECK(B.pos == 2+512);
+    for( int i=0; i<256; i++ )
+        TCHECK(rt_hexDigit(jsonbuf[1+2*i])*16 + rt_hexDigit(jsonbuf[2+2*i]) == i);
+    TCHECK(strncmp(jsonbuf, "\"0001", 5) == 0 && strncmp(jsonbuf+509, "FEFF\"", 5) == 0);
+
+    // Truncated output stops mid byte if necessary
+    for( int sz=1; sz<8; sz++ ) {
+        B.pos = 0;
+        B.bufsize = sz;
+        uj_encHex(&B, (const u1_t*)"\x12\x34\x56", 3);
+        TCHECK(B.pos == sz);
+        TCHECK(strncmp(jsonbuf, "\"123456\"", sz) == 0);
+    }
+}
+
+
 void selftest_ujenc () {
     test_simple_values();
+    test_hex();
 }
@@ -0,0 +1,195 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#include "selftests.h"
+#include "ws.h"
+
+#if defined(CFG_wsdeflate)
+#include <zlib.h>
+
+static const char MSG[] =
+    "{\"msgtype\":\"updf\",\"MHdr\":64,\"DevAddr\":-1234567,\"FCtrl\":0,\"FCnt\":17,\"FOpts\":\"\","
+    "\"FPort\":1,\"FRMPayload\":\"00112233445566778899\",\"MIC\":-123456,\"DR\":5,\"Freq\":868100000,"
+    "\"upinfo\":{\"rctx\":0,\"xtime\":12345678901,\"gpstime\":0,\"fts\":-1,\"rssi\":-42,\"snr\":9.5}}";
+
+// Connection in WS_CONNECTED state with the server's handshake response in rbuf
+static ws_t* mkconn (int zbits, const char* ext) {
+    ws_t* conn = rt_malloc(ws_t);
+    conn->rbufsize = 256;
+    conn->rbufmax = 4096;
+    conn->rbuf = rt_mallocN(u1_t, 512);
+    snprintf((char*)conn->rbuf, 512, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n%s%s%s\r\n",
+             ext ? "Sec-WebSocket-Extensions: " : "", ext ? ext : "", ext ? "\r\n" : "");
+    conn->zbits = zbits;
+    conn->state = WS_CONNECTED;
+    conn->netctx.fd = -1;
+    return conn;
+}
+
+static void freeconn (ws_t* conn) {
+    wsz_free(conn);
+    rt_free(conn->rbuf);
+    rt_free(conn);
+}
+
+static int accepts (int zbits, const char* ext) {
+    ws_t* conn = mkconn(zbits, ext);
+    int ok = wsz_accept(conn);
+    TCHECK(ok == (conn->wsz != NULL) || ext == NULL);
+    freeconn(conn);
+    return ok;
+}
+
+// Compress a copy of MSG on tx - returns compressed length (0 if sent as is)
+static int deflateMsg (ws_t* tx, u1_t* buf) {
+    int n = sizeof(MSG)-1;
+    memcpy(buf, MSG, n);
+    return wsz_deflate(tx, buf, &n) ? n : 0;
+}
+
+// Inflate on rx and compare against expected message
+static int inflateEq (ws_t* rx, u1_t* data, int n, const void* exp, int explen) {
+    if( !wsz_inflate(rx, data, n) )
+        return 0;
+    rx->rbeg = 0;
+    rx->rend = n;
+    dbuf_t b = ws_getRecvbuf(rx);
+    return b.bufsize == explen && memcmp(b.buf, exp, explen) == 0;
+}
+
+// Peer side raw deflate stream - each chunk ends with a sync flush, tail 00 00 FF FF stripped
+static int peerDeflate (z_stream* z, const u1_t* data, int n, int chunks, u1_t* out, int outsize, int finish) {
+    int pos = 0;
+    for( int i=0; i<chunks; i++ ) {
+        int beg = n*i/chunks, end = n*(i+1)/chunks;
+        z->next_in = (u1_t*)data + beg;
+        z->avail_in = end - beg;
+        z->next_out = out + pos;
+        z->avail_out = outsize - pos;
+        TCHECK(deflate(z, finish && i == chunks-1 ? Z_FINISH : Z_SYNC_FLUSH) >= Z_OK);
+        pos = outsize - z->avail_out;
+    }
+    if( !finish ) {
+        TCHECK(pos > 4 && memcmp(out+pos-4, "\x00\x00\xFF\xFF", 4) == 0);
+        pos -= 4;
+    }
+    return pos;
+}
+
+static void test_params () {
+    TCHECK(accepts(10, NULL) == 1);
+    TCHECK(accepts(0,  NULL) == 1);
+    TCHECK(accepts(0,  "permessage-deflate") == 0);           // never offered
+    TCHECK(accepts(10, "permessage-deflate") == 1);
+    TCHECK(accepts(10, "permessage-deflate; client_max_window_bits=10; server_max_window_bits=10") == 1);
+    TCHECK(accepts(10, "permessage-deflate; client_max_window_bits=10; server_max_window_bits=12") == 0);  // larger than offered
+    TCHECK(accepts(10, "Permessage-Deflate ; Client_No_Context_Takeover ;server_no_context_takeover") == 1);
+    TCHECK(accepts(10, "permessage-deflate; server_max_window_bits=8") == 1);
+    TCHECK(accepts(10, "permessage-deflate; client_max_window_bits=9") == 1);
+    TCHECK(accepts(10, "permessage-deflate; client_max_window_bits=11") == 0);  // larger than offered
+    TCHECK(accepts(10, "permessage-deflate; client_max_window_bits=8") == 0);   // zlib cannot do 8 bits
+    TCHECK(accepts(10, "permessage-deflate; server_max_window_bits=16") == 0);
+    TCHECK(accepts(10, "permessage-deflate; server_max_window_bits=7") == 0);
+    TCHECK(accepts(10, "permessage-deflate; foo=1") == 0);                     // unknown parameter
+    TCHECK(accepts(10, "permessage-deflate; client_max_window_bitsx=10") == 0);
+    TCHECK(accepts(10, "permessage-deflate x") == 0);
+    TCHECK(accepts(10, "x-webkit-deflate-frame") == 0);
+}
+
+static void test_roundtrip (const char* ext, int takeover) {
+    ws_t* tx = mkconn(10, ext);
+    ws_t* rx = mkconn(10, ext);
+    TCHECK(wsz_accept(tx) && wsz_accept(rx));
+    u1_t buf[sizeof(MSG)];
+    int n1 = deflateMsg(tx, buf);
+    TCHECK(n1 > 0 && n1 < sizeof(MSG)-1);
+    TCHECK(inflateEq(rx, buf, n1, MSG, sizeof(MSG)-1));
+    // Same message again - with context takeover it is mostly a back reference
+    int n2 = deflateMsg(tx, buf);
+    TCHECK(takeover ? n2 < n1/2 : n2 == n1);
+    TCHECK(inflateEq(rx, buf, n2, MSG, sizeof(MSG)-1));
+    // Short messages are not worth compressing
+    int n = 10;
+    memcpy(buf, MSG, n);
+    TCHECK(!wsz_deflate(tx, buf, &n) && n == 10);
+    freeconn(tx);
+    freeconn(rx);
+}
+
+static void test_peer () {
+    ws_t* rx = mkconn(10, "permessage-deflate");
+    TCHECK(wsz_accept(rx));
+    z_stream z = {0};
+    // Server keeps to the offered window - server_max_window_bits=10
+    TCHECK(deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -10, 3, Z_DEFAULT_STRATEGY) == Z_OK);
+    // Message flushed in several deflate blocks - inflated into one message
+    u1_t out[8192];
+    int n = peerDeflate(&z, (const u1_t*)MSG, sizeof(MSG)-1, 5, out, sizeof(out), 0);
+    TCHECK(inflateEq(rx, out, n, MSG, sizeof(MSG)-1));
+    // Server context takeover - next message refers back to the previous one
+    int n2 = peerDeflate(&z, (const u1_t*)MSG, sizeof(MSG)-1, 1, out, sizeof(out), 0);
+    TCHECK(n2 < n/2);
+    TCHECK(inflateEq(rx, out, n2, MSG, sizeof(MSG)-1));
+    // Inflated message larger than rbuf - output buffer grows up to rbufmax
+    u1_t big[3000];
+    for( int i=0; i<sizeof(big); i++ )
+        big[i] = MSG[i % (sizeof(MSG)-1)] ^ (i/97);
+    n = peerDeflate(&z, big, sizeof(big), 3, out, sizeof(out), 0);
+    TCHECK(inflateEq(rx, out, n, big, sizeof(big)));
+    // Peer ends the stream with a final block - both sides start over
+    n = peerDeflate(&z, (const u1_t*)MSG, sizeof(MSG)-1, 2, out, sizeof(out), 1);
+    TCHECK(inflateEq(rx, out, n, MSG, sizeof(MSG)-1));
+    deflateReset(&z);
+    n = peerDeflate(&z, (const u1_t*)MSG, sizeof(MSG)-1, 1, out, sizeof(out), 0);
+    TCHECK(inflateEq(rx, out, n, MSG, sizeof(MSG)-1));
+    // Garbage
+    TCHECK(!wsz_inflate(rx, (u1_t*)"\xFF\xFF\xFF\xFF\xFF", 5));
+    freeconn(rx);
+    // Inflated message beyond rbufmax - rejected
+    rx = mkconn(10, "permessage-deflate; server_no_context_takeover");
+    rx->rbufmax = 1024;
+    TCHECK(wsz_accept(rx));
+    deflateReset(&z);
+    n = peerDeflate(&z, big, sizeof(big), 1, out, sizeof(out), 0);
+    TCHECK(!wsz_inflate(rx, out, n));
+    deflateEnd(&z);
+    freeconn(rx);
+}
+
+#endif // defined(CFG_wsdeflate)
+
+
+void selftest_ws () {
+#if defined(CFG_wsdeflate)
+    test_params();
+    test_roundtrip("permessage-deflate; client_max_window_bits=10", 1);
+    test_roundtrip("permessage-deflate; client_no_context_takeover; server_no_context_takeover", 0);
+    test_peer();
+#endif // defined(CFG_wsdeflate)
+}
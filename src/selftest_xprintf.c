@@ -26,13 +26,32 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#include <stdio.h>
 #include "selftests.h"
 #include "uj.h"
+#include "xq.h"
 
 #define BUFSZ (2*1024)
 
 #define TSTR(s) TCHECK(strcmp(s, B.buf) == 0); B.pos=0
 
+// Pack a deferred log record and format it - returns text after the log header
+static const char* deferred (char* line, const char* fmt, ...) {
+    u1_t rec[LOGLINE_LEN];
+    va_list ap;
+    va_start(ap, fmt);
+    int reclen = log_packRecord(rec, sizeof(rec), MOD_TST|INFO, (ustime_t)1522068206421865L, fmt, ap);
+    va_end(ap);
+    TCHECK(reclen > 0);
+    int n = log_fmtRecord(line, LOGLINE_LEN, rec, reclen);
+    TCHECK(n > 0 && line[n-1] == '\n');
+    line[n-1] = 0;
+    TCHECK(strncmp(line, "2018-03-26 12:43:26.421 [TST:INFO] ", 35) == 0);
+    return line+35;
+}
+
+#define TDEF(s, ...) TCHECK(strcmp(s, deferred(line, __VA_ARGS__)) == 0)
+
 void selftest_xprintf () {
     char* outbuf = rt_mallocN(char, BUFSZ);
     ujbuf_t B = {.buf=outbuf, .bufsize=BUFSZ, .pos=0 };
@@ -100,6 +119,60 @@ void selftest_xprintf () {
     xprintf(&B, "%.*s"   , 5,"0123456789");      TSTR("01234");
     xprintf(&B, "%-*.*s" ,10,5,"0123456789");    TSTR("01234     ");
 
+    xprintf(&B, "%d|%d|%u", 0, -2147483647-1, 4294967295u);  TSTR("0|-2147483648|4294967295");
+    xprintf(&B, "%ld|%lu", (sL_t)-9223372036854775807LL-1, (uL_t)18446744073709551615ULL);
+    TSTR("-9223372036854775808|18446744073709551615");
+    xprintf(&B, "%g|%g|%g|%g", 0.0, -0.0, 1e-5, 123456789.0);  TSTR("0|-0|1e-05|1.23457e+08");
+    xprintf(&B, "%g|%g|%g", 999999.5, 0.0001, 868.1);        TSTR("1e+06|0.0001|868.1");
+    xprintf(&B, "%.1f|%.0f|%.0f|%f", -0.04, 2.5, 3.5, 1.0/3);  TSTR("-0.0|2|4|0.333333");
+    xprintf(&B, "%E|%E", 0ULL, 0xFFULL);                     TSTR("00-00-00-00-00-00-00-00|00-00-00-00-00-00-00-FF");
+    xprintf(&B, "%:E|%:E|%:E", 0ULL, 0x10000ULL, 0xABC0000000000001ULL);  TSTR("::0|::1:0|abc0::1");
+    xprintf(&B, "%:E|%:E", 0x1000200000000ULL, 0x0001000200030004ULL);  TSTR("1:2::|1:2:3:4");
+    uj_encNum(&B, 1.5); uj_encTime(&B, 1597169123.123697); xeos(&B);
+    TSTR("1.5,1597169123.123697");
+
+    // Fast number formatting must match snprintf bit by bit
+    {
+        char ref[400];
+        u4_t seed = 1;
+        int bad = 0;
+        for( int i=0; i<20000; i++ ) {
+            seed = seed*1103515245 + 12345;
+            u4_t r1 = seed;
+            seed = seed*1103515245 + 12345;
+            u4_t r2 = seed;
+            double v;
+            switch( i % 5 ) {
+            case 0:  v = (double)(s4_t)r1 / (1 + (r2 & 0xFFFF)); break;       // snr, rssi like
+            case 1:  v = 1.5e9 + r1 / 4294967296.0 * 1e6 + r2 * 1e-9; break;  // time stamps
+            case 2:  v = (r1 % 1000) / 4.0 - 100; break;                      // exact quarters
+            case 3:  v = (r1 % 20000) * 0.05; break;                          // half-way cases
+            default: { uL_t bits = ((uL_t)r1 << 32) | r2; memcpy(&v, &bits, sizeof(v)); break; }
+            }
+            if( v != v ) continue;
+            snprintf(ref, sizeof(ref), "%g", v);          xprintf(&B, "%g", v);   bad += strcmp(ref, B.buf) != 0; B.pos = 0;
+            snprintf(ref, sizeof(ref), "%.1f", v);        xprintf(&B, "%.1f", v); bad += strcmp(ref, B.buf) != 0; B.pos = 0;
+            snprintf(ref, sizeof(ref), "%.6f", v);        uj_encTime(&B, v);      xeos(&B); bad += strcmp(ref, B.buf) != 0; B.pos = 0;
+            snprintf(ref, sizeof(ref), "%d", (int)r1);    xprintf(&B, "%d", (int)r1);    bad += strcmp(ref, B.buf) != 0; B.pos = 0;
+            snprintf(ref, sizeof(ref), "%lu", (unsigned long)r1*r2); uj_encUint(&B, (uL_t)r1*r2); xeos(&B); bad += strcmp(ref, B.buf) != 0; B.pos = 0;
+        }
+        TCHECK(bad == 0);
+    }
+
+    char line[LOGLINE_LEN];
+    txjob_t txjob = { .deveui=0x0102030405060708, .diid=77, .txunit=1 };
+    char volatile_str[8] = "abc";
+    TDEF("plain text 100%",                  "plain text 100%%");
+    TDEF("RX 868.3MHz DR5 SF7/BW125 snr=-3.2", "RX %F DR%d %R snr=%.1f", 868300000, 5, 5, -3.2);
+    TDEF("[100000000] 3C:4D:A1:B2:C3:D4",     "[%lX] %M", (uL_t)1<<32, 0x1A2B3C4DA1B2C3D4);
+    TDEF("4142..4546 QUJDREVG",               "%2.2H %B", 6, "ABCDEF", 6, "ABCDEF");
+    TDEF("01234     |01234|(null)",          "%-*.*s|%.*s|%s", 10, 5, "0123456789", 5, "0123456789", NULL);
+    TDEF("12:43:26.421865 2h",                "%>.6T %~T", (ustime_t)1522068206421865L, rt_seconds(7200));
+    TDEF("102:304:506:708 diid=77 [ant#1]",  "%J", &txjob);
+    const char* s = deferred(line, "str=%s", volatile_str);
+    strcpy(volatile_str, "xyz");   // record holds a copy
+    TCHECK(strcmp(s, "str=abc") == 0);
+
     char bufsmall[10];
     ujbuf_t B2 = dbuf_ini(bufsmall);
     xputs(&B2, "123456", -1);
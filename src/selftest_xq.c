@@ -45,6 +45,8 @@ static int in_queue(txq_t* txq, txidx_t q) {
     return n;
 }
 
+enum { TEST_TXJOBS = 128, TEST_TXDATA = 16*1024 };
+
 #define txq (*_txq)
 void selftest_txq () {
     txidx_t heads[1];
@@ -52,7 +54,7 @@ void selftest_txq () {
     int n;
 
     heads[0] = TXIDX_END;
-    txq_ini(&txq);
+    txq_ini(&txq, NULL, TEST_TXJOBS, TEST_TXDATA);
 
     TCHECK(NULL           == txq_idx2job(&txq, TXIDX_NIL));
     TCHECK(NULL           == txq_idx2job(&txq, TXIDX_END));
@@ -75,7 +77,7 @@ void selftest_txq () {
     txjob_t* j;
 
     for( int k=0; k<40000; k++ ) {
-        int action, phase = k / (MAX_TXJOBS+3);
+        int action, phase = k / (TEST_TXJOBS+3);
         switch( phase % 4 ) {
         case 0: action = 0; break;
         case 2: action = 1; break;
@@ -136,13 +138,13 @@ void selftest_txq () {
             TCHECK(j->off == TXOFF_NIL && j->len == 0);
         }
         n = in_queue(&txq, txq.freeJobs) + in_queue(&txq, heads[0]);
-        TCHECK(n==MAX_TXJOBS);
+        TCHECK(n==TEST_TXJOBS);
     }
     while( heads[0] != TXIDX_END ) {
         txq_freeJob(&txq, txq_unqJob(&txq, &heads[0]));
     }
     n = in_queue(&txq, txq.freeJobs) + in_queue(&txq, heads[0]);
-    TCHECK(n==MAX_TXJOBS);
+    TCHECK(n==TEST_TXJOBS);
     TCHECK(txq.txdataInUse==0);
 
     do {
@@ -156,17 +158,123 @@ void selftest_txq () {
 
     heads[0] = TXIDX_END;
     TCHECK(NULL == txq_unqJob(&txq, &heads[0]));
+    txq_free(&txq);
+
+    // Slab allocator: space used by small blocks is reclaimed for large frames
+    txq_ini(&txq, NULL, 2*TEST_TXDATA/TXBLK_MIN, TEST_TXDATA);
+    TCHECK(txq_reserveData(&txq, MAX_TXFRAME_LEN+2) == NULL);
+    n = 0;
+    while( (j = txq_reserveJob(&txq)) != NULL && txq_reserveData(&txq, 20) != NULL ) {
+        j->len = 20;
+        txq_commitJob(&txq, j);
+        txq_insJob(&txq, &heads[0], j);
+        n++;
+    }
+    TCHECK(n == TEST_TXDATA/TXBLK_MIN && txq.txdataInUse == TEST_TXDATA);
+    TCHECK(txq_reserveData(&txq, MAX_TXFRAME_LEN) == NULL);
+    // Free every other block - fragmented slabs cannot be reclaimed
+    for( txidx_t* p = &heads[0]; *p != TXIDX_END; ) {
+        txq_freeJob(&txq, txq_unqJob(&txq, p));
+        if( *p != TXIDX_END )
+            p = txq_nextIdx(&txq, p);
+    }
+    TCHECK(txq_reserveData(&txq, MAX_TXFRAME_LEN) == NULL);
+    TCHECK(txq_reserveData(&txq, 20) != NULL);
+    while( heads[0] != TXIDX_END )
+        txq_freeJob(&txq, txq_unqJob(&txq, &heads[0]));
+    TCHECK(txq.txdataInUse == 0);
+    j = txq_reserveJob(&txq);
+    u1_t* p = txq_reserveData(&txq, MAX_TXFRAME_LEN);
+    TCHECK(p != NULL);
+    j->len = MAX_TXFRAME_LEN;
+    txq_commitJob(&txq, j);
+    TCHECK(&txq.txdata[j->off] == p && txq.txdataInUse == 256);
+    txq_freeJob(&txq, j);
+    // Job without data
+    j = txq_reserveJob(&txq);
+    txq_commitJob(&txq, j);
+    TCHECK(j->off == TXOFF_NIL);
+    txq_freeJob(&txq, j);
+    txq_free(&txq);
+    rt_free(_txq);
+}
+
+void selftest_txord () {
+    txq_t * _txq = rt_malloc(txq_t);
+    txord_t q;
+    txjob_t* j;
+
+    txq_ini(&txq, NULL, TEST_TXJOBS, TEST_TXDATA);
+    txord_ini(&q, NULL, TEST_TXJOBS);
+    TCHECK(txord_job(&txq, &q, 0) == NULL);
+    TCHECK(txord_unqJob(&txq, &q, 0) == NULL);
+    TCHECK(txord_freeSlot(&txq, &q, 1000, 100, 10) == 1000);
+
+    // Random inserts/removals - queue must stay sorted
+    int n = 0;
+    for( int k=0; k<4000; k++ ) {
+        if( n < TEST_TXJOBS && rand() % 3 ) {
+            j = txq_reserveJob(&txq);
+            TCHECK(j != NULL);
+            j->txtime = rand() % 100000;
+            j->airtime = 1 + rand() % 500;
+            txq_commitJob(&txq, j);
+            int pos = txord_insJob(&txq, &q, j);
+            TCHECK(txord_job(&txq, &q, pos) == j);
+            n++;
+        } else if( n > 0 ) {
+            j = txord_unqJob(&txq, &q, rand() % n);
+            TCHECK(j != NULL);
+            txq_freeJob(&txq, j);
+            n--;
+        }
+        TCHECK(q.n == n);
+        for( int i=1; i<n; i++ )
+            TCHECK(txord_job(&txq, &q, i-1)->txtime <= txord_job(&txq, &q, i)->txtime);
+        // A free slot must not overlap any queued job
+        ustime_t t0 = rand() % 100000;
+        u4_t air = 1 + rand() % 300;
+        ustime_t t = txord_freeSlot(&txq, &q, t0, air, 10);
+        TCHECK(t >= t0);
+        for( int i=0; i<n; i++ ) {
+            j = txord_job(&txq, &q, i);
+            TCHECK(t + air + 10 <= j->txtime || j->txtime + j->airtime + 10 <= t);
+        }
+    }
+    // Equal txtimes keep arrival order
+    while( q.n > 0 )
+        txq_freeJob(&txq, txord_unqJob(&txq, &q, 0));
+    txjob_t* jobs[3];
+    for( int i=0; i<3; i++ ) {
+        jobs[i] = j = txq_reserveJob(&txq);
+        j->txtime = 5000;
+        j->airtime = 100;
+        txq_commitJob(&txq, j);
+        TCHECK(txord_insJob(&txq, &q, j) == i);
+    }
+    TCHECK(txord_find(&txq, &q, 4999) == 0);
+    TCHECK(txord_find(&txq, &q, 5000) == 3);
+    TCHECK(txord_freeSlot(&txq, &q, 4000, 100, 10) == 4000);
+    TCHECK(txord_freeSlot(&txq, &q, 4900, 100, 10) == 5110);
+    TCHECK(txord_unqJob(&txq, &q, 1) == jobs[1]);
+    TCHECK(txord_job(&txq, &q, 1) == jobs[2]);
+    txord_free(&q);
+    txq_free(&txq);
     rt_free(_txq);
 }
+#undef txq
 
 #define rxq (*_rxq)
 void selftest_rxq () {
     int r;
     rxq_t * _rxq = rt_malloc(rxq_t);
     rxjob_t *j;
+    int wraps = 0;
 
     rxq_ini(&rxq);
-    for( int k=0; k<400; k++ ) {
+    TCHECK(rxq_firstJob(&rxq) == NULL);
+    TCHECK(rxq_popJob(&rxq) == NULL);
+    for( int k=0; k<4000; k++ ) {
         r = rand() % 5;
         switch( r ) {
         case 0:
@@ -174,31 +282,94 @@ void selftest_rxq () {
         case 2: {
             j = rxq_nextJob(&rxq);
             if( j != NULL ) {
-                j->len = k < 300 ? 196 : 16;
+                j->len = k < 3000 ? 196 : 16;
+                j->rctx = k;
+                memset(&rxq.rxdata[j->off], k, j->len);
+                if( j->off == 0 && rxq.njobs > 0 )
+                    wraps += 1;
                 rxq_commitJob(&rxq, j);
             }
             break;
         }
         case 3: {
-            if( rxq.first < rxq.next )
-                rxq.first += 1;
+            if( (j = rxq_popJob(&rxq)) != NULL ) {
+                for( int i=0; i < j->len; i++ )
+                    TCHECK(rxq.rxdata[j->off+i] == (u1_t)j->rctx);
+            }
             break;
         }
         case 4: {
-            if( rxq.first+2 < rxq.next )
-                rxq_dropJob(&rxq, &rxq.rxjobs[rxq.first+1]);
+            if( (j = rxq_firstJob(&rxq)) != NULL && (j = rxq_succJob(&rxq, j)) != NULL )
+                rxq_dropJob(&rxq, j);
             break;
         }
         }
-        TCHECK(rxq.first <= MAX_RXJOBS);
-        TCHECK(rxq.next <= MAX_RXJOBS);
-        TCHECK(rxq.first <= rxq.next);
-        TCHECK(rxq.first == rxq.next || rxq.rxjobs[rxq.first].len > 0);
-        for( int i=rxq.first+1; i < rxq.next; i++ ) {
-            TCHECK(rxq.rxjobs[i-1].len > 0);
-            TCHECK(rxq.rxjobs[i-1].off + rxq.rxjobs[i-1].len == rxq.rxjobs[i].off);
+        TCHECK(rxq.first < MAX_RXJOBS);
+        TCHECK(rxq.next < MAX_RXJOBS);
+        TCHECK(rxq.njobs <= MAX_RXJOBS);
+        TCHECK((rxq.first + rxq.njobs) % MAX_RXJOBS == rxq.next);
+        TCHECK(rxq.njobs == 0 || (rxq.rxjobs[rxq.first].flags & RXJOB_DROPPED) == 0);
+        int n = 0;
+        sL_t lastk = -1;
+        for( j = rxq_firstJob(&rxq); j != NULL; j = rxq_succJob(&rxq, j) ) {
+            TCHECK((j->flags & RXJOB_DROPPED) == 0 && j->len > 0);
+            TCHECK(rxq_findMirror(&rxq, j, 0) != NULL);
+            TCHECK(j->off + j->len <= MAX_RXDATA);
+            TCHECK(j->rctx > lastk);
+            lastk = j->rctx;
+            n += 1;
+        }
+        TCHECK(n <= rxq.njobs);
+        for( int i=1; i < rxq.njobs; i++ ) {
+            rxjob_t* p = &rxq.rxjobs[(rxq.first+i-1) % MAX_RXJOBS];
+            rxjob_t* q = &rxq.rxjobs[(rxq.first+i) % MAX_RXJOBS];
+            TCHECK(p->off + p->len == q->off || q->off == 0);
         }
     }
+    TCHECK(wraps > 0);
+    while( rxq_popJob(&rxq) != NULL );
+    TCHECK(rxq.njobs == 0 && rxq.first == rxq.next);
+    for( int i=0; i < RXQ_NHASH; i++ )
+        TCHECK(rxq.hashtbl[i] == RXIDX_NIL);
+
+    // Mirror detection
+    rxjob_t* a = rxq_nextJob(&rxq);
+    a->len = 20; a->dr = 5;
+    memset(&rxq.rxdata[a->off], 0xA5, a->len);
+    TCHECK(rxq_findMirror(&rxq, a, 0) == NULL);
+    rxq_commitJob(&rxq, a);
+    rxjob_t* b = rxq_nextJob(&rxq);
+    b->len = 20; b->dr = 5;
+    memset(&rxq.rxdata[b->off], 0xA5, b->len);
+    TCHECK(rxq_findMirror(&rxq, b, 0) == a);
+    b->rxtime = a->rxtime + rt_millis(100);
+    TCHECK(rxq_findMirror(&rxq, b, rt_millis(50)) == NULL);
+    TCHECK(rxq_findMirror(&rxq, b, rt_millis(200)) == a);
+    b->flags = 0; b->dr = 4;
+    TCHECK(rxq_findMirror(&rxq, b, 0) == NULL);
+    b->flags = 0; b->dr = 5; rxq.rxdata[b->off+19] = 0x5A;
+    TCHECK(rxq_findMirror(&rxq, b, 0) == NULL);
+    b->flags = 0; rxq.rxdata[b->off+19] = 0xA5;
+    rxq_commitJob(&rxq, b);
+    rxq_dropJob(&rxq, a);
+    TCHECK(rxq_firstJob(&rxq) == b);
+    rxjob_t* c = rxq_nextJob(&rxq);
+    c->len = 20; c->dr = 5;
+    memset(&rxq.rxdata[c->off], 0xA5, c->len);
+    TCHECK(rxq_findMirror(&rxq, c, 0) == b);
+    TCHECK(rxq_popJob(&rxq) == b);
+    TCHECK(rxq_findMirror(&rxq, c, 0) == NULL);
+
+    // Occupancy - larger of jobs and data in use
+    TCHECK(rxq_occupancy(&rxq) == 0);
+    rxq_commitJob(&rxq, c);
+    TCHECK(rxq_occupancy(&rxq) == 100/MAX_RXJOBS);
+    rxjob_t* d;
+    while( (d = rxq_nextJob(&rxq)) != NULL ) {
+        d->len = MAX_RXFRAME_LEN;
+        rxq_commitJob(&rxq, d);
+    }
+    TCHECK(rxq_occupancy(&rxq) >= 90 && rxq_occupancy(&rxq) <= 100);
     rt_free(_rxq);
 }
 
@@ -39,12 +39,16 @@ static jmp_buf onfail;
 static void (*const selftest_fns[])() = {
     selftest_txq,
     selftest_rxq,
+    selftest_txord,
     selftest_lora,
+    selftest_airtime,
     selftest_rt,
     selftest_ujdec,
     selftest_ujenc,
     selftest_xprintf,
     selftest_fs,
+    selftest_metrics,
+    selftest_ws,
     NULL
 };
 
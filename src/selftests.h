@@ -43,12 +43,16 @@
 
 extern void selftest_txq ();
 extern void selftest_rxq ();
+extern void selftest_txord ();
 extern void selftest_lora ();
+extern void selftest_airtime ();
 extern void selftest_rt ();
 extern void selftest_ujdec ();
 extern void selftest_ujenc ();
 extern void selftest_xprintf ();
 extern void selftest_fs ();
+extern void selftest_metrics ();
+extern void selftest_ws ();
 
 void selftest_fail (const char* expr, const char* file, int line);
 void selftests ();
@@ -527,38 +527,67 @@ int sx130xconf_parse_tcomp (struct sx130xconf* sx130xconf, int slaveIdx,
     }
 
     sx130xconf->tx_temp_lut.temp_comp_enabled = true;
+    sx130xconf->tx_temp_lut.pwr_valid = false;
     return 1;
 }
 
 
-void lookup_power_settings(void* ctx, float tx_pwr, int8_t* rf_power, int8_t* dig_gain) {
-    float min_diff = 99;
-
-    if( ctx == NULL ) return;
-    struct lgw_tx_temp_lut_s* tx_temp_lut = (struct lgw_tx_temp_lut_s*)ctx;
-
+// Row of the temperature LUT applying to the current temperature
+static int temp_comp_row (const struct lgw_tx_temp_lut_s* tx_temp_lut) {
     for (int i = 0; i < tx_temp_lut->size; i++) {
         // If the current temp is lower than the first temp or we reach the end of the table
         if ((tx_temp_lut->dig[0].temp > tx_temp_lut->temp_comp_value || i == tx_temp_lut->size-1) ||
             (tx_temp_lut->dig[i].temp <= tx_temp_lut->temp_comp_value && tx_temp_lut->dig[i+1].temp > tx_temp_lut->temp_comp_value)) {
-            for (int j = 0; j < TX_GAIN_LUT_SIZE_MAX; j++) {
-                for (int h = 0; h < 4; h++) {
-                    if (tx_pwr >= tx_temp_lut->dig[i].dig_gain[j*4+h] && (tx_pwr - tx_temp_lut->dig[i].dig_gain[j*4+h]) < min_diff) {
-                        min_diff = (tx_pwr - tx_temp_lut->dig[i].dig_gain[j*4+h]);
-                        *rf_power = j;
-                        *dig_gain = h;
-                    }
-                }
+            return i;
+        }
+    }
+    return -1;
+}
+
+// Closest gain setting not exceeding tx_pwr - encoded as rf_power index <<2 | dig_gain
+static u1_t search_power_settings (const struct lgw_tx_temp_lut_s* tx_temp_lut, int row, float tx_pwr) {
+    float min_diff = 99;
+    u1_t  setting = (0<<2) | 3;  // minimum output if no match was found
+
+    if( row < 0 )
+        return setting;
+    const float* gains = tx_temp_lut->dig[row].dig_gain;
+    for (int j = 0; j < TX_GAIN_LUT_SIZE_MAX; j++) {
+        for (int h = 0; h < 4; h++) {
+            if (tx_pwr >= gains[j*4+h] && (tx_pwr - gains[j*4+h]) < min_diff) {
+                min_diff = (tx_pwr - gains[j*4+h]);
+                setting = (j<<2) | h;
             }
-            break;
         }
     }
+    return setting;
+}
+
+static void build_power_cache (struct lgw_tx_temp_lut_s* tx_temp_lut) {
+    int row = temp_comp_row(tx_temp_lut);
+    for( int k=0; k < TEMP_COMP_PWR_CNT; k++ ) {
+        // Same expression as ral_tx uses to derive the requested power
+        float tx_pwr = (float)(k + TEMP_COMP_PWR_MIN*TXPOW_SCALE) / TXPOW_SCALE;
+        tx_temp_lut->pwr_cache[k] = search_power_settings(tx_temp_lut, row, tx_pwr);
+    }
+    tx_temp_lut->pwr_temp = tx_temp_lut->temp_comp_value;
+    tx_temp_lut->pwr_valid = true;
+}
+
+void lookup_power_settings(void* ctx, float tx_pwr, int8_t* rf_power, int8_t* dig_gain) {
+    if( ctx == NULL ) return;
+    struct lgw_tx_temp_lut_s* tx_temp_lut = (struct lgw_tx_temp_lut_s*)ctx;
 
-    if (min_diff == 99) {
-        // minimum output if no match was found
-        *rf_power = 0;
-        *dig_gain = 3;
+    u1_t setting;
+    int k = (int)(tx_pwr * TXPOW_SCALE + (tx_pwr < 0 ? -0.5f : 0.5f)) - TEMP_COMP_PWR_MIN*TXPOW_SCALE;
+    if( tx_temp_lut->pwr_valid && tx_temp_lut->pwr_temp == tx_temp_lut->temp_comp_value &&
+        k >= 0 && k < TEMP_COMP_PWR_CNT && (float)(k + TEMP_COMP_PWR_MIN*TXPOW_SCALE) / TXPOW_SCALE == tx_pwr ) {
+        setting = tx_temp_lut->pwr_cache[k];
+    } else {
+        setting = search_power_settings(tx_temp_lut, temp_comp_row(tx_temp_lut), tx_pwr);
     }
+    *rf_power = setting >> 2;
+    *dig_gain = setting & 3;
 }
 
 void update_temp_comp_value(void* ctx) {
@@ -587,7 +616,39 @@ void update_temp_comp_value(void* ctx) {
 
         fclose(filePointer);
     }
+    if( !tx_temp_lut->pwr_valid || tx_temp_lut->pwr_temp != tx_temp_lut->temp_comp_value )
+        build_power_cache(tx_temp_lut);
+}
+
+// Setups of slaves as found in station.conf/slave-N.conf - parsed once by the master (see sx130xconf_parse_files)
+static const struct sx130xconf* confCache;
+static int confCacheN;
+
+static int find_slave_conf (struct sx130xconf* sx130xconf, int slaveIdx) {
+    char cfname[64];
+    snprintf(cfname, sizeof(cfname), "slave-%d.conf", slaveIdx);
+    return find_sx130x_conf(cfname, sx130xconf);
+}
+
+int sx130xconf_parse_files (struct sx130xconf* confs, int n) {
+    memset(&confs[0], 0, sizeof(confs[0]));
+    confs[0].boardconf.lorawan_public = 1;
+    setDevice(&confs[0], NULL);
+    if( !find_sx130x_conf("station.conf", &confs[0]) )
+        return 0;
+    int allok = 1;
+    for( int i=n-1; i >= 0; i-- ) {
+        if( i > 0 )
+            confs[i] = confs[0];
+        if( !find_slave_conf(&confs[i], i) )
+            allok = 0;
+    }
+    return allok;
+}
 
+void sx130xconf_setCache (const struct sx130xconf* confs, int n) {
+    confCache = confs;
+    confCacheN = n;
 }
 
 int sx130xconf_parse_setup (struct sx130xconf* sx130xconf, int slaveIdx,
@@ -597,15 +658,18 @@ int sx130xconf_parse_setup (struct sx130xconf* sx130xconf, int slaveIdx,
         return 0;
     }
 
-    sx130xconf->boardconf.lorawan_public = 1;
-    setDevice(sx130xconf, NULL);
+    if( slaveIdx >= 0 && slaveIdx < confCacheN ) {
+        *sx130xconf = confCache[slaveIdx];
+#if !defined(CFG_sx1302)
+        lgw_spi_set_path(sx130xconf->device);  // normally a side effect of setDevice
+#endif
+    } else {
+        sx130xconf->boardconf.lorawan_public = 1;
+        setDevice(sx130xconf, NULL);
 
-    if( !find_sx130x_conf("station.conf", sx130xconf) )
-        return 0;
-    if( slaveIdx >= 0 ) {
-        char cfname[64];
-        snprintf(cfname, sizeof(cfname), "slave-%d.conf", slaveIdx);
-        if( !find_sx130x_conf(cfname, sx130xconf) )
+        if( !find_sx130x_conf("station.conf", sx130xconf) )
+            return 0;
+        if( slaveIdx >= 0 && !find_slave_conf(sx130xconf, slaveIdx) )
             return 0;
     }
 
@@ -690,6 +754,84 @@ int sx130xconf_challoc (struct sx130xconf* sx130xconf, chdefl_t* upchs) {
 }
 
 
+// Hand TX gain LUT to the HAL - it is consulted per lgw_send and can be replaced while running
+static int setTxlut (struct sx130xconf* sx130xconf) {
+#if defined(CFG_sx1302)
+    return lgw_txgain_setconf(0, &sx130xconf->txlut) == LGW_HAL_SUCCESS;
+#else
+    if (sx130xconf->tx_temp_lut.temp_comp_enabled) {
+        for (int i = 0; i < 16; i++) {
+            sx130xconf->txlut.lut[i].rf_power = sx130xconf->tx_temp_lut.lut[i].rf_power;
+            sx130xconf->txlut.lut[i].pa_gain = sx130xconf->tx_temp_lut.lut[i].pa_gain;
+            sx130xconf->txlut.lut[i].mix_gain = sx130xconf->tx_temp_lut.lut[i].mix_gain;
+            sx130xconf->txlut.lut[i].dig_gain = sx130xconf->tx_temp_lut.lut[i].dig_gain;
+            sx130xconf->txlut.lut[i].dac_gain = sx130xconf->tx_temp_lut.lut[i].dac_gain;
+        }
+        sx130xconf->txlut.size = 16;
+    }
+    return lgw_txgain_setconf(&sx130xconf->txlut) == LGW_HAL_SUCCESS;
+#endif
+}
+
+
+// Blank parameters which sx130xconf_updateLive can change on a running concentrator
+static void clearLiveParams (struct sx130xconf* c) {
+    memset(&c->txlut, 0, sizeof(c->txlut));
+    memset(&c->tx_temp_lut, 0, sizeof(c->tx_temp_lut));
+    for( int i=0; i<LGW_RF_CHAIN_NB; i++ )
+        c->rfconf[i].rssi_offset = 0;
+    c->txpowAdjust = 0;
+    c->pps = 0;
+}
+
+
+int sx130xconf_isLiveUpdate (const struct sx130xconf* started, const struct sx130xconf* next) {
+    // HAL default TX gains cannot be restored once a LUT was set - and vice versa
+    if( (started->txlut.size == 0) != (next->txlut.size == 0) )
+        return 0;
+    // Both are big - keep them off the stack
+    static struct sx130xconf a, b;
+    memcpy(&a, started, sizeof(a));
+    memcpy(&b, next, sizeof(b));
+    clearLiveParams(&a);
+    clearLiveParams(&b);
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+
+int sx130xconf_updateLive (struct sx130xconf* running, const struct sx130xconf* next, float rssiAdj[LGW_RF_CHAIN_NB]) {
+    int tempValue = running->tx_temp_lut.temp_comp_value;  // latest sensor reading
+    running->txlut = next->txlut;
+    running->tx_temp_lut = next->tx_temp_lut;
+    running->tx_temp_lut.temp_comp_value = tempValue;
+    running->tx_temp_lut.pwr_valid = false;  // LUT may have changed - rebuilt by next temperature update
+    if( running->txlut.size > 0 && !setTxlut(running) ) {
+        LOG(MOD_RAL|ERROR, "Live update of TX gain LUT failed");
+        return 0;
+    }
+    for( int i=0; i<LGW_RF_CHAIN_NB; i++ ) {
+        // HAL keeps applying the offset it was started with - caller corrects RX RSSI by the difference
+        rssiAdj[i] += next->rfconf[i].rssi_offset - running->rfconf[i].rssi_offset;
+        running->rfconf[i].rssi_offset = next->rfconf[i].rssi_offset;
+    }
+    if( running->pps != next->pps ) {
+#if defined(CFG_sx1302)
+        if( sx1302_gps_enable(next->pps ? 1 : 0) != LGW_REG_SUCCESS ) {
+#else
+        if( lgw_reg_w(LGW_GPS_EN, next->pps ? 1 : 0) != LGW_REG_SUCCESS ) {
+#endif
+            LOG(MOD_RAL|ERROR, "Live update of PPS capture failed");
+            return 0;
+        }
+        running->pps = next->pps;
+    }
+    running->txpowAdjust = next->txpowAdjust;
+    LOG(MOD_RAL|INFO, "Radio config updated live - TX gain LUT (%d entries), temp comp %sabled, PPS %sabled, RX RSSI adjust %.1f/%.1f dB",
+        running->txlut.size, running->tx_temp_lut.temp_comp_enabled ? "en":"dis", running->pps ? "en":"dis", rssiAdj[0], rssiAdj[1]);
+    return 1;
+}
+
+
 int sx130xconf_start (struct sx130xconf* sx130xconf, u4_t cca_region) {
     str_t errmsg = "";
     lgw_stop();
@@ -823,27 +965,9 @@ int sx130xconf_start (struct sx130xconf* sx130xconf, u4_t cca_region) {
         errmsg = "lgw_board_setconf";
         goto fail;
     }
-    if( sx130xconf->txlut.size > 0) {
-#if defined(CFG_sx1302)
-        if( lgw_txgain_setconf(0, &sx130xconf->txlut) != LGW_HAL_SUCCESS ) {
-#else
-
-        if (sx130xconf->tx_temp_lut.temp_comp_enabled) {
-            for (int i = 0; i < 16; i++) {
-                sx130xconf->txlut.lut[i].rf_power = sx130xconf->tx_temp_lut.lut[i].rf_power;
-                sx130xconf->txlut.lut[i].pa_gain = sx130xconf->tx_temp_lut.lut[i].pa_gain;
-                sx130xconf->txlut.lut[i].mix_gain = sx130xconf->tx_temp_lut.lut[i].mix_gain;
-                sx130xconf->txlut.lut[i].dig_gain = sx130xconf->tx_temp_lut.lut[i].dig_gain;
-                sx130xconf->txlut.lut[i].dac_gain = sx130xconf->tx_temp_lut.lut[i].dac_gain;
-            }
-            sx130xconf->txlut.size = 16;
-        }
-
-        if(lgw_txgain_setconf(&sx130xconf->txlut) != LGW_HAL_SUCCESS ) {
-#endif
-            errmsg = "lgw_txgain_setconf";
-            goto fail;
-        }
+    if( sx130xconf->txlut.size > 0 && !setTxlut(sx130xconf) ) {
+        errmsg = "lgw_txgain_setconf";
+        goto fail;
     }
     for( int i=0; i<LGW_RF_CHAIN_NB; i++ ) {
 #if defined(CFG_sx1302)
@@ -50,6 +50,11 @@
 #define DEFAULT_TEMP_COMP_TYPE "SENSOR"
 #define DEFAULT_TEMP_COMP_FILE "/sys/class/hwmon/hwmon0/temp1_input"
 
+// TX power range (dBm) for which gain settings are precomputed per temperature
+#define TEMP_COMP_PWR_MIN  (-10)
+#define TEMP_COMP_PWR_MAX    40
+#define TEMP_COMP_PWR_CNT  ((TEMP_COMP_PWR_MAX-TEMP_COMP_PWR_MIN)*TXPOW_SCALE+1)
+
 
 
 /**
@@ -87,6 +92,11 @@ struct lgw_tx_temp_lut_s {
     char temp_comp_file[128];
     int temp_comp_value;
     bool temp_comp_enabled;
+    // Gain settings for current temperature indexed by TX power (scaled by TXPOW_SCALE)
+    // Each entry: rf_power index <<2 | dig_gain - rebuilt by update_temp_comp_value
+    bool pwr_valid;
+    int  pwr_temp;      // temp_comp_value pwr_cache was built for
+    u1_t pwr_cache[TEMP_COMP_PWR_CNT];
 };
 
 struct sx130xconf {
@@ -107,8 +117,15 @@ struct sx130xconf {
 extern str_t station_conf_USAGE;
 
 int  sx130xconf_parse_setup (struct sx130xconf* sx130xconf, int slaveIdx, str_t hwspec, char* json, int jsonlen);
+// Parse station.conf once and overlay slave-N.conf for N=0..n-1 - a cache installed with sx130xconf_setCache
+// lets sx130xconf_parse_setup skip reading/parsing these files
+int  sx130xconf_parse_files (struct sx130xconf* confs, int n);
+void sx130xconf_setCache (const struct sx130xconf* confs, int n);
 int  sx130xconf_challoc (struct sx130xconf* sx130xconf, chdefl_t* upchs);
 int  sx130xconf_start (struct sx130xconf* sx130xconf, u4_t region);
+// Setups as parsed (before sx130xconf_start) differ only in parameters which can be changed without restart
+int  sx130xconf_isLiveUpdate (const struct sx130xconf* started, const struct sx130xconf* next);
+int  sx130xconf_updateLive (struct sx130xconf* running, const struct sx130xconf* next, float rssiAdj[LGW_RF_CHAIN_NB]);
 int  sx130xconf_parse_tcomp (struct sx130xconf* sx130xconf, int slaveIdx, str_t hwspec, char* json, int jsonlen);
 
 
@@ -35,6 +35,7 @@
 #include <errno.h>
 #include <netinet/ip.h>
 #include <netinet/tcp.h>
+#include <unistd.h>
 #endif
 
 #include "sys.h"
@@ -216,6 +217,31 @@ dbuf_t sys_webFile (str_t filename) {
     return readFile(b.buf, 0);
 }
 
+#if defined(CFG_linux)
+int sys_webFileFd (str_t filename, struct stat* st) {
+    if( !webDir )
+        return -1;
+    char filepath[MAX_FILEPATH_LEN];
+    dbuf_t b = dbuf_ini(filepath);
+    xputs(&b, webDir, -1);
+    xputs(&b, filename[0]=='/' ? filename+1 : filename, -1);
+    if( !xeos(&b) )
+        return -1;
+    char normpath[MAX_FILEPATH_LEN];
+    if( fs_fnNormalize(filepath, normpath, sizeof(normpath)) <= 0 ||
+        (strncmp(normpath, "/s2/", 4) == 0 || strcmp(normpath, "/s2") == 0) )
+        return -1;  // lives in flash simulation - no OS file descriptor
+    int fd = open(filepath, O_RDONLY|O_CLOEXEC);
+    if( fd == -1 )
+        return -1;
+    if( fstat(fd, st) == -1 || !S_ISREG(st->st_mode) ) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+#endif // defined(CFG_linux)
+
 dbuf_t sys_readFile (str_t filename) {
     str_t fpath = makeFilepath(filename,"",NULL,1);
     dbuf_t b = readFile(fpath, 1);
@@ -43,7 +43,9 @@ extern uL_t   prefixEUI;
 
 void  sys_ini ();
 void  sys_fatal (int code);
+int   sys_dumpTrace (int reason);  // write flight recorder (trace.h) to ~temp/station.trace - async signal safe
 void  sys_addLog (str_t line, int len);     // output/store one log line - *is* always \n treminated
+int   sys_addLogRecord (const u1_t* rec, int len); // queue record for log_fmtRecord - 0 if not possible right now
 #if defined(CFG_sysrandom)
 int  sys_random (u1_t* buf, int len);
 #else
@@ -91,6 +93,7 @@ void   sys_runUpdate ();
 void   sys_abortUpdate ();
 str_t  sys_radioDevice (str_t device);
 int    sys_runRadioInit (str_t device);
+void   sys_preRadioInit (str_t device);  // start radio init ahead of router_config - claimed by sys_runRadioInit
 int    sys_execCommand (ustime_t max_wait, str_t* argv);
 
 dbuf_t sys_sigKey (int key_id);
@@ -113,6 +116,7 @@ void   sys_iniWeb ();
 void   sys_stopWeb ();
 
 void   sys_keepAlive (int fd);
+void   sys_normalThread ();      // Linux: helper threads leave realtime scheduling/CPU pinning of the main loop (RT_*)
 
 int    sys_getLatLon (double* lat, double* lon);
 
@@ -37,9 +37,85 @@
 tc_t* TC;
 static s1_t tstateLast;
 
+// Last muxs URI which led to a working connection.
+// Outlives tc_free/tc_ini so a restarted TC engine can skip the INFOS round trip.
+static struct {
+    char     uri[MAX_URI_LEN+3];
+    ustime_t expires;
+    u4_t     tccrc;     // CRC of TC URI which produced this muxs URI
+    u1_t     credset;
+} muxsCache;
+
+// Connect latency - log2 buckets starting at TC_HISTO_BASE ms
+// Index 0: connected via INFOS, 1: connected directly via cached URI
+#define TC_HISTO_N    10
+#define TC_HISTO_BASE 50
+static u4_t connHisto[2][TC_HISTO_N];
+
+static void tc_connect_infos (tc_t* tc);
+
+
+static void cache_drop () {
+    muxsCache.expires = 0;
+}
+
+static void cache_save (tc_t* tc) {
+    str_t tcuri = sys_uri(SYS_CRED_TC, tc->credset);
+    if( TC_MUXS_TTL == 0 || tcuri == NULL )
+        return;
+    memcpy(muxsCache.uri, tc->muxsuri, sizeof(muxsCache.uri));
+    muxsCache.tccrc = rt_crc32(0, tcuri, strlen(tcuri));
+    muxsCache.credset = tc->credset;
+    muxsCache.expires = rt_getTime() + TC_MUXS_TTL;
+}
+
+static int cache_lookup (tc_t* tc) {
+    if( muxsCache.expires == 0 || muxsCache.credset != tc->credset )
+        return 0;
+    str_t tcuri = sys_uri(SYS_CRED_TC, tc->credset);
+    if( tcuri == NULL || muxsCache.tccrc != rt_crc32(0, tcuri, strlen(tcuri)) || rt_getTime() > muxsCache.expires ) {
+        cache_drop();
+        return 0;
+    }
+    memcpy(tc->muxsuri, muxsCache.uri, sizeof(tc->muxsuri));
+    return 1;
+}
+
+static void histo_add (tc_t* tc) {
+    ustime_t dt = rt_getTime() - tc->connBeg;
+    u4_t ms = dt / 1000;
+    int b = 0;
+    for( u4_t lim = TC_HISTO_BASE; ms >= lim && b < TC_HISTO_N-1; lim <<= 1 )
+        b++;
+    u4_t* h = connHisto[tc->direct];
+    h[b] += 1;
+    char line[TC_HISTO_N*11+1];
+    dbuf_t lb = dbuf_ini(line);
+    for( int i=0; i<TC_HISTO_N; i++ )
+        xprintf(&lb, " %u", h[i]);
+    LOG(MOD_TCE|INFO, "Connected to MUXS in %~T (%s) - latency histogram %ums..:%s",
+        dt, tc->direct ? "cached URI" : "via INFOS", TC_HISTO_BASE, line);
+}
+
+// A direct connect to the cached muxs URI did not work out - ask INFOS right away
+static int tc_fallback (tc_t* tc) {
+    if( !tc->direct )
+        return 0;
+    LOG(MOD_TCE|INFO, "Cached MUXS URI failed - asking INFOS");
+    cache_drop();
+    tc->direct = 0;
+    tc->muxsuri[0] = URI_BAD;
+    rt_clrTimer(&tc->timeout);
+    ws_free(&tc->ws);
+    ws_ini(&tc->ws, TC_RECV_BUFFER_SIZE, TC_SEND_BUFFER_SIZE);
+    tc_connect_infos(tc);
+    return 1;
+}
+
 
 static void tc_done (tc_t* tc, s1_t tstate) {
     tc->tstate = tstate;
+    tc->s2ctx.spooling = 1;  // until next router_config
     ws_free(&tc->ws);
     rt_yieldTo(&tc->timeout, tc->ondone);
     sys_inState(SYSIS_TC_DISCONNECTED);
@@ -48,30 +124,40 @@ static void tc_done (tc_t* tc, s1_t tstate) {
 
 static void tc_timeout (tmr_t* tmr) {
     tc_t* tc = timeout2tc(tmr);
+    if( tc->tstate == TC_MUXS_REQ_PEND && tc_fallback(tc) )
+        return;
     LOG(MOD_TCE|ERROR, "TC engine timed out");
     tc_done(tc, TC_ERR_TIMEOUT);
 }
 
 
+static void tc_sendVersion (ws_t* ws) {
+    dbuf_t b = ws_getSendbuf(ws, MIN_UPJSON_SIZE);
+    assert(b.buf != NULL);   // this should not fail on a fresh connection
+    uj_encOpen(&b, '{');
+    uj_encKV(&b, "msgtype",  's', "version");
+    uj_encKV(&b, "station",  's', CFG_version);
+    uj_encKV(&b, "firmware", 's', sys_version());
+    uj_encKV(&b, "package",  's', sys_version());
+    // uj_encKV(&b, "os",       's', sys_osversion()); 
+    uj_encKV(&b, "model",    's', CFG_platform);
+    uj_encKV(&b, "protocol", 'i', MUXS_PROTOCOL_VERSION);
+    uj_encKV(&b, "features", 's', rt_features());
+    uj_encClose(&b, '}');
+    ws_sendText(ws, &b);
+}
+
+
 static void tc_muxs_connection (conn_t* _conn, int ev) {
     tc_t* tc = conn2tc(_conn);
     if( ev == WSEV_CONNECTED ) {
         rt_clrTimer(&tc->timeout);
         tc->tstate = TC_MUXS_CONNECTED;
-        LOG(MOD_TCE|VERBOSE, "Connected to MUXS.");
-        dbuf_t b = ws_getSendbuf(&tc->ws, MIN_UPJSON_SIZE);
-        assert(b.buf != NULL);   // this should not fail on a fresh connection
-        uj_encOpen(&b, '{');
-        uj_encKV(&b, "msgtype",  's', "version");
-        uj_encKV(&b, "station",  's', CFG_version);
-        uj_encKV(&b, "firmware", 's', sys_version());
-        uj_encKV(&b, "package",  's', sys_version());
-        // uj_encKV(&b, "os",       's', sys_osversion()); 
-        uj_encKV(&b, "model",    's', CFG_platform);
-        uj_encKV(&b, "protocol", 'i', MUXS_PROTOCOL_VERSION);
-        uj_encKV(&b, "features", 's', rt_features());
-        uj_encClose(&b, '}');
-        ws_sendText(&tc->ws, &b);
+        tc->s2ctx.sendhigh = 0;
+        histo_add(tc);
+        cache_save(tc);
+        tc->direct = 0;
+        tc_sendVersion(&tc->ws);
         if( tc->credset == SYS_CRED_REG )
             sys_backupConfig(SYS_CRED_TC);
         // Put CUPS to long back-off
@@ -80,6 +166,13 @@ static void tc_muxs_connection (conn_t* _conn, int ev) {
     }
     if( ev == WSEV_DATASENT ) {
         s2e_flushRxjobs(&tc->s2ctx);   // send off more pending rxjobs
+        s2e_resumeRmtsh();             // uplinks are out - rmtsh may use what is left
+        return;
+    }
+    if( ev == WSEV_SENDHIGH || ev == WSEV_SENDLOW ) {
+        tc->s2ctx.sendhigh = ev == WSEV_SENDHIGH;
+        LOG(MOD_TCE|(ev == WSEV_SENDHIGH ? WARNING : INFO), "Send buffer %s watermark - %u bytes queued (buffer %u bytes)",
+            ev == WSEV_SENDHIGH ? "above high" : "below low", ws_sendQueued(&tc->ws), tc->ws.wbufsize);
         return;
     }
     if( ev == WSEV_TEXTRCVD ) {
@@ -103,6 +196,8 @@ static void tc_muxs_connection (conn_t* _conn, int ev) {
     if( ev == WSEV_CLOSED ) {
         s1_t tstate = tc->tstate;
         LOG(MOD_TCE|VERBOSE, "Connection to MUXS closed in state %d", tstate);
+        if( tstate != TC_MUXS_CONNECTED && tc_fallback(tc) )
+            return;
         if( tstate >= 0 ) {
             // Quickly reopen muxs connection if just close else go thru infos
             tstate = tstate == TC_MUXS_CONNECTED ? TC_ERR_CLOSED : TC_ERR_FAILED;
@@ -114,6 +209,32 @@ static void tc_muxs_connection (conn_t* _conn, int ev) {
 }
 
 
+// Store a ws(s):// URI in compact form: [0]=URI_TLS/URI_TCP, [1]=port offset,
+// [2]=path offset, host/port/path as zero terminated strings from [3].
+static int tc_encodeMuxsUri (char* muxsuri, const char* uri, int len) {
+    if( len+1 > MAX_URI_LEN ) {
+        LOG(MOD_TCE|ERROR, "Muxs URI too long (max %d): %.*s", MAX_URI_LEN, len, uri);
+        return 0;
+    }
+    struct uri_info ui;
+    dbuf_t b = { .buf=(char*)uri, .bufsize=len, .pos=0 };
+    if( !uri_parse(&b, &ui, 0) || ui.portBeg==ui.portEnd || ui.pathBeg==ui.pathEnd ) {
+        LOG(MOD_TCE|ERROR, "Illegal muxs URI (no port/path etc.): %.*s", len, uri);
+        return 0;
+    }
+    memset(muxsuri, 0, MAX_URI_LEN+3);
+    u1_t portoff = ui.hostEnd - ui.hostBeg + 4;
+    u1_t pathoff = portoff + ui.portEnd - ui.portBeg + 1;
+    muxsuri[0] = uri[2]=='s' ? URI_TLS : URI_TCP;
+    muxsuri[1] = portoff;
+    muxsuri[2] = pathoff;
+    memcpy(&muxsuri[3],       &uri[ui.hostBeg], ui.hostEnd - ui.hostBeg);
+    memcpy(&muxsuri[portoff], &uri[ui.portBeg], ui.portEnd - ui.portBeg);
+    memcpy(&muxsuri[pathoff], &uri[ui.pathBeg], ui.pathEnd - ui.pathBeg);
+    return 1;
+}
+
+
 static void tc_connect_muxs (tc_t* tc) {
     char* u = tc->muxsuri;
     int   tlsmode  = u[0];
@@ -122,6 +243,9 @@ static void tc_connect_muxs (tc_t* tc) {
     char* path     = &u[(u1_t)u[2]];
 
     ws_ini(&tc->ws, TC_RECV_BUFFER_SIZE, TC_SEND_BUFFER_SIZE);
+    ws_setBufmax(&tc->ws, TC_RECV_BUFSZ_MAX, TC_SEND_BUFSZ_MAX);
+    ws_setWriterThread(&tc->ws, TC_WRITER_THREAD);
+    ws_setDeflate(&tc->ws, TC_WS_DEFLATE);
     if( tlsmode == URI_TLS && !conn_setup_tls(&tc->ws, SYS_CRED_TC, SYS_CRED_REG, hostname) ) {
         goto errexit;
     }
@@ -130,12 +254,16 @@ static void tc_connect_muxs (tc_t* tc) {
         goto errexit;
     }
     rt_setTimerCb(&tc->timeout, rt_micros_ahead(TC_TIMEOUT), tc_timeout);
+    if( tc->direct )
+        rt_setTimer(&tc->timeout, rt_micros_ahead(TC_DIRECT_TIMEOUT));
     tc->ws.evcb = (evcb_t)tc_muxs_connection;
     tc->tstate = TC_MUXS_REQ_PEND;
-    LOG(MOD_TCE|VERBOSE, "Connecting to MUXS...");
+    LOG(MOD_TCE|VERBOSE, "Connecting to MUXS%s...", tc->direct ? " (cached URI)" : "");
     return;
 
  errexit:
+    if( tc_fallback(tc) )
+        return;
     tc_done(tc, TC_ERR_FAILED);
     return;
 }
@@ -186,25 +314,8 @@ static void tc_info_request (conn_t* _conn, int ev) {
                     LOG(MOD_TCE|ERROR, "Muxs URI must be ws://.. or wss://..: %s", muxsuri);
                     goto failed;
                 }
-                if( D.str.len+1 > MAX_URI_LEN ) {
-                    LOG(MOD_TCE|ERROR, "Muxs URI too long (max %d): %s", MAX_URI_LEN, muxsuri);
+                if( !tc_encodeMuxsUri(tc->muxsuri, D.str.beg, D.str.len) )
                     goto failed;
-                }
-                struct uri_info ui;
-                dbuf_t uri = { .buf=D.str.beg, .bufsize=D.str.len, .pos=0 };
-                if( !uri_parse(&uri, &ui, 0) || ui.portBeg==ui.portEnd || ui.pathBeg==ui.pathEnd ) {
-                    LOG(MOD_TCE|ERROR, "Illegal muxs URI (no port/path etc.): %s", muxsuri);
-                    goto failed;
-                }
-                memset(tc->muxsuri, 0, sizeof(tc->muxsuri));
-                u1_t portoff = ui.hostEnd - ui.hostBeg + 4;
-                u1_t pathoff = portoff + ui.portEnd - ui.portBeg + 1;
-                tc->muxsuri[0] = muxsuri[2]=='s' ? URI_TLS : URI_TCP;
-                tc->muxsuri[1] = portoff;
-                tc->muxsuri[2] = pathoff;
-                memcpy(&tc->muxsuri[3],       &muxsuri[ui.hostBeg], ui.hostEnd - ui.hostBeg);
-                memcpy(&tc->muxsuri[portoff], &muxsuri[ui.portBeg], ui.portEnd - ui.portBeg);
-                memcpy(&tc->muxsuri[pathoff], &muxsuri[ui.pathBeg], ui.pathEnd - ui.pathBeg);
                 break;
             }
             default: {
@@ -255,6 +366,16 @@ static dbuf_t tc_getSendbuf (s2ctx_t* s2ctx, int minsize) {
 }
 
 
+static dbuf_t tc_getSendbufClass (s2ctx_t* s2ctx, int minsize, int wsclass) {
+    tc_t* tc = s2ctx2tc(s2ctx);
+    if( tc->tstate != TC_MUXS_CONNECTED ) {
+        dbuf_t b = { .buf=NULL, .bufsize=0, .pos=0 };
+        return b;
+    }
+    return ws_getSendbufClass(&tc->ws, minsize, wsclass);
+}
+
+
 static void tc_sendText (s2ctx_t* s2ctx, dbuf_t* buf) {
     tc_t* tc = s2ctx2tc(s2ctx);
     ws_sendText(&tc->ws, buf);
@@ -267,6 +388,157 @@ static void tc_sendBinary (s2ctx_t* s2ctx, dbuf_t* buf) {
 }
 
 
+// --------------------------------------------------------------------------------
+// Mirror sessions (MUXS_MIRRORS)
+//
+// Extra muxs connections which receive a copy of every uplink message sent to the
+// primary muxs - the message is encoded once and the bytes are copied into each
+// mirror's send buffer. Mirrors are tap only: the primary session alone owns the
+// radio, messages from mirrors (router_config, dnmsg, ..) are counted and ignored.
+// Each mirror has its own send buffer - if it is full or the mirror is not connected
+// the copy is dropped, the primary and other mirrors are not affected.
+// Mirrors use the TC credentials and get the same message formats as the primary.
+// --------------------------------------------------------------------------------
+
+enum { MAX_MIRRORS = 4 };
+
+typedef struct tcmirror {
+    ws_t     ws;
+    tmr_t    timer;      // connect timeout / reconnect backoff
+    u1_t     idx;
+    u1_t     up;         // connected - version sent
+    u1_t     retries;
+    u4_t     copies;     // uplink messages handed to websocket
+    u4_t     drops;      // uplink messages dropped (not connected / no buffer space)
+    u4_t     ignored;    // messages received from mirror muxs
+    char     muxsuri[MAX_URI_LEN+3];
+} tcmirror_t;
+
+#define conn2mirror(p)  memberof(tcmirror_t, p, ws)
+#define timer2mirror(p) memberof(tcmirror_t, p, timer)
+
+static tcmirror_t* mirrors[MAX_MIRRORS];
+static int mirrorCnt;
+
+static void mirror_connect (tmr_t* tmr);
+
+
+static void mirror_backoff (tcmirror_t* m) {
+    m->up = 0;
+    ws_free(&m->ws);
+    int backoff = 1 << min(m->retries, 6);
+    m->retries += 1;
+    rt_setTimerCb(&m->timer, rt_seconds_ahead(backoff), mirror_connect);
+    LOG(MOD_TCE|INFO, "Mirror#%d reconnect backoff %ds (retry %d)", m->idx, backoff, m->retries);
+}
+
+
+static void mirror_timeout (tmr_t* tmr) {
+    tcmirror_t* m = timer2mirror(tmr);
+    LOG(MOD_TCE|ERROR, "Mirror#%d connect timed out", m->idx);
+    mirror_backoff(m);
+}
+
+
+static void mirror_event (conn_t* conn, int ev) {
+    tcmirror_t* m = conn2mirror(conn);
+    if( ev == WSEV_CONNECTED ) {
+        rt_clrTimer(&m->timer);
+        m->up = 1;
+        m->retries = 0;
+        tc_sendVersion(&m->ws);
+        LOG(MOD_TCE|INFO, "Mirror#%d connected", m->idx);
+        return;
+    }
+    if( ev == WSEV_TEXTRCVD || ev == WSEV_BINARYRCVD ) {
+        dbuf_t b = ws_getRecvbuf(&m->ws);
+        if( m->ignored++ == 0 ) {
+            LOG(MOD_TCE|INFO, "Mirror#%d - ignoring messages from muxs (tap only): %.*s",
+                m->idx, ev == WSEV_TEXTRCVD ? min(b.bufsize, 80) : 0, b.buf);
+        }
+        return;
+    }
+    if( ev == WSEV_CLOSED || ev == WSEV_DEAD ) {
+        LOG(MOD_TCE|VERBOSE, "Mirror#%d connection closed", m->idx);
+        mirror_backoff(m);
+        return;
+    }
+}
+
+
+static void mirror_connect (tmr_t* tmr) {
+    tcmirror_t* m = timer2mirror(tmr);
+    char* u = m->muxsuri;
+    char* hostname = u+3;
+    char* port     = &u[(u1_t)u[1]];
+    char* path     = &u[(u1_t)u[2]];
+    ws_ini(&m->ws, TC_RECV_BUFFER_SIZE, TC_SEND_BUFFER_SIZE);
+    ws_setBufmax(&m->ws, TC_RECV_BUFFER_SIZE, TC_SEND_BUFSZ_MAX);
+    ws_setDeflate(&m->ws, TC_WS_DEFLATE);
+    if( (u[0] == URI_TLS && !conn_setup_tls(&m->ws, SYS_CRED_TC, SYS_CRED_REG, hostname)) ||
+        !ws_connect(&m->ws, hostname, port, path) ) {
+        LOG(MOD_TCE|ERROR, "Mirror#%d connect failed - URI: ws%s://%s:%s%s", m->idx, u[0]==URI_TLS?"s":"", hostname, port, path);
+        mirror_backoff(m);
+        return;
+    }
+    m->ws.evcb = mirror_event;
+    rt_setTimerCb(&m->timer, rt_micros_ahead(TC_TIMEOUT), mirror_timeout);
+}
+
+
+static void mirrors_start () {
+    str_t p = MUXS_MIRRORS;
+    while( p && *p && mirrorCnt < MAX_MIRRORS ) {
+        str_t e = strchr(p, ',');
+        int len = e ? e-p : strlen(p);
+        tcmirror_t* m = rt_malloc(tcmirror_t);
+        if( (uri_isScheme(p,"ws") || uri_isScheme(p,"wss")) && tc_encodeMuxsUri(m->muxsuri, p, len) ) {
+            m->idx = mirrorCnt;
+            rt_iniTimer(&m->timer, mirror_connect);
+            mirrors[mirrorCnt++] = m;
+            LOG(MOD_TCE|INFO, "Mirror#%d: %.*s", m->idx, len, p);
+            mirror_connect(&m->timer);
+        } else {
+            LOG(MOD_TCE|ERROR, "Ignoring mirror - URI must be ws://.. or wss://..: %.*s", len, p);
+            rt_free(m);
+        }
+        p = e ? e+1 : NULL;
+    }
+}
+
+
+static void mirrors_stop () {
+    for( int i=0; i<mirrorCnt; i++ ) {
+        tcmirror_t* m = mirrors[i];
+        LOG(MOD_TCE|INFO, "Mirror#%d stopped - %u uplinks copied, %u dropped, %u messages ignored",
+            i, m->copies, m->drops, m->ignored);
+        rt_clrTimer(&m->timer);
+        ws_free(&m->ws);
+        rt_free(m);
+        mirrors[i] = NULL;
+    }
+    mirrorCnt = 0;
+}
+
+
+static void tc_fanout (s2ctx_t* s2ctx, dbuf_t* buf, int binary) {
+    for( int i=0; i<mirrorCnt; i++ ) {
+        tcmirror_t* m = mirrors[i];
+        dbuf_t b = { .buf=NULL };
+        if( m->up )
+            b = ws_getSendbuf(&m->ws, buf->pos);
+        if( b.buf == NULL ) {
+            m->drops += 1;
+            continue;
+        }
+        memcpy(b.buf, buf->buf, buf->pos);
+        b.pos = buf->pos;
+        ws_sendData(&m->ws, &b, binary);
+        m->copies += 1;
+    }
+}
+
+
 void tc_ondone_default (tmr_t* timeout) {
     tc_continue(timeout2tc(timeout));
 }
@@ -281,9 +553,12 @@ tc_t* tc_ini (tmrcb_t ondone) {
     tc->ondone = ondone==NULL ? tc_ondone_default : ondone;
     tc->muxsuri[0] = URI_BAD;
     s2e_ini(&tc->s2ctx);
+    tc->s2ctx.spooling = 1;  // until first router_config - radio may still run from last session
     tc->s2ctx.getSendbuf = tc_getSendbuf;
+    tc->s2ctx.getSendbufClass = tc_getSendbufClass;
     tc->s2ctx.sendText   = tc_sendText;
     tc->s2ctx.sendBinary = tc_sendBinary;
+    tc->s2ctx.fanout     = tc_fanout;
     return tc;
 }
 
@@ -300,8 +575,7 @@ void tc_free (tc_t* tc) {
 }
 
 
-void tc_start (tc_t* tc) {
-    assert(tc->tstate == TC_INI);
+static void tc_connect_infos (tc_t* tc) {
     int tstate_err = TC_ERR_NOURI;
 
     str_t tcuri = sys_uri(SYS_CRED_TC, tc->credset);
@@ -337,6 +611,19 @@ void tc_start (tc_t* tc) {
 }
 
 
+void tc_start (tc_t* tc) {
+    assert(tc->tstate == TC_INI);
+    tc->connBeg = rt_getTime();
+    if( cache_lookup(tc) ) {
+        LOG(MOD_TCE|INFO, "Skipping INFOS - reusing MUXS URI from last connection");
+        tc->direct = 1;
+        tc_connect_muxs(tc);
+        return;
+    }
+    tc_connect_infos(tc);
+}
+
+
 void tc_continue (tc_t* tc) {
     s1_t tstate = tc->tstate;
 
@@ -359,6 +646,7 @@ void tc_continue (tc_t* tc) {
     }
     if( tstate == TC_MUXS_BACKOFF ) {
         tc->retries += 1;
+        tc->connBeg = rt_getTime();
         tc_connect_muxs(tc);
         return;
     }
@@ -375,6 +663,7 @@ void tc_continue (tc_t* tc) {
         }
         tc->muxsuri[0] = URI_BAD;
         tc->retries = 1;
+        cache_drop();  // force next round thru INFOS
     }
 
     int backoff = min(tc->retries, 6);
@@ -389,6 +678,7 @@ void sys_stopTC () {
         LOG(MOD_TCE|INFO, "Terminating TC engine");
         tc_free(TC);
         TC = NULL;
+        mirrors_stop();
         sys_inState(SYSIS_TC_DISCONNECTED);
     }
 }
@@ -400,6 +690,7 @@ void sys_startTC () {
     LOG(MOD_TCE|INFO, "Starting TC engine");
     TC = tc_ini(NULL);
     tc_start(TC);
+    mirrors_start();
     sys_inState(SYSIS_TC_DISCONNECTED);
 }
 
@@ -56,6 +56,8 @@ typedef struct tc {
     s1_t     tstate;      // state of TC engine
     u1_t     credset;     // connect via this credential set
     u1_t     retries;
+    u1_t     direct;      // connecting to cached muxs URI without asking INFOS
+    ustime_t connBeg;     // start of current connect attempt (latency histogram)
     char     muxsuri[MAX_URI_LEN+3];
     tmrcb_t  ondone;
     s2ctx_t  s2ctx;
@@ -32,6 +32,7 @@
 #include "tc.h"
 #include "timesync.h"
 #include "ral.h"
+#include "trace.h"
 
 #if defined(CFG_smtcpico)
 #define _MAX_DT 300
@@ -45,6 +46,9 @@
 #define MCU_DRIFT_THRES        90  // cut off quantile - for MCU sync quality
 #define PPS_DRIFT_THRES        80  // cut off quantile - for PPS sync quality
 #define N_DRIFTS               20  // size of quantile table MCU/PPS
+#define MAX_QWIN               32  // capacity of quantile tables (>= N_DRIFTS, N_SYNC_QUAL)
+#define N_CLKFIT                8  // accepted time syncs per txunit in clock model
+#define MIN_CLKFIT              3  // use clock model with at least this many samples
 #define QUICK_RETRIES           3
 #define PPM       ((sL_t)1000000)  // 1sec in micros
 #define iPPM_SCALE             10  // keep drifts in deci ppm as ints
@@ -71,16 +75,39 @@ struct quants {
     int qmin, q50, q80, qmax;
 };
 
+// Window of the last n samples - additionally kept ordered by magnitude.
+// An update replaces the oldest sample in place (binary search + short move)
+// so quantiles are a plain lookup and never require sorting the window.
+struct qwin {
+    int n;
+    int widx;                 // next sample to be replaced in ring
+    int ring[MAX_QWIN];       // samples in arrival order
+    int sorted[MAX_QWIN];     // same samples ordered by abs value
+};
+
 static struct txunit_stats {
     int excessive_drift_cnt;
     int drift_thres;   // drift threshold (MCU_DRIFT_THRES quantile)
-    int mcu_drifts[N_DRIFTS];
-    int mcu_drifts_widx;
+    struct qwin mcu_drifts;
 } txunit_stats[MAX_TXUNITS];
 static int         sum_mcu_drifts;    // sum of txunit_stats[0].mcu_drifts
 
-static int         pps_drifts[N_DRIFTS];
-static int         pps_drifts_widx;
+static struct qwin pps_drifts;
+
+// Linear clock model per txunit: xtime = xref + (ustime-uref)*(1+skew)
+// Least squares fit over the last N_CLKFIT accepted time syncs. Conversions
+// no longer depend on the error of the most recent sample alone and account
+// for MCU/SX130X skew over the time span converted.
+static struct clkfit {
+    int      n;
+    int      widx;
+    ustime_t us[N_CLKFIT];
+    sL_t     xt[N_CLKFIT];
+    ustime_t uref;     // latest sample
+    sL_t     xref;     // fitted xtime at uref
+    double   skew;     // fitted xtime/ustime rate - 1
+    double   resid;    // RMS residual of fit (us)
+} clkfits[MAX_TXUNITS];
 static int         pps_drifts_thres; // drift threshold (PPS_DRIFT_THRES quantile)
 static u4_t        no_pps_thres;     // when to issue next error
 static ustime_t    ppsOffset;        // denotes where the PPS occurs on ustime_t, -1: unknown, otherwise 0..1e6-1
@@ -92,8 +119,7 @@ static timesync_t  timesyncs[MAX_TXUNITS];
 static timesync_t  ppsSync;          // last good PPS sync
 static s1_t        syncWobble;
 static u1_t        wsBufFull;
-static int         syncQual[N_SYNC_QUAL];
-static int         syncQual_widx;
+static struct qwin syncQual;
 static int         syncQual_thres;  // current threshold
 
 // Fwd decl
@@ -107,9 +133,12 @@ static void timesyncReport (int force) {
     lastReport = now;
     uL_t pps_ustime = xtime2ustime(&timesyncs[0], ppsSync.pps_xtime);
     LOG(MOD_SYN|INFO, "Time sync: ustime=0x%lX utc=0x%lX gpsOffset=0x%lX ppsOffset=%ld syncQual=%d\n",
-        now, rt_ustime2utc(now),  gpsOffset, ppsOffset, syncQual[0]);
+        now, rt_ustime2utc(now),  gpsOffset, ppsOffset, syncQual.ring[0]);
     LOG(MOD_SYN|INFO, "Time sync: MCU/SX130X#0 ustime=0x%lX xtime=0x%lX pps_xtime=0x%lX",
         timesyncs[0].ustime, timesyncs[0].xtime, timesyncs[0].pps_xtime);
+    if( clkfits[0].n >= MIN_CLKFIT )
+        LOG(MOD_SYN|INFO, "Time sync: MCU/SX130X#0 clock model skew=%+.2fppm resid=%.1fus (%d samples)",
+            clkfits[0].skew*PPM, clkfits[0].resid, clkfits[0].n);
     if( !ppsOffset )
         return;
     LOG(MOD_SYN|INFO, "Time sync: Last PPS     ustime=0x%lX xtime=0x%lX pps_ustime=0x%lX pps_xtime=0x%lX",
@@ -135,24 +164,61 @@ static double decodePPM (double scaled_ppm) {
     return scaled_ppm / fPPM_SCALE;
 }
 
-static int cmp_abs_int (const void* a, const void* b) {
-    return abs(*(int*)a) - abs(*(int*)b);
+static void qwin_ini (struct qwin* w, int n) {
+    assert(n <= MAX_QWIN);
+    memset(w, 0, sizeof(*w));
+    w->n = n;
+}
+
+// First index in w->sorted with abs value greater than a (or >= if inclusive)
+static int qwin_bound (struct qwin* w, int a, int inclusive) {
+    int lo = 0, hi = w->n;
+    while( lo < hi ) {
+        int mid = (lo+hi)/2;
+        int m = abs(w->sorted[mid]);
+        if( m < a || (!inclusive && m == a) )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+// Replace oldest sample by v - returns index of next sample to be replaced (0=window wrapped)
+static int qwin_add (struct qwin* w, int v) {
+    int old = w->ring[w->widx];
+    w->ring[w->widx] = v;
+    w->widx = (w->widx + 1) % w->n;
+    int i = qwin_bound(w, abs(old), 1);
+    while( w->sorted[i] != old )
+        i++;
+    int j = qwin_bound(w, abs(v), 0);
+    if( j > i ) {
+        j -= 1;
+        memmove(&w->sorted[i], &w->sorted[i+1], (j-i)*sizeof(w->sorted[0]));
+    } else {
+        memmove(&w->sorted[j+1], &w->sorted[j], (i-j)*sizeof(w->sorted[0]));
+    }
+    w->sorted[j] = v;
+    return w->widx;
+}
+
+// Value at quantile q (percent) - ordered by magnitude, sign preserved
+static int qwin_quant (struct qwin* w, int q) {
+    return w->sorted[min(w->n-1, (q*w->n+50)/100)];
 }
 
-static int drift_stats (int* drifts, struct quants *q, int thresQ, int* auxQ) {
-    int sorted_drifts[N_DRIFTS];
-    memcpy(sorted_drifts, drifts, sizeof(sorted_drifts));
-    qsort(sorted_drifts,N_DRIFTS,sizeof(sorted_drifts[0]), cmp_abs_int);
-    q->qmin = sorted_drifts[0];
-    q->q50  = sorted_drifts[N_DRIFTS/2];
-    q->q80  = sorted_drifts[(N_DRIFTS*80+50)/100];
-    q->qmax = sorted_drifts[N_DRIFTS-1];
+static int drift_stats (struct qwin* drifts, struct quants *q, int thresQ, int* auxQ) {
+    q->qmin = drifts->sorted[0];
+    q->q50  = qwin_quant(drifts, 50);
+    q->q80  = qwin_quant(drifts, 80);
+    q->qmax = drifts->sorted[drifts->n-1];
     if( auxQ )
-        *auxQ = sorted_drifts[(*auxQ*N_DRIFTS+50)/100];
-    return sorted_drifts[(thresQ*N_DRIFTS+50)/100];
+        *auxQ = qwin_quant(drifts, *auxQ);
+    return qwin_quant(drifts, thresQ);
 }
 
-static int log_drift_stats (str_t msg, int* drifts, int thresQ, int* auxQ) {
+static int log_drift_stats (str_t msg, struct qwin* drifts, int thresQ, int* auxQ) {
     struct quants q;
     int thres = drift_stats(drifts, &q, thresQ, auxQ);
     LOG(MOD_SYN|INFO, "%s: min: %+4.1fppm  q50: %+4.1fppm  q80: %+4.1fppm  max: %+4.1fppm - threshold q%d: %+4.1fppm",
@@ -163,6 +229,65 @@ static int log_drift_stats (str_t msg, int* drifts, int thresQ, int* auxQ) {
 }
 
 
+static void clkfit_add (u1_t txunit, const timesync_t* curr) {
+    struct clkfit* f = &clkfits[txunit];
+    if( f->n && ral_xtime2sess(f->xref) != ral_xtime2sess(curr->xtime) )
+        f->n = f->widx = 0;   // SX130X restarted - old samples are meaningless
+    f->us[f->widx] = curr->ustime;
+    f->xt[f->widx] = curr->xtime;
+    f->widx = (f->widx + 1) % N_CLKFIT;
+    if( f->n < N_CLKFIT )
+        f->n += 1;
+    f->uref = curr->ustime;
+    f->xref = curr->xtime;
+    f->skew = f->resid = 0;
+    if( f->n < MIN_CLKFIT )
+        return;
+    // Fit offset y = (xtime-xref)-(ustime-uref) as a + b*(ustime-uref)
+    double su = 0, sy = 0, suu = 0, suy = 0;
+    for( int i=0; i<f->n; i++ ) {
+        double du = (double)(f->us[i] - curr->ustime);
+        double y  = (double)(f->xt[i] - curr->xtime) - du;
+        su += du; sy += y; suu += du*du; suy += du*y;
+    }
+    double d = f->n*suu - su*su;
+    if( d <= 0 )
+        return;
+    double b = (f->n*suy - su*sy) / d;
+    double a = (sy - b*su) / f->n;
+    if( fabs(b)*PPM > _MAX_DT ) {
+        // Implausible - restart model from this sample
+        f->n = f->widx = 1;
+        f->us[0] = curr->ustime;
+        f->xt[0] = curr->xtime;
+        return;
+    }
+    double see = 0;
+    for( int i=0; i<f->n; i++ ) {
+        double du = (double)(f->us[i] - curr->ustime);
+        double e  = (double)(f->xt[i] - curr->xtime) - du - a - b*du;
+        see += e*e;
+    }
+    f->xref  = curr->xtime + (sL_t)llround(a);
+    f->skew  = b;
+    f->resid = f->n > 2 ? sqrt(see / (f->n-2)) : 0;
+}
+
+static sL_t clkfit_us2x (u1_t txunit, ustime_t ustime) {
+    const struct clkfit* f = &clkfits[txunit];
+    if( f->n < MIN_CLKFIT )
+        return ustime2xtime(&timesyncs[txunit], ustime);
+    return f->xref + (sL_t)llround((double)(ustime - f->uref) * (1.0 + f->skew));
+}
+
+static ustime_t clkfit_x2us (u1_t txunit, sL_t xtime) {
+    const struct clkfit* f = &clkfits[txunit];
+    if( f->n < MIN_CLKFIT )
+        return xtime2ustime(&timesyncs[txunit], xtime);
+    return f->uref + (ustime_t)llround((double)(xtime - f->xref) / (1.0 + f->skew));
+}
+
+
 ustime_t ts_normalizeTimespanMCU (ustime_t timespan) {
     
     
@@ -171,15 +296,11 @@ ustime_t ts_normalizeTimespanMCU (ustime_t timespan) {
 }
 
 ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
-    syncQual[syncQual_widx] = quality;
-    syncQual_widx = (syncQual_widx + 1) % N_SYNC_QUAL;
-    if( syncQual_widx == 0 ) {
-        int sorted_qual[N_SYNC_QUAL];
-        memcpy(sorted_qual, syncQual, sizeof(sorted_qual));
-        qsort(sorted_qual,N_SYNC_QUAL,sizeof(sorted_qual[0]),cmp_abs_int);
-        int thres = sorted_qual[(N_SYNC_QUAL*SYNC_QUAL_THRES+50)/100];
+    trace_rec(curr->ustime, TRACE_TIMESYNC, txunit, min(abs(quality), 0xFFFF), curr->xtime, curr->pps_xtime);
+    if( qwin_add(&syncQual, quality) == 0 ) {
+        int thres = qwin_quant(&syncQual, SYNC_QUAL_THRES);
         LOG(MOD_SYN|INFO, "Time sync qualities: min=%d q%d=%d max=%d (previous q%d=%d)",
-            sorted_qual[0], SYNC_QUAL_THRES, thres, sorted_qual[N_SYNC_QUAL-1], SYNC_QUAL_THRES, syncQual_thres);
+            syncQual.sorted[0], SYNC_QUAL_THRES, thres, syncQual.sorted[N_SYNC_QUAL-1], SYNC_QUAL_THRES, syncQual_thres);
         syncQual_thres = max(SYNC_QUAL_GOOD, abs(thres));
     }
     if( abs(quality) > syncQual_thres ) {
@@ -191,6 +312,7 @@ ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
     if( last->ustime == 0 ) {
         // Very first call - just setup last
         *last = *curr;
+        clkfit_add(txunit, curr);
         return TIMESYNC_RADIO_INTV;
     }
     ustime_t dus = curr->ustime - last->ustime;
@@ -207,14 +329,9 @@ ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
     struct txunit_stats* stats = &txunit_stats[txunit];
     int drift_ppm = encodeDriftPPM( (double)dus/(double)dxc );
     if( txunit == 0 )
-        sum_mcu_drifts += drift_ppm - stats->mcu_drifts[stats->mcu_drifts_widx];
-    stats->mcu_drifts[stats->mcu_drifts_widx] = drift_ppm;
-    stats->mcu_drifts_widx = (stats->mcu_drifts_widx + 1) % N_DRIFTS;
-    if( stats->mcu_drifts_widx == 0 ) {
-        
-        
-        
-        int thres = log_drift_stats("MCU/SX130X drift stats", stats->mcu_drifts, MCU_DRIFT_THRES, NULL);
+        sum_mcu_drifts += drift_ppm - stats->mcu_drifts.ring[stats->mcu_drifts.widx];
+    if( qwin_add(&stats->mcu_drifts, drift_ppm) == 0 ) {
+        int thres = log_drift_stats("MCU/SX130X drift stats", &stats->mcu_drifts, MCU_DRIFT_THRES, NULL);
         stats->drift_thres = max(MIN_MCU_DRIFT_THRES, min(MAX_MCU_DRIFT_THRES, abs(thres)));
         double mean_ppm = decodePPM( ((double)sum_mcu_drifts) / N_DRIFTS);
         LOG(MOD_SYN|INFO, "Mean MCU drift vs SX130X#0: %.1fppm",  mean_ppm);
@@ -234,6 +351,7 @@ ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
         return TIMESYNC_RADIO_INTV/2;
     }
     stats->excessive_drift_cnt = 0;
+    clkfit_add(txunit, curr);
     ustime_t delay = TIMESYNC_RADIO_INTV;
 
     // Only txunit#0 can have PPS or we're not tracking a PPS
@@ -267,10 +385,8 @@ ustime_t ts_updateTimesync (u1_t txunit, int quality, const timesync_t* curr) {
     // Update PPS drift stats
     double pps_drift = (double)(curr->pps_xtime - last->pps_xtime)
         / (double)((curr->pps_xtime - last->pps_xtime + PPM/2) / PPM * PPM);
-    pps_drifts[pps_drifts_widx] = encodeDriftPPM(pps_drift);
-    pps_drifts_widx = (pps_drifts_widx + 1) % N_DRIFTS;
-    if( pps_drifts_widx == 0 )
-        pps_drifts_thres = log_drift_stats("PPS/SX130X drift stats", pps_drifts, PPS_DRIFT_THRES, NULL);
+    if( qwin_add(&pps_drifts, encodeDriftPPM(pps_drift)) == 0 )
+        pps_drifts_thres = log_drift_stats("PPS/SX130X drift stats", &pps_drifts, PPS_DRIFT_THRES, NULL);
 
     ustime_t pps_ustime = xtime2ustime(curr, curr->pps_xtime);
     ustime_t off = pps_ustime % PPM;
@@ -322,7 +438,7 @@ sL_t ts_gpstime2xtime (u1_t txunit, sL_t gpstime) {
         return 0;
     }
     sL_t xtime = gpstime - gpsOffset + ppsSync.pps_xtime;
-    return txunit==0 ? xtime : xtime2xtime(&ppsSync, &timesyncs[txunit], xtime);
+    return txunit==0 ? xtime : clkfit_us2x(txunit, clkfit_x2us(0, xtime));
 }
 
 
@@ -343,8 +459,7 @@ sL_t ts_xtime2gpstime (sL_t xtime) {
 sL_t ts_ustime2xtime (u1_t txunit, ustime_t ustime) {
     if( txunit >= MAX_TXUNITS || timesyncs[txunit].xtime == 0 )
         return 0; // cannot convert
-    const timesync_t* sync = &timesyncs[txunit];
-    return ustime2xtime(sync, ustime);
+    return clkfit_us2x(txunit, ustime);
 }
 
 
@@ -361,7 +476,7 @@ ustime_t ts_xtime2ustime (sL_t xtime) {
             xtime, ral_xtime2sess(xtime), ral_xtime2sess(sync->xtime));
         return 0;
     }
-    return xtime2ustime(sync, xtime);
+    return clkfit_x2us(txunit, xtime);
 }
 
 
@@ -375,9 +490,7 @@ sL_t ts_xtime2xtime (sL_t xtime, u1_t dst_txunit) {
         LOG(MOD_SYN|ERROR, "Cannot convert xtime=%ld from txunit#%d to txunit#%d", xtime, src_txunit, dst_txunit);
         return 0; // cannot convert
     }
-    const timesync_t* src_sync = &timesyncs[src_txunit];
-    const timesync_t* dst_sync = &timesyncs[dst_txunit];
-    return xtime2xtime(src_sync, dst_sync, xtime);
+    return clkfit_us2x(dst_txunit, clkfit_x2us(src_txunit, xtime));
 }
 
 
@@ -418,15 +531,19 @@ void ts_iniTimesync () {
     no_pps_thres = NO_PPS_ALARM_INI;
     memset(&ppsSync, 0, sizeof(ppsSync));   // no PPS ever seen
     memset(&txunit_stats, 0, sizeof(txunit_stats));
-    for( int i=0; i<MAX_TXUNITS; i++ )
+    for( int i=0; i<MAX_TXUNITS; i++ ) {
         txunit_stats[i].drift_thres = MAX_MCU_DRIFT_THRES;
+        qwin_ini(&txunit_stats[i].mcu_drifts, N_DRIFTS);
+    }
     syncWobble = -1;
-    pps_drifts_widx = 0;
+    qwin_ini(&pps_drifts, N_DRIFTS);
+    qwin_ini(&syncQual, N_SYNC_QUAL);
     syncQual_thres = INT_MAX;
     syncLnsCnt = 0;
     lastReport = 0;
     sum_mcu_drifts = 0;
     memset(timesyncs, 0, sizeof(timesyncs));
+    memset(clkfits, 0, sizeof(clkfits));
     rt_clrTimer(&syncLnsTmr);
 }
 
@@ -448,7 +565,12 @@ static void onTimesyncLns (tmr_t* tmr) {
         return;
     }
     s2ctx_t* s2ctx = &TC->s2ctx;
-    ujbuf_t sendbuf = (*s2ctx->getSendbuf)(s2ctx, MIN_UPJSON_SIZE/2);
+    if( s2ctx->sendhigh ) {
+        // Backhaul is congested - leave buffer space to uplink frames
+        rt_setTimer(tmr, rt_micros_ahead(TIMESYNC_LNS_RETRY));
+        return;
+    }
+    ujbuf_t sendbuf = s2e_getSendbufClass(s2ctx, MIN_UPJSON_SIZE/2, WSCLASS_TIMESYNC);
     if( sendbuf.buf == NULL ) {
         if( !wsBufFull )
             LOG(MOD_SYN|ERROR, "Failed to send timesync to server - no buffer space");
@@ -457,13 +579,20 @@ static void onTimesyncLns (tmr_t* tmr) {
         return;
     }
     wsBufFull = 0;
-    uj_encOpen(&sendbuf, '{');
-    uj_encKVn(&sendbuf,
-              "msgtype",   's', "timesync",
-              "txtime",    'I', rt_getTime(),
-              NULL);
-    uj_encClose(&sendbuf, '}');
-    (*s2ctx->sendText)(s2ctx, &sendbuf);
+    if( s2ctx->binmsg ) {
+        sendbuf.buf[0] = BINMSG_TIMESYNC;
+        rt_wlsbf8((u1_t*)sendbuf.buf+1, rt_getTime());
+        sendbuf.pos = BINMSG_TIMESYNC_UPLEN;
+        (*s2ctx->sendBinary)(s2ctx, &sendbuf);
+    } else {
+        uj_encOpen(&sendbuf, '{');
+        uj_encKVn(&sendbuf,
+                  "msgtype",   's', "timesync",
+                  "txtime",    'I', rt_getTime(),
+                  NULL);
+        uj_encClose(&sendbuf, '}');
+        (*s2ctx->sendText)(s2ctx, &sendbuf);
+    }
     ustime_t delay = syncLnsCnt % TIMESYNC_LNS_BURST ? TIMESYNC_LNS_RETRY : TIMESYNC_LNS_PAUSE;
     syncLnsCnt += 1;
     rt_setTimer(tmr, rt_micros_ahead(delay));
@@ -494,7 +623,7 @@ void ts_processTimesyncLns (ustime_t txtime, ustime_t rxtime, sL_t gpstime) {
     if( sys_modePPS == PPS_FUZZY ) {
         // In this timing mode the PPS of the gateway and the PPS of the server are not aligned.
         // This mode facilitates beaconing while not perfectly aligned to an absolute GPS time.
-        sL_t xtime = ustime2xtime(&timesyncs[0], (txtime + rxtime)/2);
+        sL_t xtime = clkfit_us2x(0, (txtime + rxtime)/2);
         LOG(MOD_SYN|INFO, "Timesync with LNS - fuzzy PPS: tx/rx=0x%lX..0x%lX xtime=0x%lX gpsOffset=0x%lX", txtime, rxtime, xtime, gpsOffset);
         ts_setTimesyncLns(xtime, gpstime);
         return;
@@ -526,8 +655,7 @@ void ts_processTimesyncLns (ustime_t txtime, ustime_t rxtime, sL_t gpstime) {
     // Only one solution - calculate the GPS time label
     //    us_s (localtime) equivalent to gps_s (GPS seconds since epoch)
     // Translate into a seconds offset
-    const timesync_t* sync0 = &timesyncs[0];
-    sL_t pps_xtime_inferred = ustime2xtime(sync0, us_s);    // inferred PPS pulse in xtime (subject to ustime->xtime error)
+    sL_t pps_xtime_inferred = clkfit_us2x(0, us_s);    // inferred PPS pulse in xtime (subject to ustime->xtime error)
     sL_t delta  = ustimeRoundSecs(pps_xtime_inferred - ppsSync.pps_xtime);  // seconds between last latched PPS and inferred
     sL_t pps_xtime = ppsSync.pps_xtime + delta;
     sL_t jitter = pps_xtime - pps_xtime_inferred;
@@ -45,8 +45,38 @@ struct tlsconf {
     mbedtls_x509_crt*   trust;
     mbedtls_x509_crt*   mycert;
     mbedtls_pk_context* mykey;
+    int                 refs;
+    u4_t                id;      // unique - never reused
 };
 
+// TLS session as handed out via tlsctx_p.
+typedef struct tlssess {
+    mbedtls_ssl_context ssl;     // must be first - tlsctx_p points here
+    u4_t                confid;
+    char                host[MAX_HOSTNAME_LEN];
+} tlssess_t;
+
+// Parsed credentials per credential set shared by all connections.
+// Any change to the credential files yields a different CRC and a new config.
+#define TLS_CONF_CACHE    (SYS_CRED_MAX*3)
+// Sessions of past connections per config and server name for resumption.
+#define TLS_SESSION_CACHE 4
+
+static struct {
+    tlsconf_t* conf;
+    u4_t       credid;
+    u4_t       credcrc;
+} confCache[TLS_CONF_CACHE];
+
+static struct {
+    u4_t                confid;   // 0 = unused
+    char                host[MAX_HOSTNAME_LEN];
+    mbedtls_ssl_session session;
+} sessCache[TLS_SESSION_CACHE];
+
+static u4_t nextConfId;
+static u1_t nextSessSlot;
+
 u1_t tls_dbgLevel;
 
 #if defined(CFG_sysrandom)
@@ -114,6 +144,8 @@ tlsconf_t* tls_makeConf (mbedtls_x509_crt* trust, mbedtls_x509_crt* mycert, mbed
     conf->trust  = NULL;
     conf->mycert = NULL;
     conf->mykey  = NULL;
+    conf->refs   = 1;
+    conf->id     = ++nextConfId;
     int ret;
     if( (ret = mbedtls_ssl_config_defaults(&conf->sslconfig,
                                            MBEDTLS_SSL_IS_CLIENT,
@@ -126,6 +158,9 @@ tlsconf_t* tls_makeConf (mbedtls_x509_crt* trust, mbedtls_x509_crt* mycert, mbed
     mbedtls_ssl_conf_rng     (&conf->sslconfig, mbedtls_ctr_drbg_random, assertDBRG());
 #endif
     mbedtls_ssl_conf_authmode(&conf->sslconfig, MBEDTLS_SSL_VERIFY_REQUIRED);
+#if defined(MBEDTLS_SSL_SESSION_TICKETS)
+    mbedtls_ssl_conf_session_tickets(&conf->sslconfig, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif // MBEDTLS_SSL_SESSION_TICKETS
 #if defined(CFG_max_tls_frag_len)
     if( (ret = mbedtls_ssl_conf_max_frag_len(&conf->sslconfig, CFG_max_tls_frag_len)) != 0)
         rt_fatal("mbedtls_ssl_conf_max_frag_len", ret);
@@ -138,9 +173,11 @@ tlsconf_t* tls_makeConf (mbedtls_x509_crt* trust, mbedtls_x509_crt* mycert, mbed
 }
 
 
-// NOTE: this must only be done if no tlsctx_p is referencing this conf.
+// Drop a reference. Config is freed when no connection and no cache entry
+// is referencing it anymore.
+// NOTE: last reference must only be dropped if no tlsctx_p is referencing this conf.
 void tls_freeConf (tlsconf_t* conf) {
-    if( conf == NULL )
+    if( conf == NULL || --conf->refs > 0 )
         return;
     if( conf->trust ) {
         mbedtls_x509_crt_free(conf->trust);
@@ -262,15 +299,57 @@ int tls_setTrustedCAs (tlsconf_t* conf, const char* ca, int calen) {
 }
 
 
+tlsconf_t* tls_findConf (u4_t credid, u4_t credcrc) {
+    for( int i=0; i<TLS_CONF_CACHE; i++ ) {
+        if( confCache[i].conf == NULL || confCache[i].credid != credid )
+            continue;
+        if( confCache[i].credcrc == credcrc ) {
+            confCache[i].conf->refs += 1;
+            return confCache[i].conf;
+        }
+        // Credentials changed - drop stale config
+        tls_freeConf(confCache[i].conf);
+        confCache[i].conf = NULL;
+    }
+    return NULL;
+}
+
+
+void tls_keepConf (tlsconf_t* conf, u4_t credid, u4_t credcrc) {
+    int slot = 0;
+    for( int i=0; i<TLS_CONF_CACHE; i++ ) {
+        if( confCache[i].conf == NULL || confCache[i].credid == credid ) {
+            slot = i;
+            break;
+        }
+    }
+    tls_freeConf(confCache[slot].conf);
+    conf->refs += 1;
+    confCache[slot].conf    = conf;
+    confCache[slot].credid  = credid;
+    confCache[slot].credcrc = credcrc;
+}
+
+
+static int findSession (u4_t confid, const char* host) {
+    for( int i=0; i<TLS_SESSION_CACHE; i++ ) {
+        if( sessCache[i].confid == confid && strcmp(sessCache[i].host, host) == 0 )
+            return i;
+    }
+    return -1;
+}
+
+
 tlsctx_p tls_makeSession (tlsconf_t* conf, const char* servername) {
-    mbedtls_ssl_context* sslctx = rt_malloc(mbedtls_ssl_context);
+    tlssess_t* sess = rt_malloc(tlssess_t);
+    mbedtls_ssl_context* sslctx = &sess->ssl;
     mbedtls_ssl_init(sslctx);
     int ret;
     if( (ret = mbedtls_ssl_setup(sslctx, &conf->sslconfig)) != 0 ) {
         log_mbedError(ERROR, ret, "mbedtls_ssl_setup failed");
       fail:
         mbedtls_ssl_free(sslctx);
-        rt_free(sslctx);
+        rt_free(sess);
         return NULL;
     }
     if( servername && TLS_SNI ) {
@@ -279,16 +358,54 @@ tlsctx_p tls_makeSession (tlsconf_t* conf, const char* servername) {
             goto fail;
         }
     }
+    if( servername && TLS_RESUME && strlen(servername) < sizeof(sess->host) ) {
+        sess->confid = conf->id;
+        strcpy(sess->host, servername);
+        int si = findSession(conf->id, servername);
+        if( si >= 0 ) {
+            if( (ret = mbedtls_ssl_set_session(sslctx, &sessCache[si].session)) != 0 ) {
+                log_mbedError(MOD_AIO|WARNING, ret, "TLS session for %s not resumable", servername);
+            } else {
+                LOG(MOD_AIO|DEBUG, "Trying to resume TLS session with %s", servername);
+            }
+        }
+    }
     // To be done in ws_connect/http_connect
     //mbedtls_ssl_set_bio(sslctx, netctx, mbedtls_net_send, mbedtls_net_recv, NULL);
     return sslctx;
 }
 
+
+// Remember session of an established connection for the next connect to
+// the same server. If server does not accept it we fall back to a full handshake.
+static void saveSession (tlssess_t* sess) {
+    if( sess->host[0] == 0 || sess->ssl.state != MBEDTLS_SSL_HANDSHAKE_OVER )
+        return;
+    int si = findSession(sess->confid, sess->host);
+    if( si < 0 ) {
+        si = nextSessSlot;
+        nextSessSlot = (nextSessSlot+1) % TLS_SESSION_CACHE;
+    }
+    mbedtls_ssl_session_free(&sessCache[si].session);
+    mbedtls_ssl_session_init(&sessCache[si].session);
+    sessCache[si].confid = 0;
+    int ret;
+    if( (ret = mbedtls_ssl_get_session(&sess->ssl, &sessCache[si].session)) != 0 ) {
+        log_mbedError(MOD_AIO|WARNING, ret, "Saving TLS session for %s", sess->host);
+        return;
+    }
+    sessCache[si].confid = sess->confid;
+    strcpy(sessCache[si].host, sess->host);
+}
+
+
 // NOTE: this does not free the TLS config (since it could be shared among multiple sessions)
 void tls_freeSession (tlsctx_p tlsctx) {
     if( tlsctx != NULL ) {
-        mbedtls_ssl_free(tlsctx);
-        rt_free(tlsctx);
+        tlssess_t* sess = (tlssess_t*)tlsctx;
+        saveSession(sess);
+        mbedtls_ssl_free(&sess->ssl);
+        rt_free(sess);
     }
 }
 
@@ -42,6 +42,8 @@ tlsconf_t* tls_makeConf      ();
 void       tls_freeConf      (tlsconf_t* conf);
 int        tls_setMyCert     (tlsconf_t* conf, const char* cert, int certlen, const char* key, int keylen, const char* pwd);
 int        tls_setTrustedCAs (tlsconf_t* conf, const char* file_or_data, int len);
+tlsconf_t* tls_findConf      (u4_t credid, u4_t credcrc);
+void       tls_keepConf      (tlsconf_t* conf, u4_t credid, u4_t credcrc);
 tlsctx_p   tls_makeSession   (tlsconf_t* conf, const char* servername);
 void       tls_freeSession   (tlsctx_p tlsctx);
 
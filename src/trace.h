@@ -0,0 +1,105 @@
+/*
+ * --- Revised 3-Clause BSD License ---
+ * Copyright Semtech Corporation 2020. All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without modification,
+ * are permitted provided that the following conditions are met:
+ *
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *     * Neither the name of the Semtech corporation nor the names of its
+ *       contributors may be used to endorse or promote products derived from this
+ *       software without specific prior written permission.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+ * WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL SEMTECH CORPORATION. BE LIABLE FOR ANY DIRECT,
+ * INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING,
+ * BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE,
+ * DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF
+ * LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE
+ * OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF
+ * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+ */
+
+
+#ifndef _trace_h_
+#define _trace_h_
+
+#include "rt.h"
+
+// Flight recorder - a fixed ring of compact binary records kept in RAM at all times.
+// Recording is a handful of plain stores on the main thread - no locks, no formatting.
+// The ring is written out raw (sys_dumpTrace) and decoded offline by pysys/tracedump.py.
+// Times are the low 32 bits of ustime - the decoder unwraps them backwards from the dump time.
+
+enum { TRACE_RECORDS = 8192 };   // power of 2 - 128KB
+
+enum {
+    TRACE_RX = 1,      // a=DR        b=verdict  c=freq                d=len | snr<<8 | rssi<<16 | rx_load<<24
+    TRACE_TXADM,       // a=txunit    b=verdict  c=freq                d=txtime-now (s4)
+    TRACE_TIMESYNC,    // a=txunit    b=quality  c=xtime (low 32 bits) d=pps_xtime (low 32 bits)
+    TRACE_WSFILL,      // a=congested b=-        c=queued bytes        d=send buffer size
+    TRACE_STALL,       // a=kind      b=-        c=run time (us)       d=callback address (low 32 bits)
+    TRACE_SCHEDLAT,    // a=-         b=-        c=wakeup delay (us)   d=-
+};
+
+enum {  // verdicts of TRACE_RX / TRACE_TXADM
+    TRACE_OK = 0,
+    TRACE_RX_REPLACE,       // kept - dropped a weaker pending mirror frame
+    TRACE_RX_MIRROR,
+    TRACE_RX_SHED_DUP,
+    TRACE_RX_SHED_FILTER,
+    TRACE_RX_SHED_SNR,
+    TRACE_TX_DC,            // same order as MC_tx_rej_xxx
+    TRACE_TX_CCA,
+    TRACE_TX_TOOLATE,
+    TRACE_TX_COLLISION,
+    TRACE_TX_OTHER,
+};
+
+typedef struct trace_rec {
+    u4_t t;
+    u1_t ev;
+    u1_t a;
+    u2_t b;
+    u4_t c;
+    u4_t d;
+} trace_rec_t;
+
+typedef struct trace_hdr {
+    char magic[4];      // "STRC"
+    u2_t version;
+    u2_t recsize;       // sizeof(trace_rec_t)
+    u4_t nrecs;         // TRACE_RECORDS - ring follows the header
+    u4_t widx;          // records written so far (mod 2^32) - next slot is widx % nrecs
+    sL_t now;           // ustime of the dump
+    sL_t utcOffset;     // rt_utcOffset - UTC = ustime + utcOffset
+    s4_t reason;        // signal number, 0=on request, -1=fatal error
+    u4_t pid;           // 0 if unknown
+} trace_hdr_t;
+
+extern trace_rec_t trace_ring[TRACE_RECORDS];
+extern u4_t        trace_widx;
+
+static inline void trace_rec (ustime_t t, int ev, int a, int b, u4_t c, u4_t d) {
+    trace_rec_t* r = &trace_ring[trace_widx++ & (TRACE_RECORDS-1)];
+    r->t = (u4_t)t;
+    r->ev = ev;
+    r->a = a;
+    r->b = b;
+    r->c = c;
+    r->d = d;
+}
+
+static inline u4_t trace_clamp (sL_t v) {
+    return v > 0x7FFFFFFF ? 0x7FFFFFFF : v < -0x7FFFFFFF ? (u4_t)-0x7FFFFFFF : (u4_t)v;
+}
+
+void trace_header (trace_hdr_t* h, int reason);  // async signal safe
+
+#endif // _trace_h_
@@ -30,8 +30,88 @@
 #include <stdio.h>
 #include "uj.h"
 #include "xq.h"     // %J - txjob only
+#define UJ_KWTABLES
 #include "kwcrc.h"
 
+#if !defined(CFG_no_simd) && defined(__SSE2__)
+#include <emmintrin.h>
+#define UJ_SIMD_SSE2 1
+#elif !defined(CFG_no_simd) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#define UJ_SIMD_NEON 1
+#endif
+
+
+// Find the next character inside a string which needs special treatment:
+// closing quote, escape, or a NUL (reported as malformed string).
+static char* scanStr (char* p, char* end) {
+#if defined(UJ_SIMD_SSE2)
+    const __m128i q = _mm_set1_epi8('"');
+    const __m128i b = _mm_set1_epi8('\\');
+    const __m128i z = _mm_setzero_si128();
+    for( ; p+16 <= end; p += 16 ) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v,q), _mm_cmpeq_epi8(v,b)), _mm_cmpeq_epi8(v,z));
+        int bits = _mm_movemask_epi8(m);
+        if( bits )
+            return p + __builtin_ctz(bits);
+    }
+#elif defined(UJ_SIMD_NEON)
+    const uint8x16_t q = vdupq_n_u8('"');
+    const uint8x16_t b = vdupq_n_u8('\\');
+    for( ; p+16 <= end; p += 16 ) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)p);
+        uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v,q), vceqq_u8(v,b)), vceqq_u8(v,vdupq_n_u8(0)));
+        uint64_t bits = vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if( bits )
+            return p + (__builtin_ctzll(bits) >> 2);
+    }
+#endif
+    while( p < end && *p != '"' && *p != '\\' && *p != 0 )
+        p++;
+    return p;
+}
+
+// Skip JSON white space - comments are handled by caller.
+static char* scanWsp (char* p, char* end) {
+    // Most tokens are preceded by little or no white space - only vectorize
+    // longer runs as found in indented config files.
+    for( int i=0; i<4; i++, p++ ) {
+        if( p >= end || (*p != ' ' && *p != '\n' && *p != '\t' && *p != '\r') )
+            return p;
+    }
+#if defined(UJ_SIMD_SSE2)
+    const __m128i sp = _mm_set1_epi8(' ');
+    const __m128i nl = _mm_set1_epi8('\n');
+    const __m128i ht = _mm_set1_epi8('\t');
+    const __m128i cr = _mm_set1_epi8('\r');
+    for( ; p+16 <= end; p += 16 ) {
+        __m128i v = _mm_loadu_si128((const __m128i*)p);
+        __m128i m = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v,sp), _mm_cmpeq_epi8(v,nl)),
+                                 _mm_or_si128(_mm_cmpeq_epi8(v,ht), _mm_cmpeq_epi8(v,cr)));
+        int bits = _mm_movemask_epi8(m) ^ 0xFFFF;
+        if( bits )
+            return p + __builtin_ctz(bits);
+    }
+#elif defined(UJ_SIMD_NEON)
+    const uint8x16_t sp = vdupq_n_u8(' ');
+    const uint8x16_t nl = vdupq_n_u8('\n');
+    const uint8x16_t ht = vdupq_n_u8('\t');
+    const uint8x16_t cr = vdupq_n_u8('\r');
+    for( ; p+16 <= end; p += 16 ) {
+        uint8x16_t v = vld1q_u8((const uint8_t*)p);
+        uint8x16_t m = vorrq_u8(vorrq_u8(vceqq_u8(v,sp), vceqq_u8(v,nl)),
+                                vorrq_u8(vceqq_u8(v,ht), vceqq_u8(v,cr)));
+        uint64_t bits = ~vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(m), 4)), 0);
+        if( bits )
+            return p + (__builtin_ctzll(bits) >> 2);
+    }
+#endif
+    while( p < end && (*p == ' ' || *p == '\n' || *p == '\t' || *p == '\r') )
+        p++;
+    return p;
+}
+
 
 static int nextChar (ujdec_t* dec) {
     if( dec->read_pos >= dec->json_end ) {
@@ -47,6 +127,8 @@ static void backChar (ujdec_t* dec) {
 
 static int skipWsp (ujdec_t* dec) {
     while(1) {
+        if( dec->read_pos < dec->json_end )
+            dec->read_pos = scanWsp(dec->read_pos, dec->json_end);
         int c = nextChar(dec);
         switch( c ) {
         case '\t':
@@ -93,6 +175,20 @@ static void parseString (ujdec_t* dec) {
     dec->str.beg = dec->read_pos;
     assert(dec->read_pos[-1] == '"');
     while(1) {
+        // Fast path: run of plain characters - copy and hash in bulk.
+        // CRC is not needed while skipping values.
+        char* rp = dec->read_pos;
+        char* ep = rp < dec->json_end ? scanStr(rp, dec->json_end) : rp;
+        if( ep > rp ) {
+            if( wp ) {
+                if( wp != rp )
+                    memmove(wp, rp, ep-rp);
+                for( char* cp = wp; cp < wp+(ep-rp); cp++ )
+                    crc = UJ_UPDATE_CRC(crc,*cp);
+                wp += ep-rp;
+            }
+            dec->read_pos = ep;
+        }
         int c = nextChar(dec);
         switch( c ) {
         case 0: {
@@ -548,6 +644,17 @@ ujcrc_t uj_keyword (ujdec_t* dec) {
     return dec->str.crc;
 }
 
+// Hex digit values - 0x10 marks an illegal character
+#define X16 0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10
+static const u1_t HEXVAL[256] = {
+    X16, X16, X16,
+    0,1,2,3,4,5,6,7,8,9,0x10,0x10,0x10,0x10,0x10,0x10,
+    0x10,10,11,12,13,14,15,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10, X16,
+    0x10,10,11,12,13,14,15,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10,0x10, X16,
+    X16, X16, X16, X16, X16, X16, X16, X16
+};
+#undef X16
+
 int uj_hexstr (ujdec_t* dec, u1_t* buf, int bufsiz) {
     ujtype_t t = uj_nextValue(dec);
     if( t != UJ_STRING )
@@ -559,10 +666,10 @@ int uj_hexstr (ujdec_t* dec, u1_t* buf, int bufsiz) {
     if( len/2 > bufsiz )
         uj_error(dec,"Hex string too long: %d bytes, buffer is %d", len/2, bufsiz);
     for( int i=0; i<len; i+=2 ) {
-        int b = (rt_hexDigit(s[i])<<4) | rt_hexDigit(s[i+1]);
-        if( b < 0 )
+        int hi = HEXVAL[(u1_t)s[i]], lo = HEXVAL[(u1_t)s[i+1]];
+        if( (hi|lo) & 0x10 )
             uj_error(dec,"Hex string contains illegal characters: %c%c", s[i], s[i+1]);
-        buf[i/2] = b;
+        buf[i/2] = (hi<<4) | lo;
     }
     return len/2;
 }
@@ -587,6 +694,27 @@ uL_t uj_eui (ujdec_t* dec) {
     return eui;
 }
 
+// Keyword table lookup via perfect hash - index of the keyword with this CRC or -1.
+// If s is given the name is compared as well (guards against CRC collisions).
+int uj_kwIndex (ujcrc_t crc, const char* s) {
+    int k = UJ_KWSLOT(crc, (ujcrc_t)UJ_KWDISP[UJ_KWBUCKET(crc)]);
+    if( UJ_KWCRC[k] != crc || (s && strcmp(s, UJ_KWSTR[k]) != 0) )
+        return -1;
+    return k;
+}
+
+str_t uj_kwName (int kwidx) {
+    return kwidx >= 0 && kwidx < UJ_NKW ? UJ_KWSTR[kwidx] : NULL;
+}
+
+int uj_fieldKw (ujdec_t* dec) {
+    return uj_kwIndex(dec->field.crc, dec->field.name);
+}
+
+int uj_strKw (ujdec_t* dec) {
+    return uj_kwIndex(dec->str.crc, dec->str.beg);
+}
+
 //
 //  map=0
 //  back = 0
@@ -664,6 +792,231 @@ static void addHex2 (ujbuf_t* b, int v) {
         b->buf[b->pos++] = "0123456789ABCDEF"[v&0xF];
 }
 
+#define H16(h) h"0",h"1",h"2",h"3",h"4",h"5",h"6",h"7",h"8",h"9",h"A",h"B",h"C",h"D",h"E",h"F"
+static const char HEX2[256][2] = {
+    H16("0"), H16("1"), H16("2"), H16("3"), H16("4"), H16("5"), H16("6"), H16("7"),
+    H16("8"), H16("9"), H16("A"), H16("B"), H16("C"), H16("D"), H16("E"), H16("F")
+};
+#undef H16
+
+// Same as a sequence of addHex2 but with a single space check
+static void addHexBytes (ujbuf_t* b, const u1_t* d, int len) {
+    int n = (b->bufsize - b->pos) / 2;
+    if( n > len )
+        n = len;
+    char* p = &b->buf[b->pos];
+    for( int i=0; i<n; i++, p+=2 )
+        memcpy(p, HEX2[d[i]], 2);
+    b->pos += 2*n;
+    if( n < len && b->pos < b->bufsize )
+        b->buf[b->pos++] = HEX2[d[n]][0];
+}
+
+
+// --------------------------------------------------------------------------------
+// Number formatting - same output as snprintf for the formats handled here.
+// Digits are rendered into a small stack buffer back to front and copied once.
+// --------------------------------------------------------------------------------
+
+#define D10(d) d"0",d"1",d"2",d"3",d"4",d"5",d"6",d"7",d"8",d"9"
+static const char DEC2[100][2] = {
+    D10("0"), D10("1"), D10("2"), D10("3"), D10("4"), D10("5"), D10("6"), D10("7"), D10("8"), D10("9")
+};
+#undef D10
+
+static const uL_t POW10[20] = {
+    1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL, 10000000ULL, 100000000ULL,
+    1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL, 10000000000000ULL,
+    100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL,
+    1000000000000000000ULL, 10000000000000000000ULL
+};
+
+// Decimal digits of v ending at end - returns start
+static char* fmtDec (char* end, uL_t v) {
+    while( v >= 100 ) {
+        uL_t q = v / 100;
+        end -= 2;
+        memcpy(end, DEC2[v - q*100], 2);
+        v = q;
+    }
+    if( v >= 10 ) {
+        end -= 2;
+        memcpy(end, DEC2[v], 2);
+    } else {
+        *--end = '0' + v;
+    }
+    return end;
+}
+
+// Exactly nd decimal digits of v (zero padded) ending at end
+static char* fmtDecN (char* end, uL_t v, int nd) {
+    char* p = fmtDec(end, v);
+    while( end - p < nd )
+        *--p = '0';
+    return p;
+}
+
+static void addDec (ujbuf_t* b, uL_t v, int neg) {
+    char tmp[24];
+    char* end = tmp+sizeof(tmp);
+    char* p = fmtDec(end, v);
+    if( neg )
+        *--p = '-';
+    xputs(b, p, end-p);
+}
+
+static void addInt (ujbuf_t* b, sL_t v) {
+    addDec(b, v < 0 ? -(uL_t)v : (uL_t)v, v < 0);
+}
+
+#if defined(__SIZEOF_INT128__)
+typedef unsigned __int128 u16_t;
+
+// floor(m*2^e * 10^p10) of a double's mantissa/exponent - *cmp tells how the
+// remainder compares to one half (-1,0,1). Returns 0 if out of fast path range.
+static int scaleDec (uL_t m, int e, int p10, uL_t* q, int* cmp) {
+    u16_t num = m, den = 1, qq, r2;
+    if( p10 >= 0 )
+        num *= POW10[p10];      // p10 <= 19: num < 2^117
+    else
+        den = POW10[-p10];
+    if( e >= 0 ) {
+        if( e > 10 )
+            return 0;
+        num <<= e;
+    }
+    else if( 64 - __builtin_clzll((uL_t)den) - e > 127 ) {
+        *q = 0;                 // den<<-e >= 2^127 > 2*num
+        *cmp = -1;
+        return 1;
+    }
+    else if( den == 1 ) {
+        // Power of two divisor - no division needed
+        qq = num >> -e;
+        r2 = (num - (qq << -e)) * 2;
+        den <<= -e;
+        goto done;
+    }
+    else {
+        den <<= -e;
+    }
+    qq = num / den;
+    r2 = (num - qq*den) * 2;
+  done:
+    if( (qq >> 63) != 0 )
+        return 0;
+    *q = (uL_t)qq;
+    *cmp = r2 < den ? -1 : r2 > den ? 1 : 0;
+    return 1;
+}
+
+// Split finite normal double into sign, mantissa, binary exponent
+static int splitDouble (double x, int* neg, uL_t* m, int* e) {
+    uL_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int be = (bits >> 52) & 0x7FF;
+    *neg = bits >> 63;
+    if( be == 0 || be == 0x7FF )
+        return 0;   // zero, subnormal, inf, nan
+    *m = (bits & ((1ULL<<52)-1)) | (1ULL<<52);
+    *e = be - 1075;
+    return 1;
+}
+
+// Same as snprintf "%.<prec>f" - returns 0 if not handled
+static int fmtFixed (ujbuf_t* b, double x, int prec) {
+    int neg, e, cmp;
+    uL_t m, q;
+    if( prec > 9 || !splitDouble(x, &neg, &m, &e) || !scaleDec(m, e, prec, &q, &cmp) )
+        return 0;
+    q += cmp > 0 || (cmp == 0 && (q & 1));
+    char tmp[40];
+    char* end = tmp+sizeof(tmp);
+    char* p = end;
+    if( prec > 0 ) {
+        p = fmtDecN(end, q % POW10[prec], prec);
+        *--p = '.';
+    }
+    p = fmtDec(p, q / POW10[prec]);
+    if( neg )
+        *--p = '-';
+    xputs(b, p, end-p);
+    return 1;
+}
+
+// Same as snprintf "%g" - returns 0 if not handled
+static int fmtG (ujbuf_t* b, double x) {
+    int neg, e, cmp;
+    uL_t m, q;
+    if( !splitDouble(x, &neg, &m, &e) )
+        return 0;
+    // Estimate decimal exponent from binary one - corrected below
+    int E = ((e + 52) * 1233) >> 12;
+    if( E < -5 || E > 14 )
+        return 0;
+    for( int tries=0; ; tries++ ) {
+        if( tries > 2 || !scaleDec(m, e, 5-E, &q, &cmp) )
+            return 0;
+        if( q < 100000 )
+            E -= 1;
+        else if( q >= 1000000 )
+            E += 1;
+        else
+            break;
+    }
+    q += cmp > 0 || (cmp == 0 && (q & 1));
+    if( q == 1000000 ) {
+        q = 100000;
+        E += 1;
+    }
+    char digits[6];
+    fmtDecN(digits+6, q, 6);
+    char tmp[24];
+    char* p = tmp;
+    if( neg )
+        *p++ = '-';
+    if( E < -4 || E >= 6 ) {
+        int nd = 6;
+        while( nd > 1 && digits[nd-1] == '0' ) nd--;
+        *p++ = digits[0];
+        if( nd > 1 ) {
+            *p++ = '.';
+            memcpy(p, digits+1, nd-1);
+            p += nd-1;
+        }
+        *p++ = 'e';
+        *p++ = E < 0 ? '-' : '+';
+        memcpy(p, DEC2[E < 0 ? -E : E], 2);
+        p += 2;
+    } else {
+        int nd = 6;
+        while( nd > E+1 && digits[nd-1] == '0' ) nd--;
+        if( E >= 0 ) {
+            memcpy(p, digits, E+1);
+            p += E+1;
+            if( nd > E+1 ) {
+                *p++ = '.';
+                memcpy(p, digits+E+1, nd-E-1);
+                p += nd-E-1;
+            }
+        } else {
+            *p++ = '0';
+            *p++ = '.';
+            for( int i=-1; i>E; i-- )
+                *p++ = '0';
+            memcpy(p, digits, nd);
+            p += nd;
+        }
+    }
+    xputs(b, tmp, p-tmp);
+    return 1;
+}
+#else
+static int fmtFixed (ujbuf_t* b, double x, int prec) { return 0; }
+static int fmtG (ujbuf_t* b, double x) { return 0; }
+#endif // defined(__SIZEOF_INT128__)
+
+
 // Add string - n<=0 add string until \0
 //            - n>0  at most n chars
 void xputs (ujbuf_t* b, const char* s, int n) {
@@ -764,24 +1117,24 @@ void uj_encBool(ujbuf_t* b, int val) {
 
 void uj_encInt(ujbuf_t* b, sL_t val) {
     anotherValue(b);
-    xprintf(b, "%ld", val);
+    addInt(b, val);
 }
 
 void uj_encUint(ujbuf_t* b, uL_t val) {
     anotherValue(b);
-    xprintf(b, "%lu", val);
+    addDec(b, val, 0);
 }
 
 void uj_encNum(ujbuf_t* b, double val) {
     anotherValue(b);
-    int n = snprintf(b->buf + b->pos, b->bufsize - b->pos, "%g", val);
-    b->pos += n;
+    if( !fmtG(b, val) )
+        snXp(b, "%g", val);
 }
 
 void uj_encTime(ujbuf_t* b, double val) {
     anotherValue(b);
-    int n = snprintf(b->buf + b->pos, b->bufsize - b->pos, "%.6f", val);
-    b->pos += n;
+    if( !fmtFixed(b, val, 6) )
+        snXp(b, "%.6f", val);
 }
 
 void uj_encStr (ujbuf_t* b, const char* s) {
@@ -823,8 +1176,7 @@ void uj_encHex(ujbuf_t* b, const u1_t* d, int len) {
         return;
     }
     anotherString(b);
-    for( int i=0; i<len; i++ )
-        addHex2(b, d[i]);
+    addHexBytes(b, d, len);
     addChar(b, '"');
 }
 
@@ -855,14 +1207,19 @@ void uj_encDate(ujbuf_t* b, uL_t tm) {
 }
 
 static void encEui(ujbuf_t* b, uL_t eui, int nlsb) {
+    char tmp[24];
+    char* p = tmp;
     if( nlsb == 0 || nlsb >= 8 ) { // render all bytes
-        addHex2(b,eui>>56);
+        memcpy(p, HEX2[(eui>>56) & 0xFF], 2);
+        p += 2;
         nlsb = 7;
     }
     for( int i=nlsb*8-8; i>=0; i-=8 ) {
-        addChar(b,'-');
-        addHex2(b,eui>>i);
+        *p = '-';
+        memcpy(p+1, HEX2[(eui>>i) & 0xFF], 2);
+        p += 3;
     }
+    xputs(b, tmp, p-tmp);
 }
 
 void uj_encEui(ujbuf_t* b, uL_t eui) {
@@ -871,28 +1228,50 @@ void uj_encEui(ujbuf_t* b, uL_t eui) {
     addChar(b, '"');
 }
 
+// Lower case hex of v without leading zeros
+static char* fmtHexGroup (char* p, u2_t v) {
+    int sh = v >= 0x1000 ? 12 : v >= 0x100 ? 8 : v >= 0x10 ? 4 : 0;
+    for( ; sh >= 0; sh -= 4 )
+        *p++ = "0123456789abcdef"[(v >> sh) & 0xF];
+    return p;
+}
+
 static void encId6 (ujbuf_t* b, uL_t eui) {
     u2_t g[4] = { eui>>48, eui>>32, eui>>16, eui };
+    char tmp[24];
+    char* p = tmp;
 
     if( !g[0] && !g[1] ) {
-        if( !g[2] )
-            xprintf(b, "::%x", g[3]);
-        else
-            xprintf(b, "::%x:%x", g[2], g[3]);
-        return;
-    }
-    if( !g[2] && !g[3] ) {
-        if( !g[1] )
-            xprintf(b, "%x::", g[0]);
-        else
-            xprintf(b, "%x:%x::", g[0], g[1]);
-        return;
+        *p++ = ':';
+        *p++ = ':';
+        if( g[2] ) {
+            p = fmtHexGroup(p, g[2]);
+            *p++ = ':';
+        }
+        p = fmtHexGroup(p, g[3]);
     }
-    if( !g[1] && !g[2] ) {
-        xprintf(b, "%x::%x", g[0], g[3]);
-        return;
+    else if( !g[2] && !g[3] ) {
+        p = fmtHexGroup(p, g[0]);
+        if( g[1] ) {
+            *p++ = ':';
+            p = fmtHexGroup(p, g[1]);
+        }
+        *p++ = ':';
+        *p++ = ':';
+    }
+    else if( !g[1] && !g[2] ) {
+        p = fmtHexGroup(p, g[0]);
+        *p++ = ':';
+        *p++ = ':';
+        p = fmtHexGroup(p, g[3]);
+    }
+    else {
+        for( int i=0; i<4; i++ ) {
+            if( i ) *p++ = ':';
+            p = fmtHexGroup(p, g[i]);
+        }
     }
-    xprintf(b, "%x:%x:%x:%x", g[0], g[1], g[2], g[3]);
+    xputs(b, tmp, p-tmp);
 }
 
 void uj_encId6(ujbuf_t* b, uL_t eui) {
@@ -1082,15 +1461,14 @@ static void hexData(ujbuf_t* b, const u1_t* d, int len, int leftbytes, int right
     } else {
         dbeg = dend = -1;
     }
-    for( int i=0; i<len; i++ ) {
-        if( i == dbeg ) {
-            addChar(b, '.');
-            addChar(b, '.');
-            i = dend-1;
-        } else {
-            addHex2(b, d[i]);
-        }
+    if( dbeg < 0 ) {
+        addHexBytes(b, d, len);
+        return;
     }
+    addHexBytes(b, d, dbeg);
+    addChar(b, '.');
+    addChar(b, '.');
+    addHexBytes(b, d+dend, len-dend);
 }
 
 
@@ -1198,8 +1576,23 @@ int vxprintf(ujbuf_t* b, const char* fmt, va_list args) {
             case 'g':
             case 's':
             case 'p': {
-                
-                
+                int plain = width == 0 && padding == 0 && extra == 0 && stars == 0;
+                if( plain && pi == &width && (c == 'd' || c == 'u') ) {
+                    // Most common elements - skip snprintf
+                    if( longFlag ) {
+                        uL_t v = va_arg(args, uL_t);
+                        if( c == 'd' )
+                            addInt(b, (sL_t)v);
+                        else
+                            addDec(b, v, 0);
+                    }
+                    else if( c == 'd' ) {
+                        addInt(b, va_arg(args, int));
+                    } else {
+                        addDec(b, va_arg(args, unsigned), 0);
+                    }
+                    goto doneElem;
+                }
                 char fmt2[MAX_FMT_SIZE+3];
                 memcpy(fmt2, fmt-1, fmtoff+2);
                 if( sizeof(long) == 4 && fmt2[fmtoff] == 'l' ) {
@@ -1250,7 +1643,10 @@ int vxprintf(ujbuf_t* b, const char* fmt, va_list args) {
                 }
                 case 'f':
                 case 'g': {
-                    n = snprintf(pb, bl, fmt2, va_arg(args, double));
+                    double v = va_arg(args, double);
+                    if( plain && (c == 'f' ? fmtFixed(b, v, pi == &frac ? frac : 6) : pi == &width && fmtG(b, v)) )
+                        goto doneElem;
+                    n = snprintf(pb, bl, fmt2, v);
                     break;
                 }
                 }
@@ -112,6 +112,13 @@ int       uj_indexedField (ujdec_t*, str_t prefix);  // common case in radio con
 sL_t      uj_intRange     (ujdec_t*, sL_t minval, sL_t maxval);  // convenience - check value range
 sL_t      uj_intRangeOr   (ujdec_t*, sL_t minval, sL_t maxval, sL_t orval);  // convenience - check value range
 
+// Dense keyword indices K_xxx (see kwcrc.h) - minimal perfect hash over keyword CRCs.
+// If a name is given it is verified against the keyword string.
+int       uj_kwIndex (ujcrc_t crc, const char* name);   // -1 if not a keyword
+str_t     uj_kwName  (int kwidx);
+int       uj_fieldKw (ujdec_t*);   // K_xxx of current field or -1
+int       uj_strKw   (ujdec_t*);   // K_xxx of last parsed string or -1
+
 
 void uj_mergeStr(ujbuf_t* buf);
 void uj_encOpen (ujbuf_t* buf, char brace);
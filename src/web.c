@@ -26,17 +26,29 @@
  * ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
  */
 
+#if defined(CFG_linux)
+#include <sys/stat.h>
+#include <unistd.h>
+#endif // defined(CFG_linux)
 #include "s2conf.h"
 #include "web.h"
 #include "sys.h"
 #include "uj.h"
 #include "kwcrc.h"
+#include "metrics.h"
 
 static web_t* WEB;
 
 static const web_handler_t HANDLERS[];     // fwdecl
 extern const web_handler_t SYS_HANDLERS[];
 
+// Static file found by web_route
+typedef struct webfile {
+    int  fd;         // plain OS file to sendfile or -1 (content in route buffer)
+    u4_t size;
+    char etag[32];   // quoted entity tag or empty
+} webfile_t;
+
 static void web_done (web_t* web, s1_t wstate) {
     // web->wstate = wstate;
     // http_free(&web->hd);
@@ -57,7 +69,13 @@ web_t* web_ini () {
         LOG(MOD_WEB|ERROR, "Not enough space to initialize WEB.");
         return NULL;
     }
-    httpd_ini(&web->hd, CUPS_BUFSZ); //XX define WEB_BUFSZ
+    for( int i=0; i<WEB_MAX_CONNS; i++ ) {
+        httpd_t* hd = &web->hd[i];
+        httpd_ini(hd, WEB_BUFSZ);
+        hd->c.opctx = web;
+        if( i > 0 )
+            httpd_addConn(&web->hd[0], hd);
+    }
     rt_iniTimer(&web->timeout, web_timeout);
     web->wstate = WEB_INI;
     return web;
@@ -66,14 +84,19 @@ web_t* web_ini () {
 void web_free (web_t* web) {
     if( web == NULL )
         return;
-    httpd_stop(&web->hd);
-    httpd_free(&web->hd);
+    httpd_stop(&web->hd[0]);
+    for( int i=0; i<WEB_MAX_CONNS; i++ )
+        httpd_free(&web->hd[i]);
     rt_clrTimer(&web->timeout);
     web->wstate = WEB_ERR_CLOSED;
     rt_free(web);
 }
 
-static int web_route(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* buf) {
+static int isGzip (const u1_t* p, int n) {
+    return n >= 4 && (rt_rlsbf4(p) & 0x00ffffff) == 0x088b1f;
+}
+
+static int web_route(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* buf, webfile_t* wf) {
     char* path = pstate->path;
     LOG(MOD_WEB|VERBOSE, "Requested Path: %s (crc=0x%08x) [%s]",
         path, pstate->pathcrc, pstate->meth);
@@ -82,12 +105,25 @@ static int web_route(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* buf) {
         path = "index.html";
         pstate->contentType = "text/html";
     }
+#if defined(CFG_linux)
+    struct stat st;
+    if( (wf->fd = sys_webFileFd(path, &st)) >= 0 ) {
+        u1_t magic[4];
+        wf->size = st.st_size;
+        snprintf(wf->etag, sizeof(wf->etag), "\"%lx-%x\"", (long)st.st_mtime, wf->size);
+        if( isGzip(magic, pread(wf->fd, magic, sizeof(magic), 0)) )
+            pstate->contentEnc = "gzip";
+        return 200;
+    }
+#endif // defined(CFG_linux)
     *buf = sys_webFile(path);
 
     if ( buf->buf != NULL) {
-        if( buf->pos >= 4 && (rt_rlsbf4((u1_t*)buf->buf) & 0x00ffffff) == 0x088b1f ) {
+        if( isGzip((u1_t*)buf->buf, buf->pos) ) {
             pstate->contentEnc = "gzip";
         }
+        wf->size = buf->pos;
+        snprintf(wf->etag, sizeof(wf->etag), "\"%08x\"", rt_crc32(0, buf->buf, buf->pos));
         return 200;
     }
 
@@ -103,9 +139,27 @@ static int web_route(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* buf) {
     return 404;
 }
 
+// Does If-None-Match list the entity tag of what we would send?
+static int web_notModified (dbuf_t* hdr, str_t etag) {
+    if( etag[0] == 0 )
+        return 0;
+    char* p = http_findHeader(hdr->buf, "if-none-match");
+    if( p == NULL )
+        return 0;
+    int n = strlen(etag);
+    for( ; *p && *p != '\r'; p++ ) {
+        if( *p == '*' || strncmp(p, etag, n) == 0 )
+            return 1;
+    }
+    return 0;
+}
+
+static void web_status (dbuf_t* b, str_t status, str_t body) {
+    xprintf(b, "HTTP/1.1 %s\r\nContent-Length: %d\r\n\r\n%s", status, (int)strlen(body), body);
+}
+
 static void web_onev (conn_t* _conn, int ev) {
-    web_t* web = conn2web(_conn);
-    httpd_t* hd = &web->hd;
+    httpd_t* hd = conn2httpd(_conn);
     LOG(MOD_WEB|XDEBUG, "Web Event: %d", ev);
     switch(ev) {
     
@@ -117,56 +171,80 @@ static void web_onev (conn_t* _conn, int ev) {
         
         httpd_pstate_t pstate;
         int r = 500;
-        // Note: writing to respbuf overwrites hdr!
+        // Request and response live in separate buffers
         dbuf_t respbuf = httpd_getRespbuf(hd);
         dbuf_t fbuf = {0};
+        webfile_t wf = { .fd = -1 };
+        int sent = 0;
         if( !httpd_parseReqLine(&pstate, &hdr) ) {
             LOG(MOD_WEB|ERROR, "Failed to parse request header");
             r = 400;
         } else {
-            r = web_route(&pstate, hd, &fbuf);
+            r = web_route(&pstate, hd, &fbuf, &wf);
         }
         char* path = rt_strdup(pstate.path);
+        if( r == 200 && web_notModified(&hdr, wf.etag) ) {
+            LOG(MOD_WEB|VERBOSE, "Not modified: %s", path);
+            xprintf(&respbuf, "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nContent-Length: 0\r\n\r\n", wf.etag);
+            r = 304;
+        }
         switch(r) {
-        case 200:
+        case 200: {
+            u4_t clen = wf.fd >= 0 ? wf.size : fbuf.pos;
             xprintf(&respbuf,
                     "HTTP/1.1 200 OK\r\n"
                     "Content-Type: %s\r\n"
                     "Content-Encoding: %s\r\n"
-                    "\r\n", pstate.contentType, (pstate.contentEnc && pstate.contentEnc[0] != 0) ? pstate.contentEnc : "identity" );
+                    "Content-Length: %u\r\n", pstate.contentType, (pstate.contentEnc && pstate.contentEnc[0] != 0) ? pstate.contentEnc : "identity", clen);
+            if( wf.etag[0] )
+                xprintf(&respbuf, "ETag: %s\r\nCache-Control: no-cache\r\n", wf.etag);
+            xprintf(&respbuf, "\r\n");
+#if defined(CFG_linux)
+            if( wf.fd >= 0 ) {
+                LOG(MOD_WEB|VERBOSE, "Sending file: %s (%u bytes)", path, wf.size);
+                httpd_sendFile(hd, &respbuf, wf.fd, wf.size);
+                wf.fd = -1;
+                sent = 1;
+                break;
+            }
+#endif // defined(CFG_linux)
             if( respbuf.bufsize - respbuf.pos < fbuf.pos ) {
                 LOG(MOD_WEB|ERROR, "Too big: %s (size=%d, bufsize=%d)", path, fbuf.pos, respbuf.bufsize - respbuf.pos);
                 respbuf.pos = 0;
-                xprintf(&respbuf,
-                        "HTTP/1.1 507 Insufficient Storage\r\n\r\n"
-                        "Resource too big!\r\n");
+                web_status(&respbuf, "507 Insufficient Storage", "Resource too big!\r\n");
             } else {
                 LOG(MOD_WEB|VERBOSE, "Sending response: %s (%d bytes)", path, fbuf.pos);
                 memcpy(respbuf.buf + respbuf.pos, fbuf.buf, fbuf.pos);
                 respbuf.pos += fbuf.pos;
             }
-            rt_free((void*)fbuf.buf);
+            break;
+        }
+        case 304:
             break;
         case 400:
-            xprintf(&respbuf, "HTTP/1.1 400 Bad Request\r\n\r\n");
+            web_status(&respbuf, "400 Bad Request", "");
             break;
         case 401:
-            xprintf(&respbuf, "HTTP/1.1 401 Unauthorized\r\n\r\n");
+            web_status(&respbuf, "401 Unauthorized", "");
             break;
         case 404:
-            xprintf(&respbuf,
-                        "HTTP/1.1 404 Not Found\r\n\r\n"
-                        "Resource not found!\r\n");
+            web_status(&respbuf, "404 Not Found", "Resource not found!\r\n");
             break;
         case 405:
-            xprintf(&respbuf, "HTTP/1.1 405 Method Not Allowed\r\n\r\n");
+            web_status(&respbuf, "405 Method Not Allowed", "");
             break;
         case 500:
-            xprintf(&respbuf, "HTTP/1.1 500 Internal Server Error\r\n\r\n");
+            web_status(&respbuf, "500 Internal Server Error", "");
             break;
         }
+#if defined(CFG_linux)
+        if( wf.fd >= 0 )
+            close(wf.fd);
+#endif // defined(CFG_linux)
+        rt_free((void*)fbuf.buf);
         free(path);
-        httpd_response(hd, &respbuf);
+        if( !sent )
+            httpd_response(hd, &respbuf);
         break;
     }
     case HTTPDEV_DEAD: {
@@ -176,7 +254,7 @@ static void web_onev (conn_t* _conn, int ev) {
     }
     case HTTPDEV_CLOSED: {
         LOG(MOD_WEB|DEBUG, "Web client closed");
-        web->hd.c.evcb = (evcb_t)web_onev; // http_close sets ecvb to default nil-cb
+        hd->c.evcb = (evcb_t)web_onev; // http_close sets ecvb to default nil-cb
         break;
     }
     default: {
@@ -192,14 +270,15 @@ static void web_start (web_t* web) {
     char port[10];
     snprintf(port, sizeof(port), "%d", sys_webPort);
 
-    if( !httpd_listen(&web->hd, port) ) {
+    if( !httpd_listen(&web->hd[0], port) ) {
         LOG(MOD_WEB|ERROR, "Web listen failed on port %d", sys_webPort);
         goto errexit;
     }
     // rt_setTimerCb(&web->timeout, rt_micros_ahead(WEB_CONN_TIMEOUT), web_timeout);
-    web->hd.c.evcb = (evcb_t)web_onev;
+    for( int i=0; i<WEB_MAX_CONNS; i++ )
+        web->hd[i].c.evcb = (evcb_t)web_onev;
 
-    LOG(MOD_WEB|INFO, "Web server listening on port %d (fd=%d)...", sys_webPort, web->hd.listen.netctx.fd);
+    LOG(MOD_WEB|INFO, "Web server listening on port %d (fd=%d, %d connections)...", sys_webPort, web->hd[0].listen.netctx.fd, WEB_MAX_CONNS);
     return;
 
  errexit:
@@ -248,8 +327,24 @@ int handle_version(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* b) {
     return 200;
 }
 
+// Prometheus scrape target
+int handle_metrics(httpd_pstate_t* pstate, httpd_t* hd, dbuf_t* b) {
+    if ( pstate->method != HTTP_GET )
+        return 405; // Method not allowed
+
+    b->buf = _rt_malloc(METRICS_PROM_SIZE,0);
+    b->bufsize = METRICS_PROM_SIZE;
+    if( !metrics_prom(b) ) {
+        LOG(MOD_WEB|ERROR, "Metrics exceed buffer space: %d", b->bufsize);
+        return 500;
+    }
+    pstate->contentType = "text/plain; version=0.0.4";
+    return 200;
+}
+
 static const web_handler_t HANDLERS[] = {
     { J_api,     handle_api     },
     { J_version, handle_version },
+    { J_metrics, handle_metrics },
     { 0,         NULL           },
 };
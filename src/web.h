@@ -44,8 +44,10 @@ enum {
 };
 
 
+enum { WEB_MAX_CONNS = 4 };  // concurrent client connections
+
 typedef struct web {
-    httpd_t   hd;          // HTTPD connection state
+    httpd_t   hd[WEB_MAX_CONNS];  // HTTPD connection state - hd[0] also listens
     tmr_t     timeout;
     s1_t      wstate;      // state of web
 } web_t;
@@ -61,8 +63,12 @@ extern web_handler_t AUTH_HANDLERS[];
 void web_authini();
 
 dbuf_t sys_webFile (str_t filename);
+#if defined(CFG_linux)
+struct stat;
+int    sys_webFileFd (str_t filename, struct stat* st);  // plain OS file for sendfile or -1
+#endif // defined(CFG_linux)
 
 #define timeout2web(p) memberof(web_t, p, timeout)
-#define conn2web(p)    memberof(web_t, p, hd.c)
+#define conn2web(p)    ((web_t*)(p)->opctx)
 
 #endif // _web_h_
@@ -60,20 +60,35 @@ enum {
     WSEV_BINARYRCVD,
     WSEV_TEXTRCVD,
     WSEV_CONNECTED,
+    WSEV_SENDHIGH,     // queued send data crossed high watermark (3/4 of wbufmax)
+    WSEV_SENDLOW,      // queued send data drained below low watermark (1/4 of wbufmax)
 };
 
 
 void   ws_shutdown   (ws_t*);                   // immediately close (=> ws_connect)
 void   ws_close      (ws_t*, int reason);       // initialte close protocol => WSEV_CLOSED
 dbuf_t ws_getRecvbuf (ws_t*);
-dbuf_t ws_getSendbuf (ws_t*, int minsize);
+dbuf_t ws_getSendbuf (ws_t*, int minsize);       // WSCLASS_UPLINK
+dbuf_t ws_getSendbufClass (ws_t*, int minsize, int wsclass);
 void   ws_sendData   (ws_t*, dbuf_t* b, int binaryData); // send b obtained from get_sendbuf + b.pos indicates size
 void   ws_sendText   (ws_t*, dbuf_t* b);
 void   ws_sendBinary (ws_t*, dbuf_t* b);
 void   ws_ini        (ws_t*, int rbufsize, int wbufsize);
+void   ws_setBufmax  (ws_t*, int rbufmax, int wbufmax); // let buffers grow on demand (call after ws_ini)
+void   ws_setWriterThread (ws_t*, int on);      // TLS/socket writes on a separate thread (Linux, call after ws_ini)
+void   ws_setDeflate (ws_t*, int bits);         // offer permessage-deflate with 2^bits windows (CFG_wsdeflate, 0=off)
+u4_t   ws_sendQueued (ws_t*);                   // bytes in send buffer not yet handed to socket
 void   ws_free       (ws_t*);                   // free all resources (=> ws_ini)
 int    ws_connect    (ws_t*, char* host, char* port, char* uripath);
 
 int    ws_getRtt     (ws_t*, u2_t* q_80_90_95); // round trip quantiles 80/90/95% in millis
 
+#if defined(CFG_wsdeflate) && defined(CFG_selftests)
+// permessage-deflate codec - exported for selftest_ws.c
+int    wsz_accept    (ws_t*);                   // parse Sec-WebSocket-Extensions response in rbuf
+int    wsz_deflate   (ws_t*, u1_t* data, int* pn);
+int    wsz_inflate   (ws_t*, u1_t* data, int n);
+void   wsz_free      (ws_t*);
+#endif // defined(CFG_wsdeflate) && defined(CFG_selftests)
+
 #endif // _ws_h_
@@ -36,20 +36,47 @@
 // --------------------------------------------------------------------------------
 //
 // TX jobs are not strictly FIFO and may trade places arbitrarily.
-// Txjobs are managed in single linked lists. One for free jobs and one for each
-// TX unit. Txjobs optionally have txdata attached. If a txjob is freed an
-// associated txdata section is removed and txdata is compacted immediately.
-// The remainder of txdata is always the available free data space.
+// Free txjobs are managed in a single linked list, queued txjobs of a TX unit
+// in a txord_t (see below). Txjobs optionally have txdata attached.
+// The sizes of the job and data pools are set when the txq is created.
+//
+// Txdata is a slab allocator: the data pool is split into slabs of TXSLAB_SIZE
+// and each slab in use is carved into blocks of one size class (32..256 bytes).
+// Freed blocks go back to the free list of their class and are reused as is.
+// Slabs whose blocks are all free are handed to other classes only if a class
+// runs out of blocks - there is no compaction and txjob offsets never change.
 //
 
 
-void txq_ini (txq_t* txq) {
+void txq_ini (txq_t* txq, rt_arena_t* arena, int njobs, int datasize) {
     memset(txq, 0, sizeof(*txq));
-    for( txidx_t i=0; i<MAX_TXJOBS; i++ ) {
+    txq->arena  = arena;
+    njobs = max(1, min(njobs, MAX_TXJOBS_LIMIT));
+    txq->njobs  = njobs;
+    txq->nslabs = max(1, min((datasize + TXSLAB_SIZE-1) / TXSLAB_SIZE, 0xFFFF));
+    txq->txjobs    = rt_arenaMallocN(arena, txjob_t, njobs);
+    txq->txdata    = rt_arenaMallocN(arena, u1_t, txq->nslabs * TXSLAB_SIZE);
+    txq->slabClass = rt_arenaMallocN(arena, u1_t, txq->nslabs);
+    txq->slabUsed  = rt_arenaMallocN(arena, u2_t, txq->nslabs);
+    memset(txq->slabClass, TXSLAB_NIL, txq->nslabs);
+    for( int c=0; c<TXBLK_CLASSES; c++ )
+        txq->freeBlks[c] = TXOFF_NIL;
+    txq->resvClass = TXSLAB_NIL;
+    txq->resvBlk = TXOFF_NIL;
+    for( int i=0; i<njobs; i++ ) {
         txq->txjobs[i].next = i+1;
         txq->txjobs[i].off = TXOFF_NIL;
     }
-    txq->txjobs[MAX_TXJOBS-1].next = TXIDX_END;
+    txq->txjobs[njobs-1].next = TXIDX_END;
+}
+
+
+void txq_free (txq_t* txq) {
+    rt_arenaRelease(txq->arena, txq->txjobs);
+    rt_arenaRelease(txq->arena, txq->txdata);
+    rt_arenaRelease(txq->arena, txq->slabClass);
+    rt_arenaRelease(txq->arena, txq->slabUsed);
+    memset(txq, 0, sizeof(*txq));
 }
 
 
@@ -110,6 +137,19 @@ void txq_freeJob (txq_t* txq, txjob_t* j) {
 
 // Caller starts filling data but can walk away without having
 // to free anything. Data is preserver only if commitJob() is called later.
+#define blkSize(c)   (TXBLK_MIN << (c))
+#define blkLink(off) (*(txoff_t*)&txq->txdata[off])
+
+// Put back a block reserved but never committed
+static void releaseBlk (txq_t* txq) {
+    if( txq->resvClass == TXSLAB_NIL )
+        return;
+    blkLink(txq->resvBlk) = txq->freeBlks[txq->resvClass];
+    txq->freeBlks[txq->resvClass] = txq->resvBlk;
+    txq->resvClass = TXSLAB_NIL;
+    txq->resvBlk = TXOFF_NIL;
+}
+
 txjob_t* txq_reserveJob (txq_t* txq) {
     txidx_t idx = txq->freeJobs;
     assert(idx != TXIDX_NIL);
@@ -126,52 +166,203 @@ txjob_t* txq_reserveJob (txq_t* txq) {
     memset(j, 0, sizeof(*j));
     j->off = TXOFF_NIL;
     j->next = idx;
+    releaseBlk(txq);
     return j;
 }
 
+// Split an unused slab into blocks of class c
+static int carveSlab (txq_t* txq, int c) {
+    for( int s=0; s<txq->nslabs; s++ ) {
+        if( txq->slabClass[s] != TXSLAB_NIL )
+            continue;
+        txq->slabClass[s] = c;
+        txq->slabUsed[s] = 0;
+        for( int b=TXSLAB_SIZE-blkSize(c); b >= 0; b -= blkSize(c) ) {
+            txoff_t off = s*TXSLAB_SIZE + b;
+            blkLink(off) = txq->freeBlks[c];
+            txq->freeBlks[c] = off;
+        }
+        return 1;
+    }
+    return 0;
+}
+
+// Take back slabs without any used blocks - returns number of slabs reclaimed
+static int reclaimSlabs (txq_t* txq) {
+    int n = 0;
+    for( int s=0; s<txq->nslabs; s++ ) {
+        if( txq->slabClass[s] != TXSLAB_NIL && txq->slabUsed[s] == 0 ) {
+            txq->slabClass[s] = TXSLAB_NIL;
+            n += 1;
+        }
+    }
+    if( n == 0 )
+        return 0;
+    // Unlink blocks of reclaimed slabs from free lists
+    for( int c=0; c<TXBLK_CLASSES; c++ ) {
+        txoff_t* pblk = &txq->freeBlks[c];
+        while( *pblk != TXOFF_NIL ) {
+            if( txq->slabClass[*pblk / TXSLAB_SIZE] == TXSLAB_NIL )
+                *pblk = blkLink(*pblk);
+            else
+                pblk = &blkLink(*pblk);
+        }
+    }
+    return n;
+}
+
 
 u1_t* txq_reserveData (txq_t* txq, txoff_t maxlen) {
-    if( maxlen > MAX_TXDATA - txq->txdataInUse )
-        return NULL;  // no enough data space
-    return &txq->txdata[txq->txdataInUse];
+    int c = 0;
+    while( blkSize(c) < maxlen ) {
+        if( ++c >= TXBLK_CLASSES )
+            return NULL;  // larger than any frame
+    }
+    releaseBlk(txq);
+    if( txq->freeBlks[c] == TXOFF_NIL && !carveSlab(txq, c) ) {
+        if( !reclaimSlabs(txq) || !carveSlab(txq, c) )
+            return NULL;  // no enough data space
+    }
+    // Unlink block right away - caller overwrites the free list link with data
+    txoff_t off = txq->freeBlks[c];
+    txq->freeBlks[c] = blkLink(off);
+    txq->resvClass = c;
+    txq->resvBlk = off;
+    return &txq->txdata[off];
 }
 
 
 void txq_commitJob (txq_t* txq, txjob_t*j) {
     assert(j == &txq->txjobs[txq->freeJobs]);
-    assert(j->len <= MAX_TXDATA - txq->txdataInUse);
     assert(j->off == TXOFF_NIL);
     // Unqueue free head
     txq->freeJobs = j->next;
     j->next = TXIDX_NIL;
-    j->off = txq->txdataInUse;
-    txq->txdataInUse += j->len;
+    int c = txq->resvClass;
+    if( c == TXSLAB_NIL )
+        return;   // job has no data
+    assert(j->len <= blkSize(c));
+    txoff_t off = txq->resvBlk;
+    txq->slabUsed[off / TXSLAB_SIZE] += 1;
+    txq->txdataInUse += blkSize(c);
+    txq->resvClass = TXSLAB_NIL;
+    txq->resvBlk = TXOFF_NIL;
+    j->off = off;
 }
 
 
 
 
 void txq_freeData (txq_t* txq, txjob_t* j) {
-    
-    // If job had data compactify and fix offset of jobs in any tx queues
-    txoff_t freeOff = j->off;
-    if( freeOff == TXOFF_NIL )
+    txoff_t off = j->off;
+    if( off == TXOFF_NIL )
         return;
-    u1_t freeLen = j->len;
-    for( txidx_t idx=0; idx<MAX_TXJOBS; idx++ ) {
-        txjob_t* fixjob = &txq->txjobs[idx];
-        if( fixjob->off != TXOFF_NIL && fixjob->off >= freeOff )
-            fixjob->off -= freeLen;
-    }
-    txoff_t freeEnd = freeOff + freeLen;
-    if( freeEnd < txq->txdataInUse )
-        memcpy(&txq->txdata[freeOff], &txq->txdata[freeEnd], txq->txdataInUse - freeEnd);
-    txq->txdataInUse -= freeLen;
+    int s = off / TXSLAB_SIZE;
+    int c = txq->slabClass[s];
+    assert(c != TXSLAB_NIL && txq->slabUsed[s] > 0);
+    blkLink(off) = txq->freeBlks[c];
+    txq->freeBlks[c] = off;
+    txq->slabUsed[s] -= 1;
+    txq->txdataInUse -= blkSize(c);
     j->off = TXOFF_NIL;
     j->len = 0;
 }
 
 
+// --------------------------------------------------------------------------------
+//
+// TXORD - per TX unit queue of txjobs ordered by txtime
+//
+// --------------------------------------------------------------------------------
+//
+// A sorted array of txjob indices. Lookups are binary searches, inserts/removals
+// move at most one index per queued job. Queued jobs are not linked via txjob.next.
+//
+
+void txord_ini (txord_t* q, rt_arena_t* arena, int cap) {
+    q->n = 0;
+    q->maxair = 0;
+    q->cap = cap;
+    q->arena = arena;
+    q->idx = rt_arenaMallocN(arena, txidx_t, cap);
+}
+
+
+void txord_free (txord_t* q) {
+    rt_arenaRelease(q->arena, q->idx);
+    q->idx = NULL;
+    q->arena = NULL;
+    q->n = q->cap = 0;
+}
+
+
+txjob_t* txord_job (txq_t* txq, txord_t* q, int pos) {
+    if( pos < 0 || pos >= q->n )
+        return NULL;
+    return &txq->txjobs[q->idx[pos]];
+}
+
+
+// Position after all jobs with a txtime less or equal than the given one.
+int txord_find (txq_t* txq, txord_t* q, ustime_t txtime) {
+    int lo = 0, hi = q->n;
+    while( lo < hi ) {
+        int mid = (lo+hi)/2;
+        if( txq->txjobs[q->idx[mid]].txtime <= txtime )
+            lo = mid+1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+
+// Insert job by txtime - jobs with same txtime keep arrival order.
+// Returns position of inserted job.
+int txord_insJob (txq_t* txq, txord_t* q, txjob_t* j) {
+    assert(j->next == TXIDX_NIL && q->n < q->cap);
+    if( q->n == 0 )
+        q->maxair = 0;
+    q->maxair = max(q->maxair, j->airtime);
+    int pos = txord_find(txq, q, j->txtime);
+    memmove(&q->idx[pos+1], &q->idx[pos], (q->n - pos)*sizeof(txidx_t));
+    q->idx[pos] = j - txq->txjobs;
+    q->n += 1;
+    return pos;
+}
+
+
+txjob_t* txord_unqJob (txq_t* txq, txord_t* q, int pos) {
+    if( pos < 0 || pos >= q->n )
+        return NULL;
+    txjob_t* j = &txq->txjobs[q->idx[pos]];
+    q->n -= 1;
+    memmove(&q->idx[pos], &q->idx[pos+1], (q->n - pos)*sizeof(txidx_t));
+    return j;
+}
+
+
+// Earliest time at or after txtime where a frame with given airtime
+// does not overlap any queued job (keeping gap before and after).
+ustime_t txord_freeSlot (txq_t* txq, txord_t* q, ustime_t txtime, ustime_t airtime, ustime_t gap) {
+    int pos = txord_find(txq, q, txtime);
+    // Jobs starting earlier might still be on air
+    for( int i=pos-1; i >= 0; i-- ) {
+        txjob_t* j = &txq->txjobs[q->idx[i]];
+        txtime = max(txtime, (ustime_t)(j->txtime + j->airtime + gap));
+        if( j->txtime + q->maxair + gap < txtime )
+            break;  // no earlier job can reach txtime
+    }
+    for( ; pos < q->n; pos++ ) {
+        txjob_t* j = &txq->txjobs[q->idx[pos]];
+        if( txtime + airtime + gap <= j->txtime )
+            break;  // fits in front of j
+        txtime = max(txtime, (ustime_t)(j->txtime + j->airtime + gap));
+    }
+    return txtime;
+}
+
+
 // --------------------------------------------------------------------------------
 //
 // RXQ
@@ -183,90 +374,172 @@ void txq_freeData (txq_t* txq, txjob_t* j) {
 // to a websocket.
 // FIFO is filled by getting frames from the radio layer and filling a rxjob and
 // appending rxdata.
-// The used area in rxjobs/rxdata wanders to the back the available arrays.
-// If the rest is exhausted the used area is shifted to the beginning and indices
-// are adjusted.
+// Both rxjobs and rxdata are rings - nothing is ever moved. A frame is always
+// stored contiguously: if the space at the end of rxdata cannot hold a maximum
+// sized frame the next frame starts over at offset 0 (the area behind the
+// last frame is left unused).
+// Dropped jobs are only marked (tombstone) and their space is reclaimed
+// once they reach the head of the queue.
+// Queued jobs are indexed by a digest of their frame data so that mirror
+// frames can be found without comparing against every pending frame.
 //
-//      off     last
-//      first   next
-//       |      |                      |      |  compaction
-//  |----|xxxxxx|----|         |-------|xxxxxx|    ==>  |xxxxxx|-------|
+//      first   last                         last    first
+//       |      |                             |      |
+//  |----|xxxxxx|----|         wrapped:  |xxxx|------|xxxx|--|
 //
 //
 
+static rxidx_t rxq_succ (rxidx_t i) {
+    return i+1 >= MAX_RXJOBS ? 0 : i+1;
+}
+
+static rxidx_t* rxq_bucket (rxq_t* rxq, u4_t digest) {
+    return &rxq->hashtbl[digest & (RXQ_NHASH-1)];
+}
+
+static void rxq_digest (rxq_t* rxq, rxjob_t* p) {
+    if( (p->flags & RXJOB_DIGEST) == 0 ) {
+        p->digest = rt_crc32(0, &rxq->rxdata[p->off], p->len);
+        p->flags |= RXJOB_DIGEST;
+    }
+}
+
+static void rxq_unhash (rxq_t* rxq, rxjob_t* p) {
+    rxidx_t idx = p - rxq->rxjobs;
+    rxidx_t* pi = rxq_bucket(rxq, p->digest);
+    while( *pi != RXIDX_NIL ) {
+        if( *pi == idx ) {
+            *pi = p->hnext;
+            break;
+        }
+        pi = &rxq->rxjobs[*pi].hnext;
+    }
+    p->hnext = RXIDX_NIL;
+}
+
 void rxq_ini (rxq_t* rxq) {
-    rxq->first = rxq->next = 0;
+    rxq->first = rxq->next = rxq->njobs = 0;
+    memset(rxq->hashtbl, RXIDX_NIL, sizeof(rxq->hashtbl));
 }
 
-// Allocate next job and optionally compact if we need space.
+// Allocate next job and find space for a maximum sized frame.
 // Rxjob is only earmarked
 //  - in case of error caller never comes back
 //  - if data is filled in caller must invoke rxq_commitJob
 // Return NULL if no more space
 rxjob_t* rxq_nextJob (rxq_t* rxq) {
     rxjob_t* jobs = rxq->rxjobs;
-    rxidx_t first = rxq->first;
-    rxidx_t next = rxq->next;
-    if( first==next ) {
-        rxq->first = rxq->next = 0;
-        jobs[0].off = jobs[0].len = 0;
-        jobs[0].fts = -1;
-        return &jobs[0];
-    }
-    if( next >= MAX_RXJOBS ) {
-        // No enough jobs or buffer space - compact?
-        if( first == 0 ) {
+    rxoff_t end = 0;
+    if( rxq->njobs > 0 ) {
+        if( rxq->njobs >= MAX_RXJOBS ) {
             LOG(MOD_S2E|WARNING, "RX out of jobs");
             return NULL;
         }
-        memmove(&jobs[0], &jobs[first], sizeof(jobs[0])*(next-first));
-        rxq->next = next -= first;
-        rxq->first = first = 0;
-    }
-
-    rxjob_t* last = &jobs[next-1];
-    rxoff_t end = last->off + last->len;
- check_rxdata:
-    if( end + MAX_RXFRAME_LEN > MAX_RXDATA ) {
-        // No enough data or buffer space - compact?
-        rxoff_t off = jobs[first].off;
-        if( off == 0 ) {
+        rxoff_t head = jobs[rxq->first].off;
+        rxjob_t* last = &jobs[rxq->next == 0 ? MAX_RXJOBS-1 : rxq->next-1];
+        end = last->off + last->len;
+        if( last->off >= head ) {
+            // Used data area is contiguous - append or wrap around
+            if( end + MAX_RXFRAME_LEN > MAX_RXDATA ) {
+                if( head < MAX_RXFRAME_LEN ) {
+                    LOG(MOD_S2E|WARNING, "RX out of data space");
+                    return NULL;
+                }
+                end = 0;
+            }
+        }
+        else if( end + MAX_RXFRAME_LEN > head ) {
             LOG(MOD_S2E|WARNING, "RX out of data space");
             return NULL;
         }
-        memmove(&rxq->rxdata[0], &rxq->rxdata[off], end-off);
-        for( int i=first; i < next; i++ )
-            jobs[i].off -= off;
-        end -= off;
-        goto check_rxdata;
     }
-    last += 1;
-    last->off = end;
-    last->len = 0;
-    last->fts = -1;
-    return last;
+    rxjob_t* p = &jobs[rxq->next];
+    p->off = end;
+    p->len = 0;
+    p->fts = -1;
+    p->flags = 0;
+    p->hnext = RXIDX_NIL;
+    p->rxtime = rt_getTime();
+    return p;
 }
 
 void rxq_commitJob (rxq_t* rxq, rxjob_t* p) {
-    assert(p == &rxq->rxjobs[rxq->next]);
-    rxq->next += 1;
+    assert(p == &rxq->rxjobs[rxq->next] && rxq->njobs < MAX_RXJOBS);
+    rxq_digest(rxq, p);
+    rxidx_t* pi = rxq_bucket(rxq, p->digest);
+    p->hnext = *pi;
+    *pi = rxq->next;
+    rxq->next = rxq_succ(rxq->next);
+    rxq->njobs += 1;
+}
+
+// Return oldest queued job or NULL if queue is empty.
+// Reclaims dropped jobs at the head of the queue.
+rxjob_t* rxq_firstJob (rxq_t* rxq) {
+    while( rxq->njobs > 0 ) {
+        rxjob_t* p = &rxq->rxjobs[rxq->first];
+        if( (p->flags & RXJOB_DROPPED) == 0 )
+            return p;
+        rxq->first = rxq_succ(rxq->first);
+        rxq->njobs -= 1;
+    }
+    return NULL;
 }
 
-// Drop job j from list and return new pointer to last job
-// Used to delete shadow frames.
-rxjob_t* rxq_dropJob (rxq_t* rxq, rxjob_t* p) {
+// Return queued job following p or NULL if p is the last one.
+rxjob_t* rxq_succJob (rxq_t* rxq, rxjob_t* p) {
+    rxidx_t i = p - rxq->rxjobs;
+    while( (i = rxq_succ(i)) != rxq->next ) {
+        if( (rxq->rxjobs[i].flags & RXJOB_DROPPED) == 0 )
+            return &rxq->rxjobs[i];
+    }
+    return NULL;
+}
+
+// Remove oldest job from the queue and return it - NULL if queue is empty.
+// Frame data stays valid until rxq_nextJob is called again.
+rxjob_t* rxq_popJob (rxq_t* rxq) {
+    rxjob_t* p = rxq_firstJob(rxq);
+    if( p != NULL ) {
+        rxq_unhash(rxq, p);
+        rxq->first = rxq_succ(rxq->first);
+        rxq->njobs -= 1;
+        rxq_firstJob(rxq);  // reclaim dropped jobs now at the head
+    }
+    return p;
+}
+
+// Drop job p from queue - used to delete shadow frames.
+// Job is only marked, other jobs and their data do not move.
+void rxq_dropJob (rxq_t* rxq, rxjob_t* p) {
+    assert(p >= rxq->rxjobs && p < &rxq->rxjobs[MAX_RXJOBS] && rxq->njobs > 0);
+    rxq_unhash(rxq, p);
+    p->flags |= RXJOB_DROPPED;
+    rxq_firstJob(rxq);
+}
+
+// Fill level in percent - the larger of jobs and frame data in use.
+int rxq_occupancy (rxq_t* rxq) {
+    if( rxq->njobs == 0 )
+        return 0;
     rxjob_t* jobs = rxq->rxjobs;
-    u1_t* rxdata = rxq->rxdata;
-    rxjob_t* last = &jobs[--rxq->next];
-    rxoff_t poff = p->off;
-    rxoff_t pend = poff + p->len;
-    assert(p >= jobs && p < last);
-    memmove(&rxdata[poff], &rxdata[pend], last->off + last->len - pend);
-    memmove(&p[0], &p[1], sizeof(jobs[0])*(last-p+1));
-    poff = pend-poff;
-    while( p <= last ) {
-        p->off -= poff;
-        p++;
+    rxoff_t head = jobs[rxq->first].off;
+    rxjob_t* last = &jobs[rxq->next == 0 ? MAX_RXJOBS-1 : rxq->next-1];
+    int end = last->off + last->len;
+    int used = last->off >= head ? end - head : MAX_RXDATA - head + end;
+    return max(100 * rxq->njobs / MAX_RXJOBS, 100 * used / MAX_RXDATA);
+}
+
+// Find a queued job carrying the same frame as job p (not yet committed).
+// If window is not zero only jobs allocated at most window before p are considered.
+rxjob_t* rxq_findMirror (rxq_t* rxq, rxjob_t* p, ustime_t window) {
+    rxq_digest(rxq, p);
+    for( rxidx_t i = *rxq_bucket(rxq, p->digest); i != RXIDX_NIL; i = rxq->rxjobs[i].hnext ) {
+        rxjob_t* q = &rxq->rxjobs[i];
+        if( q->digest == p->digest && q->dr == p->dr && q->len == p->len &&
+            (window == 0 || p->rxtime - q->rxtime <= window) &&
+            memcmp(&rxq->rxdata[q->off], &rxq->rxdata[p->off], p->len) == 0 )
+            return q;
     }
-    return last-1;
+    return NULL;
 }
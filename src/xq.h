@@ -32,12 +32,18 @@
 #include "rt.h"
 #include "s2conf.h"
 
-typedef u2_t txoff_t;
-typedef u1_t txidx_t;
-
-enum { TXIDX_NIL = 255 };
-enum { TXIDX_END = 254 };
-enum { TXOFF_NIL = 0xFFFF };
+typedef u4_t txoff_t;
+typedef u2_t txidx_t;
+
+enum { TXIDX_NIL = 0xFFFF };
+enum { TXIDX_END = 0xFFFE };
+enum { MAX_TXJOBS_LIMIT = 0xFFF0 };
+enum { TXOFF_NIL = 0xFFFFFFFF };
+enum { TXSLAB_SIZE   = 1024,   // txdata is carved into slabs of this size
+       TXBLK_MIN     = 32,     // smallest block size - classes double up to MAX_TXFRAME_LEN
+       TXBLK_CLASSES = 4,
+       TXSLAB_NIL    = 0xFF,   // slab not assigned to a block class
+};
 
 typedef struct txjob {
     ustime_t txtime;
@@ -65,17 +71,28 @@ typedef struct txjob {
     u1_t     dnchnl2; //   -ditto- RX2
     u1_t     addcrc;   // add CRC to Lora DN frame
     u2_t     preamble; // preamble length - if zero use default
+    u2_t     pingPeriod; // class B: ping period in slots - station picks slots (0=gpstime given by LNS)
+    u2_t     pingOffset; // class B: ping offset in current beacon period
 } txjob_t;
 
 typedef struct txq {
-    txjob_t txjobs[MAX_TXJOBS];  // pool of txjobs
-    u1_t    txdata[MAX_TXDATA];  // pool for pending txdata
-    txidx_t freeJobs;            // linked list of free txjob elements
-    txoff_t txdataInUse;         // free buffer space from here to end of txdata
+    txjob_t* txjobs;             // pool of txjobs
+    u1_t*    txdata;             // pool for pending txdata - slabs of TXSLAB_SIZE
+    u1_t*    slabClass;          // block class of each slab or TXSLAB_NIL
+    u2_t*    slabUsed;           // number of blocks in use per slab
+    txidx_t  njobs;              // size of txjobs
+    u2_t     nslabs;             // number of slabs in txdata
+    txidx_t  freeJobs;           // linked list of free txjob elements
+    u1_t     resvClass;          // block class of pending txq_reserveData or TXSLAB_NIL
+    txoff_t  resvBlk;            // block handed out by txq_reserveData - unlinked from free list
+    txoff_t  freeBlks[TXBLK_CLASSES]; // free blocks per class - linked thru first bytes of block
+    u4_t     txdataInUse;        // bytes in blocks attached to txjobs
+    rt_arena_t* arena;           // pools allocated from here (NULL: heap)
 } txq_t;
 
 
-void     txq_ini      (txq_t* txq);
+void     txq_ini      (txq_t* txq, rt_arena_t* arena, int njobs, int datasize);
+void     txq_free     (txq_t* txq);
 txidx_t  txq_job2idx  (txq_t* txq, txjob_t* j);
 txjob_t* txq_idx2job  (txq_t* txq, txidx_t  i);
 txjob_t* txq_nextJob  (txq_t* txq, txjob_t* j);
@@ -88,11 +105,35 @@ txjob_t* txq_reserveJob  (txq_t* txq);
 u1_t*    txq_reserveData (txq_t* txq, txoff_t maxlen);
 void     txq_commitJob   (txq_t* txq, txjob_t*j);
 
+// Queued txjobs of one TX unit ordered by txtime.
+// Positions are found by binary search - jobs are referenced by index into txq.txjobs.
+typedef struct txord {
+    u4_t    maxair;             // longest airtime of any job queued since queue was last empty
+    txidx_t n;                  // number of queued jobs
+    txidx_t cap;                // size of idx
+    txidx_t* idx;               // ascending txtime, idx[0] is head of queue
+    rt_arena_t* arena;          // idx allocated from here (NULL: heap)
+} txord_t;
+
+void     txord_ini      (txord_t* q, rt_arena_t* arena, int cap);
+void     txord_free     (txord_t* q);
+txjob_t* txord_job      (txq_t* txq, txord_t* q, int pos);
+int      txord_find     (txq_t* txq, txord_t* q, ustime_t txtime);
+int      txord_insJob   (txq_t* txq, txord_t* q, txjob_t* j);
+txjob_t* txord_unqJob   (txq_t* txq, txord_t* q, int pos);
+ustime_t txord_freeSlot (txq_t* txq, txord_t* q, ustime_t txtime, ustime_t airtime, ustime_t gap);
+
 
 typedef u2_t rxoff_t;
 typedef u1_t rxidx_t;
 
+enum { RXIDX_NIL = 255 };
+enum { RXQ_NHASH = 64 };        // digest buckets for mirror detection (power of 2)
+enum { RXJOB_DROPPED = 0x01,    // tombstone - job was removed by rxq_dropJob
+       RXJOB_DIGEST  = 0x02 };  // digest is valid
+
 typedef struct rxjob {
+    ustime_t rxtime; // local time job was allocated
     sL_t     rctx;
     sL_t     xtime;
     s4_t     fts;
@@ -102,20 +143,30 @@ typedef struct rxjob {
     s1_t     snr;    // scaled SNR (*4)
     u1_t     dr;
     u1_t     len;    // frame end
+    u1_t     flags;  // RXJOB_*
+    rxidx_t  hnext;  // next job in same digest bucket or RXIDX_NIL
+    u4_t     digest; // CRC32 of frame data
 } rxjob_t;
 
 typedef struct rxq {
-    rxjob_t rxjobs[MAX_RXJOBS];
-    u1_t    rxdata[MAX_RXDATA];
+    rxjob_t rxjobs[MAX_RXJOBS];  // ring of jobs
+    u1_t    rxdata[MAX_RXDATA];  // ring of frame data
     rxidx_t first;   // first filled job
     rxidx_t next;    // next job to fill
+    rxidx_t njobs;   // number of queued jobs (including dropped ones)
+    rxidx_t hashtbl[RXQ_NHASH];  // digest buckets of queued jobs
 } rxq_t;
 
 
 void     rxq_ini       (rxq_t* rxq);
 rxjob_t* rxq_nextJob   (rxq_t* rxq);
 void     rxq_commitJob (rxq_t* rxq, rxjob_t* p);
-rxjob_t* rxq_dropJob   (rxq_t* rxq, rxjob_t* p);
+void     rxq_dropJob   (rxq_t* rxq, rxjob_t* p);
+rxjob_t* rxq_firstJob  (rxq_t* rxq);
+rxjob_t* rxq_succJob   (rxq_t* rxq, rxjob_t* p);
+rxjob_t* rxq_popJob    (rxq_t* rxq);
+rxjob_t* rxq_findMirror(rxq_t* rxq, rxjob_t* p, ustime_t window);
+int      rxq_occupancy (rxq_t* rxq);
 
 
 #endif // _xq_h_